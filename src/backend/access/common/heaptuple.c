@@ -1358,9 +1358,27 @@ heap_form_minimal_tuple(TupleDesc tupleDescriptor,
 						bool *isnull)
 {
 	MinimalTuple tuple;			/* return tuple */
-	Size		len,
-				data_len;
-	int			hoff;
+	Size		len;
+
+	len = heap_compute_minimal_tuple_size(tupleDescriptor, values, isnull);
+
+	tuple = (MinimalTuple) palloc(len);
+	heap_fill_minimal_tuple(tupleDescriptor, values, isnull, tuple, len);
+
+	return tuple;
+}
+
+/*
+ * heap_compute_minimal_tuple_size
+ *		compute the size of the MinimalTuple that heap_form_minimal_tuple()
+ *		would construct from the given values[] and isnull[] arrays
+ */
+Size
+heap_compute_minimal_tuple_size(TupleDesc tupleDescriptor,
+								Datum *values,
+								bool *isnull)
+{
+	Size		len;
 	bool		hasnull = false;
 	int			numberOfAttributes = tupleDescriptor->natts;
 	int			i;
@@ -1391,16 +1409,52 @@ heap_form_minimal_tuple(TupleDesc tupleDescriptor,
 	if (hasnull)
 		len += BITMAPLEN(numberOfAttributes);
 
-	hoff = len = MAXALIGN(len); /* align user data safely */
+	len = MAXALIGN(len);		/* align user data safely */
 
-	data_len = heap_compute_data_size(tupleDescriptor, values, isnull);
+	len += heap_compute_data_size(tupleDescriptor, values, isnull);
 
-	len += data_len;
+	return len;
+}
+
+/*
+ * heap_fill_minimal_tuple
+ *		construct a MinimalTuple like heap_form_minimal_tuple(), but in
+ *		caller-supplied space
+ *
+ * 'len' must be the size computed by heap_compute_minimal_tuple_size() for
+ * the same values.  This allows the caller to form the tuple directly where
+ * it's needed, rather than copying it there.
+ */
+void
+heap_fill_minimal_tuple(TupleDesc tupleDescriptor,
+						Datum *values,
+						bool *isnull,
+						MinimalTuple tuple,
+						Size len)
+{
+	int			hoff;
+	bool		hasnull = false;
+	int			numberOfAttributes = tupleDescriptor->natts;
+	int			i;
+
+	for (i = 0; i < numberOfAttributes; i++)
+	{
+		if (isnull[i])
+		{
+			hasnull = true;
+			break;
+		}
+	}
+
+	hoff = SizeofMinimalTupleHeader;
+	if (hasnull)
+		hoff += BITMAPLEN(numberOfAttributes);
+	hoff = MAXALIGN(hoff);
 
 	/*
-	 * Allocate and zero the space needed.
+	 * Zero the space, so that alignment padding is deterministic.
 	 */
-	tuple = (MinimalTuple) palloc0(len);
+	memset(tuple, 0, len);
 
 	/*
 	 * And fill in the information.
@@ -1413,11 +1467,9 @@ heap_form_minimal_tuple(TupleDesc tupleDescriptor,
 					values,
 					isnull,
 					(char *) tuple + hoff,
-					data_len,
+					len - hoff,
 					&tuple->t_infomask,
 					(hasnull ? tuple->t_bits : NULL));
-
-	return tuple;
 }
 
 /*
@@ -24,6 +24,7 @@
 #include "access/nbtree.h"
 #include "access/reloptions.h"
 #include "access/spgist_private.h"
+#include "access/zedstore_compression.h"
 #include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "commands/tablespace.h"
@@ -71,6 +72,32 @@
  * Fillfactor can be set because it applies only to subsequent changes made to
  * data blocks, as documented in hio.c
  *
+ * zedstore_compression and zedstore_compression_frames can be set at
+ * ShareUpdateExclusiveLock because they only affect how subsequently written
+ * data is compressed. The method used, and the framing, is recorded with the
+ * data.
+ *
+ * zedstore_insert_lanes can be set at ShareUpdateExclusiveLock because it
+ * only affects where subsequently inserted rows are placed in the TID space.
+ *
+ * zedstore_toast_threshold can be set at ShareUpdateExclusiveLock because it
+ * only affects whether subsequently inserted values are stored inline or
+ * out-of-line. Readers handle both.
+ *
+ * zedstore_sort_key can be set at ShareUpdateExclusiveLock because it only
+ * affects the order in which subsequently bulk-loaded rows are assigned TIDs.
+ *
+ * zedstore_cold can be set at ShareUpdateExclusiveLock because it only
+ * affects how subsequently started scans of the column, or of the whole
+ * table, use shared buffers.
+ *
+ * zedstore_bloom can be set at ShareUpdateExclusiveLock because it only
+ * affects which bloom filters the next VACUUM or ANALYZE builds.
+ *
+ * zedstore_ordered needs AccessExclusiveLock, because the planner relies on
+ * it, and the checks that keep it true are only done by inserters that see
+ * the option set. Setting it must wait for in-progress inserts.
+ *
  * n_distinct options can be set at ShareUpdateExclusiveLock because they
  * are only used during ANALYZE, which uses a ShareUpdateExclusiveLock,
  * so the ANALYZE will not be affected by in-flight changes. Changing those
@@ -113,6 +140,51 @@ static relopt_bool boolRelOpts[] =
 		},
 		true
 	},
+	{
+		{
+			"zedstore_compression_frames",
+			"Compresses new data in a zedstore column in separately decompressible frames",
+			RELOPT_KIND_ATTRIBUTE,
+			ShareUpdateExclusiveLock
+		},
+		false
+	},
+	{
+		{
+			"zedstore_cold",
+			"Reads a rarely accessed zedstore column through a small buffer ring",
+			RELOPT_KIND_ATTRIBUTE,
+			ShareUpdateExclusiveLock
+		},
+		false
+	},
+	{
+		{
+			"zedstore_cold",
+			"Reads all of a rarely accessed zedstore table through a small buffer ring",
+			RELOPT_KIND_HEAP,
+			ShareUpdateExclusiveLock
+		},
+		false
+	},
+	{
+		{
+			"zedstore_bloom",
+			"Keeps bloom filters of the zedstore column's leaf pages, for equality scans",
+			RELOPT_KIND_ATTRIBUTE,
+			ShareUpdateExclusiveLock
+		},
+		false
+	},
+	{
+		{
+			"zedstore_ordered",
+			"Declares that rows are inserted into a zedstore table in ascending order of the column",
+			RELOPT_KIND_ATTRIBUTE,
+			AccessExclusiveLock
+		},
+		false
+	},
 	{
 		{
 			"user_catalog_table",
@@ -350,6 +422,33 @@ static relopt_int intRelOpts[] =
 		},
 		-1, 0, 1024
 	},
+	{
+		{
+			"zedstore_insert_lanes",
+			"Number of disjoint TID ranges that concurrent inserters into a zedstore table are spread across.",
+			RELOPT_KIND_HEAP,
+			ShareUpdateExclusiveLock
+		},
+		0, 0, 64
+	},
+	{
+		{
+			"zedstore_toast_threshold",
+			"Size above which new values in a zedstore column are stored out-of-line",
+			RELOPT_KIND_ATTRIBUTE,
+			ShareUpdateExclusiveLock
+		},
+		-1, 128, BLCKSZ
+	},
+	{
+		{
+			"zedstore_sort_key",
+			"Position of the column in the key that zedstore sorts bulk-loaded rows by",
+			RELOPT_KIND_ATTRIBUTE,
+			ShareUpdateExclusiveLock
+		},
+		0, 0, INDEX_MAX_KEYS
+	},
 
 	/* list terminator */
 	{{NULL}}
@@ -442,6 +541,18 @@ relopt_enum_elt_def gistBufferingOptValues[] =
 	{(const char *) NULL}		/* list terminator */
 };
 
+/* values from ZSCompressionMethod */
+relopt_enum_elt_def zedstoreCompressionOptValues[] =
+{
+	{"default", ZS_COMPRESSION_DEFAULT},
+	{"none", ZS_COMPRESSION_NONE},
+	{"pglz", ZS_COMPRESSION_PGLZ},
+#ifdef USE_LZ4
+	{"lz4", ZS_COMPRESSION_LZ4},
+#endif
+	{(const char *) NULL}		/* list terminator */
+};
+
 /* values from ViewOptCheckOption */
 relopt_enum_elt_def viewCheckOptValues[] =
 {
@@ -475,6 +586,21 @@ static relopt_enum enumRelOpts[] =
 		VIEW_OPTION_CHECK_OPTION_NOT_SET,
 		gettext_noop("Valid values are \"local\" and \"cascaded\".")
 	},
+	{
+		{
+			"zedstore_compression",
+			"Compression method for new data in a zedstore column",
+			RELOPT_KIND_ATTRIBUTE,
+			ShareUpdateExclusiveLock
+		},
+		zedstoreCompressionOptValues,
+		ZS_COMPRESSION_DEFAULT,
+#ifdef USE_LZ4
+		gettext_noop("Valid values are \"default\", \"none\", \"pglz\", and \"lz4\".")
+#else
+		gettext_noop("Valid values are \"default\", \"none\", and \"pglz\".")
+#endif
+	},
 	/* list terminator */
 	{{NULL}}
 };
@@ -1524,7 +1650,11 @@ default_reloptions(Datum reloptions, bool validate, relopt_kind kind)
 		{"vacuum_index_cleanup", RELOPT_TYPE_BOOL,
 		offsetof(StdRdOptions, vacuum_index_cleanup)},
 		{"vacuum_truncate", RELOPT_TYPE_BOOL,
-		offsetof(StdRdOptions, vacuum_truncate)}
+		offsetof(StdRdOptions, vacuum_truncate)},
+		{"zedstore_insert_lanes", RELOPT_TYPE_INT,
+		offsetof(StdRdOptions, zedstore_insert_lanes)},
+		{"zedstore_cold", RELOPT_TYPE_BOOL,
+		offsetof(StdRdOptions, zedstore_cold)}
 	};
 
 	return (bytea *) build_reloptions(reloptions, validate, kind,
@@ -1672,7 +1802,14 @@ attribute_reloptions(Datum reloptions, bool validate)
 {
 	static const relopt_parse_elt tab[] = {
 		{"n_distinct", RELOPT_TYPE_REAL, offsetof(AttributeOpts, n_distinct)},
-		{"n_distinct_inherited", RELOPT_TYPE_REAL, offsetof(AttributeOpts, n_distinct_inherited)}
+		{"n_distinct_inherited", RELOPT_TYPE_REAL, offsetof(AttributeOpts, n_distinct_inherited)},
+		{"zedstore_compression", RELOPT_TYPE_ENUM, offsetof(AttributeOpts, zedstore_compression)},
+		{"zedstore_compression_frames", RELOPT_TYPE_BOOL, offsetof(AttributeOpts, zedstore_compression_frames)},
+		{"zedstore_cold", RELOPT_TYPE_BOOL, offsetof(AttributeOpts, zedstore_cold)},
+		{"zedstore_bloom", RELOPT_TYPE_BOOL, offsetof(AttributeOpts, zedstore_bloom)},
+		{"zedstore_toast_threshold", RELOPT_TYPE_INT, offsetof(AttributeOpts, zedstore_toast_threshold)},
+		{"zedstore_sort_key", RELOPT_TYPE_INT, offsetof(AttributeOpts, zedstore_sort_key)},
+		{"zedstore_ordered", RELOPT_TYPE_BOOL, offsetof(AttributeOpts, zedstore_ordered)}
 	};
 
 	return (bytea *) build_reloptions(reloptions, validate,
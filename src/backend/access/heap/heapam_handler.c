@@ -2492,6 +2492,7 @@ SampleHeapTupleVisible(TableScanDesc scan, Buffer buffer,
 static const TableAmRoutine heapam_methods = {
 	.type = T_TableAmRoutine,
 	.scans_leverage_column_projection = false,
+	.scans_support_scan_keys = false,
 
 	.slot_callbacks = heapam_slot_callbacks,
 
@@ -30,21 +30,26 @@ zedstore_desc(StringInfo buf, XLogReaderState *record)
 	{
 		wal_zedstore_undo_newpage *walrec = (wal_zedstore_undo_newpage *) rec;
 
-		appendStringInfo(buf, "first_counter " UINT64_FORMAT, walrec->first_counter);
+		appendStringInfo(buf, "first_counter " UINT64_FORMAT ", active_slot %u",
+						 walrec->first_counter, walrec->active_slot);
 	}
 	else if (info == WAL_ZEDSTORE_UNDO_DISCARD)
 	{
 		wal_zedstore_undo_discard *walrec = (wal_zedstore_undo_discard *) rec;
 
-		appendStringInfo(buf, "oldest_undorecptr " UINT64_FORMAT ", oldest_undopage %u",
+		appendStringInfo(buf, "oldest_undorecptr " UINT64_FORMAT ", oldest_undopage %u, %u pages discarded",
 						 walrec->oldest_undorecptr.counter,
-						 walrec->oldest_undopage);
+						 walrec->oldest_undopage,
+						 walrec->ndiscarded);
 	}
 	else if (info == WAL_ZEDSTORE_BTREE_NEW_ROOT)
 	{
 		wal_zedstore_btree_new_root *walrec = (wal_zedstore_btree_new_root *) rec;
 
 		appendStringInfo(buf, "attno %d", walrec->attno);
+		if (walrec->rewrite_slot != -1)
+			appendStringInfo(buf, ", rewrite slot %d, xid %u",
+							 walrec->rewrite_slot, walrec->rewrite_xid);
 	}
 	else if (info == WAL_ZEDSTORE_TIDLEAF_ADD_ITEMS)
 	{
@@ -67,6 +72,9 @@ zedstore_desc(StringInfo buf, XLogReaderState *record)
 		else
 			appendStringInfo(buf, "lower stream change");
 		appendStringInfo(buf, ", new size %d", walrec->new_attstream_size);
+		if (XLogRecGetDataLen(record) > SizeOfZSWalAttstreamChange)
+			appendStringInfo(buf, ", %d pages",
+							 (int) (XLogRecGetDataLen(record) / SizeOfZSWalAttstreamChange));
 	}
 	else if (info == WAL_ZEDSTORE_TOAST_NEWPAGE)
 	{
@@ -80,13 +88,33 @@ zedstore_desc(StringInfo buf, XLogReaderState *record)
 	{
 		wal_zedstore_fpm_delete_page *walrec = (wal_zedstore_fpm_delete_page *) rec;
 
-		appendStringInfo(buf, "nextblkno %u", walrec->next_free_blkno);
+		appendStringInfo(buf, "nextblkno %u%s", walrec->next_free_blkno,
+						 walrec->undo ? ", undo" : "");
 	}
 	else if (info == WAL_ZEDSTORE_FPM_REUSE_PAGE)
 	{
 		wal_zedstore_fpm_reuse_page *walrec = (wal_zedstore_fpm_reuse_page *) rec;
 
-		appendStringInfo(buf, "nextblkno %u", walrec->next_free_blkno);
+		appendStringInfo(buf, "nextblkno %u%s", walrec->next_free_blkno,
+						 walrec->undo ? ", undo" : "");
+	}
+	else if (info == WAL_ZEDSTORE_FPM_EXTENT)
+	{
+		wal_zedstore_fpm_extent *walrec = (wal_zedstore_fpm_extent *) rec;
+
+		appendStringInfo(buf, "slot %u, next %u, end %u",
+						 walrec->slot, walrec->next, walrec->end);
+	}
+	else if (info == WAL_ZEDSTORE_LOGICAL_CHANGE)
+	{
+		wal_zedstore_logical_change *walrec = (wal_zedstore_logical_change *) rec;
+
+		appendStringInfo(buf, "rel %u/%u/%u, %s, %u tuples%s",
+						 walrec->node.spcNode, walrec->node.dbNode, walrec->node.relNode,
+						 walrec->action == ZSLOGICAL_INSERT ? "insert" :
+						 walrec->action == ZSLOGICAL_UPDATE ? "update" : "delete",
+						 walrec->ntuples,
+						 (walrec->flags & ZSLOGICAL_HAS_OLD) ? ", old key" : "");
 	}
 }
 
@@ -130,6 +158,12 @@ zedstore_identify(uint8 info)
 		case WAL_ZEDSTORE_FPM_REUSE_PAGE:
 			id = "FPM_REUSE_PAGE";
 			break;
+		case WAL_ZEDSTORE_FPM_EXTENT:
+			id = "FPM_EXTENT";
+			break;
+		case WAL_ZEDSTORE_LOGICAL_CHANGE:
+			id = "LOGICAL_CHANGE";
+			break;
 	}
 	return id;
 }
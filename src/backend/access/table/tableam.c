@@ -22,12 +22,28 @@
 #include <math.h>
 
 #include "access/heapam.h"		/* for ss_* */
+#include "access/htup_details.h"
+#include "access/sysattr.h"
+#include "access/table.h"
 #include "access/tableam.h"
 #include "access/xact.h"
+#include "catalog/objectaddress.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
 #include "optimizer/plancat.h"
 #include "storage/bufmgr.h"
 #include "storage/shmem.h"
 #include "storage/smgr.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/regproc.h"
+#include "utils/rls.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
 
 
 /* GUC variables */
@@ -193,6 +209,40 @@ table_beginscan_parallel(Relation relation, ParallelTableScanDesc parallel_scan,
  * ----------------------------------------------------------------------------
  */
 
+/*
+ * Fetch the tuples at a sorted array of TIDs, using the AM's batch callback
+ * if it has one.
+ *
+ * Without one, we simply call index_fetch_tuple for each TID. Only the first
+ * visible version reachable from each TID is returned.
+ */
+void
+table_index_fetch_tuples(struct IndexFetchTableData *scan,
+						 ItemPointer tids, int ntids,
+						 Snapshot snapshot,
+						 TupleTableSlot **slots, bool *found)
+{
+	const TableAmRoutine *tableam = scan->rel->rd_tableam;
+
+	if (tableam->index_fetch_tuples)
+	{
+		tableam->index_fetch_tuples(scan, tids, ntids, snapshot, slots, found);
+		return;
+	}
+
+	for (int i = 0; i < ntids; i++)
+	{
+		bool		call_again = false;
+
+		Assert(i == 0 || ItemPointerCompare(&tids[i - 1], &tids[i]) <= 0);
+
+		found[i] = table_index_fetch_tuple(scan, &tids[i], snapshot, slots[i],
+										   &call_again, NULL);
+		if (!found[i])
+			ExecClearTuple(slots[i]);
+	}
+}
+
 /*
  * To perform that check simply start an index scan, create the necessary
  * slot, do the heap lookup, and shut everything down again. This could be
@@ -650,3 +700,194 @@ table_block_relation_estimate_size(Relation rel, int32 *attr_widths,
 	else
 		*allvisfrac = (double) relallvisible / curpages;
 }
+
+
+/* ----------------------------------------------------------------------------
+ * Helper for the aggregate callbacks
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Which of the TableAggKind aggregates is 'aggfnoid', applied to a value of
+ * type 'argtype'? Returns TABLE_AGG_NONE if it's none of them.
+ *
+ * We go by the aggregate's definition rather than its OID, so that min and
+ * max work for every type whose default btree opclass they follow. Only
+ * non-collatable types qualify for min and max, so that the AM doesn't need
+ * to know the collation.
+ */
+TableAggKind
+table_aggregate_kind(Oid aggfnoid, Oid argtype)
+{
+	HeapTuple	tuple;
+	Form_pg_aggregate aggform;
+	TableAggKind result = TABLE_AGG_NONE;
+
+	tuple = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggfnoid));
+	if (!HeapTupleIsValid(tuple))
+		return TABLE_AGG_NONE;
+	aggform = (Form_pg_aggregate) GETSTRUCT(tuple);
+
+	if (aggform->aggkind != AGGKIND_NORMAL)
+		 /* no ordered-set or hypothetical-set aggregates */ ;
+	else if (aggform->aggtransfn == F_INT8INC_ANY)
+		result = TABLE_AGG_COUNT;
+	else if ((aggform->aggtransfn == F_INT4_SUM && argtype == INT4OID) ||
+			 (aggform->aggtransfn == F_INT2_SUM && argtype == INT2OID))
+		result = TABLE_AGG_SUM;
+	else if (OidIsValid(aggform->aggsortop) &&
+			 !OidIsValid(aggform->aggfinalfn) &&
+			 aggform->aggtranstype == argtype &&
+			 !type_is_collatable(argtype))
+	{
+		TypeCacheEntry *typentry;
+
+		typentry = lookup_type_cache(argtype,
+									 TYPECACHE_LT_OPR | TYPECACHE_GT_OPR |
+									 TYPECACHE_CMP_PROC);
+		if (OidIsValid(typentry->cmp_proc))
+		{
+			if (aggform->aggsortop == typentry->lt_opr)
+				result = TABLE_AGG_MIN;
+			else if (aggform->aggsortop == typentry->gt_opr)
+				result = TABLE_AGG_MAX;
+		}
+	}
+
+	ReleaseSysCache(tuple);
+
+	return result;
+}
+
+
+/* ----------------------------------------------------------------------------
+ * SQL-callable functions
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * pg_table_count_rows - count the rows visible to the active snapshot, with
+ * the table AM's relation_count_rows callback.
+ *
+ * The planner substitutes a call to this for count(*) over a whole table,
+ * see preprocess_table_aggregates(). The privilege and row security checks
+ * match what "SELECT count(*) FROM rel" would do.
+ */
+Datum
+pg_table_count_rows(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	Relation	rel;
+	AclResult	aclresult;
+	uint64		count;
+
+	rel = table_open(relid, AccessShareLock);
+
+	aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+	if (aclresult != ACLCHECK_OK)
+		aclresult = pg_attribute_aclcheck_all(relid, GetUserId(), ACL_SELECT,
+											  ACLMASK_ANY);
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, get_relkind_objtype(rel->rd_rel->relkind),
+					   RelationGetRelationName(rel));
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION ||
+		!table_relation_supports_count_rows(rel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot count the rows of \"%s\" without scanning it",
+						RelationGetRelationName(rel))));
+
+	if (check_enable_rls(relid, InvalidOid, false) == RLS_ENABLED)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot count the rows of \"%s\" without scanning it",
+						RelationGetRelationName(rel)),
+				 errdetail("Row-level security is enabled for the table.")));
+
+	count = table_relation_count_rows(rel, GetActiveSnapshot());
+
+	table_close(rel, AccessShareLock);
+
+	PG_RETURN_INT64((int64) count);
+}
+
+/*
+ * pg_table_aggregate - compute an aggregate over a column with the table
+ * AM's relation_aggregate callback.
+ *
+ * The last argument is a NULL of the aggregate's result type. It's only
+ * there to let the function return that type. The planner substitutes calls
+ * to this for simple aggregates over a whole table, see
+ * preprocess_table_aggregates().
+ */
+Datum
+pg_table_aggregate(PG_FUNCTION_ARGS)
+{
+	Oid			relid;
+	AttrNumber	attnum;
+	Oid			aggfnoid;
+	Oid			argtype;
+	Oid			resulttype;
+	TableAggKind kind;
+	Relation	rel;
+	AclResult	aclresult;
+	Datum		result;
+	bool		isnull;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		PG_RETURN_NULL();
+	relid = PG_GETARG_OID(0);
+	attnum = PG_GETARG_INT16(1);
+	aggfnoid = PG_GETARG_OID(2);
+	resulttype = get_fn_expr_argtype(fcinfo->flinfo, 3);
+
+	rel = table_open(relid, AccessShareLock);
+
+	aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+	if (aclresult != ACLCHECK_OK)
+		aclresult = pg_attribute_aclcheck(relid, attnum, GetUserId(),
+										  ACL_SELECT);
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, get_relkind_objtype(rel->rd_rel->relkind),
+					   RelationGetRelationName(rel));
+
+	if (attnum > 0 && attnum <= RelationGetNumberOfAttributes(rel) &&
+		!TupleDescAttr(RelationGetDescr(rel), attnum - 1)->attisdropped)
+		argtype = TupleDescAttr(RelationGetDescr(rel), attnum - 1)->atttypid;
+	else if (attnum == SelfItemPointerAttributeNumber)
+		argtype = TIDOID;
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column %d of relation \"%s\" does not exist",
+						attnum, RelationGetRelationName(rel))));
+
+	kind = table_aggregate_kind(aggfnoid, argtype);
+	if (rel->rd_rel->relkind != RELKIND_RELATION ||
+		kind == TABLE_AGG_NONE ||
+		get_func_rettype(aggfnoid) != resulttype ||
+		!table_relation_supports_aggregate(rel, attnum, kind))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot compute aggregate %s over \"%s\" without scanning it",
+						format_procedure(aggfnoid),
+						RelationGetRelationName(rel))));
+
+	if (check_enable_rls(relid, InvalidOid, false) == RLS_ENABLED)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot compute aggregate %s over \"%s\" without scanning it",
+						format_procedure(aggfnoid),
+						RelationGetRelationName(rel)),
+				 errdetail("Row-level security is enabled for the table.")));
+
+	result = table_relation_aggregate(rel, GetActiveSnapshot(), attnum, kind,
+									  &isnull);
+
+	table_close(rel, AccessShareLock);
+
+	if (isnull)
+		PG_RETURN_NULL();
+	PG_RETURN_DATUM(result);
+}
@@ -52,6 +52,8 @@ GetTableAmRoutine(Oid amhandler)
 	Assert(routine->scan_end != NULL);
 	Assert(routine->scan_rescan != NULL);
 	Assert(routine->scan_getnextslot != NULL);
+	Assert((routine->scan_set_deferred_columns == NULL) ==
+		   (routine->scan_fetch_deferred_columns == NULL));
 
 	Assert(routine->parallelscan_estimate != NULL);
 	Assert(routine->parallelscan_initialize != NULL);
@@ -86,6 +88,11 @@ GetTableAmRoutine(Oid amhandler)
 	Assert(routine->relation_nontransactional_truncate != NULL);
 	Assert(routine->relation_copy_data != NULL);
 	Assert(routine->relation_copy_for_cluster != NULL);
+	/* optional, but all or none */
+	Assert((routine->relation_begin_column_rewrite == NULL) ==
+		   (routine->relation_column_rewrite_tuple == NULL));
+	Assert((routine->relation_begin_column_rewrite == NULL) ==
+		   (routine->relation_end_column_rewrite == NULL));
 	Assert(routine->relation_vacuum != NULL);
 	Assert(routine->scan_analyze_next_block != NULL);
 	Assert(routine->scan_analyze_next_tuple != NULL);
@@ -19,6 +19,8 @@
 #include "access/session.h"
 #include "access/xact.h"
 #include "access/xlog.h"
+#include "access/zedstore_undolog.h"
+#include "access/zedstore_undorec.h"
 #include "catalog/index.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_enum.h"
@@ -139,6 +141,9 @@ static const struct
 	},
 	{
 		"_bt_parallel_build_main", _bt_parallel_build_main
+	},
+	{
+		"zsundo_parallel_vacuum_main", zsundo_parallel_vacuum_main
 	}
 };
 
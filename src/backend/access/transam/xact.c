@@ -2110,6 +2110,8 @@ CommitTransaction(void)
 	 * actions, so we don't fail on flushing to ON COMMIT DROP tables.
 	 */
 	AtEOXact_zedstore_tuplebuffers(true);
+	AtEOXact_zedstore_freepages();
+	AtEOXact_zedstore_loadstats();
 
 	/*
 	 * Let ON COMMIT management do its thing (must happen after closing
@@ -2350,6 +2352,8 @@ PrepareTransaction(void)
 	 * actions, so we don't fail on flushing to ON COMMIT DROP tables.
 	 */
 	AtEOXact_zedstore_tuplebuffers(true);
+	AtEOXact_zedstore_freepages();
+	AtEOXact_zedstore_loadstats();
 
 	/*
 	 * Let ON COMMIT management do its thing (must happen after closing
@@ -2676,6 +2680,8 @@ AbortTransaction(void)
 	AfterTriggerEndXact(false); /* 'false' means it's abort */
 	AtAbort_Portals();
 	AtEOXact_zedstore_tuplebuffers(false);
+	AtEOXact_zedstore_freepages();
+	AtEOXact_zedstore_loadstats();
 	AtEOXact_LargeObject(false);
 	AtAbort_Notify();
 	AtEOXact_RelationMap(false, is_parallel_worker);
@@ -4985,6 +4991,8 @@ AbortSubTransaction(void)
 						   s->curTransactionOwner,
 						   s->parent->curTransactionOwner);
 		AtEOSubXact_zedstore_tuplebuffers(false);
+		AtEOXact_zedstore_freepages();
+		AtEOXact_zedstore_loadstats();
 		AtEOSubXact_LargeObject(false, s->subTransactionId,
 								s->parent->subTransactionId);
 		AtSubAbort_Notify();
@@ -618,9 +618,10 @@ XLogRecordAssemble(RmgrId rmid, uint8 info,
 			}
 
 			/*
-			 * Try to compress a block image if wal_compression is enabled
+			 * Try to compress a block image if wal_compression is enabled,
+			 * unless the caller told us it's not worth trying
 			 */
-			if (wal_compression)
+			if (wal_compression && (regbuf->flags & REGBUF_NO_COMPRESS) == 0)
 			{
 				is_compressed =
 					XLogCompressBackupBlock(page, bimg.hole_offset,
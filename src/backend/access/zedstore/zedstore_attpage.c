@@ -25,12 +25,19 @@
  */
 #include "postgres.h"
 
+#include "access/skey.h"
+#include "access/stratnum.h"
+#include "access/xloginsert.h"
 #include "access/xlogutils.h"
 #include "access/zedstore_compression.h"
 #include "access/zedstore_internal.h"
+#include "access/zedstore_stats.h"
 #include "access/zedstore_wal.h"
+#include "catalog/pg_type.h"
+#include "executor/instrument.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
+#include "utils/attoptcache.h"
 #include "utils/datum.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
@@ -47,20 +54,53 @@ typedef struct
 	zstid		hikey;
 
 	BlockNumber	nextblkno;
+
+	/* compression method to use for the new pages */
+	ZSCompressionMethod compression;
+
+	/* divide the compressed streams into frames? */
+	bool		framed;
 } zsbt_attr_repack_context;
 
 /* prototypes for local functions */
-static ZSAttStream *get_page_lowerstream(Page page);
-static ZSAttStream *get_page_upperstream(Page page);
+static bool zsbt_attr_synopsis_minmax(Form_pg_attribute attr);
+static void zsbt_attr_synopsis_init(ZSBtreePageOpaque *opaque);
+static void zsbt_attr_synopsis_add(Form_pg_attribute attr, ZSBtreePageOpaque *opaque,
+								   char *chunks, int chunkslen);
+static void zsbt_attr_check_order(Relation rel, Form_pg_attribute attr, Buffer buf,
+								  attstream_buffer *attbuf);
+static bool zsbt_attr_synopsis_match(Form_pg_attribute attr, ZSBtreePageOpaque *opaque,
+									 ScanKey key);
+static Buffer zsbt_attr_lock_root(Relation rel, AttrNumber attno, int mode);
+static void zsbt_attr_set_summary(Relation rel, Buffer buf, uint16 flags,
+								  int64 minval, int64 maxval, uint32 nleaves);
+static void zsbt_attr_summary_add(Relation rel, AttrNumber attno, bool valid,
+								  int64 minval, int64 maxval);
 static void wal_log_attstream_change(Relation rel, Buffer buf, ZSAttStream *attstream, bool is_upper,
 									 uint16 begin_offset, uint16 end_offset);
+static void wal_fill_attstream_change(Page page, ZSAttStream *attstream, bool is_upper,
+									  uint16 begin_offset, uint16 end_offset,
+									  wal_zedstore_attstream_change *xlrec);
 
-static void zsbt_attr_repack_init(zsbt_attr_repack_context *cxt, AttrNumber attno, Buffer oldbuf, bool append);
+static void zsbt_attr_repack_init(zsbt_attr_repack_context *cxt, AttrNumber attno, ZSCompressionMethod compression,
+								  bool framed, Buffer oldbuf, bool append);
 static void zsbt_attr_repack_newpage(zsbt_attr_repack_context *cxt, zstid nexttid);
-static void zsbt_attr_pack_attstream(Form_pg_attribute attr, attstream_buffer *buf, Page page);
+static void zsbt_attr_pack_attstream(Relation rel, Form_pg_attribute attr,
+									 ZSCompressionMethod compression, bool framed,
+									 attstream_buffer *buf, Page page);
+static bool zsbt_attr_should_compress(Relation rel, AttrNumber attno);
+static bool zsbt_attr_is_cold(Relation rel, AttrNumber attno);
+static void zsbt_attr_compression_feedback(Relation rel, AttrNumber attno, bool paid_off);
 static void zsbt_attr_repack_writeback_pages(zsbt_attr_repack_context *cxt,
 											 Relation rel, AttrNumber attno,
 											 Buffer oldbuf);
+static void zsbt_attr_merge_underfull(Relation rel, AttrNumber attno,
+									  ZSCompressionMethod compression, bool framed,
+									  zstid key);
+static void zsbt_attr_remove_page(Relation rel, AttrNumber attno, Buffer buf);
+static void zsbt_attr_rewrite_leaf(Relation rel, AttrNumber attno,
+								   ZSCompressionMethod compression, bool framed,
+								   Buffer buf);
 
 /* ----------------------------------------------------------------
  *						 Public interface
@@ -70,7 +110,9 @@ static void zsbt_attr_repack_writeback_pages(zsbt_attr_repack_context *cxt,
 /*
  * Begin a scan of an attribute btree.
  *
- * Fills in the scan struct in *scan.
+ * Fills in the scan struct in *scan. This is cheap; the decoder and
+ * the rest of the state that's needed to actually read the tree are set up
+ * on the first fetch, by zsbt_attr_scan_init().
  */
 void
 zsbt_attr_begin_scan(Relation rel, TupleDesc tdesc, AttrNumber attno,
@@ -82,26 +124,78 @@ zsbt_attr_begin_scan(Relation rel, TupleDesc tdesc, AttrNumber attno,
 
 	scan->context = CurrentMemoryContext;
 
-	init_attstream_decoder(&scan->decoder, scan->attdesc->attbyval, scan->attdesc->attlen);
-	scan->decoder.tmpcxt = AllocSetContextCreate(scan->context,
-												"ZedstoreAMAttrScanContext",
-												ALLOCSET_DEFAULT_SIZES);
-
+	/* an empty decoder, so that zsbt_attr_fetch() calls us to fill it */
+	memset(&scan->decoder, 0, sizeof(attstream_decoder));
 	scan->decoder_last_idx = -1;
 
 	scan->active = true;
+	scan->initialized = false;
 	scan->lastbuf = InvalidBuffer;
+	scan->strategy = NULL;
+	scan->cold_strategy = NULL;
 	scan->lastoff = InvalidOffsetNumber;
+
+	scan->pages_read = 0;
+	scan->pages_hit = 0;
+	INSTR_TIME_SET_ZERO(scan->decode_time);
+
+	scan->prefetch = false;
+	scan->prefetch_trigger = InvalidZSTid;
+
+	scan->defer_detoast = false;
+
+	scan->allnull_start = InvalidZSTid;
+	scan->allnull_end = InvalidZSTid;
+}
+
+/*
+ * Set up the decoder of a scan, on the first fetch.
+ */
+static void
+zsbt_attr_scan_init(ZSAttrTreeScan *scan)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(scan->context);
+
+	init_attstream_decoder(&scan->decoder, scan->attdesc->attbyval, scan->attdesc->attlen);
+	scan->decoder.tmpcxt = AllocSetContextCreate(scan->context,
+												"ZedstoreAMAttrScanContext",
+												DECODER_TMPCXT_SIZE,
+												DECODER_TMPCXT_SIZE,
+												ALLOCSET_DEFAULT_MAXSIZE);
+
+	/*
+	 * Pages of a column marked as cold are read through a small ring of
+	 * buffers of its own, so that the occasional access to it doesn't push
+	 * the hot columns out of shared buffers.
+	 */
+	if (zsbt_attr_is_cold(scan->rel, scan->attno))
+		scan->cold_strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	scan->defer_detoast = zedstore_toast_can_defer(scan->attdesc);
+
+	MemoryContextSwitchTo(oldcontext);
+	scan->initialized = true;
 }
 
 void
 zsbt_attr_end_scan(ZSAttrTreeScan *scan)
 {
+	ZSColumnCounters counts;
+
 	if (!scan->active)
 		return;
 
+	memset(&counts, 0, sizeof(counts));
+	counts.pages_read = scan->pages_read;
+	counts.pages_hit = scan->pages_hit;
+	counts.bytes_decompressed = scan->decoder.bytes_decompressed;
+	counts.chunks_decoded = scan->decoder.chunks_decoded;
+	zs_stats_count_column(scan->rel, scan->attno, &counts);
+
 	if (scan->lastbuf != InvalidBuffer)
 		ReleaseBuffer(scan->lastbuf);
+	if (scan->cold_strategy)
+		FreeAccessStrategy(scan->cold_strategy);
 
 	scan->active = false;
 
@@ -126,34 +220,43 @@ zsbt_attr_scan_fetch_array(ZSAttrTreeScan *scan, zstid nexttid)
 	Buffer		buf;
 	Page		page;
 	ZSAttStream *stream;
+	int64		blks_read;
+	int64		blks_hit;
+	instr_time	starttime;
+	instr_time	endtime;
+	bool		found;
 
 	if (!scan->active)
 		return InvalidZSTid;
+	if (!scan->initialized)
+		zsbt_attr_scan_init(scan);
 
 	/*
 	 * If the TID we're looking for is in the current attstream, we just
-	 * need to decoder more of it.
-	 *
-	 * TODO: We could restart the decoder, if the current attstream
-	 * covers the target TID, but we already decoded past it.
+	 * need to decode more of it. The attstream was copied into the decoder,
+	 * so we don't need to revisit the page, even if we have already decoded
+	 * all of it. The data for a TID doesn't change once it has been written,
+	 * so the copy is still valid. This makes repeated fetches with nearby
+	 * TIDs cheap, as in an index scan on a correlated index.
 	 */
-	if (scan->decoder.pos < scan->decoder.chunks_len &&
+	if (scan->decoder.chunks_len > 0 &&
 		nexttid >= scan->decoder.firsttid &&
 		nexttid <= scan->decoder.lasttid)
 	{
-		if (nexttid <= scan->decoder.prevtid)
-		{
-			/*
-			 * The target TID is in this attstream, but we already scanned
-			 * past it. Restart the decoder.
-			 */
-			scan->decoder.pos = 0;
-			scan->decoder.prevtid = 0;
-		}
+		/*
+		 * Position the decoder at the chunk containing the target TID. If
+		 * we already scanned past it, as in a backward scan, this goes back
+		 * to the chunk's start without walking the stream from the
+		 * beginning.
+		 */
+		decode_attstream_seek(&scan->decoder, nexttid);
 
 		/* Advance the scan, until we have reached the target TID */
 		while (nexttid > scan->decoder.prevtid)
-			(void) decode_attstream_cont(&scan->decoder);
+		{
+			if (!decode_attstream_cont(&scan->decoder))
+				break;
+		}
 
 		if (scan->decoder.num_elements == 0 ||
 			nexttid < scan->decoder.tids[0])
@@ -168,13 +271,24 @@ zsbt_attr_scan_fetch_array(ZSAttrTreeScan *scan, zstid nexttid)
 	scan->decoder.pos = 0;
 	scan->decoder.prevtid = 0;
 
+	/* Keep the read-ahead going, for a sequential scan */
+	if (scan->prefetch && nexttid >= scan->prefetch_trigger)
+		scan->prefetch_trigger = zsbt_prefetch_leaves(scan->rel, scan->attno, nexttid);
+
 	/*
 	 * Descend the tree, tind and lock the leaf page containing 'nexttid'.
+	 * The buffer usage counters tell how many of the pages visited were
+	 * read from disk.
 	 */
+	blks_read = pgBufferUsage.shared_blks_read + pgBufferUsage.local_blks_read;
+	blks_hit = pgBufferUsage.shared_blks_hit + pgBufferUsage.local_blks_hit;
 	buf = zsbt_find_and_lock_leaf_containing_tid(scan->rel, scan->attno,
 												 scan->lastbuf, nexttid,
-												 BUFFER_LOCK_SHARE);
+												 BUFFER_LOCK_SHARE,
+												 scan->cold_strategy ? scan->cold_strategy : scan->strategy);
 	scan->lastbuf = buf;
+	scan->pages_read += pgBufferUsage.shared_blks_read + pgBufferUsage.local_blks_read - blks_read;
+	scan->pages_hit += pgBufferUsage.shared_blks_hit + pgBufferUsage.local_blks_hit - blks_hit;
 	if (!BufferIsValid(buf))
 	{
 		/*
@@ -186,11 +300,45 @@ zsbt_attr_scan_fetch_array(ZSAttrTreeScan *scan, zstid nexttid)
 	}
 	page = BufferGetPage(buf);
 
+	/*
+	 * In a sequential scan, skip over pages of a mostly-NULL column that
+	 * have no values at all, without decompressing them. The rows of the
+	 * page that aren't in it read as NULL too, unless the column has a
+	 * missing value. Other rows might be added to the page later, but a
+	 * sequential scan only fetches rows that are visible to its snapshot,
+	 * which existed already.
+	 */
+	if (scan->prefetch && !scan->attdesc->atthasmissing)
+	{
+		ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+
+		if ((opaque->zs_flags & ZSBT_ATTR_SYNOPSIS) != 0 &&
+			opaque->zs_minval > opaque->zs_maxval)
+		{
+			scan->allnull_start = opaque->zs_lokey;
+			scan->allnull_end = opaque->zs_hikey;
+			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+			return false;
+		}
+	}
+
+	INSTR_TIME_SET_CURRENT(starttime);
+
 	/* See if the upper stream covers the target tid */
 	stream = get_page_upperstream(page);
 	if (stream && nexttid <= stream->t_lasttid)
 	{
-		decode_attstream_begin(&scan->decoder, stream);
+		/*
+		 * For a random fetch from a framed stream, decompress only the frame
+		 * we need. That's cheap enough that we don't bother with the caches.
+		 * Sequential scans read each leaf only once, so keep them from
+		 * flushing the backend-local cache that repeated fetches benefit from.
+		 */
+		if (!scan->prefetch && (stream->t_flags & ATTSTREAM_FRAMED) != 0)
+			decode_attstream_begin_frame(&scan->decoder, stream, nexttid);
+		else
+			decode_attstream_begin_cached(&scan->decoder, stream, scan->rel, buf,
+										  !scan->prefetch);
 	}
 	/*
 	 * How about the lower stream? (We assume that the upper stream is < lower
@@ -217,26 +365,55 @@ zsbt_attr_scan_fetch_array(ZSAttrTreeScan *scan, zstid nexttid)
 		nexttid <= scan->decoder.lasttid)
 	{
 		/* Advance the scan, until we have reached the target TID */
+		decode_attstream_skip_to(&scan->decoder, nexttid);
 		while (nexttid > scan->decoder.prevtid)
 			(void) decode_attstream_cont(&scan->decoder);
 
-		if (scan->decoder.num_elements == 0 ||
-			nexttid < scan->decoder.tids[0])
-			return false;
-		else
-			return true;
+		found = (scan->decoder.num_elements > 0 &&
+				 nexttid >= scan->decoder.tids[0]);
 	}
 	else
-		return false;
+		found = false;
+
+	INSTR_TIME_SET_CURRENT(endtime);
+	INSTR_TIME_ACCUM_DIFF(scan->decode_time, endtime, starttime);
+
+	return found;
+}
+
+/*
+ * Remove an attribute leaf whose rows are all dead, unlinking it from the
+ * tree. If it's the only leaf, it is left in place but emptied. Unlocks and
+ * releases 'buf'.
+ */
+static void
+zsbt_attr_remove_page(Relation rel, AttrNumber attno, Buffer buf)
+{
+	zs_split_stack *stack;
+
+	stack = zsbt_unlink_page(rel, attno, buf, 0);
+	if (!stack)
+	{
+		Page		newpage = PageGetTempPageCopySpecial(BufferGetPage(buf));
+
+		zsbt_attr_synopsis_init(ZSBtreePageGetOpaque(newpage));
+		stack = zs_new_split_stack_entry(buf, newpage);
+	}
+	zs_apply_split_changes(rel, stack, NULL);
 }
 
 /*
  * Remove data for the given TIDs from the attribute tree.
+ *
+ * Pages are read using 'strategy', which may be NULL.
  */
 void
-zsbt_attr_remove(Relation rel, AttrNumber attno, IntegerSet *tids)
+zsbt_attr_remove(Relation rel, AttrNumber attno, ZSTidStore *tids,
+				 BufferAccessStrategy strategy)
 {
 	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	ZSCompressionMethod compression = zs_get_attr_compression_method(rel, attno);
+	bool		framed = zs_get_attr_compression_frames(rel, attno);
 	Buffer		buf;
 	Page		page;
 	ZSBtreePageOpaque *opaque;
@@ -255,18 +432,36 @@ zsbt_attr_remove(Relation rel, AttrNumber attno, IntegerSet *tids)
 									   ALLOCSET_DEFAULT_SIZES);
 	oldcontext = MemoryContextSwitchTo(tmpcontext);
 
-	intset_begin_iterate(tids);
-	if (!intset_iterate_next(tids, &nexttid))
+	zs_tidstore_begin_iterate(tids);
+	if (!zs_tidstore_iterate_next(tids, &nexttid))
 		nexttid = InvalidZSTid;
 
 	while (nexttid < MaxPlusOneZSTid)
 	{
 		ZSAttStream *lowerstream;
 		ZSAttStream *upperstream;
+		zstid		lokey;
 
-		buf = zsbt_descend(rel, attno, nexttid, 0, false);
+		buf = zsbt_descend_extended(rel, attno, nexttid, 0, false, strategy);
 		page = BufferGetPage(buf);
 		opaque = ZSBtreePageGetOpaque(page);
+		lokey = opaque->zs_lokey;
+
+		/*
+		 * If all the rows on the page are dead, like after deleting a range
+		 * of old rows, free the whole page without decoding it.
+		 */
+		if (zs_tidstore_covers_range(tids, lokey, opaque->zs_hikey))
+		{
+			while (nexttid < opaque->zs_hikey)
+			{
+				if (!zs_tidstore_iterate_next(tids, &nexttid))
+					nexttid = MaxPlusOneZSTid;
+			}
+			zsbt_attr_remove_page(rel, attno, buf);
+			MemoryContextReset(tmpcontext);
+			continue;
+		}
 
 		/*
 		 * We now have a page at hand, that (should) contain at least one
@@ -281,7 +476,7 @@ zsbt_attr_remove(Relation rel, AttrNumber attno, IntegerSet *tids)
 				allocated_size *= 2;
 			}
 			tids_to_remove[num_to_remove++] = nexttid;
-			if (!intset_iterate_next(tids, &nexttid))
+			if (!zs_tidstore_iterate_next(tids, &nexttid))
 				nexttid = MaxPlusOneZSTid;
 		}
 
@@ -326,21 +521,24 @@ zsbt_attr_remove(Relation rel, AttrNumber attno, IntegerSet *tids)
 			 * new data. zsbt_attr_rewrite_page() takes care of storing them on the
 			 * page, splitting the page if needed.
 			 */
-			zsbt_attr_repack_init(&cxt, attno, buf, false);
+			zsbt_attr_repack_init(&cxt, attno, compression, framed, buf, false);
 			if (newbuf->len - newbuf->cursor > 0)
 			{
 				/*
 				 * Then, store them on the page, creating new pages as needed.
 				 */
-				zsbt_attr_pack_attstream(attr, newbuf, cxt.currpage);
+				zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, newbuf, cxt.currpage);
 				while (newbuf->cursor < newbuf->len)
 				{
 					zsbt_attr_repack_newpage(&cxt, newbuf->firsttid);
-					zsbt_attr_pack_attstream(attr, newbuf, cxt.currpage);
+					zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, newbuf, cxt.currpage);
 				}
 			}
 			zsbt_attr_repack_writeback_pages(&cxt, rel, attno, buf);
 			/* zsbt_attr_rewriteback_pages() unlocked and released the buffer */
+
+			/* If the page is now mostly empty, try to merge it with its right sibling */
+			zsbt_attr_merge_underfull(rel, attno, compression, framed, lokey);
 		}
 		else
 			UnlockReleaseBuffer(buf);
@@ -356,12 +554,849 @@ zsbt_attr_remove(Relation rel, AttrNumber attno, IntegerSet *tids)
 	MemoryContextDelete(tmpcontext);
 }
 
+/*
+ * Does an attribute leaf page with the given streams need to be rewritten,
+ * to store its data with 'compression' and 'framed'?
+ */
+static bool
+zsbt_attr_page_needs_recompress(ZSAttStream *lowerstream, ZSAttStream *upperstream,
+								ZSCompressionMethod compression, bool framed)
+{
+	/* the lower stream is never compressed */
+	if (lowerstream && compression != ZS_COMPRESSION_NONE)
+		return true;
+
+	if (upperstream)
+	{
+		bool		compressed = (upperstream->t_flags & ATTSTREAM_COMPRESSED) != 0;
+
+		if (compression == ZS_COMPRESSION_NONE)
+			return compressed;
+		if (!compressed)
+			return true;
+		if (zs_resolve_compression_method(ZSAttStreamGetCompressionMethod(upperstream)) != compression)
+			return true;
+		if (((upperstream->t_flags & ATTSTREAM_FRAMED) != 0) != framed)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Decode all the data on an attribute leaf, and re-pack it, like
+ * zsbt_attr_remove() does, but without removing anything. The uncompressed
+ * and compressed data are merged, and compressed with 'compression', in
+ * frames if 'framed'. 'buf' must be exclusively locked; it is unlocked and
+ * released.
+ */
+static void
+zsbt_attr_rewrite_leaf(Relation rel, AttrNumber attno,
+					   ZSCompressionMethod compression, bool framed, Buffer buf)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	Page		page = BufferGetPage(buf);
+	ZSAttStream *lowerstream = get_page_lowerstream(page);
+	ZSAttStream *upperstream = get_page_upperstream(page);
+	attstream_buffer upperbuf;
+	attstream_buffer lowerbuf;
+	attstream_buffer *newbuf;
+	zsbt_attr_repack_context cxt;
+
+	upperbuf.len = 0;
+	upperbuf.cursor = 0;
+	lowerbuf.len = 0;
+	lowerbuf.cursor = 0;
+	if (upperstream)
+		vacuum_attstream(rel, attno, &upperbuf, upperstream, NULL, 0);
+	if (lowerstream)
+		vacuum_attstream(rel, attno, &lowerbuf, lowerstream, NULL, 0);
+
+	if (upperbuf.len - upperbuf.cursor > 0 &&
+		lowerbuf.len - lowerbuf.cursor > 0)
+	{
+		merge_attstream_buffer(attr, &upperbuf, &lowerbuf);
+		newbuf = &upperbuf;
+	}
+	else if (upperbuf.len - upperbuf.cursor > 0)
+		newbuf = &upperbuf;
+	else
+		newbuf = &lowerbuf;
+
+	zsbt_attr_repack_init(&cxt, attno, compression, framed, buf, false);
+	if (newbuf->len - newbuf->cursor > 0)
+	{
+		zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, newbuf, cxt.currpage);
+		while (newbuf->cursor < newbuf->len)
+		{
+			zsbt_attr_repack_newpage(&cxt, newbuf->firsttid);
+			zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, newbuf, cxt.currpage);
+		}
+	}
+	zsbt_attr_repack_writeback_pages(&cxt, rel, attno, buf);
+	/* zsbt_attr_repack_writeback_pages() unlocked and released the buffer */
+}
+
+/*
+ * Rewrite the leaf pages of an attribute tree whose data isn't stored the
+ * way the attribute's "zedstore_compression" and "zedstore_compression_frames"
+ * options now say, e.g. after switching an old table to a stronger method.
+ *
+ * The leaves are rewritten one at a time, holding a lock on just that page,
+ * like when VACUUM removes dead data from them, so this can run concurrently
+ * with queries and DML on the table. Returns the number of leaf pages that
+ * were rewritten.
+ *
+ * Pages whose data didn't compress are stored uncompressed, so they get
+ * rewritten again, in vain, on every call.
+ */
+BlockNumber
+zsbt_attr_recompress(Relation rel, AttrNumber attno, BufferAccessStrategy strategy)
+{
+	ZSCompressionMethod compression = zs_get_attr_compression_method(rel, attno);
+	bool		framed = zs_get_attr_compression_frames(rel, attno);
+	BlockNumber nrewritten = 0;
+	zstid		nexttid;
+	MemoryContext oldcontext;
+	MemoryContext tmpcontext;
+
+	/* Nothing to do if the attribute has no tree */
+	if (zsmeta_get_root_for_attribute(rel, attno, true) == InvalidBlockNumber)
+		return 0;
+
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "ZedstoreAMRecompressContext",
+									   ALLOCSET_DEFAULT_SIZES);
+	oldcontext = MemoryContextSwitchTo(tmpcontext);
+
+	nexttid = MinZSTid;
+	while (nexttid < MaxPlusOneZSTid)
+	{
+		Buffer		buf;
+		Page		page;
+		ZSAttStream *lowerstream;
+		ZSAttStream *upperstream;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = zsbt_descend_extended(rel, attno, nexttid, 0, false, strategy);
+		page = BufferGetPage(buf);
+		nexttid = ZSBtreePageGetOpaque(page)->zs_hikey;
+
+		lowerstream = get_page_lowerstream(page);
+		upperstream = get_page_upperstream(page);
+		if (!zsbt_attr_page_needs_recompress(lowerstream, upperstream,
+											 compression, framed))
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		zsbt_attr_rewrite_leaf(rel, attno, compression, framed, buf);
+		nrewritten++;
+		MemoryContextReset(tmpcontext);
+	}
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextDelete(tmpcontext);
+
+	return nrewritten;
+}
+
+/*
+ * Compress the uncompressed data on the attribute leaf containing 'tid', if
+ * there's at least ZSBT_TAIL_COMPRESS_MIN_SIZE bytes of it.
+ *
+ * New rows are appended to the uncompressed stream on a leaf, and when it
+ * fills the page, the inserting backend has to merge it with the compressed
+ * data and compress it all, while holding a lock on the page. VACUUM calls
+ * this for the leaves where rows are being appended, so that inserts can
+ * keep appending, and scans see compressed data sooner. Returns true if the
+ * leaf was rewritten.
+ */
+bool
+zsbt_attr_compress_tail(Relation rel, AttrNumber attno, zstid tid,
+						BufferAccessStrategy strategy)
+{
+	ZSCompressionMethod compression = zs_get_attr_compression_method(rel, attno);
+	bool		framed = zs_get_attr_compression_frames(rel, attno);
+	Buffer		buf;
+	ZSAttStream *lowerstream;
+	MemoryContext oldcontext;
+	MemoryContext tmpcontext;
+
+	if (compression == ZS_COMPRESSION_NONE)
+		return false;
+
+	buf = zsbt_descend_extended(rel, attno, tid, 0, true, strategy);
+	if (!BufferIsValid(buf))
+		return false;
+
+	lowerstream = get_page_lowerstream(BufferGetPage(buf));
+	if (lowerstream == NULL || lowerstream->t_size < ZSBT_TAIL_COMPRESS_MIN_SIZE)
+	{
+		UnlockReleaseBuffer(buf);
+		return false;
+	}
+
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "ZedstoreAMRecompressContext",
+									   ALLOCSET_DEFAULT_SIZES);
+	oldcontext = MemoryContextSwitchTo(tmpcontext);
+
+	zsbt_attr_rewrite_leaf(rel, attno, compression, framed, buf);
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextDelete(tmpcontext);
+
+	return true;
+}
+
+/*
+ * Merge the attribute leaf containing 'key' with its right sibling, if the
+ * data on both pages fits comfortably on one page.
+ *
+ * This is used during VACUUM, after removing the data of dead rows, so that
+ * the tree doesn't stay bloated with half-empty pages after mass deletions.
+ * The data from both pages is decompressed and re-packed onto a single new
+ * page. If it doesn't fit after all, the merge is abandoned.
+ */
+static void
+zsbt_attr_merge_underfull(Relation rel, AttrNumber attno,
+						  ZSCompressionMethod compression, bool framed,
+						  zstid key)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	Buffer		leftbuf;
+	Buffer		rightbuf;
+	Page		leftpage;
+	Page		rightpage;
+	Page		newpage;
+	ZSAttStream *streams[4];
+	attstream_buffer attbuf;
+	bool		have_data = false;
+	zs_split_stack *stack;
+
+	leftbuf = zsbt_descend(rel, attno, key, 0, false);
+	if (!BufferIsValid(leftbuf))
+		return;
+	rightbuf = zsbt_get_merge_sibling(rel, attno, leftbuf);
+	if (!BufferIsValid(rightbuf))
+	{
+		UnlockReleaseBuffer(leftbuf);
+		return;
+	}
+	leftpage = BufferGetPage(leftbuf);
+	rightpage = BufferGetPage(rightbuf);
+
+	/* Collect all the data from both pages into one attstream buffer */
+	streams[0] = get_page_upperstream(leftpage);
+	streams[1] = get_page_lowerstream(leftpage);
+	streams[2] = get_page_upperstream(rightpage);
+	streams[3] = get_page_lowerstream(rightpage);
+	for (int i = 0; i < lengthof(streams); i++)
+	{
+		if (streams[i] == NULL)
+			continue;
+		if (!have_data)
+		{
+			init_attstream_buffer_from_stream(&attbuf, attr->attbyval, attr->attlen,
+											  streams[i], CurrentMemoryContext);
+			have_data = true;
+		}
+		else
+			merge_attstream(attr, &attbuf, streams[i]);
+	}
+
+	/* Construct the merged page */
+	newpage = (Page) palloc(BLCKSZ);
+	PageInit(newpage, BLCKSZ, sizeof(ZSBtreePageOpaque));
+	*ZSBtreePageGetOpaque(newpage) = *ZSBtreePageGetOpaque(leftpage);
+	zsbt_attr_synopsis_init(ZSBtreePageGetOpaque(newpage));
+	if (have_data && attbuf.len - attbuf.cursor > 0)
+	{
+		zsbt_attr_pack_attstream(rel, attr, compression, framed, &attbuf, newpage);
+		if (attbuf.cursor < attbuf.len)
+		{
+			/* didn't fit on one page after all */
+			pfree(newpage);
+			UnlockReleaseBuffer(rightbuf);
+			UnlockReleaseBuffer(leftbuf);
+			return;
+		}
+	}
+
+	stack = zsbt_merge_into_left(rel, attno, leftbuf, rightbuf, newpage);
+	if (stack == NULL)
+	{
+		UnlockReleaseBuffer(rightbuf);
+		UnlockReleaseBuffer(leftbuf);
+		return;
+	}
+	zs_apply_split_changes(rel, stack, NULL);
+}
+
+/*
+ * Find the TID ranges where attribute 'attno' might satisfy all of the scan
+ * keys in 'keys' that are on that attribute, based on the synopses of the
+ * leaf pages, and their bloom filters, if the attribute has them.
+ *
+ * On return, *ranges_p points to a palloc'd array of non-overlapping ranges,
+ * in TID order, and the number of ranges is returned. Returns -1 if none of
+ * the keys can be checked against the synopses or the filters; all TIDs
+ * might match then. The number of leaf pages that were ruled out is added
+ * to *npruned_p.
+ *
+ * Only the leaf pages are read, not the data on them. The result is only
+ * accurate for data that existed when this was called, so this is only
+ * useful for MVCC scans.
+ */
+int
+zsbt_attr_prune_ranges(Relation rel, AttrNumber attno,
+					   int nkeys, ScanKey keys, ZSTidRange **ranges_p,
+					   int64 *npruned_p)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	ScanKey		usable_keys[INDEX_MAX_KEYS];
+	int			nusable = 0;
+	uint32		bloom_hashes[INDEX_MAX_KEYS];
+	int			nbloom = 0;
+	bool		minmax;
+	ZSBloomReader bloom;
+	ZSTidRange *ranges;
+	int			nranges = 0;
+	int			maxranges;
+	Buffer		buf = InvalidBuffer;
+	zstid		nexttid;
+	int64		npruned = 0;
+
+	/*
+	 * Rows that existed before the column was added have no data in the
+	 * tree, and read as the missing value, which the synopses don't cover.
+	 */
+	if (attr->attisdropped || attr->atthasmissing)
+		return -1;
+	minmax = zsbt_attr_synopsis_minmax(attr);
+
+	/*
+	 * We can only check ordinary comparisons against a constant. We assume
+	 * that the operator is from the type's default btree operator class,
+	 * i.e. that it agrees with integer comparison of the values. Equality
+	 * can also be checked against the bloom filters.
+	 */
+	for (int i = 0; i < nkeys; i++)
+	{
+		ScanKey		key = &keys[i];
+
+		if (key->sk_attno != attno)
+			continue;
+		if (nbloom < INDEX_MAX_KEYS &&
+			zsbloom_hash_key(rel, attno, key, &bloom_hashes[nbloom]))
+			nbloom++;
+		if (!minmax || nusable == INDEX_MAX_KEYS)
+			continue;
+		if (key->sk_flags & (SK_ISNULL | SK_ROW_HEADER | SK_ROW_MEMBER |
+							 SK_SEARCHARRAY | SK_SEARCHNULL | SK_SEARCHNOTNULL |
+							 SK_ORDER_BY))
+			continue;
+		if (key->sk_strategy < BTLessStrategyNumber ||
+			key->sk_strategy > BTGreaterStrategyNumber)
+			continue;
+		if (key->sk_subtype != InvalidOid && key->sk_subtype != attr->atttypid)
+			continue;
+		usable_keys[nusable++] = key;
+	}
+
+	/*
+	 * If the keys contradict the summary of the whole tree, none of the
+	 * leaves can match, and we don't need to read them. This makes a scan on
+	 * a table, or a partition, whose values are all out of range nearly free.
+	 */
+	if (nusable > 0)
+	{
+		buf = zsbt_attr_lock_root(rel, attno, BUFFER_LOCK_SHARE);
+		if (BufferIsValid(buf))
+		{
+			ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(BufferGetPage(buf));
+			bool		match = true;
+
+			if (opaque->zs_level > 0 && (opaque->zs_flags & ZSBT_ATTR_SYNOPSIS) != 0)
+			{
+				for (int i = 0; i < nusable && match; i++)
+					match = zsbt_attr_synopsis_match(attr, opaque, usable_keys[i]);
+				npruned = opaque->zs_nullcount;
+			}
+			UnlockReleaseBuffer(buf);
+			buf = InvalidBuffer;
+
+			if (!match)
+			{
+				*ranges_p = palloc(sizeof(ZSTidRange));
+				*npruned_p += npruned;
+				return 0;
+			}
+			npruned = 0;
+		}
+	}
+
+	if (nbloom > 0)
+	{
+		BlockNumber head = zsbloom_get_head(rel, attno);
+
+		if (head == InvalidBlockNumber)
+			nbloom = 0;
+		else
+			zsbloom_begin_read(&bloom, rel, attno, head);
+	}
+	if (nusable == 0 && nbloom == 0)
+		return -1;
+
+	maxranges = 16;
+	ranges = palloc(maxranges * sizeof(ZSTidRange));
+
+	nexttid = MinZSTid;
+	while (nexttid < MaxPlusOneZSTid)
+	{
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		zstid		lokey;
+		zstid		hikey;
+		XLogRecPtr	leaflsn;
+		bool		match = true;
+
+		buf = zsbt_find_and_lock_leaf_containing_tid(rel, attno, buf, nexttid,
+													 BUFFER_LOCK_SHARE, NULL);
+		if (!BufferIsValid(buf))
+		{
+			/* completely empty tree; can't say anything */
+			if (nbloom > 0)
+				zsbloom_end_read(&bloom);
+			pfree(ranges);
+			return -1;
+		}
+		page = BufferGetPage(buf);
+		opaque = ZSBtreePageGetOpaque(page);
+
+		for (int i = 0; i < nusable && match; i++)
+			match = zsbt_attr_synopsis_match(attr, opaque, usable_keys[i]);
+		lokey = opaque->zs_lokey;
+		hikey = opaque->zs_hikey;
+		leaflsn = PageGetLSN(page);
+
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+		if (match && nbloom > 0)
+		{
+			ZSBloomEntry *entry;
+
+			entry = zsbloom_find_entry(&bloom, lokey, BufferGetBlockNumber(buf),
+									   leaflsn);
+			for (int i = 0; entry && i < nbloom && match; i++)
+				match = zsbloom_entry_may_contain(entry, bloom_hashes[i]);
+		}
+
+		if (match)
+		{
+			if (nranges > 0 && ranges[nranges - 1].end == lokey)
+				ranges[nranges - 1].end = hikey;
+			else
+			{
+				if (nranges == maxranges)
+				{
+					maxranges *= 2;
+					ranges = repalloc(ranges, maxranges * sizeof(ZSTidRange));
+				}
+				ranges[nranges].start = lokey;
+				ranges[nranges].end = hikey;
+				nranges++;
+			}
+		}
+		else
+			npruned++;
+		nexttid = hikey;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+	if (BufferIsValid(buf))
+		ReleaseBuffer(buf);
+	if (nbloom > 0)
+		zsbloom_end_read(&bloom);
+
+	*ranges_p = ranges;
+	*npruned_p += npruned;
+	return nranges;
+}
+
+/*
+ * Read the synopses of all the leaf pages of attribute 'attno', in TID order.
+ *
+ * On return, *synopses_p points to a palloc'd array, and the number of leaf
+ * pages is returned. Returns -1 if the synopses don't track the minimum and
+ * maximum of the attribute, or don't cover all of its values.
+ *
+ * Like zsbt_attr_prune_ranges(), this only reads the leaf pages, and the
+ * result is only accurate for data that existed when this was called. The
+ * synopses are not narrowed when rows are deleted, so they bound the values
+ * on a page, but the bounds might not be reached by any live row.
+ */
+int
+zsbt_attr_leaf_synopses(Relation rel, AttrNumber attno,
+						ZSAttrLeafSynopsis **synopses_p)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	ZSAttrLeafSynopsis *synopses;
+	int			nsynopses = 0;
+	int			maxsynopses;
+	Buffer		buf = InvalidBuffer;
+	zstid		nexttid;
+
+	/* see zsbt_attr_prune_ranges() */
+	if (attr->attisdropped || attr->atthasmissing ||
+		!zsbt_attr_synopsis_minmax(attr))
+		return -1;
+
+	maxsynopses = 16;
+	synopses = palloc(maxsynopses * sizeof(ZSAttrLeafSynopsis));
+
+	nexttid = MinZSTid;
+	while (nexttid < MaxPlusOneZSTid)
+	{
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		ZSAttrLeafSynopsis *synopsis;
+
+		buf = zsbt_find_and_lock_leaf_containing_tid(rel, attno, buf, nexttid,
+													 BUFFER_LOCK_SHARE, NULL);
+		if (!BufferIsValid(buf))
+			break;
+		page = BufferGetPage(buf);
+		opaque = ZSBtreePageGetOpaque(page);
+
+		if (nsynopses == maxsynopses)
+		{
+			maxsynopses *= 2;
+			synopses = repalloc(synopses, maxsynopses * sizeof(ZSAttrLeafSynopsis));
+		}
+		synopsis = &synopses[nsynopses++];
+		synopsis->lokey = opaque->zs_lokey;
+		synopsis->hikey = opaque->zs_hikey;
+		synopsis->valid = (opaque->zs_flags & ZSBT_ATTR_SYNOPSIS) != 0;
+		synopsis->minval = opaque->zs_minval;
+		synopsis->maxval = opaque->zs_maxval;
+
+		nexttid = opaque->zs_hikey;
+
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+	if (BufferIsValid(buf))
+		ReleaseBuffer(buf);
+
+	*synopses_p = synopses;
+	return nsynopses;
+}
+
+/*
+ * Compute the summary of the whole tree of attribute 'attno', and store it
+ * on the root page. See ZSBtreePageOpaque.
+ *
+ * If values are added concurrently, the summary might not be stored. The
+ * next VACUUM or ANALYZE will try again.
+ */
+void
+zsbt_attr_summarize(Relation rel, AttrNumber attno)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	ZSAttrLeafSynopsis *synopses;
+	int			nsynopses;
+	bool		valid;
+	int64		minval = PG_INT64_MAX;
+	int64		maxval = PG_INT64_MIN;
+	Buffer		buf;
+	ZSBtreePageOpaque *opaque;
+
+	if (attr->attisdropped || attr->atthasmissing ||
+		!zsbt_attr_synopsis_minmax(attr))
+		return;
+
+	/* A root leaf's own synopsis covers the tree already */
+	buf = zsbt_attr_lock_root(rel, attno, BUFFER_LOCK_EXCLUSIVE);
+	if (!BufferIsValid(buf))
+		return;
+	if (ZSBtreePageGetOpaque(BufferGetPage(buf))->zs_level == 0)
+	{
+		UnlockReleaseBuffer(buf);
+		return;
+	}
+	zsbt_attr_set_summary(rel, buf, ZSBT_ATTR_SUMMARY_PENDING,
+						  PG_INT64_MAX, PG_INT64_MIN, 0);
+	UnlockReleaseBuffer(buf);
+
+	nsynopses = zsbt_attr_leaf_synopses(rel, attno, &synopses);
+	valid = (nsynopses > 0);
+	for (int i = 0; i < nsynopses && valid; i++)
+	{
+		if (!synopses[i].valid)
+			valid = false;
+		else if (synopses[i].minval <= synopses[i].maxval)
+		{
+			minval = Min(minval, synopses[i].minval);
+			maxval = Max(maxval, synopses[i].maxval);
+		}
+	}
+	if (nsynopses > 0)
+		pfree(synopses);
+
+	/*
+	 * Store the summary, unless someone added values while we were reading
+	 * the leaves. The root might have been split meanwhile, but then the new
+	 * root doesn't have the flag.
+	 */
+	buf = zsbt_attr_lock_root(rel, attno, BUFFER_LOCK_EXCLUSIVE);
+	if (!BufferIsValid(buf))
+		return;
+	opaque = ZSBtreePageGetOpaque(BufferGetPage(buf));
+	if (opaque->zs_level > 0 && (opaque->zs_flags & ZSBT_ATTR_SUMMARY_PENDING) != 0)
+	{
+		if (valid)
+			zsbt_attr_set_summary(rel, buf, ZSBT_ATTR_SYNOPSIS,
+								  minval, maxval, nsynopses);
+		else
+			zsbt_attr_set_summary(rel, buf, 0, PG_INT64_MAX, PG_INT64_MIN, 0);
+	}
+	UnlockReleaseBuffer(buf);
+}
+
+/*
+ * Lock the root page of attribute 'attno'. Returns InvalidBuffer if the
+ * tree is empty.
+ */
+static Buffer
+zsbt_attr_lock_root(Relation rel, AttrNumber attno, int mode)
+{
+	BlockNumber failblk = InvalidBlockNumber;
+
+	for (;;)
+	{
+		BlockNumber rootblk;
+		Buffer		buf;
+
+		rootblk = zsmeta_get_root_for_attribute(rel, attno, true);
+		if (rootblk == InvalidBlockNumber)
+			return InvalidBuffer;
+		if (rootblk == failblk)
+			elog(ERROR, "could not find root for attribute %d", attno);
+
+		buf = ReadBuffer(rel, rootblk);
+		LockBuffer(buf, mode);
+		if (zsbt_page_is_expected(rel, attno, MinZSTid, -1, buf))
+			return buf;
+		UnlockReleaseBuffer(buf);
+
+		/* the root was split or moved after we cached the metadata */
+		failblk = rootblk;
+		zsmeta_invalidate_cache_attr(rel, attno);
+	}
+}
+
+/*
+ * Set or clear the summary on a root page. The caller holds an exclusive
+ * lock on it.
+ */
+static void
+zsbt_attr_set_summary(Relation rel, Buffer buf, uint16 flags,
+					  int64 minval, int64 maxval, uint32 nleaves)
+{
+	ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(BufferGetPage(buf));
+
+	START_CRIT_SECTION();
+
+	opaque->zs_flags &= ~(ZSBT_ATTR_SYNOPSIS | ZSBT_ATTR_SUMMARY_PENDING);
+	opaque->zs_flags |= flags;
+	opaque->zs_nullcount = nleaves;
+	opaque->zs_minval = minval;
+	opaque->zs_maxval = maxval;
+
+	MarkBufferDirty(buf);
+	if (zs_relation_needs_wal(rel))
+		log_newpage_buffer(buf, true);
+
+	END_CRIT_SECTION();
+}
+
+/*
+ * Values with the given synopsis were just added to a leaf. If the summary
+ * of the tree, or one that's being gathered, doesn't cover them, clear it.
+ *
+ * This must be called after the leaf was modified, so that
+ * zsbt_attr_summarize() either sees the new values, or sees its flag
+ * cleared.
+ */
+static void
+zsbt_attr_summary_add(Relation rel, AttrNumber attno, bool valid,
+					  int64 minval, int64 maxval)
+{
+	int			mode = BUFFER_LOCK_SHARE;
+
+	if (!zsbt_attr_synopsis_minmax(&rel->rd_att->attrs[attno - 1]))
+		return;
+
+	for (;;)
+	{
+		Buffer		buf;
+		ZSBtreePageOpaque *opaque;
+
+		buf = zsbt_attr_lock_root(rel, attno, mode);
+		if (!BufferIsValid(buf))
+			return;
+		opaque = ZSBtreePageGetOpaque(BufferGetPage(buf));
+
+		if (opaque->zs_level == 0 ||
+			(opaque->zs_flags & (ZSBT_ATTR_SYNOPSIS | ZSBT_ATTR_SUMMARY_PENDING)) == 0 ||
+			(valid && (minval > maxval ||
+					   (minval >= opaque->zs_minval && maxval <= opaque->zs_maxval))))
+		{
+			UnlockReleaseBuffer(buf);
+			return;
+		}
+
+		if (mode == BUFFER_LOCK_EXCLUSIVE)
+		{
+			zsbt_attr_set_summary(rel, buf, 0, PG_INT64_MAX, PG_INT64_MIN, 0);
+			UnlockReleaseBuffer(buf);
+			return;
+		}
+
+		/* The root might be split or moved while it's unlocked, so start over */
+		UnlockReleaseBuffer(buf);
+		mode = BUFFER_LOCK_EXCLUSIVE;
+	}
+}
+
+/*
+ * Size of the data on an attribute leaf page, after decompression. For the
+ * statistics gathered by zsbt_gather_tree_stats().
+ */
+uint64
+zsbt_attr_page_raw_bytes(Page page)
+{
+	ZSAttStream *lowerstream = get_page_lowerstream(page);
+	ZSAttStream *upperstream = get_page_upperstream(page);
+	uint64		result = 0;
+
+	/* the lower stream is never compressed */
+	if (lowerstream)
+		result += lowerstream->t_size - SizeOfZSAttStreamHeader;
+	if (upperstream)
+	{
+		if (upperstream->t_flags & ATTSTREAM_COMPRESSED)
+			result += upperstream->t_decompressed_size;
+		else
+			result += upperstream->t_size - SizeOfZSAttStreamHeader;
+	}
+	return result;
+}
+
+/*
+ * Add the on-disk sizes of the compressed and uncompressed attstreams on an
+ * attribute leaf page to *compressed and *uncompressed.
+ */
+void
+zsbt_attr_page_stream_sizes(Page page, int64 *compressed, int64 *uncompressed)
+{
+	ZSAttStream *streams[2];
+
+	streams[0] = get_page_lowerstream(page);
+	streams[1] = get_page_upperstream(page);
+	for (int i = 0; i < 2; i++)
+	{
+		if (streams[i] == NULL)
+			continue;
+		if (streams[i]->t_flags & ATTSTREAM_COMPRESSED)
+			*compressed += streams[i]->t_size;
+		else
+			*uncompressed += streams[i]->t_size;
+	}
+}
+
+/*
+ * Recycle the TOAST pages of all the values on an attribute leaf page, for
+ * discarding the tree of a dropped attribute. 'attr' describes the values
+ * on the page, which must be varlenas.
+ */
+void
+zsbt_attr_page_free_toast(Relation rel, Form_pg_attribute attr, Page page)
+{
+	ZSAttStream *streams[2];
+	zstid	   *tids = NULL;
+	BlockNumber *blocks = NULL;
+	int			ntoasted = 0;
+	int			maxtoasted = 0;
+
+	Assert(attr->attlen == -1);
+
+	/*
+	 * Collect the TOAST pointers first. The decoder may be looking at the
+	 * page, or at its own copy of it, so don't mix decoding with freeing.
+	 */
+	streams[0] = get_page_lowerstream(page);
+	streams[1] = get_page_upperstream(page);
+	for (int i = 0; i < 2; i++)
+	{
+		attstream_decoder decoder;
+
+		if (streams[i] == NULL)
+			continue;
+
+		init_attstream_decoder(&decoder, attr->attbyval, attr->attlen);
+		decode_attstream_begin(&decoder, streams[i]);
+		while (decode_attstream_cont(&decoder))
+		{
+			for (int idx = 0; idx < decoder.num_elements; idx++)
+			{
+				Datum		datum = decoder.datums[idx];
+				varatt_zs_toastptr *toastptr;
+
+				if (decoder.isnulls[idx] ||
+					!VARATT_IS_EXTERNAL(datum) ||
+					VARTAG_EXTERNAL(datum) != VARTAG_ZEDSTORE)
+					continue;
+
+				if (ntoasted == maxtoasted)
+				{
+					maxtoasted = Max(maxtoasted * 2, 16);
+					tids = tids ? repalloc(tids, maxtoasted * sizeof(zstid)) :
+						palloc(maxtoasted * sizeof(zstid));
+					blocks = blocks ? repalloc(blocks, maxtoasted * sizeof(BlockNumber)) :
+						palloc(maxtoasted * sizeof(BlockNumber));
+				}
+				toastptr = (varatt_zs_toastptr *) DatumGetPointer(datum);
+				tids[ntoasted] = decoder.tids[idx];
+				blocks[ntoasted] = toastptr->zst_block;
+				ntoasted++;
+			}
+		}
+		destroy_attstream_decoder(&decoder);
+	}
+
+	for (int i = 0; i < ntoasted; i++)
+	{
+		CHECK_FOR_INTERRUPTS();
+		zedstore_toast_delete(rel, attr, tids[i], blocks[i]);
+	}
+
+	if (tids)
+	{
+		pfree(tids);
+		pfree(blocks);
+	}
+}
+
 /* ----------------------------------------------------------------
  *						 Internal routines
  * ----------------------------------------------------------------
  */
 
-static ZSAttStream *
+ZSAttStream *
 get_page_lowerstream(Page page)
 {
 	int			lowersize;
@@ -379,33 +1414,319 @@ get_page_lowerstream(Page page)
 	}
 	else
 	{
-		Assert (lowersize == 0);
-		lowerstream = NULL;
+		Assert (lowersize == 0);
+		lowerstream = NULL;
+	}
+
+	return lowerstream;
+}
+
+ZSAttStream *
+get_page_upperstream(Page page)
+{
+	int			uppersize;
+	ZSAttStream *upperstream;
+
+	uppersize = ((PageHeader) page)->pd_special - ((PageHeader) page)->pd_upper;
+	if (uppersize > SizeOfZSAttStreamHeader)
+	{
+		upperstream = (ZSAttStream *) (((char *) page) + ((PageHeader) page)->pd_upper);
+		Assert(upperstream->t_size == uppersize);
+		/* by convention, upper stream is always compressed */
+		Assert((upperstream->t_flags & ATTSTREAM_COMPRESSED) != 0);
+	}
+	else
+	{
+		upperstream = NULL;
+		Assert(uppersize == 0);
+	}
+	return upperstream;
+}
+
+/*
+ * Synopsis routines.
+ *
+ * Can we keep track of the minimum and maximum values of 'attr'? Only for
+ * pass-by-value types whose values compare like signed integers.
+ */
+static bool
+zsbt_attr_synopsis_minmax(Form_pg_attribute attr)
+{
+	if (!attr->attbyval)
+		return false;
+
+	switch (attr->atttypid)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case DATEOID:
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Initialize the synopsis of an empty page */
+static void
+zsbt_attr_synopsis_init(ZSBtreePageOpaque *opaque)
+{
+	opaque->zs_flags |= ZSBT_ATTR_SYNOPSIS;
+	opaque->zs_nullcount = 0;
+	opaque->zs_minval = PG_INT64_MAX;
+	opaque->zs_maxval = PG_INT64_MIN;
+}
+
+/* Add the values in 'chunks' to the synopsis of a page, if it has one */
+static void
+zsbt_attr_synopsis_add(Form_pg_attribute attr, ZSBtreePageOpaque *opaque,
+					   char *chunks, int chunkslen)
+{
+	if ((opaque->zs_flags & ZSBT_ATTR_SYNOPSIS) == 0)
+		return;
+
+	attstream_chunks_synopsis(attr->attbyval, attr->attlen,
+							  zsbt_attr_synopsis_minmax(attr),
+							  chunks, chunkslen,
+							  &opaque->zs_nullcount,
+							  &opaque->zs_minval, &opaque->zs_maxval);
+}
+
+/*
+ * Might any value on the page satisfy 'key', according to its synopsis?
+ *
+ * The caller has checked that the key can be evaluated against the synopsis.
+ */
+static bool
+zsbt_attr_synopsis_match(Form_pg_attribute attr, ZSBtreePageOpaque *opaque,
+						 ScanKey key)
+{
+	int64		arg;
+
+	if ((opaque->zs_flags & ZSBT_ATTR_SYNOPSIS) == 0)
+		return true;
+
+	/* only NULLs on the page? They never satisfy a comparison. */
+	if (opaque->zs_minval > opaque->zs_maxval)
+		return false;
+
+	switch (attr->attlen)
+	{
+		case sizeof(int16):
+			arg = DatumGetInt16(key->sk_argument);
+			break;
+		case sizeof(int32):
+			arg = DatumGetInt32(key->sk_argument);
+			break;
+		default:
+			arg = DatumGetInt64(key->sk_argument);
+			break;
+	}
+
+	switch (key->sk_strategy)
+	{
+		case BTLessStrategyNumber:
+			return opaque->zs_minval < arg;
+		case BTLessEqualStrategyNumber:
+			return opaque->zs_minval <= arg;
+		case BTEqualStrategyNumber:
+			return opaque->zs_minval <= arg && arg <= opaque->zs_maxval;
+		case BTGreaterEqualStrategyNumber:
+			return opaque->zs_maxval >= arg;
+		case BTGreaterStrategyNumber:
+			return opaque->zs_maxval > arg;
+	}
+	return true;
+}
+
+/*
+ * Is 'attno' an ordered column, i.e. one with the "zedstore_ordered"
+ * attribute option?
+ *
+ * The values of an ordered column must ascend with the TIDs, and there must
+ * be no NULLs, so that a sequential scan returns the rows in the order of
+ * the column. That's checked whenever values are added, see
+ * zsbt_attr_check_order(), and for the rows already in the table when the
+ * option is set, by zsbt_attr_validate_order().
+ *
+ * The check relies on the synopsis of the rightmost leaf, so the option is
+ * ignored for types that don't have a min/max synopsis. Their order also
+ * matches that of the type's default B-tree operator class.
+ */
+bool
+zsbt_attr_is_ordered(Relation rel, AttrNumber attno)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	AttributeOpts *aopt;
+	bool		result = false;
+
+	if (attr->attisdropped || attr->atthasmissing ||
+		!zsbt_attr_synopsis_minmax(attr))
+		return false;
+
+	aopt = get_attribute_options(RelationGetRelid(rel), attno);
+	if (aopt)
+	{
+		result = aopt->zedstore_ordered;
+		pfree(aopt);
 	}
 
-	return lowerstream;
+	return result;
 }
 
-static ZSAttStream *
-get_page_upperstream(Page page)
+/*
+ * Check that the values in 'attbuf' can be added to the leaf page in 'buf',
+ * the page containing its first TID, without breaking the order of an
+ * ordered column. Raises an error if not.
+ *
+ * The new values must be in order themselves, and go after all the existing
+ * values: at the end of the rightmost leaf, and no smaller than the largest
+ * value on it. The existing values are in order, so the largest value on the
+ * rightmost leaf is the largest in the tree. The synopsis might be too wide,
+ * but never too narrow, so we might complain about values that are in fact
+ * in order, but never accept values that aren't.
+ *
+ * If the rightmost leaf has no values, but there are leaves to the left of
+ * it, we can't tell what the largest value is, and complain too. So does
+ * loading the table from several sessions at a time, when they put their
+ * rows in different parts of the TID space.
+ */
+static void
+zsbt_attr_check_order(Relation rel, Form_pg_attribute attr, Buffer buf,
+					  attstream_buffer *attbuf)
 {
-	int			uppersize;
-	ZSAttStream *upperstream;
+	Page		page = BufferGetPage(buf);
+	ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+	ZSAttStream *lowerstream = get_page_lowerstream(page);
+	ZSAttStream *upperstream = get_page_upperstream(page);
+	int64		firstval;
+	bool		ok;
+
+	if (!attstream_chunks_ordered(attr->attlen,
+								  attbuf->data + attbuf->cursor,
+								  attbuf->len - attbuf->cursor,
+								  &firstval))
+		ok = false;
+	else if (opaque->zs_hikey != MaxPlusOneZSTid ||
+			 (lowerstream && attbuf->firsttid <= lowerstream->t_lasttid) ||
+			 (upperstream && attbuf->firsttid <= upperstream->t_lasttid))
+		ok = false;
+	else if ((opaque->zs_flags & ZSBT_ATTR_SYNOPSIS) != 0 &&
+			 opaque->zs_minval <= opaque->zs_maxval)
+		ok = (opaque->zs_maxval <= firstval);
+	else
+		ok = (lowerstream == NULL && upperstream == NULL &&
+			  opaque->zs_lokey == MinZSTid);
 
-	uppersize = ((PageHeader) page)->pd_special - ((PageHeader) page)->pd_upper;
-	if (uppersize > SizeOfZSAttStreamHeader)
+	if (!ok)
 	{
-		upperstream = (ZSAttStream *) (((char *) page) + ((PageHeader) page)->pd_upper);
-		Assert(upperstream->t_size == uppersize);
-		/* by convention, upper stream is always compressed */
-		Assert((upperstream->t_flags & ATTSTREAM_COMPRESSED) != 0);
+		UnlockReleaseBuffer(buf);
+		ereport(ERROR,
+				(errcode(ERRCODE_CHECK_VIOLATION),
+				 errmsg("new values of column \"%s\" of relation \"%s\" are not in insertion order",
+						NameStr(attr->attname), RelationGetRelationName(rel)),
+				 errdetail("The column has the zedstore_ordered option, so its values must ascend in the order the rows are inserted, and must not be null.")));
 	}
-	else
+}
+
+/*
+ * Check that the values already in the tree of an ordered column are in
+ * order, when the option is set. Raises an error if not.
+ *
+ * The values of deleted rows that haven't been vacuumed away yet are
+ * checked too, because zsbt_attr_check_order() relies on the synopsis of the
+ * rightmost leaf, which covers them.
+ *
+ * The caller holds an AccessExclusiveLock on the relation, so the tree
+ * can't change under us.
+ */
+void
+zsbt_attr_validate_order(Relation rel, AttrNumber attno)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	Buffer		buf = InvalidBuffer;
+	zstid		nexttid;
+	int64		prevval = PG_INT64_MIN;
+	bool		ok = true;
+
+	Assert(attr->attbyval && attr->attlen > 0 && attr->attlen <= sizeof(int64));
+
+	nexttid = MinZSTid;
+	while (ok && nexttid < MaxPlusOneZSTid)
 	{
-		upperstream = NULL;
-		Assert(uppersize == 0);
+		Page		page;
+		ZSAttStream *streams[2];
+
+		buf = zsbt_find_and_lock_leaf_containing_tid(rel, attno, buf, nexttid,
+													 BUFFER_LOCK_SHARE, NULL);
+		if (!BufferIsValid(buf))
+			break;
+		page = BufferGetPage(buf);
+
+		/* the TIDs in the upper stream are lower than in the lower stream */
+		streams[0] = get_page_upperstream(page);
+		streams[1] = get_page_lowerstream(page);
+		for (int i = 0; ok && i < 2; i++)
+		{
+			attstream_decoder decoder;
+
+			if (streams[i] == NULL)
+				continue;
+
+			init_attstream_decoder(&decoder, attr->attbyval, attr->attlen);
+			decode_attstream_begin(&decoder, streams[i]);
+			while (ok && decode_attstream_cont(&decoder))
+			{
+				for (int idx = 0; idx < decoder.num_elements; idx++)
+				{
+					int64		val;
+
+					if (decoder.isnulls[idx])
+					{
+						ok = false;
+						break;
+					}
+					switch (attr->attlen)
+					{
+						case sizeof(int16):
+							val = DatumGetInt16(decoder.datums[idx]);
+							break;
+						case sizeof(int32):
+							val = DatumGetInt32(decoder.datums[idx]);
+							break;
+						default:
+							val = DatumGetInt64(decoder.datums[idx]);
+							break;
+					}
+					if (val < prevval)
+					{
+						ok = false;
+						break;
+					}
+					prevval = val;
+				}
+			}
+			destroy_attstream_decoder(&decoder);
+		}
+
+		nexttid = ZSBtreePageGetOpaque(page)->zs_hikey;
+
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+		CHECK_FOR_INTERRUPTS();
 	}
-	return upperstream;
+	if (BufferIsValid(buf))
+		ReleaseBuffer(buf);
+
+	if (!ok)
+		ereport(ERROR,
+				(errcode(ERRCODE_CHECK_VIOLATION),
+				 errmsg("column \"%s\" of relation \"%s\" contains values that are not in insertion order",
+						NameStr(attr->attname), RelationGetRelationName(rel)),
+				 errdetail("The column has the zedstore_ordered option, so its values must ascend in the order the rows are inserted, and must not be null.")));
 }
 
 /*
@@ -428,9 +1749,11 @@ void
 zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 {
 	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	ZSCompressionMethod compression;
 	Buffer		origbuf;
 	Page		origpage;
 	ZSBtreePageOpaque *origpageopaque;
+	ZSBtreePageOpaque newopaque;
 	ZSAttStream *lowerstream;
 	ZSAttStream *upperstream;
 	int			lowerstreamsz;
@@ -440,13 +1763,26 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 	zstid 		splittid;
 	zsbt_attr_repack_context cxt;
 	bool		split = false;
+	bool		framed;
+	bool		ordered;
 
 	Assert (attbuf->len - attbuf->cursor > 0);
 
+	/*
+	 * Look up the compression method and framing, and whether the column is
+	 * ordered, before locking any pages, because they might require a
+	 * catalog lookup.
+	 */
+	compression = zs_get_attr_compression_method(rel, attno);
+	framed = zs_get_attr_compression_frames(rel, attno);
+	ordered = zsbt_attr_is_ordered(rel, attno);
+
 	/*
 	 * Find the right place to insert the new data.
 	 */
 	origbuf = zsbt_descend(rel, attno, attbuf->firsttid, 0, false);
+	if (ordered)
+		zsbt_attr_check_order(rel, attr, origbuf, attbuf);
 	origpage = BufferGetPage(origbuf);
 	origpageopaque = ZSBtreePageGetOpaque(origpage);
 	splittid = origpageopaque->zs_hikey - 1;
@@ -493,16 +1829,25 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 			newhdr.t_lasttid = attbuf->lasttid;
 			new_pd_lower = SizeOfPageHeaderData + newhdr.t_size;
 
+			/* Update the synopsis. An empty page can start a new one. */
+			newopaque = *origpageopaque;
+			if (upperstream == NULL)
+				zsbt_attr_synopsis_init(&newopaque);
+			zsbt_attr_synopsis_add(attr, &newopaque,
+								   attbuf->data + attbuf->cursor,
+								   attbuf->len - attbuf->cursor);
+
 			START_CRIT_SECTION();
 
 			memcpy(origpage + SizeOfPageHeaderData, &newhdr, SizeOfZSAttStreamHeader);
 			memcpy(origpage + SizeOfPageHeaderData + SizeOfZSAttStreamHeader,
 				   attbuf->data + attbuf->cursor, attbuf->len - attbuf->cursor);
 			((PageHeader) origpage)->pd_lower = new_pd_lower;
+			*origpageopaque = newopaque;
 
 			MarkBufferDirty(origbuf);
 
-			if (RelationNeedsWAL(rel))
+			if (zs_relation_needs_wal(rel))
 				wal_log_attstream_change(rel, origbuf,
 										 (ZSAttStream *) (origpage + SizeOfPageHeaderData), false,
 										 orig_pd_lower, new_pd_lower);
@@ -510,6 +1855,9 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 			END_CRIT_SECTION();
 
 			UnlockReleaseBuffer(origbuf);
+			zsbt_attr_summary_add(rel, attno,
+								  (newopaque.zs_flags & ZSBT_ATTR_SYNOPSIS) != 0,
+								  newopaque.zs_minval, newopaque.zs_maxval);
 			if (split)
 			{
 				/*
@@ -527,8 +1875,15 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 	else
 	{
 		/*
-		 * Try to append the new data to the existing uncompressed data first
+		 * Try to append the new data to the existing uncompressed data first.
+		 * Compute the new synopsis beforehand, in case it succeeds.
 		 */
+		newopaque = *origpageopaque;
+		if (attbuf->lasttid <= splittid)
+			zsbt_attr_synopsis_add(attr, &newopaque,
+								   attbuf->data + attbuf->cursor,
+								   attbuf->len - attbuf->cursor);
+
 		START_CRIT_SECTION();
 
 		if (attbuf->lasttid <= splittid &&
@@ -537,6 +1892,7 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 									 attbuf))
 		{
 			new_pd_lower = SizeOfPageHeaderData + lowerstream->t_size;
+			*origpageopaque = newopaque;
 
 			/* fast path succeeded */
 			MarkBufferDirty(origbuf);
@@ -551,13 +1907,16 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 			 */
 			((PageHeader) origpage)->pd_lower = new_pd_lower;
 
-			if (RelationNeedsWAL(rel))
+			if (zs_relation_needs_wal(rel))
 				wal_log_attstream_change(rel, origbuf, lowerstream, false,
 										 orig_pd_lower, new_pd_lower);
 
 			END_CRIT_SECTION();
 
 			UnlockReleaseBuffer(origbuf);
+			zsbt_attr_summary_add(rel, attno,
+								  (newopaque.zs_flags & ZSBT_ATTR_SYNOPSIS) != 0,
+								  newopaque.zs_minval, newopaque.zs_maxval);
 			return;
 		}
 
@@ -584,11 +1943,11 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 		 * Keep the original page unmodified, and allocate a new page
 		 * for the new data.
 		 */
-		zsbt_attr_repack_init(&cxt, attno, origbuf, true);
+		zsbt_attr_repack_init(&cxt, attno, compression, framed, origbuf, true);
 		zsbt_attr_repack_newpage(&cxt, attbuf->firsttid);
 
 		/* write out the new data (or part of it) */
-		zsbt_attr_pack_attstream(attr, attbuf, cxt.currpage);
+		zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, attbuf, cxt.currpage);
 	}
 	else
 	{
@@ -646,7 +2005,7 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 		 * new data. Write it out, making sure that at least all the old data is
 		 * written out (otherwise, we'd momentarily remove existing data!)
 		 */
-		zsbt_attr_repack_init(&cxt, attno, origbuf, false);
+		zsbt_attr_repack_init(&cxt, attno, compression, framed, origbuf, false);
 
 		if (attbuf->lasttid > splittid)
 		{
@@ -661,12 +2020,12 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 			split = true;
 		}
 
-		zsbt_attr_pack_attstream(attr, attbuf, cxt.currpage);
+		zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, attbuf, cxt.currpage);
 
 		while (attbuf->cursor < attbuf->len && (split || attbuf->firsttid <= mintid))
 		{
 			zsbt_attr_repack_newpage(&cxt, attbuf->firsttid);
-			zsbt_attr_pack_attstream(attr, attbuf, cxt.currpage);
+			zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, attbuf, cxt.currpage);
 		}
 
 		if (split)
@@ -683,6 +2042,315 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
 	zsbt_attr_repack_writeback_pages(&cxt, rel, attno, origbuf);
 }
 
+/*
+ * zsbt_attr_add_bulk() leaves less than ZS_BULK_MIN_PENDING bytes of data
+ * in the buffer, as that might not be enough to fill a page after
+ * compression. It writes at most ZS_BULK_MAX_PAGES pages in one call, to
+ * limit the number of buffers locked and the size of the WAL record.
+ */
+#define ZS_BULK_MIN_PENDING		(4 * BLCKSZ)
+#define ZS_BULK_MAX_PAGES		32
+
+/*
+ * Bulk-loading variant of zsbt_attr_add().
+ *
+ * When loading a lot of data, e.g. with COPY, zsbt_attr_add() would merge
+ * each new page's worth of data with the partially-filled rightmost page,
+ * decompressing and recompressing the data on it every time. This function
+ * is for appending a large amount of new data after the existing data on a
+ * page: it leaves the existing page alone, and packs as many full pages as
+ * possible, compressing each exactly once. A tail of less than
+ * ZS_BULK_MIN_PENDING bytes is left in 'attbuf', to be written together with
+ * more data later.
+ *
+ * Usually the target is the rightmost page, but when several backends are
+ * loading the same table, each one's data goes after its own earlier data,
+ * in the middle of the tree. That works the same, as long as all the new
+ * data falls below the page's high key.
+ *
+ * If the new data overlaps with the existing data on the page or extends
+ * past its high key, or if the page is mostly empty, this falls back to
+ * zsbt_attr_add(). In the latter case, the page is filled up by merging, once.
+ */
+void
+zsbt_attr_add_bulk(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
+{
+	Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+	ZSCompressionMethod compression;
+	Buffer		origbuf;
+	Page		origpage;
+	ZSBtreePageOpaque *origpageopaque;
+	ZSAttStream *lowerstream;
+	ZSAttStream *upperstream;
+	int			lowerstreamsz;
+	bool		append;
+	int			npages;
+	zsbt_attr_repack_context cxt;
+	bool		framed;
+	bool		ordered;
+
+	Assert (attbuf->len - attbuf->cursor > 0);
+
+	/*
+	 * Look up the compression method and framing, and whether the column is
+	 * ordered, before locking any pages, because they might require a
+	 * catalog lookup.
+	 */
+	compression = zs_get_attr_compression_method(rel, attno);
+	framed = zs_get_attr_compression_frames(rel, attno);
+	ordered = zsbt_attr_is_ordered(rel, attno);
+
+	origbuf = zsbt_descend(rel, attno, attbuf->firsttid, 0, false);
+	origpage = BufferGetPage(origbuf);
+	origpageopaque = ZSBtreePageGetOpaque(origpage);
+
+	lowerstream = get_page_lowerstream(origpage);
+	upperstream = get_page_upperstream(origpage);
+	lowerstreamsz = lowerstream ? lowerstream->t_size : 0;
+
+	if (attbuf->lasttid >= origpageopaque->zs_hikey ||
+		(lowerstream && attbuf->firsttid <= lowerstream->t_lasttid) ||
+		(upperstream && attbuf->firsttid <= upperstream->t_lasttid) ||
+		((lowerstream || upperstream) &&
+		 PageGetExactFreeSpace(origpage) + lowerstreamsz >= BLCKSZ / 2))
+	{
+		UnlockReleaseBuffer(origbuf);
+		zsbt_attr_add(rel, attno, attbuf);
+		return;
+	}
+	if (ordered)
+		zsbt_attr_check_order(rel, attr, origbuf, attbuf);
+
+	/*
+	 * If the page is empty, fill it, otherwise keep the original page
+	 * unmodified, and start a new one.
+	 */
+	append = (lowerstream != NULL || upperstream != NULL);
+	zsbt_attr_repack_init(&cxt, attno, compression, framed, origbuf, append);
+	npages = 0;
+	if (!append)
+	{
+		zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, attbuf, cxt.currpage);
+		npages++;
+	}
+
+	while (attbuf->cursor < attbuf->len &&
+		   (npages == 0 || attbuf->len - attbuf->cursor > ZS_BULK_MIN_PENDING) &&
+		   npages < ZS_BULK_MAX_PAGES)
+	{
+		zsbt_attr_repack_newpage(&cxt, attbuf->firsttid);
+		zsbt_attr_pack_attstream(rel, attr, cxt.compression, cxt.framed, attbuf, cxt.currpage);
+		npages++;
+	}
+
+	zsbt_attr_repack_writeback_pages(&cxt, rel, attno, origbuf);
+}
+
+/*
+ * Max number of pages modified by one zsbt_attr_add_multi() WAL record.
+ */
+#define ZS_ADD_MULTI_MAX_PAGES		XLR_MAX_BLOCK_ID
+
+/*
+ * Add data to the attribute trees of several attributes at once.
+ *
+ * When a tuple buffer is flushed, there is typically a little bit of new
+ * data for every attribute, which is appended to the uncompressed stream on
+ * the rightmost leaf of each attribute tree. zsbt_attr_add() would write a
+ * separate WAL record for each one. For a wide table, that's a lot of WAL
+ * insertions, each with its own record header and WAL insertion lock
+ * acquisition. This function does the appends to all the attribute trees
+ * in groups, and WAL-logs each group with one record.
+ *
+ * Only the simple case is handled here: the data must fit in the free space
+ * on the target page, after any existing uncompressed data, without
+ * crossing the page's high key. Buffers that don't meet those conditions
+ * are left untouched, and the caller should use zsbt_attr_add() for them.
+ * Others are emptied.
+ *
+ * The leaf pages of a group are kept locked until the WAL record for them
+ * is written. They are locked in the order of 'attnos', which must be
+ * ascending, so that two backends doing this concurrently cannot deadlock.
+ */
+void
+zsbt_attr_add_multi(Relation rel, int nattrs, AttrNumber *attnos,
+					attstream_buffer **attbufs)
+{
+	bool		wal_needed = zs_relation_needs_wal(rel);
+	int			next = 0;
+	bool	   *ordered;
+
+	/* the record holds an array of these */
+	StaticAssertStmt(sizeof(wal_zedstore_attstream_change) == SizeOfZSWalAttstreamChange,
+					 "unexpected padding in wal_zedstore_attstream_change");
+
+	if (wal_needed)
+		XLogEnsureRecordSpace(ZS_ADD_MULTI_MAX_PAGES, ZS_ADD_MULTI_MAX_PAGES + 1);
+
+	/*
+	 * Ordered columns are left for zsbt_attr_add(), which checks the order.
+	 * Look them up before locking any pages.
+	 */
+	ordered = palloc(nattrs * sizeof(bool));
+	for (int i = 0; i < nattrs; i++)
+		ordered[i] = zsbt_attr_is_ordered(rel, attnos[i]);
+
+	while (next < nattrs)
+	{
+		Buffer		bufs[ZS_ADD_MULTI_MAX_PAGES];
+		int			idxs[ZS_ADD_MULTI_MAX_PAGES];
+		ZSBtreePageOpaque newopaques[ZS_ADD_MULTI_MAX_PAGES];
+		uint16		orig_pd_lowers[ZS_ADD_MULTI_MAX_PAGES];
+		wal_zedstore_attstream_change xlrecs[ZS_ADD_MULTI_MAX_PAGES];
+		bool		modified[ZS_ADD_MULTI_MAX_PAGES];
+		int			npages = 0;
+		int			nmodified = 0;
+
+		/* Lock the target pages, for as many attributes as we can. */
+		for (; next < nattrs && npages < ZS_ADD_MULTI_MAX_PAGES; next++)
+		{
+			AttrNumber	attno = attnos[next];
+			attstream_buffer *attbuf = attbufs[next];
+			Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+			int			newlen = attbuf->len - attbuf->cursor;
+			Buffer		buf;
+			Page		page;
+			ZSBtreePageOpaque *opaque;
+			ZSAttStream *lowerstream;
+			ZSAttStream *upperstream;
+
+			Assert(next == 0 || attnos[next - 1] < attno);
+
+			if (newlen == 0 || ordered[next])
+				continue;
+
+			buf = zsbt_descend(rel, attno, attbuf->firsttid, 0, false);
+			page = BufferGetPage(buf);
+			opaque = ZSBtreePageGetOpaque(page);
+			lowerstream = get_page_lowerstream(page);
+			upperstream = get_page_upperstream(page);
+
+			if (attbuf->lasttid >= opaque->zs_hikey ||
+				(lowerstream == NULL &&
+				 SizeOfZSAttStreamHeader + newlen > PageGetExactFreeSpace(page)) ||
+				(lowerstream != NULL &&
+				 (newlen > PageGetExactFreeSpace(page) ||
+				  attbuf->firsttid <= lowerstream->t_lasttid)))
+			{
+				UnlockReleaseBuffer(buf);
+				continue;
+			}
+
+			/* Compute the new synopsis, outside the critical section */
+			newopaques[npages] = *opaque;
+			if (lowerstream == NULL && upperstream == NULL)
+				zsbt_attr_synopsis_init(&newopaques[npages]);
+			zsbt_attr_synopsis_add(attr, &newopaques[npages],
+								   attbuf->data + attbuf->cursor, newlen);
+
+			bufs[npages] = buf;
+			idxs[npages] = next;
+			orig_pd_lowers[npages] = ((PageHeader) page)->pd_lower;
+			npages++;
+		}
+
+		if (npages == 0)
+			continue;
+
+		START_CRIT_SECTION();
+
+		for (int i = 0; i < npages; i++)
+		{
+			AttrNumber	attno = attnos[idxs[i]];
+			attstream_buffer *attbuf = attbufs[idxs[i]];
+			Form_pg_attribute attr = &rel->rd_att->attrs[attno - 1];
+			Page		page = BufferGetPage(bufs[i]);
+			ZSAttStream *lowerstream = get_page_lowerstream(page);
+
+			if (lowerstream == NULL)
+			{
+				ZSAttStream newhdr;
+
+				newhdr.t_flags = 0;
+				newhdr.t_decompressed_size = 0;
+				newhdr.t_decompressed_bufsize = 0;
+				newhdr.t_size = SizeOfZSAttStreamHeader + (attbuf->len - attbuf->cursor);
+				newhdr.t_lasttid = attbuf->lasttid;
+
+				memcpy(page + SizeOfPageHeaderData, &newhdr, SizeOfZSAttStreamHeader);
+				memcpy(page + SizeOfPageHeaderData + SizeOfZSAttStreamHeader,
+					   attbuf->data + attbuf->cursor, attbuf->len - attbuf->cursor);
+				lowerstream = (ZSAttStream *) (page + SizeOfPageHeaderData);
+				attbuf->cursor = attbuf->len;
+			}
+			else if (!append_attstream_inplace(attr, lowerstream,
+											   PageGetExactFreeSpace(page),
+											   attbuf))
+			{
+				/* leave it for zsbt_attr_add() */
+				modified[i] = false;
+				continue;
+			}
+
+			((PageHeader) page)->pd_lower = SizeOfPageHeaderData + lowerstream->t_size;
+			*ZSBtreePageGetOpaque(page) = newopaques[i];
+			modified[i] = true;
+			nmodified++;
+
+			MarkBufferDirty(bufs[i]);
+
+			if (wal_needed)
+				wal_fill_attstream_change(page, lowerstream, false,
+										  orig_pd_lowers[i],
+										  ((PageHeader) page)->pd_lower,
+										  &xlrecs[nmodified - 1]);
+		}
+
+		if (wal_needed && nmodified > 0)
+		{
+			XLogRecPtr	recptr;
+			uint8		block_id = 0;
+
+			XLogBeginInsert();
+			XLogRegisterData((char *) xlrecs, nmodified * SizeOfZSWalAttstreamChange);
+			for (int i = 0; i < npages; i++)
+			{
+				Page		page = BufferGetPage(bufs[i]);
+
+				if (!modified[i])
+					continue;
+
+				XLogRegisterBuffer(block_id, bufs[i], REGBUF_STANDARD | zsbt_page_regbuf_flags(page));
+				XLogRegisterBufData(block_id, (char *) page + xlrecs[block_id].begin_offset,
+									xlrecs[block_id].end_offset - xlrecs[block_id].begin_offset);
+				block_id++;
+			}
+
+			recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_ATTSTREAM_CHANGE);
+
+			for (int i = 0; i < npages; i++)
+			{
+				if (modified[i])
+					PageSetLSN(BufferGetPage(bufs[i]), recptr);
+			}
+		}
+
+		END_CRIT_SECTION();
+
+		for (int i = 0; i < npages; i++)
+			UnlockReleaseBuffer(bufs[i]);
+		for (int i = 0; i < npages; i++)
+		{
+			if (modified[i])
+				zsbt_attr_summary_add(rel, attnos[idxs[i]],
+									  (newopaques[i].zs_flags & ZSBT_ATTR_SYNOPSIS) != 0,
+									  newopaques[i].zs_minval, newopaques[i].zs_maxval);
+		}
+	}
+
+	pfree(ordered);
+}
+
 /*
  * Repacker routines
  *
@@ -700,7 +2368,9 @@ zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *attbuf)
  * is modified until step 4.
  */
 static void
-zsbt_attr_repack_init(zsbt_attr_repack_context *cxt, AttrNumber attno, Buffer origbuf, bool append)
+zsbt_attr_repack_init(zsbt_attr_repack_context *cxt, AttrNumber attno,
+					  ZSCompressionMethod compression, bool framed,
+					  Buffer origbuf, bool append)
 {
 	Page		origpage;
 	ZSBtreePageOpaque *origopaque;
@@ -715,6 +2385,8 @@ zsbt_attr_repack_init(zsbt_attr_repack_context *cxt, AttrNumber attno, Buffer or
 	cxt->attno = attno;
 	cxt->hikey = origopaque->zs_hikey;
 	cxt->nextblkno = origopaque->zs_next;
+	cxt->compression = compression;
+	cxt->framed = framed;
 
 	newpage = (Page) palloc(BLCKSZ);
 	if (append)
@@ -727,6 +2399,8 @@ zsbt_attr_repack_init(zsbt_attr_repack_context *cxt, AttrNumber attno, Buffer or
 									 newpage);
 	if (append)
 		stack->special_only = true;
+	else
+		stack->delta = true;	/* this will replace the original page */
 	cxt->stack_head = stack;
 	cxt->stack_tail = stack;
 
@@ -738,6 +2412,8 @@ zsbt_attr_repack_init(zsbt_attr_repack_context *cxt, AttrNumber attno, Buffer or
 	newopaque->zs_level = 0;
 	newopaque->zs_flags = origopaque->zs_flags & ZSBT_ROOT;
 	newopaque->zs_page_id = ZS_BTREE_PAGE_ID;
+	if (!append)
+		zsbt_attr_synopsis_init(newopaque);
 }
 
 static void
@@ -769,16 +2445,100 @@ zsbt_attr_repack_newpage(zsbt_attr_repack_context *cxt, zstid nexttid)
 	newopaque->zs_level = 0;
 	newopaque->zs_flags = 0;
 	newopaque->zs_page_id = ZS_BTREE_PAGE_ID;
+	zsbt_attr_synopsis_init(newopaque);
+}
+
+/*
+ * Is the attribute marked with the "zedstore_cold" attribute option, or the
+ * whole table with the reloption of the same name?
+ *
+ * A single relation file can't be spread across tablespaces, so cold
+ * columns are not moved to different storage. The option only controls
+ * how much of shared buffers reads of the column may occupy.
+ */
+static bool
+zsbt_attr_is_cold(Relation rel, AttrNumber attno)
+{
+	AttributeOpts *aopt;
+	bool		result = false;
+
+	if (RelationIsZedstoreCold(rel))
+		return true;
+
+	aopt = get_attribute_options(RelationGetRelid(rel), attno);
+	if (aopt)
+	{
+		result = aopt->zedstore_cold;
+		pfree(aopt);
+	}
+
+	return result;
+}
+
+/*
+ * Adaptive compression.
+ *
+ * Some data, like UUIDs or random floats, doesn't compress. Compressing it
+ * anyway is a waste of CPU cycles on the write side, and every read of the
+ * page has to decompress it, too. To avoid that, we keep track of how well
+ * compression has worked for each attribute tree. If compression hasn't
+ * saved at least ZS_COMPRESSION_MIN_SAVINGS_PCT percent of space on
+ * ZS_COMPRESSION_MAX_FAILURES consecutive page writes, we store the next
+ * ZS_COMPRESSION_SKIP_PAGES pages uncompressed without even trying, and
+ * then probe again.
+ *
+ * The state lives in the backend-private metapage cache, so it's lost
+ * whenever the cache is invalidated. That's OK, we'll just probe again.
+ */
+#define ZS_COMPRESSION_MIN_SAVINGS_PCT	10
+#define ZS_COMPRESSION_MAX_FAILURES		4
+#define ZS_COMPRESSION_SKIP_PAGES		64
+
+static bool
+zsbt_attr_should_compress(Relation rel, AttrNumber attno)
+{
+	ZSMetaCacheData *metacache = (ZSMetaCacheData *) rel->rd_amcache;
+
+	if (metacache == NULL || attno >= metacache->cache_nattributes)
+		return true;
+
+	if (metacache->cache_attrs[attno].compress_skip > 0)
+	{
+		metacache->cache_attrs[attno].compress_skip--;
+		return false;
+	}
+	return true;
+}
+
+static void
+zsbt_attr_compression_feedback(Relation rel, AttrNumber attno, bool paid_off)
+{
+	ZSMetaCacheData *metacache = (ZSMetaCacheData *) rel->rd_amcache;
+
+	if (metacache == NULL || attno >= metacache->cache_nattributes)
+		return;
+
+	if (paid_off)
+		metacache->cache_attrs[attno].compress_failures = 0;
+	else if (++metacache->cache_attrs[attno].compress_failures >= ZS_COMPRESSION_MAX_FAILURES)
+	{
+		metacache->cache_attrs[attno].compress_failures = 0;
+		metacache->cache_attrs[attno].compress_skip = ZS_COMPRESSION_SKIP_PAGES;
+	}
 }
 
 /*
  * Compress and write as much of the data from 'attbuf' onto 'page' as fits.
  * 'attbuf' is updated in place, so that on exit, it contains the remaining chunks
  * that did not fit on 'page'.
+ *
+ * 'compression' and 'framed' come from the attribute's options. The caller
+ * looks them up before locking any pages.
  */
 static void
-zsbt_attr_pack_attstream(Form_pg_attribute attr, attstream_buffer *attbuf,
-						 Page page)
+zsbt_attr_pack_attstream(Relation rel, Form_pg_attribute attr,
+						 ZSCompressionMethod compression, bool framed,
+						 attstream_buffer *attbuf, Page page)
 {
 	Size		freespc;
 	int			orig_bytes;
@@ -788,7 +2548,7 @@ zsbt_attr_pack_attstream(Form_pg_attribute attr, attstream_buffer *attbuf,
 	int			complete_chunks_len;
 	zstid		lasttid = 0;
 	int			srcSize;
-	int			compressed_size;
+	int			compressed_size = 0;
 	ZSAttStream *hdr;
 	char		compressbuf[BLCKSZ];
 
@@ -807,10 +2567,33 @@ zsbt_attr_pack_attstream(Form_pg_attribute attr, attstream_buffer *attbuf,
 	 *
 	 * Note: we try compressing, even if the data fits uncompressed. That might seem
 	 * like a waste of time, but compression is very cheap, and this leaves more free
-	 * space on the page for new additions.
+	 * space on the page for new additions. If compression is disabled for the
+	 * column, zs_compress_destSize() returns 0, and we store it uncompressed.
+	 * If compression hasn't been paying off for this attribute recently, we
+	 * don't bother.
 	 */
-	srcSize = orig_bytes;
-	compressed_size = zs_compress_destSize(pstart, compressbuf, &srcSize, freespc);
+	if (compression != ZS_COMPRESSION_NONE &&
+		zsbt_attr_should_compress(rel, attr->attnum))
+	{
+		srcSize = orig_bytes;
+		if (framed)
+			compressed_size = compress_attstream_framed(compression, attbuf, compressbuf,
+														freespc, &srcSize);
+		else
+			compressed_size = zs_compress_destSize(compression, pstart, compressbuf,
+												   &srcSize, freespc);
+
+		if (compressed_size > 0 &&
+			(int64) compressed_size * 100 > (int64) srcSize * (100 - ZS_COMPRESSION_MIN_SAVINGS_PCT))
+		{
+			/* not worth it, store uncompressed instead */
+			compressed_size = 0;
+			zsbt_attr_compression_feedback(rel, attr->attnum, false);
+		}
+		else if (compressed_size > 0)
+			zsbt_attr_compression_feedback(rel, attr->attnum, true);
+	}
+
 	if (compressed_size > 0)
 	{
 		/* store compressed, in upper stream */
@@ -834,7 +2617,10 @@ zsbt_attr_pack_attstream(Form_pg_attribute attr, attstream_buffer *attbuf,
 		dst = (char *) page + ((PageHeader) page)->pd_special - (SizeOfZSAttStreamHeader + compressed_size);
 		hdr = (ZSAttStream *) dst;
 		hdr->t_size = SizeOfZSAttStreamHeader + compressed_size;
-		hdr->t_flags = ATTSTREAM_COMPRESSED;
+		hdr->t_flags = ATTSTREAM_COMPRESSED |
+			(compression << ATTSTREAM_COMPRESSION_METHOD_SHIFT);
+		if (framed)
+			hdr->t_flags |= ATTSTREAM_FRAMED;
 		hdr->t_decompressed_size = complete_chunks_len;
 		hdr->t_decompressed_bufsize = bytes_compressed;
 		hdr->t_lasttid = lasttid;
@@ -875,6 +2661,8 @@ zsbt_attr_pack_attstream(Form_pg_attribute attr, attstream_buffer *attbuf,
 		((PageHeader) page)->pd_lower += hdr->t_size;
 	}
 
+	zsbt_attr_synopsis_add(attr, ZSBtreePageGetOpaque(page), pstart, complete_chunks_len);
+
 	/*
 	 * Chop off the part of the chunk stream in 'attbuf' that we wrote out.
 	 */
@@ -889,6 +2677,9 @@ zsbt_attr_repack_writeback_pages(zsbt_attr_repack_context *cxt,
 	ZSBtreePageOpaque *oldopaque = ZSBtreePageGetOpaque(oldpage);
 	zs_split_stack *stack;
 	List	   *downlinks = NIL;
+	bool		synopsis_valid = true;
+	int64		minval = PG_INT64_MAX;
+	int64		maxval = PG_INT64_MIN;
 
 	/*
 	 * Ok, we now have a list of pages, to replace the original page, as private
@@ -909,7 +2700,7 @@ zsbt_attr_repack_writeback_pages(zsbt_attr_repack_context *cxt,
 
 		Assert(stack->next->buf == InvalidBuffer);
 
-		nextbuf = zspage_getnewbuf(rel);
+		nextbuf = zspage_getnewbuf(rel, attno);
 		stack->next->buf = nextbuf;
 
 		thisopaque->zs_next = BufferGetBlockNumber(nextbuf);
@@ -924,6 +2715,20 @@ zsbt_attr_repack_writeback_pages(zsbt_attr_repack_context *cxt,
 	/* last one in the chain */
 	ZSBtreePageGetOpaque(stack->page)->zs_next = cxt->nextblkno;
 
+	/* Combine the synopses of the new leaves, for the summary of the tree */
+	for (stack = cxt->stack_head; stack != NULL; stack = stack->next)
+	{
+		ZSBtreePageOpaque *thisopaque = ZSBtreePageGetOpaque(stack->page);
+
+		if ((thisopaque->zs_flags & ZSBT_ATTR_SYNOPSIS) == 0)
+			synopsis_valid = false;
+		else if (thisopaque->zs_minval <= thisopaque->zs_maxval)
+		{
+			minval = Min(minval, thisopaque->zs_minval);
+			maxval = Max(maxval, thisopaque->zs_maxval);
+		}
+	}
+
 	/* If we had to split, insert downlinks for the new pages. */
 	if (cxt->stack_head->next)
 	{
@@ -956,6 +2761,8 @@ zsbt_attr_repack_writeback_pages(zsbt_attr_repack_context *cxt,
 
 	/* Finally, overwrite all the pages we had to modify */
 	zs_apply_split_changes(rel, cxt->stack_head, NULL);
+
+	zsbt_attr_summary_add(rel, attno, synopsis_valid, minval, maxval);
 }
 
 static void
@@ -968,6 +2775,26 @@ wal_log_attstream_change(Relation rel, Buffer buf, ZSAttStream *attstream,
 	Page		page = BufferGetPage(buf);
 	XLogRecPtr	recptr;
 	wal_zedstore_attstream_change xlrec;
+
+	wal_fill_attstream_change(page, attstream, is_upper, begin_offset, end_offset,
+							  &xlrec);
+
+	XLogBeginInsert();
+	XLogRegisterBuffer(0, buf, REGBUF_STANDARD | zsbt_page_regbuf_flags(page));
+	XLogRegisterData((char *) &xlrec, SizeOfZSWalAttstreamChange);
+	XLogRegisterBufData(0, (char *) page + begin_offset, end_offset - begin_offset);
+
+	recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_ATTSTREAM_CHANGE);
+
+	PageSetLSN(page, recptr);
+}
+
+static void
+wal_fill_attstream_change(Page page, ZSAttStream *attstream, bool is_upper,
+						  uint16 begin_offset, uint16 end_offset,
+						  wal_zedstore_attstream_change *xlrec)
+{
+	ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
 #ifdef USE_ASSERT_CHECKING
 	uint16		pd_lower = ((PageHeader) page)->pd_lower;
 	uint16		pd_upper = ((PageHeader) page)->pd_upper;
@@ -976,93 +2803,110 @@ wal_log_attstream_change(Relation rel, Buffer buf, ZSAttStream *attstream,
 
 	Assert(begin_offset < end_offset);
 
-	memset(&xlrec, 0, sizeof(xlrec)); /* clear padding */
-	xlrec.is_upper = is_upper;
+	memset(xlrec, 0, sizeof(*xlrec)); /* clear padding */
+	xlrec->is_upper = is_upper;
+
+	xlrec->new_attstream_size = attstream->t_size;
+	xlrec->new_decompressed_size = attstream->t_decompressed_size;
+	xlrec->new_decompressed_bufsize = attstream->t_decompressed_bufsize;
+	xlrec->new_lasttid = attstream->t_lasttid;
 
-	xlrec.new_attstream_size = attstream->t_size;
-	xlrec.new_decompressed_size = attstream->t_decompressed_size;
-	xlrec.new_decompressed_bufsize = attstream->t_decompressed_bufsize;
-	xlrec.new_lasttid = attstream->t_lasttid;
+	xlrec->begin_offset = begin_offset;
+	xlrec->end_offset = end_offset;
 
-	xlrec.begin_offset = begin_offset;
-	xlrec.end_offset = end_offset;
+	xlrec->has_synopsis = (opaque->zs_flags & ZSBT_ATTR_SYNOPSIS) != 0;
+	xlrec->new_nullcount = opaque->zs_nullcount;
+	xlrec->new_minval = opaque->zs_minval;
+	xlrec->new_maxval = opaque->zs_maxval;
 
 	if (is_upper)
 		Assert(begin_offset >= pd_upper && end_offset <= pd_special);
 	else
 		Assert(begin_offset >= SizeOfPageHeaderData && end_offset <= pd_lower);
-
-	XLogBeginInsert();
-	XLogRegisterBuffer(0, buf, REGBUF_STANDARD);
-	XLogRegisterData((char *) &xlrec, SizeOfZSWalAttstreamChange);
-	XLogRegisterBufData(0, (char *) page + begin_offset, end_offset - begin_offset);
-
-	recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_ATTSTREAM_CHANGE);
-
-	PageSetLSN(page, recptr);
 }
 
 void
 zsbt_attstream_change_redo(XLogReaderState *record)
 {
 	XLogRecPtr	lsn = record->EndRecPtr;
-	wal_zedstore_attstream_change *xlrec =
+	wal_zedstore_attstream_change *xlrecs =
 		(wal_zedstore_attstream_change *) XLogRecGetData(record);
-	Buffer		buffer;
+	int			nblocks = XLogRecGetDataLen(record) / SizeOfZSWalAttstreamChange;
 
-	if (XLogReadBufferForRedo(record, 0, &buffer) == BLK_NEEDS_REDO)
-	{
-		Page		page = (Page) BufferGetPage(buffer);
-		Size		datasz;
-		char	   *data = XLogRecGetBlockData(record, 0, &datasz);
-		ZSAttStream *attstream;
+	/* A record can carry changes to several pages, see zsbt_attr_add_multi() */
+	if (nblocks != record->max_block_id + 1)
+		elog(ERROR, "number of changes in zedstore attstream change record (%d) does not match number of blocks (%d)",
+			 nblocks, record->max_block_id + 1);
 
-		Assert(datasz == xlrec->end_offset - xlrec->begin_offset);
+	for (uint8 block_id = 0; block_id <= record->max_block_id; block_id++)
+	{
+		wal_zedstore_attstream_change *xlrec = &xlrecs[block_id];
+		Buffer		buffer;
 
-		if (xlrec->is_upper)
+		if (XLogReadBufferForRedo(record, block_id, &buffer) == BLK_NEEDS_REDO)
 		{
-			/*
-			 * In the upper stream, if the size changes, the old data is moved
-			 * to begin at pd_upper, and then the new data is applied.
-			 *
-			 * XXX: we could be much smarter about this, and not move data that
-			 * we will overwrite on the next line.
-			 */
-			uint16		pd_special = ((PageHeader) page)->pd_special;
-			uint16		new_pd_upper = pd_special - xlrec->new_attstream_size;
-			uint16		old_pd_upper = ((PageHeader) page)->pd_upper;
-			uint16		old_size = old_pd_upper - pd_special;
-			uint16		new_size = new_pd_upper - pd_special;
+			Page		page = (Page) BufferGetPage(buffer);
+			ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+			Size		datasz;
+			char	   *data = XLogRecGetBlockData(record, block_id, &datasz);
+			ZSAttStream *attstream;
 
-			memmove(page + new_pd_upper, page + old_pd_upper, Min(old_size, new_size));
+			Assert(datasz == xlrec->end_offset - xlrec->begin_offset);
 
-			((PageHeader) page)->pd_upper = new_pd_upper;
-		}
-		else
-		{
-			uint16		new_pd_lower = SizeOfPageHeaderData + xlrec->new_attstream_size;
+			if (xlrec->is_upper)
+			{
+				/*
+				 * In the upper stream, if the size changes, the old data is
+				 * moved to begin at pd_upper, and then the new data is
+				 * applied.
+				 *
+				 * XXX: we could be much smarter about this, and not move
+				 * data that we will overwrite on the next line.
+				 */
+				uint16		pd_special = ((PageHeader) page)->pd_special;
+				uint16		new_pd_upper = pd_special - xlrec->new_attstream_size;
+				uint16		old_pd_upper = ((PageHeader) page)->pd_upper;
+				uint16		old_size = old_pd_upper - pd_special;
+				uint16		new_size = new_pd_upper - pd_special;
 
-			((PageHeader) page)->pd_lower = new_pd_lower;
-		}
+				memmove(page + new_pd_upper, page + old_pd_upper, Min(old_size, new_size));
 
-		memcpy(page + xlrec->begin_offset, data, datasz);
+				((PageHeader) page)->pd_upper = new_pd_upper;
+			}
+			else
+			{
+				uint16		new_pd_lower = SizeOfPageHeaderData + xlrec->new_attstream_size;
 
-		/*
-		 * Finally, adjust the size in the attstream header to match.
-		 * (if the replacement data in the WAL record covered the attstream
-		 * header, this is unnecessarily but harmless)
-		 */
-		attstream = (ZSAttStream *) (
-			xlrec->is_upper ? (page + ((PageHeader) page)->pd_upper) :
-			(page + SizeOfPageHeaderData));
-		attstream->t_size = xlrec->new_attstream_size;
-		attstream->t_decompressed_size = xlrec->new_decompressed_size;
-		attstream->t_decompressed_bufsize = xlrec->new_decompressed_bufsize;
-		attstream->t_lasttid = xlrec->new_lasttid;
-
-		PageSetLSN(page, lsn);
-		MarkBufferDirty(buffer);
+				((PageHeader) page)->pd_lower = new_pd_lower;
+			}
+
+			memcpy(page + xlrec->begin_offset, data, datasz);
+
+			/*
+			 * Finally, adjust the size in the attstream header to match.
+			 * (if the replacement data in the WAL record covered the
+			 * attstream header, this is unnecessarily but harmless)
+			 */
+			attstream = (ZSAttStream *) (
+				xlrec->is_upper ? (page + ((PageHeader) page)->pd_upper) :
+				(page + SizeOfPageHeaderData));
+			attstream->t_size = xlrec->new_attstream_size;
+			attstream->t_decompressed_size = xlrec->new_decompressed_size;
+			attstream->t_decompressed_bufsize = xlrec->new_decompressed_bufsize;
+			attstream->t_lasttid = xlrec->new_lasttid;
+
+			if (xlrec->has_synopsis)
+				opaque->zs_flags |= ZSBT_ATTR_SYNOPSIS;
+			else
+				opaque->zs_flags &= ~ZSBT_ATTR_SYNOPSIS;
+			opaque->zs_nullcount = xlrec->new_nullcount;
+			opaque->zs_minval = xlrec->new_minval;
+			opaque->zs_maxval = xlrec->new_maxval;
+
+			PageSetLSN(page, lsn);
+			MarkBufferDirty(buffer);
+		}
+		if (BufferIsValid(buffer))
+			UnlockReleaseBuffer(buffer);
 	}
-	if (BufferIsValid(buffer))
-		UnlockReleaseBuffer(buffer);
 }
@@ -65,10 +65,13 @@
 
 #include "access/detoast.h"
 #include "access/toast_internals.h"
+#include "access/zedstore_decompcache.h"
 #include "access/zedstore_internal.h"
 #include "miscadmin.h"
+#include "port/pg_bitutils.h"
 #include "utils/datum.h"
 #include "utils/memutils.h"
+#include "utils/numeric.h"
 
 #define TARGET_CHUNK_SIZE	128
 
@@ -81,6 +84,7 @@ static int get_chunk_length(int attlen, char *chunk);
 static zstid get_chunk_first_tid(int attlen, char *chunk);
 static int decode_chunk(bool attbyval, int attlen, zstid *lasttid, char *chunk,
 						int *num_elems, zstid *tids, Datum *datums, bool *isnulls);
+static zs_decode_chunk_fn choose_chunk_decoder(bool attbyval, int attlen);
 static int encode_chunk(attstream_buffer *dst, zstid prevtid, int ntids,
 						zstid *tids, Datum *datums, bool *isnulls);
 static int chunk_num_elements(char *chunk, int attlen);
@@ -101,6 +105,12 @@ static void verify_attstream(attstream_buffer *buffer);
  * by calling decode_attstream_cont(), until it returns false. Each
  * call to decode_attstream_cont() fills the arrays in the decoder
  * struct with the TIDs, Datums and isnull-flags in current chunk.
+ *
+ * Alternatively, call decode_attstream_batch() to decode many chunks at a
+ * time into arrays provided by the caller. That's more efficient when the
+ * caller wants to process a large part of the stream, e.g. in a sequential
+ * scan, because it amortizes the per-call overhead over thousands of
+ * elements, instead of at most DECODER_MAX_ELEMS.
  * ----------------------------------------------------------------------------
  */
 
@@ -112,30 +122,124 @@ init_attstream_decoder(attstream_decoder *decoder, bool attbyval, int16 attlen)
 {
 	decoder->cxt = CurrentMemoryContext;
 	decoder->tmpcxt = NULL;		/* can be set by caller */
+	decoder->tmpcxt_used = 0;
 
 	decoder->attbyval = attbyval;
 	decoder->attlen = attlen;
+	decoder->decode_chunk = choose_chunk_decoder(attbyval, attlen);
 
 	decoder->chunks_buf = NULL;
 	decoder->chunks_buf_size = 0;
+	decoder->chunks_buf_borrowed = false;
 	decoder->chunks_len = 0;
 	decoder->lasttid = InvalidZSTid;
+	decoder->basetid = 0;
 
 	decoder->pos = 0;
 	decoder->prevtid = InvalidZSTid;
 
+	decoder->boundaries = NULL;
+	decoder->num_boundaries = 0;
+	decoder->max_boundaries = 0;
+
 	decoder->num_elements = 0;
+
+	decoder->bytes_compressed = 0;
+	decoder->bytes_decompressed = 0;
+	decoder->chunks_decoded = 0;
 }
 
 void
 destroy_attstream_decoder(attstream_decoder *decoder)
 {
-	if (decoder->chunks_buf)
+	if (decoder->chunks_buf && !decoder->chunks_buf_borrowed)
 		pfree(decoder->chunks_buf);
 	decoder->chunks_buf = NULL;
 	decoder->chunks_buf_size = 0;
+	decoder->chunks_buf_borrowed = false;
 	decoder->chunks_len = 0;
 	decoder->num_elements = 0;
+
+	if (decoder->boundaries)
+		pfree(decoder->boundaries);
+	decoder->boundaries = NULL;
+	decoder->num_boundaries = 0;
+	decoder->max_boundaries = 0;
+}
+
+/*
+ * Make sure the decoder's chunk buffer is at least 'size' bytes, and owned
+ * by the decoder.
+ */
+static void
+decode_attstream_reserve(attstream_decoder *decoder, int size)
+{
+	if (decoder->chunks_buf_borrowed)
+	{
+		decoder->chunks_buf = NULL;
+		decoder->chunks_buf_borrowed = false;
+	}
+	if (decoder->chunks_buf_size < size)
+	{
+		int			newsize;
+
+		/*
+		 * Allocate generously, so that a scan doesn't need to reallocate the
+		 * buffer for every page that's a little larger than the previous one.
+		 */
+		newsize = Max(size, DECODER_INITIAL_BUF_SIZE);
+		newsize = Max(newsize, decoder->chunks_buf_size * 2);
+
+		if (decoder->chunks_buf)
+			pfree(decoder->chunks_buf);
+
+		decoder->chunks_buf = MemoryContextAlloc(decoder->cxt, newsize);
+		decoder->chunks_buf_size = newsize;
+	}
+}
+
+/*
+ * Switch to the decoder's tmpcxt, if it has one, resetting it first if
+ * enough has been allocated in it since the last reset.
+ *
+ * Resetting only once in a while, rather than on every call, avoids
+ * freeing and re-allocating AllocSet blocks for every chunk, when each chunk
+ * allocates more than fits in the context's keeper block. Returns the old
+ * memory context.
+ */
+static inline MemoryContext
+decode_attstream_enter_tmpcxt(attstream_decoder *decoder)
+{
+	MemoryContext oldcxt = CurrentMemoryContext;
+
+	if (decoder->tmpcxt)
+	{
+		if (decoder->tmpcxt_used >= DECODER_TMPCXT_RESET_SIZE)
+		{
+			MemoryContextReset(decoder->tmpcxt);
+			decoder->tmpcxt_used = 0;
+		}
+		MemoryContextSwitchTo(decoder->tmpcxt);
+	}
+	return oldcxt;
+}
+
+/*
+ * Reset the decoder's position, after loading the chunks of 'attstream'
+ * into the chunk buffer.
+ */
+static void
+decode_attstream_reset(attstream_decoder *decoder, ZSAttStream *attstream)
+{
+	decoder->basetid = 0;
+	decoder->firsttid = get_chunk_first_tid(decoder->attlen, decoder->chunks_buf);
+	decoder->lasttid = attstream->t_lasttid;
+
+	decoder->pos = 0;
+	decoder->prevtid = 0;
+	decoder->num_boundaries = 0;
+
+	decoder->num_elements = 0;
 }
 
 /*
@@ -151,22 +255,19 @@ decode_attstream_begin(attstream_decoder *decoder, ZSAttStream *attstream)
 	else
 		buf_size_needed = attstream->t_size - SizeOfZSAttStreamHeader;
 
-	if (decoder->chunks_buf_size < buf_size_needed)
-	{
-		if (decoder->chunks_buf)
-			pfree(decoder->chunks_buf);
-
-		decoder->chunks_buf = MemoryContextAlloc(decoder->cxt, buf_size_needed);
-		decoder->chunks_buf_size = buf_size_needed;
-	}
+	/*
+	 * The stream usually lives on a buffer page that the caller will unlock
+	 * as soon as we return, so we always make a copy.
+	 */
+	decode_attstream_reserve(decoder, buf_size_needed);
 
 	if ((attstream->t_flags & ATTSTREAM_COMPRESSED) != 0)
 	{
 		/* decompress */
-		zs_decompress(attstream->t_payload, decoder->chunks_buf,
-					  attstream->t_size - SizeOfZSAttStreamHeader,
-					  attstream->t_decompressed_bufsize);
+		zs_decompress_attstream(attstream, decoder->chunks_buf);
 		decoder->chunks_len = attstream->t_decompressed_size;
+		decoder->bytes_compressed += attstream->t_size - SizeOfZSAttStreamHeader;
+		decoder->bytes_decompressed += attstream->t_decompressed_size;
 	}
 	else
 	{
@@ -175,38 +276,173 @@ decode_attstream_begin(attstream_decoder *decoder, ZSAttStream *attstream)
 			   attstream->t_size - SizeOfZSAttStreamHeader);
 		decoder->chunks_len = attstream->t_size - SizeOfZSAttStreamHeader;
 	}
-	decoder->firsttid = get_chunk_first_tid(decoder->attlen, decoder->chunks_buf);
-	decoder->lasttid = attstream->t_lasttid;
+	decode_attstream_reset(decoder, attstream);
+}
+
+/*
+ * Like decode_attstream_begin(), for a stream on buffer page 'buf'. If the
+ * stream is compressed, the decompressed chunks are looked up in the shared
+ * decompressed data cache first, and added to it on a miss. 'local' says
+ * whether to use the backend-local cache too, see zedstore_decompcache.c.
+ *
+ * The caller must hold a lock on 'buf'.
+ */
+void
+decode_attstream_begin_cached(attstream_decoder *decoder, ZSAttStream *attstream,
+							  Relation rel, Buffer buf, bool local)
+{
+	if ((attstream->t_flags & ATTSTREAM_COMPRESSED) == 0)
+	{
+		decode_attstream_begin(decoder, attstream);
+		return;
+	}
+
+	decode_attstream_reserve(decoder, attstream->t_decompressed_bufsize);
+	if (zs_decompcache_lookup(rel, buf, decoder->chunks_buf,
+							  attstream->t_decompressed_size, local))
+	{
+		decoder->chunks_len = attstream->t_decompressed_size;
+		decode_attstream_reset(decoder, attstream);
+	}
+	else
+	{
+		decode_attstream_begin(decoder, attstream);
+		zs_decompcache_insert(rel, buf, decoder->chunks_buf, decoder->chunks_len,
+							  local);
+	}
+}
+
+/*
+ * Like decode_attstream_begin(), but if the stream is framed, decompress
+ * only the frame that contains 'tid'. The decoder then covers just the
+ * TIDs in that frame.
+ */
+void
+decode_attstream_begin_frame(attstream_decoder *decoder, ZSAttStream *attstream,
+							 zstid tid)
+{
+	ZSAttStreamFrame frame;
+	uint32		nframes;
+	char	   *src;
+	zstid		basetid = 0;
+	int			bufsize;
+	uint32		i;
+
+	if ((attstream->t_flags & ATTSTREAM_FRAMED) == 0)
+	{
+		decode_attstream_begin(decoder, attstream);
+		return;
+	}
+
+	nframes = zs_attstream_num_frames(attstream);
+	Assert(nframes > 0);
+	memset(&frame, 0, sizeof(frame));
+	src = attstream->t_payload + SizeOfZSAttStreamFrameDir(nframes);
+	for (i = 0; i < nframes; i++)
+	{
+		zs_attstream_get_frame(attstream, i, &frame);
+		if (tid <= frame.lasttid || i == nframes - 1)
+			break;
+		basetid = frame.lasttid;
+		src += frame.compressed_size;
+	}
+
+	/* the last frame can have an incomplete chunk at the end */
+	bufsize = frame.decompressed_size;
+	if (i == nframes - 1)
+		bufsize += attstream->t_decompressed_bufsize - attstream->t_decompressed_size;
+
+	decode_attstream_reserve(decoder, bufsize);
+	zs_decompress(ZSAttStreamGetCompressionMethod(attstream),
+				  src, decoder->chunks_buf, frame.compressed_size, bufsize);
+	decoder->chunks_len = frame.decompressed_size;
+	decoder->bytes_compressed += frame.compressed_size;
+	decoder->bytes_decompressed += frame.decompressed_size;
+
+	decoder->basetid = basetid;
+	decoder->firsttid = basetid + get_chunk_first_tid(decoder->attlen, decoder->chunks_buf);
+	decoder->lasttid = frame.lasttid;
 
 	decoder->pos = 0;
-	decoder->prevtid = 0;
+	decoder->prevtid = basetid;
+	decoder->num_boundaries = 0;
+
+	decoder->num_elements = 0;
+}
+
+/*
+ * Remember that a chunk starts at 'pos', for decode_attstream_seek().
+ *
+ * The boundaries are kept in order. A boundary that's not past the last one
+ * we have is already known, because the decoder never skips over a chunk
+ * without walking it, so there's nothing to do for it.
+ */
+static inline void
+decode_attstream_note_chunk(attstream_decoder *decoder, int pos, zstid prevtid)
+{
+	attstream_chunk_boundary *b;
+
+	if (decoder->num_boundaries > 0 &&
+		pos <= decoder->boundaries[decoder->num_boundaries - 1].pos)
+		return;
+
+	if (decoder->num_boundaries == decoder->max_boundaries)
+	{
+		if (decoder->boundaries == NULL)
+		{
+			decoder->max_boundaries = 64;
+			decoder->boundaries = MemoryContextAlloc(decoder->cxt,
+													 decoder->max_boundaries * sizeof(attstream_chunk_boundary));
+		}
+		else
+		{
+			decoder->max_boundaries *= 2;
+			decoder->boundaries = repalloc(decoder->boundaries,
+										   decoder->max_boundaries * sizeof(attstream_chunk_boundary));
+		}
+	}
+
+	b = &decoder->boundaries[decoder->num_boundaries++];
+	b->pos = pos;
+	b->prevtid = prevtid;
+}
 
+/*
+ * Restart decoding from the beginning of the chunks in the decoder.
+ */
+void
+decode_attstream_rewind(attstream_decoder *decoder)
+{
+	decoder->pos = 0;
+	decoder->prevtid = decoder->basetid;
 	decoder->num_elements = 0;
 }
 
 /*
  * internal routine like decode_attstream_begin(), for reading chunks without the
  * ZSAttStream header.
+ *
+ * The chunks are in backend-private memory, so the decoder reads them in
+ * place, without making a copy. Pass-by-reference datums returned by the
+ * decoder point directly to 'chunks', so the caller must keep it unmodified
+ * for as long as it uses the datums.
  */
 static void
 decode_chunks_begin(attstream_decoder *decoder, char *chunks, int chunkslen, zstid lasttid)
 {
-	if (decoder->chunks_buf_size < chunkslen)
-	{
-		if (decoder->chunks_buf)
-			pfree(decoder->chunks_buf);
-
-		decoder->chunks_buf = MemoryContextAlloc(decoder->cxt, chunkslen);
-		decoder->chunks_buf_size = chunkslen;
-	}
+	if (decoder->chunks_buf && !decoder->chunks_buf_borrowed)
+		pfree(decoder->chunks_buf);
 
-	/* XXX: do we really need to make a copy? */
-	memcpy(decoder->chunks_buf, chunks, chunkslen);
+	decoder->chunks_buf = chunks;
+	decoder->chunks_buf_size = 0;
+	decoder->chunks_buf_borrowed = true;
 	decoder->chunks_len = chunkslen;
 	decoder->lasttid = lasttid;
+	decoder->basetid = 0;
 
 	decoder->pos = 0;
 	decoder->prevtid = 0;
+	decoder->num_boundaries = 0;
 
 	decoder->num_elements = 0;
 }
@@ -216,7 +452,9 @@ decode_chunks_begin(attstream_decoder *decoder, char *chunks, int chunkslen, zst
  *
  * The TIDs, Datums and isnull flags in 'decoder' are filled in with
  * data from the next chunk. Returns true if there was more data,
- * false if the end of chunk was reached.
+ * false if the end of chunk was reached. Pass-by-reference datums are
+ * valid at least until the next call; memory in decoder->tmpcxt is only
+ * reset once enough has accumulated in it.
  *
  * TODO: avoid extracting elements we're not interested in, by passing
  * starttid/endtid. Or provide a separate "fast forward" function.
@@ -230,12 +468,7 @@ decode_attstream_cont(attstream_decoder *decoder)
 	char	   *pend;
 	MemoryContext oldcxt;
 
-	oldcxt = CurrentMemoryContext;
-	if (decoder->tmpcxt)
-	{
-		MemoryContextReset(decoder->tmpcxt);
-		MemoryContextSwitchTo(decoder->tmpcxt);
-	}
+	oldcxt = decode_attstream_enter_tmpcxt(decoder);
 
 	p = decoder->chunks_buf + decoder->pos;
 	pend = decoder->chunks_buf + decoder->chunks_len;
@@ -250,17 +483,22 @@ decode_attstream_cont(attstream_decoder *decoder)
 	{
 		int			num_decoded;
 
-		p += decode_chunk(decoder->attbyval, decoder->attlen, &lasttid, p,
-						  &num_decoded,
-						  &decoder->tids[total_decoded],
-						  &decoder->datums[total_decoded],
-						  &decoder->isnulls[total_decoded]);
+		decode_attstream_note_chunk(decoder, p - decoder->chunks_buf, lasttid);
+		p += decoder->decode_chunk(decoder->attbyval, decoder->attlen,
+								   &lasttid, p, &num_decoded,
+								   &decoder->tids[total_decoded],
+								   &decoder->datums[total_decoded],
+								   &decoder->isnulls[total_decoded]);
 		total_decoded += num_decoded;
+		decoder->chunks_decoded++;
 	}
 
 	MemoryContextSwitchTo(oldcxt);
 
 	Assert(p <= pend);
+	if (!decoder->attbyval)
+		decoder->tmpcxt_used += (p - (decoder->chunks_buf + decoder->pos)) +
+			total_decoded * VARHDRSZ;
 	decoder->num_elements = total_decoded;
 	decoder->pos = p - decoder->chunks_buf;
 	if (total_decoded > 0)
@@ -272,6 +510,148 @@ decode_attstream_cont(attstream_decoder *decoder)
 		return false;
 }
 
+/*
+ * Decode as many whole chunks from an attribute stream as fit in the
+ * caller-provided arrays.
+ *
+ * 'max_elems' is the size of the 'tids', 'datums' and 'isnulls' arrays. It
+ * must be at least 60, the maximum number of elements in one chunk. Returns
+ * the number of elements decoded, or 0 if the end of the stream was reached.
+ *
+ * Like with decode_attstream_cont(), pass-by-reference datums point to the
+ * decoder's buffer, or to memory allocated in decoder->tmpcxt, and are valid
+ * at least until the next call. The decoder's own arrays are not used, and
+ * decoder->num_elements is reset to 0. Calls to decode_attstream_batch()
+ * and decode_attstream_cont() on the same decoder can be mixed.
+ */
+int
+decode_attstream_batch(attstream_decoder *decoder, int max_elems,
+					   zstid *tids, Datum *datums, bool *isnulls)
+{
+	bool		attbyval = decoder->attbyval;
+	int			attlen = decoder->attlen;
+	zs_decode_chunk_fn decode_chunk_fn = decoder->decode_chunk;
+	zstid		lasttid;
+	int			total_decoded;
+	int			nchunks = 0;
+	char	   *p;
+	char	   *pend;
+	MemoryContext oldcxt;
+
+	Assert(max_elems >= 60);
+
+	oldcxt = decode_attstream_enter_tmpcxt(decoder);
+
+	p = decoder->chunks_buf + decoder->pos;
+	pend = decoder->chunks_buf + decoder->chunks_len;
+
+	total_decoded = 0;
+	lasttid = decoder->prevtid;
+
+	while (p < pend && total_decoded + 60 <= max_elems)
+	{
+		int			num_decoded;
+
+		p += decode_chunk_fn(attbyval, attlen, &lasttid, p,
+							 &num_decoded,
+							 &tids[total_decoded],
+							 &datums[total_decoded],
+							 &isnulls[total_decoded]);
+		total_decoded += num_decoded;
+		nchunks++;
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+	decoder->chunks_decoded += nchunks;
+
+	Assert(p <= pend);
+	if (!attbyval)
+		decoder->tmpcxt_used += (p - (decoder->chunks_buf + decoder->pos)) +
+			total_decoded * VARHDRSZ;
+	decoder->num_elements = 0;
+	decoder->pos = p - decoder->chunks_buf;
+	if (total_decoded > 0)
+		decoder->prevtid = tids[total_decoded - 1];
+
+	return total_decoded;
+}
+
+/*
+ * Skip over chunks that end before 'tid', without decoding their datums.
+ *
+ * After this, the next decode_attstream_cont() call returns the chunk
+ * containing 'tid', or the first chunk after it, if there is one.
+ */
+void
+decode_attstream_skip_to(attstream_decoder *decoder, zstid tid)
+{
+	char	   *p = decoder->chunks_buf + decoder->pos;
+	char	   *pend = decoder->chunks_buf + decoder->chunks_len;
+	zstid		prevtid = decoder->prevtid;
+
+	while (p < pend)
+	{
+		zstid		chunk_lasttid = prevtid;
+		int			len;
+
+		decode_attstream_note_chunk(decoder, p - decoder->chunks_buf, prevtid);
+		len = skip_chunk(decoder->attlen, p, &chunk_lasttid);
+		if (chunk_lasttid >= tid)
+			break;
+		p += len;
+		prevtid = chunk_lasttid;
+	}
+	Assert(p <= pend);
+
+	if (p != decoder->chunks_buf + decoder->pos)
+	{
+		decoder->pos = p - decoder->chunks_buf;
+		decoder->prevtid = prevtid;
+		decoder->num_elements = 0;
+	}
+}
+
+/*
+ * Like decode_attstream_skip_to(), but 'tid' may also be behind the current
+ * position.
+ *
+ * To go backwards, we jump to the last chunk start we have seen that is
+ * before 'tid', and skip forward from there. When a backward scan steps
+ * back over a chunk boundary, that's the previous chunk, so we don't need
+ * to walk over all the chunks before it again.
+ */
+void
+decode_attstream_seek(attstream_decoder *decoder, zstid tid)
+{
+	if (tid <= decoder->prevtid)
+	{
+		int			lo = 0;
+		int			hi = decoder->num_boundaries;
+
+		/* binary search for the last boundary with prevtid < tid */
+		while (lo < hi)
+		{
+			int			mid = (lo + hi) / 2;
+
+			if (decoder->boundaries[mid].prevtid < tid)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (lo > 0)
+		{
+			decoder->pos = decoder->boundaries[lo - 1].pos;
+			decoder->prevtid = decoder->boundaries[lo - 1].prevtid;
+			decoder->num_elements = 0;
+		}
+		else
+			decode_attstream_rewind(decoder);
+	}
+
+	decode_attstream_skip_to(decoder, tid);
+}
+
 bool
 get_attstream_chunk_cont(attstream_decoder *decoder, zstid *prevtid, zstid *firsttid, zstid *lasttid, bytea **chunk)
 {
@@ -281,12 +661,7 @@ get_attstream_chunk_cont(attstream_decoder *decoder, zstid *prevtid, zstid *firs
 	int len;
 	bytea *attr_data = NULL;
 
-	oldcxt = CurrentMemoryContext;
-	if(decoder->tmpcxt)
-	{
-		MemoryContextReset(decoder->tmpcxt);
-		MemoryContextSwitchTo(decoder->tmpcxt);
-	}
+	oldcxt = decode_attstream_enter_tmpcxt(decoder);
 
 	p = decoder->chunks_buf + decoder->pos;
 	pend = decoder->chunks_buf + decoder->chunks_len;
@@ -298,6 +673,7 @@ get_attstream_chunk_cont(attstream_decoder *decoder, zstid *prevtid, zstid *firs
 		len = skip_chunk(decoder->attlen, p, &decoder->prevtid);
 
 		attr_data = (bytea *) palloc(len + VARHDRSZ);
+		decoder->tmpcxt_used += len + VARHDRSZ;
 		SET_VARSIZE(attr_data, len + VARHDRSZ);
 		memcpy(VARDATA(attr_data), p, len);
 
@@ -735,43 +1111,193 @@ find_chunk_for_offset(attstream_buffer *attbuf, int offset, zstid *lasttid)
 	return p - (char *) chunks;
 }
 
-void
-init_attstream_buffer_from_stream(attstream_buffer *buf, bool attbyval, int16 attlen,
-								  ZSAttStream *attstream, MemoryContext memcontext)
+/*
+ * Compress the chunks in 'attbuf' into frames, for a framed stream. See
+ * ZSAttStreamFrame.
+ *
+ * As much as fits in 'dstsize' bytes is compressed, into 'dst'. This works
+ * like zs_compress_destSize(): *srcSizePtr is set to the number of input
+ * bytes that were compressed, and the return value is the compressed size,
+ * including the frame directory, or 0 if nothing could be compressed. Like
+ * with an unframed stream, the compressed input can end with an incomplete
+ * chunk.
+ */
+int
+compress_attstream_framed(ZSCompressionMethod method, attstream_buffer *attbuf,
+						  char *dst, int dstsize, int *srcSizePtr)
 {
-	int			buf_size;
+	ZSAttStreamFrame frames[ZS_ATTSTREAM_MAX_FRAMES];
+	char	   *compressbuf;
+	char	   *chunks = attbuf->data + attbuf->cursor;
+	int			chunkslen = attbuf->len - attbuf->cursor;
+	int			nframes = 0;
+	int			compressed_len = 0;
+	int			src_off = 0;
+	int			waste = 0;
+	zstid		prevtid = 0;
 
-	if ((attstream->t_flags & ATTSTREAM_COMPRESSED) != 0)
-		buf_size = attstream->t_decompressed_bufsize;
-	else
-		buf_size = attstream->t_size - SizeOfZSAttStreamHeader;
+	compressbuf = palloc(dstsize);
 
-	buf->data = MemoryContextAlloc(memcontext, buf_size);
-	buf->len = 0;
-	buf->maxlen = buf_size;
-	buf->cursor = 0;
+	while (src_off < chunkslen && nframes < ZS_ATTSTREAM_MAX_FRAMES)
+	{
+		char	   *p = chunks + src_off;
+		char	   *pend = chunks + chunkslen;
+		int			frame_len;
+		int			srcSize;
+		int			csize;
+		int			avail;
+		zstid		frame_lasttid;
+
+		avail = dstsize - SizeOfZSAttStreamFrameDir(nframes + 1) - compressed_len;
+		if (avail < 64)
+			break;
 
-	buf->attlen = attlen;
-	buf->attbyval = attbyval;
+		/* Collect complete chunks for this frame, but at least one */
+		frame_lasttid = prevtid;
+		while (p < pend)
+		{
+			int			len = get_chunk_length(attbuf->attlen, p);
 
-	if ((attstream->t_flags & ATTSTREAM_COMPRESSED) != 0)
+			if (p != chunks + src_off && (p - (chunks + src_off)) + len > ZS_ATTSTREAM_FRAME_SIZE)
+				break;
+			p += skip_chunk(attbuf->attlen, p, &frame_lasttid);
+		}
+		frame_len = p - (chunks + src_off);
+
+		srcSize = frame_len;
+		csize = zs_compress_destSize(method, chunks + src_off,
+									 compressbuf + compressed_len, &srcSize, avail);
+		if (csize <= 0)
+			break;
+
+		if (srcSize < frame_len)
+		{
+			/*
+			 * Ran out of space in the middle of the frame. Keep the complete
+			 * chunks that made it, and stop here.
+			 */
+			p = chunks + src_off;
+			frame_lasttid = prevtid;
+			while (p + sizeof(uint64) <= chunks + src_off + srcSize)
+			{
+				int			len = get_chunk_length(attbuf->attlen, p);
+
+				if (p + len > chunks + src_off + srcSize)
+					break;
+				p += skip_chunk(attbuf->attlen, p, &frame_lasttid);
+			}
+			if (p == chunks + src_off)
+				break;			/* not even one complete chunk, drop the frame */
+			waste = srcSize - (p - (chunks + src_off));
+			frame_len = p - (chunks + src_off);
+		}
+
+		frames[nframes].lasttid = frame_lasttid;
+		frames[nframes].compressed_size = csize;
+		frames[nframes].decompressed_size = frame_len;
+		nframes++;
+		compressed_len += csize;
+		src_off += frame_len;
+		prevtid = frame_lasttid;
+
+		if (waste > 0)
+			break;
+	}
+
+	if (nframes == 0)
 	{
-		zs_decompress(attstream->t_payload, buf->data,
-					  attstream->t_size - SizeOfZSAttStreamHeader,
-					  attstream->t_decompressed_bufsize);
-		buf->len = attstream->t_decompressed_size;
+		pfree(compressbuf);
+		return 0;
 	}
-	else
+
+	*srcSizePtr = src_off + waste;
+
 	{
-		memcpy(buf->data, attstream->t_payload, attstream->t_size - SizeOfZSAttStreamHeader);
-		buf->len = attstream->t_size - SizeOfZSAttStreamHeader;
+		uint32		n = nframes;
+
+		memcpy(dst, &n, sizeof(uint32));
 	}
+	memcpy(dst + sizeof(uint32), frames, nframes * sizeof(ZSAttStreamFrame));
+	memcpy(dst + SizeOfZSAttStreamFrameDir(nframes), compressbuf, compressed_len);
+	pfree(compressbuf);
 
-	buf->firsttid = get_chunk_first_tid(buf->attlen, buf->data + buf->cursor);
-	buf->lasttid = attstream->t_lasttid;
+	return SizeOfZSAttStreamFrameDir(nframes) + compressed_len;
 }
 
-void
+/*
+ * Decompress a compressed stream, framed or not, into 'dst', which must be
+ * at least 't_decompressed_bufsize' bytes.
+ */
+void
+zs_decompress_attstream(ZSAttStream *attstream, char *dst)
+{
+	ZSCompressionMethod method = ZSAttStreamGetCompressionMethod(attstream);
+	uint32		nframes;
+	char	   *src;
+
+	Assert((attstream->t_flags & ATTSTREAM_COMPRESSED) != 0);
+
+	if ((attstream->t_flags & ATTSTREAM_FRAMED) == 0)
+	{
+		zs_decompress(method, attstream->t_payload, dst,
+					  attstream->t_size - SizeOfZSAttStreamHeader,
+					  attstream->t_decompressed_bufsize);
+		return;
+	}
+
+	nframes = zs_attstream_num_frames(attstream);
+	src = attstream->t_payload + SizeOfZSAttStreamFrameDir(nframes);
+	for (uint32 i = 0; i < nframes; i++)
+	{
+		ZSAttStreamFrame frame;
+		int			bufsize;
+
+		zs_attstream_get_frame(attstream, i, &frame);
+		bufsize = frame.decompressed_size;
+		if (i == nframes - 1)
+			bufsize += attstream->t_decompressed_bufsize - attstream->t_decompressed_size;
+
+		zs_decompress(method, src, dst, frame.compressed_size, bufsize);
+		src += frame.compressed_size;
+		dst += frame.decompressed_size;
+	}
+}
+
+void
+init_attstream_buffer_from_stream(attstream_buffer *buf, bool attbyval, int16 attlen,
+								  ZSAttStream *attstream, MemoryContext memcontext)
+{
+	int			buf_size;
+
+	if ((attstream->t_flags & ATTSTREAM_COMPRESSED) != 0)
+		buf_size = attstream->t_decompressed_bufsize;
+	else
+		buf_size = attstream->t_size - SizeOfZSAttStreamHeader;
+
+	buf->data = MemoryContextAlloc(memcontext, buf_size);
+	buf->len = 0;
+	buf->maxlen = buf_size;
+	buf->cursor = 0;
+
+	buf->attlen = attlen;
+	buf->attbyval = attbyval;
+
+	if ((attstream->t_flags & ATTSTREAM_COMPRESSED) != 0)
+	{
+		zs_decompress_attstream(attstream, buf->data);
+		buf->len = attstream->t_decompressed_size;
+	}
+	else
+	{
+		memcpy(buf->data, attstream->t_payload, attstream->t_size - SizeOfZSAttStreamHeader);
+		buf->len = attstream->t_size - SizeOfZSAttStreamHeader;
+	}
+
+	buf->firsttid = get_chunk_first_tid(buf->attlen, buf->data + buf->cursor);
+	buf->lasttid = attstream->t_lasttid;
+}
+
+void
 init_attstream_buffer(attstream_buffer *buf, bool attbyval, int16 attlen)
 {
 #define ATTBUF_INIT_SIZE 1024
@@ -919,9 +1445,7 @@ merge_attstream(Form_pg_attribute attr, attstream_buffer *buf, ZSAttStream *atts
 		char	   *decompress_buf;
 
 		decompress_buf = palloc(attstream2->t_decompressed_bufsize);
-		zs_decompress(attstream2->t_payload, decompress_buf,
-					  attstream2->t_size - SizeOfZSAttStreamHeader,
-					  attstream2->t_decompressed_bufsize);
+		zs_decompress_attstream(attstream2, decompress_buf);
 
 		merge_attstream_guts(attr, buf,
 							 decompress_buf, attstream2->t_decompressed_size,
@@ -1197,6 +1721,132 @@ append_attstream_inplace(Form_pg_attribute att, ZSAttStream *oldstream, int free
 	return true;
 }
 
+/*
+ * Accumulate the synopsis of the chunks in 'chunks' into *nullcount, *minval
+ * and *maxval. If 'minmax' is true, the values are interpreted as signed
+ * integers of 'attlen' bytes, so it's only meaningful for pass-by-value
+ * types whose ordering matches that. Otherwise, every non-NULL value counts
+ * as 0, which only tells whether there are any.
+ */
+void
+attstream_chunks_synopsis(bool attbyval, int16 attlen, bool minmax,
+						  char *chunks, int chunkslen,
+						  uint32 *nullcount, int64 *minval, int64 *maxval)
+{
+	char	   *p = chunks;
+	char	   *pend = chunks + chunkslen;
+	zstid		lasttid = 0;
+	zstid		tids[DECODER_MAX_ELEMS];
+	Datum		datums[DECODER_MAX_ELEMS];
+	bool		isnulls[DECODER_MAX_ELEMS];
+
+	Assert(!minmax || (attbyval && attlen > 0 && attlen <= sizeof(int64)));
+
+	while (p < pend)
+	{
+		int			nelems;
+
+		p += decode_chunk(attbyval, attlen, &lasttid, p, &nelems,
+						  tids, datums, isnulls);
+
+		for (int i = 0; i < nelems; i++)
+		{
+			int64		val;
+
+			if (isnulls[i])
+			{
+				(*nullcount)++;
+				continue;
+			}
+
+			if (!minmax)
+				val = 0;
+			else
+			{
+				switch (attlen)
+				{
+					case sizeof(int16):
+						val = DatumGetInt16(datums[i]);
+						break;
+					case sizeof(int32):
+						val = DatumGetInt32(datums[i]);
+						break;
+					default:
+						val = DatumGetInt64(datums[i]);
+						break;
+				}
+			}
+			if (val < *minval)
+				*minval = val;
+			if (val > *maxval)
+				*maxval = val;
+		}
+	}
+	Assert(p == pend);
+}
+
+
+/*
+ * Check that the values in 'chunks' are in ascending order of TID and
+ * value, and that there are no NULLs. The values are interpreted as signed
+ * integers of 'attlen' bytes, as in attstream_chunks_synopsis(). On success,
+ * the first value is returned in *firstval.
+ */
+bool
+attstream_chunks_ordered(int16 attlen, char *chunks, int chunkslen,
+						 int64 *firstval)
+{
+	char	   *p = chunks;
+	char	   *pend = chunks + chunkslen;
+	zstid		lasttid = 0;
+	zstid		tids[DECODER_MAX_ELEMS];
+	Datum		datums[DECODER_MAX_ELEMS];
+	bool		isnulls[DECODER_MAX_ELEMS];
+	bool		first = true;
+	int64		prevval = PG_INT64_MIN;
+
+	Assert(attlen > 0 && attlen <= sizeof(int64));
+
+	while (p < pend)
+	{
+		int			nelems;
+
+		p += decode_chunk(true, attlen, &lasttid, p, &nelems,
+						  tids, datums, isnulls);
+
+		for (int i = 0; i < nelems; i++)
+		{
+			int64		val;
+
+			if (isnulls[i])
+				return false;
+
+			switch (attlen)
+			{
+				case sizeof(int16):
+					val = DatumGetInt16(datums[i]);
+					break;
+				case sizeof(int32):
+					val = DatumGetInt32(datums[i]);
+					break;
+				default:
+					val = DatumGetInt64(datums[i]);
+					break;
+			}
+			if (val < prevval)
+				return false;
+			if (first)
+			{
+				*firstval = val;
+				first = false;
+			}
+			prevval = val;
+		}
+	}
+	Assert(p == pend);
+
+	return true;
+}
 
 #ifdef USE_ASSERT_CHECKING
 static void
@@ -1244,6 +1894,84 @@ print_attstream(int attlen, char *chunk, int len)
  * ----------------------------------------------------------------------------
  */
 
+/* ----------------------------------------------------------------------------
+ * Bit-packing helpers, used by the dictionary and frame-of-reference modes.
+ *
+ * Packs an array of integers of 'nbits' bits each, starting from the least
+ * significant bit of each byte. The packed array is padded to a full byte.
+ * ----------------------------------------------------------------------------
+ */
+#define BITPACK_MAX_BITS			56
+#define BITPACK_BYTES(nbits)		(((nbits) + 7) / 8)
+
+/* Write 'nvals' values of 'nbits' bits each to 'p'. Returns end pointer. */
+static char *
+bitpack_put(char *p, int nvals, uint64 *vals, int nbits)
+{
+	uint64		acc = 0;
+	int			accbits = 0;
+
+	Assert(nbits <= BITPACK_MAX_BITS);
+	if (nbits == 0)
+		return p;
+
+	for (int i = 0; i < nvals; i++)
+	{
+		acc |= (uint64) vals[i] << accbits;
+		accbits += nbits;
+		while (accbits >= 8)
+		{
+			*(p++) = (char) (acc & 0xFF);
+			acc >>= 8;
+			accbits -= 8;
+		}
+	}
+	if (accbits > 0)
+		*(p++) = (char) (acc & 0xFF);
+
+	return p;
+}
+
+/* Read 'nvals' values of 'nbits' bits each from 'p'. Returns end pointer. */
+static char *
+bitpack_get(char *p, int nvals, uint64 *vals, int nbits)
+{
+	uint64		acc = 0;
+	int			accbits = 0;
+	uint64		mask = (UINT64CONST(1) << nbits) - 1;
+
+	if (nbits == 0)
+	{
+		memset(vals, 0, nvals * sizeof(uint64));
+		return p;
+	}
+
+	for (int i = 0; i < nvals; i++)
+	{
+		while (accbits < nbits)
+		{
+			acc |= (uint64) (uint8) *(p++) << accbits;
+			accbits += 8;
+		}
+		vals[i] = acc & mask;
+		acc >>= nbits;
+		accbits -= nbits;
+	}
+
+	return p;
+}
+
+/* Number of bits needed to represent 'val' */
+static inline int
+bitpack_width(uint64 val)
+{
+	int			bits = 0;
+
+	while (bits < 64 && (val >> bits) != 0)
+		bits++;
+	return bits;
+}
+
 /*
  * FIXED-LENGTH CODEWORD MODES
  * ---------------------------
@@ -1340,6 +2068,77 @@ print_attstream(int attlen, char *chunk, int len)
  *          one TID, 59 bits
  *          NULL bit
  *
+ * mode 15 has four unused bits, so we use those to encode extended modes:
+ *
+ * run:     1111 0001 wwwwwwwN CCCCCCxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ *
+ *          A run of 'C' + 1 consecutive TIDs, all with the same value.
+ *          40 bits for the first TID, the rest are implicit
+ *          NULL bit, for a run of NULLs
+ *          one datum follows, unless it's a run of NULLs
+ *
+ * The run mode is used when at least ZS_RUN_MIN_LENGTH consecutive TIDs have
+ * the same value. That's common with sorted or low-cardinality columns, like
+ * flags, dates or foreign keys to a small dimension table. A run chunk holds at
+ * most 60 TIDs, like the other modes, but it only stores the value once.
+ *
+ * for:     1111 0010 TTTTBBBB BBCCCCCC xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ *
+ *          Frame-of-reference encoding of 'C' + 1 non-NULL 4- or 8-byte
+ *          pass-by-value integers (int4, int8, date, timestamp etc.)
+ *          40 bits for the first TID
+ *          T: bits used for each subsequent TID delta (0-15)
+ *          B: bits used for each value (0-56)
+ *
+ *          The codeword is followed by the minimum and maximum value in the
+ *          chunk (attlen bytes each), the bit-packed TID deltas, and the
+ *          bit-packed values, each stored as the difference from the minimum.
+ *
+ * The frame-of-reference mode is used for values that are close to each
+ * other, like sequences or timestamps of events that arrive in order. The
+ * values are packed much more densely than in the other modes, and the min
+ * and max of the chunk can be read without decoding the whole chunk.
+ *
+ * packed:  1111 0011 TTTTBBBB BNCCCCCC xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ *
+ *          Bit-packed encoding of 'C' + 1 1- or 2-byte pass-by-value values
+ *          (bool, "char", int2), NULLs allowed
+ *          40 bits for the first TID
+ *          T: bits used for each subsequent TID delta (0-15)
+ *          B: bits used for each value (0-16)
+ *          N: a NULL bitmap follows
+ *
+ *          The codeword is followed by the minimum value in the chunk (attlen
+ *          bytes), the NULL bitmap (one bit per element, if N is set), the
+ *          bit-packed TID deltas, and the bit-packed values, each stored as
+ *          the difference from the minimum. NULLs are stored as 0.
+ *
+ * The packed mode is the narrow-type counterpart of frame-of-reference. A
+ * boolean column takes one bit per value instead of a full byte, and so do
+ * other flags and small-domain int2 columns.
+ *
+ * xor:     1111 0100 TTTT0000 00CCCCCC xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ *
+ *          XOR encoding of 'C' + 1 non-NULL 4- or 8-byte pass-by-value values
+ *          40 bits for the first TID
+ *          T: bits used for each subsequent TID delta (0-15)
+ *
+ *          The codeword is followed by the length of the XOR stream in bytes
+ *          (uint16), the first value (attlen bytes), the bit-packed TID
+ *          deltas, and the XOR stream. Each subsequent value is XORed with
+ *          the previous one, and the result is stored as a single 0 bit if
+ *          it's zero, as '10' and the meaningful bits if they fall within the
+ *          previous value's window of meaningful bits, and otherwise as '11',
+ *          the number of leading zeros (6 bits), the number of meaningful
+ *          bits minus one (6 bits) and the meaningful bits.
+ *
+ * The xor mode is for floating point columns, typically metrics that change
+ * slowly. Consecutive values share the sign, the exponent and the high bits
+ * of the mantissa, which the page-level compression can't exploit because
+ * they're not byte-aligned. It's tried on any 4- or 8-byte pass-by-value
+ * values that frame-of-reference can't handle, as the attstream doesn't know
+ * the data type.
+ *
  * XXX: we store the first TID in the low bits, and subsequent TIDs in higher bits. Not
  * sure if that's how it's usually done...
  *
@@ -1374,588 +2173,2625 @@ static const struct codeword_mode
 	{0, 0, false}				/* sentinel */
 };
 
-static int
-get_chunk_length_fixed(int attlen, char *chunk)
-{
-	uint64		codeword;
+#define ZS_FIXED_EXTENDED_MODE		15
+#define ZS_FIXED_SUBMODE(codeword)	(((codeword) >> 56) & 0x0F)
+#define ZS_FIXED_SUBMODE_RUN		1
 
-	memcpy(&codeword, chunk, sizeof(uint64));
+#define ZS_RUN_FIRSTTID_BITS		40
+#define ZS_RUN_NULL_BIT				(UINT64CONST(1) << 46)
+#define ZS_RUN_MIN_LENGTH			8
+#define ZS_RUN_MAX_LENGTH			60
 
-	{
-		int			selector = (codeword >> 60);
-		int			nints = fixed_width_modes[selector].num_ints;
-		int			bits = fixed_width_modes[selector].bits_per_int;
-		bool		has_nulls = fixed_width_modes[selector].nullbitmap;
-		int			num_nulls;
+static inline bool
+is_fixed_run_chunk(uint64 codeword)
+{
+	return (codeword >> 60) == ZS_FIXED_EXTENDED_MODE &&
+		ZS_FIXED_SUBMODE(codeword) == ZS_FIXED_SUBMODE_RUN;
+}
 
-		/* skip over the TIDs */
-		codeword >>= bits * nints;
+static inline int
+fixed_run_length(uint64 codeword)
+{
+	return ((codeword >> ZS_RUN_FIRSTTID_BITS) & 0x3F) + 1;
+}
 
-		num_nulls = 0;
-		if (has_nulls)
-		{
-			/* count set bits in the NULL bitmap */
-			for (int i = 0; i < nints; i++)
-			{
-				 if (codeword & 1)
-					 num_nulls++;
-				 codeword >>= 1;
-			 }
-		 }
-		return sizeof(uint64) + (nints - num_nulls) * attlen;
-	}
+static inline int
+fixed_run_chunk_size(uint64 codeword, int attlen)
+{
+	return sizeof(uint64) + ((codeword & ZS_RUN_NULL_BIT) ? 0 : attlen);
 }
 
-static zstid
-get_chunk_first_tid_fixed(int attlen, char *chunk)
+/*
+ * Are two non-NULL datums of a fixed-width type equal, as far as their
+ * stored representation is concerned?
+ */
+static inline bool
+fixed_datums_equal(bool attbyval, int attlen, Datum a, Datum b)
 {
-	uint64		codeword;
+	if (!attbyval)
+		return memcmp(DatumGetPointer(a), DatumGetPointer(b), attlen) == 0;
+
+	if (attlen == sizeof(Datum))
+		return a == b;
+	else if (attlen == sizeof(int32))
+		return DatumGetInt32(a) == DatumGetInt32(b);
+	else if (attlen == sizeof(int16))
+		return DatumGetInt16(a) == DatumGetInt16(b);
+	else if (attlen == sizeof(char))
+		return DatumGetChar(a) == DatumGetChar(b);
+	else
+		elog(ERROR, "unsupported byval length: %d", attlen);
+	return false;				/* keep compiler quiet */
+}
 
-	memcpy(&codeword, chunk, sizeof(uint64));
+/*
+ * Count the number of leading elements that can be encoded as one run.
+ */
+static int
+fixed_run_count(bool attbyval, int attlen, int ntids,
+				zstid *tids, Datum *datums, bool *isnulls)
+{
+	int			n;
 
+	for (n = 1; n < ntids && n < ZS_RUN_MAX_LENGTH; n++)
 	{
-		int			selector = (codeword >> 60);
-		int			bits = fixed_width_modes[selector].bits_per_int;
-		uint64		mask = (UINT64CONST(1) << bits) - 1;
-
-		/* get first tid */
-		return (codeword & mask);
+		if (tids[n] != tids[n - 1] + 1)
+			break;
+		if (isnulls[n] != isnulls[0])
+			break;
+		if (!isnulls[0] &&
+			!fixed_datums_equal(attbyval, attlen, datums[n], datums[0]))
+			break;
 	}
+	return n;
 }
 
-static bool
-replace_first_tid_fixed(int attlen, zstid newtid, char *chunk)
+static int
+decode_chunk_fixed_run(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+					   int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
 {
+	char	   *p = chunk;
 	uint64		codeword;
+	int			nelems;
+	zstid		tid;
+	Datum		datum;
+	bool		isnull;
 
-	memcpy(&codeword, chunk, sizeof(uint64));
-
-	{
-		int			selector = (codeword >> 60);
-		int			bits = fixed_width_modes[selector].bits_per_int;
-		uint64		mask = (UINT64CONST(1) << bits) - 1;
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
 
-		/* get first tid */
-		if (newtid >= (1 << bits))
-			return false;
+	nelems = fixed_run_length(codeword);
+	tid = *lasttid + (codeword & ((UINT64CONST(1) << ZS_RUN_FIRSTTID_BITS) - 1));
+	isnull = (codeword & ZS_RUN_NULL_BIT) != 0;
 
-		/* zero out the TID */
-		codeword &= ~mask;
-		codeword |= newtid;
+	if (isnull)
+		datum = (Datum) 0;
+	else if (attbyval)
+	{
+		/* FIXME: the code below ignores alignment. 'p' might not be aligned */
+		if (attlen == sizeof(Datum))
+			datum = *((Datum *) p);
+		else if (attlen == sizeof(int32))
+			datum = Int32GetDatum(*(int32 *) p);
+		else if (attlen == sizeof(int16))
+			datum = Int16GetDatum(*(int16 *) p);
+		else if (attlen == sizeof(char))
+			datum = CharGetDatum(*p);
+		else
+			elog(ERROR, "unsupported byval length: %d", attlen);
+		p += attlen;
+	}
+	else
+	{
+		/* all the elements in the run share the same copy */
+		char	   *datump = palloc(attlen);
 
-		memcpy(chunk, &codeword, sizeof(uint64));
+		memcpy(datump, p, attlen);
+		datum = PointerGetDatum(datump);
+		p += attlen;
+	}
 
-		return true;
+	for (int i = 0; i < nelems; i++)
+	{
+		tids[i] = tid + i;
+		datums[i] = datum;
+		isnulls[i] = isnull;
 	}
+	*lasttid = tid + nelems - 1;
+	*num_elems = nelems;
+
+	return p - chunk;
 }
 
 static int
-skip_chunk_fixed(int attlen, char *chunk, zstid *lasttid)
+encode_chunk_fixed_run(attstream_buffer *dst, zstid prevtid, int nelems,
+					   zstid *tids, Datum *datums, bool *isnulls)
 {
-	zstid		prevtid = *lasttid;
-	char	   *p = chunk;
+	bool		attbyval = dst->attbyval;
+	int16		attlen = dst->attlen;
 	uint64		codeword;
+	char	   *p;
 
-	memcpy(&codeword, p, sizeof(uint64));
+	Assert(nelems >= 1 && nelems <= ZS_RUN_MAX_LENGTH);
+	Assert(tids[0] - prevtid < (UINT64CONST(1) << ZS_RUN_FIRSTTID_BITS));
+
+	codeword = (uint64) ZS_FIXED_EXTENDED_MODE << 60;
+	codeword |= (uint64) ZS_FIXED_SUBMODE_RUN << 56;
+	if (isnulls[0])
+		codeword |= ZS_RUN_NULL_BIT;
+	codeword |= (uint64) (nelems - 1) << ZS_RUN_FIRSTTID_BITS;
+	codeword |= tids[0] - prevtid;
+
+	enlarge_attstream_buffer(dst, sizeof(uint64) + attlen);
+	p = &dst->data[dst->len];
+	memcpy(p, (char *) &codeword, sizeof(uint64));
 	p += sizeof(uint64);
 
+	if (!isnulls[0])
 	{
-		int			selector = (codeword >> 60);
-		int			nints = fixed_width_modes[selector].num_ints;
-		int			bits = fixed_width_modes[selector].bits_per_int;
-		bool		has_nulls = fixed_width_modes[selector].nullbitmap;
-		uint64		mask = (UINT64CONST(1) << bits) - 1;
-		int			num_nulls;
-		zstid		tid = prevtid;
-
-		for (int i = 0; i < nints; i++)
-		{
-			uint64		val = codeword & mask;
+		/* FIXME: the code below ignores alignment. 'p' might not be aligned */
+		if (!attbyval)
+			memcpy(p, DatumGetPointer(datums[0]), attlen);
+		else if (attlen == sizeof(Datum))
+			*((Datum *) p) = datums[0];
+		else if (attlen == sizeof(int32))
+			*((int32 *) p) = DatumGetInt32(datums[0]);
+		else if (attlen == sizeof(int16))
+			*((int16 *) p) = DatumGetInt16(datums[0]);
+		else if (attlen == sizeof(char))
+			*p = DatumGetChar(datums[0]);
+		else
+			elog(ERROR, "unsupported byval length: %d", attlen);
+		p += attlen;
+	}
 
-			tid += val;
-			codeword >>= bits;
-		}
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
 
-		num_nulls = 0;
-		if (has_nulls)
-		{
-			/* count set bits in the NULL bitmap */
-			for (int i = 0; i < nints; i++)
-			{
-				if (codeword & 1)
-					num_nulls++;
-				codeword >>= 1;
-			}
-		 }
+	return nelems;
+}
 
-		/* ignore the datums */
-		*lasttid = tid;
-		return sizeof(uint64) + (nints - num_nulls) * attlen;
-	 }
+#define ZS_FIXED_SUBMODE_FOR		2
+
+#define ZS_FOR_FIRSTTID_BITS		40
+#define ZS_FOR_MAX_TIDBITS			15
+#define ZS_FOR_MIN_LENGTH			8
+#define ZS_FOR_MAX_LENGTH			60
+
+static inline bool
+is_fixed_for_chunk(uint64 codeword)
+{
+	return (codeword >> 60) == ZS_FIXED_EXTENDED_MODE &&
+		ZS_FIXED_SUBMODE(codeword) == ZS_FIXED_SUBMODE_FOR;
+}
+
+static inline int
+fixed_for_length(uint64 codeword)
+{
+	return ((codeword >> ZS_FOR_FIRSTTID_BITS) & 0x3F) + 1;
+}
+
+static inline int
+fixed_for_valbits(uint64 codeword)
+{
+	return (codeword >> 46) & 0x3F;
+}
+
+static inline int
+fixed_for_tidbits(uint64 codeword)
+{
+	return (codeword >> 52) & 0x0F;
+}
+
+static inline int
+fixed_for_chunk_size(uint64 codeword, int attlen)
+{
+	int			nelems = fixed_for_length(codeword);
+
+	return sizeof(uint64) + 2 * attlen +
+		BITPACK_BYTES((nelems - 1) * fixed_for_tidbits(codeword)) +
+		BITPACK_BYTES(nelems * fixed_for_valbits(codeword));
+}
+
+static inline int64
+fixed_for_get_value(int attlen, Datum d)
+{
+	if (attlen == sizeof(int64))
+		return DatumGetInt64(d);
+	else
+		return (int64) DatumGetInt32(d);
+}
+
+static inline Datum
+fixed_for_make_datum(int attlen, int64 val)
+{
+	if (attlen == sizeof(int64))
+		return Int64GetDatum(val);
+	else
+		return Int32GetDatum((int32) val);
 }
 
 static int
-decode_chunk_fixed(bool attbyval, int attlen, zstid *lasttid, char *chunk,
-				   int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+decode_chunk_fixed_for(int attlen, zstid *lasttid, char *chunk,
+					   int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
 {
 	char	   *p = chunk;
 	uint64		codeword;
+	int			nelems;
+	int			tidbits;
+	int			valbits;
+	int64		minval;
+	uint64		vals[ZS_FOR_MAX_LENGTH];
+	zstid		tid;
 
 	memcpy(&codeword, p, sizeof(uint64));
 	p += sizeof(uint64);
 
+	nelems = fixed_for_length(codeword);
+	tidbits = fixed_for_tidbits(codeword);
+	valbits = fixed_for_valbits(codeword);
+
+	if (attlen == sizeof(int64))
 	{
-		int			selector = (codeword >> 60);
-		int			bits = fixed_width_modes[selector].bits_per_int;
-		bool		has_nulls = fixed_width_modes[selector].nullbitmap;
-		int			nints = fixed_width_modes[selector].num_ints;
-		uint64		mask = (UINT64CONST(1) << bits) - 1;
-		zstid		tid = *lasttid;
-		uint64		nullbitmap;
+		int64		v;
 
-		for (int i = 0; i < nints; i++)
+		memcpy(&v, p, sizeof(int64));
+		minval = v;
+	}
+	else
+	{
+		int32		v;
+
+		memcpy(&v, p, sizeof(int32));
+		minval = v;
+	}
+	/* skip over min and max */
+	p += 2 * attlen;
+
+	tid = *lasttid + (codeword & ((UINT64CONST(1) << ZS_FOR_FIRSTTID_BITS) - 1));
+	tids[0] = tid;
+	p = bitpack_get(p, nelems - 1, vals, tidbits);
+	for (int i = 1; i < nelems; i++)
+	{
+		tid += vals[i - 1] + 1;
+		tids[i] = tid;
+	}
+	*lasttid = tid;
+
+	p = bitpack_get(p, nelems, vals, valbits);
+	for (int i = 0; i < nelems; i++)
+	{
+		datums[i] = fixed_for_make_datum(attlen, (int64) ((uint64) minval + vals[i]));
+		isnulls[i] = false;
+	}
+
+	*num_elems = nelems;
+	return p - chunk;
+}
+
+/*
+ * Try to encode the datums using the frame-of-reference mode.
+ *
+ * Returns the number of datums encoded, or 0 if the mode isn't suitable
+ * for the input, in which case nothing is written.
+ */
+static int
+encode_chunk_fixed_for(attstream_buffer *dst, zstid prevtid, int ntids,
+					   zstid *tids, Datum *datums, bool *isnulls)
+{
+	int16		attlen = dst->attlen;
+	uint64		tiddeltas[ZS_FOR_MAX_LENGTH];
+	uint64		vals[ZS_FOR_MAX_LENGTH];
+	uint64		maxtiddelta = 0;
+	int64		minval;
+	int64		maxval;
+	int			maxvalbits;
+	int			tidbits;
+	int			valbits;
+	int			size;
+	int			n;
+	uint64		codeword;
+	char	   *p;
+
+	if (tids[0] - prevtid >= (UINT64CONST(1) << ZS_FOR_FIRSTTID_BITS) || isnulls[0])
+		return 0;
+
+	/*
+	 * Accept values as long as the range of values stays narrow enough to
+	 * save at least a quarter of the space.
+	 */
+	maxvalbits = attlen * 8 * 3 / 4;
+	minval = maxval = fixed_for_get_value(attlen, datums[0]);
+	for (n = 1; n < ntids && n < ZS_FOR_MAX_LENGTH; n++)
+	{
+		uint64		tiddelta;
+		int64		val;
+		int64		newmin;
+		int64		newmax;
+
+		if (isnulls[n])
+			break;
+
+		tiddelta = tids[n] - tids[n - 1] - 1;
+		if (tiddelta >= (UINT64CONST(1) << ZS_FOR_MAX_TIDBITS))
+			break;
+
+		val = fixed_for_get_value(attlen, datums[n]);
+		newmin = Min(minval, val);
+		newmax = Max(maxval, val);
+		if (bitpack_width((uint64) newmax - (uint64) newmin) > maxvalbits)
+			break;
+
+		minval = newmin;
+		maxval = newmax;
+		tiddeltas[n - 1] = tiddelta;
+		maxtiddelta = Max(maxtiddelta, tiddelta);
+	}
+
+	if (n < ZS_FOR_MIN_LENGTH)
+		return 0;
+
+	tidbits = bitpack_width(maxtiddelta);
+	valbits = bitpack_width((uint64) maxval - (uint64) minval);
+	size = sizeof(uint64) + 2 * attlen +
+		BITPACK_BYTES((n - 1) * tidbits) +
+		BITPACK_BYTES(n * valbits);
+
+	/* Is it worth it, compared to storing the values as is? */
+	if (size >= n * attlen + sizeof(uint64))
+		return 0;
+
+	for (int i = 0; i < n; i++)
+		vals[i] = (uint64) fixed_for_get_value(attlen, datums[i]) - (uint64) minval;
+
+	codeword = (uint64) ZS_FIXED_EXTENDED_MODE << 60;
+	codeword |= (uint64) ZS_FIXED_SUBMODE_FOR << 56;
+	codeword |= (uint64) tidbits << 52;
+	codeword |= (uint64) valbits << 46;
+	codeword |= (uint64) (n - 1) << ZS_FOR_FIRSTTID_BITS;
+	codeword |= tids[0] - prevtid;
+
+	enlarge_attstream_buffer(dst, size);
+	p = &dst->data[dst->len];
+	memcpy(p, (char *) &codeword, sizeof(uint64));
+	p += sizeof(uint64);
+
+	if (attlen == sizeof(int64))
+	{
+		memcpy(p, &minval, sizeof(int64));
+		memcpy(p + sizeof(int64), &maxval, sizeof(int64));
+	}
+	else
+	{
+		int32		v;
+
+		v = (int32) minval;
+		memcpy(p, &v, sizeof(int32));
+		v = (int32) maxval;
+		memcpy(p + sizeof(int32), &v, sizeof(int32));
+	}
+	p += 2 * attlen;
+
+	p = bitpack_put(p, n - 1, tiddeltas, tidbits);
+	p = bitpack_put(p, n, vals, valbits);
+
+	Assert(p - &dst->data[dst->len] == size);
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
+
+	return n;
+}
+
+#define ZS_FIXED_SUBMODE_PACKED		3
+
+#define ZS_PACKED_FIRSTTID_BITS		40
+#define ZS_PACKED_MAX_TIDBITS		15
+#define ZS_PACKED_MIN_LENGTH		16
+#define ZS_PACKED_MAX_LENGTH		60
+
+static inline bool
+is_fixed_packed_chunk(uint64 codeword)
+{
+	return (codeword >> 60) == ZS_FIXED_EXTENDED_MODE &&
+		ZS_FIXED_SUBMODE(codeword) == ZS_FIXED_SUBMODE_PACKED;
+}
+
+static inline int
+fixed_packed_length(uint64 codeword)
+{
+	return ((codeword >> ZS_PACKED_FIRSTTID_BITS) & 0x3F) + 1;
+}
+
+static inline bool
+fixed_packed_has_nulls(uint64 codeword)
+{
+	return (codeword >> 46) & 1;
+}
+
+static inline int
+fixed_packed_valbits(uint64 codeword)
+{
+	return (codeword >> 47) & 0x1F;
+}
+
+static inline int
+fixed_packed_tidbits(uint64 codeword)
+{
+	return (codeword >> 52) & 0x0F;
+}
+
+static inline int
+fixed_packed_chunk_size(uint64 codeword, int attlen)
+{
+	int			nelems = fixed_packed_length(codeword);
+
+	return sizeof(uint64) + attlen +
+		(fixed_packed_has_nulls(codeword) ? BITPACK_BYTES(nelems) : 0) +
+		BITPACK_BYTES((nelems - 1) * fixed_packed_tidbits(codeword)) +
+		BITPACK_BYTES(nelems * fixed_packed_valbits(codeword));
+}
+
+static inline int64
+fixed_packed_get_value(int attlen, Datum d)
+{
+	if (attlen == sizeof(int16))
+		return (int64) DatumGetInt16(d);
+	else
+		return (int64) DatumGetChar(d);
+}
+
+static inline Datum
+fixed_packed_make_datum(int attlen, int64 val)
+{
+	if (attlen == sizeof(int16))
+		return Int16GetDatum((int16) val);
+	else
+		return CharGetDatum((char) val);
+}
+
+static int
+decode_chunk_fixed_packed(int attlen, zstid *lasttid, char *chunk,
+						  int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	char	   *p = chunk;
+	uint64		codeword;
+	int			nelems;
+	int			tidbits;
+	int			valbits;
+	int64		minval;
+	uint64		vals[ZS_PACKED_MAX_LENGTH];
+	zstid		tid;
+
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
+
+	nelems = fixed_packed_length(codeword);
+	tidbits = fixed_packed_tidbits(codeword);
+	valbits = fixed_packed_valbits(codeword);
+
+	if (attlen == sizeof(int16))
+	{
+		int16		v;
+
+		memcpy(&v, p, sizeof(int16));
+		minval = v;
+	}
+	else
+		minval = *((char *) p);
+	p += attlen;
+
+	if (fixed_packed_has_nulls(codeword))
+	{
+		for (int i = 0; i < nelems; i++)
+			isnulls[i] = (p[i / 8] >> (i % 8)) & 1;
+		p += BITPACK_BYTES(nelems);
+	}
+	else
+		memset(isnulls, 0, nelems * sizeof(bool));
+
+	tid = *lasttid + (codeword & ((UINT64CONST(1) << ZS_PACKED_FIRSTTID_BITS) - 1));
+	tids[0] = tid;
+	p = bitpack_get(p, nelems - 1, vals, tidbits);
+	for (int i = 1; i < nelems; i++)
+	{
+		tid += vals[i - 1] + 1;
+		tids[i] = tid;
+	}
+	*lasttid = tid;
+
+	p = bitpack_get(p, nelems, vals, valbits);
+	for (int i = 0; i < nelems; i++)
+	{
+		if (isnulls[i])
+			datums[i] = (Datum) 0;
+		else
+			datums[i] = fixed_packed_make_datum(attlen, (int64) ((uint64) minval + vals[i]));
+	}
+
+	*num_elems = nelems;
+	return p - chunk;
+}
+
+/*
+ * Try to encode the datums using the packed mode.
+ *
+ * Returns the number of datums encoded, or 0 if the mode isn't suitable
+ * for the input, in which case nothing is written.
+ */
+static int
+encode_chunk_fixed_packed(attstream_buffer *dst, zstid prevtid, int ntids,
+						  zstid *tids, Datum *datums, bool *isnulls)
+{
+	int16		attlen = dst->attlen;
+	uint64		tiddeltas[ZS_PACKED_MAX_LENGTH];
+	uint64		vals[ZS_PACKED_MAX_LENGTH];
+	uint64		maxtiddelta = 0;
+	bool		have_value = false;
+	bool		has_nulls = false;
+	int64		minval = 0;
+	int64		maxval = 0;
+	int			maxvalbits;
+	int			tidbits;
+	int			valbits;
+	int			size;
+	int			n;
+	uint64		codeword;
+	char	   *p;
+
+	if (tids[0] - prevtid >= (UINT64CONST(1) << ZS_PACKED_FIRSTTID_BITS))
+		return 0;
+
+	/*
+	 * Accept values as long as the range of values stays narrow enough to
+	 * save at least a quarter of the space. For booleans, that's any input.
+	 */
+	maxvalbits = attlen * 8 * 3 / 4;
+	for (n = 0; n < ntids && n < ZS_PACKED_MAX_LENGTH; n++)
+	{
+		if (n > 0)
 		{
-			uint64		val = codeword & mask;
+			uint64		tiddelta = tids[n] - tids[n - 1] - 1;
 
-			tid = tid + val;
-			tids[i] = tid;
-			codeword >>= bits;
+			if (tiddelta >= (UINT64CONST(1) << ZS_PACKED_MAX_TIDBITS))
+				break;
+			tiddeltas[n - 1] = tiddelta;
 		}
-		*lasttid = tid;
 
-		if (has_nulls)
-			nullbitmap = codeword & UINT64CONST(0x0FFFFFFFFFFFFF);
+		if (isnulls[n])
+			has_nulls = true;
 		else
-			nullbitmap = 0;
+		{
+			int64		val = fixed_packed_get_value(attlen, datums[n]);
+			int64		newmin = have_value ? Min(minval, val) : val;
+			int64		newmax = have_value ? Max(maxval, val) : val;
 
-		/* datums follow */
-		if (attbyval)
+			if (bitpack_width((uint64) newmax - (uint64) newmin) > maxvalbits)
+				break;
+			minval = newmin;
+			maxval = newmax;
+			have_value = true;
+		}
+
+		if (n > 0)
+			maxtiddelta = Max(maxtiddelta, tiddeltas[n - 1]);
+	}
+
+	if (n < ZS_PACKED_MIN_LENGTH)
+		return 0;
+
+	tidbits = bitpack_width(maxtiddelta);
+	valbits = bitpack_width((uint64) maxval - (uint64) minval);
+	size = sizeof(uint64) + attlen +
+		(has_nulls ? BITPACK_BYTES(n) : 0) +
+		BITPACK_BYTES((n - 1) * tidbits) +
+		BITPACK_BYTES(n * valbits);
+
+	/* Is it worth it, compared to storing the values as is? */
+	if (size >= n * attlen + sizeof(uint64))
+		return 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		if (isnulls[i])
+			vals[i] = 0;
+		else
+			vals[i] = (uint64) fixed_packed_get_value(attlen, datums[i]) - (uint64) minval;
+	}
+
+	codeword = (uint64) ZS_FIXED_EXTENDED_MODE << 60;
+	codeword |= (uint64) ZS_FIXED_SUBMODE_PACKED << 56;
+	codeword |= (uint64) tidbits << 52;
+	codeword |= (uint64) valbits << 47;
+	codeword |= (uint64) (has_nulls ? 1 : 0) << 46;
+	codeword |= (uint64) (n - 1) << ZS_PACKED_FIRSTTID_BITS;
+	codeword |= tids[0] - prevtid;
+
+	enlarge_attstream_buffer(dst, size);
+	p = &dst->data[dst->len];
+	memcpy(p, (char *) &codeword, sizeof(uint64));
+	p += sizeof(uint64);
+
+	if (attlen == sizeof(int16))
+	{
+		int16		v = (int16) minval;
+
+		memcpy(p, &v, sizeof(int16));
+	}
+	else
+		*p = (char) minval;
+	p += attlen;
+
+	if (has_nulls)
+	{
+		memset(p, 0, BITPACK_BYTES(n));
+		for (int i = 0; i < n; i++)
 		{
-			if (nullbitmap == 0)
-			{
-				/* FIXME: the loops below ignore alignment. 'p' might not be aligned */
-				if (attlen == sizeof(Datum))
-				{
-					for (int i = 0; i < nints; i++)
-					{
-						datums[i] = *((Datum *) p);
-						isnulls[i] = false;
-						p += sizeof(Datum);
-					}
-				}
-				else if (attlen == sizeof(int32))
-				{
-					for (int i = 0; i < nints; i++)
-					{
-						datums[i] = Int32GetDatum(*(int32 *) p);
-						isnulls[i] = false;
-						p += sizeof(int32);
-					}
-				}
-				else if (attlen == sizeof(int16))
-				{
+			if (isnulls[i])
+				p[i / 8] |= 1 << (i % 8);
+		}
+		p += BITPACK_BYTES(n);
+	}
+
+	p = bitpack_put(p, n - 1, tiddeltas, tidbits);
+	p = bitpack_put(p, n, vals, valbits);
+
+	Assert(p - &dst->data[dst->len] == size);
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
+
+	return n;
+}
+
+#define ZS_FIXED_SUBMODE_XOR		4
+
+#define ZS_XOR_FIRSTTID_BITS		40
+#define ZS_XOR_MAX_TIDBITS			15
+#define ZS_XOR_MIN_LENGTH			8
+#define ZS_XOR_MAX_LENGTH			60
+/* worst case: 2 control bits, 12 bits of window and 64 meaningful bits */
+#define ZS_XOR_MAX_STREAM_BYTES		BITPACK_BYTES(ZS_XOR_MAX_LENGTH * 78)
+
+static inline bool
+is_fixed_xor_chunk(uint64 codeword)
+{
+	return (codeword >> 60) == ZS_FIXED_EXTENDED_MODE &&
+		ZS_FIXED_SUBMODE(codeword) == ZS_FIXED_SUBMODE_XOR;
+}
+
+static inline int
+fixed_xor_length(uint64 codeword)
+{
+	return ((codeword >> ZS_XOR_FIRSTTID_BITS) & 0x3F) + 1;
+}
+
+static inline int
+fixed_xor_tidbits(uint64 codeword)
+{
+	return (codeword >> 52) & 0x0F;
+}
+
+static inline int
+fixed_xor_chunk_size(char *chunk, int attlen)
+{
+	uint64		codeword;
+	uint16		streamlen;
+
+	memcpy(&codeword, chunk, sizeof(uint64));
+	memcpy(&streamlen, chunk + sizeof(uint64), sizeof(uint16));
+
+	return sizeof(uint64) + sizeof(uint16) + attlen +
+		BITPACK_BYTES((fixed_xor_length(codeword) - 1) * fixed_xor_tidbits(codeword)) +
+		streamlen;
+}
+
+static inline uint64
+fixed_xor_get_bits(int attlen, Datum d)
+{
+	if (attlen == sizeof(int64))
+		return (uint64) DatumGetInt64(d);
+	else
+		return (uint64) (uint32) DatumGetInt32(d);
+}
+
+static inline Datum
+fixed_xor_make_datum(int attlen, uint64 bits)
+{
+	if (attlen == sizeof(int64))
+		return Int64GetDatum((int64) bits);
+	else
+		return Int32GetDatum((int32) (uint32) bits);
+}
+
+/*
+ * Bit stream used by the XOR mode. Unlike bitpack_put/get, the width of each
+ * field varies. Fields wider than 32 bits are written in two parts, so that
+ * the accumulator never overflows.
+ */
+typedef struct
+{
+	char	   *p;
+	uint64		acc;
+	int			accbits;
+} xor_bitstream;
+
+static inline void
+xor_put_bits(xor_bitstream *bs, uint64 val, int nbits)
+{
+	if (nbits > 32)
+	{
+		xor_put_bits(bs, val & 0xFFFFFFFF, 32);
+		val >>= 32;
+		nbits -= 32;
+	}
+	bs->acc |= val << bs->accbits;
+	bs->accbits += nbits;
+	while (bs->accbits >= 8)
+	{
+		*(bs->p++) = (char) (bs->acc & 0xFF);
+		bs->acc >>= 8;
+		bs->accbits -= 8;
+	}
+}
+
+static inline void
+xor_flush_bits(xor_bitstream *bs)
+{
+	if (bs->accbits > 0)
+		*(bs->p++) = (char) (bs->acc & 0xFF);
+	bs->acc = 0;
+	bs->accbits = 0;
+}
+
+static inline uint64
+xor_get_bits(xor_bitstream *bs, int nbits)
+{
+	uint64		val;
+
+	if (nbits > 32)
+	{
+		val = xor_get_bits(bs, 32);
+		return val | (xor_get_bits(bs, nbits - 32) << 32);
+	}
+	while (bs->accbits < nbits)
+	{
+		bs->acc |= (uint64) (uint8) *(bs->p++) << bs->accbits;
+		bs->accbits += 8;
+	}
+	val = bs->acc & ((UINT64CONST(1) << nbits) - 1);
+	bs->acc >>= nbits;
+	bs->accbits -= nbits;
+	return val;
+}
+
+static int
+decode_chunk_fixed_xor(int attlen, zstid *lasttid, char *chunk,
+					   int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	char	   *p = chunk;
+	uint64		codeword;
+	uint16		streamlen;
+	int			nelems;
+	int			tidbits;
+	int			valbits = attlen * 8;
+	uint64		tiddeltas[ZS_XOR_MAX_LENGTH];
+	uint64		prev;
+	int			lead = 0;
+	int			trail = 0;
+	xor_bitstream bs;
+	zstid		tid;
+
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
+	memcpy(&streamlen, p, sizeof(uint16));
+	p += sizeof(uint16);
+
+	nelems = fixed_xor_length(codeword);
+	tidbits = fixed_xor_tidbits(codeword);
+
+	if (attlen == sizeof(int64))
+		memcpy(&prev, p, sizeof(uint64));
+	else
+	{
+		uint32		v;
+
+		memcpy(&v, p, sizeof(uint32));
+		prev = v;
+	}
+	p += attlen;
+
+	tid = *lasttid + (codeword & ((UINT64CONST(1) << ZS_XOR_FIRSTTID_BITS) - 1));
+	tids[0] = tid;
+	p = bitpack_get(p, nelems - 1, tiddeltas, tidbits);
+	for (int i = 1; i < nelems; i++)
+	{
+		tid += tiddeltas[i - 1] + 1;
+		tids[i] = tid;
+	}
+	*lasttid = tid;
+
+	datums[0] = fixed_xor_make_datum(attlen, prev);
+	isnulls[0] = false;
+
+	bs.p = p;
+	bs.acc = 0;
+	bs.accbits = 0;
+	for (int i = 1; i < nelems; i++)
+	{
+		if (xor_get_bits(&bs, 1) != 0)
+		{
+			if (xor_get_bits(&bs, 1) != 0)
+			{
+				lead = xor_get_bits(&bs, 6);
+				trail = valbits - lead - (xor_get_bits(&bs, 6) + 1);
+			}
+			prev ^= xor_get_bits(&bs, valbits - lead - trail) << trail;
+		}
+		datums[i] = fixed_xor_make_datum(attlen, prev);
+		isnulls[i] = false;
+	}
+	Assert(bs.p <= p + streamlen);
+	p += streamlen;
+
+	*num_elems = nelems;
+	return p - chunk;
+}
+
+/*
+ * Try to encode the datums using the XOR mode.
+ *
+ * Returns the number of datums encoded, or 0 if the mode isn't suitable
+ * for the input, in which case nothing is written.
+ */
+static int
+encode_chunk_fixed_xor(attstream_buffer *dst, zstid prevtid, int ntids,
+					   zstid *tids, Datum *datums, bool *isnulls)
+{
+	int16		attlen = dst->attlen;
+	int			valbits = attlen * 8;
+	uint64		tiddeltas[ZS_XOR_MAX_LENGTH];
+	uint64		maxtiddelta = 0;
+	char		stream[ZS_XOR_MAX_STREAM_BYTES];
+	xor_bitstream bs;
+	uint64		first;
+	uint64		prev;
+	int			lead = -1;
+	int			trail = 0;
+	uint16		streamlen;
+	int			tidbits;
+	int			size;
+	int			n;
+	uint64		codeword;
+	char	   *p;
+
+	if (tids[0] - prevtid >= (UINT64CONST(1) << ZS_XOR_FIRSTTID_BITS) || isnulls[0])
+		return 0;
+
+	bs.p = stream;
+	bs.acc = 0;
+	bs.accbits = 0;
+	first = prev = fixed_xor_get_bits(attlen, datums[0]);
+	for (n = 1; n < ntids && n < ZS_XOR_MAX_LENGTH; n++)
+	{
+		uint64		tiddelta;
+		uint64		val;
+		uint64		x;
+
+		if (isnulls[n])
+			break;
+
+		tiddelta = tids[n] - tids[n - 1] - 1;
+		if (tiddelta >= (UINT64CONST(1) << ZS_XOR_MAX_TIDBITS))
+			break;
+		tiddeltas[n - 1] = tiddelta;
+		maxtiddelta = Max(maxtiddelta, tiddelta);
+
+		val = fixed_xor_get_bits(attlen, datums[n]);
+		x = val ^ prev;
+		if (x == 0)
+			xor_put_bits(&bs, 0, 1);
+		else
+		{
+			int			thislead = valbits - 1 - pg_leftmost_one_pos64(x);
+			int			thistrail = pg_rightmost_one_pos64(x);
+
+			if (lead >= 0 && thislead >= lead && thistrail >= trail)
+			{
+				/* fits in the previous window */
+				xor_put_bits(&bs, 1, 2);
+			}
+			else
+			{
+				lead = thislead;
+				trail = thistrail;
+				xor_put_bits(&bs, 3, 2);
+				xor_put_bits(&bs, lead, 6);
+				xor_put_bits(&bs, valbits - lead - trail - 1, 6);
+			}
+			xor_put_bits(&bs, x >> trail, valbits - lead - trail);
+		}
+		prev = val;
+	}
+	xor_flush_bits(&bs);
+
+	if (n < ZS_XOR_MIN_LENGTH)
+		return 0;
+
+	streamlen = bs.p - stream;
+	tidbits = bitpack_width(maxtiddelta);
+	size = sizeof(uint64) + sizeof(uint16) + attlen +
+		BITPACK_BYTES((n - 1) * tidbits) +
+		streamlen;
+
+	/*
+	 * Is it worth it, compared to storing the values as is? The plain values
+	 * compress better at the page level, so require the XOR stream to save
+	 * at least a quarter of the space.
+	 */
+	if (size * 4 > (n * attlen + sizeof(uint64)) * 3)
+		return 0;
+
+	codeword = (uint64) ZS_FIXED_EXTENDED_MODE << 60;
+	codeword |= (uint64) ZS_FIXED_SUBMODE_XOR << 56;
+	codeword |= (uint64) tidbits << 52;
+	codeword |= (uint64) (n - 1) << ZS_XOR_FIRSTTID_BITS;
+	codeword |= tids[0] - prevtid;
+
+	enlarge_attstream_buffer(dst, size);
+	p = &dst->data[dst->len];
+	memcpy(p, (char *) &codeword, sizeof(uint64));
+	p += sizeof(uint64);
+	memcpy(p, &streamlen, sizeof(uint16));
+	p += sizeof(uint16);
+
+	if (attlen == sizeof(int64))
+		memcpy(p, &first, sizeof(uint64));
+	else
+	{
+		uint32		v = (uint32) first;
+
+		memcpy(p, &v, sizeof(uint32));
+	}
+	p += attlen;
+
+	p = bitpack_put(p, n - 1, tiddeltas, tidbits);
+	memcpy(p, stream, streamlen);
+	p += streamlen;
+
+	Assert(p - &dst->data[dst->len] == size);
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
+
+	return n;
+}
+
+static int
+get_chunk_length_fixed(int attlen, char *chunk)
+{
+	uint64		codeword;
+
+	memcpy(&codeword, chunk, sizeof(uint64));
+
+	if (is_fixed_run_chunk(codeword))
+		return fixed_run_chunk_size(codeword, attlen);
+	if (is_fixed_for_chunk(codeword))
+		return fixed_for_chunk_size(codeword, attlen);
+	if (is_fixed_packed_chunk(codeword))
+		return fixed_packed_chunk_size(codeword, attlen);
+	if (is_fixed_xor_chunk(codeword))
+		return fixed_xor_chunk_size(chunk, attlen);
+
+	{
+		int			selector = (codeword >> 60);
+		int			nints = fixed_width_modes[selector].num_ints;
+		int			bits = fixed_width_modes[selector].bits_per_int;
+		bool		has_nulls = fixed_width_modes[selector].nullbitmap;
+		int			num_nulls;
+
+		/* skip over the TIDs */
+		codeword >>= bits * nints;
+
+		num_nulls = 0;
+		if (has_nulls)
+		{
+			/* count set bits in the NULL bitmap */
+			for (int i = 0; i < nints; i++)
+			{
+				 if (codeword & 1)
+					 num_nulls++;
+				 codeword >>= 1;
+			 }
+		 }
+		return sizeof(uint64) + (nints - num_nulls) * attlen;
+	}
+}
+
+static zstid
+get_chunk_first_tid_fixed(int attlen, char *chunk)
+{
+	uint64		codeword;
+
+	memcpy(&codeword, chunk, sizeof(uint64));
+
+	{
+		int			selector = (codeword >> 60);
+		int			bits = fixed_width_modes[selector].bits_per_int;
+		uint64		mask;
+
+		if (is_fixed_run_chunk(codeword))
+			bits = ZS_RUN_FIRSTTID_BITS;
+		else if (is_fixed_for_chunk(codeword))
+			bits = ZS_FOR_FIRSTTID_BITS;
+		else if (is_fixed_packed_chunk(codeword))
+			bits = ZS_PACKED_FIRSTTID_BITS;
+		else if (is_fixed_xor_chunk(codeword))
+			bits = ZS_XOR_FIRSTTID_BITS;
+		mask = (UINT64CONST(1) << bits) - 1;
+
+		/* get first tid */
+		return (codeword & mask);
+	}
+}
+
+static bool
+replace_first_tid_fixed(int attlen, zstid newtid, char *chunk)
+{
+	uint64		codeword;
+
+	memcpy(&codeword, chunk, sizeof(uint64));
+
+	{
+		int			selector = (codeword >> 60);
+		int			bits = fixed_width_modes[selector].bits_per_int;
+		uint64		mask;
+
+		if (is_fixed_run_chunk(codeword))
+			bits = ZS_RUN_FIRSTTID_BITS;
+		else if (is_fixed_for_chunk(codeword))
+			bits = ZS_FOR_FIRSTTID_BITS;
+		else if (is_fixed_packed_chunk(codeword))
+			bits = ZS_PACKED_FIRSTTID_BITS;
+		else if (is_fixed_xor_chunk(codeword))
+			bits = ZS_XOR_FIRSTTID_BITS;
+		mask = (UINT64CONST(1) << bits) - 1;
+
+		/* get first tid */
+		if (newtid >= (UINT64CONST(1) << bits))
+			return false;
+
+		/* zero out the TID */
+		codeword &= ~mask;
+		codeword |= newtid;
+
+		memcpy(chunk, &codeword, sizeof(uint64));
+
+		return true;
+	}
+}
+
+static int
+skip_chunk_fixed(int attlen, char *chunk, zstid *lasttid)
+{
+	zstid		prevtid = *lasttid;
+	char	   *p = chunk;
+	uint64		codeword;
+
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
+
+	if (is_fixed_run_chunk(codeword))
+	{
+		*lasttid = prevtid +
+			(codeword & ((UINT64CONST(1) << ZS_RUN_FIRSTTID_BITS) - 1)) +
+			fixed_run_length(codeword) - 1;
+		return fixed_run_chunk_size(codeword, attlen);
+	}
+	if (is_fixed_for_chunk(codeword))
+	{
+		zstid		tids[ZS_FOR_MAX_LENGTH];
+		Datum		datums[ZS_FOR_MAX_LENGTH];
+		bool		isnulls[ZS_FOR_MAX_LENGTH];
+		int			n;
+
+		return decode_chunk_fixed_for(attlen, lasttid, chunk, &n, tids, datums, isnulls);
+	}
+	if (is_fixed_packed_chunk(codeword))
+	{
+		zstid		tids[ZS_PACKED_MAX_LENGTH];
+		Datum		datums[ZS_PACKED_MAX_LENGTH];
+		bool		isnulls[ZS_PACKED_MAX_LENGTH];
+		int			n;
+
+		return decode_chunk_fixed_packed(attlen, lasttid, chunk, &n, tids, datums, isnulls);
+	}
+	if (is_fixed_xor_chunk(codeword))
+	{
+		zstid		tids[ZS_XOR_MAX_LENGTH];
+		Datum		datums[ZS_XOR_MAX_LENGTH];
+		bool		isnulls[ZS_XOR_MAX_LENGTH];
+		int			n;
+
+		return decode_chunk_fixed_xor(attlen, lasttid, chunk, &n, tids, datums, isnulls);
+	}
+
+	{
+		int			selector = (codeword >> 60);
+		int			nints = fixed_width_modes[selector].num_ints;
+		int			bits = fixed_width_modes[selector].bits_per_int;
+		bool		has_nulls = fixed_width_modes[selector].nullbitmap;
+		uint64		mask = (UINT64CONST(1) << bits) - 1;
+		int			num_nulls;
+		zstid		tid = prevtid;
+
+		for (int i = 0; i < nints; i++)
+		{
+			uint64		val = codeword & mask;
+
+			tid += val;
+			codeword >>= bits;
+		}
+
+		num_nulls = 0;
+		if (has_nulls)
+		{
+			/* count set bits in the NULL bitmap */
+			for (int i = 0; i < nints; i++)
+			{
+				if (codeword & 1)
+					num_nulls++;
+				codeword >>= 1;
+			}
+		 }
+
+		/* ignore the datums */
+		*lasttid = tid;
+		return sizeof(uint64) + (nints - num_nulls) * attlen;
+	 }
+}
+
+/*
+ * Decode a fixed-width chunk.
+ *
+ * This is inlined into a separate function for each common attlen, with
+ * 'attbyval' and 'attlen' known at compile time, so that the loops below
+ * compile into straight-line code without the checks on them. See
+ * choose_chunk_decoder().
+ */
+static pg_attribute_always_inline int
+decode_chunk_fixed_guts(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+						int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	char	   *p = chunk;
+	uint64		codeword;
+
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
+
+	if (is_fixed_run_chunk(codeword))
+		return decode_chunk_fixed_run(attbyval, attlen, lasttid, chunk,
+									  num_elems, tids, datums, isnulls);
+	if (is_fixed_for_chunk(codeword))
+		return decode_chunk_fixed_for(attlen, lasttid, chunk,
+									  num_elems, tids, datums, isnulls);
+	if (is_fixed_packed_chunk(codeword))
+		return decode_chunk_fixed_packed(attlen, lasttid, chunk,
+										 num_elems, tids, datums, isnulls);
+	if (is_fixed_xor_chunk(codeword))
+		return decode_chunk_fixed_xor(attlen, lasttid, chunk,
+									  num_elems, tids, datums, isnulls);
+
+	{
+		int			selector = (codeword >> 60);
+		int			bits = fixed_width_modes[selector].bits_per_int;
+		bool		has_nulls = fixed_width_modes[selector].nullbitmap;
+		int			nints = fixed_width_modes[selector].num_ints;
+		uint64		mask = (UINT64CONST(1) << bits) - 1;
+		zstid		tid = *lasttid;
+		uint64		nullbitmap;
+
+		for (int i = 0; i < nints; i++)
+		{
+			uint64		val = codeword & mask;
+
+			tid = tid + val;
+			tids[i] = tid;
+			codeword >>= bits;
+		}
+		*lasttid = tid;
+
+		if (has_nulls)
+			nullbitmap = codeword & UINT64CONST(0x0FFFFFFFFFFFFF);
+		else
+			nullbitmap = 0;
+
+		/* datums follow */
+		if (attbyval)
+		{
+			if (nullbitmap == 0)
+			{
+				/* FIXME: the loops below ignore alignment. 'p' might not be aligned */
+				if (attlen == sizeof(Datum))
+				{
+					for (int i = 0; i < nints; i++)
+					{
+						datums[i] = *((Datum *) p);
+						isnulls[i] = false;
+						p += sizeof(Datum);
+					}
+				}
+				else if (attlen == sizeof(int32))
+				{
+					for (int i = 0; i < nints; i++)
+					{
+						datums[i] = Int32GetDatum(*(int32 *) p);
+						isnulls[i] = false;
+						p += sizeof(int32);
+					}
+				}
+				else if (attlen == sizeof(int16))
+				{
+					for (int i = 0; i < nints; i++)
+					{
+						datums[i] = DatumGetInt16(*(int16 *) p);
+						isnulls[i] = false;
+						p += sizeof(int16);
+					}
+				}
+				else if (attlen == sizeof(char))
+				{
+					for (int i = 0; i < nints; i++)
+					{
+						datums[i] = CharGetDatum(*p);
+						isnulls[i] = false;
+						p++;
+					}
+				}
+				else
+					elog(ERROR, "unsupported byval length: %d", attlen);
+			}
+			else
+			{
+				/* FIXME: the loops below ignore alignment. 'p' might not be aligned */
+				if (attlen == sizeof(Datum))
+				{
 					for (int i = 0; i < nints; i++)
 					{
-						datums[i] = DatumGetInt16(*(int16 *) p);
-						isnulls[i] = false;
-						p += sizeof(int16);
+						if ((nullbitmap & (1 << i)) == 0)
+						{
+							datums[i] = *((Datum *) p);
+							isnulls[i] = false;
+							p += sizeof(Datum);
+						}
+						else
+						{
+							datums[i] = (Datum) 0;
+							isnulls[i] = true;
+						}
+					}
+				}
+				else if (attlen == sizeof(int32))
+				{
+					for (int i = 0; i < nints; i++)
+					{
+						if ((nullbitmap & (1 << i)) == 0)
+						{
+							datums[i] = Int32GetDatum(*(int32 *) p);
+							isnulls[i] = false;
+							p += sizeof(int32);
+						}
+						else
+						{
+							datums[i] = (Datum) 0;
+							isnulls[i] = true;
+						}
+					}
+				}
+				else if (attlen == sizeof(int16))
+				{
+					for (int i = 0; i < nints; i++)
+					{
+						if ((nullbitmap & (1 << i)) == 0)
+						{
+							datums[i] = DatumGetInt16(*(int16 *) p);
+							isnulls[i] = false;
+							p += sizeof(int16);
+						}
+						else
+						{
+							datums[i] = (Datum) 0;
+							isnulls[i] = true;
+						}
 					}
 				}
 				else if (attlen == sizeof(char))
 				{
 					for (int i = 0; i < nints; i++)
 					{
-						datums[i] = CharGetDatum(*p);
-						isnulls[i] = false;
-						p++;
+						if ((nullbitmap & (1 << i)) == 0)
+						{
+							datums[i] = CharGetDatum(*p);
+							isnulls[i] = false;
+							p++;
+						}
+						else
+						{
+							datums[i] = (Datum) 0;
+							isnulls[i] = true;
+						}
 					}
 				}
 				else
 					elog(ERROR, "unsupported byval length: %d", attlen);
 			}
+		}
+		else
+		{
+			char	   *datumbuf = palloc(MAXALIGN(attlen) * nints); /* XXX: attalign */
+			char	   *datump = datumbuf;
+
+			for (int i = 0; i < nints; i++)
+			{
+				if ((nullbitmap & (1 << i)) == 0)
+				{
+					memcpy(datump, p, attlen);
+					datums[i] = PointerGetDatum(datump);
+					isnulls[i] = false;
+					p += attlen;
+					datump += MAXALIGN(attlen);
+				}
+				else
+				{
+					datums[i] = (Datum) 0;
+					isnulls[i] = true;
+				}
+			}
+		}
+
+		*num_elems = nints;
+		return p - chunk;
+	}
+}
+
+static int
+decode_chunk_fixed(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+				   int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	return decode_chunk_fixed_guts(attbyval, attlen, lasttid, chunk,
+								   num_elems, tids, datums, isnulls);
+}
+
+#if SIZEOF_DATUM == 8
+static int
+decode_chunk_fixed_int64(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+						 int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	return decode_chunk_fixed_guts(true, sizeof(int64), lasttid, chunk,
+								   num_elems, tids, datums, isnulls);
+}
+#endif
+
+static int
+decode_chunk_fixed_int32(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+						 int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	return decode_chunk_fixed_guts(true, sizeof(int32), lasttid, chunk,
+								   num_elems, tids, datums, isnulls);
+}
+
+static int
+decode_chunk_fixed_int16(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+						 int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	return decode_chunk_fixed_guts(true, sizeof(int16), lasttid, chunk,
+								   num_elems, tids, datums, isnulls);
+}
+
+static int
+decode_chunk_fixed_char(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+						int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	return decode_chunk_fixed_guts(true, sizeof(char), lasttid, chunk,
+								   num_elems, tids, datums, isnulls);
+}
+
+static int
+encode_chunk_fixed(attstream_buffer *dst, zstid prevtid, int ntids,
+				   zstid *tids, Datum *datums, bool *isnulls)
+{
+	/*
+	 * Select the "mode" to use for this codeword.
+	 *
+	 * In each iteration, check if the next value can be represented in the
+	 * current mode we're considering.  If it's too large, then step up the
+	 * mode to a wider one, and repeat.  If it fits, move on to the next
+	 * integer.  Repeat until the codeword is full, given the current mode.
+	 *
+	 * Note that we don't have any way to represent unused slots in the
+	 * codeword, so we require each codeword to be "full".  It is always
+	 * possible to produce a full codeword unless the very first delta is too
+	 * large to be encoded.  For example, if the first delta is small but the
+	 * second is too large to be encoded, we'll end up using the last "mode",
+	 * which has nints == 1.
+	 */
+	bool		attbyval = dst->attbyval;
+	int16		attlen = dst->attlen;
+	int			selector;
+	int			this_nints;
+	int			this_bits;
+	bool		this_supports_nulls;
+	uint64		val;
+	int			i;
+	bool		has_nulls;
+	int			size = sizeof(uint64);
+	uint64		codeword;
+	uint64		deltas[60];
+	char		*p;
+	int			runlen;
+
+	/*
+	 * If the input begins with a run of identical values, encode it as
+	 * a run. Otherwise, stop the regular chunk where the next run begins,
+	 * so that the run can be encoded as a run chunk.
+	 */
+	if (ntids >= ZS_RUN_MIN_LENGTH &&
+		tids[0] - prevtid < (UINT64CONST(1) << ZS_RUN_FIRSTTID_BITS))
+	{
+		runlen = fixed_run_count(attbyval, attlen, ntids, tids, datums, isnulls);
+		if (runlen >= ZS_RUN_MIN_LENGTH)
+			return encode_chunk_fixed_run(dst, prevtid, runlen, tids, datums, isnulls);
+	}
+	runlen = 1;
+	for (i = 1; i < ntids && i < 60; i++)
+	{
+		if (tids[i] == tids[i - 1] + 1 &&
+			isnulls[i] == isnulls[i - 1] &&
+			(isnulls[i] ||
+			 fixed_datums_equal(attbyval, attlen, datums[i], datums[i - 1])))
+		{
+			if (++runlen >= ZS_RUN_MIN_LENGTH)
+			{
+				if (i - runlen + 1 > 0)
+					ntids = i - runlen + 1;
+				break;
+			}
+		}
+		else
+			runlen = 1;
+	}
+
+	/* Try frame-of-reference encoding for integers */
+	if (attbyval && (attlen == sizeof(int32) || attlen == sizeof(int64)) &&
+		ntids >= ZS_FOR_MIN_LENGTH)
+	{
+		int			nencoded;
+
+		nencoded = encode_chunk_fixed_for(dst, prevtid, ntids, tids, datums, isnulls);
+		if (nencoded > 0)
+			return nencoded;
+	}
+
+	/* Try XOR encoding for floats and other values that didn't fit above */
+	if (attbyval && (attlen == sizeof(int32) || attlen == sizeof(int64)) &&
+		ntids >= ZS_XOR_MIN_LENGTH)
+	{
+		int			nencoded;
+
+		nencoded = encode_chunk_fixed_xor(dst, prevtid, ntids, tids, datums, isnulls);
+		if (nencoded > 0)
+			return nencoded;
+	}
+
+	/* Try bit-packing booleans and other narrow types */
+	if (attbyval && (attlen == sizeof(int16) || attlen == sizeof(char)) &&
+		ntids >= ZS_PACKED_MIN_LENGTH)
+	{
+		int			nencoded;
+
+		nencoded = encode_chunk_fixed_packed(dst, prevtid, ntids, tids, datums, isnulls);
+		if (nencoded > 0)
+			return nencoded;
+	}
+
+	selector = 0;
+	this_nints = fixed_width_modes[0].num_ints;
+	this_bits = fixed_width_modes[0].bits_per_int;
+	this_supports_nulls = fixed_width_modes[0].nullbitmap;
+
+	val = tids[0] - prevtid;
+	has_nulls = isnulls[0];
+	i = 0;
+	for (;;)
+	{
+		if (val >= (UINT64CONST(1) << this_bits) ||
+			(has_nulls && !this_supports_nulls))
+		{
+			/* Too large, or need NULL bitmap. Step up to next mode */
+			selector++;
+			this_nints = fixed_width_modes[selector].num_ints;
+			this_bits = fixed_width_modes[selector].bits_per_int;
+			this_supports_nulls = fixed_width_modes[selector].nullbitmap;
+
+			/* we might already have accepted enough deltas for this mode */
+			if (i >= this_nints)
+				break;
+		}
+		else
+		{
+			/* accept this delta; then done if codeword is full */
+			deltas[i] = val;
+			if (!isnulls[i])
+				size += attlen;
+			i++;
+			if (i >= this_nints)
+				break;
+			/* examine next delta */
+			if (i < ntids && size + attlen <= TARGET_CHUNK_SIZE)
+			{
+				has_nulls |= isnulls[i];
+				val = tids[i] - tids[i - 1];
+			}
 			else
 			{
-				/* FIXME: the loops below ignore alignment. 'p' might not be aligned */
-				if (attlen == sizeof(Datum))
-				{
-					for (int i = 0; i < nints; i++)
-					{
-						if ((nullbitmap & (1 << i)) == 0)
-						{
-							datums[i] = *((Datum *) p);
-							isnulls[i] = false;
-							p += sizeof(Datum);
-						}
-						else
-						{
-							datums[i] = (Datum) 0;
-							isnulls[i] = true;
-						}
-					}
-				}
-				else if (attlen == sizeof(int32))
+				/*
+				 * Reached end of input. Pretend that the next integer is a
+				 * value that's too large to represent in Simple-8b, so that
+				 * we fall out.
+				 */
+				val = PG_UINT64_MAX;
+			}
+		}
+	}
+
+	Assert(i > 0);
+
+	/*
+	 * Encode the integers using the selected mode.
+	 */
+	codeword = 0;
+	if (has_nulls)
+	{
+		for (int i = 0; i < this_nints; i++)
+			codeword |= isnulls[i] ? (1 << i) : 0;
+		codeword <<= this_nints * this_bits;
+	}
+	for (int i = 0; i < this_nints; i++)
+		codeword |= deltas[i] << (i * this_bits);
+
+	/* add selector to the codeword, and return */
+	codeword |= (uint64) selector << 60;
+
+	/*
+	 * Note: 'size' is too large at this point, if we had to "back down" to a
+	 * less dense mode. That's fine for sizing the destination buffer, but we
+	 * can't rely on it for the final size of the chunk.
+	 */
+	enlarge_attstream_buffer(dst, size);
+	p = &dst->data[dst->len];
+	memcpy(p, (char *) &codeword, sizeof(uint64));
+	p += sizeof(uint64);
+
+	/*
+	 * Now, the data
+	 */
+
+	/* FIXME: the loops below ignore alignment. 'p' might not be aligned */
+	if (attbyval)
+	{
+		if (attlen == sizeof(Datum))
+		{
+			for (int i = 0; i < this_nints; i++)
+			{
+				if (!isnulls[i])
 				{
-					for (int i = 0; i < nints; i++)
-					{
-						if ((nullbitmap & (1 << i)) == 0)
-						{
-							datums[i] = Int32GetDatum(*(int32 *) p);
-							isnulls[i] = false;
-							p += sizeof(int32);
-						}
-						else
-						{
-							datums[i] = (Datum) 0;
-							isnulls[i] = true;
-						}
-					}
+					*((Datum *) p) = datums[i];
+					p += sizeof(Datum);
 				}
-				else if (attlen == sizeof(int16))
+			}
+		}
+		else if (attlen == sizeof(int32))
+		{
+			for (int i = 0; i < this_nints; i++)
+			{
+				if (!isnulls[i])
 				{
-					for (int i = 0; i < nints; i++)
-					{
-						if ((nullbitmap & (1 << i)) == 0)
-						{
-							datums[i] = DatumGetInt16(*(int16 *) p);
-							isnulls[i] = false;
-							p += sizeof(int16);
-						}
-						else
-						{
-							datums[i] = (Datum) 0;
-							isnulls[i] = true;
-						}
-					}
+					*((int32 *) p) = DatumGetInt32(datums[i]);
+					p += sizeof(int32);
 				}
-				else if (attlen == sizeof(char))
+			}
+		}
+		else if (attlen == sizeof(int16))
+		{
+			for (int i = 0; i < this_nints; i++)
+			{
+				if (!isnulls[i])
 				{
-					for (int i = 0; i < nints; i++)
-					{
-						if ((nullbitmap & (1 << i)) == 0)
-						{
-							datums[i] = CharGetDatum(*p);
-							isnulls[i] = false;
-							p++;
-						}
-						else
-						{
-							datums[i] = (Datum) 0;
-							isnulls[i] = true;
-						}
-					}
+					*((int16 *) p) = DatumGetInt16(datums[i]);
+					p += sizeof(int16);
 				}
-				else
-					elog(ERROR, "unsupported byval length: %d", attlen);
+			}
+		}
+		else if (attlen == sizeof(char))
+		{
+			for (int i = 0; i < this_nints; i++)
+			{
+				if (!isnulls[i])
+					*(p++) = DatumGetChar(datums[i]);
 			}
 		}
 		else
+			elog(ERROR, "unsupported byval length: %d", attlen);
+	}
+	else
+	{
+		for (int i = 0; i < this_nints; i++)
 		{
-			char	   *datumbuf = palloc(MAXALIGN(attlen) * nints); /* XXX: attalign */
-			char	   *datump = datumbuf;
-
-			for (int i = 0; i < nints; i++)
+			if (!isnulls[i])
 			{
-				if ((nullbitmap & (1 << i)) == 0)
-				{
-					memcpy(datump, p, attlen);
-					datums[i] = PointerGetDatum(datump);
-					isnulls[i] = false;
-					p += attlen;
-					datump += MAXALIGN(attlen);
-				}
-				else
-				{
-					datums[i] = (Datum) 0;
-					isnulls[i] = true;
-				}
+				memcpy(p, DatumGetPointer(datums[i]), attlen);
+				p += attlen;
 			}
 		}
+	}
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
+
+	return this_nints;
+}
+
+/*
+ * VARIABLE-SIZE MODES
+ * -------------------
+ *
+ * These are used with varlenas. With varlenas, we encode not only the
+ * TIDs and NULLness of each datum, but also its length, in the same
+ * codeword. The value 0 stored in the length field is used to represent
+ * a NULL; there is no separate NULL bitmap. For non-NULLs, the value
+ * stored in the length is the real length + 1.
+ *
+ * We don't track a maximum size for the chunk during encoding, but the
+ * fact that we use a smallish number of bits to store the length, depending
+ * on the mode, puts a cap on the max chunk size. For example, in mode 4,
+ * we encode 10 TIDs in a codeword with 4 bits to store the length. With four
+ * bits, each datum can be max 14 bytes long. That limits the max size of a
+ * chunk in mode 4 to 10*14 = 140 bytes. Below table shows the modes with the
+ * number of bits use for the TID and length of each datum, and the maximum
+ * chunk size they give (not including the size of the codeword itself)
+ *
+ * mode    tidbits lenbits wasted  ntids   maxsize
+ * 0       1       1       0       30      30
+ * 1       1       2       0       20      40
+ * 2       1       3       0       15      90
+ * 3       2       3       0       12      72
+ * 4       2       4       0       10      140
+ * 5       3       4       4       8       112
+ * 6       4       4       4       7       98
+ * 7       5       5       0       6       180
+ * 8       6       6       0       5       310
+ * 9       8       7       0       4       504
+ * 10      13      7       0       3       378
+ * 11      23      7       0       2       252
+ * 12      45      15      0       1       32766
+ * 13 dictionary
+ * 14 toast
+ * 15 extended
+ *
+ * Mode 13 is a dictionary mode, for columns with few distinct values.
+ * See the DICTIONARY MODE section below.
+ *
+ * Mode 15 is used for extended modes, like the fixed-width mode 15. See the
+ * EXTENDED MODES section below.
+ *
+ * Mode 14 is special: It is used to encode a toasted datum. The toast
+ * datum is compressed with toast_compress_datum(). Unlike the other
+ * modes, the toast mode lenbits field is overloaded and is used to
+ * identify where the toast datum is stored. The toast datum could be
+ * stored either inline or in separate toast pages. The TID of the
+ * datum is stored in the codeword as is. If the toast datum is stored
+ * inline, then after the codeword comes the zs_toast_header_inline
+ * followed by the datum. If the toast datum is stored in separate
+ * toast pages, then after the codeword comes the block number of the
+ * first toast block, as a 32-bit integer.
+ *
+ * FIXME: Mode 12 is the widest mode, but it only uses up to 45 bits for
+ * the TID. That's not enough to cover the whole range of valid zstids.
+ * I think we need one more special mode, where we use full 60 bits for
+ * the TID, with the length stored separately after the codeword, for
+ * the odd case that you have a very large datum with a very high TID.
+ */
+static const struct
+{
+	uint8		bits_per_tid;
+	uint8		lenbits;
+	uint8		num_ints;
+} varlen_modes[17] =
+{
+	{ 1,   1,   30 },	/* mode 0 */
+	{ 1,   2,   20 },	/* mode 1 */
+	{ 1,   3,   15 },	/* mode 2 */
+	{ 2,   3,   12 },	/* mode 3 */
+	{ 2,   4,   10 },	/* mode 4 */
+	{ 3,   4,   8  },	/* mode 5 */
+	{ 4,   4,   7  },	/* mode 6 */
+	{ 5,   5,   6  },	/* mode 7 */
+	{ 6,   6,   5  },	/* mode 8 */
+	{ 8,   7,   4  },	/* mode 9 */
+	{ 13,  7,   3  },	/* mode 10 */
+	{ 23,  7,   2  },	/* mode 11 */
+	{ 45,  15,  1  },	/* mode 12 */
+
+	/* special modes */
+	{ 43, 0, 0 },	/* mode 13 (dictionary) */
+	{ 48, 12, 1 },	/* mode 14 (toast) */
+	{ 33, 0, 0 },	/* mode 15 (extended) */
+
+	{ 0, 0, 0 }		/* sentinel */
+};
+
+#define ZS_VARLENA_INLINE_TOAST 1
+#define ZS_VARLENA_TOAST_PAGE 0
+
+typedef struct zs_toast_header_external {
+	BlockNumber toast_blkno;
+} zs_toast_header_external;
+
+typedef struct zs_toast_header_inline
+{
+	uint32 compressed_size;
+	uint32 rawsize;
+} zs_toast_header_inline;
+
+/*
+ * DICTIONARY MODE
+ * ---------------
+ *
+ * Mode 13 is used for chunks of varlenas with few distinct values. Each
+ * distinct value is stored once in a small chunk-local dictionary, and each
+ * datum is represented by an index into the dictionary. The codeword looks
+ * like this:
+ *
+ * 1101 CCCCCC BBBBB DDDDDD xxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ *
+ *          C: number of datums in the chunk, minus one (6 bits)
+ *          B: number of bits used for each TID delta after the first (5 bits)
+ *          D: number of entries in the dictionary (6 bits)
+ *          x: delta of the first TID (43 bits)
+ *
+ * The codeword is followed by:
+ *
+ * 1. The deltas of the 2nd and subsequent TIDs, minus one, B bits each.
+ *    On a freshly loaded table, the TIDs are consecutive, so B is 0 and this
+ *    takes no space at all.
+ * 2. An index into the dictionary for each datum. 0 means NULL, 1..D are
+ *    dictionary entries. The indexes are just wide enough to hold D.
+ * 3. The dictionary. Each entry is a 1-byte length, followed by the data.
+ *
+ * The TID deltas and the indexes are bit-packed, starting from the least
+ * significant bit of each byte, and each array is padded to a full byte.
+ *
+ * The dictionary is local to the chunk, so that chunks remain independent
+ * of each other, and can be split, merged and moved between pages like any
+ * other chunk. To keep the dictionary small, we only use this mode for
+ * short values, and only if it actually saves space compared to the
+ * regular modes.
+ *
+ * When decoding, the datums with the same value all point to the same
+ * copy of the dictionary entry.
+ */
+#define ZS_VARLENA_DICT_MODE			13
+#define ZS_DICT_MAX_ELEMS				60
+#define ZS_DICT_MAX_ENTRIES				63
+#define ZS_DICT_MAX_ENTRY_LEN			255
+#define ZS_DICT_FIRSTTID_BITS			43
+#define ZS_DICT_MAX_TIDBITS				31
+
+static int
+dict_chunk_num_elements(uint64 codeword)
+{
+	return ((codeword >> 54) & 0x3F) + 1;
+}
+
+/*
+ * Decode a dictionary chunk. If 'datums' is NULL, only the TIDs are
+ * decoded. Returns the size of the chunk.
+ */
+static int
+decode_chunk_varlen_dict(zstid *lasttid, char *chunk,
+						 int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	char	   *p = chunk;
+	uint64		codeword;
+	int			nelems;
+	int			tidbits;
+	int			ndict;
+	int			idxbits;
+	uint64		vals[ZS_DICT_MAX_ELEMS];
+	uint64		idx[ZS_DICT_MAX_ELEMS];
+	zstid		tid;
+	char	   *dictp;
+	Size		dictsize = 0;
+	Datum		dict[ZS_DICT_MAX_ENTRIES + 1];
+
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
+
+	nelems = dict_chunk_num_elements(codeword);
+	tidbits = (codeword >> 49) & 0x1F;
+	ndict = (codeword >> 43) & 0x3F;
+	idxbits = bitpack_width(ndict);
+
+	tid = *lasttid + (codeword & ((UINT64CONST(1) << ZS_DICT_FIRSTTID_BITS) - 1));
+	tids[0] = tid;
+	p = bitpack_get(p, nelems - 1, vals, tidbits);
+	for (int i = 1; i < nelems; i++)
+	{
+		tid += (zstid) vals[i - 1] + 1;
+		tids[i] = tid;
+	}
+	*lasttid = tid;
+
+	p = bitpack_get(p, nelems, idx, idxbits);
+
+	/* Find the end of the dictionary */
+	dictp = p;
+	for (int j = 0; j < ndict; j++)
+	{
+		int			len = (uint8) *p;
+
+		dictsize += MAXALIGN(VARHDRSZ + len);
+		p += 1 + len;
+	}
+
+	if (datums)
+	{
+		char	   *datump;
+
+		/* Materialize each dictionary entry once */
+		datump = palloc(Max(dictsize, 1));
+		dict[0] = (Datum) 0;
+		for (int j = 1; j <= ndict; j++)
+		{
+			int			len = (uint8) *dictp;
+
+			memcpy(VARDATA(datump), dictp + 1, len);
+			SET_VARSIZE(datump, len + VARHDRSZ);
+			dict[j] = PointerGetDatum(datump);
+
+			datump += MAXALIGN(VARHDRSZ + len);
+			dictp += 1 + len;
+		}
 
-		*num_elems = nints;
-		return p - chunk;
+		for (int i = 0; i < nelems; i++)
+		{
+			if (idx[i] > ndict)
+				elog(ERROR, "invalid dictionary index " UINT64_FORMAT " in zedstore chunk with %d entries",
+					 idx[i], ndict);
+			datums[i] = dict[idx[i]];
+			isnulls[i] = (idx[i] == 0);
+		}
 	}
+
+	*num_elems = nelems;
+	return p - chunk;
 }
 
+/*
+ * Try to encode the datums using the dictionary mode.
+ *
+ * Returns the number of datums encoded, or 0 if the dictionary mode isn't
+ * suitable for the input, in which case nothing is written.
+ */
 static int
-encode_chunk_fixed(attstream_buffer *dst, zstid prevtid, int ntids,
-				   zstid *tids, Datum *datums, bool *isnulls)
+encode_chunk_varlen_dict(attstream_buffer *dst, zstid prevtid, int ntids,
+						 zstid *tids, Datum *datums, bool *isnulls)
 {
-	/*
-	 * Select the "mode" to use for this codeword.
-	 *
-	 * In each iteration, check if the next value can be represented in the
-	 * current mode we're considering.  If it's too large, then step up the
-	 * mode to a wider one, and repeat.  If it fits, move on to the next
-	 * integer.  Repeat until the codeword is full, given the current mode.
-	 *
-	 * Note that we don't have any way to represent unused slots in the
-	 * codeword, so we require each codeword to be "full".  It is always
-	 * possible to produce a full codeword unless the very first delta is too
-	 * large to be encoded.  For example, if the first delta is small but the
-	 * second is too large to be encoded, we'll end up using the last "mode",
-	 * which has nints == 1.
-	 */
-	bool		attbyval = dst->attbyval;
-	int16		attlen = dst->attlen;
-	int			selector;
-	int			this_nints;
-	int			this_bits;
-	bool		this_supports_nulls;
-	uint64		val;
-	int			i;
-	bool		has_nulls;
-	int			size = sizeof(uint64);
+	uint64		idx[ZS_DICT_MAX_ELEMS];
+	uint64		deltas[ZS_DICT_MAX_ELEMS];
+	int			dictidx[ZS_DICT_MAX_ENTRIES];	/* datum index of each entry */
+	int			ndict = 0;
+	int			dict_bytes = 0;
+	int			plain_bytes = 0;
+	uint64		maxdelta = 0;
+	int			tidbits;
+	int			idxbits;
+	int			size;
+	int			n;
 	uint64		codeword;
-	uint64		deltas[60];
-	char		*p;
+	char	   *p;
 
-	selector = 0;
-	this_nints = fixed_width_modes[0].num_ints;
-	this_bits = fixed_width_modes[0].bits_per_int;
-	this_supports_nulls = fixed_width_modes[0].nullbitmap;
+	if (tids[0] - prevtid >= (UINT64CONST(1) << ZS_DICT_FIRSTTID_BITS))
+		return 0;
 
-	val = tids[0] - prevtid;
-	has_nulls = isnulls[0];
-	i = 0;
-	for (;;)
+	for (n = 0; n < ntids && n < ZS_DICT_MAX_ELEMS; n++)
 	{
-		if (val >= (UINT64CONST(1) << this_bits) ||
-			(has_nulls && !this_supports_nulls))
-		{
-			/* Too large, or need NULL bitmap. Step up to next mode */
-			selector++;
-			this_nints = fixed_width_modes[selector].num_ints;
-			this_bits = fixed_width_modes[selector].bits_per_int;
-			this_supports_nulls = fixed_width_modes[selector].nullbitmap;
+		uint64		delta = 0;
 
-			/* we might already have accepted enough deltas for this mode */
-			if (i >= this_nints)
+		if (n > 0)
+		{
+			delta = tids[n] - tids[n - 1] - 1;
+			if (delta >= (UINT64CONST(1) << ZS_DICT_MAX_TIDBITS))
 				break;
 		}
+
+		if (isnulls[n])
+			idx[n] = 0;
 		else
 		{
-			/* accept this delta; then done if codeword is full */
-			deltas[i] = val;
-			if (!isnulls[i])
-				size += attlen;
-			i++;
-			if (i >= this_nints)
+			int			len;
+			int			j;
+
+			/* toasted datums are stored in their own chunks */
+			if (VARATT_IS_EXTERNAL(datums[n]) || VARATT_IS_COMPRESSED(datums[n]))
 				break;
-			/* examine next delta */
-			has_nulls |= isnulls[i];
-			if (i < ntids && size + attlen <= TARGET_CHUNK_SIZE)
+
+			len = VARSIZE_ANY_EXHDR(datums[n]);
+			if (len > ZS_DICT_MAX_ENTRY_LEN)
+				break;
+
+			for (j = 0; j < ndict; j++)
 			{
-				val = tids[i] - tids[i - 1];
+				Datum		d = datums[dictidx[j]];
+
+				if (VARSIZE_ANY_EXHDR(d) == len &&
+					memcmp(VARDATA_ANY(d), VARDATA_ANY(datums[n]), len) == 0)
+					break;
 			}
-			else
+			if (j == ndict)
 			{
-				/*
-				 * Reached end of input. Pretend that the next integer is a
-				 * value that's too large to represent in Simple-8b, so that
-				 * we fall out.
-				 */
-				val = PG_UINT64_MAX;
+				/* new value. Give up if values don't seem to repeat. */
+				if (ndict == ZS_DICT_MAX_ENTRIES ||
+					dict_bytes + 1 + len > TARGET_CHUNK_SIZE)
+					break;
+				if (n >= 8 && ndict + 1 > n / 2)
+					return 0;
+
+				dictidx[ndict++] = n;
+				dict_bytes += 1 + len;
 			}
+			idx[n] = j + 1;
+			plain_bytes += len;
 		}
+
+		if (n > 0)
+			deltas[n - 1] = delta;
+		maxdelta = Max(maxdelta, delta);
 	}
 
-	Assert(i > 0);
+	if (n < 2)
+		return 0;
+
+	tidbits = bitpack_width(maxdelta);
+	idxbits = bitpack_width(ndict);
+	size = sizeof(uint64) +
+		BITPACK_BYTES((n - 1) * tidbits) +
+		BITPACK_BYTES(n * idxbits) +
+		dict_bytes;
 
 	/*
-	 * Encode the integers using the selected mode.
+	 * Is it worth it? Compare with a lower bound of what the regular modes
+	 * would need: the data itself, plus one codeword for every 30 datums.
 	 */
-	codeword = 0;
+	if (size >= plain_bytes + sizeof(uint64) * ((n + 29) / 30))
+		return 0;
+
+	codeword = (uint64) ZS_VARLENA_DICT_MODE << 60;
+	codeword |= (uint64) (n - 1) << 54;
+	codeword |= (uint64) tidbits << 49;
+	codeword |= (uint64) ndict << 43;
+	codeword |= tids[0] - prevtid;
+
+	enlarge_attstream_buffer(dst, size);
+	p = &dst->data[dst->len];
+
+	memcpy(p, (char *) &codeword, sizeof(uint64));
+	p += sizeof(uint64);
+	p = bitpack_put(p, n - 1, deltas, tidbits);
+	p = bitpack_put(p, n, idx, idxbits);
+	for (int j = 0; j < ndict; j++)
+	{
+		Datum		d = datums[dictidx[j]];
+		int			len = VARSIZE_ANY_EXHDR(d);
+
+		*(p++) = (char) len;
+		memcpy(p, VARDATA_ANY(d), len);
+		p += len;
+	}
+
+	Assert(p - &dst->data[dst->len] == size);
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
+	return n;
+}
+
+/*
+ * EXTENDED MODES
+ * --------------
+ *
+ * In mode 15, the next 4 bits of the codeword select an extended mode:
+ *
+ * 1111 0001  scaled numeric, see the SCALED NUMERIC MODE section
+ * 1111 0010  front coding, see the FRONT CODING MODE section
+ *
+ * In all of them, the following 6 bits hold the number of datums in the
+ * chunk, minus one, and the low 33 bits hold the delta of the first TID, so
+ * that the generic routines don't need to know about each extended mode.
+ */
+#define ZS_VARLENA_EXTENDED_MODE		15
+#define ZS_VARLENA_SUBMODE(codeword)	(((codeword) >> 56) & 0x0F)
+#define ZS_VARLENA_SUBMODE_SCALED		1
+#define ZS_VARLENA_SUBMODE_FRONT		2
+#define ZS_VARLENA_EXT_MAX_ELEMS		60
+#define ZS_VARLENA_EXT_FIRSTTID_BITS	33
+#define ZS_VARLENA_EXT_MAX_TIDBITS		31
+
+static int
+varlen_ext_chunk_num_elements(uint64 codeword)
+{
+	return ((codeword >> 50) & 0x3F) + 1;
+}
+
+/*
+ * SCALED NUMERIC MODE
+ * -------------------
+ *
+ * This extended mode is used for chunks of numerics that all have the same
+ * display scale, like the values of a NUMERIC(12,2) column. Each value is
+ * stored as an integer holding the value multiplied by 10^dscale, using
+ * numeric_to_scaled_int64(), and the integers are bit-packed as differences
+ * from the minimum, like in the frame-of-reference mode for fixed-width
+ * values. The codeword looks like this:
+ *
+ * 1111 0001 CCCCCC BBBBB SSSSS VVVVVV N x xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ *
+ *          C: number of datums in the chunk, minus one (6 bits)
+ *          B: number of bits used for each TID delta after the first (5 bits)
+ *          S: the display scale of all the values (5 bits)
+ *          V: number of bits used for each value (6 bits)
+ *          N: a NULL bitmap follows
+ *          x: delta of the first TID (33 bits)
+ *
+ * The codeword is followed by the minimum of the scaled values (int64), the
+ * NULL bitmap if N is set, the deltas of the 2nd and subsequent TIDs minus
+ * one, and the values. NULLs are stored as 0.
+ *
+ * Nothing here knows the data type. numeric_to_scaled_int64() only accepts
+ * canonical numerics, which numeric_from_scaled_int64() rebuilds to the same
+ * bytes, so any varlena that passes is stored losslessly, whatever its type.
+ * A short numeric takes 3-13 bytes, while this takes a few bits for values
+ * in a narrow range, like prices or amounts.
+ */
+#define ZS_SCALED_MIN_ELEMS				8
+
+/*
+ * Convert a varlena to a scaled integer with numeric_to_scaled_int64(), if
+ * it's a numeric it accepts.
+ */
+static bool
+scaled_get_value(Datum d, int64 *val, int *dscale)
+{
+	union
+	{
+		int64		align;
+		char		data[NUMERIC_SCALED_INT64_MAX_SIZE];
+	}			buf;
+	int			len;
+
+	/* toasted datums are stored in their own chunks */
+	if (VARATT_IS_EXTERNAL(d) || VARATT_IS_COMPRESSED(d))
+		return false;
+
+	/* copy it to an aligned buffer with a 4-byte header */
+	len = VARSIZE_ANY_EXHDR(d);
+	if (len > NUMERIC_SCALED_INT64_MAX_SIZE - VARHDRSZ)
+		return false;
+	SET_VARSIZE(buf.data, len + VARHDRSZ);
+	memcpy(VARDATA(buf.data), VARDATA_ANY(d), len);
+
+	return numeric_to_scaled_int64((Numeric) buf.data, val, dscale);
+}
+
+/*
+ * Decode a scaled numeric chunk. If 'datums' is NULL, only the TIDs are
+ * decoded. Returns the size of the chunk.
+ */
+static int
+decode_chunk_varlen_scaled(zstid *lasttid, char *chunk,
+						   int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	char	   *p = chunk;
+	uint64		codeword;
+	int			nelems;
+	int			tidbits;
+	int			dscale;
+	int			valbits;
+	bool		has_nulls;
+	int64		minval;
+	char	   *nullbitmap = NULL;
+	uint64		vals[ZS_VARLENA_EXT_MAX_ELEMS];
+	zstid		tid;
+
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
+
+	nelems = varlen_ext_chunk_num_elements(codeword);
+	tidbits = (codeword >> 45) & 0x1F;
+	dscale = (codeword >> 40) & 0x1F;
+	valbits = (codeword >> 34) & 0x3F;
+	has_nulls = (codeword >> 33) & 1;
+
+	memcpy(&minval, p, sizeof(int64));
+	p += sizeof(int64);
+
 	if (has_nulls)
 	{
-		for (int i = 0; i < this_nints; i++)
-			codeword |= isnulls[i] ? (1 << i) : 0;
-		codeword <<= this_nints * this_bits;
+		nullbitmap = p;
+		p += BITPACK_BYTES(nelems);
 	}
-	for (int i = 0; i < this_nints; i++)
-		codeword |= deltas[i] << (i * this_bits);
 
-	/* add selector to the codeword, and return */
-	codeword |= (uint64) selector << 60;
+	tid = *lasttid + (codeword & ((UINT64CONST(1) << ZS_VARLENA_EXT_FIRSTTID_BITS) - 1));
+	tids[0] = tid;
+	p = bitpack_get(p, nelems - 1, vals, tidbits);
+	for (int i = 1; i < nelems; i++)
+	{
+		tid += (zstid) vals[i - 1] + 1;
+		tids[i] = tid;
+	}
+	*lasttid = tid;
+
+	if (datums)
+	{
+		char	   *datump;
+
+		p = bitpack_get(p, nelems, vals, valbits);
+
+		datump = palloc(MAXALIGN(NUMERIC_SCALED_INT64_MAX_SIZE) * nelems);
+		for (int i = 0; i < nelems; i++)
+		{
+			if (nullbitmap && ((nullbitmap[i / 8] >> (i % 8)) & 1) != 0)
+			{
+				datums[i] = (Datum) 0;
+				isnulls[i] = true;
+			}
+			else
+			{
+				numeric_from_scaled_int64((int64) ((uint64) minval + vals[i]),
+										  dscale, (Numeric) datump);
+				datums[i] = PointerGetDatum(datump);
+				isnulls[i] = false;
+				datump += MAXALIGN(VARSIZE(datump));
+			}
+		}
+	}
+	else
+		p += BITPACK_BYTES(nelems * valbits);
+
+	*num_elems = nelems;
+	return p - chunk;
+}
+
+/*
+ * Try to encode the datums using the scaled numeric mode.
+ *
+ * Returns the number of datums encoded, or 0 if the mode isn't suitable
+ * for the input, in which case nothing is written.
+ */
+static int
+encode_chunk_varlen_scaled(attstream_buffer *dst, zstid prevtid, int ntids,
+						   zstid *tids, Datum *datums, bool *isnulls)
+{
+	uint64		deltas[ZS_VARLENA_EXT_MAX_ELEMS];
+	int64		scaled[ZS_VARLENA_EXT_MAX_ELEMS];
+	uint64		vals[ZS_VARLENA_EXT_MAX_ELEMS];
+	uint64		maxdelta = 0;
+	bool		have_value = false;
+	bool		has_nulls = false;
+	int			dscale = 0;
+	int64		minval = 0;
+	int64		maxval = 0;
+	int			plain_bytes = 0;
+	int			tidbits;
+	int			valbits;
+	int			size;
+	int			n;
+	uint64		codeword;
+	char	   *p;
+
+	if (tids[0] - prevtid >= (UINT64CONST(1) << ZS_VARLENA_EXT_FIRSTTID_BITS))
+		return 0;
+
+	for (n = 0; n < ntids && n < ZS_VARLENA_EXT_MAX_ELEMS; n++)
+	{
+		uint64		delta = 0;
+
+		if (n > 0)
+		{
+			delta = tids[n] - tids[n - 1] - 1;
+			if (delta >= (UINT64CONST(1) << ZS_VARLENA_EXT_MAX_TIDBITS))
+				break;
+		}
+
+		if (isnulls[n])
+		{
+			scaled[n] = 0;
+			has_nulls = true;
+		}
+		else
+		{
+			int64		val;
+			int			thisdscale;
+			int64		newmin;
+			int64		newmax;
+
+			if (!scaled_get_value(datums[n], &val, &thisdscale))
+			{
+				/* not a numeric; don't bother trying the rest */
+				if (!have_value)
+					return 0;
+				break;
+			}
+			if (have_value && thisdscale != dscale)
+				break;
+
+			newmin = have_value ? Min(minval, val) : val;
+			newmax = have_value ? Max(maxval, val) : val;
+			if (bitpack_width((uint64) newmax - (uint64) newmin) > BITPACK_MAX_BITS)
+				break;
+
+			minval = newmin;
+			maxval = newmax;
+			dscale = thisdscale;
+			have_value = true;
+			scaled[n] = val;
+			plain_bytes += VARSIZE_ANY_EXHDR(datums[n]);
+		}
+
+		if (n > 0)
+			deltas[n - 1] = delta;
+		maxdelta = Max(maxdelta, delta);
+	}
+
+	if (n < ZS_SCALED_MIN_ELEMS || !have_value)
+		return 0;
+
+	tidbits = bitpack_width(maxdelta);
+	valbits = bitpack_width((uint64) maxval - (uint64) minval);
+	size = sizeof(uint64) + sizeof(int64) +
+		(has_nulls ? BITPACK_BYTES(n) : 0) +
+		BITPACK_BYTES((n - 1) * tidbits) +
+		BITPACK_BYTES(n * valbits);
 
 	/*
-	 * Note: 'size' is too large at this point, if we had to "back down" to a
-	 * less dense mode. That's fine for sizing the destination buffer, but we
-	 * can't rely on it for the final size of the chunk.
+	 * Is it worth it? Compare with a lower bound of what the regular modes
+	 * would need: the data itself, plus one codeword for every 30 datums.
 	 */
+	if (size >= plain_bytes + sizeof(uint64) * ((n + 29) / 30))
+		return 0;
+
+	for (int i = 0; i < n; i++)
+		vals[i] = isnulls[i] ? 0 : (uint64) scaled[i] - (uint64) minval;
+
+	codeword = (uint64) ZS_VARLENA_EXTENDED_MODE << 60;
+	codeword |= (uint64) ZS_VARLENA_SUBMODE_SCALED << 56;
+	codeword |= (uint64) (n - 1) << 50;
+	codeword |= (uint64) tidbits << 45;
+	codeword |= (uint64) dscale << 40;
+	codeword |= (uint64) valbits << 34;
+	codeword |= (uint64) (has_nulls ? 1 : 0) << 33;
+	codeword |= tids[0] - prevtid;
+
 	enlarge_attstream_buffer(dst, size);
 	p = &dst->data[dst->len];
+
 	memcpy(p, (char *) &codeword, sizeof(uint64));
 	p += sizeof(uint64);
+	memcpy(p, &minval, sizeof(int64));
+	p += sizeof(int64);
+	if (has_nulls)
+	{
+		memset(p, 0, BITPACK_BYTES(n));
+		for (int i = 0; i < n; i++)
+		{
+			if (isnulls[i])
+				p[i / 8] |= 1 << (i % 8);
+		}
+		p += BITPACK_BYTES(n);
+	}
+	p = bitpack_put(p, n - 1, deltas, tidbits);
+	p = bitpack_put(p, n, vals, valbits);
+
+	Assert(p - &dst->data[dst->len] == size);
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
+	return n;
+}
+
+/*
+ * FRONT CODING MODE
+ * -----------------
+ *
+ * This extended mode is used for chunks of values that share prefixes with
+ * the previous value, like URLs, file paths or composite keys loaded in
+ * sorted order. Each value is stored as the length of the prefix it shares
+ * with the previous non-NULL value in the chunk, and the rest of the value.
+ * The codeword looks like this:
+ *
+ * 1111 0010 CCCCCC BBBBB PPPPP LLLLL 00 x xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ *
+ *          C: number of datums in the chunk, minus one (6 bits)
+ *          B: number of bits used for each TID delta after the first (5 bits)
+ *          P: number of bits used for each prefix length (5 bits)
+ *          L: number of bits used for each suffix length (5 bits)
+ *          x: delta of the first TID (33 bits)
+ *
+ * The codeword is followed by the deltas of the 2nd and subsequent TIDs
+ * minus one, the prefix lengths, the suffix lengths plus one, with 0
+ * meaning NULL, and finally the suffixes.
+ *
+ * Unlike the page-level compression, this finds the shared prefixes of long
+ * values regardless of how far apart their previous occurrences are, and
+ * decoding is just a copy of each prefix and suffix.
+ */
+#define ZS_FRONT_MIN_ELEMS				4
+#define ZS_FRONT_MAX_LEN				0xFFFF
+
+/*
+ * Decode a front-coded chunk. If 'datums' is NULL, only the TIDs are
+ * decoded. Returns the size of the chunk.
+ */
+static int
+decode_chunk_varlen_front(zstid *lasttid, char *chunk,
+						  int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	char	   *p = chunk;
+	uint64		codeword;
+	int			nelems;
+	int			tidbits;
+	int			prefixbits;
+	int			lenbits;
+	uint64		vals[ZS_VARLENA_EXT_MAX_ELEMS];
+	uint64		prefixlens[ZS_VARLENA_EXT_MAX_ELEMS];
+	uint64		lens[ZS_VARLENA_EXT_MAX_ELEMS];
+	Size		datasize = 0;
+	zstid		tid;
+
+	memcpy(&codeword, p, sizeof(uint64));
+	p += sizeof(uint64);
+
+	nelems = varlen_ext_chunk_num_elements(codeword);
+	tidbits = (codeword >> 45) & 0x1F;
+	prefixbits = (codeword >> 40) & 0x1F;
+	lenbits = (codeword >> 35) & 0x1F;
+
+	tid = *lasttid + (codeword & ((UINT64CONST(1) << ZS_VARLENA_EXT_FIRSTTID_BITS) - 1));
+	tids[0] = tid;
+	p = bitpack_get(p, nelems - 1, vals, tidbits);
+	for (int i = 1; i < nelems; i++)
+	{
+		tid += (zstid) vals[i - 1] + 1;
+		tids[i] = tid;
+	}
+	*lasttid = tid;
 
-	/*
-	 * Now, the data
-	 */
+	p = bitpack_get(p, nelems, prefixlens, prefixbits);
+	p = bitpack_get(p, nelems, lens, lenbits);
 
-	/* FIXME: the loops below ignore alignment. 'p' might not be aligned */
-	if (attbyval)
+	if (datums)
 	{
-		if (attlen == sizeof(Datum))
-		{
-			for (int i = 0; i < this_nints; i++)
-			{
-				if (!isnulls[i])
-				{
-					*((Datum *) p) = datums[i];
-					p += sizeof(Datum);
-				}
-			}
-		}
-		else if (attlen == sizeof(int32))
-		{
-			for (int i = 0; i < this_nints; i++)
-			{
-				if (!isnulls[i])
-				{
-					*((int32 *) p) = DatumGetInt32(datums[i]);
-					p += sizeof(int32);
-				}
-			}
-		}
-		else if (attlen == sizeof(int16))
+		char	   *datump;
+		char	   *prev = NULL;
+		int			prevlen = 0;
+
+		for (int i = 0; i < nelems; i++)
 		{
-			for (int i = 0; i < this_nints; i++)
-			{
-				if (!isnulls[i])
-				{
-					*((int16 *) p) = DatumGetInt16(datums[i]);
-					p += sizeof(int16);
-				}
-			}
+			if (lens[i] > 0)
+				datasize += MAXALIGN(VARHDRSZ + prefixlens[i] + lens[i] - 1);
 		}
-		else if (attlen == sizeof(char))
+
+		/* Materialize all the values in one buffer */
+		datump = palloc(Max(datasize, 1));
+		for (int i = 0; i < nelems; i++)
 		{
-			for (int i = 0; i < this_nints; i++)
+			int			prefixlen = prefixlens[i];
+			int			suffixlen;
+
+			if (lens[i] == 0)
 			{
-				if (!isnulls[i])
-					*(p++) = DatumGetChar(datums[i]);
+				datums[i] = (Datum) 0;
+				isnulls[i] = true;
+				continue;
 			}
+			suffixlen = lens[i] - 1;
+			if (prefixlen > prevlen)
+				elog(ERROR, "invalid prefix length %d in zedstore chunk, previous value has length %d",
+					 prefixlen, prevlen);
+
+			if (prefixlen > 0)
+				memcpy(VARDATA(datump), prev, prefixlen);
+			memcpy(VARDATA(datump) + prefixlen, p, suffixlen);
+			p += suffixlen;
+			SET_VARSIZE(datump, VARHDRSZ + prefixlen + suffixlen);
+
+			datums[i] = PointerGetDatum(datump);
+			isnulls[i] = false;
+
+			prev = VARDATA(datump);
+			prevlen = prefixlen + suffixlen;
+			datump += MAXALIGN(VARHDRSZ + prevlen);
 		}
-		else
-			elog(ERROR, "unsupported byval length: %d", attlen);
 	}
 	else
 	{
-		for (int i = 0; i < this_nints; i++)
+		for (int i = 0; i < nelems; i++)
 		{
-			if (!isnulls[i])
-			{
-				memcpy(p, DatumGetPointer(datums[i]), attlen);
-				p += attlen;
-			}
+			if (lens[i] > 0)
+				p += lens[i] - 1;
 		}
 	}
-	dst->len = p - dst->data;
-	Assert(dst->len <= dst->maxlen);
 
-	return this_nints;
+	*num_elems = nelems;
+	return p - chunk;
 }
 
 /*
- * VARIABLE-SIZE MODES
- * -------------------
- *
- * These are used with varlenas. With varlenas, we encode not only the
- * TIDs and NULLness of each datum, but also its length, in the same
- * codeword. The value 0 stored in the length field is used to represent
- * a NULL; there is no separate NULL bitmap. For non-NULLs, the value
- * stored in the length is the real length + 1.
- *
- * We don't track a maximum size for the chunk during encoding, but the
- * fact that we use a smallish number of bits to store the length, depending
- * on the mode, puts a cap on the max chunk size. For example, in mode 4,
- * we encode 10 TIDs in a codeword with 4 bits to store the length. With four
- * bits, each datum can be max 14 bytes long. That limits the max size of a
- * chunk in mode 4 to 10*14 = 140 bytes. Below table shows the modes with the
- * number of bits use for the TID and length of each datum, and the maximum
- * chunk size they give (not including the size of the codeword itself)
- *
- * mode    tidbits lenbits wasted  ntids   maxsize
- * 0       1       1       0       30      30
- * 1       1       2       0       20      40
- * 2       1       3       0       15      90
- * 3       2       3       0       12      72
- * 4       2       4       0       10      140
- * 5       3       4       4       8       112
- * 6       4       4       4       7       98
- * 7       5       5       0       6       180
- * 8       6       6       0       5       310
- * 9       8       7       0       4       504
- * 10      13      7       0       3       378
- * 11      23      7       0       2       252
- * 12      45      15      0       1       32766
- * 13 unused
- * 14 toast
- * 15 unused
- *
- * Modes 13 and 15 are currently unused. (The idea is that 15 could be
- * used for various extended modes with special handling, using more
- * bits to indicate which extended mode it is. And it seems logical to
- * have special modes, like the toast mode, at the end. We could use
- * 13 for another "regular" mode.. )
- *
- * Mode 14 is special: It is used to encode a toasted datum. The toast
- * datum is compressed with toast_compress_datum(). Unlike the other
- * modes, the toast mode lenbits field is overloaded and is used to
- * identify where the toast datum is stored. The toast datum could be
- * stored either inline or in separate toast pages. The TID of the
- * datum is stored in the codeword as is. If the toast datum is stored
- * inline, then after the codeword comes the zs_toast_header_inline
- * followed by the datum. If the toast datum is stored in separate
- * toast pages, then after the codeword comes the block number of the
- * first toast block, as a 32-bit integer.
+ * Try to encode the datums using front coding.
  *
- * FIXME: Mode 12 is the widest mode, but it only uses up to 45 bits for
- * the TID. That's not enough to cover the whole range of valid zstids.
- * I think we need one more special mode, where we use full 60 bits for
- * the TID, with the length stored separately after the codeword, for
- * the odd case that you have a very large datum with a very high TID.
+ * Returns the number of datums encoded, or 0 if the mode isn't suitable
+ * for the input, in which case nothing is written.
  */
-static const struct
-{
-	uint8		bits_per_tid;
-	uint8		lenbits;
-	uint8		num_ints;
-} varlen_modes[17] =
+static int
+encode_chunk_varlen_front(attstream_buffer *dst, zstid prevtid, int ntids,
+						  zstid *tids, Datum *datums, bool *isnulls)
 {
-	{ 1,   1,   30 },	/* mode 0 */
-	{ 1,   2,   20 },	/* mode 1 */
-	{ 1,   3,   15 },	/* mode 2 */
-	{ 2,   3,   12 },	/* mode 3 */
-	{ 2,   4,   10 },	/* mode 4 */
-	{ 3,   4,   8  },	/* mode 5 */
-	{ 4,   4,   7  },	/* mode 6 */
-	{ 5,   5,   6  },	/* mode 7 */
-	{ 6,   6,   5  },	/* mode 8 */
-	{ 8,   7,   4  },	/* mode 9 */
-	{ 13,  7,   3  },	/* mode 10 */
-	{ 23,  7,   2  },	/* mode 11 */
-	{ 45,  15,  1  },	/* mode 12 */
+	uint64		deltas[ZS_VARLENA_EXT_MAX_ELEMS];
+	uint64		prefixlens[ZS_VARLENA_EXT_MAX_ELEMS];
+	uint64		lens[ZS_VARLENA_EXT_MAX_ELEMS];
+	uint64		maxdelta = 0;
+	uint64		maxprefixlen = 0;
+	uint64		maxlen = 0;
+	char	   *prev = NULL;
+	int			prevlen = 0;
+	int			plain_bytes = 0;
+	int			suffix_bytes = 0;
+	int			tidbits;
+	int			prefixbits;
+	int			lenbits;
+	int			size;
+	int			n;
+	uint64		codeword;
+	char	   *p;
 
-	/* special modes */
-	{ 0, 0, 0 },	/* mode 13 (unused) */
-	{ 48, 12, 1 },	/* mode 14 (toast) */
-	{ 0, 0, 0 },	/* mode 15 */
+	if (tids[0] - prevtid >= (UINT64CONST(1) << ZS_VARLENA_EXT_FIRSTTID_BITS))
+		return 0;
 
-	{ 0, 0, 0 }		/* sentinel */
-};
+	for (n = 0; n < ntids && n < ZS_VARLENA_EXT_MAX_ELEMS; n++)
+	{
+		uint64		delta = 0;
 
-#define ZS_VARLENA_INLINE_TOAST 1
-#define ZS_VARLENA_TOAST_PAGE 0
+		if (n > 0)
+		{
+			delta = tids[n] - tids[n - 1] - 1;
+			if (delta >= (UINT64CONST(1) << ZS_VARLENA_EXT_MAX_TIDBITS))
+				break;
+		}
 
-typedef struct zs_toast_header_external {
-	BlockNumber toast_blkno;
-} zs_toast_header_external;
+		if (isnulls[n])
+		{
+			prefixlens[n] = 0;
+			lens[n] = 0;
+		}
+		else
+		{
+			char	   *data;
+			int			len;
+			int			prefixlen = 0;
 
-typedef struct zs_toast_header_inline
+			/* toasted datums are stored in their own chunks */
+			if (VARATT_IS_EXTERNAL(datums[n]) || VARATT_IS_COMPRESSED(datums[n]))
+				break;
+
+			data = VARDATA_ANY(datums[n]);
+			len = VARSIZE_ANY_EXHDR(datums[n]);
+			if (len >= ZS_FRONT_MAX_LEN)
+				break;
+
+			while (prefixlen < prevlen && prefixlen < len &&
+				   data[prefixlen] == prev[prefixlen])
+				prefixlen++;
+
+			/* Give up early if the values don't seem to share prefixes. */
+			if (n == ZS_FRONT_MIN_ELEMS && suffix_bytes * 4 > plain_bytes * 3)
+				return 0;
+
+			prefixlens[n] = prefixlen;
+			lens[n] = len - prefixlen + 1;
+			maxprefixlen = Max(maxprefixlen, prefixlen);
+			maxlen = Max(maxlen, lens[n]);
+			plain_bytes += len;
+			suffix_bytes += len - prefixlen;
+
+			prev = data;
+			prevlen = len;
+		}
+
+		if (n > 0)
+			deltas[n - 1] = delta;
+		maxdelta = Max(maxdelta, delta);
+	}
+
+	if (n < ZS_FRONT_MIN_ELEMS)
+		return 0;
+
+	tidbits = bitpack_width(maxdelta);
+	prefixbits = bitpack_width(maxprefixlen);
+	lenbits = bitpack_width(maxlen);
+	size = sizeof(uint64) +
+		BITPACK_BYTES((n - 1) * tidbits) +
+		BITPACK_BYTES(n * prefixbits) +
+		BITPACK_BYTES(n * lenbits) +
+		suffix_bytes;
+
+	/*
+	 * Is it worth it? Compare with a lower bound of what the regular modes
+	 * would need: the data itself, plus one codeword for every 30 datums.
+	 */
+	if (size >= plain_bytes + sizeof(uint64) * ((n + 29) / 30))
+		return 0;
+
+	codeword = (uint64) ZS_VARLENA_EXTENDED_MODE << 60;
+	codeword |= (uint64) ZS_VARLENA_SUBMODE_FRONT << 56;
+	codeword |= (uint64) (n - 1) << 50;
+	codeword |= (uint64) tidbits << 45;
+	codeword |= (uint64) prefixbits << 40;
+	codeword |= (uint64) lenbits << 35;
+	codeword |= tids[0] - prevtid;
+
+	enlarge_attstream_buffer(dst, size);
+	p = &dst->data[dst->len];
+
+	memcpy(p, (char *) &codeword, sizeof(uint64));
+	p += sizeof(uint64);
+	p = bitpack_put(p, n - 1, deltas, tidbits);
+	p = bitpack_put(p, n, prefixlens, prefixbits);
+	p = bitpack_put(p, n, lens, lenbits);
+	for (int i = 0; i < n; i++)
+	{
+		if (lens[i] > 0)
+		{
+			memcpy(p, VARDATA_ANY(datums[i]) + prefixlens[i], lens[i] - 1);
+			p += lens[i] - 1;
+		}
+	}
+
+	Assert(p - &dst->data[dst->len] == size);
+	dst->len = p - dst->data;
+	Assert(dst->len <= dst->maxlen);
+	return n;
+}
+
+/*
+ * Decode a chunk in one of the extended modes. If 'datums' is NULL, only the
+ * TIDs are decoded. Returns the size of the chunk.
+ */
+static int
+decode_chunk_varlen_extended(zstid *lasttid, char *chunk,
+							 int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
 {
-	uint32 compressed_size;
-	uint32 rawsize;
-} zs_toast_header_inline;
+	uint64		codeword;
+
+	memcpy(&codeword, chunk, sizeof(uint64));
+
+	switch (ZS_VARLENA_SUBMODE(codeword))
+	{
+		case ZS_VARLENA_SUBMODE_SCALED:
+			return decode_chunk_varlen_scaled(lasttid, chunk, num_elems,
+											  tids, datums, isnulls);
+		case ZS_VARLENA_SUBMODE_FRONT:
+			return decode_chunk_varlen_front(lasttid, chunk, num_elems,
+											 tids, datums, isnulls);
+		default:
+			elog(ERROR, "invalid extended mode %d in zedstore chunk",
+				 (int) ZS_VARLENA_SUBMODE(codeword));
+	}
+	return 0;					/* keep compiler quiet */
+}
 
 static int
 get_toast_chunk_length(char *chunk, uint64 toast_mode_selector)
@@ -1997,6 +4833,23 @@ get_chunk_length_varlen(char *chunk)
 		uint64		lenmask = (UINT64CONST(1) << lenbits) - 1;
 		int			total_len;
 
+		if (selector == ZS_VARLENA_DICT_MODE)
+		{
+			zstid		tid = 0;
+			zstid		tids[ZS_DICT_MAX_ELEMS];
+			int			n;
+
+			return decode_chunk_varlen_dict(&tid, chunk, &n, tids, NULL, NULL);
+		}
+		if (selector == ZS_VARLENA_EXTENDED_MODE)
+		{
+			zstid		tid = 0;
+			zstid		tids[ZS_VARLENA_EXT_MAX_ELEMS];
+			int			n;
+
+			return decode_chunk_varlen_extended(&tid, chunk, &n, tids, NULL, NULL);
+		}
+
 		/* skip over the TIDs */
 		codeword >>= tidbits * nints;
 
@@ -2049,7 +4902,7 @@ replace_first_tid_varlen(zstid newtid, char *chunk)
 		int			bits = varlen_modes[selector].bits_per_tid;
 		uint64		mask = (UINT64CONST(1) << bits) - 1;
 
-		if (newtid >= (1 << bits))
+		if (newtid >= (UINT64CONST(1) << bits))
 			return false;
 
 		/* zero out the TID */
@@ -2082,6 +4935,21 @@ skip_chunk_varlen(char *chunk, zstid *lasttid)
 		int			total_len;
 		zstid		tid = prevtid;
 
+		if (selector == ZS_VARLENA_DICT_MODE)
+		{
+			zstid		tids[ZS_DICT_MAX_ELEMS];
+			int			n;
+
+			return decode_chunk_varlen_dict(lasttid, chunk, &n, tids, NULL, NULL);
+		}
+		if (selector == ZS_VARLENA_EXTENDED_MODE)
+		{
+			zstid		tids[ZS_VARLENA_EXT_MAX_ELEMS];
+			int			n;
+
+			return decode_chunk_varlen_extended(lasttid, chunk, &n, tids, NULL, NULL);
+		}
+
 		if (selector == 14)
 		{
 			/* toast pointer */
@@ -2121,11 +4989,69 @@ chunk_num_elements(char *chunk, int attlen)
 	char	   *p = chunk;
 	uint64		codeword;
 
+	int			selector;
+
 	memcpy(&codeword, p, sizeof(uint64));
 	p += sizeof(uint64);
 
-	int			selector = (codeword >> 60);
-	return attlen > 0 ? fixed_width_modes[selector].num_ints : varlen_modes[selector].num_ints;
+	selector = (codeword >> 60);
+
+	if (attlen > 0)
+	{
+		if (is_fixed_run_chunk(codeword))
+			return fixed_run_length(codeword);
+		if (is_fixed_for_chunk(codeword))
+			return fixed_for_length(codeword);
+		if (is_fixed_packed_chunk(codeword))
+			return fixed_packed_length(codeword);
+		if (is_fixed_xor_chunk(codeword))
+			return fixed_xor_length(codeword);
+		return fixed_width_modes[selector].num_ints;
+	}
+	if (selector == ZS_VARLENA_DICT_MODE)
+		return dict_chunk_num_elements(codeword);
+	if (selector == ZS_VARLENA_EXTENDED_MODE)
+		return varlen_ext_chunk_num_elements(codeword);
+	return varlen_modes[selector].num_ints;
+}
+
+/*
+ * Return the name of the encoding used in a chunk, for debugging and tests.
+ * The regular Simple-8b-style modes are all reported as "plain".
+ */
+const char *
+attstream_chunk_mode_name(int16 attlen, char *chunk)
+{
+	uint64		codeword;
+	int			selector;
+
+	memcpy(&codeword, chunk, sizeof(uint64));
+	selector = (codeword >> 60);
+
+	if (attlen > 0)
+	{
+		if (is_fixed_run_chunk(codeword))
+			return "run";
+		if (is_fixed_for_chunk(codeword))
+			return "for";
+		if (is_fixed_packed_chunk(codeword))
+			return "packed";
+		if (is_fixed_xor_chunk(codeword))
+			return "xor";
+		return "plain";
+	}
+	if (selector == ZS_VARLENA_DICT_MODE)
+		return "dict";
+	if (selector == 14)
+		return "toast";
+	if (selector == ZS_VARLENA_EXTENDED_MODE)
+	{
+		if (ZS_VARLENA_SUBMODE(codeword) == ZS_VARLENA_SUBMODE_SCALED)
+			return "scaled";
+		if (ZS_VARLENA_SUBMODE(codeword) == ZS_VARLENA_SUBMODE_FRONT)
+			return "front";
+	}
+	return "plain";
 }
 
 static int
@@ -2148,6 +5074,13 @@ decode_chunk_varlen(zstid *lasttid, char *chunk,
 		zstid		tid = *lasttid;
 		char	   *datump;
 
+		if (selector == ZS_VARLENA_DICT_MODE)
+			return decode_chunk_varlen_dict(lasttid, chunk, num_elems,
+											tids, datums, isnulls);
+		if (selector == ZS_VARLENA_EXTENDED_MODE)
+			return decode_chunk_varlen_extended(lasttid, chunk, num_elems,
+												tids, datums, isnulls);
+
 		if (selector == 14)
 		{
 			/* in-line toast datum or toast pointer */
@@ -2326,6 +5259,36 @@ encode_chunk_varlen(attstream_buffer *dst, zstid prevtid, int ntids,
 	else if (!isnulls[0] && VARATT_IS_EXTERNAL(datums[0]) && VARTAG_EXTERNAL(datums[0]) == VARTAG_ZEDSTORE)
 		return encode_chunk_varlen_toast_page(dst, prevtid, tids, datums);
 
+	/* Store numerics of a fixed scale as scaled integers */
+	if (ntids >= ZS_SCALED_MIN_ELEMS)
+	{
+		int			nencoded;
+
+		nencoded = encode_chunk_varlen_scaled(dst, prevtid, ntids, tids, datums, isnulls);
+		if (nencoded > 0)
+			return nencoded;
+	}
+
+	/* Use dictionary encoding, if the values repeat */
+	if (ntids > 1)
+	{
+		int			nencoded;
+
+		nencoded = encode_chunk_varlen_dict(dst, prevtid, ntids, tids, datums, isnulls);
+		if (nencoded > 0)
+			return nencoded;
+	}
+
+	/* Use front coding, if the values share prefixes */
+	if (ntids >= ZS_FRONT_MIN_ELEMS)
+	{
+		int			nencoded;
+
+		nencoded = encode_chunk_varlen_front(dst, prevtid, ntids, tids, datums, isnulls);
+		if (nencoded > 0)
+			return nencoded;
+	}
+
 	selector = 0;
 	this_nints = varlen_modes[0].num_ints;
 	this_tidbits = varlen_modes[0].bits_per_tid;
@@ -2504,6 +5467,45 @@ decode_chunk(bool attbyval, int attlen, zstid *lasttid, char *chunk,
 								   tids, datums, isnulls);
 }
 
+static int
+decode_chunk_varlen_any(bool attbyval, int attlen, zstid *lasttid, char *chunk,
+						int *num_elems, zstid *tids, Datum *datums, bool *isnulls)
+{
+	return decode_chunk_varlen(lasttid, chunk, num_elems,
+							   tids, datums, isnulls);
+}
+
+/*
+ * Choose the function to decode chunks of an attribute, when a decoder is
+ * initialized. This moves the checks on attlen and attbyval out of the
+ * per-chunk loops of the decoder. Pass-by-value types of the common widths
+ * get their own copy of the fixed-width decoder.
+ */
+static zs_decode_chunk_fn
+choose_chunk_decoder(bool attbyval, int attlen)
+{
+	if (attlen <= 0)
+		return decode_chunk_varlen_any;
+
+	if (attbyval)
+	{
+		switch (attlen)
+		{
+#if SIZEOF_DATUM == 8
+			case sizeof(int64):
+				return decode_chunk_fixed_int64;
+#endif
+			case sizeof(int32):
+				return decode_chunk_fixed_int32;
+			case sizeof(int16):
+				return decode_chunk_fixed_int16;
+			case sizeof(char):
+				return decode_chunk_fixed_char;
+		}
+	}
+	return decode_chunk_fixed;
+}
+
 static int
 encode_chunk(attstream_buffer *buf, zstid prevtid, int ntids,
 			 zstid *tids, Datum *datums, bool *isnulls)
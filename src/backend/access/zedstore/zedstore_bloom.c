@@ -0,0 +1,564 @@
+/*
+ * zedstore_bloom.c
+ *		Bloom filters of zedstore attribute leaves
+ *
+ * The min/max synopses of the leaf pages let a scan skip leaves by value
+ * range, but that's no help for equality lookups of values like random
+ * identifiers, that are spread evenly over the whole table. For columns
+ * marked with the "zedstore_bloom" attribute option, VACUUM and ANALYZE
+ * build a small bloom filter over the values on each leaf page. A scan
+ * with an equality key on the column checks the filters when it starts,
+ * together with the synopses, and skips the TID ranges of the leaves that
+ * cannot contain the value.
+ *
+ * The filters of an attribute are stored on a chain of bloom pages, linked
+ * from the attribute's entry on the stats pages, see ZSTreeStats. Each
+ * entry records the block number and LSN of the leaf it was built from.
+ * Any modification of the leaf, which is always WAL-logged, changes its
+ * LSN, which implicitly invalidates the entry, like in the decompressed
+ * data cache. The filters are never updated in place; each VACUUM or
+ * ANALYZE writes a new chain, copying the entries of leaves that haven't
+ * changed, and frees the old one.
+ *
+ * Readers don't lock the chain. They copy each bloom page while holding a
+ * share lock on it, and if the page was freed and reused in the meanwhile,
+ * they only lose the ability to skip the rest of the leaves. That's
+ * harmless, because a filter is only ever trusted if its leaf's block and
+ * LSN match.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zedstore/zedstore_bloom.c
+ */
+#include "postgres.h"
+
+#include "access/skey.h"
+#include "access/stratnum.h"
+#include "access/xloginsert.h"
+#include "access/zedstore_internal.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "utils/attoptcache.h"
+#include "utils/hashutils.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/typcache.h"
+
+static bool zsbloom_is_bloom_page(Page page, AttrNumber attno);
+static uint32 zsbloom_hash_datum(TypeCacheEntry *typentry, Oid collation, Datum datum);
+static int	zsbloom_filter_size(int nvalues);
+static void zsbloom_set(uint8 *bits, int nbytes, uint32 hash);
+static void zsbloom_init_page(Page page, AttrNumber attno);
+static void zsbloom_write_page(Buffer buf, Page image);
+
+/*
+ * Is the "zedstore_bloom" option set on the attribute?
+ */
+bool
+zsbloom_attr_enabled(Relation rel, AttrNumber attno)
+{
+	AttributeOpts *aopt;
+	bool		result = false;
+
+	aopt = get_attribute_options(RelationGetRelid(rel), attno);
+	if (aopt)
+	{
+		result = aopt->zedstore_bloom;
+		pfree(aopt);
+	}
+
+	return result;
+}
+
+/*
+ * Build bloom filters for all the leaves of attribute 'attno'.
+ *
+ * Entries for leaves that haven't changed are copied from the old chain
+ * starting at 'oldhead', the rest are computed by decoding the leaves.
+ * Returns the head of the new chain, or InvalidBlockNumber if no filters
+ * can be built for the attribute. The old chain is left alone; the caller
+ * frees it with zsbloom_free_chain(), once the new chain has been linked
+ * in its place.
+ *
+ * If this fails with an error, the new pages written so far are leaked,
+ * like the pages allocated by an interrupted page split.
+ */
+BlockNumber
+zsbloom_build(Relation rel, AttrNumber attno, BlockNumber oldhead,
+			  BufferAccessStrategy strategy)
+{
+	Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attno - 1);
+	TypeCacheEntry *typentry;
+	ZSBloomReader reader;
+	attstream_decoder decoders[2];
+	MemoryContext tmpcxt;
+	MemoryContext oldcxt;
+	ZSBloomEntry *entry;
+	uint32	   *hashes;
+	int			maxhashes;
+	Page		image = NULL;
+	Buffer		imagebuf = InvalidBuffer;
+	BlockNumber head = InvalidBlockNumber;
+	Buffer		leafbuf = InvalidBuffer;
+	zstid		nexttid;
+
+	/* the entries are validated by the leaves' LSNs, see ZSBloomEntry */
+	if (!zs_relation_needs_wal(rel))
+		return InvalidBlockNumber;
+	if (attr->attisdropped || attr->atthasmissing)
+		return InvalidBlockNumber;
+	typentry = lookup_type_cache(attr->atttypid, TYPECACHE_HASH_PROC_FINFO);
+	if (!OidIsValid(typentry->hash_proc))
+		return InvalidBlockNumber;
+
+	tmpcxt = AllocSetContextCreate(CurrentMemoryContext,
+								   "zedstore bloom build",
+								   ALLOCSET_DEFAULT_SIZES);
+
+	zsbloom_begin_read(&reader, rel, attno, oldhead);
+	init_attstream_decoder(&decoders[0], attr->attbyval, attr->attlen);
+	init_attstream_decoder(&decoders[1], attr->attbyval, attr->attlen);
+	entry = palloc(ZSBloomEntrySize(ZS_BLOOM_MAX_BYTES));
+	maxhashes = 1024;
+	hashes = palloc(maxhashes * sizeof(uint32));
+
+	nexttid = MinZSTid;
+	while (nexttid < MaxPlusOneZSTid)
+	{
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		ZSBloomEntry *oldentry;
+		bool		decoding[2] = {false, false};
+		int			nhashes = 0;
+		bool		toasted = false;
+
+		CHECK_FOR_INTERRUPTS();
+
+		leafbuf = zsbt_find_and_lock_leaf_containing_tid(rel, attno, leafbuf, nexttid,
+														 BUFFER_LOCK_SHARE, strategy);
+		if (!BufferIsValid(leafbuf))
+			break;
+		page = BufferGetPage(leafbuf);
+		opaque = ZSBtreePageGetOpaque(page);
+
+		entry->lokey = opaque->zs_lokey;
+		entry->leaflsn = PageGetLSN(page);
+		entry->leafblk = BufferGetBlockNumber(leafbuf);
+		entry->padding = 0;
+		nexttid = opaque->zs_hikey;
+
+		/* Start decoding the streams, unless the old filter is still good */
+		oldentry = zsbloom_find_entry(&reader, entry->lokey, entry->leafblk,
+									  entry->leaflsn);
+		if (oldentry == NULL)
+		{
+			ZSAttStream *streams[2];
+
+			streams[0] = get_page_lowerstream(page);
+			streams[1] = get_page_upperstream(page);
+			for (int i = 0; i < 2; i++)
+			{
+				if (streams[i] == NULL)
+					continue;
+				decode_attstream_begin(&decoders[i], streams[i]);
+				decoding[i] = true;
+			}
+		}
+		LockBuffer(leafbuf, BUFFER_LOCK_UNLOCK);
+
+		if (oldentry)
+			memcpy(entry, oldentry, ZSBloomEntrySize(oldentry->nbytes));
+		else
+		{
+			/* Hash all the values on the leaf */
+			oldcxt = MemoryContextSwitchTo(tmpcxt);
+			for (int i = 0; i < 2 && !toasted; i++)
+			{
+				if (!decoding[i])
+					continue;
+				while (!toasted && decode_attstream_cont(&decoders[i]))
+				{
+					for (int idx = 0; idx < decoders[i].num_elements; idx++)
+					{
+						Datum		datum = decoders[i].datums[idx];
+
+						if (decoders[i].isnulls[idx])
+							continue;
+						if (attr->attlen == -1 &&
+							VARATT_IS_EXTERNAL(datum) &&
+							VARTAG_EXTERNAL(datum) == VARTAG_ZEDSTORE)
+						{
+							/* would have to fetch it; give up on this leaf */
+							toasted = true;
+							break;
+						}
+						if (nhashes == maxhashes)
+						{
+							maxhashes *= 2;
+							hashes = repalloc(hashes, maxhashes * sizeof(uint32));
+						}
+						hashes[nhashes++] = zsbloom_hash_datum(typentry,
+															   attr->attcollation,
+															   datum);
+					}
+				}
+			}
+			MemoryContextSwitchTo(oldcxt);
+			MemoryContextReset(tmpcxt);
+
+			if (toasted)
+				entry->nbytes = 0;
+			else
+			{
+				entry->nbytes = zsbloom_filter_size(nhashes);
+				memset(entry->bits, 0, entry->nbytes);
+				for (int i = 0; i < nhashes; i++)
+					zsbloom_set(entry->bits, entry->nbytes, hashes[i]);
+			}
+		}
+
+		/* Append the entry, moving on to a new page if it doesn't fit */
+		if (image == NULL ||
+			((PageHeader) image)->pd_lower + ZSBloomEntrySize(entry->nbytes) >
+			((PageHeader) image)->pd_upper)
+		{
+			Buffer		newbuf;
+
+			newbuf = zspage_getnewbuf(rel, ZS_META_ATTRIBUTE_NUM);
+			LockBuffer(newbuf, BUFFER_LOCK_UNLOCK);
+
+			if (image == NULL)
+			{
+				image = palloc(BLCKSZ);
+				head = BufferGetBlockNumber(newbuf);
+			}
+			else
+			{
+				((ZSBloomPageOpaque *) PageGetSpecialPointer(image))->zs_next =
+					BufferGetBlockNumber(newbuf);
+				zsbloom_write_page(imagebuf, image);
+			}
+			zsbloom_init_page(image, attno);
+			imagebuf = newbuf;
+		}
+		memcpy((char *) image + ((PageHeader) image)->pd_lower, entry,
+			   offsetof(ZSBloomEntry, bits) + entry->nbytes);
+		((PageHeader) image)->pd_lower += ZSBloomEntrySize(entry->nbytes);
+	}
+	if (BufferIsValid(leafbuf))
+		ReleaseBuffer(leafbuf);
+
+	if (image)
+	{
+		zsbloom_write_page(imagebuf, image);
+		pfree(image);
+	}
+
+	zsbloom_end_read(&reader);
+	destroy_attstream_decoder(&decoders[0]);
+	destroy_attstream_decoder(&decoders[1]);
+	pfree(entry);
+	pfree(hashes);
+	MemoryContextDelete(tmpcxt);
+
+	return head;
+}
+
+/*
+ * Free the pages of a bloom chain that's no longer linked from the stats.
+ */
+void
+zsbloom_free_chain(Relation rel, AttrNumber attno, BlockNumber head)
+{
+	BlockNumber next = head;
+
+	while (next != InvalidBlockNumber)
+	{
+		Buffer		buf;
+		Page		page;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBuffer(rel, next);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		page = BufferGetPage(buf);
+		if (!zsbloom_is_bloom_page(page, attno))
+		{
+			/* shouldn't happen, but don't free a page that isn't ours */
+			elog(WARNING, "unexpected page %u in zedstore bloom chain", next);
+			UnlockReleaseBuffer(buf);
+			break;
+		}
+		next = ((ZSBloomPageOpaque *) PageGetSpecialPointer(page))->zs_next;
+		zspage_delete_page(rel, buf, InvalidBuffer);
+		UnlockReleaseBuffer(buf);
+	}
+}
+
+/*
+ * Get the head of the current bloom chain of attribute 'attno'.
+ */
+BlockNumber
+zsbloom_get_head(Relation rel, AttrNumber attno)
+{
+	ZSRelStats *stats;
+	BlockNumber head = InvalidBlockNumber;
+
+	stats = zsmeta_read_stats(rel);
+	if (stats)
+	{
+		if (attno < stats->nattributes)
+			head = stats->trees[attno].zs_bloom_head;
+		pfree(stats);
+	}
+	return head;
+}
+
+/*
+ * Lockstep reader of a bloom chain.
+ *
+ * zsbloom_find_entry() must be called for the leaves in TID order. It
+ * returns the entry for the leaf, if there's one that's still valid. The
+ * entry points to the reader's private copy of the bloom page, and is valid
+ * until the next call.
+ */
+void
+zsbloom_begin_read(ZSBloomReader *reader, Relation rel, AttrNumber attno,
+				   BlockNumber head)
+{
+	reader->rel = rel;
+	reader->attno = attno;
+	reader->next = head;
+	reader->page = NULL;
+	reader->off = 0;
+	reader->end = 0;
+	reader->lastkey = InvalidZSTid;
+	reader->valid = (head != InvalidBlockNumber);
+}
+
+ZSBloomEntry *
+zsbloom_find_entry(ZSBloomReader *reader, zstid lokey, BlockNumber leafblk,
+				   XLogRecPtr leaflsn)
+{
+	while (reader->valid)
+	{
+		ZSBloomEntry *entry;
+
+		if (reader->off >= reader->end)
+		{
+			Buffer		buf;
+			Page		page;
+
+			/* Move to the next page */
+			if (reader->next == InvalidBlockNumber)
+			{
+				reader->valid = false;
+				break;
+			}
+			if (reader->page == NULL)
+				reader->page = palloc(BLCKSZ);
+
+			buf = ReadBuffer(reader->rel, reader->next);
+			LockBuffer(buf, BUFFER_LOCK_SHARE);
+			page = BufferGetPage(buf);
+			if (!zsbloom_is_bloom_page(page, reader->attno))
+			{
+				/* the chain was freed under us */
+				UnlockReleaseBuffer(buf);
+				reader->valid = false;
+				break;
+			}
+			memcpy(reader->page, page, BLCKSZ);
+			UnlockReleaseBuffer(buf);
+
+			reader->next = ((ZSBloomPageOpaque *) PageGetSpecialPointer(reader->page))->zs_next;
+			reader->off = MAXALIGN(SizeOfPageHeaderData);
+			reader->end = ((PageHeader) reader->page)->pd_lower;
+			continue;
+		}
+
+		entry = (ZSBloomEntry *) (reader->page + reader->off);
+		if (reader->off + offsetof(ZSBloomEntry, bits) > reader->end ||
+			entry->nbytes > ZS_BLOOM_MAX_BYTES ||
+			reader->off + ZSBloomEntrySize(entry->nbytes) > reader->end ||
+			(reader->lastkey != InvalidZSTid && entry->lokey <= reader->lastkey))
+		{
+			/* not a chain we can follow anymore */
+			reader->valid = false;
+			break;
+		}
+
+		if (entry->lokey > lokey)
+			break;
+		reader->off += ZSBloomEntrySize(entry->nbytes);
+		reader->lastkey = entry->lokey;
+		if (entry->lokey == lokey)
+		{
+			if (entry->leafblk == leafblk && entry->leaflsn == leaflsn)
+				return entry;
+			break;
+		}
+	}
+	return NULL;
+}
+
+void
+zsbloom_end_read(ZSBloomReader *reader)
+{
+	if (reader->page)
+		pfree(reader->page);
+	reader->page = NULL;
+	reader->valid = false;
+}
+
+/*
+ * Can the bloom filters of attribute 'attno' be used for scan key 'key'?
+ * If so, computes the hash of the key's argument into *hash.
+ *
+ * Only equality with a constant of the attribute's own type, using the
+ * type's default equality operator, can be checked: the hash function must
+ * agree with the operator.
+ */
+bool
+zsbloom_hash_key(Relation rel, AttrNumber attno, ScanKey key, uint32 *hash)
+{
+	Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attno - 1);
+	TypeCacheEntry *typentry;
+
+	if (key->sk_attno != attno || key->sk_strategy != BTEqualStrategyNumber)
+		return false;
+	if (key->sk_flags & (SK_ISNULL | SK_ROW_HEADER | SK_ROW_MEMBER |
+						 SK_SEARCHARRAY | SK_SEARCHNULL | SK_SEARCHNOTNULL |
+						 SK_ORDER_BY))
+		return false;
+	if (key->sk_subtype != InvalidOid && key->sk_subtype != attr->atttypid)
+		return false;
+	if (key->sk_collation != attr->attcollation)
+		return false;
+
+	typentry = lookup_type_cache(attr->atttypid,
+								 TYPECACHE_EQ_OPR | TYPECACHE_HASH_PROC_FINFO);
+	if (!OidIsValid(typentry->hash_proc) ||
+		!OidIsValid(typentry->eq_opr) ||
+		key->sk_func.fn_oid != get_opcode(typentry->eq_opr))
+		return false;
+
+	*hash = zsbloom_hash_datum(typentry, attr->attcollation, key->sk_argument);
+	return true;
+}
+
+/*
+ * Might the leaf of 'entry' contain a value with hash 'hash'?
+ */
+bool
+zsbloom_entry_may_contain(ZSBloomEntry *entry, uint32 hash)
+{
+	uint32		nbits = entry->nbytes * BITS_PER_BYTE;
+	uint32		h2;
+
+	/* no filter for this leaf */
+	if (entry->nbytes == 0)
+		return true;
+
+	h2 = murmurhash32(hash) | 1;
+	for (int i = 0; i < ZS_BLOOM_NHASHES; i++)
+	{
+		uint32		bit = (hash + i * h2) & (nbits - 1);
+
+		if ((entry->bits[bit / BITS_PER_BYTE] & (1 << (bit % BITS_PER_BYTE))) == 0)
+			return false;
+	}
+	return true;
+}
+
+/* ----------------------------------------------------------------
+ *						 Internal routines
+ * ----------------------------------------------------------------
+ */
+
+static bool
+zsbloom_is_bloom_page(Page page, AttrNumber attno)
+{
+	ZSBloomPageOpaque *opaque;
+
+	if (PageIsNew(page) ||
+		PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSBloomPageOpaque)))
+		return false;
+	opaque = (ZSBloomPageOpaque *) PageGetSpecialPointer(page);
+	return opaque->zs_page_id == ZS_BLOOM_PAGE_ID && opaque->zs_attno == attno;
+}
+
+static uint32
+zsbloom_hash_datum(TypeCacheEntry *typentry, Oid collation, Datum datum)
+{
+	return DatumGetUInt32(FunctionCall1Coll(&typentry->hash_proc_finfo,
+											collation, datum));
+}
+
+/*
+ * Size of the filter for 'nvalues' values: about one byte per value, which
+ * with three bits set per value gives a false positive rate of a few
+ * percent, rounded up to a power of two so that bit positions can be masked.
+ */
+static int
+zsbloom_filter_size(int nvalues)
+{
+	int			nbytes = ZS_BLOOM_MIN_BYTES;
+
+	while (nbytes < nvalues && nbytes < ZS_BLOOM_MAX_BYTES)
+		nbytes *= 2;
+	return nbytes;
+}
+
+static void
+zsbloom_set(uint8 *bits, int nbytes, uint32 hash)
+{
+	uint32		nbits = nbytes * BITS_PER_BYTE;
+	uint32		h2 = murmurhash32(hash) | 1;
+
+	for (int i = 0; i < ZS_BLOOM_NHASHES; i++)
+	{
+		uint32		bit = (hash + i * h2) & (nbits - 1);
+
+		bits[bit / BITS_PER_BYTE] |= (1 << (bit % BITS_PER_BYTE));
+	}
+}
+
+static void
+zsbloom_init_page(Page page, AttrNumber attno)
+{
+	ZSBloomPageOpaque *opaque;
+
+	PageInit(page, BLCKSZ, sizeof(ZSBloomPageOpaque));
+	opaque = (ZSBloomPageOpaque *) PageGetSpecialPointer(page);
+	opaque->zs_next = InvalidBlockNumber;
+	opaque->zs_attno = attno;
+	opaque->zs_flags = 0;
+	opaque->padding1 = 0;
+	opaque->padding2 = 0;
+	opaque->padding3 = 0;
+	opaque->zs_page_id = ZS_BLOOM_PAGE_ID;
+
+	((PageHeader) page)->pd_lower = MAXALIGN(SizeOfPageHeaderData);
+}
+
+/*
+ * Write out a completed bloom page onto a buffer allocated for it, and
+ * release the buffer.
+ */
+static void
+zsbloom_write_page(Buffer buf, Page image)
+{
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+
+	START_CRIT_SECTION();
+	memcpy(BufferGetPage(buf), image, BLCKSZ);
+	MarkBufferDirty(buf);
+	log_newpage_buffer(buf, true);
+	END_CRIT_SECTION();
+
+	UnlockReleaseBuffer(buf);
+}
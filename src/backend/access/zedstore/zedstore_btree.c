@@ -20,11 +20,14 @@
  */
 #include "postgres.h"
 
+#include <math.h>
+
 #include "access/xlogutils.h"
 #include "access/zedstore_internal.h"
 #include "access/zedstore_undorec.h"
 #include "access/zedstore_wal.h"
 #include "miscadmin.h"
+#include "pg_trace.h"
 #include "storage/bufmgr.h"
 #include "storage/procarray.h"
 #include "utils/rel.h"
@@ -33,14 +36,50 @@
 static zs_split_stack *zsbt_split_internal_page(Relation rel, AttrNumber attno,
 												Buffer leftbuf, OffsetNumber newoff, List *downlinks);
 static zs_split_stack *zsbt_merge_pages(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf, bool target_is_left);
+static void zsbt_free_tree(Relation rel, AttrNumber attno, BlockNumber rootblk,
+						   Form_pg_attribute toast_attr);
 
 static int zsbt_binsrch_internal(zstid key, ZSBtreeInternalPageItem *arr, int arr_elems);
 
+/*
+ * Remember the downlinks around 'itemno' on level-1 page 'page' in the
+ * metacache, so that the next descents to nearby leaves can skip the
+ * internal pages.
+ */
+static void
+zsbt_cache_downlinks(Relation rel, AttrNumber attno, Page page, int itemno)
+{
+	ZSMetaCacheData *metacache = zsmeta_get_cache(rel);
+	ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+	ZSBtreeInternalPageItem *items = ZSBtreeInternalPageGetItems(page);
+	int			nitems = ZSBtreeInternalPageGetNumItems(page);
+	int			first;
+	int			ncached;
+
+	if (attno >= metacache->cache_nattributes)
+		return;
+
+	ncached = Min(nitems, ZS_CACHED_DOWNLINKS);
+	first = Max(itemno - ZS_CACHED_DOWNLINKS / 2, 0);
+	first = Min(first, nitems - ncached);
+
+	memcpy(metacache->cache_attrs[attno].downlinks, &items[first],
+		   ncached * sizeof(ZSBtreeInternalPageItem));
+	metacache->cache_attrs[attno].num_downlinks = ncached;
+	metacache->cache_attrs[attno].downlinks_hikey =
+		(first + ncached < nitems) ? items[first + ncached].tid : opaque->zs_hikey;
+}
+
 /*
  * Find the page containing the given key TID at the given level.
  *
  * Level 0 means leaf. The returned buffer is exclusive-locked.
  *
+ * When looking for a leaf, we first try the rightmost leaf, and then the
+ * downlinks cached from the last leaf-parent page visited, before descending
+ * from the root. The cached locations can be stale, but that's caught by the
+ * zsbt_page_is_expected() check on the leaf, like with concurrent splits.
+ *
  * If tree doesn't exist at all (probably because the table was just created
  * or truncated), the behavior depends on the 'readonly' argument. If
  * readonly == true, then returns InvalidBuffer. If readonly == false, then
@@ -48,6 +87,18 @@ static int zsbt_binsrch_internal(zstid key, ZSBtreeInternalPageItem *arr, int ar
  */
 Buffer
 zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly)
+{
+	return zsbt_descend_extended(rel, attno, key, level, readonly, NULL);
+}
+
+/*
+ * Like zsbt_descend(), but reads the pages using the given buffer access
+ * strategy. Large scans and VACUUM use this with a bulk-read ring, so that
+ * they don't flush the rest of shared_buffers.
+ */
+Buffer
+zsbt_descend_extended(Relation rel, AttrNumber attno, zstid key, int level,
+					  bool readonly, BufferAccessStrategy strategy)
 {
 	BlockNumber next;
 	Buffer		buf;
@@ -60,9 +111,12 @@ zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly
 	BlockNumber failblk = InvalidBlockNumber;
 	int			faillevel = -1;
 	ZSMetaCacheData *metacache;
+	bool		rightmost = false;
 
 	Assert(key != InvalidZSTid);
 
+	TRACE_POSTGRESQL_ZEDSTORE_DESCEND_START(RelationGetRelid(rel), attno, level);
+
 	/* Fast path for the very common case that we're looking for the rightmost page */
 	metacache = zsmeta_get_cache(rel);
 	if (level == 0 &&
@@ -72,6 +126,19 @@ zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly
 	{
 		next = metacache->cache_attrs[attno].rightmost;
 		nextlevel = 0;
+		rightmost = (attno == ZS_META_ATTRIBUTE_NUM);
+	}
+	else if (level == 0 &&
+			 attno < metacache->cache_nattributes &&
+			 metacache->cache_attrs[attno].num_downlinks > 0 &&
+			 key >= metacache->cache_attrs[attno].downlinks[0].tid &&
+			 key < metacache->cache_attrs[attno].downlinks_hikey)
+	{
+		itemno = zsbt_binsrch_internal(key, metacache->cache_attrs[attno].downlinks,
+									   metacache->cache_attrs[attno].num_downlinks);
+		Assert(itemno >= 0);
+		next = metacache->cache_attrs[attno].downlinks[itemno].childblk;
+		nextlevel = 0;
 	}
 	else
 	{
@@ -80,6 +147,8 @@ zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly
 		if (next == InvalidBlockNumber)
 		{
 			/* completely empty tree */
+			TRACE_POSTGRESQL_ZEDSTORE_DESCEND_DONE(RelationGetRelid(rel), attno,
+												   InvalidBlockNumber);
 			return InvalidBuffer;
 		}
 		nextlevel = -1;
@@ -97,8 +166,12 @@ zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly
 		if (next == failblk || next == ZS_META_BLK)
 			elog(ERROR, "arrived at incorrect block %u while descending zedstore btree", next);
 
-		buf = ReadBuffer(rel, next);
-		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);		/* TODO: shared */
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, next, RBM_NORMAL, strategy);
+		if (rightmost)
+			LockBufferWithWaitEvent(buf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_RIGHTMOST_TID_LEAF);
+		else
+			LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);		/* TODO: shared */
+		rightmost = false;		/* only the fast path's first page */
 		page = BufferGetPage(buf);
 		if (!zsbt_page_is_expected(rel, attno, key, nextlevel, buf))
 		{
@@ -117,7 +190,7 @@ zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly
 			failblk = next;
 			faillevel = nextlevel;
 			nextlevel = -1;
-			zsmeta_invalidate_cache(rel);
+			zsmeta_invalidate_cache_attr(rel, attno);
 			next = zsmeta_get_root_for_attribute(rel, attno, readonly);
 			if (next == InvalidBlockNumber)
 				elog(ERROR, "could not find root for attribute %d", attno);
@@ -160,19 +233,28 @@ zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly
 		next = items[itemno].childblk;
 		nextlevel--;
 
+		/* Remember the downlinks around the target, for the next descent */
+		if (nextlevel == 0 && level == 0)
+			zsbt_cache_downlinks(rel, attno, page, itemno);
+
 		UnlockReleaseBuffer(buf);
 	}
 
 	if (opaque->zs_level == 0 && opaque->zs_next == InvalidBlockNumber)
 	{
 		metacache = zsmeta_get_cache(rel);
-		if (attno < metacache->cache_nattributes)
+		if (attno < metacache->cache_nattributes &&
+			(metacache->cache_attrs[attno].rightmost != next ||
+			 metacache->cache_attrs[attno].rightmost_lokey != opaque->zs_lokey))
 		{
 			metacache->cache_attrs[attno].rightmost = next;
 			metacache->cache_attrs[attno].rightmost_lokey = opaque->zs_lokey;
+			zs_metacache_set_rightmost(rel, attno, next, opaque->zs_lokey);
 		}
 	}
 
+	TRACE_POSTGRESQL_ZEDSTORE_DESCEND_DONE(RelationGetRelid(rel), attno,
+										   BufferGetBlockNumber(buf));
 	return buf;
 }
 
@@ -187,10 +269,13 @@ zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly
  * That should only happen after ALTER TABLE ADD COLUMN. Or on a newly
  * created table, but none of the current callers would even try to
  * fetch attribute data, without scanning the TID tree first.)
+ *
+ * Pages are read using 'strategy', which may be NULL.
  */
 Buffer
 zsbt_find_and_lock_leaf_containing_tid(Relation rel, AttrNumber attno,
-									   Buffer buf, zstid nexttid, int lockmode)
+									   Buffer buf, zstid nexttid, int lockmode,
+									   BufferAccessStrategy strategy)
 {
 	if (BufferIsValid(buf))
 	{
@@ -221,7 +306,9 @@ retry:
 				if (next != InvalidBlockNumber)
 				{
 					LockBuffer(buf, BUFFER_LOCK_UNLOCK);
-					buf = ReleaseAndReadBuffer(buf, rel, next);
+					ReleaseBuffer(buf);
+					buf = ReadBufferExtended(rel, MAIN_FORKNUM, next,
+											 RBM_NORMAL, strategy);
 					goto retry;
 				}
 			}
@@ -233,11 +320,763 @@ retry:
 
 	/* Descend the B-tree to find the correct leaf page. */
 	if (!BufferIsValid(buf))
-		buf = zsbt_descend(rel, attno, nexttid, 0, true);
+		buf = zsbt_descend_extended(rel, attno, nexttid, 0, true, strategy);
+
+	return buf;
+}
+
+/*
+ * Find the internal page at level 1 that has the downlink for the leaf
+ * containing the given key. The returned buffer is share-locked.
+ *
+ * This is used for things that need to know about leaf pages, without
+ * reading them. It doesn't retry: if we land on an unexpected page, because
+ * of a concurrent split for example, returns InvalidBuffer. *noparent is set
+ * if there is no such page, because the tree doesn't exist or consists of
+ * just a root leaf; InvalidBuffer is returned in that case too.
+ */
+static Buffer
+zsbt_find_leaf_parent(Relation rel, AttrNumber attno, zstid key, bool *noparent)
+{
+	BlockNumber next;
+	int			level;
+
+	*noparent = false;
+
+	next = zsmeta_get_root_for_attribute(rel, attno, true);
+	if (next == InvalidBlockNumber)
+	{
+		*noparent = true;
+		return InvalidBuffer;
+	}
+	level = -1;
+	for (;;)
+	{
+		Buffer		buf;
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		ZSBtreeInternalPageItem *items;
+		int			nitems;
+		int			itemno;
+
+		buf = ReadBuffer(rel, next);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		if (!zsbt_page_is_expected(rel, attno, key, level, buf))
+		{
+			UnlockReleaseBuffer(buf);
+			return InvalidBuffer;
+		}
+		page = BufferGetPage(buf);
+		opaque = ZSBtreePageGetOpaque(page);
+
+		if (opaque->zs_level == 1)
+			return buf;
+		if (opaque->zs_level == 0)
+		{
+			/* the root is a leaf */
+			UnlockReleaseBuffer(buf);
+			*noparent = true;
+			return InvalidBuffer;
+		}
+
+		items = ZSBtreeInternalPageGetItems(page);
+		nitems = ZSBtreeInternalPageGetNumItems(page);
+		itemno = zsbt_binsrch_internal(key, items, nitems);
+		if (itemno < 0)
+		{
+			UnlockReleaseBuffer(buf);
+			return InvalidBuffer;
+		}
+		next = items[itemno].childblk;
+		level = opaque->zs_level - 1;
+		UnlockReleaseBuffer(buf);
+	}
+}
+
+/*
+ * Issue a prefetch request for the leaf page containing the given key.
+ *
+ * The internal pages on the way down are read normally; they are usually
+ * in the buffer cache anyway. Only the leaf is prefetched. The downlinks
+ * around it are cached like in zsbt_descend(), so reading the leaf after
+ * the prefetch doesn't need to visit the internal pages again. On return,
+ * *range is set to the range of keys that the prefetched leaf covers, so
+ * that the caller can avoid prefetching the same leaf again for nearby
+ * keys.
+ *
+ * This is just a hint. If we land on an unexpected page, because of a
+ * concurrent split for example, we just give up.
+ */
+void
+zsbt_prefetch_leaf(Relation rel, AttrNumber attno, zstid key, ZSTidRange *range)
+{
+#ifdef USE_PREFETCH
+	ZSMetaCacheData *metacache;
+	Buffer		buf;
+	bool		noparent;
+	Page		page;
+	ZSBtreePageOpaque *opaque;
+	ZSBtreeInternalPageItem *items;
+	int			nitems;
+	int			itemno;
+#endif
+
+	range->start = key;
+	range->end = key + 1;
+
+#ifdef USE_PREFETCH
+	/* Fast path for the rightmost leaf, like in zsbt_descend() */
+	metacache = zsmeta_get_cache(rel);
+	if (attno < metacache->cache_nattributes &&
+		metacache->cache_attrs[attno].rightmost != InvalidBlockNumber &&
+		key >= metacache->cache_attrs[attno].rightmost_lokey)
+	{
+		PrefetchBuffer(rel, MAIN_FORKNUM, metacache->cache_attrs[attno].rightmost);
+		range->start = metacache->cache_attrs[attno].rightmost_lokey;
+		range->end = MaxPlusOneZSTid;
+		return;
+	}
+
+	/* Likewise for the cached downlinks */
+	if (attno < metacache->cache_nattributes &&
+		metacache->cache_attrs[attno].num_downlinks > 0 &&
+		key >= metacache->cache_attrs[attno].downlinks[0].tid &&
+		key < metacache->cache_attrs[attno].downlinks_hikey)
+	{
+		int			ncached = metacache->cache_attrs[attno].num_downlinks;
+
+		items = metacache->cache_attrs[attno].downlinks;
+		itemno = zsbt_binsrch_internal(key, items, ncached);
+		Assert(itemno >= 0);
+		range->start = items[itemno].tid;
+		if (itemno + 1 < ncached)
+			range->end = items[itemno + 1].tid;
+		else
+			range->end = metacache->cache_attrs[attno].downlinks_hikey;
+		PrefetchBuffer(rel, MAIN_FORKNUM, items[itemno].childblk);
+		return;
+	}
+
+	buf = zsbt_find_leaf_parent(rel, attno, key, &noparent);
+	if (!BufferIsValid(buf))
+	{
+		/*
+		 * If the tree doesn't exist, there is nothing to prefetch. If the
+		 * root is a leaf, zsbt_find_leaf_parent() just read it.
+		 */
+		if (noparent)
+		{
+			range->start = MinZSTid;
+			range->end = MaxPlusOneZSTid;
+		}
+		return;
+	}
+	page = BufferGetPage(buf);
+	opaque = ZSBtreePageGetOpaque(page);
+	items = ZSBtreeInternalPageGetItems(page);
+	nitems = ZSBtreeInternalPageGetNumItems(page);
+	itemno = zsbt_binsrch_internal(key, items, nitems);
+	if (itemno >= 0)
+	{
+		range->start = items[itemno].tid;
+		if (itemno + 1 < nitems)
+			range->end = items[itemno + 1].tid;
+		else
+			range->end = opaque->zs_hikey;
+		PrefetchBuffer(rel, MAIN_FORKNUM, items[itemno].childblk);
+
+		/* so that the descent to read the leaf can skip the internal pages */
+		zsbt_cache_downlinks(rel, attno, page, itemno);
+	}
+	UnlockReleaseBuffer(buf);
+#endif							/* USE_PREFETCH */
+}
+
+/*
+ * Read-ahead for scans that read a whole tree in key order.
+ *
+ * The leaves of different attribute trees are interleaved in the file, so
+ * OS readahead doesn't help much with sequential scans. Instead, we read
+ * the downlinks of the next leaves after the one containing 'key' from the
+ * parent page, and issue prefetch requests for them. How many leaves are
+ * prefetched is based on effective_io_concurrency.
+ *
+ * Returns the key at which the caller should call this again, to keep the
+ * read-ahead going. That's about halfway through the prefetched leaves, so
+ * that there are always some prefetches in flight.
+ */
+zstid
+zsbt_prefetch_leaves(Relation rel, AttrNumber attno, zstid key)
+{
+#ifdef USE_PREFETCH
+	Buffer		buf;
+	bool		noparent;
+	Page		page;
+	ZSBtreePageOpaque *opaque;
+	ZSBtreeInternalPageItem *items;
+	int			nitems;
+	int			itemno;
+	int			nleaves;
+	int			last;
+	zstid		trigger;
+
+	if (target_prefetch_pages <= 0)
+		return MaxPlusOneZSTid;
+	nleaves = Min(Max(target_prefetch_pages, ZSBT_MIN_PREFETCH_LEAVES), ZSBT_MAX_PREFETCH_LEAVES);
+
+	buf = zsbt_find_leaf_parent(rel, attno, key, &noparent);
+	if (!BufferIsValid(buf))
+	{
+		/* If there are no internal pages, there's nothing to read ahead */
+		return noparent ? MaxPlusOneZSTid : key + 1;
+	}
+	page = BufferGetPage(buf);
+	opaque = ZSBtreePageGetOpaque(page);
+	items = ZSBtreeInternalPageGetItems(page);
+	nitems = ZSBtreeInternalPageGetNumItems(page);
+	itemno = zsbt_binsrch_internal(key, items, nitems);
+	if (itemno < 0)
+	{
+		UnlockReleaseBuffer(buf);
+		return key + 1;
+	}
+
+	last = Min(itemno + nleaves, nitems - 1);
+	for (int i = itemno + 1; i <= last; i++)
+		PrefetchBuffer(rel, MAIN_FORKNUM, items[i].childblk);
+
+	/*
+	 * Continue halfway through the leaves we just prefetched, or at the next
+	 * parent page if this was the last leaf under this one.
+	 */
+	if (itemno == nitems - 1)
+		trigger = opaque->zs_hikey;
+	else
+		trigger = items[Min(itemno + Max(nleaves / 2, 1), nitems - 1)].tid;
+
+	UnlockReleaseBuffer(buf);
+
+	return trigger;
+#else
+	return MaxPlusOneZSTid;
+#endif							/* USE_PREFETCH */
+}
+
+/*
+ * Find a key range boundary, approximately 'nleaves' leaf pages to the right
+ * of 'key'.
+ *
+ * The boundary is read from the downlinks of the internal page above the
+ * leaf containing 'key', so the result is the low key of a leaf, or the high
+ * key of that internal page if it has fewer than 'nleaves' downlinks to the
+ * right. The leaves are not read. This is used to divide a tree into pieces
+ * of roughly equal physical size, regardless of how densely the keys are
+ * packed.
+ *
+ * Returns MaxPlusOneZSTid if the tree consists of just one leaf, or
+ * InvalidZSTid if the boundary could not be determined because of concurrent
+ * changes.
+ */
+zstid
+zsbt_find_leaf_boundary(Relation rel, AttrNumber attno, zstid key, int nleaves)
+{
+	Buffer		buf;
+	bool		noparent;
+	Page		page;
+	ZSBtreePageOpaque *opaque;
+	ZSBtreeInternalPageItem *items;
+	int			nitems;
+	int			itemno;
+	zstid		result;
+
+	Assert(nleaves >= 1);
+
+	buf = zsbt_find_leaf_parent(rel, attno, key, &noparent);
+	if (!BufferIsValid(buf))
+		return noparent ? MaxPlusOneZSTid : InvalidZSTid;
+
+	page = BufferGetPage(buf);
+	opaque = ZSBtreePageGetOpaque(page);
+	items = ZSBtreeInternalPageGetItems(page);
+	nitems = ZSBtreeInternalPageGetNumItems(page);
+	itemno = zsbt_binsrch_internal(key, items, nitems);
+	if (itemno < 0)
+		result = InvalidZSTid;
+	else if (itemno + nleaves < nitems)
+		result = items[itemno + nleaves].tid;
+	else
+		result = opaque->zs_hikey;
+	UnlockReleaseBuffer(buf);
+
+	return result;
+}
+
+/*
+ * Collect the key ranges of all the leaf pages of a tree, in key order.
+ *
+ * The ranges are read from the downlinks on the internal pages at level 1,
+ * so the leaves themselves are not read. If the tree consists of just a root
+ * leaf, or doesn't exist, a single range covering all keys is returned.
+ *
+ * On return, *ranges_p points to a palloc'd array, and the number of ranges
+ * is returned. If the level 1 pages change concurrently, we start over, so
+ * the ranges were accurate at some point during the call.
+ */
+int
+zsbt_leaf_ranges(Relation rel, AttrNumber attno, ZSTidRange **ranges_p)
+{
+	ZSTidRange *ranges;
+	int			nranges;
+	int			maxranges;
+	Buffer		buf;
+	bool		noparent;
+
+	maxranges = 16;
+	ranges = palloc(maxranges * sizeof(ZSTidRange));
+
+restart:
+	CHECK_FOR_INTERRUPTS();
+	nranges = 0;
+
+	buf = zsbt_find_leaf_parent(rel, attno, MinZSTid, &noparent);
+	if (!BufferIsValid(buf))
+	{
+		if (!noparent)
+			goto restart;
+		ranges[0].start = MinZSTid;
+		ranges[0].end = MaxPlusOneZSTid;
+		*ranges_p = ranges;
+		return 1;
+	}
+
+	for (;;)
+	{
+		Page		page = BufferGetPage(buf);
+		ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+		ZSBtreeInternalPageItem *items = ZSBtreeInternalPageGetItems(page);
+		int			nitems = ZSBtreeInternalPageGetNumItems(page);
+		BlockNumber next = opaque->zs_next;
+		zstid		hikey = opaque->zs_hikey;
+
+		if (nranges + nitems > maxranges)
+		{
+			maxranges = Max(maxranges * 2, nranges + nitems);
+			ranges = repalloc(ranges, maxranges * sizeof(ZSTidRange));
+		}
+		for (int i = 0; i < nitems; i++)
+		{
+			ranges[nranges].start = items[i].tid;
+			ranges[nranges].end = (i + 1 < nitems) ? items[i + 1].tid : hikey;
+			nranges++;
+		}
+		UnlockReleaseBuffer(buf);
+
+		if (next == InvalidBlockNumber || hikey == MaxPlusOneZSTid)
+			break;
+
+		buf = ReadBuffer(rel, next);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		if (!zsbt_page_is_expected(rel, attno, hikey, 1, buf))
+		{
+			UnlockReleaseBuffer(buf);
+			goto restart;
+		}
+	}
+
+	*ranges_p = ranges;
+	return nranges;
+}
+
+/*
+ * Estimate the number of pages in a tree, for the planner.
+ *
+ * Descends from the root to a leaf, following the middle downlink on each
+ * level, and assumes that every internal page on a level has as many
+ * downlinks as the one visited. That's only a few page reads per tree, and
+ * close enough, because the pages are kept reasonably full. Returns 0 if the
+ * tree doesn't exist.
+ */
+BlockNumber
+zsbt_estimate_tree_pages(Relation rel, AttrNumber attno)
+{
+	BlockNumber next;
+	zstid		key = MinZSTid;
+	int			level = -1;
+	double		levelpages = 1;
+	double		totalpages = 0;
 
+	next = zsmeta_get_root_for_attribute(rel, attno, true);
+	while (next != InvalidBlockNumber)
+	{
+		Buffer		buf;
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		ZSBtreeInternalPageItem *items;
+		int			nitems;
+
+		buf = ReadBuffer(rel, next);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+		/* on concurrent changes, go with what we have so far */
+		if (!zsbt_page_is_expected(rel, attno, key, level, buf))
+		{
+			UnlockReleaseBuffer(buf);
+			break;
+		}
+		totalpages += levelpages;
+
+		page = BufferGetPage(buf);
+		opaque = ZSBtreePageGetOpaque(page);
+		items = ZSBtreeInternalPageGetItems(page);
+		nitems = ZSBtreeInternalPageGetNumItems(page);
+		if (opaque->zs_level == 0 || nitems == 0)
+		{
+			UnlockReleaseBuffer(buf);
+			break;
+		}
+
+		levelpages *= nitems;
+		key = items[nitems / 2].tid;
+		next = items[nitems / 2].childblk;
+		level = opaque->zs_level - 1;
+		UnlockReleaseBuffer(buf);
+	}
+
+	return (BlockNumber) Min(totalpages, (double) MaxBlockNumber);
+}
+
+/*
+ * Number of leaf pages read by zsbt_gather_tree_stats(), to estimate the
+ * amount of data in a tree.
+ */
+#define ZS_STATS_SAMPLE_LEAVES		30
+
+/* Add the data on one leaf page to the leaf statistics in 'stats' */
+static void
+zsbt_leaf_stats_add(AttrNumber attno, Page page, ZSTreeStats *stats)
+{
+	stats->zs_leaf_bytes += BLCKSZ - SizeOfPageHeaderData -
+		PageGetSpecialSize(page) - PageGetExactFreeSpace(page);
+
+	if (attno == ZS_META_ATTRIBUTE_NUM)
+	{
+		uint64		ntids = 0;
+		uint64		span = 0;
+
+		zsbt_tid_page_tid_stats(page, &ntids, &span);
+		stats->zs_leaf_tids += ntids;
+		stats->zs_leaf_tid_span += span;
+		stats->zs_leaf_raw_bytes += ntids * sizeof(zstid);
+	}
+	else
+		stats->zs_leaf_raw_bytes += zsbt_attr_page_raw_bytes(page);
+}
+
+/*
+ * Collect the block numbers of all the leaf pages of a tree, in key order.
+ *
+ * The internal levels are walked from left to right, and the leaf block
+ * numbers are read from the downlinks at level 1, so the leaves themselves
+ * are not read. On return, *nleaves_p is the number of leaves, and
+ * *ninternal_p the number of internal pages. Returns NULL if the tree
+ * doesn't exist. If the root is a leaf, it's the only element. Pages that
+ * are split or merged concurrently can be missed or counted twice.
+ */
+static BlockNumber *
+zsbt_collect_leaves(Relation rel, AttrNumber attno, BufferAccessStrategy strategy,
+					int *nleaves_p, BlockNumber *ninternal_p)
+{
+	BlockNumber next;
+	int			level = -1;
+	BlockNumber *leaves = NULL;
+	int			nleaves = 0;
+	int			maxleaves = 0;
+	BlockNumber ninternal = 0;
+
+	next = zsmeta_get_root_for_attribute(rel, attno, true);
+	while (next != InvalidBlockNumber)
+	{
+		BlockNumber levelstart = InvalidBlockNumber;
+
+		/* walk one level, from left to right */
+		while (next != InvalidBlockNumber)
+		{
+			Buffer		buf;
+			Page		page;
+			ZSBtreePageOpaque *opaque;
+			ZSBtreeInternalPageItem *items;
+			int			nitems;
+
+			CHECK_FOR_INTERRUPTS();
+
+			buf = ReadBufferExtended(rel, MAIN_FORKNUM, next, RBM_NORMAL, strategy);
+			LockBuffer(buf, BUFFER_LOCK_SHARE);
+			page = BufferGetPage(buf);
+			opaque = ZSBtreePageGetOpaque(page);
+
+			/* the page might have been deleted and reused concurrently */
+			if (PageIsNew(page) ||
+				PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSBtreePageOpaque)) ||
+				opaque->zs_page_id != ZS_BTREE_PAGE_ID ||
+				opaque->zs_attno != attno ||
+				(level != -1 && opaque->zs_level != level))
+			{
+				UnlockReleaseBuffer(buf);
+				break;
+			}
+			level = opaque->zs_level;
+
+			if (level == 0)
+			{
+				/* the root is a leaf */
+				UnlockReleaseBuffer(buf);
+				leaves = palloc(sizeof(BlockNumber));
+				leaves[0] = next;
+				*nleaves_p = 1;
+				*ninternal_p = 0;
+				return leaves;
+			}
+
+			ninternal++;
+			items = ZSBtreeInternalPageGetItems(page);
+			nitems = ZSBtreeInternalPageGetNumItems(page);
+			if (levelstart == InvalidBlockNumber && nitems > 0)
+				levelstart = items[0].childblk;
+			if (level == 1)
+			{
+				if (nleaves + nitems > maxleaves)
+				{
+					maxleaves = Max(maxleaves * 2, nleaves + nitems);
+					if (leaves)
+						leaves = repalloc(leaves, maxleaves * sizeof(BlockNumber));
+					else
+						leaves = palloc(maxleaves * sizeof(BlockNumber));
+				}
+				for (int i = 0; i < nitems; i++)
+					leaves[nleaves++] = items[i].childblk;
+			}
+			next = opaque->zs_next;
+			UnlockReleaseBuffer(buf);
+		}
+
+		if (level <= 1)
+			break;
+		next = levelstart;
+		level--;
+	}
+
+	*nleaves_p = nleaves;
+	*ninternal_p = ninternal;
+	return leaves;
+}
+
+/*
+ * Read leaf page 'blkno' of a tree, and lock it in share mode.
+ *
+ * Returns InvalidBuffer if the page is not a leaf of the tree anymore,
+ * because it was deleted concurrently.
+ */
+static Buffer
+zsbt_read_sampled_leaf(Relation rel, AttrNumber attno, BlockNumber blkno,
+					   BufferAccessStrategy strategy)
+{
+	Buffer		buf;
+	Page		page;
+	ZSBtreePageOpaque *opaque;
+
+	CHECK_FOR_INTERRUPTS();
+
+	buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	opaque = ZSBtreePageGetOpaque(page);
+	if (PageIsNew(page) ||
+		PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSBtreePageOpaque)) ||
+		opaque->zs_page_id != ZS_BTREE_PAGE_ID ||
+		opaque->zs_attno != attno ||
+		opaque->zs_level != 0)
+	{
+		UnlockReleaseBuffer(buf);
+		return InvalidBuffer;
+	}
 	return buf;
 }
 
+/*
+ * Gather size statistics of a tree, for zsmeta_update_stats().
+ *
+ * The internal levels are walked from left to right, which gives exact page
+ * counts by reading only a small fraction of the tree. The amount of data on
+ * the leaves is extrapolated from a sample of ZS_STATS_SAMPLE_LEAVES leaves.
+ * Concurrent changes can make the result slightly off, which is fine for
+ * statistics.
+ */
+void
+zsbt_gather_tree_stats(Relation rel, AttrNumber attno, ZSTreeStats *stats,
+					   BufferAccessStrategy strategy)
+{
+	BlockNumber *leaves;
+	int			nleaves = 0;
+	BlockNumber ninternal = 0;
+	ZSTreeStats sampled;
+	int			nsampled = 0;
+
+	memset(stats, 0, sizeof(ZSTreeStats));
+	memset(&sampled, 0, sizeof(ZSTreeStats));
+
+	leaves = zsbt_collect_leaves(rel, attno, strategy, &nleaves, &ninternal);
+
+	stats->zs_leaf_pages = nleaves;
+	stats->zs_total_pages = ninternal + nleaves;
+
+	/* Read a sample of evenly-spaced leaves */
+	for (int i = 0; i < Min(nleaves, ZS_STATS_SAMPLE_LEAVES); i++)
+	{
+		BlockNumber blkno = leaves[(uint64) i * nleaves / Min(nleaves, ZS_STATS_SAMPLE_LEAVES)];
+		Buffer		buf;
+
+		buf = zsbt_read_sampled_leaf(rel, attno, blkno, strategy);
+		if (BufferIsValid(buf))
+		{
+			zsbt_leaf_stats_add(attno, BufferGetPage(buf), &sampled);
+			nsampled++;
+			UnlockReleaseBuffer(buf);
+		}
+	}
+	if (nsampled > 0)
+	{
+		double		scale = (double) nleaves / nsampled;
+
+		stats->zs_leaf_bytes = (uint64) (sampled.zs_leaf_bytes * scale);
+		stats->zs_leaf_raw_bytes = (uint64) (sampled.zs_leaf_raw_bytes * scale);
+		stats->zs_leaf_tids = (uint64) (sampled.zs_leaf_tids * scale);
+		stats->zs_leaf_tid_span = (uint64) (sampled.zs_leaf_tid_span * scale);
+	}
+
+	if (leaves)
+		pfree(leaves);
+}
+
+/*
+ * Measure the physical layout of a tree, for pg_zs_fragmentation().
+ *
+ * The number of leaves, and the runs of leaves that are stored in
+ * consecutive blocks, are counted from the downlinks, without reading the
+ * leaves. Every leaf is part of a run; a tree whose leaves are all in key
+ * order, next to each other, has just one run. The space usage is measured
+ * on an evenly-spaced sample of about 'sample_fraction' of the leaves, but
+ * at least one. Only share locks are taken, one page at a time, so this can
+ * be used on a busy table.
+ */
+void
+zsbt_tree_fragmentation(Relation rel, AttrNumber attno, double sample_fraction,
+						BufferAccessStrategy strategy, ZSTreeFragmentation *frag)
+{
+	BlockNumber *leaves;
+	int			nleaves = 0;
+	BlockNumber ninternal = 0;
+	int			nsample;
+
+	memset(frag, 0, sizeof(ZSTreeFragmentation));
+
+	leaves = zsbt_collect_leaves(rel, attno, strategy, &nleaves, &ninternal);
+	if (nleaves == 0)
+		return;
+
+	frag->leaf_pages = nleaves;
+	frag->leaf_runs = 1;
+	for (int i = 1; i < nleaves; i++)
+	{
+		if (leaves[i] != leaves[i - 1] + 1)
+			frag->leaf_runs++;
+	}
+
+	nsample = (int) Min((double) nleaves, ceil(nleaves * sample_fraction));
+	nsample = Max(nsample, 1);
+	for (int i = 0; i < nsample; i++)
+	{
+		BlockNumber blkno = leaves[((uint64) i * nleaves + nleaves / 2) / nsample];
+		Buffer		buf;
+		Page		page;
+		Size		freespace;
+		Size		used;
+
+		buf = zsbt_read_sampled_leaf(rel, attno, blkno, strategy);
+		if (!BufferIsValid(buf))
+			continue;
+		page = BufferGetPage(buf);
+
+		freespace = PageGetExactFreeSpace(page);
+		used = BLCKSZ - SizeOfPageHeaderData - PageGetSpecialSize(page) - freespace;
+		frag->sampled_pages++;
+		frag->free_bytes += freespace;
+		frag->used_bytes += used;
+
+		/* TID array items are not compressed */
+		if (attno == ZS_META_ATTRIBUTE_NUM)
+			frag->uncompressed_bytes += used;
+		else
+			zsbt_attr_page_stream_sizes(page, &frag->compressed_bytes,
+										&frag->uncompressed_bytes);
+		UnlockReleaseBuffer(buf);
+	}
+
+	pfree(leaves);
+}
+
+static int
+zsbt_blocknumber_cmp(const void *a, const void *b)
+{
+	BlockNumber blka = *(const BlockNumber *) a;
+	BlockNumber blkb = *(const BlockNumber *) b;
+
+	if (blka < blkb)
+		return -1;
+	if (blka > blkb)
+		return 1;
+	return 0;
+}
+
+/*
+ * Load all the pages of a tree into shared buffers, for zedstore_prewarm().
+ *
+ * The internal pages are read while collecting the downlinks to the
+ * leaves, and the leaves are then read in physical order, with prefetching,
+ * so that they can be read with mostly sequential I/O even if the tree is
+ * fragmented. Returns the number of pages read.
+ */
+BlockNumber
+zsbt_prewarm_tree(Relation rel, AttrNumber attno)
+{
+	BlockNumber *leaves;
+	int			nleaves = 0;
+	BlockNumber ninternal = 0;
+#ifdef USE_PREFETCH
+	int			prefetched = 0;
+#endif
+
+	leaves = zsbt_collect_leaves(rel, attno, NULL, &nleaves, &ninternal);
+	if (nleaves == 0)
+		return ninternal;
+
+	qsort(leaves, nleaves, sizeof(BlockNumber), zsbt_blocknumber_cmp);
+	for (int i = 0; i < nleaves; i++)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+#ifdef USE_PREFETCH
+		while (prefetched < nleaves &&
+			   prefetched < i + Max(target_prefetch_pages, 1))
+			PrefetchBuffer(rel, MAIN_FORKNUM, leaves[prefetched++]);
+#endif
+
+		ReleaseBuffer(ReadBuffer(rel, leaves[i]));
+	}
+	pfree(leaves);
+
+	return ninternal + nleaves;
+}
+
 
 /*
  * Check that a page is a valid B-tree page, and covers the given key.
@@ -310,15 +1149,18 @@ zsbt_newroot(Relation rel, AttrNumber attno, int level, List *downlinks)
 	ZSBtreePageOpaque *newrootopaque;
 	ZSBtreeInternalPageItem *items;
 	Buffer		metabuf;
+	Buffer		dirbuf;
+	Page		dirpage;
+	BlockNumber *rootloc;
 	zs_split_stack *stack1;
 	zs_split_stack *stack2;
 	ListCell   *lc;
 	int			i;
 
-	newrootbuf = zspage_getnewbuf(rel);
+	newrootbuf = zspage_getnewbuf(rel, attno);
 
 	metabuf = ReadBuffer(rel, ZS_META_BLK);
-	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
 
 	/* allocate a new root page */
 	newrootpage = palloc(BLCKSZ);
@@ -346,20 +1188,40 @@ zsbt_newroot(Relation rel, AttrNumber attno, int level, List *downlinks)
 
 	/* FIXME: Check that all the downlinks fit on the page. */
 
-	/* update the metapage */
-	metapage = PageGetTempPageCopy(BufferGetPage(metabuf));
+	/* update the root directory */
+	metapage = BufferGetPage(metabuf);
 
 	metapg = (ZSMetaPage *) PageGetContents(metapage);
 	if ((attno != ZS_META_ATTRIBUTE_NUM) && (attno <= 0 || attno > metapg->nattributes))
 		elog(ERROR, "invalid attribute number %d (table \"%s\" has only %d attributes)",
 			 attno, RelationGetRelationName(rel), metapg->nattributes);
 
-	metapg->tree_root_dir[attno].root = BufferGetBlockNumber(newrootbuf);
+	rootloc = zsmeta_root_location(rel, metabuf, attno, BUFFER_LOCK_EXCLUSIVE, &dirbuf);
+	dirpage = PageGetTempPageCopy(BufferGetPage(dirbuf));
+	*(BlockNumber *) (dirpage + ((char *) rootloc - (char *) BufferGetPage(dirbuf))) =
+		BufferGetBlockNumber(newrootbuf);
+
+	stack1 = zs_new_split_stack_entry(dirbuf, dirpage);
+	if (dirbuf != metabuf)
+	{
+		/*
+		 * The entry is on a root directory overflow page. The metapage isn't
+		 * modified, but it must stay locked until the change has been
+		 * applied, so put it on the stack too.
+		 */
+		zs_split_stack *metastack;
 
-	stack1 = zs_new_split_stack_entry(metabuf, metapage);
+		metastack = zs_new_split_stack_entry(metabuf, PageGetTempPageCopy(metapage));
+		metastack->special_only = true;
+		metastack->next = stack1;
+		stack1 = metastack;
+	}
 	stack2 = zs_new_split_stack_entry(newrootbuf, newrootpage);
 	stack2->next = stack1;
 
+	/* the metapage stays locked until the new root is in place */
+	zs_metacache_invalidate(rel);
+
 	return stack2;
 }
 
@@ -531,7 +1393,7 @@ zsbt_split_internal_page(Relation rel, AttrNumber attno, Buffer origbuf,
 			BlockNumber blkno;
 			ZSBtreeInternalPageItem *downlink;
 
-			buf = zspage_getnewbuf(rel);
+			buf = zspage_getnewbuf(rel, attno);
 			blkno = BufferGetBlockNumber(buf);
 			page = palloc(BLCKSZ);
 			PageInit(page, BLCKSZ, sizeof(ZSBtreePageOpaque));
@@ -576,8 +1438,12 @@ zsbt_split_internal_page(Relation rel, AttrNumber attno, Buffer origbuf,
 
 			stack->next = zsbt_newroot(rel, attno, origopaque->zs_level + 1, downlinks);
 
-			/* clear the ZSBT_ROOT flag on the old root page */
-			ZSBtreePageGetOpaque(stack_first->page)->zs_flags &= ~ZSBT_ROOT;
+			/*
+			 * Clear the ZSBT_ROOT flag on the old root page, and the summary
+			 * of the tree, which only the root carries.
+			 */
+			ZSBtreePageGetOpaque(stack_first->page)->zs_flags &=
+				~(ZSBT_ROOT | ZSBT_ATTR_SYNOPSIS | ZSBT_ATTR_SUMMARY_PENDING);
 		}
 		else
 		{
@@ -632,36 +1498,87 @@ zsbt_unlink_page(Relation rel, AttrNumber attno, Buffer buf, int level)
 	}
 	else
 	{
-		rightbuf = zsbt_descend(rel, attno, opaque->zs_hikey, level, false);
-		leftbuf = buf;
-		stack = zsbt_merge_pages(rel, attno, leftbuf, rightbuf, true);
-		if (!stack)
-		{
-			UnlockReleaseBuffer(rightbuf);
-			return NULL;
-		}
+		rightbuf = zsbt_descend(rel, attno, opaque->zs_hikey, level, false);
+		leftbuf = buf;
+		stack = zsbt_merge_pages(rel, attno, leftbuf, rightbuf, true);
+		if (!stack)
+		{
+			UnlockReleaseBuffer(rightbuf);
+			return NULL;
+		}
+	}
+
+	return stack;
+}
+
+/*
+ * Page deletion:
+ *
+ * Mark page empty, remove downlink. If parent becomes empty, recursively delete it.
+ *
+ * Unlike in the nbtree index, we don't need to worry about concurrent scans. They
+ * will simply retry if they land on an unexpected page.
+ */
+static zs_split_stack *
+zsbt_merge_pages(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf, bool target_is_left)
+{
+	Page		origleftpage;
+	Page		leftpage;
+	Page		rightpage;
+	ZSBtreePageOpaque *leftopaque;
+	ZSBtreePageOpaque *origleftopaque;
+	ZSBtreePageOpaque *rightopaque;
+
+	origleftpage = BufferGetPage(leftbuf);
+	origleftopaque = ZSBtreePageGetOpaque(origleftpage);
+	rightpage = BufferGetPage(rightbuf);
+	rightopaque = ZSBtreePageGetOpaque(rightpage);
+
+	if (target_is_left)
+	{
+		/* move all items from right to left before unlinking the right page */
+		leftpage = PageGetTempPageCopy(rightpage);
+		leftopaque = ZSBtreePageGetOpaque(leftpage);
+
+		memcpy(leftopaque, origleftopaque, sizeof(ZSBtreePageOpaque));
+
+		/* but the synopsis must describe the items, from the right page */
+		leftopaque->zs_flags &= ~(ZSBT_ATTR_SYNOPSIS | ZSBT_TID_UNDO_SYNOPSIS);
+		leftopaque->zs_flags |= rightopaque->zs_flags & (ZSBT_ATTR_SYNOPSIS | ZSBT_TID_UNDO_SYNOPSIS);
+		leftopaque->zs_nullcount = rightopaque->zs_nullcount;
+		leftopaque->zs_minval = rightopaque->zs_minval;
+		leftopaque->zs_maxval = rightopaque->zs_maxval;
+	}
+	else
+	{
+		/* right page is empty. */
+		leftpage = PageGetTempPageCopy(origleftpage);
 	}
 
-	return stack;
+	return zsbt_merge_into_left(rel, attno, leftbuf, rightbuf, leftpage);
 }
 
 /*
- * Page deletion:
+ * Replace the contents of 'leftbuf' with 'newleftpage', and unlink its right
+ * sibling, 'rightbuf', from the tree.
  *
- * Mark page empty, remove downlink. If parent becomes empty, recursively delete it.
+ * 'newleftpage' must contain everything that should remain on the two pages.
+ * Its hikey and right-link are set here, from the right page. Both buffers
+ * must be exclusively-locked. The right page is marked for recycling in the
+ * Free Page Map.
  *
- * Unlike in the nbtree index, we don't need to worry about concurrent scans. They
- * will simply retry if they land on an unexpected page.
+ * Returns a split stack with the changes, to be applied with
+ * zs_apply_split_changes(). Returns NULL if the right page is the leftmost
+ * child of its parent, which we cannot delete. In that case, 'newleftpage'
+ * is freed, and the buffers are left locked.
  */
-static zs_split_stack *
-zsbt_merge_pages(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf, bool target_is_left)
+zs_split_stack *
+zsbt_merge_into_left(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf,
+					 Page newleftpage)
 {
 	Buffer		parentbuf;
-	Page		origleftpage;
-	Page		leftpage;
 	Page		rightpage;
 	ZSBtreePageOpaque *leftopaque;
-	ZSBtreePageOpaque *origleftopaque;
 	ZSBtreePageOpaque *rightopaque;
 	ZSBtreeInternalPageItem *parentitems;
 	int			parentnitems;
@@ -671,13 +1588,12 @@ zsbt_merge_pages(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf
 	zs_split_stack *stack_head;
 	zs_split_stack *stack_tail;
 
-	origleftpage = BufferGetPage(leftbuf);
-	origleftopaque = ZSBtreePageGetOpaque(origleftpage);
 	rightpage = BufferGetPage(rightbuf);
 	rightopaque = ZSBtreePageGetOpaque(rightpage);
+	leftopaque = ZSBtreePageGetOpaque(newleftpage);
 
 	/* find downlink for 'rightbuf' in the parent */
-	parentbuf = zsbt_descend(rel, attno, rightopaque->zs_lokey, origleftopaque->zs_level + 1, false);
+	parentbuf = zsbt_descend(rel, attno, rightopaque->zs_lokey, leftopaque->zs_level + 1, false);
 	parentpage = BufferGetPage(parentbuf);
 
 	parentitems = ZSBtreeInternalPageGetItems(parentpage);
@@ -695,32 +1611,18 @@ zsbt_merge_pages(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf
 		 * Maybe later...
 		 */
 		UnlockReleaseBuffer(parentbuf);
+		pfree(newleftpage);
 		elog(DEBUG1, "deleting leftmost child of a parent not implemented");
 		return NULL;
 	}
 
-	if (target_is_left)
-	{
-		/* move all items from right to left before unlinking the right page */
-		leftpage = PageGetTempPageCopy(rightpage);
-		leftopaque = ZSBtreePageGetOpaque(leftpage);
-
-		memcpy(leftopaque, origleftopaque, sizeof(ZSBtreePageOpaque));
-	}
-	else
-	{
-		/* right page is empty. */
-		leftpage = PageGetTempPageCopy(origleftpage);
-		leftopaque = ZSBtreePageGetOpaque(leftpage);
-	}
-
 	/* update left hikey */
-	leftopaque->zs_hikey = ZSBtreePageGetOpaque(rightpage)->zs_hikey;
-	leftopaque->zs_next = ZSBtreePageGetOpaque(rightpage)->zs_next;
+	leftopaque->zs_hikey = rightopaque->zs_hikey;
+	leftopaque->zs_next = rightopaque->zs_next;
 
-	Assert(ZSBtreePageGetOpaque(leftpage)->zs_level == ZSBtreePageGetOpaque(rightpage)->zs_level);
+	Assert(leftopaque->zs_level == rightopaque->zs_level);
 
-	stack = zs_new_split_stack_entry(leftbuf, leftpage);
+	stack = zs_new_split_stack_entry(leftbuf, newleftpage);
 	stack_head = stack_tail = stack;
 
 	/* Mark right page as empty/unused */
@@ -753,6 +1655,7 @@ zsbt_merge_pages(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf
 		if (stack_tail->next == NULL)
 		{
 			/* oops, couldn't remove the parent. Back out */
+			UnlockReleaseBuffer(parentbuf);
 			stack = stack_head;
 			while (stack)
 			{
@@ -762,12 +1665,340 @@ zsbt_merge_pages(Relation rel, AttrNumber attno, Buffer leftbuf, Buffer rightbuf
 				pfree(stack);
 				stack = next;
 			}
+			stack_head = NULL;
 		}
 	}
 
 	return stack_head;
 }
 
+/*
+ * Move the non-root B-tree page in 'buf' to a free page below 'cutoff'.
+ *
+ * The page's contents are copied as is to the new block, and the downlink
+ * in the parent and the right-link of the left sibling are updated to point
+ * to it. Concurrent readers that arrive at the old block see that it's not
+ * the page they expected, and restart from the root, like after a merge.
+ * The old page is marked as deleted, but not added to the FPM, so that it's
+ * not handed out again as the destination of the next move.
+ *
+ * 'buf' must be exclusive-locked, and it's released. Returns false if the
+ * page was not moved, because its left sibling was just changed, or because
+ * there are no free pages below 'cutoff' (*nospace is set then).
+ */
+static bool
+zsbt_relocate_page(Relation rel, AttrNumber attno, Buffer buf,
+				   BlockNumber cutoff, bool *nospace)
+{
+	Page		page = BufferGetPage(buf);
+	ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+	BlockNumber blkno = BufferGetBlockNumber(buf);
+	zstid		lokey = opaque->zs_lokey;
+	int			level = opaque->zs_level;
+	Buffer		leftbuf = InvalidBuffer;
+	Buffer		newbuf;
+	Buffer		parentbuf;
+	Page		parentpage;
+	ZSBtreeInternalPageItem *parentitems;
+	int			itemno;
+	Page		newpage;
+	zs_split_stack *stack;
+	zs_split_stack *stack_head;
+	zs_split_stack *stack_tail;
+
+	/*
+	 * Lock the left sibling first, to lock the pages at the same level in
+	 * left-to-right order, and re-check the page after that.
+	 */
+	if (lokey != MinZSTid)
+	{
+		ZSBtreePageOpaque *leftopaque;
+
+		UnlockReleaseBuffer(buf);
+
+		leftbuf = zsbt_descend(rel, attno, lokey - 1, level, true);
+		if (!BufferIsValid(leftbuf))
+			return false;
+		leftopaque = ZSBtreePageGetOpaque(BufferGetPage(leftbuf));
+		if (leftopaque->zs_hikey != lokey || leftopaque->zs_next != blkno)
+		{
+			UnlockReleaseBuffer(leftbuf);
+			return false;
+		}
+
+		buf = ReadBuffer(rel, blkno);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		page = BufferGetPage(buf);
+		if (!zsbt_page_is_expected(rel, attno, lokey, level, buf) ||
+			ZSBtreePageGetOpaque(page)->zs_lokey != lokey)
+		{
+			UnlockReleaseBuffer(buf);
+			UnlockReleaseBuffer(leftbuf);
+			return false;
+		}
+	}
+
+	newbuf = zspage_getfreebuf_below(rel, cutoff);
+	if (!BufferIsValid(newbuf))
+	{
+		UnlockReleaseBuffer(buf);
+		if (BufferIsValid(leftbuf))
+			UnlockReleaseBuffer(leftbuf);
+		*nospace = true;
+		return false;
+	}
+
+	/* find downlink for the page in the parent */
+	parentbuf = zsbt_descend(rel, attno, lokey, level + 1, false);
+	parentpage = BufferGetPage(parentbuf);
+	parentitems = ZSBtreeInternalPageGetItems(parentpage);
+	itemno = zsbt_binsrch_internal(lokey, parentitems,
+								   ZSBtreeInternalPageGetNumItems(parentpage));
+	if (itemno < 0 || parentitems[itemno].childblk != blkno)
+		elog(ERROR, "could not find downlink to page %u", blkno);
+
+	/* copy the page to its new location */
+	stack = zs_new_split_stack_entry(newbuf, PageGetTempPageCopy(page));
+	stack_head = stack_tail = stack;
+
+	/* mark the old page as deleted, but don't link it to the FPM yet */
+	newpage = palloc(BLCKSZ);
+	zspage_mark_page_deleted(newpage, InvalidBlockNumber);
+	stack = zs_new_split_stack_entry(buf, newpage);
+	stack_tail->next = stack;
+	stack_tail = stack;
+
+	/* update the downlink */
+	newpage = PageGetTempPageCopy(parentpage);
+	ZSBtreeInternalPageGetItems(newpage)[itemno].childblk = BufferGetBlockNumber(newbuf);
+	stack = zs_new_split_stack_entry(parentbuf, newpage);
+	stack->delta = true;
+	stack_tail->next = stack;
+	stack_tail = stack;
+
+	/* and the left sibling's right-link */
+	if (BufferIsValid(leftbuf))
+	{
+		newpage = PageGetTempPageCopy(BufferGetPage(leftbuf));
+		ZSBtreePageGetOpaque(newpage)->zs_next = BufferGetBlockNumber(newbuf);
+		stack = zs_new_split_stack_entry(leftbuf, newpage);
+		stack->special_only = true;
+		stack_tail->next = stack;
+		stack_tail = stack;
+	}
+
+	zs_apply_split_changes(rel, stack_head, NULL);
+
+	return true;
+}
+
+/*
+ * Move the B-tree pages of attribute 'attno' in blocks 'cutoff' to 'end'
+ * (exclusive) to free pages below 'cutoff', to compact the relation.
+ *
+ * Each level of the tree is walked from left to right, locking only the page
+ * being moved, and its neighbors, like when pages are merged. The root page
+ * is left in place. The old block numbers of the moved pages are appended to
+ * 'moved'; the caller must give them to zspage_truncate() when done.
+ * Returns false if we ran out of free pages below 'cutoff'.
+ */
+bool
+zsbt_relocate_tree(Relation rel, AttrNumber attno, BlockNumber cutoff,
+				   BlockNumber end, BlockNumber *moved, int *nmoved)
+{
+	for (int level = 0;; level++)
+	{
+		zstid		key = MinZSTid;
+
+		while (key < MaxPlusOneZSTid)
+		{
+			Buffer		buf;
+			ZSBtreePageOpaque *opaque;
+			BlockNumber blkno;
+			bool		nospace = false;
+
+			CHECK_FOR_INTERRUPTS();
+
+			buf = zsbt_descend(rel, attno, key, level, true);
+			if (!BufferIsValid(buf))
+				return true;		/* the tree is empty */
+			opaque = ZSBtreePageGetOpaque(BufferGetPage(buf));
+			if ((opaque->zs_flags & ZSBT_ROOT) != 0)
+			{
+				/* reached the root, all the levels below it are done */
+				UnlockReleaseBuffer(buf);
+				return true;
+			}
+			key = opaque->zs_hikey;
+
+			blkno = BufferGetBlockNumber(buf);
+			if (blkno < cutoff || blkno >= end)
+			{
+				UnlockReleaseBuffer(buf);
+				continue;
+			}
+
+			if (zsbt_relocate_page(rel, attno, buf, cutoff, &nospace))
+				moved[(*nmoved)++] = blkno;
+			else if (nospace)
+				return false;
+		}
+	}
+}
+
+/*
+ * Discard the B-tree of a dropped attribute, and recycle all its pages.
+ *
+ * Nothing reads or writes the tree of a dropped attribute, so we don't need
+ * to worry about concurrent access. The tree is first detached from the
+ * metapage, and then each page is walked through from the root down, and
+ * handed to the FPM, along with the TOAST pages of the values on the leaf
+ * pages. If we crash in the middle, the rest of the pages are leaked, but
+ * that's no worse than not reclaiming them at all.
+ */
+void
+zsbt_free_dropped_tree(Relation rel, AttrNumber attno)
+{
+	Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attno - 1);
+	BlockNumber rootblk;
+
+	Assert(attr->attisdropped);
+
+	rootblk = zsmeta_detach_root_for_attribute(rel, attno);
+	if (rootblk != InvalidBlockNumber)
+		zsbt_free_tree(rel, attno, rootblk, attr);
+}
+
+/*
+ * Fold finished column rewrites into the root directory, and recycle the
+ * pages of the trees they made obsolete: the old tree if the rewrite
+ * committed, the new one if it aborted. Like the tree of a dropped
+ * attribute, an obsolete tree is no longer reachable. Its TOAST pages are
+ * not reclaimed, though, because its values were of a different type than
+ * the attribute has now, and we don't know how to decode them.
+ */
+void
+zsbt_fold_rewrites(Relation rel)
+{
+	AttrNumber	attno;
+	BlockNumber oldroot;
+
+	while (zsmeta_fold_rewrite(rel, &attno, &oldroot))
+	{
+		if (oldroot != InvalidBlockNumber)
+			zsbt_free_tree(rel, attno, oldroot, NULL);
+	}
+}
+
+/*
+ * Recycle all pages of a B-tree that has been detached from the metapage.
+ * If 'toast_attr' is given, the values on the leaf pages are of that
+ * attribute, and their TOAST pages are recycled too.
+ */
+static void
+zsbt_free_tree(Relation rel, AttrNumber attno, BlockNumber rootblk,
+			   Form_pg_attribute toast_attr)
+{
+	BlockNumber *blocks;
+	int			nblocks;
+	int			maxblocks;
+
+	maxblocks = 64;
+	blocks = palloc(maxblocks * sizeof(BlockNumber));
+	blocks[0] = rootblk;
+	nblocks = 1;
+	while (nblocks > 0)
+	{
+		BlockNumber blkno = blocks[--nblocks];
+		Buffer		buf;
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBuffer(rel, blkno);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		page = BufferGetPage(buf);
+		opaque = ZSBtreePageGetOpaque(page);
+
+		if (PageIsNew(page) ||
+			PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSBtreePageOpaque)) ||
+			opaque->zs_page_id != ZS_BTREE_PAGE_ID ||
+			opaque->zs_attno != attno)
+		{
+			/* not part of the tree, after all. Leave it alone. */
+			elog(LOG, "unexpected page %u found in discarded B-tree of attribute %d of \"%s\"",
+				 blkno, attno, RelationGetRelationName(rel));
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		if (opaque->zs_level > 0)
+		{
+			ZSBtreeInternalPageItem *items = ZSBtreeInternalPageGetItems(page);
+			int			nitems = ZSBtreeInternalPageGetNumItems(page);
+
+			if (nblocks + nitems > maxblocks)
+			{
+				maxblocks = Max(maxblocks * 2, nblocks + nitems);
+				blocks = repalloc(blocks, maxblocks * sizeof(BlockNumber));
+			}
+			for (int i = 0; i < nitems; i++)
+				blocks[nblocks++] = items[i].childblk;
+		}
+		else if (toast_attr && toast_attr->attlen == -1)
+			zsbt_attr_page_free_toast(rel, toast_attr, page);
+
+		zspage_delete_page(rel, buf, InvalidBuffer);
+		UnlockReleaseBuffer(buf);
+	}
+	pfree(blocks);
+}
+
+/*
+ * Find and lock the right sibling of leaf 'leftbuf', for merging the two.
+ *
+ * Returns InvalidBuffer if there is no right sibling, if the contents of the
+ * two pages together would take more than ZSBT_MERGE_MAX_FILL bytes, or if the
+ * sibling is locked by someone else right now. We don't wait for the lock,
+ * because we're already holding a lock on 'leftbuf', and merging is just an
+ * optimization.
+ */
+Buffer
+zsbt_get_merge_sibling(Relation rel, AttrNumber attno, Buffer leftbuf)
+{
+	Page		leftpage = BufferGetPage(leftbuf);
+	ZSBtreePageOpaque *leftopaque = ZSBtreePageGetOpaque(leftpage);
+	Buffer		rightbuf;
+	Page		rightpage;
+	Size		used;
+
+	if (leftopaque->zs_next == InvalidBlockNumber)
+		return InvalidBuffer;
+
+	used = zsbt_page_used_space(leftpage);
+	if (used > ZSBT_MERGE_MAX_FILL)
+		return InvalidBuffer;
+
+	rightbuf = ReadBuffer(rel, leftopaque->zs_next);
+	if (!ConditionalLockBuffer(rightbuf))
+	{
+		ReleaseBuffer(rightbuf);
+		return InvalidBuffer;
+	}
+	rightpage = BufferGetPage(rightbuf);
+
+	if (!zsbt_page_is_expected(rel, attno, leftopaque->zs_hikey, 0, rightbuf) ||
+		ZSBtreePageGetOpaque(rightpage)->zs_lokey != leftopaque->zs_hikey ||
+		used + zsbt_page_used_space(rightpage) > ZSBT_MERGE_MAX_FILL)
+	{
+		UnlockReleaseBuffer(rightbuf);
+		return InvalidBuffer;
+	}
+
+	return rightbuf;
+}
+
 /*
  * Allocate a new zs_split_stack struct.
  */
@@ -784,12 +2015,206 @@ zs_new_split_stack_entry(Buffer buf, Page page)
 	/* caller can change these */
 	stack->recycle = false;
 	stack->special_only = false;
+	stack->delta = false;
 
 	return stack;
 }
 
 #define MAX_BLOCKS_IN_REWRITE		199
 
+/*
+ * Flags to use for XLogRegisterBuffer() of a b-tree page, in addition to
+ * REGBUF_STANDARD.
+ *
+ * An attribute leaf page consists mostly of its compressed (upper) stream,
+ * so wal_compression would only burn CPU trying to compress a full-page
+ * image of it, mostly in vain. Skip it if at least 3/4 of the data on the
+ * page is compressed.
+ */
+uint8
+zsbt_page_regbuf_flags(Page page)
+{
+	PageHeader	phdr = (PageHeader) page;
+	ZSBtreePageOpaque *opaque;
+	int			lowersize;
+	int			uppersize;
+
+	if (PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSBtreePageOpaque)))
+		return 0;
+	opaque = ZSBtreePageGetOpaque(page);
+	if (opaque->zs_page_id != ZS_BTREE_PAGE_ID ||
+		opaque->zs_attno == ZS_META_ATTRIBUTE_NUM ||
+		opaque->zs_level != 0)
+		return 0;
+
+	lowersize = phdr->pd_lower - SizeOfPageHeaderData;
+	uppersize = phdr->pd_special - phdr->pd_upper;
+	if (uppersize > 0 && uppersize >= 3 * lowersize)
+		return REGBUF_NO_COMPRESS;
+	return 0;
+}
+
+/*
+ * The first bytes of each area are always included in a page delta, because
+ * that's where the headers of attribute streams are, which are likely to have
+ * changed, even if the data following them hasn't.
+ */
+#define ZS_PAGE_DELTA_HEAD_SIZE		32
+
+/*
+ * Compute the delta of one area of a page, see wal_zedstore_page_delta.
+ * Appends the bytes to be included in the record at *p.
+ */
+static void
+zs_page_delta_area(char *oldarea, int oldlen, char *newarea, int newlen,
+				   uint16 *head, uint16 *keep, uint16 *tail, char **p)
+{
+	int			common;
+	int			mid;
+	int			i;
+
+	*head = Min(newlen, ZS_PAGE_DELTA_HEAD_SIZE);
+	common = Max(Min(oldlen, newlen) - *head, 0);
+
+	for (i = 0; i < common; i++)
+	{
+		if (oldarea[*head + i] != newarea[*head + i])
+			break;
+	}
+	*keep = i;
+	common -= i;
+
+	for (i = 0; i < common; i++)
+	{
+		if (oldarea[oldlen - 1 - i] != newarea[newlen - 1 - i])
+			break;
+	}
+	*tail = i;
+
+	mid = newlen - *head - *keep - *tail;
+
+	memcpy(*p, newarea, *head);
+	*p += *head;
+	memcpy(*p, newarea + *head + *keep, mid);
+	*p += mid;
+}
+
+/*
+ * Reconstruct one area of a page from a delta, see wal_zedstore_page_delta.
+ */
+static char *
+zs_page_delta_apply_area(char *oldarea, int oldlen, char *newarea, int newlen,
+						 uint16 head, uint16 keep, uint16 tail, char *p)
+{
+	int			mid = newlen - head - keep - tail;
+
+	if (mid < 0 || (keep > 0 && head + keep > oldlen) || tail > oldlen)
+		elog(ERROR, "invalid zedstore page delta");
+
+	memcpy(newarea, p, head);
+	p += head;
+	memcpy(newarea + head, oldarea + head, keep);
+	memcpy(newarea + head + keep, p, mid);
+	p += mid;
+	memcpy(newarea + newlen - tail, oldarea + oldlen - tail, tail);
+
+	return p;
+}
+
+/*
+ * Compute the delta from 'oldpage' to 'newpage', for WAL-logging. Returns
+ * a palloc'd wal_zedstore_page_delta, and its size in *len, or NULL if the
+ * delta wouldn't be much smaller than a full-page image.
+ */
+static char *
+zs_page_delta(Page oldpage, Page newpage, int *len)
+{
+	PageHeader	oldhdr = (PageHeader) oldpage;
+	PageHeader	newhdr = (PageHeader) newpage;
+	wal_zedstore_page_delta *delta;
+	char	   *result;
+	char	   *p;
+	uint16		special_size = PageGetSpecialSize(newpage);
+
+	Assert(oldhdr->pd_special == newhdr->pd_special);
+
+	result = palloc(SizeOfZSWalPageDelta + BLCKSZ);
+	delta = (wal_zedstore_page_delta *) result;
+	delta->pd_flags = newhdr->pd_flags;
+	delta->pd_lower = newhdr->pd_lower;
+	delta->pd_upper = newhdr->pd_upper;
+	p = result + SizeOfZSWalPageDelta;
+
+	zs_page_delta_area((char *) oldpage + SizeOfPageHeaderData,
+					   oldhdr->pd_lower - SizeOfPageHeaderData,
+					   (char *) newpage + SizeOfPageHeaderData,
+					   newhdr->pd_lower - SizeOfPageHeaderData,
+					   &delta->lower_head, &delta->lower_keep, &delta->lower_tail,
+					   &p);
+	zs_page_delta_area((char *) oldpage + oldhdr->pd_upper,
+					   oldhdr->pd_special - oldhdr->pd_upper,
+					   (char *) newpage + newhdr->pd_upper,
+					   newhdr->pd_special - newhdr->pd_upper,
+					   &delta->upper_head, &delta->upper_keep, &delta->upper_tail,
+					   &p);
+	memcpy(p, PageGetSpecialPointer(newpage), special_size);
+	p += special_size;
+
+	*len = p - result;
+	if (*len > BLCKSZ / 2)
+	{
+		pfree(result);
+		return NULL;
+	}
+	return result;
+}
+
+/*
+ * Apply a page delta in WAL replay.
+ */
+static void
+zs_page_delta_redo(Page page, char *data, Size len)
+{
+	PageHeader	hdr = (PageHeader) page;
+	wal_zedstore_page_delta delta;
+	PGAlignedBlock newpage;
+	PageHeader	newhdr = (PageHeader) newpage.data;
+	char	   *p;
+	uint16		special_size = PageGetSpecialSize(page);
+
+	if (len < SizeOfZSWalPageDelta)
+		elog(ERROR, "invalid zedstore page delta");
+	memcpy(&delta, data, SizeOfZSWalPageDelta);
+	if (delta.pd_lower < SizeOfPageHeaderData ||
+		delta.pd_lower > delta.pd_upper ||
+		delta.pd_upper > hdr->pd_special)
+		elog(ERROR, "invalid zedstore page delta");
+	p = data + SizeOfZSWalPageDelta;
+
+	memcpy(newpage.data, page, BLCKSZ);
+	newhdr->pd_flags = delta.pd_flags;
+	newhdr->pd_lower = delta.pd_lower;
+	newhdr->pd_upper = delta.pd_upper;
+
+	p = zs_page_delta_apply_area((char *) page + SizeOfPageHeaderData,
+								 hdr->pd_lower - SizeOfPageHeaderData,
+								 newpage.data + SizeOfPageHeaderData,
+								 delta.pd_lower - SizeOfPageHeaderData,
+								 delta.lower_head, delta.lower_keep, delta.lower_tail,
+								 p);
+	p = zs_page_delta_apply_area((char *) page + hdr->pd_upper,
+								 hdr->pd_special - hdr->pd_upper,
+								 newpage.data + delta.pd_upper,
+								 hdr->pd_special - delta.pd_upper,
+								 delta.upper_head, delta.upper_keep, delta.upper_tail,
+								 p);
+	if (p + special_size != data + len)
+		elog(ERROR, "invalid zedstore page delta");
+	memcpy(newpage.data + hdr->pd_special, p, special_size);
+
+	memcpy(page, newpage.data, BLCKSZ);
+}
+
 /*
  * Apply all the changes represented by a list of zs_split_stack
  * entries.
@@ -798,20 +2223,31 @@ void
 zs_apply_split_changes(Relation rel, zs_split_stack *stack, zs_pending_undo_op *undo_op)
 {
 	zs_split_stack *head = stack;
-	bool		wal_needed = RelationNeedsWAL(rel);
+	bool		wal_needed = zs_relation_needs_wal(rel);
 	wal_zedstore_btree_rewrite_pages *xlrec = NULL;
 	int			xlrecsz = 0;
 	int			block_id = 0;
 	XLogRecPtr	recptr;
+	char	  **deltas = NULL;
+	int		   *deltalens = NULL;
+	int			num_pages = 0;
+	int			attno pg_attribute_unused() = -1;
+
+	for (stack = head; stack != NULL; stack = stack->next)
+		num_pages++;
+
+	/* the tree being split, for the trace probes */
+	if (head != NULL &&
+		PageGetSpecialSize(head->page) == MAXALIGN(sizeof(ZSBtreePageOpaque)) &&
+		ZSBtreePageGetOpaque(head->page)->zs_page_id == ZS_BTREE_PAGE_ID)
+		attno = ZSBtreePageGetOpaque(head->page)->zs_attno;
+
+	TRACE_POSTGRESQL_ZEDSTORE_SPLIT_START(RelationGetRelid(rel), attno, num_pages);
 
 	if (wal_needed)
 	{
-		int			num_pages = 0;
 		int			i;
 
-		for (stack = head; stack != NULL; stack = stack->next)
-			num_pages++;
-
 		if (num_pages > MAX_BLOCKS_IN_REWRITE)
 			elog(ERROR, "cannot rewrite more than %d pages in one WAL record",
 				 MAX_BLOCKS_IN_REWRITE);
@@ -825,12 +2261,24 @@ zs_apply_split_changes(Relation rel, zs_split_stack *stack, zs_pending_undo_op *
 		xlrecsz = SizeOfZSWalBtreeRewritePages(num_pages);
 		xlrec = palloc(xlrecsz);
 
+		/*
+		 * Compute the deltas of pages that replace their old versions. This
+		 * must be done before modifying the pages, and outside the critical
+		 * section, because it allocates memory.
+		 */
+		deltas = palloc0(num_pages * sizeof(char *));
+		deltalens = palloc0(num_pages * sizeof(int));
+
 		xlrec->numpages = num_pages;
 		i = 0;
 		for (stack = head; stack != NULL; stack = stack->next)
 		{
 			xlrec->pageinfo[i].recycle = stack->recycle;
 			xlrec->pageinfo[i].special_only = stack->special_only;
+			if (stack->delta && !stack->special_only)
+				deltas[i] = zs_page_delta(BufferGetPage(stack->buf), stack->page,
+										  &deltalens[i]);
+			xlrec->pageinfo[i].delta = (deltas[i] != NULL);
 			i++;
 		}
 		Assert(i == num_pages);
@@ -866,13 +2314,22 @@ zs_apply_split_changes(Relation rel, zs_split_stack *stack, zs_pending_undo_op *
 				XLogRegisterBufData(block_id, orig_special_area, special_size);
 			}
 		}
+		else if (wal_needed && deltas[block_id - 1] != NULL)
+		{
+			PageRestoreTempPage(stack->page, BufferGetPage(stack->buf));
+
+			XLogRegisterBuffer(block_id, stack->buf,
+							   REGBUF_STANDARD | zsbt_page_regbuf_flags(stack->page));
+			XLogRegisterBufData(block_id, deltas[block_id - 1], deltalens[block_id - 1]);
+		}
 		else
 		{
 			PageRestoreTempPage(stack->page, BufferGetPage(stack->buf));
 
 			if (wal_needed)
 				XLogRegisterBuffer(block_id, stack->buf,
-								   REGBUF_STANDARD | REGBUF_FORCE_IMAGE);
+								   REGBUF_STANDARD | REGBUF_FORCE_IMAGE |
+								   zsbt_page_regbuf_flags(stack->page));
 		}
 		MarkBufferDirty(stack->buf);
 
@@ -917,7 +2374,18 @@ zs_apply_split_changes(Relation rel, zs_split_stack *stack, zs_pending_undo_op *
 		stack = next;
 	}
 	if (wal_needed)
+	{
+		for (int i = 0; i < xlrec->numpages; i++)
+		{
+			if (deltas[i])
+				pfree(deltas[i]);
+		}
+		pfree(deltas);
+		pfree(deltalens);
 		pfree(xlrec);
+	}
+
+	TRACE_POSTGRESQL_ZEDSTORE_SPLIT_DONE(RelationGetRelid(rel), attno, num_pages);
 }
 
 static int
@@ -972,16 +2440,21 @@ zsbt_rewrite_pages_redo(XLogReaderState *record)
 			Page		page = BufferGetPage(buffers[block_id]);
 			char	   *special_area = PageGetSpecialPointer(page);
 			uint16		special_size = PageGetSpecialSize(page);
-			Size		new_special_size;
-			char	   *new_special_area = XLogRecGetBlockData(record, block_id, &new_special_size);
+			Size		datalen;
+			char	   *data = XLogRecGetBlockData(record, block_id, &datalen);
 
-			if (!xlrec->pageinfo[block_id - 1].special_only)
-				elog(ERROR, "zedstore rewrite_pages WAL record did not contain a full-page image");
+			if (xlrec->pageinfo[block_id - 1].delta)
+				zs_page_delta_redo(page, data, datalen);
+			else if (xlrec->pageinfo[block_id - 1].special_only)
+			{
+				if (datalen != special_size)
+					elog(ERROR, "size of page's special area in WAL record does not match old page");
 
-			if (new_special_size != special_size)
-				elog(ERROR, "size of page's special area in WAL record does not match old page");
+				memcpy(special_area, data, special_size);
+			}
+			else
+				elog(ERROR, "zedstore rewrite_pages WAL record did not contain a full-page image");
 
-			memcpy(special_area, new_special_area, special_size);
 			PageSetLSN(page, lsn);
 		}
 	}
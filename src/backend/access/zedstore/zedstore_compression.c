@@ -4,7 +4,13 @@
  *
  * There are two implementations at the moment: LZ4, and the Postgres
  * pg_lzcompress(). LZ4 support requires that the server was compiled
- * with --with-lz4.
+ * with --with-lz4. In addition, a column can be left uncompressed.
+ *
+ * The method can be chosen per column, with the "zedstore_compression"
+ * attribute option. The method used for each compressed attribute stream
+ * is recorded in the stream header, so a relation can contain a mix of
+ * streams compressed with different methods, e.g. after the option has
+ * been changed.
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -20,19 +26,106 @@
 
 #include "access/zedstore_compression.h"
 #include "common/pg_lzcompress.h"
+#include "pg_trace.h"
+#include "utils/attoptcache.h"
 #include "utils/datum.h"
+#include "utils/rel.h"
 
+/*
+ * The method used for ZS_COMPRESSION_DEFAULT.
+ */
 #ifdef USE_LZ4
+#define ZS_BUILTIN_COMPRESSION_METHOD	ZS_COMPRESSION_LZ4
+#else
+#define ZS_BUILTIN_COMPRESSION_METHOD	ZS_COMPRESSION_PGLZ
+#endif
 
-int
-zs_compress_destSize(const char *src, char *dst, int *srcSizePtr, int targetDstSize)
+const char *
+zs_compression_method_name(ZSCompressionMethod method)
+{
+	switch (method)
+	{
+		case ZS_COMPRESSION_DEFAULT:
+			return "default";
+		case ZS_COMPRESSION_NONE:
+			return "none";
+		case ZS_COMPRESSION_PGLZ:
+			return "pglz";
+		case ZS_COMPRESSION_LZ4:
+			return "lz4";
+	}
+	return "unknown";
+}
+
+/*
+ * Get the compression method to use for new data in the given attribute.
+ *
+ * The result is never ZS_COMPRESSION_DEFAULT.
+ */
+ZSCompressionMethod
+zs_get_attr_compression_method(Relation rel, AttrNumber attno)
+{
+	AttributeOpts *aopt;
+	ZSCompressionMethod method = ZS_COMPRESSION_DEFAULT;
+
+	aopt = get_attribute_options(RelationGetRelid(rel), attno);
+	if (aopt)
+	{
+		method = (ZSCompressionMethod) aopt->zedstore_compression;
+		pfree(aopt);
+	}
+
+	return zs_resolve_compression_method(method);
+}
+
+/*
+ * Resolve ZS_COMPRESSION_DEFAULT, as stored in old streams, to the method it
+ * stands for.
+ */
+ZSCompressionMethod
+zs_resolve_compression_method(ZSCompressionMethod method)
+{
+	if (method == ZS_COMPRESSION_DEFAULT)
+		return ZS_BUILTIN_COMPRESSION_METHOD;
+	return method;
+}
+
+/*
+ * Should compressed streams of the given attribute be divided into frames?
+ */
+bool
+zs_get_attr_compression_frames(Relation rel, AttrNumber attno)
+{
+	AttributeOpts *aopt;
+	bool		result = false;
+
+	aopt = get_attribute_options(RelationGetRelid(rel), attno);
+	if (aopt)
+	{
+		result = aopt->zedstore_compression_frames;
+		pfree(aopt);
+	}
+
+	return result;
+}
+
+/* LZ4 implementation */
+
+static int
+zs_lz4_compress_destSize(const char *src, char *dst, int *srcSizePtr, int targetDstSize)
 {
+#ifdef USE_LZ4
 	return LZ4_compress_destSize(src, dst, srcSizePtr, targetDstSize);
+#else
+	elog(ERROR, "LZ4 compression is not supported by this build");
+	return 0;					/* keep compiler quiet */
+#endif
 }
 
-void
-zs_decompress(const char *src, char *dst, int compressedSize, int uncompressedSize)
+static void
+zs_lz4_decompress(const char *src, char *dst, int compressedSize, int uncompressedSize)
 {
+#ifdef USE_LZ4
 	int			decompressed_size;
 
 	decompressed_size = LZ4_decompress_safe(src, dst, compressedSize, uncompressedSize);
@@ -41,13 +134,15 @@ zs_decompress(const char *src, char *dst, int compressedSize, int uncompressedSi
 			 compressedSize, uncompressedSize);
 	if (decompressed_size != uncompressedSize)
 		elog(ERROR, "unexpected decompressed size");
+#else
+	elog(ERROR, "LZ4 compression is not supported by this build");
+#endif
 }
 
-#else
 /* PGLZ implementation */
 
-int
-zs_compress_destSize(const char *src, char *dst, int *srcSizePtr, int targetDstSize)
+static int
+zs_pglz_compress_destSize(const char *src, char *dst, int *srcSizePtr, int targetDstSize)
 {
 	int			maxInputSize;
 	int			compressed_size;
@@ -77,8 +172,8 @@ zs_compress_destSize(const char *src, char *dst, int *srcSizePtr, int targetDstS
 	return compressed_size;
 }
 
-void
-zs_decompress(const char *src, char *dst, int compressedSize, int uncompressedSize)
+static void
+zs_pglz_decompress(const char *src, char *dst, int compressedSize, int uncompressedSize)
 {
 	int			decompressed_size;
 
@@ -89,4 +184,56 @@ zs_decompress(const char *src, char *dst, int compressedSize, int uncompressedSi
 		elog(ERROR, "unexpected decompressed size");
 }
 
-#endif		/* !USE_LZ4 */
+/*
+ * Compress as much of 'src' as fits in 'targetDstSize' bytes, using the
+ * given method.
+ *
+ * On return, *srcSizePtr is set to the number of input bytes that were
+ * compressed. Returns the compressed size, or 0 if the data could not be
+ * compressed (or the method is ZS_COMPRESSION_NONE). The caller should
+ * store the data uncompressed in that case.
+ */
+int
+zs_compress_destSize(ZSCompressionMethod method, const char *src, char *dst,
+					 int *srcSizePtr, int targetDstSize)
+{
+	if (method == ZS_COMPRESSION_DEFAULT)
+		method = ZS_BUILTIN_COMPRESSION_METHOD;
+
+	switch (method)
+	{
+		case ZS_COMPRESSION_NONE:
+			return 0;
+		case ZS_COMPRESSION_PGLZ:
+			return zs_pglz_compress_destSize(src, dst, srcSizePtr, targetDstSize);
+		case ZS_COMPRESSION_LZ4:
+			return zs_lz4_compress_destSize(src, dst, srcSizePtr, targetDstSize);
+		default:
+			elog(ERROR, "unrecognized zedstore compression method %d", method);
+	}
+	return 0;					/* keep compiler quiet */
+}
+
+void
+zs_decompress(ZSCompressionMethod method, const char *src, char *dst,
+			  int compressedSize, int uncompressedSize)
+{
+	if (method == ZS_COMPRESSION_DEFAULT)
+		method = ZS_BUILTIN_COMPRESSION_METHOD;
+
+	TRACE_POSTGRESQL_ZEDSTORE_DECOMPRESS_START(method, compressedSize, uncompressedSize);
+
+	switch (method)
+	{
+		case ZS_COMPRESSION_PGLZ:
+			zs_pglz_decompress(src, dst, compressedSize, uncompressedSize);
+			break;
+		case ZS_COMPRESSION_LZ4:
+			zs_lz4_decompress(src, dst, compressedSize, uncompressedSize);
+			break;
+		default:
+			elog(ERROR, "unrecognized zedstore compression method %d", method);
+	}
+
+	TRACE_POSTGRESQL_ZEDSTORE_DECOMPRESS_DONE(method, compressedSize, uncompressedSize);
+}
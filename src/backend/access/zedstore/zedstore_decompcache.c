@@ -0,0 +1,470 @@
+/*
+ * zedstore_decompcache.c
+ *		Caches of decompressed zedstore attribute streams
+ *
+ * The shared buffer cache holds attribute pages in compressed form, so every
+ * scan that reads a compressed attribute stream has to decompress it again,
+ * in every backend. This cache sits next to the buffer cache and holds the
+ * decompressed chunks of recently-read streams, so that repeated scans over
+ * hot tables don't burn CPU on decompression.
+ *
+ * Each attribute page has at most one compressed stream, the upper stream,
+ * so entries are keyed by relfilenode and block number. The page LSN is
+ * stored with the entry, and an entry is only used if the LSN still matches
+ * the page's, so any modification of the page, which is always WAL-logged,
+ * implicitly invalidates it. That also covers pages that have been recycled
+ * for a different tree. Relations that aren't WAL-logged don't have
+ * meaningful LSNs, and bypass the cache.
+ *
+ * The cache consists of a fixed number of slots of ZS_DECOMPCACHE_SLOT_SIZE
+ * bytes. Streams that don't fit in a slot are not cached. A victim slot is
+ * chosen with the clock algorithm, like in the buffer manager: every hit
+ * increments the slot's usage count, and the clock hand decrements them until
+ * it finds one that's zero.
+ *
+ * Locking: the mapping lock protects the hash table, and the tag of each
+ * slot, as well as the clock hand. Each slot has its own lock that protects
+ * its contents. To read a slot, acquire the mapping lock in shared mode, look
+ * up the slot, lock the slot, and release the mapping lock. To fill a slot,
+ * the mapping lock is held in exclusive mode while choosing the slot, and the
+ * slot lock is held exclusively while copying the data in. Slot locks are
+ * only acquired conditionally while holding the mapping lock exclusively, so
+ * that a reader can't block eviction for long.
+ *
+ * In front of the shared cache, each backend keeps a few recently used
+ * entries in private memory, with LRU replacement. That's for index fetches
+ * and nested loop joins, which tend to hit the same few leaves over and over
+ * again, and can then skip the shared cache and its locks. The local entries
+ * are validated by page LSN, like the shared ones.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zedstore/zedstore_decompcache.c
+ */
+#include "postgres.h"
+
+#include "access/zedstore_decompcache.h"
+#include "port/atomics.h"
+#include "storage/bufmgr.h"
+#include "storage/lwlock.h"
+#include "storage/relfilenode.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+/* GUC variable */
+int			zedstore_decompressed_cache_size = 8192;
+
+#define ZS_DECOMPCACHE_SLOT_SIZE	(4 * BLCKSZ)
+#define ZS_DECOMPCACHE_MAX_USAGE	5
+
+typedef struct ZSDecompCacheTag
+{
+	RelFileNode rnode;
+	BlockNumber blkno;
+} ZSDecompCacheTag;
+
+/* hash table entry */
+typedef struct ZSDecompCacheEnt
+{
+	ZSDecompCacheTag tag;
+	int			slotno;
+} ZSDecompCacheEnt;
+
+typedef struct ZSDecompCacheSlot
+{
+	/* protected by the mapping lock */
+	ZSDecompCacheTag tag;
+	bool		valid;			/* is 'tag' in the hash table? */
+
+	/* protected by the slot lock */
+	XLogRecPtr	lsn;			/* LSN of the page the data came from */
+	int			len;			/* length of the decompressed chunks */
+
+	pg_atomic_uint32 usage_count;
+	LWLock		lock;
+} ZSDecompCacheSlot;
+
+typedef struct ZSDecompCacheCtl
+{
+	LWLock		mapping_lock;
+	int			clock_hand;		/* protected by mapping_lock */
+
+	int			nslots;
+	ZSDecompCacheSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} ZSDecompCacheCtl;
+
+static ZSDecompCacheCtl *ZSDecompCache = NULL;
+static HTAB *ZSDecompCacheHash = NULL;
+static char *ZSDecompCacheData = NULL;
+
+/*
+ * Backend-local cache. Entries larger than ZS_LOCAL_DECOMPCACHE_MAX_SIZE are
+ * not cached, to keep the memory usage bounded.
+ */
+#define ZS_LOCAL_DECOMPCACHE_ENTRIES	8
+#define ZS_LOCAL_DECOMPCACHE_MAX_SIZE	(16 * BLCKSZ)
+
+typedef struct ZSLocalDecompCacheEnt
+{
+	ZSDecompCacheTag tag;
+	XLogRecPtr	lsn;			/* InvalidXLogRecPtr if unused */
+	uint64		last_used;
+	int			len;
+	char	   *data;
+	int			data_size;		/* allocated size of 'data' */
+} ZSLocalDecompCacheEnt;
+
+static ZSLocalDecompCacheEnt ZSLocalDecompCache[ZS_LOCAL_DECOMPCACHE_ENTRIES];
+static uint64 ZSLocalDecompCacheCounter = 0;
+
+static int
+zs_decompcache_nslots(void)
+{
+	return ((Size) zedstore_decompressed_cache_size * 1024) / ZS_DECOMPCACHE_SLOT_SIZE;
+}
+
+/*
+ * Report shared-memory space needed by ZSDecompCacheShmemInit
+ */
+Size
+ZSDecompCacheShmemSize(void)
+{
+	int			nslots = zs_decompcache_nslots();
+	Size		size;
+
+	if (nslots == 0)
+		return 0;
+
+	size = add_size(offsetof(ZSDecompCacheCtl, slots),
+					mul_size(nslots, sizeof(ZSDecompCacheSlot)));
+	size = add_size(size, mul_size(nslots, ZS_DECOMPCACHE_SLOT_SIZE));
+	size = add_size(size, hash_estimate_size(nslots, sizeof(ZSDecompCacheEnt)));
+
+	return size;
+}
+
+/*
+ * Allocate and initialize the cache in shared memory
+ */
+void
+ZSDecompCacheShmemInit(void)
+{
+	int			nslots = zs_decompcache_nslots();
+	HASHCTL		info;
+	bool		found;
+	bool		found_data;
+
+	if (nslots == 0)
+		return;
+
+	ZSDecompCache = (ZSDecompCacheCtl *)
+		ShmemInitStruct("Zedstore Decompressed Cache",
+						add_size(offsetof(ZSDecompCacheCtl, slots),
+								 mul_size(nslots, sizeof(ZSDecompCacheSlot))),
+						&found);
+	ZSDecompCacheData = (char *)
+		ShmemInitStruct("Zedstore Decompressed Cache Data",
+						mul_size(nslots, ZS_DECOMPCACHE_SLOT_SIZE),
+						&found_data);
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(ZSDecompCacheTag);
+	info.entrysize = sizeof(ZSDecompCacheEnt);
+	ZSDecompCacheHash = ShmemInitHash("Zedstore Decompressed Cache Hash",
+									  nslots, nslots,
+									  &info,
+									  HASH_ELEM | HASH_BLOBS);
+
+	if (!found)
+	{
+		Assert(!found_data);
+
+		LWLockInitialize(&ZSDecompCache->mapping_lock, LWTRANCHE_ZEDSTORE_DECOMPCACHE);
+		ZSDecompCache->clock_hand = 0;
+		ZSDecompCache->nslots = nslots;
+		for (int i = 0; i < nslots; i++)
+		{
+			ZSDecompCacheSlot *slot = &ZSDecompCache->slots[i];
+
+			slot->valid = false;
+			slot->lsn = InvalidXLogRecPtr;
+			slot->len = 0;
+			pg_atomic_init_u32(&slot->usage_count, 0);
+			LWLockInitialize(&slot->lock, LWTRANCHE_ZEDSTORE_DECOMPCACHE);
+		}
+	}
+	else
+		Assert(found_data);
+}
+
+/*
+ * Can the given page be cached? Fills in the tag and the page's LSN.
+ *
+ * The caller must hold a lock on the buffer.
+ */
+static bool
+zs_decompcache_init_tag(Relation rel, Buffer buf, ZSDecompCacheTag *tag, XLogRecPtr *lsn)
+{
+	if (!RelationNeedsWAL(rel))
+		return false;
+
+	*lsn = PageGetLSN(BufferGetPage(buf));
+	if (*lsn == InvalidXLogRecPtr)
+		return false;
+
+	/* clear any padding, the tag is hashed as a blob */
+	MemSet(tag, 0, sizeof(ZSDecompCacheTag));
+	tag->rnode = rel->rd_node;
+	tag->blkno = BufferGetBlockNumber(buf);
+
+	return true;
+}
+
+static ZSLocalDecompCacheEnt *
+zs_local_decompcache_find(ZSDecompCacheTag *tag, XLogRecPtr lsn)
+{
+	for (int i = 0; i < ZS_LOCAL_DECOMPCACHE_ENTRIES; i++)
+	{
+		ZSLocalDecompCacheEnt *ent = &ZSLocalDecompCache[i];
+
+		if (ent->lsn == lsn && memcmp(&ent->tag, tag, sizeof(ZSDecompCacheTag)) == 0)
+			return ent;
+	}
+	return NULL;
+}
+
+static void
+zs_local_decompcache_insert(ZSDecompCacheTag *tag, XLogRecPtr lsn, char *src, int len)
+{
+	ZSLocalDecompCacheEnt *ent = NULL;
+
+	if (len > ZS_LOCAL_DECOMPCACHE_MAX_SIZE)
+		return;
+
+	/*
+	 * Replace an entry for an older version of the same page, or else the
+	 * least recently used entry.
+	 */
+	for (int i = 0; i < ZS_LOCAL_DECOMPCACHE_ENTRIES; i++)
+	{
+		ZSLocalDecompCacheEnt *e = &ZSLocalDecompCache[i];
+
+		if (e->lsn != InvalidXLogRecPtr &&
+			memcmp(&e->tag, tag, sizeof(ZSDecompCacheTag)) == 0)
+		{
+			ent = e;
+			break;
+		}
+		if (ent == NULL || e->last_used < ent->last_used)
+			ent = e;
+	}
+
+	if (ent->data_size < len)
+	{
+		if (ent->data)
+			pfree(ent->data);
+		ent->lsn = InvalidXLogRecPtr;
+		ent->data = MemoryContextAlloc(TopMemoryContext, len);
+		ent->data_size = len;
+	}
+	memcpy(ent->data, src, len);
+	ent->tag = *tag;
+	ent->lsn = lsn;
+	ent->len = len;
+	ent->last_used = ++ZSLocalDecompCacheCounter;
+}
+
+/*
+ * Look up the decompressed chunks of the compressed stream on the given
+ * attribute page. If found, copies 'len' bytes into 'dst', and returns true.
+ * If 'local' is true, the backend-local cache is checked first, and a hit
+ * in the shared cache is also copied to it.
+ *
+ * The caller must hold a lock on the buffer, and 'len' must be the
+ * decompressed size of the page's compressed stream.
+ */
+bool
+zs_decompcache_lookup(Relation rel, Buffer buf, char *dst, int len, bool local)
+{
+	ZSDecompCacheTag tag;
+	XLogRecPtr	lsn;
+	uint32		hashcode;
+	ZSDecompCacheEnt *ent;
+	ZSDecompCacheSlot *slot;
+	int			slotno;
+	bool		hit;
+
+	if (!zs_decompcache_init_tag(rel, buf, &tag, &lsn))
+		return false;
+
+	if (local)
+	{
+		ZSLocalDecompCacheEnt *lent = zs_local_decompcache_find(&tag, lsn);
+
+		if (lent && lent->len == len)
+		{
+			memcpy(dst, lent->data, len);
+			lent->last_used = ++ZSLocalDecompCacheCounter;
+			return true;
+		}
+	}
+
+	if (ZSDecompCache == NULL)
+		return false;
+	hashcode = get_hash_value(ZSDecompCacheHash, &tag);
+
+	LWLockAcquire(&ZSDecompCache->mapping_lock, LW_SHARED);
+	ent = (ZSDecompCacheEnt *) hash_search_with_hash_value(ZSDecompCacheHash, &tag,
+														   hashcode, HASH_FIND, NULL);
+	if (!ent)
+	{
+		LWLockRelease(&ZSDecompCache->mapping_lock);
+		return false;
+	}
+	slotno = ent->slotno;
+	slot = &ZSDecompCache->slots[slotno];
+	LWLockAcquire(&slot->lock, LW_SHARED);
+	LWLockRelease(&ZSDecompCache->mapping_lock);
+
+	hit = (slot->lsn == lsn && slot->len == len);
+	if (hit)
+	{
+		memcpy(dst, ZSDecompCacheData + (Size) slotno * ZS_DECOMPCACHE_SLOT_SIZE, len);
+
+		/* racy, but an occasional lost or extra increment doesn't matter */
+		if (pg_atomic_read_u32(&slot->usage_count) < ZS_DECOMPCACHE_MAX_USAGE)
+			pg_atomic_fetch_add_u32(&slot->usage_count, 1);
+	}
+	LWLockRelease(&slot->lock);
+
+	if (hit && local)
+		zs_local_decompcache_insert(&tag, lsn, dst, len);
+
+	return hit;
+}
+
+/*
+ * Find a slot to evict, and lock it. Returns -1 if all slots are busy.
+ *
+ * The caller must hold the mapping lock in exclusive mode.
+ */
+static int
+zs_decompcache_get_victim(void)
+{
+	int			nslots = ZSDecompCache->nslots;
+
+	for (int tries = 0; tries < nslots * (ZS_DECOMPCACHE_MAX_USAGE + 1); tries++)
+	{
+		int			slotno = ZSDecompCache->clock_hand;
+		ZSDecompCacheSlot *slot = &ZSDecompCache->slots[slotno];
+		uint32		usage;
+
+		ZSDecompCache->clock_hand = (slotno + 1) % nslots;
+
+		usage = pg_atomic_read_u32(&slot->usage_count);
+		if (usage > 0)
+		{
+			pg_atomic_write_u32(&slot->usage_count, usage - 1);
+			continue;
+		}
+
+		if (LWLockConditionalAcquire(&slot->lock, LW_EXCLUSIVE))
+			return slotno;
+	}
+	return -1;
+}
+
+/*
+ * Remember the decompressed chunks of the compressed stream on the given
+ * attribute page, in the shared cache, and also in the backend-local cache
+ * if 'local' is true.
+ *
+ * The caller must hold a lock on the buffer. If the cache is disabled, or
+ * the data doesn't fit, or we would have to wait for a lock, does nothing.
+ */
+void
+zs_decompcache_insert(Relation rel, Buffer buf, char *src, int len, bool local)
+{
+	ZSDecompCacheTag tag;
+	XLogRecPtr	lsn;
+	uint32		hashcode;
+	ZSDecompCacheEnt *ent;
+	ZSDecompCacheSlot *slot;
+	int			slotno;
+	bool		found;
+
+	if (len <= 0)
+		return;
+	if (!zs_decompcache_init_tag(rel, buf, &tag, &lsn))
+		return;
+
+	if (local)
+		zs_local_decompcache_insert(&tag, lsn, src, len);
+
+	if (ZSDecompCache == NULL || len > ZS_DECOMPCACHE_SLOT_SIZE)
+		return;
+	hashcode = get_hash_value(ZSDecompCacheHash, &tag);
+
+	LWLockAcquire(&ZSDecompCache->mapping_lock, LW_EXCLUSIVE);
+	ent = (ZSDecompCacheEnt *) hash_search_with_hash_value(ZSDecompCacheHash, &tag,
+														   hashcode, HASH_FIND, NULL);
+	if (ent)
+	{
+		/* There's a stale entry for an older version of the page. Overwrite. */
+		slotno = ent->slotno;
+		slot = &ZSDecompCache->slots[slotno];
+		if (!LWLockConditionalAcquire(&slot->lock, LW_EXCLUSIVE))
+		{
+			LWLockRelease(&ZSDecompCache->mapping_lock);
+			return;
+		}
+	}
+	else
+	{
+		slotno = zs_decompcache_get_victim();
+		if (slotno == -1)
+		{
+			LWLockRelease(&ZSDecompCache->mapping_lock);
+			return;
+		}
+		slot = &ZSDecompCache->slots[slotno];
+
+		if (slot->valid)
+		{
+			ent = (ZSDecompCacheEnt *) hash_search(ZSDecompCacheHash, &slot->tag,
+												   HASH_REMOVE, NULL);
+			Assert(ent != NULL);
+			slot->valid = false;
+		}
+		slot->lsn = InvalidXLogRecPtr;
+		slot->len = 0;
+
+		ent = (ZSDecompCacheEnt *) hash_search_with_hash_value(ZSDecompCacheHash, &tag,
+															   hashcode, HASH_ENTER_NULL,
+															   &found);
+		if (!ent)
+		{
+			/* shouldn't happen, since we just freed an entry */
+			LWLockRelease(&slot->lock);
+			LWLockRelease(&ZSDecompCache->mapping_lock);
+			return;
+		}
+		Assert(!found);
+		ent->slotno = slotno;
+		slot->tag = tag;
+		slot->valid = true;
+	}
+	LWLockRelease(&ZSDecompCache->mapping_lock);
+
+	/* We hold the slot lock, so readers will wait until we're done copying */
+	memcpy(ZSDecompCacheData + (Size) slotno * ZS_DECOMPCACHE_SLOT_SIZE, src, len);
+	slot->lsn = lsn;
+	slot->len = len;
+	pg_atomic_write_u32(&slot->usage_count, 1);
+
+	LWLockRelease(&slot->lock);
+}
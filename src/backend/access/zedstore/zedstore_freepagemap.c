@@ -7,7 +7,28 @@
  *
  * The FPM is a linked list of pages. Each page contains a pointer to the
  * next free page.
-
+ *
+ * Free UNDO pages are kept in a separate list, and are only reused for UNDO.
+ * UNDO pages are allocated and discarded at a high rate, and if they shared
+ * the FPM with the B-trees, they would get scattered all over the relation,
+ * and break up the attribute trees as the discarded pages get reused.
+ *
+ * In addition to the FPM, the metapage holds a small number of extents of
+ * never-used blocks at the end of the relation. When there are no free
+ * pages, and the relation has to be extended, it's extended by a whole
+ * extent at a time, and the rest of the extent is reserved for the same
+ * attribute (or other attributes mapped to the same extent slot). That way,
+ * the leaves of each attribute tree that grows by appending, like in a bulk
+ * load, end up mostly contiguous on disk. The extent size grows with the
+ * relation, so that small tables don't waste space.
+ *
+ * To avoid taking the metapage lock for every allocation, a backend takes
+ * pages from the FPM in batches, and keeps the rest of the batch in a
+ * backend-private pool, see ZSPagePool. The pages in the pool are still
+ * chained together like in the FPM, so what's left of the pool can be
+ * spliced back to the FPM at the end of the transaction with just one
+ * metapage lock, too.
+ *
  * Design principles:
  *
  * - it's ok to have a block incorrectly stored in the FPM. Before actually
@@ -30,8 +51,11 @@
  * TODO:
  *
  * - Avoid fragmentation. If B-tree page is split, try to hand out a page
- *   that's close to the old page. When the relation is extended, allocate
- *   a larger chunk at once.
+ *   that's close to the old page. Recycled pages are still handed out in
+ *   LIFO order, regardless of which attribute they're allocated for.
+ *
+ * - Free UNDO pages are never given back to the FPM, so after a burst of
+ *   UNDO activity, they stay reserved for UNDO until the table is rewritten.
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -48,7 +72,10 @@
 #include "access/xlogutils.h"
 #include "access/zedstore_internal.h"
 #include "access/zedstore_wal.h"
+#include "catalog/storage.h"
+#include "access/zedstoream.h"
 #include "miscadmin.h"
+#include "storage/bufmgr.h"
 #include "storage/bufpage.h"
 #include "storage/lmgr.h"
 #include "utils/rel.h"
@@ -66,7 +93,84 @@ typedef struct ZSFreePageOpaque
 	uint16		zs_page_id;		/* ZS_FREE_PAGE_ID */
 } ZSFreePageOpaque;
 
-static Buffer zspage_extendrel_newbuf(Relation rel);
+/*
+ * Maximum size of an extent, in blocks. The size of each new extent is
+ * a fraction of the current relation size, up to this.
+ */
+#define ZS_FPM_MAX_EXTENT_SIZE	128
+
+/*
+ * The extent that this backend reserved most recently for each attribute
+ * extent slot. When we have to reserve a new extent for a slot, the previous
+ * one has been filled, typically by a bulk load appending to the attribute
+ * trees. Its pages are not likely to be modified again soon, so we write
+ * them out right away, as one sequential run, instead of leaving them for
+ * the checkpointer to write in between all the other dirty pages of the
+ * relation. Extents smaller than ZS_FPM_WRITE_COMBINE_MIN blocks are not
+ * worth the trouble.
+ */
+#define ZS_FPM_WRITE_COMBINE_MIN	32
+
+typedef struct ZSOwnExtent
+{
+	RelFileNode node;
+	BlockNumber start;
+	BlockNumber end;
+} ZSOwnExtent;
+
+static ZSOwnExtent zs_own_extents[ZS_FPM_EXTENT_SLOTS];
+
+/*
+ * Pages that this backend has taken from the FPM, but not handed out yet.
+ *
+ * When zspage_getnewbuf() has to take a page from the FPM, it takes up to
+ * ZS_FPM_BATCH_SIZE pages at once, under one metapage lock and with one WAL
+ * record, and keeps the rest in the pool for the following allocations in
+ * the same relation. The pool is only used for B-tree pages, not UNDO, and
+ * only for WAL-logged relations that other backends can access; the others
+ * don't contend for the metapage.
+ *
+ * blocks[next] to blocks[nblocks - 1] are the pages still in the pool, in
+ * the order they were in the FPM, and their zs_next links still point to
+ * each other. They're given back to the FPM at the end of the transaction,
+ * before we release our lock on the relation, or when we need pages from
+ * another relation. We must not hold on to them without the lock, or a
+ * concurrent compaction might truncate them away. If we crash, the pages in
+ * the pool are leaked, like a page that's been taken from the FPM but not
+ * used yet.
+ */
+#define ZS_FPM_BATCH_SIZE		32
+
+typedef struct ZSPagePool
+{
+	RelFileNode node;
+	int			next;
+	int			nblocks;
+	BlockNumber blocks[ZS_FPM_BATCH_SIZE - 1];
+} ZSPagePool;
+
+static ZSPagePool zs_page_pool;
+
+static Buffer zspage_getfreebuf(Relation rel, int slot, BlockNumber limit,
+								bool batch);
+static Buffer zspage_pool_getbuf(Relation rel);
+static void zspage_set_fpm_head(Relation rel, Buffer metabuf, bool undo,
+								BlockNumber head);
+static void zspage_log_fpm_head(Buffer metabuf, bool undo, BlockNumber head,
+								bool needs_wal);
+static BlockNumber zspage_relink_fpm(Relation rel, Buffer metabuf, bool undo,
+									 BlockNumber limit);
+static void zspage_delete_page_internal(Relation rel, Buffer buf, Buffer metabuf,
+										bool undo);
+static void zspage_push_free_page(Buffer buf, Buffer metabuf, bool undo,
+								  bool needs_wal);
+static Buffer zspage_extendrel_newbuf(Relation rel, BlockNumber nblocks);
+static void zspage_free_new_blocks(Relation rel, Buffer metabuf,
+								   BlockNumber start, BlockNumber end);
+static Buffer zspage_alloc_from_extent(Relation rel, Buffer metabuf, int slot);
+static bool zspage_reserve_extent(Relation rel, int slot, BlockNumber start, BlockNumber end);
+static void zspage_set_extent(Relation rel, Buffer metabuf, int slot,
+							  BlockNumber next, BlockNumber end);
 
 /*
  * zspage_is_recyclable()
@@ -107,7 +211,10 @@ zspage_is_unused(Buffer buf)
 /*
  * Allocate a new page.
  *
- * The page is exclusive-locked, but not initialized.
+ * The page is exclusive-locked, but not initialized. 'attno' is the
+ * attribute the page is for, or ZS_INVALID_ATTRIBUTE_NUM for UNDO pages.
+ * UNDO pages are taken from the list of free UNDO pages, or from the UNDO
+ * extent, and must be given back with zspage_delete_undo_page().
  *
  * The head of the FPM chain is kept in the metapage, and thus this
  * function will acquire the lock on the metapage. The caller must
@@ -123,35 +230,194 @@ zspage_is_unused(Buffer buf)
  * That's unfortunate, but hopefully won't happen too often.
  */
 Buffer
-zspage_getnewbuf(Relation rel)
+zspage_getnewbuf(Relation rel, AttrNumber attno)
+{
+	Buffer		buf;
+	BlockNumber blk;
+	int			slot;
+	BlockNumber extent_size;
+	BlockNumber extra_blocks = 0;
+	bool		needLock;
+	bool		batch;
+
+	slot = (attno >= 0) ? attno % ZS_FPM_EXTENT_SLOTS : ZS_FPM_UNDO_EXTENT_SLOT;
+
+	batch = (slot != ZS_FPM_UNDO_EXTENT_SLOT && !RELATION_IS_LOCAL(rel) &&
+			 zs_relation_needs_wal(rel));
+	if (batch)
+	{
+		buf = zspage_pool_getbuf(rel);
+		if (BufferIsValid(buf))
+			return buf;
+	}
+
+	buf = zspage_getfreebuf(rel, slot, InvalidBlockNumber, batch);
+	if (BufferIsValid(buf))
+		return buf;
+
+	/*
+	 * No free pages. Have to extend the relation.
+	 *
+	 * We have to use a lock to ensure no one else is extending the rel at
+	 * the same time, else we will both try to initialize the same new
+	 * page.  We can skip locking for new or temp relations, however,
+	 * since no one else could be accessing them.
+	 *
+	 * If the lock is contended, like during a bulk load into a wide table,
+	 * where every attribute tree needs new pages all the time, other
+	 * backends might have extended the relation while we waited, so check
+	 * the FPM again. If there are still no free pages, extend the relation
+	 * by some extra blocks, proportional to the number of waiters, and put
+	 * them in the FPM for everyone. This is the same heuristic as
+	 * RelationAddExtraBlocks() uses for heap.
+	 */
+	needLock = !RELATION_IS_LOCAL(rel);
+	if (needLock && !ConditionalLockRelationForExtension(rel, ExclusiveLock))
+	{
+		LockRelationForExtension(rel, ExclusiveLock);
+
+		buf = zspage_getfreebuf(rel, slot, InvalidBlockNumber, batch);
+		if (BufferIsValid(buf))
+		{
+			UnlockRelationForExtension(rel, ExclusiveLock);
+			return buf;
+		}
+
+		extra_blocks = Min(512, RelationExtensionLockWaiterCount(rel) * 20);
+	}
+
+	/*
+	 * Extend by a whole extent, and reserve the rest of the extent for the
+	 * same attribute, or for UNDO.
+	 */
+	extent_size = RelationGetNumberOfBlocks(rel) / (ZS_FPM_EXTENT_SLOTS * 8);
+	extent_size = Max(extent_size, 1);
+	extent_size = Min(extent_size, ZS_FPM_MAX_EXTENT_SIZE);
+	buf = zspage_extendrel_newbuf(rel, extent_size + extra_blocks);
+	blk = BufferGetBlockNumber(buf);
+
+	/*
+	 * Release the file-extension lock; it's now OK for someone else to
+	 * extend the relation some more.  Note that we cannot release this
+	 * lock before we have buffer lock on the new page, or we risk a race
+	 * condition against btvacuumscan --- see comments therein.
+	 */
+	if (needLock)
+		UnlockRelationForExtension(rel, ExclusiveLock);
+
+	if (extent_size > 1 &&
+		zspage_reserve_extent(rel, slot, blk + 1, blk + extent_size) &&
+		slot < ZS_FPM_EXTENT_SLOTS)
+	{
+		ZSOwnExtent *own = &zs_own_extents[slot];
+
+		if (RelFileNodeEquals(own->node, rel->rd_node) &&
+			own->end - own->start >= ZS_FPM_WRITE_COMBINE_MIN)
+			FlushRelationBlockRange(rel, own->start, own->end);
+
+		own->node = rel->rd_node;
+		own->start = blk;
+		own->end = blk + extent_size;
+	}
+	if (extra_blocks > 0)
+		zspage_free_new_blocks(rel, InvalidBuffer,
+							   blk + extent_size, blk + extent_size + extra_blocks);
+
+	return buf;
+}
+
+/*
+ * Allocate 'nblocks' consecutive new pages, by extending the relation.
+ *
+ * This is for toast chains of large datums, so that they can be read back
+ * with readahead. The pages are never taken from the FPM or an extent, which
+ * are unlikely to have a long enough run of consecutive pages anyway.
+ *
+ * Returns the first page, exclusive-locked. The caller must lock, initialize
+ * and WAL-log all the following pages too. Like with zspage_getnewbuf(), the
+ * pages are leaked if we crash before that.
+ */
+Buffer
+zspage_getnewbufs_contiguous(Relation rel, BlockNumber nblocks)
+{
+	Buffer		buf;
+	bool		needLock;
+
+	Assert(nblocks > 0);
+
+	needLock = !RELATION_IS_LOCAL(rel);
+	if (needLock)
+		LockRelationForExtension(rel, ExclusiveLock);
+
+	buf = zspage_extendrel_newbuf(rel, nblocks);
+
+	if (needLock)
+		UnlockRelationForExtension(rel, ExclusiveLock);
+
+	return buf;
+}
+
+/*
+ * Get a free page below block 'limit' from the FPM, for moving a B-tree
+ * page to. Never extends the relation, nor takes pages from the extents.
+ * Returns InvalidBuffer if there is no such page.
+ *
+ * This relies on the FPM being in ascending block order, as left by
+ * zspage_sort_fpm(), so only the head of the FPM is checked.
+ */
+Buffer
+zspage_getfreebuf_below(Relation rel, BlockNumber limit)
+{
+	return zspage_getfreebuf(rel, 0, limit, false);
+}
+
+/*
+ * Get a page from the FPM, or from the extent in slot 'slot'. For the UNDO
+ * slot, the list of free UNDO pages is used instead of the FPM. Returns
+ * InvalidBuffer if there are no free pages.
+ *
+ * If 'limit' is valid, only a page from the FPM below 'limit' will do.
+ *
+ * If 'batch' is set, the following pages in the FPM are moved to the pool
+ * of this backend, too, see ZSPagePool. The pool must be empty.
+ */
+static Buffer
+zspage_getfreebuf(Relation rel, int slot, BlockNumber limit, bool batch)
 {
 	Buffer		buf;
 	BlockNumber blk;
 	Buffer		metabuf;
 	Page		metapage;
 	ZSMetaPageOpaque *metaopaque;
+	bool		undo = (slot == ZS_FPM_UNDO_EXTENT_SLOT);
+	BlockNumber *head;
 
 	metabuf = ReadBuffer(rel, ZS_META_BLK);
-	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
 
 	metapage = BufferGetPage(metabuf);
 	metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
 
 	/* Get a block from the FPM. */
-	blk = metaopaque->zs_fpm_head;
+	head = undo ? &metaopaque->zs_undo_fpm_head : &metaopaque->zs_fpm_head;
+	blk = *head;
 	if (blk == ZS_META_BLK)
 	{
 		/* metapage, not expected */
 		elog(ERROR, "could not find valid page in FPM");
 	}
+	if (BlockNumberIsValid(limit) && (blk == InvalidBlockNumber || blk >= limit))
+	{
+		UnlockReleaseBuffer(metabuf);
+		return InvalidBuffer;
+	}
 	if (blk != InvalidBlockNumber)
 	{
 		ZSFreePageOpaque *opaque;
 		Page		page;
-		BlockNumber next_free_blkno;
 
 		buf = ReadBuffer(rel, blk);
-		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		LockBufferWithWaitEvent(buf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_FPM);
 
 		/* Check that the page really is unused. */
 		if (!zspage_is_unused(buf))
@@ -161,45 +427,379 @@ zspage_getnewbuf(Relation rel)
 		}
 		page = BufferGetPage(buf);
 		opaque = (ZSFreePageOpaque *) PageGetSpecialPointer(page);
-		next_free_blkno = opaque->zs_next;
+		blk = opaque->zs_next;
 
-		metaopaque->zs_fpm_head = next_free_blkno;
-
-		if (RelationNeedsWAL(rel))
+		/*
+		 * Take the following pages for the pool. If we find something
+		 * else than a free page in the chain, just stop there, and leave
+		 * it at the head of the FPM, so that whoever gets to it first will
+		 * complain.
+		 */
+		if (batch)
 		{
-			wal_zedstore_fpm_reuse_page xlrec;
-			XLogRecPtr recptr;
+			Assert(zs_page_pool.next == zs_page_pool.nblocks);
+			zs_page_pool.node = rel->rd_node;
+			zs_page_pool.next = 0;
+			zs_page_pool.nblocks = 0;
+			while (blk != InvalidBlockNumber && blk != ZS_META_BLK &&
+				   zs_page_pool.nblocks < lengthof(zs_page_pool.blocks))
+			{
+				Buffer		nextbuf;
+				bool		unused;
+
+				nextbuf = ReadBuffer(rel, blk);
+				LockBufferWithWaitEvent(nextbuf, BUFFER_LOCK_SHARE, ZS_WAIT_FPM);
+				unused = zspage_is_unused(nextbuf);
+				if (unused)
+				{
+					zs_page_pool.blocks[zs_page_pool.nblocks++] = blk;
+					blk = ((ZSFreePageOpaque *) PageGetSpecialPointer(BufferGetPage(nextbuf)))->zs_next;
+				}
+				UnlockReleaseBuffer(nextbuf);
+				if (!unused)
+					break;
+			}
+		}
 
-			xlrec.next_free_blkno = next_free_blkno;
+		/*
+		 * NOTE: We don't WAL-log the reused page here. It's up to the
+		 * caller to WAL-log its initialization. If we crash between here
+		 * and the initialization, the page is leaked. That's unfortunate,
+		 * but it should be rare enough that we can live with it.
+		 */
+		zspage_set_fpm_head(rel, metabuf, undo, blk);
+		UnlockReleaseBuffer(metabuf);
+	}
+	else
+	{
+		/* No free pages in the FPM. Try the extent. */
+		buf = zspage_alloc_from_extent(rel, metabuf, slot);
+		UnlockReleaseBuffer(metabuf);
+	}
 
-			XLogBeginInsert();
-			XLogRegisterData((char *) &xlrec, SizeOfZSWalFpmReusePage);
-			XLogRegisterBuffer(0, metabuf, REGBUF_STANDARD);
+	return buf;
+}
 
-			/*
-			 * NOTE: We don't WAL-log the reused page here. It's up to the
-			 * caller to WAL-log its initialization. If we crash between here
-			 * and the initialization, the page is leaked. That's unfortunate,
-			 * but it should be rare enough that we can live with it.
-			 */
+/*
+ * Get a page from this backend's pool, or InvalidBuffer if the pool is
+ * empty. If the pool has pages of another relation, they're given back
+ * first.
+ */
+static Buffer
+zspage_pool_getbuf(Relation rel)
+{
+	Buffer		buf;
+	BlockNumber blk;
 
-			recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_FPM_REUSE_PAGE);
+	if (zs_page_pool.next == zs_page_pool.nblocks)
+		return InvalidBuffer;
+	if (!RelFileNodeEquals(zs_page_pool.node, rel->rd_node))
+	{
+		AtEOXact_zedstore_freepages();
+		return InvalidBuffer;
+	}
 
-			PageSetLSN(BufferGetPage(metabuf), recptr);
-		}
-		UnlockReleaseBuffer(metabuf);
+	blk = zs_page_pool.blocks[zs_page_pool.next];
+	buf = ReadBuffer(rel, blk);
+	LockBufferWithWaitEvent(buf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_FPM);
+	if (!zspage_is_unused(buf))
+	{
+		UnlockReleaseBuffer(buf);
+		elog(ERROR, "unexpected page found in free page pool");
 	}
+	zs_page_pool.next++;
+
+	return buf;
+}
+
+/*
+ * Give the pages in this backend's pool back to the FPM.
+ *
+ * This is called at the end of each transaction and subtransaction abort,
+ * while we're still holding our lock on the relation. We might not be able
+ * to access the relcache at that point, so this works with the buffers
+ * directly. The pages are still chained together, so it's enough to link
+ * the last one to the current head of the FPM, and make the first one the
+ * new head. If we crash in between, the rest of the pages are leaked.
+ */
+void
+AtEOXact_zedstore_freepages(void)
+{
+	Buffer		metabuf;
+	Buffer		buf;
+	BlockNumber first;
+	BlockNumber last;
+
+	if (zs_page_pool.next == zs_page_pool.nblocks)
+		return;
+
+	/* forget about the pool first, so that we don't try again on error */
+	first = zs_page_pool.blocks[zs_page_pool.next];
+	last = zs_page_pool.blocks[zs_page_pool.nblocks - 1];
+	zs_page_pool.next = zs_page_pool.nblocks = 0;
+
+	metabuf = ReadBufferWithoutRelcache(zs_page_pool.node, MAIN_FORKNUM,
+										ZS_META_BLK, RBM_NORMAL, NULL);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+	buf = ReadBufferWithoutRelcache(zs_page_pool.node, MAIN_FORKNUM, last,
+									RBM_NORMAL, NULL);
+	LockBufferWithWaitEvent(buf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_FPM);
+
+	zspage_push_free_page(buf, metabuf, false, true);
+	if (first != last)
+		zspage_log_fpm_head(metabuf, false, first, true);
+
+	UnlockReleaseBuffer(buf);
+	UnlockReleaseBuffer(metabuf);
+}
+
+/*
+ * Forget the pages in the pool without giving them back, because the
+ * relation is being truncated or replaced.
+ */
+void
+zspage_forget_pool(const RelFileNode *rnode)
+{
+	if (RelFileNodeEquals(zs_page_pool.node, *rnode))
+		zs_page_pool.next = zs_page_pool.nblocks = 0;
+}
+
+/*
+ * Set the head of the FPM, or of the list of free UNDO pages, and WAL-log it.
+ * The caller must hold an exclusive lock on the metapage.
+ */
+static void
+zspage_set_fpm_head(Relation rel, Buffer metabuf, bool undo, BlockNumber head)
+{
+	zspage_log_fpm_head(metabuf, undo, head, zs_relation_needs_wal(rel));
+}
+
+/*
+ * Workhorse of zspage_set_fpm_head(), for when we don't have the relcache
+ * entry at hand.
+ */
+static void
+zspage_log_fpm_head(Buffer metabuf, bool undo, BlockNumber head, bool needs_wal)
+{
+	Page		metapage = BufferGetPage(metabuf);
+	ZSMetaPageOpaque *metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+
+	START_CRIT_SECTION();
+
+	if (undo)
+		metaopaque->zs_undo_fpm_head = head;
 	else
+		metaopaque->zs_fpm_head = head;
+
+	MarkBufferDirty(metabuf);
+
+	if (needs_wal)
 	{
-		/* No free pages. Have to extend the relation. */
-		UnlockReleaseBuffer(metabuf);
-		buf = zspage_extendrel_newbuf(rel);
-		blk = BufferGetBlockNumber(buf);
+		wal_zedstore_fpm_reuse_page xlrec;
+		XLogRecPtr recptr;
+
+		xlrec.next_free_blkno = head;
+		xlrec.undo = undo;
+
+		XLogBeginInsert();
+		XLogRegisterData((char *) &xlrec, SizeOfZSWalFpmReusePage);
+		XLogRegisterBuffer(0, metabuf, REGBUF_STANDARD);
+
+		recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_FPM_REUSE_PAGE);
+
+		PageSetLSN(metapage, recptr);
 	}
 
+	END_CRIT_SECTION();
+}
+
+/*
+ * Allocate the next block from an extent in the metapage.
+ *
+ * The caller must hold an exclusive lock on the metapage. Returns the
+ * page, exclusive-locked, or InvalidBuffer if the extent is empty.
+ */
+static Buffer
+zspage_alloc_from_extent(Relation rel, Buffer metabuf, int slot)
+{
+	Page		metapage = BufferGetPage(metabuf);
+	ZSMetaPageOpaque *metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+	ZSFpmExtent *extent = &metaopaque->zs_extents[slot];
+	BlockNumber blk;
+	Buffer		buf;
+
+	if (extent->next >= extent->end)
+		return InvalidBuffer;
+	blk = extent->next;
+
+	/*
+	 * Extending the relation isn't WAL-logged, so after a crash, the
+	 * blocks of the extent might be gone. They're gone for good then, so
+	 * forget about the rest of the extent. Likewise if the block has been
+	 * put to use somehow, which shouldn't happen.
+	 */
+	if (blk >= RelationGetNumberOfBlocks(rel))
+	{
+		zspage_set_extent(rel, metabuf, slot, extent->end, extent->end);
+		return InvalidBuffer;
+	}
+
+	buf = ReadBuffer(rel, blk);
+	LockBufferWithWaitEvent(buf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_FPM);
+	if (!PageIsNew(BufferGetPage(buf)))
+	{
+		UnlockReleaseBuffer(buf);
+		elog(LOG, "unexpected page found in extent of zedstore relation \"%s\"",
+			 RelationGetRelationName(rel));
+		zspage_set_extent(rel, metabuf, slot, extent->end, extent->end);
+		return InvalidBuffer;
+	}
+
+	/*
+	 * NOTE: Like when reusing a page from the FPM, it's up to the caller
+	 * to WAL-log the initialization of the page.
+	 */
+	zspage_set_extent(rel, metabuf, slot, blk + 1, extent->end);
+
 	return buf;
 }
 
+/*
+ * Reserve blocks 'start' to 'end' (exclusive), that we just added to the
+ * relation, for later allocations in extent slot 'slot'.
+ *
+ * Returns false if another backend reserved an extent for the slot first,
+ * and the blocks were put in the FPM instead.
+ */
+static bool
+zspage_reserve_extent(Relation rel, int slot, BlockNumber start, BlockNumber end)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	ZSMetaPageOpaque *metaopaque;
+	ZSFpmExtent *extent;
+	bool		reserved;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+	metapage = BufferGetPage(metabuf);
+	metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+	extent = &metaopaque->zs_extents[slot];
+
+	reserved = (extent->next >= extent->end);
+	if (reserved)
+		zspage_set_extent(rel, metabuf, slot, start, end);
+	else
+	{
+		/*
+		 * Another backend reserved a new extent for this slot concurrently.
+		 * Give our blocks to the FPM instead, so that they're not leaked.
+		 */
+		zspage_free_new_blocks(rel, metabuf, start, end);
+	}
+
+	UnlockReleaseBuffer(metabuf);
+
+	return reserved;
+}
+
+/*
+ * Add blocks 'start' to 'end' (exclusive), that we just added to the
+ * relation, to the FPM.
+ *
+ * They're pushed in reverse order, so that they're handed out in ascending
+ * order. If the caller is already holding a lock on the metapage, pass it
+ * in 'metabuf'.
+ */
+static void
+zspage_free_new_blocks(Relation rel, Buffer metabuf,
+					   BlockNumber start, BlockNumber end)
+{
+	bool		release_metabuf = false;
+
+	if (metabuf == InvalidBuffer)
+	{
+		metabuf = ReadBuffer(rel, ZS_META_BLK);
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+		release_metabuf = true;
+	}
+
+	for (BlockNumber blk = end; blk > start; blk--)
+	{
+		Buffer		buf;
+
+		buf = ReadBuffer(rel, blk - 1);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		zspage_delete_page(rel, buf, metabuf);
+		UnlockReleaseBuffer(buf);
+	}
+
+	if (release_metabuf)
+		UnlockReleaseBuffer(metabuf);
+}
+
+/*
+ * Update an extent slot in the metapage, and WAL-log it.
+ */
+static void
+zspage_set_extent(Relation rel, Buffer metabuf, int slot,
+				  BlockNumber next, BlockNumber end)
+{
+	Page		metapage = BufferGetPage(metabuf);
+	ZSMetaPageOpaque *metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+
+	START_CRIT_SECTION();
+
+	metaopaque->zs_extents[slot].next = next;
+	metaopaque->zs_extents[slot].end = end;
+
+	MarkBufferDirty(metabuf);
+
+	if (zs_relation_needs_wal(rel))
+	{
+		wal_zedstore_fpm_extent xlrec;
+		XLogRecPtr	recptr;
+
+		xlrec.slot = slot;
+		xlrec.next = next;
+		xlrec.end = end;
+
+		XLogBeginInsert();
+		XLogRegisterData((char *) &xlrec, SizeOfZSWalFpmExtent);
+		XLogRegisterBuffer(0, metabuf, REGBUF_STANDARD);
+
+		recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_FPM_EXTENT);
+
+		PageSetLSN(metapage, recptr);
+	}
+
+	END_CRIT_SECTION();
+}
+
+void
+zspage_extent_redo(XLogReaderState *record)
+{
+	XLogRecPtr	lsn = record->EndRecPtr;
+	wal_zedstore_fpm_extent *xlrec = (wal_zedstore_fpm_extent *) XLogRecGetData(record);
+	Buffer		metabuf;
+
+	if (XLogReadBufferForRedo(record, 0, &metabuf) == BLK_NEEDS_REDO)
+	{
+		Page		metapage = BufferGetPage(metabuf);
+		ZSMetaPageOpaque *metaopaque;
+
+		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+		metaopaque->zs_extents[xlrec->slot].next = xlrec->next;
+		metaopaque->zs_extents[xlrec->slot].end = xlrec->end;
+
+		PageSetLSN(metapage, lsn);
+		MarkBufferDirty(metabuf);
+	}
+
+	if (BufferIsValid(metabuf))
+		UnlockReleaseBuffer(metabuf);
+}
+
 void
 zspage_reuse_page_redo(XLogReaderState *record)
 {
@@ -213,7 +813,10 @@ zspage_reuse_page_redo(XLogReaderState *record)
 		ZSMetaPageOpaque *metaopaque;
 
 		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
-		metaopaque->zs_fpm_head = xlrec->next_free_blkno;
+		if (xlrec->undo)
+			metaopaque->zs_undo_fpm_head = xlrec->next_free_blkno;
+		else
+			metaopaque->zs_fpm_head = xlrec->next_free_blkno;
 
 		PageSetLSN(metapage, lsn);
 		MarkBufferDirty(metabuf);
@@ -224,42 +827,30 @@ zspage_reuse_page_redo(XLogReaderState *record)
 }
 
 /*
- * Extend the relation.
+ * Extend the relation by 'nblocks' blocks.
  *
- * Returns the new page, exclusive-locked.
+ * Returns the first new page, exclusive-locked. The rest of the new pages
+ * follow it, and are left all-zeros. The caller must hold the relation
+ * extension lock, unless the relation is local to this backend.
  */
 static Buffer
-zspage_extendrel_newbuf(Relation rel)
+zspage_extendrel_newbuf(Relation rel, BlockNumber nblocks)
 {
 	Buffer		buf;
-	bool		needLock;
-
-	/*
-	 * Extend the relation by one page.
-	 *
-	 * We have to use a lock to ensure no one else is extending the rel at
-	 * the same time, else we will both try to initialize the same new
-	 * page.  We can skip locking for new or temp relations, however,
-	 * since no one else could be accessing them.
-	 */
-	needLock = !RELATION_IS_LOCAL(rel);
-
-	if (needLock)
-		LockRelationForExtension(rel, ExclusiveLock);
 
 	buf = ReadBuffer(rel, P_NEW);
 
 	/* Acquire buffer lock on new page */
 	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
 
-	/*
-	 * Release the file-extension lock; it's now OK for someone else to
-	 * extend the relation some more.  Note that we cannot release this
-	 * lock before we have buffer lock on the new page, or we risk a race
-	 * condition against btvacuumscan --- see comments therein.
-	 */
-	if (needLock)
-		UnlockRelationForExtension(rel, ExclusiveLock);
+	for (BlockNumber i = 1; i < nblocks; i++)
+	{
+		Buffer		extrabuf = ReadBuffer(rel, P_NEW);
+
+		/* we're holding the extension lock, so nothing can get in between */
+		Assert(BufferGetBlockNumber(extrabuf) == BufferGetBlockNumber(buf) + i);
+		ReleaseBuffer(extrabuf);
+	}
 
 	return buf;
 }
@@ -281,40 +872,74 @@ zspage_extendrel_newbuf(Relation rel)
  */
 void
 zspage_delete_page(Relation rel, Buffer buf, Buffer metabuf)
+{
+	zspage_delete_page_internal(rel, buf, metabuf, false);
+}
+
+/*
+ * Like zspage_delete_page(), but for a page that was allocated for UNDO.
+ * It's added to the list of free UNDO pages.
+ */
+void
+zspage_delete_undo_page(Relation rel, Buffer buf, Buffer metabuf)
+{
+	zspage_delete_page_internal(rel, buf, metabuf, true);
+}
+
+static void
+zspage_delete_page_internal(Relation rel, Buffer buf, Buffer metabuf, bool undo)
 {
 	bool		release_metabuf;
-	BlockNumber blk = BufferGetBlockNumber(buf);
-	Page		metapage;
-	ZSMetaPageOpaque *metaopaque;
-	Page		page;
-	BlockNumber next_free_blkno;
 
 	if (metabuf == InvalidBuffer)
 	{
 		metabuf = ReadBuffer(rel, ZS_META_BLK);
-		LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
 		release_metabuf = true;
 	}
 	else
 		release_metabuf = false;
 
+	zspage_push_free_page(buf, metabuf, undo, zs_relation_needs_wal(rel));
+
+	if (release_metabuf)
+		UnlockReleaseBuffer(metabuf);
+}
+
+/*
+ * Mark a page as deleted, and push it to the FPM or the list of free UNDO
+ * pages. The caller must hold exclusive locks on both the page and the
+ * metapage.
+ */
+static void
+zspage_push_free_page(Buffer buf, Buffer metabuf, bool undo, bool needs_wal)
+{
+	BlockNumber blk = BufferGetBlockNumber(buf);
+	Page		metapage;
+	ZSMetaPageOpaque *metaopaque;
+	Page		page;
+	BlockNumber next_free_blkno;
+	BlockNumber *head;
+
 	metapage = BufferGetPage(metabuf);
 	metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+	head = undo ? &metaopaque->zs_undo_fpm_head : &metaopaque->zs_fpm_head;
 
 	page = BufferGetPage(buf);
-	next_free_blkno = metaopaque->zs_fpm_head;
+	next_free_blkno = *head;
 	zspage_mark_page_deleted(page, next_free_blkno);
-	metaopaque->zs_fpm_head = blk;
+	*head = blk;
 
 	MarkBufferDirty(metabuf);
 	MarkBufferDirty(buf);
 
-	if (RelationNeedsWAL(rel))
+	if (needs_wal)
 	{
 		wal_zedstore_fpm_delete_page xlrec;
 		XLogRecPtr recptr;
 
 		xlrec.next_free_blkno = next_free_blkno;
+		xlrec.undo = undo;
 
 		XLogBeginInsert();
 		XLogRegisterData((char *) &xlrec, SizeOfZSWalFpmDeletePage);
@@ -326,9 +951,6 @@ zspage_delete_page(Relation rel, Buffer buf, Buffer metabuf)
 		PageSetLSN(metapage, recptr);
 		PageSetLSN(page, recptr);
 	}
-
-	if (release_metabuf)
-		UnlockReleaseBuffer(metabuf);
 }
 
 /*
@@ -349,6 +971,327 @@ zspage_mark_page_deleted(Page page, BlockNumber next_free_blk)
 	opaque->zs_next = next_free_blk;
 }
 
+static int
+blocknumber_cmp(const void *a, const void *b)
+{
+	BlockNumber blka = *(const BlockNumber *) a;
+	BlockNumber blkb = *(const BlockNumber *) b;
+
+	if (blka < blkb)
+		return -1;
+	if (blka > blkb)
+		return 1;
+	return 0;
+}
+
+/*
+ * Re-link the pages in the FPM, or in the list of free UNDO pages, in
+ * ascending block order, leaving out pages at or above 'limit'. Returns
+ * the number of pages left in the list.
+ *
+ * The caller must hold an exclusive lock on the metapage. The list is
+ * detached from the metapage, and the pages are pushed back one by one.
+ * If we crash in between, the rest of the pages are leaked.
+ */
+static BlockNumber
+zspage_relink_fpm(Relation rel, Buffer metabuf, bool undo, BlockNumber limit)
+{
+	Page		metapage = BufferGetPage(metabuf);
+	ZSMetaPageOpaque *metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+	BlockNumber nblocks = RelationGetNumberOfBlocks(rel);
+	BlockNumber *blocks;
+	int			nfree = 0;
+	int			allocated = 100;
+	BlockNumber nkept = 0;
+	BlockNumber blk;
+
+	blocks = palloc(allocated * sizeof(BlockNumber));
+	blk = undo ? metaopaque->zs_undo_fpm_head : metaopaque->zs_fpm_head;
+	while (blk != InvalidBlockNumber)
+	{
+		Buffer		buf;
+
+		if (blk == ZS_META_BLK || blk >= nblocks || nfree >= nblocks)
+			elog(ERROR, "could not find valid page in FPM");
+
+		buf = ReadBuffer(rel, blk);
+		LockBufferWithWaitEvent(buf, BUFFER_LOCK_SHARE, ZS_WAIT_FPM);
+		if (!zspage_is_unused(buf))
+		{
+			UnlockReleaseBuffer(buf);
+			elog(ERROR, "unexpected page found in free page list");
+		}
+		if (nfree == allocated)
+		{
+			allocated *= 2;
+			blocks = repalloc(blocks, allocated * sizeof(BlockNumber));
+		}
+		blocks[nfree++] = blk;
+		blk = ((ZSFreePageOpaque *) PageGetSpecialPointer(BufferGetPage(buf)))->zs_next;
+		UnlockReleaseBuffer(buf);
+	}
+
+	zspage_set_fpm_head(rel, metabuf, undo, InvalidBlockNumber);
+
+	/* Push them back in reverse order, so that they're handed out in ascending order */
+	qsort(blocks, nfree, sizeof(BlockNumber), blocknumber_cmp);
+	for (int i = nfree - 1; i >= 0; i--)
+	{
+		Buffer		buf;
+
+		if (blocks[i] >= limit)
+			continue;
+
+		buf = ReadBuffer(rel, blocks[i]);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		zspage_delete_page_internal(rel, buf, metabuf, undo);
+		UnlockReleaseBuffer(buf);
+		nkept++;
+	}
+	pfree(blocks);
+
+	return nkept;
+}
+
+/*
+ * Sort the FPM in ascending block order, so that the pages at the beginning
+ * of the relation are handed out first. Returns the number of pages in it.
+ *
+ * This is the first step of compacting a table: the B-tree pages at the end
+ * of the relation are then moved to the free pages at the beginning, with
+ * zspage_getfreebuf_below(), and zspage_truncate() cuts off the end.
+ */
+BlockNumber
+zspage_sort_fpm(Relation rel)
+{
+	Buffer		metabuf;
+	BlockNumber nfree;
+
+	/* our own pool goes to the FPM, too */
+	AtEOXact_zedstore_freepages();
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+	nfree = zspage_relink_fpm(rel, metabuf, false, InvalidBlockNumber);
+	UnlockReleaseBuffer(metabuf);
+
+	return nfree;
+}
+
+/*
+ * Add pages to the FPM that were marked as deleted with
+ * zspage_mark_page_deleted(), but not linked to the FPM yet, and if
+ * 'truncate' is set, truncate away all the unused pages at the end of the
+ * relation. Returns the number of blocks truncated.
+ *
+ * When truncating, the caller must hold an AccessExclusiveLock on the
+ * relation, so that no one else is using the pages at the end.
+ */
+BlockNumber
+zspage_truncate(Relation rel, BlockNumber *unlinked, int nunlinked, bool truncate)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	ZSMetaPageOpaque *metaopaque;
+	BlockNumber nblocks;
+	BlockNumber newend;
+
+	/* the pages in our pool look unused, so they must not be truncated */
+	AtEOXact_zedstore_freepages();
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+	metapage = BufferGetPage(metabuf);
+	metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+
+	nblocks = RelationGetNumberOfBlocks(rel);
+	newend = nblocks;
+	if (truncate)
+	{
+		/* Find the last page that's in use */
+		while (newend > ZS_META_BLK + 1)
+		{
+			Buffer		buf;
+			bool		unused;
+
+			CHECK_FOR_INTERRUPTS();
+
+			buf = ReadBuffer(rel, newend - 1);
+			LockBuffer(buf, BUFFER_LOCK_SHARE);
+			unused = PageIsNew(BufferGetPage(buf)) || zspage_is_unused(buf);
+			UnlockReleaseBuffer(buf);
+			if (!unused)
+				break;
+			newend--;
+		}
+	}
+
+	if (newend < nblocks)
+	{
+		/* Forget about the free pages beyond the new end */
+		zspage_relink_fpm(rel, metabuf, false, newend);
+		zspage_relink_fpm(rel, metabuf, true, newend);
+		for (int slot = 0; slot <= ZS_FPM_UNDO_EXTENT_SLOT; slot++)
+		{
+			ZSFpmExtent *extent = &metaopaque->zs_extents[slot];
+
+			if (extent->end > newend)
+				zspage_set_extent(rel, metabuf, slot,
+								  Min(extent->next, newend), newend);
+		}
+	}
+
+	for (int i = 0; i < nunlinked; i++)
+	{
+		Buffer		buf;
+
+		if (unlinked[i] >= newend)
+			continue;
+
+		buf = ReadBuffer(rel, unlinked[i]);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		zspage_delete_page(rel, buf, metabuf);
+		UnlockReleaseBuffer(buf);
+	}
+	UnlockReleaseBuffer(metabuf);
+
+	if (newend < nblocks)
+	{
+		/* the cached rightmost leaves might point past the new end */
+		zs_metacache_invalidate(rel);
+		RelationTruncate(rel, newend);
+	}
+
+	return nblocks - newend;
+}
+
+/*
+ * How long zspage_compact() tries to get the AccessExclusiveLock for
+ * truncating the relation, like VACUUM does.
+ */
+#define ZS_COMPACT_LOCK_WAIT_INTERVAL	50		/* ms */
+#define ZS_COMPACT_LOCK_TIMEOUT			5000	/* ms */
+
+/*
+ * Count the pages in the FPM.
+ */
+static BlockNumber
+zspage_count_free(Relation rel)
+{
+	Buffer		metabuf;
+	BlockNumber nblocks = RelationGetNumberOfBlocks(rel);
+	BlockNumber nfree = 0;
+	BlockNumber blk;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
+	blk = ((ZSMetaPageOpaque *) PageGetSpecialPointer(BufferGetPage(metabuf)))->zs_fpm_head;
+	while (blk != InvalidBlockNumber && blk != ZS_META_BLK &&
+		   blk < nblocks && nfree < nblocks)
+	{
+		Buffer		buf;
+		bool		unused;
+
+		buf = ReadBuffer(rel, blk);
+		LockBufferWithWaitEvent(buf, BUFFER_LOCK_SHARE, ZS_WAIT_FPM);
+		unused = zspage_is_unused(buf);
+		if (unused)
+			blk = ((ZSFreePageOpaque *) PageGetSpecialPointer(BufferGetPage(buf)))->zs_next;
+		UnlockReleaseBuffer(buf);
+		if (!unused)
+			break;
+		nfree++;
+	}
+	UnlockReleaseBuffer(metabuf);
+
+	return nfree;
+}
+
+/*
+ * Compact the relation, and truncate the free pages at its end.
+ *
+ * The B-tree pages at the end of the relation are moved to the free pages
+ * at the beginning, with zsbt_relocate_tree(). TIDs don't change, so
+ * indexes are not affected. The pages are moved one at a time, while
+ * queries and DML continue on the table; only the final truncation needs a
+ * brief AccessExclusiveLock, which is given up on if it can't be acquired
+ * soon, like in VACUUM. UNDO and TOAST pages, and the root pages of the
+ * B-trees, are not moved, so they can keep the relation from shrinking all
+ * the way.
+ *
+ * Nothing is done if there are fewer than 'min_free' pages in the FPM. The
+ * caller must hold a ShareUpdateExclusiveLock on the relation. Returns the
+ * number of blocks truncated away.
+ */
+BlockNumber
+zspage_compact(Relation rel, BlockNumber min_free, int elevel)
+{
+	BlockNumber nblocks;
+	BlockNumber nfree;
+	BlockNumber cutoff;
+	BlockNumber *moved;
+	int			nmoved = 0;
+	BlockNumber ntruncated;
+	bool		locked;
+	int			lock_retry = 0;
+
+	nblocks = RelationGetNumberOfBlocks(rel);
+	if (nblocks <= ZS_META_BLK + 1)
+		return 0;
+	if (min_free > 0 && zspage_count_free(rel) < min_free)
+		return 0;
+
+	/*
+	 * Everything should fit below 'cutoff', if all the free pages were at
+	 * the end.
+	 */
+	nfree = zspage_sort_fpm(rel);
+	cutoff = Max(nblocks - nfree, ZS_META_BLK + 1);
+
+	moved = palloc((nblocks - cutoff + 1) * sizeof(BlockNumber));
+	for (AttrNumber attno = ZS_META_ATTRIBUTE_NUM; attno <= RelationGetNumberOfAttributes(rel); attno++)
+	{
+		if (attno != ZS_META_ATTRIBUTE_NUM &&
+			TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped)
+			continue;
+
+		if (!zsbt_relocate_tree(rel, attno, cutoff, nblocks, moved, &nmoved))
+			break;
+	}
+
+	while (!(locked = ConditionalLockRelation(rel, AccessExclusiveLock)))
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		if (++lock_retry > ZS_COMPACT_LOCK_TIMEOUT / ZS_COMPACT_LOCK_WAIT_INTERVAL)
+		{
+			ereport(elevel,
+					(errmsg("\"%s\": stopping truncate due to conflicting lock request",
+							RelationGetRelationName(rel))));
+			break;
+		}
+		pg_usleep(ZS_COMPACT_LOCK_WAIT_INTERVAL * 1000L);
+	}
+
+	/*
+	 * The truncation resets the smgr target block in all backends, which
+	 * makes them reload their metapage caches, and forget any downlinks
+	 * to the truncated blocks cached in them.
+	 */
+	ntruncated = zspage_truncate(rel, moved, nmoved, locked);
+	if (locked)
+		UnlockRelation(rel, AccessExclusiveLock);
+	pfree(moved);
+
+	if (ntruncated > 0)
+		ereport(elevel,
+				(errmsg("\"%s\": moved %d pages, truncated %u to %u pages",
+						RelationGetRelationName(rel), nmoved,
+						nblocks, nblocks - ntruncated)));
+
+	return ntruncated;
+}
+
 void
 zspage_delete_page_redo(XLogReaderState *record)
 {
@@ -371,7 +1314,10 @@ zspage_delete_page_redo(XLogReaderState *record)
 		ZSMetaPageOpaque *metaopaque;
 
 		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
-		metaopaque->zs_fpm_head = deletedblkno;
+		if (xlrec->undo)
+			metaopaque->zs_undo_fpm_head = deletedblkno;
+		else
+			metaopaque->zs_fpm_head = deletedblkno;
 
 		PageSetLSN(metapage, lsn);
 		MarkBufferDirty(metabuf);
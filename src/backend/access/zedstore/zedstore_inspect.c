@@ -43,6 +43,34 @@
  *      2 |     3 |    38.7542309420398383
  * (3 rows)
  *
+ * Block ranges modified since a backup was taken at LSN 0/3000028:
+ *
+ * select * from pg_zs_modified_extents('t_zedstore', '0/3000028');
+ *  startblk | nblocks |  max_lsn
+ * ----------+---------+-----------
+ *         0 |       1 | 0/3A1C4B0
+ *      2944 |     128 | 0/3A1C4B0
+ * (2 rows)
+ *
+ * Compression ratio of each column, according to the statistics gathered
+ * by the last VACUUM or ANALYZE:
+ *
+ * select attno, raw_bytes::numeric / leaf_bytes as compratio
+ *   from pg_zs_tree_stats('t_zedstore');
+ *
+ * Columns whose leaves are scattered over many runs of blocks, or that have
+ * much free space on their leaves, from a sample of 5% of the leaves:
+ *
+ * select attno, avg_run_length, avg_fill
+ *   from pg_zs_fragmentation('t_zedstore', 0.05);
+ *
+ * Distribution of the compressed size of the leaf pages of column 1, without
+ * returning a row for every page like pg_zs_btree_pages() does:
+ *
+ * select bucket_low, bucket_high, pages
+ *   from pg_zs_btree_histogram('t_zedstore')
+ *  where attno = 1 and measure = 'totalsz';
+ *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
  *
@@ -57,21 +85,31 @@
 
 #include "miscadmin.h"
 
+#include "access/relation.h"
 #include "access/relscan.h"
 #include "access/table.h"
 #include "access/zedstore_internal.h"
 #include "access/zedstore_undorec.h"
+#include "catalog/objectaddress.h"
+#include "catalog/pg_am.h"
 #include "commands/vacuum.h"
 #include "funcapi.h"
+#include "port/pg_bitutils.h"
+#include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/pg_lsn.h"
 #include "utils/rel.h"
 
 Datum		pg_zs_page_type(PG_FUNCTION_ARGS);
 Datum		pg_zs_undo_pages(PG_FUNCTION_ARGS);
 Datum		pg_zs_btree_pages(PG_FUNCTION_ARGS);
+Datum		pg_zs_btree_histogram(PG_FUNCTION_ARGS);
 Datum		pg_zs_toast_pages(PG_FUNCTION_ARGS);
 Datum		pg_zs_meta_page(PG_FUNCTION_ARGS);
 Datum		pg_zs_calculate_adjacent_block(PG_FUNCTION_ARGS);
+Datum		pg_zs_modified_extents(PG_FUNCTION_ARGS);
+Datum		pg_zs_tree_stats(PG_FUNCTION_ARGS);
+Datum		pg_zs_fragmentation(PG_FUNCTION_ARGS);
 
 Datum
 pg_zs_page_type(PG_FUNCTION_ARGS)
@@ -128,6 +166,15 @@ pg_zs_page_type(PG_FUNCTION_ARGS)
 		case ZS_FREE_PAGE_ID:
 			result = "FREE";
 			break;
+		case ZS_STATS_PAGE_ID:
+			result = "STATS";
+			break;
+		case ZS_BLOOM_PAGE_ID:
+			result = "BLOOM";
+			break;
+		case ZS_ROOTDIR_PAGE_ID:
+			result = "ROOTDIR";
+			break;
 		default:
 			result = psprintf("UNKNOWN 0x%04x", zs_page_id);
 	}
@@ -708,6 +755,92 @@ pg_zs_decode_chunk(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
 }
 
+/*
+ * Compute the item count and sizes reported for a B-tree page by
+ * pg_zs_btree_pages() and pg_zs_btree_histogram(). The sizes are only
+ * meaningful for leaf pages.
+ */
+static void
+zs_inspect_btree_page(Page page, ZSBtreePageOpaque *opaque, int *nitems_p,
+					  int *ncompressed_p, int *totalsz_p, int *uncompressedsz_p)
+{
+	int			nitems = 0;
+	int			ncompressed = 0;
+	int			totalsz = 0;
+	int			uncompressedsz = 0;
+
+	if (opaque->zs_level == 0)
+	{
+		/* meta leaf page */
+		if (opaque->zs_attno == ZS_META_ATTRIBUTE_NUM) {
+			OffsetNumber maxoff;
+			OffsetNumber off;
+
+			maxoff = PageGetMaxOffsetNumber(page);
+			for (off = FirstOffsetNumber; off <= maxoff; off++)
+			{
+				ItemId iid = PageGetItemId(page, off);
+
+				ZSTidArrayItem
+					*item = (ZSTidArrayItem *) PageGetItem(page, iid);
+
+				nitems++;
+				totalsz += item->t_size;
+
+				uncompressedsz += item->t_size;
+			}
+		}
+		/* attribute leaf page */
+		else
+		{
+			PageHeader	phdr = (PageHeader) page;
+			ZSAttStream *streams[2];
+			int			nstreams = 0;
+
+			if (phdr->pd_lower - SizeOfPageHeaderData > SizeOfZSAttStreamHeader)
+			{
+				streams[nstreams++] =  (ZSAttStream *) (((char *) page) + SizeOfPageHeaderData);
+			}
+
+			if (phdr->pd_special - phdr->pd_upper > SizeOfZSAttStreamHeader)
+			{
+				streams[nstreams++] =  (ZSAttStream *) (((char *) page) + phdr->pd_upper);
+			}
+
+			for (int i = 0; i < nstreams; i++)
+			{
+				ZSAttStream *stream = streams[i];
+
+				totalsz += stream->t_size;
+				/*
+				 *  FIXME: this is wrong. We currently don't calculate the
+				 *  number of items in the stream
+				 */
+				nitems++;
+				if ((stream->t_flags & ATTSTREAM_COMPRESSED) != 0)
+				{
+					ncompressed++;
+					uncompressedsz += stream->t_decompressed_size;
+				}
+				else
+				{
+					uncompressedsz += stream->t_size;
+				}
+			}
+		}
+	}
+	else
+	{
+		/* internal page */
+		nitems = ZSBtreeInternalPageGetNumItems(page);
+	}
+
+	*nitems_p = nitems;
+	*ncompressed_p = ncompressed;
+	*totalsz_p = totalsz;
+	*uncompressedsz_p = uncompressedsz;
+}
+
 /*
  *  blkno int8
  *  nextblk int8
@@ -821,75 +954,9 @@ pg_zs_btree_pages(PG_FUNCTION_ARGS)
 			continue;
 		}
 
-		nitems = 0;
-		ncompressed = 0;
-		totalsz = 0;
-		uncompressedsz = 0;
-		if (opaque->zs_level == 0)
-		{
-			/* meta leaf page */
-			if (opaque->zs_attno == ZS_META_ATTRIBUTE_NUM) {
-				OffsetNumber maxoff;
-				OffsetNumber off;
-
-				maxoff = PageGetMaxOffsetNumber(page);
-				for (off = FirstOffsetNumber; off <= maxoff; off++)
-				{
-					ItemId iid = PageGetItemId(page, off);
-
-					ZSTidArrayItem
-						*item = (ZSTidArrayItem *) PageGetItem(page, iid);
-
-					nitems++;
-					totalsz += item->t_size;
+		zs_inspect_btree_page(page, opaque, &nitems, &ncompressed,
+							  &totalsz, &uncompressedsz);
 
-					uncompressedsz += item->t_size;
-				}
-			}
-			/* attribute leaf page */
-			else
-			{
-				PageHeader	phdr = (PageHeader) page;
-				ZSAttStream *streams[2];
-				int			nstreams = 0;
-
-				if (phdr->pd_lower - SizeOfPageHeaderData > SizeOfZSAttStreamHeader)
-				{
-					streams[nstreams++] =  (ZSAttStream *) (((char *) page) + SizeOfPageHeaderData);
-				}
-
-				if (phdr->pd_special - phdr->pd_upper > SizeOfZSAttStreamHeader)
-				{
-					streams[nstreams++] =  (ZSAttStream *) (((char *) page) + phdr->pd_upper);
-				}
-
-				for (int i = 0; i < nstreams; i++)
-				{
-					ZSAttStream *stream = streams[i];
-
-					totalsz += stream->t_size;
-					/*
-					 *  FIXME: this is wrong. We currently don't calculate the
-					 *  number of items in the stream
-					 */
-					nitems++;
-					if ((stream->t_flags & ATTSTREAM_COMPRESSED) != 0)
-					{
-						ncompressed++;
-						uncompressedsz += stream->t_decompressed_size;
-					}
-					else
-					{
-						uncompressedsz += stream->t_size;
-					}
-				}
-			}
-		}
-		else
-		{
-			/* internal page */
-			nitems = ZSBtreeInternalPageGetNumItems(page);
-		}
 		values[0] = Int64GetDatum(blkno);
 		values[1] = Int64GetDatum(opaque->zs_next);
 		values[2] = Int32GetDatum(opaque->zs_attno);
@@ -922,6 +989,189 @@ pg_zs_btree_pages(PG_FUNCTION_ARGS)
 	return (Datum) 0;
 }
 
+/*
+ * Histograms of the values that pg_zs_btree_pages() reports for leaf pages.
+ *
+ * pg_zs_btree_pages() returns a row for every page, which on a big table
+ * means materializing millions of rows just to aggregate them. This scans
+ * the relation the same way, but only keeps a counter per power-of-two
+ * bucket, per attribute and measure. Bucket 0 holds the zeros, and bucket
+ * N > 0 holds values in the range [2^(N-1), 2^N - 1].
+ *
+ *  attno int2
+ *  measure text	'totalsz', 'uncompressedsz' or 'nitems'
+ *  bucket_low int8
+ *  bucket_high int8
+ *  pages int8
+ */
+#define ZS_HISTOGRAM_NMEASURES	3
+#define ZS_HISTOGRAM_NBUCKETS	33
+
+static const char *const zs_histogram_measures[ZS_HISTOGRAM_NMEASURES] = {
+	"totalsz", "uncompressedsz", "nitems"
+};
+
+static inline int
+zs_histogram_bucket(int value)
+{
+	if (value <= 0)
+		return 0;
+	return pg_leftmost_one_pos32((uint32) value) + 1;
+}
+
+Datum
+pg_zs_btree_histogram(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Relation	rel;
+	BlockNumber blkno;
+	BlockNumber nblocks;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	BufferAccessStrategy bstrategy;
+	int			natts;
+	int64	   *counts;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use zedstore inspection functions"))));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	rel = table_open(relid, AccessShareLock);
+
+	if (rel->rd_rel->relam != ZEDSTORE_TABLE_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a zedstore table",
+						RelationGetRelationName(rel))));
+
+	/*
+	 * Reject attempts to read non-local temporary relations; we would be
+	 * likely to get wrong data since we have no visibility into the owning
+	 * session's local buffers.
+	 */
+	if (RELATION_IS_OTHER_TEMP(rel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot access temporary tables of other sessions")));
+
+	natts = RelationGetNumberOfAttributes(rel);
+	counts = palloc0((natts + 1) * ZS_HISTOGRAM_NMEASURES *
+					 ZS_HISTOGRAM_NBUCKETS * sizeof(int64));
+#define HISTOGRAM_COUNT(attno, measure, bucket) \
+	counts[((attno) * ZS_HISTOGRAM_NMEASURES + (measure)) * ZS_HISTOGRAM_NBUCKETS + (bucket)]
+
+	/* don't let a scan of a big table wipe out the buffer cache */
+	bstrategy = GetAccessStrategy(BAS_BULKREAD);
+
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	/* scan all blocks in physical order */
+	for (blkno = 1; blkno < nblocks; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		int			nitems;
+		int			ncompressed;
+		int			totalsz;
+		int			uncompressedsz;
+		AttrNumber	attno;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, bstrategy);
+		page = BufferGetPage(buf);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+		if (PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSBtreePageOpaque)))
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+		opaque = (ZSBtreePageOpaque *) PageGetSpecialPointer(page);
+		if (opaque->zs_page_id != ZS_BTREE_PAGE_ID || opaque->zs_level != 0)
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+		attno = opaque->zs_attno;
+
+		zs_inspect_btree_page(page, opaque, &nitems, &ncompressed,
+							  &totalsz, &uncompressedsz);
+		UnlockReleaseBuffer(buf);
+
+		/* a leaf of a column added after we opened the relation? */
+		if (attno < 0 || attno > natts)
+			continue;
+
+		HISTOGRAM_COUNT(attno, 0, zs_histogram_bucket(totalsz))++;
+		HISTOGRAM_COUNT(attno, 1, zs_histogram_bucket(uncompressedsz))++;
+		HISTOGRAM_COUNT(attno, 2, zs_histogram_bucket(nitems))++;
+	}
+
+	for (int attno = 0; attno <= natts; attno++)
+	{
+		for (int measure = 0; measure < ZS_HISTOGRAM_NMEASURES; measure++)
+		{
+			for (int bucket = 0; bucket < ZS_HISTOGRAM_NBUCKETS; bucket++)
+			{
+				Datum		values[5];
+				bool		nulls[5];
+				int64		pages = HISTOGRAM_COUNT(attno, measure, bucket);
+
+				if (pages == 0)
+					continue;
+
+				memset(nulls, 0, sizeof(nulls));
+				values[0] = Int16GetDatum(attno);
+				values[1] = CStringGetTextDatum(zs_histogram_measures[measure]);
+				values[2] = Int64GetDatum(bucket == 0 ? 0 : INT64CONST(1) << (bucket - 1));
+				values[3] = Int64GetDatum(bucket == 0 ? 0 : (INT64CONST(1) << bucket) - 1);
+				values[4] = Int64GetDatum(pages);
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+	}
+#undef HISTOGRAM_COUNT
+	tuplestore_donestoring(tupstore);
+
+	pfree(counts);
+	FreeAccessStrategy(bstrategy);
+	table_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
+
 /*
  *  blkno int8
  *  undo_head int8
@@ -1139,3 +1389,377 @@ pg_zs_calculate_adjacent_block(PG_FUNCTION_ARGS)
 
 	return (Datum) 0;
 }
+
+/*
+ * Return the ranges of blocks that have been modified since the given LSN.
+ *
+ * This is meant for incremental backup tools: instead of copying whole
+ * segment files, they can copy just the returned ranges. Consecutive
+ * modified blocks are merged into one range, so a table that only sees
+ * appends returns a few ranges at the ends of the extents currently being
+ * filled, plus the metapage and the UNDO pages.
+ *
+ * The reserved, never-used parts of the extents in the metapage are known
+ * to be empty, so they are skipped without reading them. Every other block
+ * is pinned to read the page LSN, but not locked. Hint-bit-only changes that
+ * don't bump the LSN are not reported, which is fine for restoring a backup.
+ */
+Datum
+pg_zs_modified_extents(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	XLogRecPtr	since_lsn = PG_GETARG_LSN(1);
+	Relation	rel;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	Tuplestorestate *tupstore;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	BufferAccessStrategy bstrategy;
+	ZSFpmExtent unused[ZS_FPM_EXTENT_SLOTS + 1];
+	BlockNumber nblocks;
+	BlockNumber blkno;
+	BlockNumber runstart = InvalidBlockNumber;
+	XLogRecPtr	runmaxlsn = InvalidXLogRecPtr;
+	Datum		values[3];
+	bool		nulls[3];
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use zedstore inspection functions"))));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	rel = table_open(relid, AccessShareLock);
+
+	/*
+	 * Reject attempts to read non-local temporary relations; we would be
+	 * likely to get wrong data since we have no visibility into the owning
+	 * session's local buffers.
+	 */
+	if (RELATION_IS_OTHER_TEMP(rel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot access temporary tables of other sessions")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/*
+	 * Get the relation size and the unused parts of the extents together
+	 * under the metapage lock, so that they're consistent with each other.
+	 * Blocks allocated from the extents after this get modified after the
+	 * scan started, and will be reported by the next call.
+	 */
+	{
+		Buffer		metabuf;
+		ZSMetaPageOpaque *metaopaque;
+
+		metabuf = ReadBuffer(rel, ZS_META_BLK);
+		LockBuffer(metabuf, BUFFER_LOCK_SHARE);
+		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(BufferGetPage(metabuf));
+		memcpy(unused, metaopaque->zs_extents, sizeof(unused));
+		nblocks = RelationGetNumberOfBlocks(rel);
+		UnlockReleaseBuffer(metabuf);
+	}
+
+	bstrategy = GetAccessStrategy(BAS_BULKREAD);
+
+	memset(nulls, 0, sizeof(nulls));
+	for (blkno = 0; blkno <= nblocks; blkno++)
+	{
+		bool		modified = false;
+		XLogRecPtr	lsn = InvalidXLogRecPtr;
+
+		if (blkno < nblocks)
+		{
+			bool		reserved = false;
+
+			for (int i = 0; i < ZS_FPM_EXTENT_SLOTS + 1; i++)
+			{
+				if (blkno >= unused[i].next && blkno < unused[i].end)
+				{
+					/* never used, no need to read it */
+					reserved = true;
+					break;
+				}
+			}
+
+			if (!reserved)
+			{
+				Buffer		buf;
+
+				CHECK_FOR_INTERRUPTS();
+
+				buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, bstrategy);
+				lsn = BufferGetLSNAtomic(buf);
+				ReleaseBuffer(buf);
+
+				modified = (lsn > since_lsn);
+			}
+		}
+
+		if (modified)
+		{
+			if (runstart == InvalidBlockNumber)
+			{
+				runstart = blkno;
+				runmaxlsn = lsn;
+			}
+			else if (lsn > runmaxlsn)
+				runmaxlsn = lsn;
+		}
+		else if (runstart != InvalidBlockNumber)
+		{
+			values[0] = Int64GetDatum(runstart);
+			values[1] = Int64GetDatum(blkno - runstart);
+			values[2] = LSNGetDatum(runmaxlsn);
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+			runstart = InvalidBlockNumber;
+		}
+	}
+	tuplestore_donestoring(tupstore);
+
+	FreeAccessStrategy(bstrategy);
+	table_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Show the per-tree statistics stored by the last VACUUM or ANALYZE.
+ *
+ * Returns no rows if there are no statistics, or they were gathered by a
+ * server with a different stats page format.
+ */
+Datum
+pg_zs_tree_stats(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	Relation	rel;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	Tuplestorestate *tupstore;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	ZSRelStats *stats;
+	Datum		values[8];
+	bool		nulls[8];
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use zedstore inspection functions"))));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	rel = table_open(relid, AccessShareLock);
+
+	/*
+	 * Reject attempts to read non-local temporary relations; we would be
+	 * likely to get wrong data since we have no visibility into the owning
+	 * session's local buffers.
+	 */
+	if (RELATION_IS_OTHER_TEMP(rel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot access temporary tables of other sessions")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	stats = zsmeta_read_stats(rel);
+
+	memset(nulls, 0, sizeof(nulls));
+	for (int attno = 0; stats && attno < stats->nattributes; attno++)
+	{
+		ZSTreeStats *tree = &stats->trees[attno];
+
+		values[0] = Int16GetDatum(attno);
+		values[1] = Int64GetDatum(tree->zs_leaf_pages);
+		values[2] = Int64GetDatum(tree->zs_total_pages);
+		values[3] = Int64GetDatum(tree->zs_leaf_bytes);
+		values[4] = Int64GetDatum(tree->zs_leaf_raw_bytes);
+		values[5] = Int64GetDatum(tree->zs_leaf_tids);
+		values[6] = Int64GetDatum(tree->zs_leaf_tid_span);
+		values[7] = Float8GetDatum(stats->reltuples);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	tuplestore_donestoring(tupstore);
+
+	table_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Report the physical layout of each tree of a table, see
+ * zsbt_tree_fragmentation(). Unlike the other functions in this file, this
+ * only reads a sample of the leaf pages, with a bulk-read buffer ring, and
+ * requires only SELECT privilege on the table, so that it can be used to
+ * monitor production systems.
+ */
+Datum
+pg_zs_fragmentation(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	double		sample_fraction = PG_GETARG_FLOAT8(1);
+	Relation	rel;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	Tuplestorestate *tupstore;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	BufferAccessStrategy bstrategy;
+	AclResult	aclresult;
+	Datum		values[9];
+	bool		nulls[9];
+
+	if (sample_fraction <= 0 || sample_fraction > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("sample fraction must be between 0 and 1")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/*
+	 * The pg_zedstore_fragmentation view calls this for every zedstore table,
+	 * so don't complain if the table was dropped concurrently.
+	 */
+	rel = try_relation_open(relid, AccessShareLock);
+	if (rel == NULL)
+	{
+		tuplestore_donestoring(tupstore);
+		return (Datum) 0;
+	}
+
+	aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, get_relkind_objtype(rel->rd_rel->relkind),
+					   RelationGetRelationName(rel));
+
+	if (rel->rd_rel->relam != ZEDSTORE_TABLE_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a zedstore table",
+						RelationGetRelationName(rel))));
+
+	/*
+	 * Reject attempts to read non-local temporary relations; we would be
+	 * likely to get wrong data since we have no visibility into the owning
+	 * session's local buffers.
+	 */
+	if (RELATION_IS_OTHER_TEMP(rel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot access temporary tables of other sessions")));
+
+	bstrategy = GetAccessStrategy(BAS_BULKREAD);
+
+	for (AttrNumber attno = 0; attno <= RelationGetNumberOfAttributes(rel); attno++)
+	{
+		ZSTreeFragmentation frag;
+
+		if (attno > 0 && TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped)
+			continue;
+
+		zsbt_tree_fragmentation(rel, attno, sample_fraction, bstrategy, &frag);
+		if (frag.leaf_pages == 0)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = Int16GetDatum(attno);
+		values[1] = Int64GetDatum(frag.leaf_pages);
+		values[2] = Int64GetDatum(frag.leaf_runs);
+		values[3] = Float8GetDatum((double) frag.leaf_pages / frag.leaf_runs);
+		values[4] = Int64GetDatum(frag.sampled_pages);
+		if (frag.sampled_pages > 0)
+		{
+			values[5] = Float8GetDatum((double) frag.used_bytes /
+									   (frag.used_bytes + frag.free_bytes));
+			values[6] = Float8GetDatum((double) frag.free_bytes / frag.sampled_pages);
+		}
+		else
+		{
+			nulls[5] = true;
+			nulls[6] = true;
+		}
+		values[7] = Int64GetDatum(frag.compressed_bytes);
+		values[8] = Int64GetDatum(frag.uncompressed_bytes);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	tuplestore_donestoring(tupstore);
+
+	FreeAccessStrategy(bstrategy);
+	table_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
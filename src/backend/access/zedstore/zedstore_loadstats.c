@@ -0,0 +1,294 @@
+/*
+ * zedstore_loadstats.c
+ *		Collecting planner statistics during bulk loads
+ *
+ * After loading a table, you usually ANALYZE it, which reads a random
+ * sample of the rows back from the attribute trees. But when a table is
+ * created or truncated and then loaded in the same transaction, every row
+ * of it passes through the bulk insertion functions, so we might as well
+ * collect the sample while the rows go by. With zedstore_load_statistics
+ * enabled, we keep a reservoir sample of the loaded rows, and at the end of
+ * each bulk load (COPY, CREATE TABLE AS and the like) hand it over to the
+ * regular ANALYZE code. It computes the null fractions, distinct counts,
+ * most common values and histograms from it, and stores them in
+ * pg_statistic, where they become visible when the transaction commits.
+ *
+ * The sample only describes the table if it has seen every row in it. So we
+ * only start one when the table is empty, and throw it away if the table is
+ * modified in any other way: by a non-bulk insert, an update or a delete, or
+ * when the table is truncated or rewritten. We also give up on all samples
+ * if a subtransaction is rolled back, since some of the sampled rows might
+ * have been inserted in it.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zedstore/zedstore_loadstats.c
+ */
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/zedstore_internal.h"
+#include "access/zedstoream.h"
+#include "catalog/pg_class.h"
+#include "commands/vacuum.h"
+#include "executor/tuptable.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/sampling.h"
+
+/* GUC variable */
+bool		zedstore_load_statistics = false;
+
+typedef struct
+{
+	Oid			relid;			/* table's OID (hash key) */
+	RelFileNode	node;			/* relfilenode the sample was taken from */
+
+	int			targrows;		/* size of the reservoir */
+	int			numrows;		/* # rows now in the reservoir */
+	double		samplerows;		/* total # rows seen */
+	double		rowstoskip;		/* -1 means not set yet */
+	ReservoirStateData rstate;
+	HeapTuple  *rows;
+} ZSLoadSample;
+
+static MemoryContext loadstats_cxt = NULL;
+static HTAB *loadsamples = NULL;
+
+/* the table we last checked in zs_loadstats_begin(), and its sample */
+static Oid	loadstats_checked_relid = InvalidOid;
+static ZSLoadSample *loadstats_current = NULL;
+
+static ZSLoadSample *zs_loadstats_lookup(Relation rel);
+static void zs_loadstats_add_row(ZSLoadSample *sample, TupleTableSlot *slot);
+
+/*
+ * Start collecting a sample of the rows loaded into a table, if we should.
+ *
+ * Called before the TIDs for the new rows are allocated, like
+ * zsbt_tuplebuffer_begin_skip_wal().
+ */
+void
+zs_loadstats_begin(Relation rel)
+{
+	Oid			relid = RelationGetRelid(rel);
+	ZSLoadSample *sample;
+	TupleDesc	desc = RelationGetDescr(rel);
+	int			targrows;
+	bool		found;
+
+	if (!zedstore_load_statistics || relid == loadstats_checked_relid)
+		return;
+	loadstats_checked_relid = relid;
+	loadstats_current = NULL;
+
+	/* Continue a sample from a previous load in this transaction */
+	sample = zs_loadstats_lookup(rel);
+	if (sample)
+	{
+		loadstats_current = sample;
+		return;
+	}
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION &&
+		rel->rd_rel->relkind != RELKIND_MATVIEW)
+		return;
+	if (rel->rd_createSubid == InvalidSubTransactionId &&
+		rel->rd_newRelfilenodeSubid == InvalidSubTransactionId)
+		return;
+	if (RelationGetNumberOfBlocks(rel) > ZS_META_BLK + 1)
+		return;
+
+	/*
+	 * Size the reservoir like ANALYZE would, for the column with the highest
+	 * statistics target. See std_typanalyze().
+	 */
+	targrows = 100;
+	for (int i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+		int			target = attr->attstattarget;
+
+		if (attr->attisdropped)
+			continue;
+		if (target < 0)
+			target = default_statistics_target;
+		targrows = Max(targrows, 300 * target);
+	}
+
+	if (loadstats_cxt == NULL)
+	{
+		HASHCTL		ctl;
+
+		loadstats_cxt = AllocSetContextCreate(TopTransactionContext,
+											  "zedstore load statistics",
+											  ALLOCSET_DEFAULT_SIZES);
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(ZSLoadSample);
+		ctl.hcxt = loadstats_cxt;
+		loadsamples = hash_create("zedstore load samples", 16, &ctl,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	sample = hash_search(loadsamples, &relid, HASH_ENTER, &found);
+	Assert(!found);
+	sample->node = rel->rd_node;
+	sample->targrows = targrows;
+	sample->numrows = 0;
+	sample->samplerows = 0;
+	sample->rowstoskip = -1;
+	reservoir_init_selection_state(&sample->rstate, targrows);
+	sample->rows = MemoryContextAlloc(loadstats_cxt, targrows * sizeof(HeapTuple));
+
+	loadstats_current = sample;
+}
+
+/*
+ * Add newly loaded rows to the table's sample. The slots' tts_tid must be
+ * set already.
+ */
+void
+zs_loadstats_add(Relation rel, TupleTableSlot **slots, int ntuples)
+{
+	ZSLoadSample *sample = loadstats_current;
+	MemoryContext oldcontext;
+
+	if (RelationGetRelid(rel) != loadstats_checked_relid)
+	{
+		/*
+		 * zs_loadstats_begin() didn't look at this table, so these rows
+		 * would bypass its sample, if it has one. That makes it useless.
+		 */
+		zs_loadstats_forget(rel);
+		return;
+	}
+	if (sample == NULL)
+		return;
+
+	/* Has the table been rewritten under us? */
+	if (!RelFileNodeEquals(sample->node, rel->rd_node))
+	{
+		zs_loadstats_forget(rel);
+		return;
+	}
+
+	oldcontext = MemoryContextSwitchTo(loadstats_cxt);
+	for (int i = 0; i < ntuples; i++)
+		zs_loadstats_add_row(sample, slots[i]);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Add one row to a sample. This is the same algorithm that
+ * acquire_sample_rows() uses to pick the rows from the blocks it reads.
+ */
+static void
+zs_loadstats_add_row(ZSLoadSample *sample, TupleTableSlot *slot)
+{
+	HeapTuple  *rowp = NULL;
+
+	if (sample->numrows < sample->targrows)
+		rowp = &sample->rows[sample->numrows++];
+	else
+	{
+		if (sample->rowstoskip < 0)
+			sample->rowstoskip = reservoir_get_next_S(&sample->rstate,
+													  sample->samplerows,
+													  sample->targrows);
+		if (sample->rowstoskip <= 0)
+		{
+			/* Replace one old row at random */
+			int			k = (int) (sample->targrows * sampler_random_fract(sample->rstate.randstate));
+
+			Assert(k >= 0 && k < sample->targrows);
+			heap_freetuple(sample->rows[k]);
+			rowp = &sample->rows[k];
+		}
+		sample->rowstoskip -= 1;
+	}
+
+	if (rowp)
+	{
+		*rowp = ExecCopySlotHeapTuple(slot);
+		(*rowp)->t_self = slot->tts_tid;
+	}
+	sample->samplerows += 1;
+}
+
+/*
+ * At the end of a bulk load, compute statistics from the table's sample.
+ *
+ * The sample is kept, so that if more rows are loaded later in the same
+ * transaction, the statistics are computed again, from all of them.
+ */
+void
+zs_loadstats_finish(Relation rel)
+{
+	ZSLoadSample *sample = zs_loadstats_lookup(rel);
+
+	if (sample == NULL || sample->numrows == 0)
+		return;
+
+	if (!RelFileNodeEquals(sample->node, rel->rd_node))
+	{
+		zs_loadstats_forget(rel);
+		return;
+	}
+
+	analyze_rel_sample(rel, sample->rows, sample->numrows,
+					   sample->samplerows, DEBUG2);
+}
+
+/*
+ * Throw away the sample of a table, because it's been modified in a way
+ * that the sample doesn't reflect.
+ */
+void
+zs_loadstats_forget(Relation rel)
+{
+	Oid			relid = RelationGetRelid(rel);
+	ZSLoadSample *sample;
+
+	if (relid == loadstats_checked_relid)
+	{
+		loadstats_checked_relid = InvalidOid;
+		loadstats_current = NULL;
+	}
+
+	sample = zs_loadstats_lookup(rel);
+	if (sample == NULL)
+		return;
+
+	for (int i = 0; i < sample->numrows; i++)
+		heap_freetuple(sample->rows[i]);
+	pfree(sample->rows);
+	hash_search(loadsamples, &relid, HASH_REMOVE, NULL);
+}
+
+static ZSLoadSample *
+zs_loadstats_lookup(Relation rel)
+{
+	Oid			relid = RelationGetRelid(rel);
+
+	if (loadsamples == NULL)
+		return NULL;
+	return hash_search(loadsamples, &relid, HASH_FIND, NULL);
+}
+
+/*
+ * Forget all samples, at end of transaction or subtransaction abort.
+ */
+void
+AtEOXact_zedstore_loadstats(void)
+{
+	if (loadstats_cxt)
+		MemoryContextDelete(loadstats_cxt);
+	loadstats_cxt = NULL;
+	loadsamples = NULL;
+	loadstats_checked_relid = InvalidOid;
+	loadstats_current = NULL;
+}
@@ -0,0 +1,264 @@
+/*
+ * zedstore_logical.c
+ *		WAL-logging of row changes for logical decoding
+ *
+ * Zedstore's physical WAL records describe changes to the TID tree and the
+ * attribute trees separately, and the attribute data is usually written out
+ * from the tuple buffers long after the row was inserted, in a batch with
+ * other rows. A logical decoding plugin cannot reconstruct rows from those.
+ * So when the table is logically logged, we write an extra record for each
+ * insert, update and delete, with the rows in heap tuple format, like heap
+ * does. See wal_zedstore_logical_change for the format, and
+ * DecodeZedstoreOp() for the decoding side.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zedstore/zedstore_logical.c
+ */
+#include "postgres.h"
+
+#include "access/heapam_xlog.h"
+#include "access/heaptoast.h"
+#include "access/htup_details.h"
+#include "access/xloginsert.h"
+#include "access/zedstore_internal.h"
+#include "access/zedstore_wal.h"
+#include "catalog/catalog.h"
+#include "catalog/pg_class.h"
+#include "executor/tuptable.h"
+#include "lib/stringinfo.h"
+#include "nodes/bitmapset.h"
+#include "utils/datum.h"
+#include "utils/rel.h"
+
+static HeapTuple zs_logical_form_tuple(TupleDesc desc, Datum *values, bool *isnull);
+static HeapTuple zs_logical_old_key(Relation rel, TupleTableSlot *oldslot,
+									TupleTableSlot *newslot);
+static void zs_logical_append_tuple(StringInfo buf, HeapTuple tuple);
+static void zs_logical_insert_record(Relation rel, uint8 action, StringInfo data,
+									 int ntuples, bool has_old);
+
+/*
+ * Log the insertion of rows.
+ */
+void
+zs_logical_log_insert(Relation rel, TupleTableSlot **slots, int ntuples)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	StringInfoData data;
+	int			i;
+
+	if (!RelationIsLogicallyLogged(rel))
+		return;
+
+	initStringInfo(&data);
+	for (i = 0; i < ntuples; i++)
+	{
+		HeapTuple	tuple;
+
+		/* The ntuples field is a uint16, so split large batches */
+		if (i > 0 && i % PG_UINT16_MAX == 0)
+		{
+			zs_logical_insert_record(rel, ZSLOGICAL_INSERT, &data, PG_UINT16_MAX, false);
+			resetStringInfo(&data);
+		}
+
+		slot_getallattrs(slots[i]);
+		tuple = zs_logical_form_tuple(desc, slots[i]->tts_values, slots[i]->tts_isnull);
+		zs_logical_append_tuple(&data, tuple);
+		heap_freetuple(tuple);
+	}
+	if (ntuples > 0)
+		zs_logical_insert_record(rel, ZSLOGICAL_INSERT, &data,
+								 (ntuples - 1) % PG_UINT16_MAX + 1, false);
+	pfree(data.data);
+}
+
+/*
+ * Log an update of a row. 'oldslot' holds the old version of the row.
+ */
+void
+zs_logical_log_update(Relation rel, TupleTableSlot *oldslot, TupleTableSlot *newslot)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	StringInfoData data;
+	HeapTuple	newtuple;
+	HeapTuple	oldkey;
+
+	if (!RelationIsLogicallyLogged(rel))
+		return;
+
+	slot_getallattrs(oldslot);
+	slot_getallattrs(newslot);
+
+	initStringInfo(&data);
+	newtuple = zs_logical_form_tuple(desc, newslot->tts_values, newslot->tts_isnull);
+	zs_logical_append_tuple(&data, newtuple);
+	heap_freetuple(newtuple);
+
+	oldkey = zs_logical_old_key(rel, oldslot, newslot);
+	if (oldkey)
+	{
+		zs_logical_append_tuple(&data, oldkey);
+		heap_freetuple(oldkey);
+	}
+
+	zs_logical_insert_record(rel, ZSLOGICAL_UPDATE, &data, oldkey ? 2 : 1,
+							 oldkey != NULL);
+	pfree(data.data);
+}
+
+/*
+ * Log the deletion of a row. 'oldslot' holds the deleted row, or NULL if the
+ * table's replica identity is NOTHING.
+ */
+void
+zs_logical_log_delete(Relation rel, TupleTableSlot *oldslot)
+{
+	StringInfoData data;
+	HeapTuple	oldkey = NULL;
+
+	if (!RelationIsLogicallyLogged(rel))
+		return;
+
+	initStringInfo(&data);
+	if (oldslot)
+	{
+		slot_getallattrs(oldslot);
+		oldkey = zs_logical_old_key(rel, oldslot, NULL);
+	}
+	if (oldkey)
+	{
+		zs_logical_append_tuple(&data, oldkey);
+		heap_freetuple(oldkey);
+	}
+
+	zs_logical_insert_record(rel, ZSLOGICAL_DELETE, &data, oldkey ? 1 : 0,
+							 oldkey != NULL);
+	pfree(data.data);
+}
+
+/*
+ * Form a heap tuple to be included in the WAL record. Any toasted values are
+ * inlined: the decoding side only knows how to deal with values that are
+ * toasted in a heap TOAST table, when it has seen the changes to the TOAST
+ * table too.
+ */
+static HeapTuple
+zs_logical_form_tuple(TupleDesc desc, Datum *values, bool *isnull)
+{
+	HeapTuple	tuple;
+
+	tuple = heap_form_tuple(desc, values, isnull);
+	if (HeapTupleHasExternal(tuple))
+	{
+		HeapTuple	flattened = toast_flatten_tuple(tuple, desc);
+
+		heap_freetuple(tuple);
+		tuple = flattened;
+	}
+	return tuple;
+}
+
+/*
+ * Build the old key to log for an update or delete, like heap's
+ * ExtractReplicaIdentity(). For an update, 'newslot' is the new version of
+ * the row, and the key is only logged if some of its columns changed.
+ * Returns NULL if no old key needs to be logged.
+ */
+static HeapTuple
+zs_logical_old_key(Relation rel, TupleTableSlot *oldslot, TupleTableSlot *newslot)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	char		replident = rel->rd_rel->relreplident;
+	Bitmapset  *idattrs;
+	Datum	   *values;
+	bool	   *nulls;
+	bool		key_changed = (newslot == NULL);
+	HeapTuple	result;
+
+	if (replident == REPLICA_IDENTITY_NOTHING)
+		return NULL;
+
+	if (replident == REPLICA_IDENTITY_FULL)
+		return zs_logical_form_tuple(desc, oldslot->tts_values, oldslot->tts_isnull);
+
+	idattrs = RelationGetIndexAttrBitmap(rel, INDEX_ATTR_BITMAP_IDENTITY_KEY);
+	if (bms_is_empty(idattrs))
+		return NULL;
+
+	values = palloc(desc->natts * sizeof(Datum));
+	nulls = palloc(desc->natts * sizeof(bool));
+	for (int i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+
+		if (bms_is_member(i + 1 - FirstLowInvalidHeapAttributeNumber, idattrs))
+		{
+			values[i] = oldslot->tts_values[i];
+			nulls[i] = oldslot->tts_isnull[i];
+
+			if (!key_changed &&
+				(nulls[i] != newslot->tts_isnull[i] ||
+				 (!nulls[i] &&
+				  !datumIsEqual(values[i], newslot->tts_values[i],
+								attr->attbyval, attr->attlen))))
+				key_changed = true;
+		}
+		else
+		{
+			values[i] = (Datum) 0;
+			nulls[i] = true;
+		}
+	}
+
+	if (key_changed)
+		result = zs_logical_form_tuple(desc, values, nulls);
+	else
+		result = NULL;
+
+	pfree(values);
+	pfree(nulls);
+	bms_free(idattrs);
+
+	return result;
+}
+
+static void
+zs_logical_append_tuple(StringInfo buf, HeapTuple tuple)
+{
+	xl_heap_header xlhdr;
+	uint32		len;
+
+	xlhdr.t_infomask2 = tuple->t_data->t_infomask2;
+	xlhdr.t_infomask = tuple->t_data->t_infomask;
+	xlhdr.t_hoff = tuple->t_data->t_hoff;
+
+	len = SizeOfHeapHeader + tuple->t_len - SizeofHeapTupleHeader;
+	appendBinaryStringInfo(buf, (char *) &len, sizeof(uint32));
+	appendBinaryStringInfo(buf, (char *) &xlhdr, SizeOfHeapHeader);
+	appendBinaryStringInfo(buf, (char *) tuple->t_data + SizeofHeapTupleHeader,
+						   tuple->t_len - SizeofHeapTupleHeader);
+}
+
+static void
+zs_logical_insert_record(Relation rel, uint8 action, StringInfo data,
+						 int ntuples, bool has_old)
+{
+	wal_zedstore_logical_change xlrec;
+
+	xlrec.node = rel->rd_node;
+	xlrec.action = action;
+	xlrec.flags = has_old ? ZSLOGICAL_HAS_OLD : 0;
+	xlrec.ntuples = ntuples;
+
+	XLogBeginInsert();
+	XLogSetRecordFlags(XLOG_INCLUDE_ORIGIN);
+	XLogRegisterData((char *) &xlrec, SizeOfZSWalLogicalChange);
+	if (data->len > 0)
+		XLogRegisterData(data->data, data->len);
+
+	(void) XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_LOGICAL_CHANGE);
+}
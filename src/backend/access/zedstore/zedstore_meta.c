@@ -3,11 +3,10 @@
  *		Routines for handling ZedStore metapage
  *
  * The metapage holds a directory of B-tree root block numbers, one for each
- * column.
- *
- * TODO:
- * - extend the root block dir to an overflow page if there are too many
- *   attributes to fit on one page
+ * column, and the roots of columns that are being rewritten, see
+ * ZSPendingRewrite. If there are too many attributes for the directory to
+ * fit on the metapage, the rest of it is on a chain of overflow pages, see
+ * ZSMetaPageMaxRootDirItems.
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -18,23 +17,45 @@
 #include "postgres.h"
 
 #include "access/itup.h"
+#include "access/transam.h"
+#include "access/xact.h"
+#include "access/xloginsert.h"
 #include "access/xlogutils.h"
+#include "access/zedstoream.h"
 #include "access/zedstore_internal.h"
+#include "access/zedstore_metacache.h"
 #include "access/zedstore_wal.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
 #include "storage/lmgr.h"
+#include "storage/procarray.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 
-static void zsmeta_wal_log_metapage(Buffer buf, int natts);
+/* GUC variable */
+int			zedstore_debug_rootdir_items = 0;
+
+static void zsmeta_wal_log_metapage(Buffer buf, Buffer dirbuf, int natts);
+static void zsmeta_wal_log_new_att_root(Buffer dirbuf, Buffer rootbuf,
+										AttrNumber attno, int rewrite_slot,
+										TransactionId rewrite_xid);
+static void zsmeta_init_root_page(Page page, AttrNumber attno);
+static Buffer zsmeta_read_rootdir_page(Relation rel, BlockNumber blkno, int mode);
+static BlockNumber *zsmeta_rootdir_entry(Relation rel, Buffer metabuf, AttrNumber attno,
+										 int mode, Buffer *dirbuf);
+static bool zsmeta_rewrite_in_effect(ZSPendingRewrite *rw);
 
 static ZSMetaCacheData *
-zsmeta_populate_cache_from_metapage(Relation rel, Page page)
+zsmeta_populate_cache_from_metapage(Relation rel, Buffer metabuf)
 {
 	ZSMetaCacheData *cache;
+	Page		page = BufferGetPage(metabuf);
+	ZSMetaPageOpaque *opaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(page);
 	ZSMetaPage *metapg;
 	int			natts;
+	BlockNumber next;
 
 	if (rel->rd_amcache != NULL)
 	{
@@ -53,10 +74,39 @@ zsmeta_populate_cache_from_metapage(Relation rel, Page page)
 
 	for (int i = 0; i < natts; i++)
 	{
-		cache->cache_attrs[i].root = metapg->tree_root_dir[i].root;
+		if (i < opaque->zs_rootdir_nitems)
+			cache->cache_attrs[i].root = metapg->tree_root_dir[i].root;
+		else
+			cache->cache_attrs[i].root = InvalidBlockNumber;
 		cache->cache_attrs[i].rightmost = InvalidBlockNumber;
 	}
 
+	/* the rest of the root directory is on the overflow pages */
+	next = opaque->zs_rootdir_head;
+	while (next != InvalidBlockNumber)
+	{
+		Buffer		buf = zsmeta_read_rootdir_page(rel, next, BUFFER_LOCK_SHARE);
+		Page		dirpage = BufferGetPage(buf);
+		int			firstattno = ((ZSRootDirPageHeader *) PageGetContents(dirpage))->zs_firstattno;
+		ZSRootDirItem *items = ZSRootDirPageGetItems(dirpage);
+
+		for (int i = 0; i < ZSRootDirPageMaxItems && firstattno + i < natts; i++)
+			cache->cache_attrs[firstattno + i].root = items[i].root;
+
+		next = ((ZSRootDirPageOpaque *) PageGetSpecialPointer(dirpage))->zs_next;
+		UnlockReleaseBuffer(buf);
+	}
+
+	/* pending rewrites that are in effect for us override the directory */
+	for (int i = 0; i < ZS_MAX_PENDING_REWRITES; i++)
+	{
+		ZSPendingRewrite *rw = &opaque->zs_rewrites[i];
+
+		if (rw->attno != InvalidAttrNumber && rw->attno < natts &&
+			zsmeta_rewrite_in_effect(rw))
+			cache->cache_attrs[rw->attno].root = rw->root;
+	}
+
 	rel->rd_amcache = cache;
 	return cache;
 }
@@ -70,14 +120,27 @@ zsmeta_populate_cache(Relation rel)
 
 	RelationOpenSmgr(rel);
 
+	nblocks = RelationGetNumberOfBlocks(rel);
+	RelationSetTargetBlock(rel, nblocks);
+
+	/*
+	 * If our copy was built with an entry in the shared cache, and the root
+	 * directory hasn't changed since, we can keep it.
+	 */
+	cache = (ZSMetaCacheData *) rel->rd_amcache;
+	if (nblocks != 0 && cache != NULL && cache->cache_shared_version != 0 &&
+		zs_metacache_version(rel) == cache->cache_shared_version)
+	{
+		cache->cache_nblocks = nblocks;
+		return cache;
+	}
+
 	if (rel->rd_amcache != NULL)
 	{
 		pfree(rel->rd_amcache);
 		rel->rd_amcache = NULL;
 	}
 
-	nblocks = RelationGetNumberOfBlocks(rel);
-	RelationSetTargetBlock(rel, nblocks);
 	if (nblocks == 0)
 	{
 		cache =
@@ -86,61 +149,228 @@ zsmeta_populate_cache(Relation rel)
 		cache->cache_nattributes = 0;
 		rel->rd_amcache = cache;
 	}
+	else if ((cache = zs_metacache_load(rel)) != NULL)
+		rel->rd_amcache = cache;
 	else
 	{
 		metabuf = ReadBuffer(rel, ZS_META_BLK);
-		LockBuffer(metabuf, BUFFER_LOCK_SHARE);
-		cache = zsmeta_populate_cache_from_metapage(rel, BufferGetPage(metabuf));
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
+		cache = zsmeta_populate_cache_from_metapage(rel, metabuf);
+		zs_metacache_publish(rel, BufferGetPage(metabuf), cache);
 		UnlockReleaseBuffer(metabuf);
 	}
 
+	cache->cache_nblocks = nblocks;
+
 	return cache;
 }
 
+/*
+ * Re-check the cached metadata, after the smgr target block of the relation
+ * was invalidated.
+ *
+ * The cached blocks are checked with zsbt_page_is_expected() whenever
+ * they're used, so we don't need to throw them away, except for blocks past
+ * the end of the relation, if it has been truncated. Other backends
+ * extending the relation doesn't affect the cache at all.
+ */
+void
+zsmeta_revalidate_cache(Relation rel)
+{
+	ZSMetaCacheData *cache = (ZSMetaCacheData *) rel->rd_amcache;
+	BlockNumber nblocks;
+
+	RelationOpenSmgr(rel);
+
+	nblocks = RelationGetNumberOfBlocks(rel);
+	if (nblocks == 0 || cache->cache_nattributes == 0)
+	{
+		/* the table was truncated away, or it was empty and isn't anymore */
+		zsmeta_populate_cache(rel);
+		return;
+	}
+	RelationSetTargetBlock(rel, nblocks);
+
+	if (nblocks < cache->cache_nblocks)
+	{
+		for (int i = 0; i < cache->cache_nattributes; i++)
+		{
+			if (cache->cache_attrs[i].root >= nblocks)
+				cache->cache_attrs[i].root = InvalidBlockNumber;
+			if (cache->cache_attrs[i].rightmost >= nblocks)
+				cache->cache_attrs[i].rightmost = InvalidBlockNumber;
+			for (int j = 0; j < cache->cache_attrs[i].num_downlinks; j++)
+			{
+				if (cache->cache_attrs[i].downlinks[j].childblk >= nblocks)
+				{
+					cache->cache_attrs[i].num_downlinks = 0;
+					break;
+				}
+			}
+		}
+	}
+	cache->cache_nblocks = nblocks;
+}
+
+/*
+ * Initialize a root directory overflow page, with all the entries unused.
+ */
+static void
+zsmeta_init_rootdir_page(Page page, int firstattno, BlockNumber next)
+{
+	ZSRootDirPageHeader *hdr;
+	ZSRootDirPageOpaque *opaque;
+	ZSRootDirItem *items;
+
+	PageInit(page, BLCKSZ, sizeof(ZSRootDirPageOpaque));
+	opaque = (ZSRootDirPageOpaque *) PageGetSpecialPointer(page);
+	opaque->zs_next = next;
+	opaque->zs_flags = 0;
+	opaque->zs_page_id = ZS_ROOTDIR_PAGE_ID;
+
+	hdr = (ZSRootDirPageHeader *) PageGetContents(page);
+	hdr->zs_firstattno = firstattno;
+
+	items = ZSRootDirPageGetItems(page);
+	for (int i = 0; i < ZSRootDirPageMaxItems; i++)
+		items[i].root = InvalidBlockNumber;
+
+	((PageHeader) page)->pd_lower =
+		(char *) &items[ZSRootDirPageMaxItems] - (char *) page;
+}
+
+static Buffer
+zsmeta_read_rootdir_page(Relation rel, BlockNumber blkno, int mode)
+{
+	Buffer		buf;
+	Page		page;
+
+	buf = ReadBuffer(rel, blkno);
+	LockBuffer(buf, mode);
+	page = BufferGetPage(buf);
+	if (PageIsNew(page) ||
+		PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSRootDirPageOpaque)) ||
+		((ZSRootDirPageOpaque *) PageGetSpecialPointer(page))->zs_page_id != ZS_ROOTDIR_PAGE_ID)
+		elog(ERROR, "unexpected page %u in zedstore root directory chain of \"%s\"",
+			 blkno, RelationGetRelationName(rel));
+
+	return buf;
+}
+
+/*
+ * Return the number of root directory entries that the metapage and its
+ * overflow pages have room for. The caller must hold a lock on the metapage.
+ */
+static int
+zsmeta_rootdir_capacity(Relation rel, Buffer metabuf)
+{
+	ZSMetaPageOpaque *opaque =
+		(ZSMetaPageOpaque *) PageGetSpecialPointer(BufferGetPage(metabuf));
+	Buffer		buf;
+	int			capacity;
+
+	if (opaque->zs_rootdir_head == InvalidBlockNumber)
+		return opaque->zs_rootdir_nitems;
+
+	/* the head of the chain has the highest-numbered entries */
+	buf = zsmeta_read_rootdir_page(rel, opaque->zs_rootdir_head, BUFFER_LOCK_SHARE);
+	capacity = ((ZSRootDirPageHeader *) PageGetContents(BufferGetPage(buf)))->zs_firstattno +
+		ZSRootDirPageMaxItems;
+	UnlockReleaseBuffer(buf);
+
+	return capacity;
+}
+
 static void
 zsmeta_expand_metapage_for_new_attributes(Relation rel)
 {
 	int			natts = RelationGetNumberOfAttributes(rel) + 1;
 	Buffer		metabuf;
+	Buffer		newbuf = InvalidBuffer;
 	Page		page;
 	ZSMetaPage *metapg;
+	ZSMetaPageOpaque *opaque;
 
 	metabuf = ReadBuffer(rel, ZS_META_BLK);
 
-	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
-	page = BufferGetPage(metabuf);
-	metapg = (ZSMetaPage *) PageGetContents(page);
-
-	if (natts > metapg->nattributes)
+	for (;;)
 	{
-		int			new_pd_lower;
+		int			capacity;
+
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+		page = BufferGetPage(metabuf);
+		metapg = (ZSMetaPage *) PageGetContents(page);
+		opaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(page);
 
-		new_pd_lower = (char *) &metapg->tree_root_dir[natts] - (char *) page;
-		if (new_pd_lower > ((PageHeader) page)->pd_upper)
+		if (natts <= metapg->nattributes)
+			break;
+
+		capacity = zsmeta_rootdir_capacity(rel, metabuf);
+		if (natts <= capacity)
 		{
+			int			nmeta = Min(natts, opaque->zs_rootdir_nitems);
+
+			START_CRIT_SECTION();
+
 			/*
-			 * The root block directory must fit on the metapage.
-			 *
-			 * TODO: We could extend this by overflowing to another page.
+			 * Initialize the new attribute roots to InvalidBlockNumber. The
+			 * entries on the overflow pages were initialized already, when
+			 * the pages were added.
 			 */
-			elog(ERROR, "too many attributes for zedstore");
+			for (int i = metapg->nattributes; i < nmeta; i++)
+				metapg->tree_root_dir[i].root = InvalidBlockNumber;
+
+			metapg->nattributes = natts;
+			((PageHeader) page)->pd_lower =
+				(char *) &metapg->tree_root_dir[nmeta] - (char *) page;
+
+			MarkBufferDirty(metabuf);
+
+			if (zs_relation_needs_wal(rel))
+				zsmeta_wal_log_metapage(metabuf, InvalidBuffer, natts);
+
+			END_CRIT_SECTION();
+			zs_metacache_invalidate(rel);
+			break;
 		}
 
-		START_CRIT_SECTION();
+		if (!BufferIsValid(newbuf))
+		{
+			/*
+			 * Need another overflow page. Release the lock on the metapage
+			 * while we find a new block, like zsmeta_get_root_for_attribute()
+			 * does, and re-check after re-acquiring it.
+			 */
+			LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
+			newbuf = zspage_getnewbuf(rel, ZS_META_ATTRIBUTE_NUM);
+			continue;
+		}
 
-		/* Initialize the new attribute roots to InvalidBlockNumber */
-		for (int i = metapg->nattributes; i < natts; i++)
-			metapg->tree_root_dir[i].root = InvalidBlockNumber;
+		/* Add the new overflow page to the head of the chain */
+		START_CRIT_SECTION();
 
-		metapg->nattributes = natts;
-		((PageHeader) page)->pd_lower = new_pd_lower;
+		zsmeta_init_rootdir_page(BufferGetPage(newbuf), capacity,
+								 opaque->zs_rootdir_head);
+		opaque->zs_rootdir_head = BufferGetBlockNumber(newbuf);
 
+		MarkBufferDirty(newbuf);
 		MarkBufferDirty(metabuf);
 
-		if (RelationNeedsWAL(rel))
-			zsmeta_wal_log_metapage(metabuf, natts);
+		if (zs_relation_needs_wal(rel))
+			zsmeta_wal_log_metapage(metabuf, newbuf, metapg->nattributes);
 
 		END_CRIT_SECTION();
+
+		UnlockReleaseBuffer(newbuf);
+		newbuf = InvalidBuffer;
+		LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
+	}
+
+	/* Someone else added the overflow pages while we were allocating one */
+	if (BufferIsValid(newbuf))
+	{
+		zspage_delete_page(rel, newbuf, metabuf);
+		UnlockReleaseBuffer(newbuf);
 	}
 	UnlockReleaseBuffer(metabuf);
 
@@ -157,11 +387,9 @@ zsmeta_initmetapage_internal(int natts)
 	Page		page;
 	ZSMetaPageOpaque *opaque;
 	ZSMetaPage *metapg;
-	int			new_pd_lower;
 
 	/*
-	 * It's possible that we error out when building the metapage, if there
-	 * are too many attribute, so work on a temporary copy first, before actually
+	 * Build the metapage in a temporary copy first, before actually
 	 * allocating the buffer.
 	 */
 	page = palloc(BLCKSZ);
@@ -176,27 +404,42 @@ zsmeta_initmetapage_internal(int natts)
 	opaque->zs_undo_head = InvalidBlockNumber;
 	opaque->zs_undo_tail = InvalidBlockNumber;
 	opaque->zs_undo_tail_first_counter = 2;
+	for (int i = 0; i < ZS_UNDO_ACTIVE_PAGES; i++)
+		opaque->zs_undo_active[i] = InvalidBlockNumber;
 
 	opaque->zs_fpm_head = InvalidBlockNumber;
+	opaque->zs_undo_fpm_head = InvalidBlockNumber;
+	opaque->zs_stats_head = InvalidBlockNumber;
+	opaque->zs_rootdir_head = InvalidBlockNumber;
+	opaque->zs_rootdir_nitems = ZSMetaPageMaxRootDirItems;
+	if (zedstore_debug_rootdir_items > 0)
+		opaque->zs_rootdir_nitems = Min(opaque->zs_rootdir_nitems,
+										zedstore_debug_rootdir_items);
+	for (int i = 0; i < ZS_FPM_EXTENT_SLOTS + 1; i++)
+	{
+		opaque->zs_extents[i].next = InvalidBlockNumber;
+		opaque->zs_extents[i].end = InvalidBlockNumber;
+	}
+	for (int i = 0; i < ZS_MAX_PENDING_REWRITES; i++)
+	{
+		opaque->zs_rewrites[i].attno = InvalidAttrNumber;
+		opaque->zs_rewrites[i].root = InvalidBlockNumber;
+		opaque->zs_rewrites[i].xid = InvalidTransactionId;
+	}
 
 	metapg = (ZSMetaPage *) PageGetContents(page);
 
-	new_pd_lower = (char *) &metapg->tree_root_dir[natts] - (char *) page;
-	if (new_pd_lower > ((PageHeader) page)->pd_upper)
-	{
-		/*
-		 * The root block directory must fit on the metapage.
-		 *
-		 * TODO: We could extend this by overflowing to another page.
-		 */
-		elog(ERROR, "too many attributes for zedstore");
-	}
+	/*
+	 * If the root directory doesn't fit on the metapage, the caller adds
+	 * the overflow pages for the rest.
+	 */
+	natts = Min(natts, opaque->zs_rootdir_nitems);
 
 	metapg->nattributes = natts;
 	for (int i = 0; i < natts; i++)
 		metapg->tree_root_dir[i].root = InvalidBlockNumber;
 
-	((PageHeader) page)->pd_lower = new_pd_lower;
+	((PageHeader) page)->pd_lower = (char *) &metapg->tree_root_dir[natts] - (char *) page;
 	return page;
 }
 
@@ -209,12 +452,17 @@ zsmeta_initmetapage(Relation rel)
 	Buffer		buf;
 	Page		page;
 	int			natts = RelationGetNumberOfAttributes(rel) + 1;
+	int			nmeta;
+
+	/* forget any entry left behind by a dropped relation with this relfilenode */
+	zs_metacache_forget(&rel->rd_node);
 
 	/* Ok, write it out to disk */
 	buf = ReadBuffer(rel, P_NEW);
 	if (BufferGetBlockNumber(buf) != ZS_META_BLK)
 		elog(ERROR, "table is not empty");
 	page = zsmeta_initmetapage_internal(natts);
+	nmeta = ((ZSMetaPage *) PageGetContents(page))->nattributes;
 	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
 
 	START_CRIT_SECTION();
@@ -222,16 +470,23 @@ zsmeta_initmetapage(Relation rel)
 
 	MarkBufferDirty(buf);
 
-	if (RelationNeedsWAL(rel))
-		zsmeta_wal_log_metapage(buf, natts);
+	if (zs_relation_needs_wal(rel))
+		zsmeta_wal_log_metapage(buf, InvalidBuffer, nmeta);
 
 	END_CRIT_SECTION();
 
 	UnlockReleaseBuffer(buf);
+
+	if (natts > nmeta)
+		zsmeta_expand_metapage_for_new_attributes(rel);
 }
 
+/*
+ * WAL-log the metapage, and optionally a root directory overflow page that
+ * was modified together with it, as full-page images.
+ */
 static void
-zsmeta_wal_log_metapage(Buffer buf, int natts)
+zsmeta_wal_log_metapage(Buffer buf, Buffer dirbuf, int natts)
 {
 	Page		page = BufferGetPage(buf);
 	wal_zedstore_init_metapage init_rec;
@@ -242,33 +497,57 @@ zsmeta_wal_log_metapage(Buffer buf, int natts)
 	XLogBeginInsert();
 	XLogRegisterData((char *) &init_rec, SizeOfZSWalInitMetapage);
 	XLogRegisterBuffer(0, buf, REGBUF_FORCE_IMAGE | REGBUF_STANDARD);
+	if (BufferIsValid(dirbuf))
+		XLogRegisterBuffer(1, dirbuf, REGBUF_FORCE_IMAGE | REGBUF_STANDARD);
 
 	recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_INIT_METAPAGE);
 
 	PageSetLSN(page, recptr);
+	if (BufferIsValid(dirbuf))
+		PageSetLSN(BufferGetPage(dirbuf), recptr);
 }
 
 static void
-zsmeta_wal_log_new_att_root(Buffer metabuf, Buffer rootbuf, AttrNumber attno)
+zsmeta_wal_log_new_att_root(Buffer dirbuf, Buffer rootbuf, AttrNumber attno,
+							int rewrite_slot, TransactionId rewrite_xid)
 {
-	Page		metapage = BufferGetPage(metabuf);
+	Page		dirpage = BufferGetPage(dirbuf);
 	Page		rootpage = BufferGetPage(rootbuf);
 	wal_zedstore_btree_new_root xlrec;
 	XLogRecPtr recptr;
 
 	xlrec.attno = attno;
+	xlrec.rewrite_slot = rewrite_slot;
+	xlrec.rewrite_xid = rewrite_xid;
 
 	XLogBeginInsert();
 	XLogRegisterData((char *) &xlrec, SizeOfZSWalBtreeNewRoot);
-	XLogRegisterBuffer(0, metabuf, REGBUF_STANDARD);
+	XLogRegisterBuffer(0, dirbuf, REGBUF_STANDARD);
 	XLogRegisterBuffer(1, rootbuf, REGBUF_WILL_INIT | REGBUF_STANDARD);
 
 	recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_BTREE_NEW_ROOT);
 
-	PageSetLSN(metapage, recptr);
+	PageSetLSN(dirpage, recptr);
 	PageSetLSN(rootpage, recptr);
 }
 
+/* Initialize a page to look like an empty root leaf */
+static void
+zsmeta_init_root_page(Page page, AttrNumber attno)
+{
+	ZSBtreePageOpaque *opaque;
+
+	PageInit(page, BLCKSZ, sizeof(ZSBtreePageOpaque));
+	opaque = ZSBtreePageGetOpaque(page);
+	opaque->zs_attno = attno;
+	opaque->zs_next = InvalidBlockNumber;
+	opaque->zs_lokey = MinZSTid;
+	opaque->zs_hikey = MaxPlusOneZSTid;
+	opaque->zs_level = 0;
+	opaque->zs_flags = ZSBT_ROOT;
+	opaque->zs_page_id = ZS_BTREE_PAGE_ID;
+}
+
 void
 zsmeta_initmetapage_redo(XLogReaderState *record)
 {
@@ -283,6 +562,13 @@ zsmeta_initmetapage_redo(XLogReaderState *record)
 
 	Assert(BufferGetBlockNumber(buf) == ZS_META_BLK);
 	UnlockReleaseBuffer(buf);
+
+	if (XLogRecHasBlockRef(record, 1))
+	{
+		if (XLogReadBufferForRedo(record, 1, &buf) != BLK_RESTORED)
+			elog(ERROR, "zedstore metapage init WAL record did not contain a full-page image");
+		UnlockReleaseBuffer(buf);
+	}
 }
 
 void
@@ -292,50 +578,86 @@ zsmeta_new_btree_root_redo(XLogReaderState *record)
 	wal_zedstore_btree_new_root *xlrec =
 		(wal_zedstore_btree_new_root *) XLogRecGetData(record);
 	AttrNumber	attno = xlrec->attno;
-	Buffer		metabuf;
+	Buffer		dirbuf;
 	Buffer		rootbuf;
 	Page		rootpage;
 	BlockNumber	rootblk;
-	ZSBtreePageOpaque *opaque;
 
 	rootbuf = XLogInitBufferForRedo(record, 1);
 	rootpage = (Page) BufferGetPage(rootbuf);
 	rootblk = BufferGetBlockNumber(rootbuf);
-	/* initialize the page to look like a root leaf */
-	rootpage = BufferGetPage(rootbuf);
-	PageInit(rootpage, BLCKSZ, sizeof(ZSBtreePageOpaque));
-	opaque = ZSBtreePageGetOpaque(rootpage);
-	opaque->zs_attno = attno;
-	opaque->zs_next = InvalidBlockNumber;
-	opaque->zs_lokey = MinZSTid;
-	opaque->zs_hikey = MaxPlusOneZSTid;
-	opaque->zs_level = 0;
-	opaque->zs_flags = ZSBT_ROOT;
-	opaque->zs_page_id = ZS_BTREE_PAGE_ID;
+	zsmeta_init_root_page(rootpage, attno);
 
 	PageSetLSN(rootpage, lsn);
 	MarkBufferDirty(rootbuf);
 
-	/* Update the metapage to point to it */
-	if (XLogReadBufferForRedo(record, 0, &metabuf) == BLK_NEEDS_REDO)
+	/* Update the root directory to point to it */
+	if (XLogReadBufferForRedo(record, 0, &dirbuf) == BLK_NEEDS_REDO)
 	{
-		Page		metapage = (Page) BufferGetPage(metabuf);
-		ZSMetaPage *metapg = (ZSMetaPage *) PageGetContents(metapage);
+		Page		dirpage = (Page) BufferGetPage(dirbuf);
 
-		Assert(BufferGetBlockNumber(metabuf) == ZS_META_BLK);
-		Assert(metapg->tree_root_dir[attno].root == InvalidBlockNumber);
+		if (xlrec->rewrite_slot != -1)
+		{
+			ZSMetaPageOpaque *metaopaque =
+				(ZSMetaPageOpaque *) PageGetSpecialPointer(dirpage);
+			ZSPendingRewrite *rw = &metaopaque->zs_rewrites[xlrec->rewrite_slot];
+
+			Assert(BufferGetBlockNumber(dirbuf) == ZS_META_BLK);
+			Assert(rw->attno == InvalidAttrNumber);
+			rw->attno = attno;
+			rw->root = rootblk;
+			rw->xid = xlrec->rewrite_xid;
+		}
+		else if (BufferGetBlockNumber(dirbuf) == ZS_META_BLK)
+		{
+			ZSMetaPage *metapg = (ZSMetaPage *) PageGetContents(dirpage);
 
-		metapg->tree_root_dir[attno].root = rootblk;
+			Assert(metapg->tree_root_dir[attno].root == InvalidBlockNumber);
+			metapg->tree_root_dir[attno].root = rootblk;
+		}
+		else
+		{
+			/* the entry is on a root directory overflow page */
+			int			firstattno = ((ZSRootDirPageHeader *) PageGetContents(dirpage))->zs_firstattno;
+			ZSRootDirItem *item = &ZSRootDirPageGetItems(dirpage)[attno - firstattno];
 
-		PageSetLSN(metapage, lsn);
-		MarkBufferDirty(metabuf);
+			Assert(item->root == InvalidBlockNumber);
+			item->root = rootblk;
+		}
+
+		PageSetLSN(dirpage, lsn);
+		MarkBufferDirty(dirbuf);
 	}
 
-	if (BufferIsValid(metabuf))
-		UnlockReleaseBuffer(metabuf);
+	if (BufferIsValid(dirbuf))
+		UnlockReleaseBuffer(dirbuf);
 	UnlockReleaseBuffer(rootbuf);
 }
 
+/*
+ * Read the root of attribute 'attno', as seen by the current transaction,
+ * from the metapage, bypassing the cache.
+ */
+static BlockNumber
+zsmeta_read_root(Relation rel, AttrNumber attno)
+{
+	Buffer		metabuf;
+	Buffer		dirbuf;
+	BlockNumber rootblk = InvalidBlockNumber;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
+	if (attno < ((ZSMetaPage *) PageGetContents(BufferGetPage(metabuf)))->nattributes)
+	{
+		rootblk = *zsmeta_root_location(rel, metabuf, attno, BUFFER_LOCK_SHARE, &dirbuf);
+		if (dirbuf != metabuf)
+			UnlockReleaseBuffer(dirbuf);
+	}
+	UnlockReleaseBuffer(metabuf);
+
+	return rootblk;
+}
+
 /*
  * Get the block number of the b-tree root for given attribute.
  *
@@ -347,7 +669,6 @@ BlockNumber
 zsmeta_get_root_for_attribute(Relation rel, AttrNumber attno, bool readonly)
 {
 	Buffer		metabuf;
-	ZSMetaPage *metapg;
 	BlockNumber	rootblk;
 	ZSMetaCacheData *metacache;
 
@@ -404,42 +725,40 @@ zsmeta_get_root_for_attribute(Relation rel, AttrNumber attno, bool readonly)
 
 	/*
 	 * Don't believe a cached result that says that the root is empty.
-	 * It's possible that it was created after we populated the cache. If the
+	 * It's possible that it was created after we populated the cache, or
+	 * that we forgot the cached root because it was out of date. If the
 	 * root block number is out-of-date, that's OK because the caller will
 	 * detect that case, but if the tree is missing altogether, the caller
 	 * will have nothing to detect and will incorrectly return an empty result.
-	 *
-	 * XXX: It's a inefficient to repopulate the cache here, if we just
-	 * did so in the zsmeta_get_cache() call above already.
+	 * Re-read just this attribute's root, the rest of the cache is fine.
 	 */
-	if (readonly && rootblk == InvalidBlockNumber)
+	if (rootblk == InvalidBlockNumber)
 	{
-		zsmeta_invalidate_cache(rel);
-		metacache = zsmeta_get_cache(rel);
-		rootblk = metacache->cache_attrs[attno].root;
+		rootblk = zsmeta_read_root(rel, attno);
+		metacache->cache_attrs[attno].root = rootblk;
 	}
 
 	if (!readonly && rootblk == InvalidBlockNumber)
 	{
 		/* try to allocate one */
-		Page		page;
+		Buffer		dirbuf;
+		BlockNumber *rootloc;
 
 		metabuf = ReadBuffer(rel, ZS_META_BLK);
 
-		LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
-		page = BufferGetPage(metabuf);
-		metapg = (ZSMetaPage *) PageGetContents(page);
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
 
 		/*
 		 * Re-check that the root is still invalid, now that we have the
 		 * metapage locked.
 		 */
-		rootblk = metapg->tree_root_dir[attno].root;
+		rootloc = zsmeta_root_location(rel, metabuf, attno, BUFFER_LOCK_SHARE, &dirbuf);
+		rootblk = *rootloc;
+		if (dirbuf != metabuf)
+			UnlockReleaseBuffer(dirbuf);
 		if (rootblk == InvalidBlockNumber)
 		{
 			Buffer		rootbuf;
-			Page		rootpage;
-			ZSBtreePageOpaque *opaque;
 
 			/*
 			 * Release the lock on the metapage while we find a new block, because
@@ -449,11 +768,11 @@ zsmeta_get_root_for_attribute(Relation rel, AttrNumber attno, bool readonly)
 			LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
 
 			/* TODO: release lock on metapage while we do I/O */
-			rootbuf = zspage_getnewbuf(rel);
+			rootbuf = zspage_getnewbuf(rel, attno);
 
-			LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
-			metapg = (ZSMetaPage *) PageGetContents(page);
-			rootblk = metapg->tree_root_dir[attno].root;
+			LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+			rootloc = zsmeta_root_location(rel, metabuf, attno, BUFFER_LOCK_EXCLUSIVE, &dirbuf);
+			rootblk = *rootloc;
 			if (rootblk != InvalidBlockNumber)
 			{
 				/*
@@ -469,29 +788,24 @@ zsmeta_get_root_for_attribute(Relation rel, AttrNumber attno, bool readonly)
 
 				START_CRIT_SECTION();
 
-				metapg->tree_root_dir[attno].root = rootblk;
+				/* a pending rewrite always has a root, so this is the old tree */
+				*rootloc = rootblk;
 
-				/* initialize the page to look like a root leaf */
-				rootpage = BufferGetPage(rootbuf);
-				PageInit(rootpage, BLCKSZ, sizeof(ZSBtreePageOpaque));
-				opaque = ZSBtreePageGetOpaque(rootpage);
-				opaque->zs_attno = attno;
-				opaque->zs_next = InvalidBlockNumber;
-				opaque->zs_lokey = MinZSTid;
-				opaque->zs_hikey = MaxPlusOneZSTid;
-				opaque->zs_level = 0;
-				opaque->zs_flags = ZSBT_ROOT;
-				opaque->zs_page_id = ZS_BTREE_PAGE_ID;
+				zsmeta_init_root_page(BufferGetPage(rootbuf), attno);
 
 				MarkBufferDirty(rootbuf);
-				MarkBufferDirty(metabuf);
+				MarkBufferDirty(dirbuf);
 
-				if (RelationNeedsWAL(rel))
-					zsmeta_wal_log_new_att_root(metabuf, rootbuf, attno);
+				if (zs_relation_needs_wal(rel))
+					zsmeta_wal_log_new_att_root(dirbuf, rootbuf, attno,
+												-1, InvalidTransactionId);
 
 				END_CRIT_SECTION();
+				zs_metacache_invalidate(rel);
 			}
 
+			if (dirbuf != metabuf)
+				UnlockReleaseBuffer(dirbuf);
 			UnlockReleaseBuffer(rootbuf);
 		}
 		UnlockReleaseBuffer(metabuf);
@@ -501,3 +815,739 @@ zsmeta_get_root_for_attribute(Relation rel, AttrNumber attno, bool readonly)
 
 	return rootblk;
 }
+
+/*
+ * Detach the B-tree of attribute 'attno' from the metapage. Returns the old
+ * root block, or InvalidBlockNumber if the attribute had no tree.
+ *
+ * This is used by VACUUM, to discard the trees of dropped columns. The
+ * caller is responsible for recycling the pages of the old tree.
+ */
+BlockNumber
+zsmeta_detach_root_for_attribute(Relation rel, AttrNumber attno)
+{
+	Buffer		metabuf;
+	Buffer		dirbuf = InvalidBuffer;
+	Page		page;
+	ZSMetaPage *metapg;
+	BlockNumber *rootloc = NULL;
+	BlockNumber rootblk = InvalidBlockNumber;
+
+	if (RelationGetNumberOfBlocks(rel) == 0)
+		return InvalidBlockNumber;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+	page = BufferGetPage(metabuf);
+	metapg = (ZSMetaPage *) PageGetContents(page);
+
+	if (attno < metapg->nattributes)
+	{
+		rootloc = zsmeta_rootdir_entry(rel, metabuf, attno, BUFFER_LOCK_EXCLUSIVE, &dirbuf);
+		rootblk = *rootloc;
+	}
+
+	if (rootblk != InvalidBlockNumber)
+	{
+		START_CRIT_SECTION();
+
+		*rootloc = InvalidBlockNumber;
+
+		MarkBufferDirty(dirbuf);
+
+		/* this is rare, so just WAL-log the whole page */
+		if (zs_relation_needs_wal(rel))
+		{
+			if (dirbuf == metabuf)
+				zsmeta_wal_log_metapage(metabuf, InvalidBuffer, metapg->nattributes);
+			else
+				log_newpage_buffer(dirbuf, true);
+		}
+
+		END_CRIT_SECTION();
+		zs_metacache_invalidate(rel);
+	}
+	if (BufferIsValid(dirbuf) && dirbuf != metabuf)
+		UnlockReleaseBuffer(dirbuf);
+	UnlockReleaseBuffer(metabuf);
+
+	zsmeta_invalidate_cache(rel);
+
+	return rootblk;
+}
+
+/*
+ * Is the new tree of a pending column rewrite in effect for us? It is if the
+ * rewrite was done by our own transaction, or by one that has committed.
+ */
+static bool
+zsmeta_rewrite_in_effect(ZSPendingRewrite *rw)
+{
+	if (TransactionIdIsCurrentTransactionId(rw->xid))
+		return true;
+	if (TransactionIdIsInProgress(rw->xid))
+		return false;
+	return TransactionIdDidCommit(rw->xid);
+}
+
+/*
+ * Return a pointer to the root directory entry of attribute 'attno'.
+ *
+ * The caller must hold a lock on the metapage. If the entry is on an
+ * overflow page, that page is locked in 'mode' and returned in *dirbuf, for
+ * the caller to release. Otherwise, *dirbuf is set to 'metabuf'.
+ */
+static BlockNumber *
+zsmeta_rootdir_entry(Relation rel, Buffer metabuf, AttrNumber attno,
+					 int mode, Buffer *dirbuf)
+{
+	Page		metapage = BufferGetPage(metabuf);
+	ZSMetaPage *metapg = (ZSMetaPage *) PageGetContents(metapage);
+	ZSMetaPageOpaque *opaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+	BlockNumber next;
+
+	Assert(attno < metapg->nattributes);
+
+	if (attno < opaque->zs_rootdir_nitems)
+	{
+		*dirbuf = metabuf;
+		return &metapg->tree_root_dir[attno].root;
+	}
+
+	next = opaque->zs_rootdir_head;
+	while (next != InvalidBlockNumber)
+	{
+		Buffer		buf = zsmeta_read_rootdir_page(rel, next, mode);
+		Page		page = BufferGetPage(buf);
+		int			firstattno = ((ZSRootDirPageHeader *) PageGetContents(page))->zs_firstattno;
+
+		if (attno >= firstattno)
+		{
+			Assert(attno < firstattno + ZSRootDirPageMaxItems);
+			*dirbuf = buf;
+			return &ZSRootDirPageGetItems(page)[attno - firstattno].root;
+		}
+		next = ((ZSRootDirPageOpaque *) PageGetSpecialPointer(page))->zs_next;
+		UnlockReleaseBuffer(buf);
+	}
+
+	elog(ERROR, "root directory entry for attribute %d of \"%s\" is missing",
+		 attno, RelationGetRelationName(rel));
+	return NULL;				/* keep compiler quiet */
+}
+
+/*
+ * Return a pointer to the field that holds the root block of the tree of
+ * attribute 'attno', as seen by the current transaction. That's the root of
+ * a pending rewrite of the attribute on the metapage if it's in effect, and
+ * the attribute's entry in the root directory otherwise. 'mode' and *dirbuf
+ * are as with zsmeta_rootdir_entry().
+ */
+BlockNumber *
+zsmeta_root_location(Relation rel, Buffer metabuf, AttrNumber attno,
+					 int mode, Buffer *dirbuf)
+{
+	ZSMetaPageOpaque *opaque =
+		(ZSMetaPageOpaque *) PageGetSpecialPointer(BufferGetPage(metabuf));
+
+	if (attno != ZS_META_ATTRIBUTE_NUM)
+	{
+		for (int i = 0; i < ZS_MAX_PENDING_REWRITES; i++)
+		{
+			ZSPendingRewrite *rw = &opaque->zs_rewrites[i];
+
+			if (rw->attno == attno)
+			{
+				if (zsmeta_rewrite_in_effect(rw))
+				{
+					*dirbuf = metabuf;
+					return &rw->root;
+				}
+				break;
+			}
+		}
+	}
+
+	return zsmeta_rootdir_entry(rel, metabuf, attno, mode, dirbuf);
+}
+
+/*
+ * Can the given attributes be rewritten with zsmeta_begin_rewrite()? There
+ * must be a free slot for each of them, and none of them can have a pending
+ * rewrite already. The caller should've folded finished rewrites with
+ * zsbt_fold_rewrites() first, so a pending rewrite means that the attribute
+ * was already rewritten in this transaction.
+ */
+bool
+zsmeta_can_begin_rewrite(Relation rel, int nattrs, AttrNumber *attnums)
+{
+	Buffer		metabuf;
+	ZSMetaPageOpaque *opaque;
+	int			nfree = 0;
+	bool		result = true;
+
+	/* an empty table is cheap to rewrite as a whole */
+	if (RelationGetNumberOfBlocks(rel) == 0)
+		return false;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
+	opaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(BufferGetPage(metabuf));
+
+	for (int i = 0; i < ZS_MAX_PENDING_REWRITES; i++)
+	{
+		ZSPendingRewrite *rw = &opaque->zs_rewrites[i];
+
+		if (rw->attno == InvalidAttrNumber)
+		{
+			nfree++;
+			continue;
+		}
+		for (int j = 0; j < nattrs; j++)
+		{
+			if (attnums[j] == rw->attno)
+				result = false;
+		}
+	}
+	if (nfree < nattrs)
+		result = false;
+
+	UnlockReleaseBuffer(metabuf);
+
+	return result;
+}
+
+/*
+ * Start rewriting attribute 'attno' into a new, empty B-tree, as part of the
+ * current transaction. The caller has checked with zsmeta_can_begin_rewrite()
+ * that this is possible, and holds an AccessExclusiveLock on the table.
+ *
+ * From now on, the current transaction sees the new tree, and inserts to it.
+ */
+void
+zsmeta_begin_rewrite(Relation rel, AttrNumber attno)
+{
+	TransactionId xid = GetCurrentTransactionId();
+	Buffer		metabuf;
+	Buffer		rootbuf;
+	Page		page;
+	ZSMetaPage *metapg;
+	ZSMetaPageOpaque *opaque;
+	ZSPendingRewrite *rw = NULL;
+	int			slot;
+
+	Assert(attno >= 1);
+
+	if (attno >= zsmeta_get_cache(rel)->cache_nattributes)
+		zsmeta_expand_metapage_for_new_attributes(rel);
+
+	/* Find a new block first, see zsmeta_get_root_for_attribute() */
+	rootbuf = zspage_getnewbuf(rel, attno);
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+	page = BufferGetPage(metabuf);
+	metapg = (ZSMetaPage *) PageGetContents(page);
+	opaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(page);
+
+	if (attno >= metapg->nattributes)
+		elog(ERROR, "invalid attribute number %d (table \"%s\" has only %d attributes)",
+			 attno, RelationGetRelationName(rel), metapg->nattributes);
+
+	for (slot = 0; slot < ZS_MAX_PENDING_REWRITES; slot++)
+	{
+		if (opaque->zs_rewrites[slot].attno == InvalidAttrNumber)
+		{
+			rw = &opaque->zs_rewrites[slot];
+			break;
+		}
+	}
+	if (rw == NULL)
+		elog(ERROR, "no free slot for rewriting attribute %d of \"%s\"",
+			 attno, RelationGetRelationName(rel));
+
+	START_CRIT_SECTION();
+
+	rw->attno = attno;
+	rw->root = BufferGetBlockNumber(rootbuf);
+	rw->xid = xid;
+
+	zsmeta_init_root_page(BufferGetPage(rootbuf), attno);
+
+	MarkBufferDirty(rootbuf);
+	MarkBufferDirty(metabuf);
+
+	if (zs_relation_needs_wal(rel))
+		zsmeta_wal_log_new_att_root(metabuf, rootbuf, attno, slot, xid);
+
+	END_CRIT_SECTION();
+	zs_metacache_invalidate(rel);
+
+	UnlockReleaseBuffer(rootbuf);
+	UnlockReleaseBuffer(metabuf);
+
+	zsmeta_invalidate_cache(rel);
+}
+
+/*
+ * Fold a finished column rewrite into the root directory. If the rewriting
+ * transaction committed, its tree replaces the old one, otherwise the new
+ * tree is discarded.
+ *
+ * Returns false if there are no finished rewrites. Otherwise, returns the
+ * attribute in *attno, and the root of the tree that is no longer needed in
+ * *oldroot, for the caller to recycle. *oldroot can be InvalidBlockNumber, if
+ * the attribute had no tree before the rewrite.
+ */
+bool
+zsmeta_fold_rewrite(Relation rel, AttrNumber *attno, BlockNumber *oldroot)
+{
+	Buffer		metabuf;
+	Buffer		dirbuf;
+	Page		page;
+	ZSMetaPage *metapg;
+	ZSMetaPageOpaque *opaque;
+	bool		found = false;
+
+	if (RelationGetNumberOfBlocks(rel) == 0)
+		return false;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+	page = BufferGetPage(metabuf);
+	metapg = (ZSMetaPage *) PageGetContents(page);
+	opaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(page);
+
+	for (int i = 0; i < ZS_MAX_PENDING_REWRITES; i++)
+	{
+		ZSPendingRewrite *rw = &opaque->zs_rewrites[i];
+		bool		committed;
+		BlockNumber *rootloc;
+
+		if (rw->attno == InvalidAttrNumber)
+			continue;
+		if (TransactionIdIsCurrentTransactionId(rw->xid) ||
+			TransactionIdIsInProgress(rw->xid))
+			continue;
+		committed = TransactionIdDidCommit(rw->xid);
+
+		rootloc = zsmeta_rootdir_entry(rel, metabuf, rw->attno,
+									   BUFFER_LOCK_EXCLUSIVE, &dirbuf);
+
+		START_CRIT_SECTION();
+
+		*attno = rw->attno;
+		if (committed)
+		{
+			*oldroot = *rootloc;
+			*rootloc = rw->root;
+			MarkBufferDirty(dirbuf);
+		}
+		else
+			*oldroot = rw->root;
+
+		rw->attno = InvalidAttrNumber;
+		rw->root = InvalidBlockNumber;
+		rw->xid = InvalidTransactionId;
+
+		MarkBufferDirty(metabuf);
+
+		/* this is rare, so just WAL-log the whole metapage */
+		if (zs_relation_needs_wal(rel))
+			zsmeta_wal_log_metapage(metabuf,
+									(committed && dirbuf != metabuf) ? dirbuf : InvalidBuffer,
+									metapg->nattributes);
+
+		END_CRIT_SECTION();
+		zs_metacache_invalidate(rel);
+
+		if (dirbuf != metabuf)
+			UnlockReleaseBuffer(dirbuf);
+
+		found = true;
+		break;
+	}
+	UnlockReleaseBuffer(metabuf);
+
+	if (found)
+		zsmeta_invalidate_cache(rel);
+
+	return found;
+}
+
+/*
+ * Initialize a stats page, with the given entries.
+ */
+static void
+zsmeta_init_stats_page(Page page, int firstattno, int nattributes, ZSTreeStats *entries,
+					   BlockNumber relpages, double reltuples, BlockNumber next)
+{
+	ZSStatsPageHeader *hdr;
+	ZSStatsPageOpaque *opaque;
+
+	PageInit(page, BLCKSZ, sizeof(ZSStatsPageOpaque));
+	opaque = (ZSStatsPageOpaque *) PageGetSpecialPointer(page);
+	opaque->zs_next = next;
+	opaque->zs_flags = 0;
+	opaque->zs_page_id = ZS_STATS_PAGE_ID;
+
+	hdr = (ZSStatsPageHeader *) PageGetContents(page);
+	hdr->zs_firstattno = firstattno;
+	hdr->zs_nattributes = nattributes;
+	hdr->zs_relpages = relpages;
+	hdr->zs_format = ZS_STATS_FORMAT;
+	hdr->zs_reltuples = reltuples;
+	if (nattributes > 0)
+		memcpy(ZSStatsPageGetItems(page), entries, nattributes * sizeof(ZSTreeStats));
+
+	((PageHeader) page)->pd_lower =
+		(char *) &ZSStatsPageGetItems(page)[nattributes] - (char *) page;
+}
+
+static bool
+zsmeta_is_stats_page(Page page)
+{
+	if (PageIsNew(page) ||
+		PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSStatsPageOpaque)))
+		return false;
+
+	return ((ZSStatsPageOpaque *) PageGetSpecialPointer(page))->zs_page_id == ZS_STATS_PAGE_ID;
+}
+
+static BlockNumber
+zsmeta_get_stats_head(Relation rel)
+{
+	Buffer		metabuf;
+	BlockNumber head;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
+	head = ((ZSMetaPageOpaque *) PageGetSpecialPointer(BufferGetPage(metabuf)))->zs_stats_head;
+	UnlockReleaseBuffer(metabuf);
+
+	return head;
+}
+
+/*
+ * Gather size statistics of all the trees, and store them on the stats
+ * pages, for zsmeta_read_stats().
+ *
+ * This is called by VACUUM and ANALYZE, with the number of live rows they
+ * counted or estimated. Those hold a ShareUpdateExclusiveLock, so there is
+ * only one of us running at a time. The stats pages are rewritten as a whole,
+ * and WAL-logged as full-page images; it's only a few pages, even for wide
+ * tables. The bloom filters of the columns that have them are rebuilt here
+ * too, see zedstore_bloom.c, and so are the summaries stored on the root
+ * pages of the attribute trees, see zsbt_attr_summarize().
+ */
+void
+zsmeta_update_stats(Relation rel, double reltuples, BufferAccessStrategy strategy)
+{
+	int			natts = RelationGetNumberOfAttributes(rel) + 1;
+	ZSTreeStats *entries;
+	int			npages;
+	BlockNumber *blocks;
+	int			nexisting = 0;
+	BlockNumber next;
+	BlockNumber tail;
+	BlockNumber relpages;
+	ZSRelStats *oldstats;
+
+	if (RelationGetNumberOfBlocks(rel) == 0)
+		return;
+
+	entries = palloc0(natts * sizeof(ZSTreeStats));
+	zsbt_gather_tree_stats(rel, ZS_META_ATTRIBUTE_NUM, &entries[0], strategy);
+	entries[0].zs_bloom_head = InvalidBlockNumber;
+	for (AttrNumber attno = 1; attno < natts; attno++)
+	{
+		if (!TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped)
+		{
+			zsbt_gather_tree_stats(rel, attno, &entries[attno], strategy);
+			zsbt_attr_summarize(rel, attno);
+		}
+		entries[attno].zs_bloom_head = InvalidBlockNumber;
+	}
+
+	/*
+	 * Rebuild the bloom filters. The old chains are freed once the new
+	 * stats pages no longer point to them.
+	 */
+	oldstats = zsmeta_read_stats(rel);
+	for (AttrNumber attno = 1; attno < natts; attno++)
+	{
+		BlockNumber oldhead = InvalidBlockNumber;
+
+		if (oldstats && attno < oldstats->nattributes)
+			oldhead = oldstats->trees[attno].zs_bloom_head;
+
+		if (!TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped &&
+			zsbloom_attr_enabled(rel, attno))
+			entries[attno].zs_bloom_head = zsbloom_build(rel, attno, oldhead, strategy);
+	}
+
+	/* Collect the existing stats pages, and allocate more if needed */
+	npages = (natts + ZSStatsPageMaxItems - 1) / ZSStatsPageMaxItems;
+	blocks = palloc(npages * sizeof(BlockNumber));
+	next = zsmeta_get_stats_head(rel);
+	while (next != InvalidBlockNumber && nexisting < npages)
+	{
+		Buffer		buf;
+		Page		page;
+
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, next, RBM_NORMAL, strategy);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		if (!zsmeta_is_stats_page(page))
+			elog(ERROR, "unexpected page %u in zedstore stats chain", next);
+		blocks[nexisting++] = next;
+		next = ((ZSStatsPageOpaque *) PageGetSpecialPointer(page))->zs_next;
+		UnlockReleaseBuffer(buf);
+	}
+	tail = next;
+	for (int i = nexisting; i < npages; i++)
+	{
+		Buffer		buf;
+
+		buf = zspage_getnewbuf(rel, ZS_META_ATTRIBUTE_NUM);
+
+		START_CRIT_SECTION();
+		zsmeta_init_stats_page(BufferGetPage(buf), 0, 0, NULL, 0, 0,
+							   InvalidBlockNumber);
+		MarkBufferDirty(buf);
+		if (zs_relation_needs_wal(rel))
+			log_newpage_buffer(buf, true);
+		END_CRIT_SECTION();
+
+		blocks[i] = BufferGetBlockNumber(buf);
+		UnlockReleaseBuffer(buf);
+	}
+
+	/* Fill in the stats pages */
+	relpages = RelationGetNumberOfBlocks(rel);
+	for (int i = 0; i < npages; i++)
+	{
+		Buffer		buf;
+		int			firstattno = i * ZSStatsPageMaxItems;
+		int			n = Min(natts - firstattno, ZSStatsPageMaxItems);
+
+		/* keep any surplus pages linked after the last one */
+		next = (i < npages - 1) ? blocks[i + 1] : tail;
+
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blocks[i], RBM_NORMAL, strategy);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+
+		START_CRIT_SECTION();
+		zsmeta_init_stats_page(BufferGetPage(buf), firstattno, n, &entries[firstattno],
+							   relpages, reltuples, next);
+		MarkBufferDirty(buf);
+		if (zs_relation_needs_wal(rel))
+			log_newpage_buffer(buf, true);
+		END_CRIT_SECTION();
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	/* Link the chain to the metapage, if it's new */
+	if (nexisting == 0)
+	{
+		Buffer		metabuf;
+		Page		metapage;
+		ZSMetaPageOpaque *metaopaque;
+
+		metabuf = ReadBuffer(rel, ZS_META_BLK);
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+		metapage = BufferGetPage(metabuf);
+		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+
+		START_CRIT_SECTION();
+
+		metaopaque->zs_stats_head = blocks[0];
+		MarkBufferDirty(metabuf);
+
+		/* this is rare, so just WAL-log the whole metapage */
+		if (zs_relation_needs_wal(rel))
+			zsmeta_wal_log_metapage(metabuf, InvalidBuffer,
+									((ZSMetaPage *) PageGetContents(metapage))->nattributes);
+
+		END_CRIT_SECTION();
+
+		UnlockReleaseBuffer(metabuf);
+	}
+
+	if (oldstats)
+	{
+		for (AttrNumber attno = 1; attno < oldstats->nattributes; attno++)
+		{
+			if (oldstats->trees[attno].zs_bloom_head != InvalidBlockNumber)
+				zsbloom_free_chain(rel, attno, oldstats->trees[attno].zs_bloom_head);
+		}
+		pfree(oldstats);
+	}
+
+	pfree(blocks);
+	pfree(entries);
+
+	/* make other backends re-read the statistics for planning */
+	CacheInvalidateRelcache(rel);
+}
+
+/*
+ * Read the statistics gathered by zsmeta_update_stats(). Returns NULL if
+ * there are none.
+ */
+ZSRelStats *
+zsmeta_read_stats(Relation rel)
+{
+	ZSRelStats *stats = NULL;
+	BlockNumber next;
+
+	if (RelationGetNumberOfBlocks(rel) == 0)
+		return NULL;
+
+	next = zsmeta_get_stats_head(rel);
+	while (next != InvalidBlockNumber)
+	{
+		Buffer		buf;
+		Page		page;
+		ZSStatsPageHeader *hdr;
+
+		buf = ReadBuffer(rel, next);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		if (!zsmeta_is_stats_page(page))
+			elog(ERROR, "unexpected page %u in zedstore stats chain", next);
+		hdr = (ZSStatsPageHeader *) PageGetContents(page);
+
+		if (hdr->zs_format != ZS_STATS_FORMAT)
+		{
+			UnlockReleaseBuffer(buf);
+			break;
+		}
+
+		if (hdr->zs_nattributes > 0)
+		{
+			int			natts = hdr->zs_firstattno + hdr->zs_nattributes;
+
+			/* the entries on the pages must be consecutive */
+			if (hdr->zs_firstattno != (stats ? stats->nattributes : 0))
+			{
+				UnlockReleaseBuffer(buf);
+				break;
+			}
+
+			if (stats == NULL)
+			{
+				stats = palloc0(offsetof(ZSRelStats, trees[natts]));
+				stats->relpages = hdr->zs_relpages;
+				stats->reltuples = hdr->zs_reltuples;
+			}
+			else
+				stats = repalloc(stats, offsetof(ZSRelStats, trees[natts]));
+
+			memcpy(&stats->trees[hdr->zs_firstattno], ZSStatsPageGetItems(page),
+				   hdr->zs_nattributes * sizeof(ZSTreeStats));
+			stats->nattributes = natts;
+		}
+
+		next = ((ZSStatsPageOpaque *) PageGetSpecialPointer(page))->zs_next;
+		UnlockReleaseBuffer(buf);
+	}
+
+	return stats;
+}
+
+/*
+ * Backend-local cache of the statistics, for the planner.
+ *
+ * Reading the stats pages takes a metapage lock and a few page reads, and
+ * the planner needs them every time it plans a query on the table. They
+ * only change when VACUUM or ANALYZE gathers new ones, and
+ * zsmeta_update_stats() sends a relcache invalidation when that happens,
+ * so keep a copy until the next relcache invalidation of the relation.
+ * Entries are keyed by relation OID, and also hold NULL, if the relation
+ * has no statistics.
+ *
+ * This must not be used for anything that follows the block numbers in the
+ * stats, like the heads of the bloom chains; those might be out of date.
+ */
+typedef struct ZSStatsCacheEntry
+{
+	Oid			relid;			/* hash key */
+	ZSRelStats *stats;			/* in CacheMemoryContext, or NULL */
+} ZSStatsCacheEntry;
+
+static HTAB *zs_stats_cache = NULL;
+
+static void
+zsmeta_stats_cache_callback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	ZSStatsCacheEntry *entry;
+
+	if (OidIsValid(relid))
+	{
+		entry = hash_search(zs_stats_cache, &relid, HASH_FIND, NULL);
+		if (entry)
+		{
+			if (entry->stats)
+				pfree(entry->stats);
+			(void) hash_search(zs_stats_cache, &relid, HASH_REMOVE, NULL);
+		}
+		return;
+	}
+
+	hash_seq_init(&status, zs_stats_cache);
+	while ((entry = (ZSStatsCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->stats)
+			pfree(entry->stats);
+		(void) hash_search(zs_stats_cache, &entry->relid, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Like zsmeta_read_stats(), but returns the cached copy, if we have one.
+ * The result must not be modified or freed; it's valid until the next
+ * relcache invalidation.
+ */
+const ZSRelStats *
+zsmeta_get_cached_stats(Relation rel)
+{
+	Oid			relid = RelationGetRelid(rel);
+	ZSStatsCacheEntry *entry;
+	ZSRelStats *stats;
+	bool		found;
+
+	if (zs_stats_cache == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(ZSStatsCacheEntry);
+		zs_stats_cache = hash_create("zedstore stats cache", 64, &ctl,
+									 HASH_ELEM | HASH_BLOBS);
+		CacheRegisterRelcacheCallback(zsmeta_stats_cache_callback, (Datum) 0);
+	}
+
+	entry = hash_search(zs_stats_cache, &relid, HASH_FIND, NULL);
+	if (entry)
+		return entry->stats;
+
+	/* read them, and copy them to the cache */
+	stats = zsmeta_read_stats(rel);
+	entry = hash_search(zs_stats_cache, &relid, HASH_ENTER, &found);
+	if (stats)
+	{
+		Size		size = offsetof(ZSRelStats, trees[stats->nattributes]);
+
+		entry->stats = MemoryContextAlloc(CacheMemoryContext, size);
+		memcpy(entry->stats, stats, size);
+		pfree(stats);
+	}
+	else
+		entry->stats = NULL;
+
+	return entry->stats;
+}
@@ -0,0 +1,431 @@
+/*
+ * zedstore_metacache.c
+ *		Shared cache of the root directories of zedstore tables
+ *
+ * Each backend keeps a copy of the root block numbers of the trees, read from
+ * the metapage, in ZSMetaCacheData. The copy is thrown away whenever the
+ * relation's smgr target block is invalidated, and rebuilding it means
+ * share-locking the metapage. With many backends inserting into the same
+ * table, that makes the metapage a hot spot. This cache keeps a copy of the
+ * root directory in shared memory, along with the rightmost leaf of each tree,
+ * so that backends can rebuild their private copies without touching the
+ * metapage.
+ *
+ * Each entry has a version number, which changes whenever the root directory
+ * on the metapage changes. A backend remembers the version that its private
+ * copy was built with, and as long as the entry still has that version, it
+ * keeps using its private copy when the target block is invalidated, along
+ * with the rightmost leaves and downlinks it has cached since. The versions
+ * come from a global counter, so an entry that is evicted and created again
+ * never repeats a version.
+ *
+ * The entries are kept consistent with the metapage by the metapage lock. An
+ * entry is only filled in while holding a lock on the metapage, from what's
+ * on it, and everything that changes the root directory invalidates the
+ * entry before releasing its exclusive lock on the metapage. So a valid entry
+ * always matches the metapage. The rightmost leaves are just hints, like in
+ * the private copies, and are updated without changing the version.
+ *
+ * Only tables with at most ZS_METACACHE_MAX_ATTS attributes, and no pending
+ * column rewrites, are cached; the roots seen with a pending rewrite depend
+ * on the transaction. Temporary relations are not cached, and the cache is
+ * not used during recovery, where WAL replay changes the metapages behind
+ * our back.
+ *
+ * Entries are keyed by relfilenode. A relfilenode can be reused after the
+ * relation is dropped, so the entry is forgotten when a metapage is
+ * initialized, or a relation is copied to a new relfilenode, and the entries
+ * of a database are forgotten when the database is dropped or moved to
+ * another tablespace, like its buffers.
+ *
+ * Locking: the mapping lock protects the hash table, the tags of the slots,
+ * and the victim hand. Each slot has its own lock that protects its
+ * contents. To use a slot, acquire the mapping lock in shared mode, look up
+ * the slot, lock the slot, and release the mapping lock. To evict a slot, the
+ * mapping lock is held in exclusive mode while the slot is locked. Victims are
+ * chosen round-robin; an evicted table is simply read from its metapage
+ * again.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zedstore/zedstore_metacache.c
+ */
+#include "postgres.h"
+
+#include "access/xlog.h"
+#include "access/zedstore_internal.h"
+#include "access/zedstore_metacache.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#define ZS_METACACHE_ENTRIES	256
+#define ZS_METACACHE_MAX_ATTS	128
+
+/* hash table entry */
+typedef struct ZSMetaCacheEnt
+{
+	RelFileNode rnode;
+	int			slotno;
+} ZSMetaCacheEnt;
+
+typedef struct ZSMetaCacheSlotAttr
+{
+	BlockNumber root;
+	BlockNumber rightmost;
+	zstid		rightmost_lokey;
+} ZSMetaCacheSlotAttr;
+
+typedef struct ZSMetaCacheSlot
+{
+	/* protected by the mapping lock */
+	RelFileNode rnode;
+	bool		inuse;			/* is 'rnode' in the hash table? */
+
+	/* protected by the slot lock */
+	LWLock		lock;
+	uint64		version;
+	bool		valid;			/* do 'attrs' match the metapage? */
+	int			nattributes;
+	ZSMetaCacheSlotAttr attrs[ZS_METACACHE_MAX_ATTS];
+} ZSMetaCacheSlot;
+
+typedef struct ZSMetaCacheCtl
+{
+	LWLock		mapping_lock;
+	int			victim;			/* protected by mapping_lock */
+
+	pg_atomic_uint64 next_version;
+
+	ZSMetaCacheSlot slots[ZS_METACACHE_ENTRIES];
+} ZSMetaCacheCtl;
+
+static ZSMetaCacheCtl *ZSMetaCache = NULL;
+static HTAB *ZSMetaCacheHash = NULL;
+
+/*
+ * Report shared-memory space needed by ZSMetaCacheShmemInit
+ */
+Size
+ZSMetaCacheShmemSize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(ZSMetaCacheCtl));
+	size = add_size(size, hash_estimate_size(ZS_METACACHE_ENTRIES,
+											 sizeof(ZSMetaCacheEnt)));
+
+	return size;
+}
+
+/*
+ * Allocate and initialize the cache in shared memory
+ */
+void
+ZSMetaCacheShmemInit(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	ZSMetaCache = (ZSMetaCacheCtl *)
+		ShmemInitStruct("Zedstore Metapage Cache", sizeof(ZSMetaCacheCtl), &found);
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(RelFileNode);
+	info.entrysize = sizeof(ZSMetaCacheEnt);
+	ZSMetaCacheHash = ShmemInitHash("Zedstore Metapage Cache Hash",
+									ZS_METACACHE_ENTRIES, ZS_METACACHE_ENTRIES,
+									&info,
+									HASH_ELEM | HASH_BLOBS);
+
+	if (!found)
+	{
+		LWLockInitialize(&ZSMetaCache->mapping_lock, LWTRANCHE_ZEDSTORE_METACACHE);
+		ZSMetaCache->victim = 0;
+		pg_atomic_init_u64(&ZSMetaCache->next_version, 1);
+		for (int i = 0; i < ZS_METACACHE_ENTRIES; i++)
+		{
+			ZSMetaCacheSlot *slot = &ZSMetaCache->slots[i];
+
+			slot->inuse = false;
+			slot->version = 0;
+			slot->valid = false;
+			slot->nattributes = 0;
+			LWLockInitialize(&slot->lock, LWTRANCHE_ZEDSTORE_METACACHE);
+		}
+	}
+}
+
+static bool
+zs_metacache_enabled(Relation rel)
+{
+	return ZSMetaCache != NULL && !RelationUsesLocalBuffers(rel) &&
+		!RecoveryInProgress();
+}
+
+/*
+ * Look up the slot of a relation, and lock it in 'mode'. Returns NULL if the
+ * relation has no slot.
+ */
+static ZSMetaCacheSlot *
+zs_metacache_lookup(const RelFileNode *rnode, LWLockMode mode)
+{
+	ZSMetaCacheEnt *ent;
+	ZSMetaCacheSlot *slot = NULL;
+
+	LWLockAcquire(&ZSMetaCache->mapping_lock, LW_SHARED);
+	ent = (ZSMetaCacheEnt *) hash_search(ZSMetaCacheHash, rnode, HASH_FIND, NULL);
+	if (ent)
+	{
+		slot = &ZSMetaCache->slots[ent->slotno];
+		LWLockAcquire(&slot->lock, mode);
+	}
+	LWLockRelease(&ZSMetaCache->mapping_lock);
+
+	return slot;
+}
+
+/*
+ * Like zs_metacache_lookup(), but creates a slot for the relation if it
+ * doesn't have one, evicting another relation. The slot is locked in
+ * exclusive mode.
+ */
+static ZSMetaCacheSlot *
+zs_metacache_lookup_or_create(const RelFileNode *rnode)
+{
+	ZSMetaCacheEnt *ent;
+	ZSMetaCacheSlot *slot;
+	bool		found;
+
+	slot = zs_metacache_lookup(rnode, LW_EXCLUSIVE);
+	if (slot)
+		return slot;
+
+	LWLockAcquire(&ZSMetaCache->mapping_lock, LW_EXCLUSIVE);
+	ent = (ZSMetaCacheEnt *) hash_search(ZSMetaCacheHash, rnode, HASH_FIND, NULL);
+	if (ent)
+	{
+		/* someone else created it while we weren't holding the lock */
+		slot = &ZSMetaCache->slots[ent->slotno];
+		LWLockAcquire(&slot->lock, LW_EXCLUSIVE);
+		LWLockRelease(&ZSMetaCache->mapping_lock);
+		return slot;
+	}
+
+	slot = &ZSMetaCache->slots[ZSMetaCache->victim];
+	LWLockAcquire(&slot->lock, LW_EXCLUSIVE);
+	if (slot->inuse)
+		hash_search(ZSMetaCacheHash, &slot->rnode, HASH_REMOVE, NULL);
+	ent = (ZSMetaCacheEnt *) hash_search(ZSMetaCacheHash, rnode, HASH_ENTER, &found);
+	Assert(!found);
+	ent->slotno = ZSMetaCache->victim;
+	slot->rnode = *rnode;
+	slot->inuse = true;
+	slot->valid = false;
+	slot->version = pg_atomic_fetch_add_u64(&ZSMetaCache->next_version, 1);
+
+	ZSMetaCache->victim = (ZSMetaCache->victim + 1) % ZS_METACACHE_ENTRIES;
+	LWLockRelease(&ZSMetaCache->mapping_lock);
+
+	return slot;
+}
+
+/*
+ * Return the version of the relation's entry, or 0 if it has no valid entry.
+ */
+uint64
+zs_metacache_version(Relation rel)
+{
+	ZSMetaCacheSlot *slot;
+	uint64		version = 0;
+
+	if (!zs_metacache_enabled(rel))
+		return 0;
+
+	slot = zs_metacache_lookup(&rel->rd_node, LW_SHARED);
+	if (slot)
+	{
+		if (slot->valid)
+			version = slot->version;
+		LWLockRelease(&slot->lock);
+	}
+	return version;
+}
+
+/*
+ * Build a private metapage cache for the relation from its shared entry.
+ * Returns NULL if there is no valid entry, and the caller has to read the
+ * metapage.
+ */
+ZSMetaCacheData *
+zs_metacache_load(Relation rel)
+{
+	ZSMetaCacheSlot *slot;
+	ZSMetaCacheData *cache = NULL;
+
+	if (!zs_metacache_enabled(rel))
+		return NULL;
+
+	slot = zs_metacache_lookup(&rel->rd_node, LW_SHARED);
+	if (slot == NULL)
+		return NULL;
+
+	if (slot->valid)
+	{
+		int			natts = slot->nattributes;
+
+		cache = MemoryContextAllocZero(CacheMemoryContext,
+									   offsetof(ZSMetaCacheData, cache_attrs[natts]));
+		cache->cache_nattributes = natts;
+		cache->cache_shared_version = slot->version;
+		for (int i = 0; i < natts; i++)
+		{
+			cache->cache_attrs[i].root = slot->attrs[i].root;
+			cache->cache_attrs[i].rightmost = slot->attrs[i].rightmost;
+			cache->cache_attrs[i].rightmost_lokey = slot->attrs[i].rightmost_lokey;
+		}
+	}
+	LWLockRelease(&slot->lock);
+
+	return cache;
+}
+
+/*
+ * Store the roots in a private metapage cache, just built from the metapage,
+ * in the shared cache. The caller must still hold a lock on the metapage.
+ */
+void
+zs_metacache_publish(Relation rel, Page metapage, ZSMetaCacheData *cache)
+{
+	ZSMetaPageOpaque *opaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+	ZSMetaCacheSlot *slot;
+	int			natts = cache->cache_nattributes;
+
+	if (!zs_metacache_enabled(rel) || natts > ZS_METACACHE_MAX_ATTS ||
+		PageIsNew(metapage))
+		return;
+	for (int i = 0; i < ZS_MAX_PENDING_REWRITES; i++)
+	{
+		if (opaque->zs_rewrites[i].attno != InvalidAttrNumber)
+			return;
+	}
+
+	slot = zs_metacache_lookup_or_create(&rel->rd_node);
+
+	slot->version = pg_atomic_fetch_add_u64(&ZSMetaCache->next_version, 1);
+	slot->valid = true;
+	slot->nattributes = natts;
+	for (int i = 0; i < natts; i++)
+	{
+		slot->attrs[i].root = cache->cache_attrs[i].root;
+		slot->attrs[i].rightmost = InvalidBlockNumber;
+		slot->attrs[i].rightmost_lokey = InvalidZSTid;
+	}
+	cache->cache_shared_version = slot->version;
+
+	LWLockRelease(&slot->lock);
+}
+
+/*
+ * Invalidate the relation's entry, after changing its root directory. The
+ * caller must still hold the exclusive lock on the metapage, or an
+ * AccessExclusiveLock on the relation.
+ */
+void
+zs_metacache_invalidate(Relation rel)
+{
+	ZSMetaCacheSlot *slot;
+
+	if (!zs_metacache_enabled(rel))
+		return;
+
+	slot = zs_metacache_lookup(&rel->rd_node, LW_EXCLUSIVE);
+	if (slot)
+	{
+		slot->version = pg_atomic_fetch_add_u64(&ZSMetaCache->next_version, 1);
+		slot->valid = false;
+		LWLockRelease(&slot->lock);
+	}
+}
+
+/*
+ * Remember the rightmost leaf of a tree in the relation's entry, if it has
+ * one. This is only a hint, so the version isn't changed.
+ */
+void
+zs_metacache_set_rightmost(Relation rel, AttrNumber attno, BlockNumber blkno,
+						   zstid lokey)
+{
+	ZSMetaCacheSlot *slot;
+
+	if (!zs_metacache_enabled(rel))
+		return;
+
+	slot = zs_metacache_lookup(&rel->rd_node, LW_EXCLUSIVE);
+	if (slot)
+	{
+		if (slot->valid && attno < slot->nattributes)
+		{
+			slot->attrs[attno].rightmost = blkno;
+			slot->attrs[attno].rightmost_lokey = lokey;
+		}
+		LWLockRelease(&slot->lock);
+	}
+}
+
+/*
+ * Forget the entry of a relfilenode, whose contents are about to be replaced.
+ */
+void
+zs_metacache_forget(const RelFileNode *rnode)
+{
+	ZSMetaCacheEnt *ent;
+
+	if (ZSMetaCache == NULL)
+		return;
+
+	LWLockAcquire(&ZSMetaCache->mapping_lock, LW_EXCLUSIVE);
+	ent = (ZSMetaCacheEnt *) hash_search(ZSMetaCacheHash, rnode, HASH_REMOVE, NULL);
+	if (ent)
+	{
+		ZSMetaCacheSlot *slot = &ZSMetaCache->slots[ent->slotno];
+
+		LWLockAcquire(&slot->lock, LW_EXCLUSIVE);
+		slot->inuse = false;
+		slot->valid = false;
+		LWLockRelease(&slot->lock);
+	}
+	LWLockRelease(&ZSMetaCache->mapping_lock);
+}
+
+/*
+ * Forget the entries of all relations in a database, like
+ * DropDatabaseBuffers() does for buffers.
+ */
+void
+zs_metacache_forget_database(Oid dbid)
+{
+	if (ZSMetaCache == NULL)
+		return;
+
+	LWLockAcquire(&ZSMetaCache->mapping_lock, LW_EXCLUSIVE);
+	for (int i = 0; i < ZS_METACACHE_ENTRIES; i++)
+	{
+		ZSMetaCacheSlot *slot = &ZSMetaCache->slots[i];
+
+		if (!slot->inuse || slot->rnode.dbNode != dbid)
+			continue;
+
+		hash_search(ZSMetaCacheHash, &slot->rnode, HASH_REMOVE, NULL);
+		LWLockAcquire(&slot->lock, LW_EXCLUSIVE);
+		slot->inuse = false;
+		slot->valid = false;
+		LWLockRelease(&slot->lock);
+	}
+	LWLockRelease(&ZSMetaCache->mapping_lock);
+}
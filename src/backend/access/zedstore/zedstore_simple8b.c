@@ -4,7 +4,7 @@
  *
  * FIXME: This is copy-pasted from src/backend/lib/integerset.c. Some of
  * the things we do here are not relevant for the use in zedstore, or could
- * be optimized. For example, EMPTY_CODEWORD is not used.
+ * be optimized.
  *
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
@@ -17,33 +17,6 @@
 
 #include "access/zedstore_simple8b.h"
 
-/*
- * Decode an array of Simple-8b codewords, known to contain 'num_integers'
- * integers.
- */
-void
-simple8b_decode_words(uint64 *codewords, int num_codewords,
-					  uint64 *dst, int num_integers)
-{
-	int			total_decoded = 0;
-
-	/* decode all the codewords */
-	for (int i = 0; i < num_codewords; i++)
-	{
-		int			num_decoded;
-
-		num_decoded = simple8b_decode(codewords[i], &dst[total_decoded]);
-		total_decoded += num_decoded;
-	}
-	/*
-	 * XXX: This error message is a bit specific, but it matches how this
-	 * function is actually used, i.e. to encode TIDs, and the number of integers
-	 * comes from the item header.
-	 */
-	if (total_decoded != num_integers)
-		elog(ERROR, "number of TIDs in codewords did not match the item header");
-}
-
 /*
  * Simple-8b encoding.
  *
@@ -117,19 +90,227 @@ static const struct simple8b_mode
 };
 
 /*
- * Maximum number of integers that can be encoded in a single Simple-8b
- * codeword.
+ * Mask of the 60 payload bits of a codeword, i.e. all but the selector.
+ */
+#define SIMPLE8B_PAYLOAD_MASK	UINT64CONST(0x0FFFFFFFFFFFFFFF)
+
+/*
+ * Number of integers encoded in a codeword.
+ */
+static inline int
+simple8b_num_ints(uint64 codeword)
+{
+	if (codeword == EMPTY_CODEWORD)
+		return 0;
+	return simple8b_modes[codeword >> 60].num_ints;
+}
+
+/*
+ * Decode 'nints' deltas of 'bits' bits each from 'codeword', adding each to
+ * the running sum 'val', and store the sums in 'dst'. Returns the final sum.
+ *
+ * This is always inlined with constant 'bits' and 'nints', so that the
+ * compiler can fully unroll the loop.
+ */
+static pg_attribute_always_inline uint64
+simple8b_decode_sum(uint64 codeword, int bits, int nints, uint64 val, uint64 *dst)
+{
+	uint64		mask = (UINT64CONST(1) << bits) - 1;
+
+	for (int i = 0; i < nints; i++)
+	{
+		val += codeword & mask;
+		dst[i] = val;
+		codeword >>= bits;
+	}
+	return val;
+}
+
+/*
+ * Decode an array of Simple-8b codewords, known to contain 'num_integers'
+ * integers.
+ */
+void
+simple8b_decode_words(uint64 *codewords, int num_codewords,
+					  uint64 *dst, int num_integers)
+{
+	int			total_decoded = 0;
+
+	/* decode all the codewords */
+	for (int i = 0; i < num_codewords; i++)
+	{
+		int			num_decoded;
+
+		if (total_decoded + simple8b_num_ints(codewords[i]) > num_integers)
+			elog(ERROR, "number of TIDs in codewords did not match the item header");
+
+		num_decoded = simple8b_decode(codewords[i], &dst[total_decoded]);
+		total_decoded += num_decoded;
+	}
+	/*
+	 * XXX: This error message is a bit specific, but it matches how this
+	 * function is actually used, i.e. to encode TIDs, and the number of integers
+	 * comes from the item header.
+	 */
+	if (total_decoded != num_integers)
+		elog(ERROR, "number of TIDs in codewords did not match the item header");
+}
+
+/*
+ * Like simple8b_decode_words(), but the codewords are known to contain
+ * deltas, and the result is converted to absolute values. The first
+ * value is 'firstval' plus the first delta.
+ *
+ * This is the hot path for decoding TID arrays, so the codewords are
+ * decoded with a separate loop for each mode, with the bit width as a
+ * compile-time constant, and the running sum is computed in the same pass.
+ * The common case of consecutive values, i.e. a codeword of sixty 1-bit
+ * deltas that are all ones, has a fast path of its own.
  */
-#define SIMPLE8B_MAX_VALUES_PER_CODEWORD 240
+void
+simple8b_decode_words_to_values(uint64 *codewords, int num_codewords,
+								uint64 firstval, uint64 *dst, int num_integers)
+{
+	int			total_decoded = 0;
+	uint64		val = firstval;
+
+	for (int i = 0; i < num_codewords; i++)
+	{
+		uint64		codeword = codewords[i];
+		int			selector = (codeword >> 60);
+		uint64	   *p = &dst[total_decoded];
+
+		if (codeword == EMPTY_CODEWORD)
+			continue;
+
+		if (total_decoded + simple8b_modes[selector].num_ints > num_integers)
+			elog(ERROR, "number of TIDs in codewords did not match the item header");
+
+		switch (selector)
+		{
+			case 0:
+			case 1:
+				/* a run of zero deltas */
+				for (int j = 0; j < simple8b_modes[selector].num_ints; j++)
+					p[j] = val;
+				break;
+			case 2:
+				if ((codeword & SIMPLE8B_PAYLOAD_MASK) == SIMPLE8B_PAYLOAD_MASK)
+				{
+					/* sixty consecutive values */
+					for (int j = 0; j < 60; j++)
+						p[j] = val + j + 1;
+					val += 60;
+				}
+				else
+					val = simple8b_decode_sum(codeword, 1, 60, val, p);
+				break;
+			case 3:
+				val = simple8b_decode_sum(codeword, 2, 30, val, p);
+				break;
+			case 4:
+				val = simple8b_decode_sum(codeword, 3, 20, val, p);
+				break;
+			case 5:
+				val = simple8b_decode_sum(codeword, 4, 15, val, p);
+				break;
+			case 6:
+				val = simple8b_decode_sum(codeword, 5, 12, val, p);
+				break;
+			case 7:
+				val = simple8b_decode_sum(codeword, 6, 10, val, p);
+				break;
+			case 8:
+				val = simple8b_decode_sum(codeword, 7, 8, val, p);
+				break;
+			case 9:
+				val = simple8b_decode_sum(codeword, 8, 7, val, p);
+				break;
+			case 10:
+				val = simple8b_decode_sum(codeword, 10, 6, val, p);
+				break;
+			case 11:
+				val = simple8b_decode_sum(codeword, 12, 5, val, p);
+				break;
+			case 12:
+				val = simple8b_decode_sum(codeword, 15, 4, val, p);
+				break;
+			case 13:
+				val = simple8b_decode_sum(codeword, 20, 3, val, p);
+				break;
+			case 14:
+				val = simple8b_decode_sum(codeword, 30, 2, val, p);
+				break;
+			case 15:
+				val += codeword & SIMPLE8B_PAYLOAD_MASK;
+				p[0] = val;
+				break;
+		}
+		total_decoded += simple8b_modes[selector].num_ints;
+	}
+
+	if (total_decoded != num_integers)
+		elog(ERROR, "number of TIDs in codewords did not match the item header");
+}
 
 /*
- * EMPTY_CODEWORD is a special value, used to indicate "no values".
- * It is used if the next value is too large to be encoded with Simple-8b.
+ * Find 'target' among the values that simple8b_decode_words_to_values()
+ * would produce from the same arguments. Returns its index, or -1 if it's
+ * not there.
  *
- * This value looks like a mode-0 codeword, but we can distinguish it
- * because a regular mode-0 codeword would have zeroes in the unused bits.
+ * This is for point lookups. The codewords are processed one at a time,
+ * stopping as soon as the running sum reaches the target, and nothing is
+ * stored. Runs of zero deltas, and of sixty consecutive values, are skipped
+ * by their count without decoding.
  */
-#define EMPTY_CODEWORD		UINT64CONST(0x0FFFFFFFFFFFFFFF)
+int
+simple8b_find_value(uint64 *codewords, int num_codewords,
+					uint64 firstval, uint64 target)
+{
+	int			idx = 0;
+	uint64		val = firstval;
+
+	for (int i = 0; i < num_codewords; i++)
+	{
+		uint64		codeword = codewords[i];
+		int			selector = (codeword >> 60);
+		int			nints;
+
+		if (codeword == EMPTY_CODEWORD)
+			continue;
+		nints = simple8b_modes[selector].num_ints;
+
+		if (selector <= 1)
+		{
+			/* a run of zero deltas */
+			if (val >= target)
+				return (val == target) ? idx : -1;
+		}
+		else if (selector == 2 && (codeword & SIMPLE8B_PAYLOAD_MASK) == SIMPLE8B_PAYLOAD_MASK)
+		{
+			/* sixty consecutive values */
+			if (target <= val)
+				return -1;
+			if (target <= val + 60)
+				return idx + (int) (target - val - 1);
+			val += 60;
+		}
+		else
+		{
+			uint64		deltas[SIMPLE8B_MAX_VALUES_PER_CODEWORD];
+
+			(void) simple8b_decode(codeword, deltas);
+			for (int j = 0; j < nints; j++)
+			{
+				val += deltas[j];
+				if (val >= target)
+					return (val == target) ? idx + j : -1;
+			}
+		}
+		idx += nints;
+	}
+	return -1;
+}
 
 /*
  * Encode a number of integers into a Simple-8b codeword.
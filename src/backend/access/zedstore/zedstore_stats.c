@@ -0,0 +1,452 @@
+/*
+ * zedstore_stats.c
+ *		Per-column activity statistics of zedstore tables
+ *
+ * The regular table statistics count rows and blocks for a table as a whole,
+ * which doesn't tell which columns of a zedstore table the reads and the
+ * decompression work go to. This module keeps a few counters for each
+ * column, which are shown in the pg_stat_zedstore_columns view.
+ *
+ * The counters are collected cheaply, in backend-private memory: an attribute
+ * tree scan accumulates its counts in the scan struct, and adds them to the
+ * backend's hash table when it ends. pgstat_report_stat() then periodically
+ * adds the backend's counts to a hash table in shared memory, and clears
+ * them. The shared table has room for a fixed number of columns; counts for
+ * columns that don't fit are discarded. Entries of dropped tables stay
+ * until the counters are reset with pg_stat_reset_zedstore_columns().
+ *
+ * Unlike the statistics collector's counters, these are not preserved
+ * across server restarts.
+ *
+ * The counters of attribute 0, for the TID tree and UNDO log, are also shown
+ * in the pg_stat_zedstore_undo view, together with a summary of the UNDO log
+ * read from the metapage.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zedstore/zedstore_stats.c
+ */
+#include "postgres.h"
+
+#include "access/relation.h"
+#include "access/zedstore_internal.h"
+#include "access/zedstore_stats.h"
+#include "catalog/pg_am.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/rel.h"
+#include "utils/tuplestore.h"
+
+/* number of columns that the shared hash table has room for */
+#define ZS_STATS_MAX_ENTRIES	4096
+
+typedef struct ZSColumnStatsKey
+{
+	Oid			dbid;
+	Oid			relid;
+	AttrNumber	attno;
+} ZSColumnStatsKey;
+
+typedef struct ZSColumnStatsEntry
+{
+	ZSColumnStatsKey key;		/* hash key, must be first */
+	ZSColumnCounters counters;
+} ZSColumnStatsEntry;
+
+typedef struct ZSStatsCtl
+{
+	LWLock		lock;			/* protects the hash table and the counters */
+} ZSStatsCtl;
+
+static ZSStatsCtl *ZSStats = NULL;
+static HTAB *ZSStatsHash = NULL;
+
+/* Backend-local counts that haven't been added to the shared table yet */
+static HTAB *ZSLocalStatsHash = NULL;
+bool		zs_have_column_stats = false;
+
+static void zs_stats_add_counters(ZSColumnCounters *dst, const ZSColumnCounters *src);
+
+/*
+ * Report shared-memory space needed by ZSStatsShmemInit
+ */
+Size
+ZSStatsShmemSize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(ZSStatsCtl));
+	size = add_size(size, hash_estimate_size(ZS_STATS_MAX_ENTRIES,
+											 sizeof(ZSColumnStatsEntry)));
+
+	return size;
+}
+
+/*
+ * Allocate and initialize the shared counters
+ */
+void
+ZSStatsShmemInit(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	ZSStats = (ZSStatsCtl *)
+		ShmemInitStruct("Zedstore Column Stats", sizeof(ZSStatsCtl), &found);
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(ZSColumnStatsKey);
+	info.entrysize = sizeof(ZSColumnStatsEntry);
+	ZSStatsHash = ShmemInitHash("Zedstore Column Stats Hash",
+								ZS_STATS_MAX_ENTRIES, ZS_STATS_MAX_ENTRIES,
+								&info,
+								HASH_ELEM | HASH_BLOBS);
+
+	if (!found)
+		LWLockInitialize(&ZSStats->lock, LWTRANCHE_ZEDSTORE_STATS);
+}
+
+/*
+ * Find or create the backend-local entry for a column.
+ */
+static ZSColumnCounters *
+zs_stats_get_local(Relation rel, AttrNumber attno)
+{
+	ZSColumnStatsKey key;
+	ZSColumnStatsEntry *entry;
+	bool		found;
+
+	if (ZSLocalStatsHash == NULL)
+	{
+		HASHCTL		info;
+
+		MemSet(&info, 0, sizeof(info));
+		info.keysize = sizeof(ZSColumnStatsKey);
+		info.entrysize = sizeof(ZSColumnStatsEntry);
+		ZSLocalStatsHash = hash_create("Zedstore local column stats", 64,
+									   &info, HASH_ELEM | HASH_BLOBS);
+	}
+
+	/* zero the padding, too, since the whole struct is hashed */
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.relid = RelationGetRelid(rel);
+	key.attno = attno;
+
+	entry = hash_search(ZSLocalStatsHash, &key, HASH_ENTER, &found);
+	if (!found)
+		memset(&entry->counters, 0, sizeof(ZSColumnCounters));
+	zs_have_column_stats = true;
+
+	return &entry->counters;
+}
+
+/*
+ * Add the counts of an attribute tree scan.
+ */
+void
+zs_stats_count_column(Relation rel, AttrNumber attno,
+					  const ZSColumnCounters *counts)
+{
+	if (counts->pages_read == 0 && counts->pages_hit == 0 &&
+		counts->bytes_decompressed == 0 && counts->chunks_decoded == 0)
+		return;
+
+	zs_stats_add_counters(zs_stats_get_local(rel, attno), counts);
+}
+
+void
+zs_stats_count_toast_flatten(Relation rel, AttrNumber attno)
+{
+	zs_stats_get_local(rel, attno)->toast_flattened++;
+}
+
+void
+zs_stats_count_undo_fetch(Relation rel)
+{
+	zs_stats_get_local(rel, 0)->undo_fetched++;
+}
+
+void
+zs_stats_count_undo_scan(Relation rel)
+{
+	zs_stats_get_local(rel, 0)->undo_scans++;
+}
+
+void
+zs_stats_count_undo_discard(Relation rel, int npages)
+{
+	zs_stats_get_local(rel, 0)->undo_pages_discarded += npages;
+}
+
+static void
+zs_stats_add_counters(ZSColumnCounters *dst, const ZSColumnCounters *src)
+{
+	dst->pages_read += src->pages_read;
+	dst->pages_hit += src->pages_hit;
+	dst->bytes_decompressed += src->bytes_decompressed;
+	dst->chunks_decoded += src->chunks_decoded;
+	dst->toast_flattened += src->toast_flattened;
+	dst->undo_fetched += src->undo_fetched;
+	dst->undo_scans += src->undo_scans;
+	dst->undo_pages_discarded += src->undo_pages_discarded;
+}
+
+/*
+ * Add the backend's counts to the shared table, and clear them.
+ *
+ * Called from pgstat_report_stat(), and before reading the shared table, so
+ * that a backend sees its own activity right away.
+ */
+void
+zs_stats_flush(void)
+{
+	HASH_SEQ_STATUS status;
+	ZSColumnStatsEntry *local;
+
+	if (!zs_have_column_stats)
+		return;
+
+	LWLockAcquire(&ZSStats->lock, LW_EXCLUSIVE);
+	hash_seq_init(&status, ZSLocalStatsHash);
+	while ((local = hash_seq_search(&status)) != NULL)
+	{
+		ZSColumnStatsEntry *shared;
+		bool		found;
+
+		/* if the shared table is full, the counts are lost */
+		shared = hash_search(ZSStatsHash, &local->key, HASH_ENTER_NULL, &found);
+		if (shared == NULL)
+			continue;
+		if (!found)
+			memset(&shared->counters, 0, sizeof(ZSColumnCounters));
+		zs_stats_add_counters(&shared->counters, &local->counters);
+	}
+	LWLockRelease(&ZSStats->lock);
+
+	hash_destroy(ZSLocalStatsHash);
+	ZSLocalStatsHash = NULL;
+	zs_have_column_stats = false;
+}
+
+/*
+ * SQL-callable function to show the counters of the current database.
+ */
+Datum
+pg_stat_get_zedstore_columns(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_ZEDSTORE_COLUMNS_COLS	8
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS status;
+	ZSColumnStatsEntry *entry;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	zs_stats_flush();
+
+	LWLockAcquire(&ZSStats->lock, LW_SHARED);
+	hash_seq_init(&status, ZSStatsHash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		Datum		values[PG_STAT_GET_ZEDSTORE_COLUMNS_COLS];
+		bool		nulls[PG_STAT_GET_ZEDSTORE_COLUMNS_COLS];
+
+		if (entry->key.dbid != MyDatabaseId)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(entry->key.relid);
+		values[1] = Int16GetDatum(entry->key.attno);
+		values[2] = Int64GetDatum(entry->counters.pages_read);
+		values[3] = Int64GetDatum(entry->counters.pages_hit);
+		values[4] = Int64GetDatum(entry->counters.bytes_decompressed);
+		values[5] = Int64GetDatum(entry->counters.chunks_decoded);
+		values[6] = Int64GetDatum(entry->counters.toast_flattened);
+		values[7] = Int64GetDatum(entry->counters.undo_fetched);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	LWLockRelease(&ZSStats->lock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Reset the counters of the current database, including the ones of this
+ * backend that haven't been flushed yet.
+ */
+Datum
+pg_stat_reset_zedstore_columns(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS status;
+	ZSColumnStatsEntry *entry;
+
+	if (ZSLocalStatsHash)
+	{
+		hash_destroy(ZSLocalStatsHash);
+		ZSLocalStatsHash = NULL;
+	}
+	zs_have_column_stats = false;
+
+	LWLockAcquire(&ZSStats->lock, LW_EXCLUSIVE);
+	hash_seq_init(&status, ZSStatsHash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		/* deleting the entry just returned by the scan is allowed */
+		if (entry->key.dbid == MyDatabaseId)
+			hash_search(ZSStatsHash, &entry->key, HASH_REMOVE, NULL);
+	}
+	LWLockRelease(&ZSStats->lock);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * SQL-callable function to show a summary of the UNDO log of a table, and
+ * the UNDO activity counters of the table.
+ *
+ * Returns no rows if the table doesn't exist anymore, because the
+ * pg_stat_zedstore_undo view calls this for every zedstore table.
+ */
+Datum
+pg_stat_get_zedstore_undo(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_ZEDSTORE_UNDO_COLS	8
+	Oid			relid = PG_GETARG_OID(0);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	Relation	rel;
+	ZSUndoLogStats undostats;
+	ZSColumnStatsKey key;
+	ZSColumnStatsEntry *entry;
+	ZSColumnCounters counters;
+	Datum		values[PG_STAT_GET_ZEDSTORE_UNDO_COLS];
+	bool		nulls[PG_STAT_GET_ZEDSTORE_UNDO_COLS];
+	uint64		lag_pages;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	rel = try_relation_open(relid, AccessShareLock);
+	if (rel == NULL)
+		return (Datum) 0;
+
+	if (rel->rd_rel->relam != ZEDSTORE_TABLE_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a zedstore table",
+						RelationGetRelationName(rel))));
+
+	/* we have no access to the local buffers of other sessions */
+	if (RELATION_IS_OTHER_TEMP(rel))
+	{
+		relation_close(rel, AccessShareLock);
+		return (Datum) 0;
+	}
+
+	zsundo_get_stats(rel, &undostats);
+	relation_close(rel, AccessShareLock);
+
+	/* fetch the counters of the table, including our own unflushed ones */
+	zs_stats_flush();
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	key.attno = 0;
+
+	LWLockAcquire(&ZSStats->lock, LW_SHARED);
+	entry = hash_search(ZSStatsHash, &key, HASH_FIND, NULL);
+	if (entry)
+		counters = entry->counters;
+	else
+		memset(&counters, 0, sizeof(ZSColumnCounters));
+	LWLockRelease(&ZSStats->lock);
+
+	/*
+	 * Number of pages from the one with the oldest record that's still
+	 * needed, to the newest one. The pages before that are waiting to be
+	 * discarded.
+	 */
+	if (undostats.npages == 0)
+		lag_pages = 0;
+	else if (undostats.oldest_counter < undostats.tail_counter)
+		lag_pages = Min((undostats.tail_counter - undostats.oldest_counter) /
+						ZS_UNDO_PAGE_COUNTERS + 1, undostats.npages);
+	else
+		lag_pages = 1;
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum((int64) undostats.npages);
+	values[1] = Int64GetDatum((int64) undostats.npages * BLCKSZ);
+	values[2] = Int64GetDatum((int64) undostats.oldest_counter);
+	values[3] = Int64GetDatum((int64) undostats.tail_counter);
+	values[4] = Int64GetDatum((int64) lag_pages);
+	values[5] = Int64GetDatum(counters.undo_fetched);
+	values[6] = Int64GetDatum(counters.undo_scans);
+	values[7] = Int64GetDatum(counters.undo_pages_discarded);
+
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+	return (Datum) 0;
+}
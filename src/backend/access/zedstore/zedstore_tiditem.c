@@ -12,6 +12,7 @@
 
 #include "access/zedstore_internal.h"
 #include "access/zedstore_simple8b.h"
+#include "port/pg_bitutils.h"
 
 static int remap_slots(uint8 *slotnos, int num_tids,
 					   ZSUndoRecPtr *orig_slots, int num_orig_slots,
@@ -24,7 +25,10 @@ static ZSTidArrayItem *build_item(zstid *tids, uint64 *deltas, uint8 *slotnos, i
 								  ZSUndoRecPtr *slots, int num_slots);
 
 static void deltas_to_tids(zstid firsttid, uint64 *deltas, int num_tids, zstid *tids);
-static void slotwords_to_slotnos(uint64 *slotwords, int num_tids, uint8 *slotnos);
+static void slotwords_to_slotnos(uint64 *slotwords, int num_tids, int num_slots,
+								 uint8 *slotnos);
+static void slotnos_to_slotwords(uint8 *slotnos, int num_tids, int num_slots,
+								 uint64 *slotwords);
 static int binsrch_tid_array(zstid key, zstid *arr, int arr_elems);
 
 /*
@@ -52,16 +56,15 @@ zsbt_tid_item_unpack(ZSTidArrayItem *item, ZSTidItemIterator *iter)
 	ZSTidArrayItemDecode(item, &codewords, &slots, &slotwords);
 	num_tids = item->t_num_tids;
 
-	/* decode all the codewords */
-	simple8b_decode_words(codewords, item->t_num_codewords, iter->tids, num_tids);
-
-	/* convert the deltas to TIDs */
-	deltas_to_tids(item->t_firsttid, iter->tids, num_tids, iter->tids);
+	/* decode all the codewords, converting the deltas to TIDs */
+	simple8b_decode_words_to_values(codewords, item->t_num_codewords,
+									item->t_firsttid, iter->tids, num_tids);
 	iter->num_tids = num_tids;
 	Assert(iter->tids[num_tids - 1] == item->t_endtid - 1);
 
 	/* Expand slotwords to slotnos */
-	slotwords_to_slotnos(slotwords, num_tids, iter->tid_undoslotnos);
+	slotwords_to_slotnos(slotwords, num_tids, item->t_num_undo_slots,
+						 iter->tid_undoslotnos);
 
 	/* also copy out the slots to the iterator */
 	iter->undoslots[ZSBT_OLD_UNDO_SLOT] = InvalidUndoPtr;
@@ -70,6 +73,173 @@ zsbt_tid_item_unpack(ZSTidArrayItem *item, ZSTidItemIterator *iter)
 		iter->undoslots[i] = slots[i - ZSBT_FIRST_NORMAL_UNDO_SLOT];
 }
 
+/*
+ * Count how many TIDs in an item use each UNDO slot.
+ *
+ * This only looks at the slotwords; the TID codewords are not decoded.
+ * 'counts' must have room for ZSBT_MAX_ITEM_UNDO_SLOTS entries.
+ */
+void
+zsbt_tid_item_count_slots(ZSTidArrayItem *item, int *counts)
+{
+	const uint64 lowbits = UINT64CONST(0x5555555555555555);
+	ZSUndoRecPtr *slots;
+	uint64	   *slotwords;
+	uint64	   *codewords;
+	int			remain;
+
+	ZSTidArrayItemDecode(item, &codewords, &slots, &slotwords);
+
+	memset(counts, 0, ZSBT_MAX_ITEM_UNDO_SLOTS * sizeof(int));
+
+	if (item->t_num_undo_slots > ZSBT_MAX_NARROW_UNDO_SLOTS)
+	{
+		/* Wide slot numbers are rare. Just count them one by one. */
+		const int	bits = ZSBT_WIDE_UNDO_SLOT_BITS;
+		const uint64 mask = (UINT64CONST(1) << bits) - 1;
+		const int	per_word = ZSBT_SLOTNOS_PER_WORD(item->t_num_undo_slots);
+
+		remain = item->t_num_tids;
+		for (int i = 0; remain > 0; i++)
+		{
+			uint64		slotword = slotwords[i];
+			int			n = Min(remain, per_word);
+
+			for (int j = 0; j < n; j++)
+			{
+				counts[slotword & mask]++;
+				slotword >>= bits;
+			}
+			remain -= n;
+		}
+		return;
+	}
+
+	remain = item->t_num_tids;
+	for (int i = 0; remain > 0; i++)
+	{
+		uint64		slotword = slotwords[i];
+		int			n = Min(remain, ZSBT_SLOTNOS_PER_WORD(item->t_num_undo_slots));
+		uint64		lo;
+		uint64		hi;
+		int			n1;
+		int			n2;
+		int			n3;
+
+		/* ignore the unused slot numbers at the end of the last word */
+		if (n < ZSBT_SLOTNOS_PER_WORD(item->t_num_undo_slots))
+			slotword &= (UINT64CONST(1) << (n * ZSBT_NARROW_UNDO_SLOT_BITS)) - 1;
+
+		lo = slotword & lowbits;
+		hi = (slotword >> 1) & lowbits;
+		n1 = pg_popcount64(lo & ~hi);
+		n2 = pg_popcount64(hi & ~lo);
+		n3 = pg_popcount64(lo & hi);
+
+		counts[0] += n - n1 - n2 - n3;
+		counts[1] += n1;
+		counts[2] += n2;
+		counts[3] += n3;
+		remain -= n;
+	}
+}
+
+/*
+ * Are all the TIDs in an item dead?
+ *
+ * Dead TIDs stay in the TID tree until VACUUM removes them. Scans can skip
+ * an item where every TID points to the dead UNDO slot without decoding its
+ * TID codewords. This only compares the slotwords against a word with the
+ * dead slot number in every position.
+ */
+bool
+zsbt_tid_item_is_all_dead(ZSTidArrayItem *item)
+{
+	int			bits = ZSBT_UNDO_SLOT_BITS(item->t_num_undo_slots);
+	int			per_word = ZSBT_SLOTNOS_PER_WORD(item->t_num_undo_slots);
+	uint64		deadbits;
+	ZSUndoRecPtr *slots;
+	uint64	   *slotwords;
+	uint64	   *codewords;
+	int			remain;
+
+	StaticAssertStmt(ZSBT_DEAD_UNDO_SLOT == 1,
+					 "dead slotword pattern assumes dead slot number 1");
+	if (bits == ZSBT_NARROW_UNDO_SLOT_BITS)
+		deadbits = UINT64CONST(0x5555555555555555);
+	else
+		deadbits = UINT64CONST(0x1111111111111111);
+
+	ZSTidArrayItemDecode(item, &codewords, &slots, &slotwords);
+
+	remain = item->t_num_tids;
+	for (int i = 0; remain > 0; i++)
+	{
+		uint64		slotword = slotwords[i];
+		uint64		expected = deadbits;
+		int			n = Min(remain, per_word);
+
+		/* ignore the unused slot numbers at the end of the last word */
+		if (n < per_word)
+		{
+			uint64		mask = (UINT64CONST(1) << (n * bits)) - 1;
+
+			slotword &= mask;
+			expected &= mask;
+		}
+		if (slotword != expected)
+			return false;
+		remain -= n;
+	}
+	return true;
+}
+
+/*
+ * Look up a single TID in an item.
+ *
+ * This is the fast path for point lookups. Unlike zsbt_tid_item_unpack(), it
+ * only decodes the codewords up to the one holding the target TID, and only
+ * the slot number of the target. Returns the UNDO slot number of the TID, and
+ * its UNDO pointer in *undoptr_p, or -1 if the item doesn't contain the TID.
+ */
+int
+zsbt_tid_item_lookup(ZSTidArrayItem *item, zstid tid, ZSUndoRecPtr *undoptr_p)
+{
+	ZSUndoRecPtr *slots;
+	uint64	   *slotwords;
+	uint64	   *codewords;
+	int			idx;
+	int			slotno;
+	int			bits;
+	int			per_word;
+
+	if (tid < item->t_firsttid || tid >= item->t_endtid)
+		return -1;
+
+	ZSTidArrayItemDecode(item, &codewords, &slots, &slotwords);
+
+	idx = simple8b_find_value(codewords, item->t_num_codewords,
+							  item->t_firsttid, tid);
+	if (idx < 0)
+		return -1;
+	if (idx >= item->t_num_tids)
+		elog(ERROR, "number of TIDs in codewords did not match the item header");
+
+	bits = ZSBT_UNDO_SLOT_BITS(item->t_num_undo_slots);
+	per_word = ZSBT_SLOTNOS_PER_WORD(item->t_num_undo_slots);
+	slotno = (slotwords[idx / per_word] >> ((idx % per_word) * bits)) &
+		((UINT64CONST(1) << bits) - 1);
+
+	if (slotno == ZSBT_OLD_UNDO_SLOT)
+		*undoptr_p = InvalidUndoPtr;
+	else if (slotno == ZSBT_DEAD_UNDO_SLOT)
+		*undoptr_p = DeadUndoPtr;
+	else
+		*undoptr_p = slots[slotno - ZSBT_FIRST_NORMAL_UNDO_SLOT];
+
+	return slotno;
+}
+
 /*
  * Create a ZSTidArrayItem (or items), to represent a range of contiguous TIDs,
  * all with the same UNDO pointer.
@@ -156,6 +326,7 @@ zsbt_tid_item_create_for_range(zstid tid, int nelements, ZSUndoRecPtr undo_ptr)
 		}
 
 		/* Fill in slotwords */
+		Assert(num_slots <= ZSBT_MAX_NARROW_UNDO_SLOTS);
 		i = 0;
 		slotword_p = newitem_slotwords;
 		while (i < num_tids)
@@ -163,9 +334,9 @@ zsbt_tid_item_create_for_range(zstid tid, int nelements, ZSUndoRecPtr undo_ptr)
 			uint64		slotword;
 
 			slotword = 0;
-			for (int j = 0; j < ZSBT_SLOTNOS_PER_WORD && i < num_tids; j++)
+			for (int j = 0; j < ZSBT_SLOTNOS_PER_WORD(num_slots) && i < num_tids; j++)
 			{
-				slotword |= (uint64) slotno << (j * ZSBT_ITEM_UNDO_SLOT_BITS);
+				slotword |= (uint64) slotno << (j * ZSBT_NARROW_UNDO_SLOT_BITS);
 				i++;
 			}
 			*(slotword_p++) = slotword;
@@ -331,39 +502,57 @@ zsbt_tid_item_add_tids(ZSTidArrayItem *orig, zstid firsttid, int nelements,
 	/*
 	 * Copy and build slotwords
 	 */
-	dst_slotword = newitem_slotwords;
-	/* copy full original slotwords as is */
-	for (i = 0; i < orig->t_num_tids / ZSBT_SLOTNOS_PER_WORD; i++)
-		*(dst_slotword++) = orig_slotwords[i];
-
-	/* add to the last, partial slotword. */
-	i = orig->t_num_tids;
-	j = orig->t_num_tids % ZSBT_SLOTNOS_PER_WORD;
-	if (j != 0)
+	if (ZSBT_UNDO_SLOT_BITS(num_slots) != ZSBT_UNDO_SLOT_BITS(orig->t_num_undo_slots))
 	{
-		uint64		slotword = orig_slotwords[orig->t_num_tids / ZSBT_SLOTNOS_PER_WORD];
-
-		for (; j < ZSBT_SLOTNOS_PER_WORD && i < num_tids; j++)
-		{
-			slotword |= (uint64) slotno << (j * ZSBT_ITEM_UNDO_SLOT_BITS);
-			i++;
-		}
-		*(dst_slotword++) = slotword;
+		/* The new slot doesn't fit in narrow slot numbers. Re-encode all. */
+		uint8	   *slotnos = palloc(num_tids * sizeof(uint8));
+
+		slotwords_to_slotnos(orig_slotwords, orig->t_num_tids, orig->t_num_undo_slots,
+							 slotnos);
+		for (i = orig->t_num_tids; i < num_tids; i++)
+			slotnos[i] = slotno;
+		slotnos_to_slotwords(slotnos, num_tids, num_slots, newitem_slotwords);
+		pfree(slotnos);
 	}
-
-	/* new slotwords */
-	while (i < num_tids)
+	else
 	{
-		uint64		slotword = 0;
+		int			bits = ZSBT_UNDO_SLOT_BITS(num_slots);
+		int			per_word = ZSBT_SLOTNOS_PER_WORD(num_slots);
+
+		dst_slotword = newitem_slotwords;
+		/* copy full original slotwords as is */
+		for (i = 0; i < orig->t_num_tids / per_word; i++)
+			*(dst_slotword++) = orig_slotwords[i];
+
+		/* add to the last, partial slotword. */
+		i = orig->t_num_tids;
+		j = orig->t_num_tids % per_word;
+		if (j != 0)
+		{
+			uint64		slotword = orig_slotwords[orig->t_num_tids / per_word];
+
+			for (; j < per_word && i < num_tids; j++)
+			{
+				slotword |= (uint64) slotno << (j * bits);
+				i++;
+			}
+			*(dst_slotword++) = slotword;
+		}
 
-		for (j = 0; j < ZSBT_SLOTNOS_PER_WORD && i < num_tids; j++)
+		/* new slotwords */
+		while (i < num_tids)
 		{
-			slotword |= (uint64) slotno << (j * ZSBT_ITEM_UNDO_SLOT_BITS);
-			i++;
+			uint64		slotword = 0;
+
+			for (j = 0; j < per_word && i < num_tids; j++)
+			{
+				slotword |= (uint64) slotno << (j * bits);
+				i++;
+			}
+			*(dst_slotword++) = slotword;
 		}
-		*(dst_slotword++) = slotword;
+		Assert(dst_slotword == newitem_slotwords + ZSBT_NUM_SLOTWORDS(num_tids, num_slots));
 	}
-	Assert(dst_slotword == newitem_slotwords + ZSBT_NUM_SLOTWORDS(num_tids));
 
 	/* Create more items for the remainder, if needed */
 	*modified_orig = true;
@@ -475,25 +664,42 @@ zsbt_tid_item_change_undoptr(ZSTidArrayItem *orig, zstid target_tid, ZSUndoRecPt
 			newitem_slots[new_slotno - ZSBT_FIRST_NORMAL_UNDO_SLOT] = undoptr;
 
 		/* copy slotwords */
-		for (int i = 0; i < ZSBT_NUM_SLOTWORDS(orig->t_num_tids); i++)
+		if (ZSBT_UNDO_SLOT_BITS(num_slots) != ZSBT_UNDO_SLOT_BITS(orig->t_num_undo_slots))
 		{
-			uint64		slotword;
-
-			slotword = orig_slotwords[i];
+			/* The new slot doesn't fit in narrow slot numbers. Re-encode all. */
+			uint8	   *slotnos = palloc(num_tids * sizeof(uint8));
+
+			slotwords_to_slotnos(orig_slotwords, num_tids, orig->t_num_undo_slots,
+								 slotnos);
+			slotnos[target_idx] = new_slotno;
+			slotnos_to_slotwords(slotnos, num_tids, num_slots, newitem_slotwords);
+			pfree(slotnos);
+		}
+		else
+		{
+			int			bits = ZSBT_UNDO_SLOT_BITS(num_slots);
+			int			per_word = ZSBT_SLOTNOS_PER_WORD(num_slots);
 
-			if (target_idx / ZSBT_SLOTNOS_PER_WORD == i)
+			for (int i = 0; i < ZSBT_NUM_SLOTWORDS(num_tids, num_slots); i++)
 			{
-				/* this slotword contains the target TID */
-				int			shift = (target_idx % ZSBT_SLOTNOS_PER_WORD) * ZSBT_ITEM_UNDO_SLOT_BITS;
-				uint64		mask;
+				uint64		slotword;
 
-				mask = ((UINT64CONST(1) << ZSBT_ITEM_UNDO_SLOT_BITS) - 1) << shift;
+				slotword = orig_slotwords[i];
 
-				slotword &= ~mask;
-				slotword |= (uint64) new_slotno << shift;
-			}
+				if (target_idx / per_word == i)
+				{
+					/* this slotword contains the target TID */
+					int			shift = (target_idx % per_word) * bits;
+					uint64		mask;
 
-			newitem_slotwords[i] = slotword;
+					mask = ((UINT64CONST(1) << bits) - 1) << shift;
+
+					slotword &= ~mask;
+					slotword |= (uint64) new_slotno << shift;
+				}
+
+				newitem_slotwords[i] = slotword;
+			}
 		}
 
 		newitems = list_make1(newitem);
@@ -507,7 +713,8 @@ zsbt_tid_item_change_undoptr(ZSTidArrayItem *orig, zstid target_tid, ZSUndoRecPt
 		int			idx;
 
 		slotnos = palloc(orig->t_num_tids * sizeof(uint8));
-		slotwords_to_slotnos(orig_slotwords, orig->t_num_tids, slotnos);
+		slotwords_to_slotnos(orig_slotwords, orig->t_num_tids, orig->t_num_undo_slots,
+							 slotnos);
 
 		tmp_slotnos = palloc(orig->t_num_tids * sizeof(uint8));
 
@@ -545,11 +752,79 @@ zsbt_tid_item_change_undoptr(ZSTidArrayItem *orig, zstid target_tid, ZSUndoRecPt
 	return newitems;
 }
 
+/*
+ * Mark all the TIDs that use UNDO slot 'slotno' in an item as dead.
+ *
+ * The slot is removed, and the slots after it are renumbered. The TID
+ * codewords are not modified, so the new item is always smaller than the
+ * original, and can replace it in place.
+ */
+ZSTidArrayItem *
+zsbt_tid_item_kill_slot(ZSTidArrayItem *orig, int slotno)
+{
+	ZSUndoRecPtr *orig_slots;
+	uint64	   *orig_slotwords;
+	uint64	   *orig_codewords;
+	ZSTidArrayItem *newitem;
+	ZSUndoRecPtr *newitem_slots;
+	uint64	   *newitem_slotwords;
+	uint64	   *newitem_codewords;
+	int			num_slots;
+	Size		itemsz;
+	uint8	   *slotnos;
+
+	Assert(slotno >= ZSBT_FIRST_NORMAL_UNDO_SLOT && slotno < orig->t_num_undo_slots);
+
+	ZSTidArrayItemDecode(orig, &orig_codewords, &orig_slots, &orig_slotwords);
+
+	num_slots = orig->t_num_undo_slots - 1;
+	itemsz = SizeOfZSTidArrayItem(orig->t_num_tids, num_slots, orig->t_num_codewords);
+	newitem = palloc(itemsz);
+	newitem->t_size = itemsz;
+	newitem->t_num_tids = orig->t_num_tids;
+	newitem->t_num_codewords = orig->t_num_codewords;
+	newitem->t_num_undo_slots = num_slots;
+	newitem->t_firsttid = orig->t_firsttid;
+	newitem->t_endtid = orig->t_endtid;
+
+	ZSTidArrayItemDecode(newitem, &newitem_codewords, &newitem_slots, &newitem_slotwords);
+
+	for (int i = 0; i < orig->t_num_codewords; i++)
+		newitem_codewords[i] = orig_codewords[i];
+
+	for (int i = ZSBT_FIRST_NORMAL_UNDO_SLOT, j = ZSBT_FIRST_NORMAL_UNDO_SLOT;
+		 i < orig->t_num_undo_slots; i++)
+	{
+		if (i != slotno)
+			newitem_slots[j++ - ZSBT_FIRST_NORMAL_UNDO_SLOT] =
+				orig_slots[i - ZSBT_FIRST_NORMAL_UNDO_SLOT];
+	}
+
+	/*
+	 * Renumber the slots. Removing a slot can make the slot numbers narrow
+	 * again, so decode and re-encode them.
+	 */
+	slotnos = palloc(orig->t_num_tids * sizeof(uint8));
+	slotwords_to_slotnos(orig_slotwords, orig->t_num_tids, orig->t_num_undo_slots,
+						 slotnos);
+	for (int i = 0; i < orig->t_num_tids; i++)
+	{
+		if (slotnos[i] == slotno)
+			slotnos[i] = ZSBT_DEAD_UNDO_SLOT;
+		else if (slotnos[i] > slotno)
+			slotnos[i]--;
+	}
+	slotnos_to_slotwords(slotnos, orig->t_num_tids, num_slots, newitem_slotwords);
+	pfree(slotnos);
+
+	return newitem;
+}
+
 /*
  * Completely remove a number of TIDs from an item. (for vacuum)
  */
 List *
-zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, IntegerSet *remove_tids,
+zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, ZSTidStore *remove_tids,
 						  ZSUndoRecPtr recent_oldest_undo)
 {
 	ZSUndoRecPtr *orig_slots_partial;
@@ -563,7 +838,6 @@ zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, IntegerSet *remo
 	List	   *newitems = NIL;
 	zstid		tid;
 	zstid		prev_tid;
-	int			idx;
 	uint8	   *slotnos;
 
 	deltas = palloc(sizeof(uint64) * nelements);
@@ -581,17 +855,8 @@ zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, IntegerSet *remo
 	for (int i = ZSBT_FIRST_NORMAL_UNDO_SLOT; i < orig->t_num_undo_slots; i++)
 		orig_slots[i] = orig_slots_partial[i - ZSBT_FIRST_NORMAL_UNDO_SLOT];
 
-	idx = 0;
-	while (idx < orig->t_num_tids)
-	{
-		uint64		slotword = orig_slotwords[idx / ZSBT_SLOTNOS_PER_WORD];
-
-		for (int j = 0; j < ZSBT_SLOTNOS_PER_WORD && idx < orig->t_num_tids; j++)
-		{
-			slotnos[idx++] = slotword & ((UINT64CONST(1) << ZSBT_ITEM_UNDO_SLOT_BITS) - 1);
-			slotword >>= ZSBT_ITEM_UNDO_SLOT_BITS;
-		}
-	}
+	slotwords_to_slotnos(orig_slotwords, orig->t_num_tids, orig->t_num_undo_slots,
+						 slotnos);
 
 	/*
 	 * Remove all the TIDs we can
@@ -607,7 +872,7 @@ zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, IntegerSet *remo
 
 		while (*nexttid < tid)
 		{
-			if (!intset_iterate_next(remove_tids, nexttid))
+			if (!zs_tidstore_iterate_next(remove_tids, nexttid))
 				*nexttid = MaxPlusOneZSTid;
 		}
 		if (tid < *nexttid)
@@ -665,6 +930,186 @@ zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, IntegerSet *remo
 }
 
 
+/*
+ * Pack the TIDs of a run of consecutive items into as few items as possible.
+ *
+ * 'undoptrs' holds the UNDO pointer of each TID.
+ */
+static List *
+repack_tids(zstid *tids, ZSUndoRecPtr *undoptrs, int num_tids,
+			ZSUndoRecPtr recent_oldest_undo)
+{
+	List	   *newitems = NIL;
+	uint64	   *deltas;
+	uint8	   *slotnos;
+	int			idx;
+
+	deltas = palloc(num_tids * sizeof(uint64));
+	slotnos = palloc(num_tids * sizeof(uint8));
+	for (int i = 1; i < num_tids; i++)
+		deltas[i] = tids[i] - tids[i - 1];
+
+	idx = 0;
+	while (idx < num_tids)
+	{
+		ZSUndoRecPtr slots[ZSBT_MAX_ITEM_UNDO_SLOTS];
+		int			num_slots;
+		int			n;
+		ZSTidArrayItem *newitem;
+
+		/* assign UNDO slots, until we run out of them */
+		slots[ZSBT_OLD_UNDO_SLOT] = InvalidUndoPtr;
+		slots[ZSBT_DEAD_UNDO_SLOT] = DeadUndoPtr;
+		num_slots = ZSBT_FIRST_NORMAL_UNDO_SLOT;
+		for (n = 0; n < num_tids - idx && n < ZSBT_MAX_ITEM_TIDS; n++)
+		{
+			ZSUndoRecPtr undoptr = undoptrs[idx + n];
+			int			slotno = -1;
+
+			if (undoptr.counter == DeadUndoPtr.counter)
+				slotno = ZSBT_DEAD_UNDO_SLOT;
+			else if (undoptr.counter < recent_oldest_undo.counter)
+				slotno = ZSBT_OLD_UNDO_SLOT;
+			else
+			{
+				for (int j = ZSBT_FIRST_NORMAL_UNDO_SLOT; j < num_slots; j++)
+				{
+					if (slots[j].counter == undoptr.counter)
+					{
+						slotno = j;
+						break;
+					}
+				}
+				if (slotno == -1)
+				{
+					if (num_slots >= ZSBT_MAX_ITEM_UNDO_SLOTS)
+						break;		/* out of slots */
+					slots[num_slots] = undoptr;
+					slotno = num_slots++;
+				}
+			}
+			slotnos[idx + n] = slotno;
+		}
+
+		deltas[idx] = 0;
+		newitem = build_item(&tids[idx], &deltas[idx], &slotnos[idx], n,
+							 slots, num_slots);
+		newitems = lappend(newitems, newitem);
+		idx += newitem->t_num_tids;
+	}
+
+	pfree(deltas);
+	pfree(slotnos);
+
+	return newitems;
+}
+
+/*
+ * Subroutine of zsbt_tid_item_merge_small(), to merge one run of items that
+ * hold 'num_tids' TIDs in total.
+ */
+static List *
+merge_item_run(List *run, int num_tids, ZSUndoRecPtr recent_oldest_undo)
+{
+	zstid	   *tids;
+	ZSUndoRecPtr *undoptrs;
+	uint8	   *slotnos;
+	List	   *newitems;
+	Size		oldsize = 0;
+	Size		newsize = 0;
+	int			n = 0;
+	ListCell   *lc;
+
+	if (list_length(run) < 2)
+		return run;
+
+	tids = palloc(num_tids * sizeof(zstid));
+	undoptrs = palloc(num_tids * sizeof(ZSUndoRecPtr));
+	slotnos = palloc(num_tids * sizeof(uint8));
+	foreach(lc, run)
+	{
+		ZSTidArrayItem *item = (ZSTidArrayItem *) lfirst(lc);
+		ZSUndoRecPtr slots[ZSBT_MAX_ITEM_UNDO_SLOTS];
+		ZSUndoRecPtr *slots_partial;
+		uint64	   *codewords;
+		uint64	   *slotwords;
+
+		ZSTidArrayItemDecode(item, &codewords, &slots_partial, &slotwords);
+		slots[ZSBT_OLD_UNDO_SLOT] = InvalidUndoPtr;
+		slots[ZSBT_DEAD_UNDO_SLOT] = DeadUndoPtr;
+		for (int i = ZSBT_FIRST_NORMAL_UNDO_SLOT; i < item->t_num_undo_slots; i++)
+			slots[i] = slots_partial[i - ZSBT_FIRST_NORMAL_UNDO_SLOT];
+
+		simple8b_decode_words_to_values(codewords, item->t_num_codewords,
+										item->t_firsttid, &tids[n],
+										item->t_num_tids);
+		slotwords_to_slotnos(slotwords, item->t_num_tids, item->t_num_undo_slots,
+							 &slotnos[n]);
+		for (int i = 0; i < item->t_num_tids; i++)
+			undoptrs[n + i] = slots[slotnos[n + i]];
+		n += item->t_num_tids;
+		oldsize += sizeof(ItemIdData) + MAXALIGN(item->t_size);
+	}
+	Assert(n == num_tids);
+
+	newitems = repack_tids(tids, undoptrs, num_tids, recent_oldest_undo);
+	foreach(lc, newitems)
+		newsize += sizeof(ItemIdData) + MAXALIGN(((ZSTidArrayItem *) lfirst(lc))->t_size);
+
+	pfree(tids);
+	pfree(undoptrs);
+	pfree(slotnos);
+
+	if (newsize >= oldsize)
+	{
+		list_free_deep(newitems);
+		return run;
+	}
+	list_free(run);
+	return newitems;
+}
+
+/*
+ * Combine runs of small consecutive items in 'items' into fewer, larger ones.
+ *
+ * After VACUUM has removed most of the TIDs from a range, the remaining items
+ * hold only a few TIDs each, and the fixed-size item headers take up most of
+ * the space. Re-encoding the TIDs of neighbouring items together gets rid of
+ * the headers, and usually needs fewer codewords too, as simple-8b can pack
+ * more deltas in a word when there are more of them.
+ *
+ * Returns a new list. The items of a run are replaced only if the result is
+ * smaller; items that are left alone are reused as is.
+ */
+List *
+zsbt_tid_item_merge_small(List *items, ZSUndoRecPtr recent_oldest_undo)
+{
+	List	   *result = NIL;
+	List	   *run = NIL;
+	int			run_tids = 0;
+	ListCell   *lc;
+
+	foreach(lc, items)
+	{
+		ZSTidArrayItem *item = (ZSTidArrayItem *) lfirst(lc);
+
+		if (run_tids + item->t_num_tids > ZSBT_MAX_ITEM_TIDS)
+		{
+			result = list_concat(result,
+								 merge_item_run(run, run_tids, recent_oldest_undo));
+			run = NIL;
+			run_tids = 0;
+		}
+		run = lappend(run, item);
+		run_tids += item->t_num_tids;
+	}
+	result = list_concat(result,
+						 merge_item_run(run, run_tids, recent_oldest_undo));
+
+	return result;
+}
+
+
 /*
  * Convert an array of deltas to tids.
  *
@@ -686,16 +1131,35 @@ deltas_to_tids(zstid firsttid, uint64 *deltas, int num_tids, zstid *tids)
 }
 
 /*
- * Expand the slot numbers packed in slotwords, 2 bits per slotno, into
- * a regular C array.
+ * Expand the slot numbers packed in slotwords, 2 or 4 bits per slotno
+ * depending on 'num_slots', into a regular C array.
  */
 static void
-slotwords_to_slotnos(uint64 *slotwords, int num_tids, uint8 *slotnos)
+slotwords_to_slotnos(uint64 *slotwords, int num_tids, int num_slots, uint8 *slotnos)
 {
 	uint64	   *slotword_p;
-	const uint64 mask = (UINT64CONST(1) << ZSBT_ITEM_UNDO_SLOT_BITS) - 1;
+	const uint64 mask = (UINT64CONST(1) << ZSBT_NARROW_UNDO_SLOT_BITS) - 1;
 	int			i;
 
+	if (num_slots > ZSBT_MAX_NARROW_UNDO_SLOTS)
+	{
+		const uint64 widemask = (UINT64CONST(1) << ZSBT_WIDE_UNDO_SLOT_BITS) - 1;
+
+		i = 0;
+		slotword_p = slotwords;
+		while (i < num_tids)
+		{
+			uint64		slotword = *(slotword_p++);
+
+			for (int j = 0; j < ZSBT_SLOTNOS_PER_WORD(num_slots) && i < num_tids; j++)
+			{
+				slotnos[i++] = slotword & widemask;
+				slotword >>= ZSBT_WIDE_UNDO_SLOT_BITS;
+			}
+		}
+		return;
+	}
+
 	i = 0;
 	slotword_p = slotwords;
 	while (i < num_tids)
@@ -708,7 +1172,7 @@ slotwords_to_slotnos(uint64 *slotwords, int num_tids, uint8 *slotnos)
 		 * unrolled version of the loop below
 		 */
 		j = 0;
-		while (j < ZSBT_SLOTNOS_PER_WORD && num_tids - i > 3)
+		while (j < ZSBT_SLOTNOS_PER_WORD(num_slots) && num_tids - i > 3)
 		{
 			slotnos[i] = slotword & mask;
 			slotnos[i + 1] = (slotword >> 2) & mask;
@@ -719,7 +1183,7 @@ slotwords_to_slotnos(uint64 *slotwords, int num_tids, uint8 *slotnos)
 			j += 4;
 		}
 		/* handle the 0-3 elements at the end */
-		while (j < ZSBT_SLOTNOS_PER_WORD && num_tids - i > 0)
+		while (j < ZSBT_SLOTNOS_PER_WORD(num_slots) && num_tids - i > 0)
 		{
 			slotnos[i] = slotword & mask;
 			slotword = slotword >> 2;
@@ -729,6 +1193,31 @@ slotwords_to_slotnos(uint64 *slotwords, int num_tids, uint8 *slotnos)
 	}
 }
 
+/*
+ * Pack an array of slot numbers into slotwords, using the slot number width
+ * for an item with 'num_slots' UNDO slots. The inverse of
+ * slotwords_to_slotnos().
+ */
+static void
+slotnos_to_slotwords(uint8 *slotnos, int num_tids, int num_slots, uint64 *slotwords)
+{
+	int			bits = ZSBT_UNDO_SLOT_BITS(num_slots);
+	int			per_word = ZSBT_SLOTNOS_PER_WORD(num_slots);
+	int			idx = 0;
+
+	while (idx < num_tids)
+	{
+		uint64		slotword = 0;
+
+		for (int j = 0; j < per_word && idx < num_tids; j++)
+		{
+			Assert(slotnos[idx] < num_slots);
+			slotword |= (uint64) slotnos[idx++] << (j * bits);
+		}
+		*(slotwords++) = slotword;
+	}
+}
+
 /*
  * Remap undo slots.
  *
@@ -852,8 +1341,6 @@ build_item(zstid *tids, uint64 *deltas, uint8 *slotnos, int num_tids,
 	ZSUndoRecPtr *newitem_slots;
 	uint64	   *newitem_slotwords;
 	uint64	   *newitem_codewords;
-	uint64	   *dst_slotword;
-	int			idx;
 
 	/*
 	 * Create codewords.
@@ -894,18 +1381,7 @@ build_item(zstid *tids, uint64 *deltas, uint8 *slotnos, int num_tids,
 		newitem_slots[i - ZSBT_FIRST_NORMAL_UNDO_SLOT] = slots[i];
 
 	/* Create slotwords */
-	dst_slotword = newitem_slotwords;
-	idx = 0;
-	while (idx < num_encoded)
-	{
-		uint64		slotword = 0;
-
-		for (int j = 0; j < ZSBT_SLOTNOS_PER_WORD && idx < num_encoded; j++)
-			slotword |= (uint64) slotnos[idx++] << (j * ZSBT_ITEM_UNDO_SLOT_BITS);
-
-		*(dst_slotword++) = slotword;
-	}
-	Assert(dst_slotword == newitem_slotwords + ZSBT_NUM_SLOTWORDS(num_tids));
+	slotnos_to_slotwords(slotnos, num_encoded, num_slots, newitem_slotwords);
 
 	return newitem;
 }
@@ -26,16 +26,20 @@
  */
 #include "postgres.h"
 
+#include "access/xact.h"
+#include "access/xlog.h"
 #include "access/xlogutils.h"
 #include "access/zedstore_internal.h"
+#include "access/zedstore_stats.h"
 #include "access/zedstore_undorec.h"
 #include "access/zedstore_wal.h"
-#include "lib/integerset.h"
 #include "miscadmin.h"
+#include "storage/backendid.h"
 #include "storage/bufmgr.h"
 #include "storage/predicate.h"
 #include "storage/procarray.h"
 #include "utils/memutils.h"
+#include "utils/snapmgr.h"
 #include "utils/rel.h"
 
 
@@ -57,9 +61,35 @@ static zstid zsbt_tid_update_insert_new(Relation rel, TransactionId xid, Command
 static bool zsbt_tid_mark_old_updated(Relation rel, zstid otid, zstid newtid,
 									  TransactionId xid, CommandId cid, bool key_update, ZSUndoRecPtr prevrecptr);
 static OffsetNumber zsbt_binsrch_tidpage(zstid key, Page page);
+static Buffer zsbt_tid_find_lane(Relation rel, int nlanes, int ntuples,
+								 zstid *tid_p, OffsetNumber *prevoff_p);
+static void zsbt_tid_merge_underfull(Relation rel, zstid key);
 static void zsbt_wal_log_tidleaf_items(Relation rel, Buffer buf,
 									   OffsetNumber off, bool replace, List *items,
 									   zs_pending_undo_op *undo_op);
+static zstid zsbt_tid_insert_internal(Relation rel, int ntuples,
+									  TransactionId xid, CommandId cid,
+									  uint32 speculative_token, ZSUndoRecPtr prevundoptr,
+									  ZSUndoRecPtr *undoptr_p);
+
+/*
+ * The most recent speculative insertion in this backend. An INSERT ... ON
+ * CONFLICT inserts a row speculatively, inserts the index entries, and then
+ * completes the insertion, one row at a time. To complete it, the speculative
+ * token in the row's UNDO record is cleared. Remembering where the record is
+ * saves a descent of the TID tree, and an exclusive lock on the leaf, for
+ * each row.
+ *
+ * The record can't be discarded while the inserting transaction is still in
+ * progress, so the entry is valid as long as the XID matches.
+ */
+static struct
+{
+	Oid			relid;
+	zstid		tid;
+	TransactionId xid;
+	ZSUndoRecPtr undoptr;
+} last_speculative_insert;
 
 /* ----------------------------------------------------------------
  *						 Public interface
@@ -81,12 +111,18 @@ zsbt_tid_begin_scan(Relation rel, zstid starttid,
 	scan->currtid = starttid - 1;
 	memset(&scan->recent_oldest_undo, 0, sizeof(scan->recent_oldest_undo));
 	memset(&scan->array_iter, 0, sizeof(scan->array_iter));
+	memset(scan->visi_memo, 0, sizeof(scan->visi_memo));
 	scan->array_iter.context = CurrentMemoryContext;
 	scan->array_curr_idx = -1;
 
 	scan->active = true;
 	scan->lastbuf = InvalidBuffer;
 	scan->lastoff = InvalidOffsetNumber;
+	scan->strategy = NULL;
+	scan->prefetch = false;
+	scan->prefetch_trigger = InvalidZSTid;
+	scan->undo_lookups = 0;
+	scan->num_prunable = 0;
 
 	scan->recent_oldest_undo = zsundo_get_oldest_undo_ptr(rel, true);
 }
@@ -112,6 +148,9 @@ zsbt_tid_end_scan(ZSTidTreeScan *scan)
 	if (scan->lastbuf != InvalidBuffer)
 		ReleaseBuffer(scan->lastbuf);
 
+	if (scan->undo_lookups > 0)
+		zs_stats_count_undo_scan(scan->rel);
+
 	scan->active = false;
 	scan->array_iter.num_tids = 0;
 	scan->array_curr_idx = -1;
@@ -122,14 +161,291 @@ zsbt_tid_end_scan(ZSTidTreeScan *scan)
 		pfree(scan->array_iter.tid_undoslotnos);
 }
 
+/*
+ * Check the visibility of an UNDO pointer, like zs_SatisfiesVisibility(), but
+ * using and maintaining the scan's memo of recently seen UNDO pointers.
+ *
+ * The memo is only used for MVCC snapshots, whose answer for a given UNDO
+ * record doesn't change during the scan. Results are not memoized once the
+ * scanning transaction has an XID, because the visibility of its own
+ * changes could still change, if a subtransaction aborts.
+ */
+static bool
+zsbt_tid_scan_check_visibility(ZSTidTreeScan *scan, ZSUndoRecPtr undoptr,
+							   TransactionId *obsoleting_xid,
+							   ZSUndoSlotVisibility *visi_info)
+{
+	ZSUndoVisibilityMemo *memo;
+	bool		visible;
+
+	if (scan->snapshot->snapshot_type != SNAPSHOT_MVCC ||
+		undoptr.counter < scan->recent_oldest_undo.counter)
+		return zs_SatisfiesVisibility(scan, undoptr, obsoleting_xid, NULL, visi_info);
+
+	memo = &scan->visi_memo[undoptr.counter % ZS_VISIBILITY_MEMO_SIZE];
+	if (ZSUndoRecPtrEquals(memo->undoptr, undoptr))
+	{
+		*obsoleting_xid = memo->obsoleting_xid;
+		*visi_info = memo->visi_info;
+		return memo->visible;
+	}
+
+	visible = zs_SatisfiesVisibility(scan, undoptr, obsoleting_xid, NULL, visi_info);
+
+	if (!TransactionIdIsValid(GetCurrentTransactionIdIfAny()))
+	{
+		memo->undoptr = undoptr;
+		memo->visible = visible;
+		memo->obsoleting_xid = *obsoleting_xid;
+		memo->visi_info = *visi_info;
+	}
+
+	return visible;
+}
+
+/*
+ * Prefetch the UNDO pages that the visibility checks on an array item's UNDO
+ * slots are going to read.
+ *
+ * zsundo_fetch() reads the UNDO pages one at a time, as the visibility
+ * checks walk the slots. After a restart, the UNDO pages are usually not in
+ * the buffer cache, and can be scattered around the file, so issue the
+ * reads for all the distinct pages up front. With only one page to read,
+ * prefetching would gain nothing.
+ */
+static void
+zsbt_tid_scan_prefetch_undo(ZSTidTreeScan *scan, ZSTidArrayItem *aitem)
+{
+#ifdef USE_PREFETCH
+	BlockNumber blocks[ZSBT_MAX_ITEM_UNDO_SLOTS];
+	int			nblocks = 0;
+
+	for (int i = ZSBT_FIRST_NORMAL_UNDO_SLOT; i < aitem->t_num_undo_slots; i++)
+	{
+		ZSUndoRecPtr undoptr = scan->array_iter.undoslots[i];
+		ZSUndoVisibilityMemo *memo;
+		bool		found;
+
+		if (undoptr.counter < scan->recent_oldest_undo.counter)
+			continue;
+
+		/* no need to read the page, if the result is memoized */
+		memo = &scan->visi_memo[undoptr.counter % ZS_VISIBILITY_MEMO_SIZE];
+		if (ZSUndoRecPtrEquals(memo->undoptr, undoptr))
+			continue;
+
+		found = false;
+		for (int j = 0; j < nblocks; j++)
+		{
+			if (blocks[j] == undoptr.blkno)
+			{
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			blocks[nblocks++] = undoptr.blkno;
+	}
+
+	if (nblocks > 1)
+	{
+		for (int j = 0; j < nblocks; j++)
+			PrefetchBuffer(scan->rel, MAIN_FORKNUM, blocks[j]);
+	}
+#endif
+}
+
+/*
+ * Return the largest UNDO counter stored in an item's UNDO slots, or 0 if it
+ * has none.
+ */
+static uint64
+zsbt_tid_item_max_undo_counter(ZSTidArrayItem *item)
+{
+	uint64	   *codewords;
+	ZSUndoRecPtr *slots;
+	uint64	   *slotwords;
+	uint64		result = 0;
+
+	ZSTidArrayItemDecode(item, &codewords, &slots, &slotwords);
+	for (int i = 0; i < item->t_num_undo_slots - ZSBT_FIRST_NORMAL_UNDO_SLOT; i++)
+		result = Max(result, slots[i].counter);
+
+	return result;
+}
+
+/*
+ * Update the UNDO synopsis of a TID leaf page, after adding 'item' to it.
+ *
+ * This must be called for every item added to a page with the
+ * ZSBT_TID_UNDO_SYNOPSIS flag, or the flag must be cleared.
+ */
+static void
+zsbt_tid_page_note_item(Page page, ZSTidArrayItem *item)
+{
+	ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+	int64		counter;
+
+	if ((opaque->zs_flags & ZSBT_TID_UNDO_SYNOPSIS) == 0)
+		return;
+
+	counter = (int64) zsbt_tid_item_max_undo_counter(item);
+	if (counter > opaque->zs_maxval)
+		opaque->zs_maxval = counter;
+}
+
+/*
+ * Are all the UNDO pointers on a TID leaf page older than
+ * 'recent_oldest_undo'? If so, every TID on it that's not dead is visible
+ * to everyone, without looking at the UNDO log.
+ */
+static bool
+zsbt_tid_page_all_visible(Page page, ZSUndoRecPtr recent_oldest_undo)
+{
+	ZSBtreePageOpaque *opaque = ZSBtreePageGetOpaque(page);
+
+	return (opaque->zs_flags & ZSBT_TID_UNDO_SYNOPSIS) != 0 &&
+		(uint64) opaque->zs_maxval < recent_oldest_undo.counter;
+}
+
+/*
+ * Remember an UNDO pointer whose TIDs can be marked dead, if it's for a
+ * deletion that's visible to everyone.
+ *
+ * Dead TIDs are cheaper to scan than deleted ones, as they don't need an
+ * UNDO lookup, and whole items of them are skipped. Normally they are
+ * marked dead only when the UNDO log is discarded, which doesn't happen
+ * until VACUUM. An MVCC scan that sees a deletion by a transaction older
+ * than the xmin horizon knows that no one can see the row anymore, so it
+ * can do the same, like heap pruning. The TIDs stay in the tree, because
+ * indexes still point to them, and VACUUM removes them as usual.
+ *
+ * 'xmax' is the deleting transaction, as reported by zs_SatisfiesMVCC().
+ */
+static void
+zsbt_tid_scan_note_prunable(ZSTidTreeScan *scan, ZSUndoRecPtr undoptr,
+							TransactionId xmax)
+{
+	if (scan->snapshot->snapshot_type != SNAPSHOT_MVCC ||
+		!TransactionIdIsNormal(xmax) ||
+		!TransactionIdPrecedes(xmax, zsundo_xmin_horizon(scan->rel)))
+		return;
+
+	for (int i = 0; i < scan->num_prunable; i++)
+	{
+		if (scan->prunable[i].counter == undoptr.counter)
+			return;
+	}
+	if (scan->num_prunable < ZS_MAX_PRUNABLE_UNDOPTRS)
+		scan->prunable[scan->num_prunable++] = undoptr;
+}
+
+/*
+ * Mark the TIDs on a TID leaf that point to the UNDO records collected by
+ * zsbt_tid_scan_note_prunable() as dead.
+ *
+ * 'buf' is the page the scan just finished with. It's pinned, but not locked.
+ * This is only an optimization, so if someone else is holding a lock on the
+ * page, don't wait.
+ */
+static void
+zsbt_tid_prune_page(ZSTidTreeScan *scan, Buffer buf)
+{
+	Relation	rel = scan->rel;
+	Page		page;
+	ZSBtreePageOpaque *opaque;
+	OffsetNumber maxoff;
+
+	if (RecoveryInProgress() || !ConditionalLockBuffer(buf))
+	{
+		scan->num_prunable = 0;
+		return;
+	}
+
+	/* The page might've been split, merged or recycled in the meanwhile */
+	page = BufferGetPage(buf);
+	opaque = ZSBtreePageGetOpaque(page);
+	if (PageIsNew(page) ||
+		opaque->zs_page_id != ZS_BTREE_PAGE_ID ||
+		opaque->zs_attno != ZS_META_ATTRIBUTE_NUM ||
+		opaque->zs_level != 0)
+	{
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+		scan->num_prunable = 0;
+		return;
+	}
+
+	maxoff = PageGetMaxOffsetNumber(page);
+	for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+	{
+		ItemId		iid = PageGetItemId(page, off);
+		ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
+		ZSTidArrayItem *newitem = NULL;
+		uint64	   *codewords;
+		ZSUndoRecPtr *slots;
+		uint64	   *slotwords;
+
+		ZSTidArrayItemDecode(item, &codewords, &slots, &slotwords);
+
+		/* scan backwards, so that killing a slot doesn't renumber the rest */
+		for (int slotno = item->t_num_undo_slots - 1;
+			 slotno >= ZSBT_FIRST_NORMAL_UNDO_SLOT; slotno--)
+		{
+			ZSUndoRecPtr undoptr = slots[slotno - ZSBT_FIRST_NORMAL_UNDO_SLOT];
+
+			for (int i = 0; i < scan->num_prunable; i++)
+			{
+				if (scan->prunable[i].counter == undoptr.counter)
+				{
+					ZSTidArrayItem *killed;
+
+					killed = zsbt_tid_item_kill_slot(newitem ? newitem : item, slotno);
+					if (newitem)
+						pfree(newitem);
+					newitem = killed;
+					break;
+				}
+			}
+		}
+		if (newitem == NULL)
+			continue;
+
+		START_CRIT_SECTION();
+
+		if (!PageIndexTupleOverwrite(page, off, (Item) newitem, newitem->t_size))
+			elog(ERROR, "could not replace item in TID tree page at off %d", off);
+		MarkBufferDirty(buf);
+
+		if (zs_relation_needs_wal(rel))
+		{
+			List	   *newitems = list_make1(newitem);
+
+			zsbt_wal_log_tidleaf_items(rel, buf, off, true, newitems, NULL);
+			list_free(newitems);
+		}
+
+		END_CRIT_SECTION();
+
+		pfree(newitem);
+	}
+
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+	scan->num_prunable = 0;
+}
+
 /*
  * Helper function of zsbt_tid_scan_next_array(), to extract Datums from the given
  * array item into the scan->array_* fields.
+ *
+ * If 'all_visible' is true, the caller has determined that all the UNDO
+ * pointers in the item are older than the scan's recent_oldest_undo, and
+ * the visibility checks are skipped.
  */
 static void
-zsbt_tid_scan_extract_array(ZSTidTreeScan *scan, ZSTidArrayItem *aitem)
+zsbt_tid_scan_extract_array(ZSTidTreeScan *scan, ZSTidArrayItem *aitem,
+							bool all_visible)
 {
-	bool		slots_visible[4];
+	bool		slots_visible[ZSBT_MAX_ITEM_UNDO_SLOTS];
 	int			first;
 	int			last;
 	int			num_visible_tids;
@@ -145,6 +461,9 @@ zsbt_tid_scan_extract_array(ZSTidTreeScan *scan, ZSTidArrayItem *aitem)
 
 	scan->array_iter.undoslot_visibility[ZSBT_DEAD_UNDO_SLOT] = InvalidUndoSlotVisibility;
 
+	if (!all_visible)
+		zsbt_tid_scan_prefetch_undo(scan, aitem);
+
 	for (int i = 2; i < aitem->t_num_undo_slots; i++)
 	{
 		ZSUndoRecPtr undoptr = scan->array_iter.undoslots[i];
@@ -152,10 +471,23 @@ zsbt_tid_scan_extract_array(ZSTidTreeScan *scan, ZSTidArrayItem *aitem)
 
 		scan->array_iter.undoslot_visibility[i] = InvalidUndoSlotVisibility;
 
-		slots_visible[i] = zs_SatisfiesVisibility(scan, undoptr, &obsoleting_xid,
-												  NULL, &scan->array_iter.undoslot_visibility[i]);
+		if (all_visible)
+		{
+			/* same as what zs_SatisfiesVisibility() returns for old pointers */
+			Assert(undoptr.counter < scan->recent_oldest_undo.counter);
+			scan->array_iter.undoslot_visibility[i].xmin = FrozenTransactionId;
+			slots_visible[i] = true;
+			continue;
+		}
+
+		slots_visible[i] = zsbt_tid_scan_check_visibility(scan, undoptr, &obsoleting_xid,
+														 &scan->array_iter.undoslot_visibility[i]);
 		if (scan->serializable && TransactionIdIsValid(obsoleting_xid))
 			CheckForSerializableConflictOut(scan->rel, obsoleting_xid, scan->snapshot);
+
+		if (!slots_visible[i])
+			zsbt_tid_scan_note_prunable(scan, undoptr,
+										scan->array_iter.undoslot_visibility[i].xmax);
 	}
 
 	/*
@@ -238,15 +570,24 @@ zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direc
 		OffsetNumber maxoff;
 		OffsetNumber off;
 		BlockNumber	next;
+		bool		all_visible;
+
+		/* Keep the read-ahead going, for a sequential scan */
+		if (scan->prefetch && nexttid >= scan->prefetch_trigger)
+			scan->prefetch_trigger = zsbt_prefetch_leaves(scan->rel, ZS_META_ATTRIBUTE_NUM,
+														  nexttid);
 
 		/*
 		 * Find and lock the leaf page containing nexttid.
 		 */
 		buf = zsbt_find_and_lock_leaf_containing_tid(scan->rel, ZS_META_ATTRIBUTE_NUM,
 													 scan->lastbuf, nexttid,
-													 BUFFER_LOCK_SHARE);
+													 BUFFER_LOCK_SHARE, scan->strategy);
 		if (buf != scan->lastbuf)
+		{
 			scan->lastoff = InvalidOffsetNumber;
+			scan->num_prunable = 0;
+		}
 		scan->lastbuf = buf;
 		if (!BufferIsValid(buf))
 		{
@@ -261,6 +602,8 @@ zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direc
 		opaque = ZSBtreePageGetOpaque(page);
 		Assert(opaque->zs_page_id == ZS_BTREE_PAGE_ID);
 
+		all_visible = zsbt_tid_page_all_visible(page, scan->recent_oldest_undo);
+
 		/*
 		 * Scan the items on the page, to find the next one that covers
 		 * nexttid.
@@ -295,7 +638,14 @@ zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direc
 					break;
 				}
 
-				zsbt_tid_scan_extract_array(scan, item);
+				/* None of the TIDs can be visible, if they're all dead */
+				if (zsbt_tid_item_is_all_dead(item))
+				{
+					nexttid = item->t_endtid;
+					continue;
+				}
+
+				zsbt_tid_scan_extract_array(scan, item, all_visible);
 
 				if (scan->array_iter.num_tids > 0)
 				{
@@ -314,13 +664,18 @@ zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direc
 			next = opaque->zs_next;
 			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 
+			if (scan->num_prunable > 0)
+				zsbt_tid_prune_page(scan, buf);
+
 			if (next == InvalidBlockNumber || nexttid >= scan->endtid)
 			{
 				/* reached end of scan */
 				break;
 			}
 
-			scan->lastbuf = ReleaseAndReadBuffer(scan->lastbuf, scan->rel, next);
+			ReleaseBuffer(scan->lastbuf);
+			scan->lastbuf = ReadBufferExtended(scan->rel, MAIN_FORKNUM, next,
+											   RBM_NORMAL, scan->strategy);
 		}
 		else
 		{
@@ -339,7 +694,13 @@ zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direc
 					break;
 				}
 
-				zsbt_tid_scan_extract_array(scan, item);
+				if (zsbt_tid_item_is_all_dead(item))
+				{
+					nexttid = item->t_firsttid - 1;
+					continue;
+				}
+
+				zsbt_tid_scan_extract_array(scan, item, all_visible);
 
 				if (scan->array_iter.num_tids > 0)
 				{
@@ -356,12 +717,20 @@ zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direc
 			if (nexttid >= opaque->zs_lokey)
 				nexttid = opaque->zs_lokey - 1;
 			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+			if (scan->num_prunable > 0)
+				zsbt_tid_prune_page(scan, buf);
 			if (nexttid < scan->starttid)
 			{
 				/* reached end of scan */
 				break;
 			}
-			scan->lastbuf = InvalidBuffer;
+
+			/*
+			 * Keep the pin on scan->lastbuf. The next
+			 * zsbt_find_and_lock_leaf_containing_tid() call sees that it
+			 * doesn't cover nexttid, releases it, and descends the tree.
+			 */
 		}
 	}
 
@@ -375,6 +744,25 @@ zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direc
 	return false;
 }
 
+/*
+ * Count the TIDs on a TID leaf page, and the size of the TID ranges covered
+ * by its items. For the statistics gathered by zsbt_gather_tree_stats().
+ */
+void
+zsbt_tid_page_tid_stats(Page page, uint64 *ntids, uint64 *span)
+{
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+
+	for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+	{
+		ItemId		iid = PageGetItemId(page, off);
+		ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
+
+		*ntids += item->t_num_tids;
+		*span += item->t_endtid - item->t_firsttid;
+	}
+}
+
 /*
  * Get the first tid in the tree.
  */
@@ -464,6 +852,288 @@ zsbt_get_last_tid(Relation rel)
 	return tid;
 }
 
+/*
+ * Count the TIDs that are visible to 'snapshot'.
+ *
+ * This is the fast path for count(*). Unlike a scan, it doesn't decode the
+ * TIDs of the items at all. The visibility of each of an item's UNDO slots
+ * is checked once, and the number of TIDs pointing to each slot is counted
+ * from the slotwords. Slots older than the oldest UNDO record, and all the
+ * items on pages whose UNDO synopsis says they're all-visible, don't need
+ * a visibility check at all, only the dead TIDs are subtracted.
+ *
+ * The caller is responsible for predicate locking the relation.
+ */
+uint64
+zsbt_tid_count_visible(Relation rel, Snapshot snapshot,
+					   BufferAccessStrategy strategy)
+{
+	ZSTidTreeScan scan;
+	uint64		result = 0;
+	zstid		nexttid = MinZSTid;
+	Buffer		buf = InvalidBuffer;
+
+	zsbt_tid_begin_scan(rel, MinZSTid, MaxPlusOneZSTid, snapshot, &scan);
+	scan.serializable = true;
+
+	for (;;)
+	{
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		OffsetNumber maxoff;
+		bool		all_visible;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (nexttid >= scan.prefetch_trigger)
+			scan.prefetch_trigger = zsbt_prefetch_leaves(rel, ZS_META_ATTRIBUTE_NUM,
+														 nexttid);
+
+		buf = zsbt_find_and_lock_leaf_containing_tid(rel, ZS_META_ATTRIBUTE_NUM,
+													 buf, nexttid,
+													 BUFFER_LOCK_SHARE, strategy);
+		if (!BufferIsValid(buf))
+			break;
+		page = BufferGetPage(buf);
+		opaque = ZSBtreePageGetOpaque(page);
+		all_visible = zsbt_tid_page_all_visible(page, scan.recent_oldest_undo);
+
+		maxoff = PageGetMaxOffsetNumber(page);
+		for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+		{
+			ItemId		iid = PageGetItemId(page, off);
+			ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
+			bool		slots_visible[ZSBT_MAX_ITEM_UNDO_SLOTS];
+			int			counts[ZSBT_MAX_ITEM_UNDO_SLOTS];
+			uint64	   *codewords;
+			ZSUndoRecPtr *slots;
+			uint64	   *slotwords;
+
+			/* already counted, if the page was merged with its left sibling */
+			if (item->t_endtid <= nexttid)
+				continue;
+
+			ZSTidArrayItemDecode(item, &codewords, &slots, &slotwords);
+
+			slots_visible[ZSBT_OLD_UNDO_SLOT] = true;
+			slots_visible[ZSBT_DEAD_UNDO_SLOT] = false;
+			for (int i = ZSBT_FIRST_NORMAL_UNDO_SLOT; i < item->t_num_undo_slots; i++)
+			{
+				ZSUndoRecPtr undoptr = slots[i - ZSBT_FIRST_NORMAL_UNDO_SLOT];
+				TransactionId obsoleting_xid;
+				ZSUndoSlotVisibility visi_info;
+
+				if (all_visible || undoptr.counter < scan.recent_oldest_undo.counter)
+				{
+					slots_visible[i] = true;
+					continue;
+				}
+
+				slots_visible[i] = zsbt_tid_scan_check_visibility(&scan, undoptr,
+																  &obsoleting_xid,
+																  &visi_info);
+				if (TransactionIdIsValid(obsoleting_xid))
+					CheckForSerializableConflictOut(rel, obsoleting_xid, snapshot);
+			}
+
+			if (item->t_firsttid >= nexttid)
+				zsbt_tid_item_count_slots(item, counts);
+			else
+			{
+				/*
+				 * The item straddles 'nexttid'. That can only happen if
+				 * leaves were merged and their items recompressed after we
+				 * moved on from the left one. Count only the TIDs we haven't
+				 * seen yet.
+				 */
+				zsbt_tid_item_unpack(item, &scan.array_iter);
+				memset(counts, 0, sizeof(counts));
+				for (int i = 0; i < scan.array_iter.num_tids; i++)
+				{
+					if (scan.array_iter.tids[i] >= nexttid)
+						counts[scan.array_iter.tid_undoslotnos[i]]++;
+				}
+			}
+
+			for (int i = 0; i < item->t_num_undo_slots; i++)
+			{
+				if (slots_visible[i])
+					result += counts[i];
+			}
+		}
+
+		nexttid = opaque->zs_hikey;
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+		if (nexttid >= MaxPlusOneZSTid)
+			break;
+	}
+
+	if (BufferIsValid(buf))
+		ReleaseBuffer(buf);
+	zsbt_tid_end_scan(&scan);
+
+	return result;
+}
+
+/*
+ * Size of one insertion lane, in TIDs. See zsbt_tid_find_lane().
+ */
+#define ZSBT_INSERT_LANE_SIZE	((zstid) 1 << 20)
+
+/*
+ * Find a place to insert 'ntuples' new TIDs in this backend's insertion lane.
+ *
+ * Normally, all new TIDs are allocated at the end of the TID space, which
+ * makes the rightmost leaf of the TID tree, and of each attribute tree, a
+ * point of contention when many backends insert concurrently. With the
+ * zedstore_insert_lanes reloption, the TID space is divided into groups of
+ * 'nlanes' lanes of ZSBT_INSERT_LANE_SIZE TIDs each, and each backend
+ * allocates TIDs from the lane matching its backend ID, within the group it
+ * last used. The lanes start out on the same leaf, but every split of a leaf
+ * holding several lanes separates them, until each busy lane has its own
+ * leaf. When a backend's lane fills up, it moves on to the next group.
+ *
+ * The group is remembered in the metapage cache, so this is all backend-local
+ * state. Correctness doesn't depend on backends agreeing on it: the new TIDs
+ * are always placed after any existing item that starts below the end of the
+ * lane, on the leaf that covers the end of the lane, so they cannot collide
+ * with TIDs allocated by anyone else, even with a different 'nlanes'.
+ *
+ * On success, returns the exclusively-locked leaf, sets *tid_p to the first
+ * new TID, and *prevoff_p to the offset of the item that the new TIDs go
+ * after, or InvalidOffsetNumber if they go first on the page. Returns
+ * InvalidBuffer if the lanes would run past the end of the TID space, and
+ * the caller should fall back to appending at the end.
+ */
+static Buffer
+zsbt_tid_find_lane(Relation rel, int nlanes, int ntuples,
+				   zstid *tid_p, OffsetNumber *prevoff_p)
+{
+	ZSMetaCacheData *metacache;
+	zstid		group_size = (zstid) nlanes * ZSBT_INSERT_LANE_SIZE;
+	int			lane;
+	uint64		group;
+
+	Assert(ntuples <= ZSBT_INSERT_LANE_SIZE);
+
+	lane = (MyBackendId == InvalidBackendId) ? 0 : MyBackendId % nlanes;
+
+	metacache = zsmeta_get_cache(rel);
+	if (metacache->cache_lane_nlanes != nlanes)
+	{
+		/* Start from the group at the current end of the TID space */
+		group = zsbt_get_last_tid(rel) / group_size;
+	}
+	else
+		group = metacache->cache_lane_group;
+
+	for (;;)
+	{
+		zstid		lane_start;
+		zstid		lane_end;
+		Buffer		buf;
+		Page		page;
+		ZSBtreePageOpaque *opaque;
+		OffsetNumber prevoff;
+		zstid		tid;
+
+		lane_start = group * group_size + lane * ZSBT_INSERT_LANE_SIZE;
+		lane_end = lane_start + ZSBT_INSERT_LANE_SIZE;
+		/* Don't go past the last TID that can be represented as an ItemPointer */
+		if (lane_end > ZSTidFromBlkOff(MaxBlockNumber, MaxZSTidOffsetNumber - 1))
+			return InvalidBuffer;
+
+		buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, lane_end - 1, 0, false);
+		page = BufferGetPage(buf);
+		opaque = ZSBtreePageGetOpaque(page);
+
+		/* The new TIDs go after the last item that starts within or below the lane */
+		tid = Max(lane_start, opaque->zs_lokey);
+		prevoff = zsbt_binsrch_tidpage(lane_end - 1, page);
+		if (prevoff != InvalidOffsetNumber)
+		{
+			ZSTidArrayItem *previtem;
+
+			previtem = (ZSTidArrayItem *) PageGetItem(page, PageGetItemId(page, prevoff));
+			tid = Max(tid, previtem->t_endtid);
+		}
+
+		if (tid + ntuples <= lane_end)
+		{
+			/* zsbt_descend() may have reloaded the cache */
+			metacache = zsmeta_get_cache(rel);
+			metacache->cache_lane_nlanes = nlanes;
+			metacache->cache_lane_group = group;
+
+			*tid_p = tid;
+			*prevoff_p = prevoff;
+			return buf;
+		}
+
+		/* The lane is full. Move on to the next group. */
+		UnlockReleaseBuffer(buf);
+		group++;
+	}
+}
+
+/*
+ * Return the TIDs of the rows inserted last, at the points where new rows
+ * are appended to the TID space: the end of the TID space, and with
+ * insertion lanes, the end of the used part of each lane in the group at
+ * the end. The data of the most recent inserts is on the attribute leaves
+ * containing these TIDs. 'points' must have room for
+ * ZSBT_MAX_APPEND_POINTS entries. Returns the number of points.
+ */
+int
+zsbt_tid_get_append_points(Relation rel, zstid *points)
+{
+	int			nlanes = RelationGetZedstoreInsertLanes(rel);
+	zstid		lasttid;
+	int			npoints = 0;
+
+	lasttid = zsbt_get_last_tid(rel);
+	if (lasttid > MinZSTid)
+		points[npoints++] = lasttid - 1;
+
+	if (nlanes > 1)
+	{
+		zstid		group_size = (zstid) nlanes * ZSBT_INSERT_LANE_SIZE;
+		zstid		group_start = (lasttid / group_size) * group_size;
+
+		Assert(1 + nlanes <= ZSBT_MAX_APPEND_POINTS);
+
+		for (int lane = 0; lane < nlanes; lane++)
+		{
+			zstid		lane_start = group_start + lane * ZSBT_INSERT_LANE_SIZE;
+			zstid		lane_end = lane_start + ZSBT_INSERT_LANE_SIZE;
+			Buffer		buf;
+			Page		page;
+			OffsetNumber off;
+
+			/* the lane at the end of the TID space was covered above */
+			if (lane_end > lasttid)
+				break;
+
+			buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, lane_end - 1, 0, true);
+			if (!BufferIsValid(buf))
+				break;
+			page = BufferGetPage(buf);
+			off = zsbt_binsrch_tidpage(lane_end - 1, page);
+			if (off != InvalidOffsetNumber)
+			{
+				ZSTidArrayItem *item;
+
+				item = (ZSTidArrayItem *) PageGetItem(page, PageGetItemId(page, off));
+				if (item->t_endtid > lane_start)
+					points[npoints++] = Min(item->t_endtid, lane_end) - 1;
+			}
+			UnlockReleaseBuffer(buf);
+		}
+	}
+
+	return npoints;
+}
+
 /*
  * Insert a multiple TIDs.
  *
@@ -477,83 +1147,299 @@ zsbt_get_last_tid(Relation rel)
 zstid
 zsbt_tid_multi_insert(Relation rel, int ntuples,
 					  TransactionId xid, CommandId cid, uint32 speculative_token, ZSUndoRecPtr prevundoptr)
+{
+	return zsbt_tid_insert_internal(rel, ntuples, xid, cid, speculative_token,
+									prevundoptr, NULL);
+}
+
+/*
+ * Insert a single TID for a speculative insertion.
+ *
+ * The location of the UNDO record is remembered, for
+ * zsbt_tid_clear_speculative_token().
+ */
+zstid
+zsbt_tid_insert_speculative(Relation rel, TransactionId xid, CommandId cid,
+							uint32 speculative_token)
+{
+	ZSUndoRecPtr undoptr;
+	zstid		tid;
+
+	Assert(speculative_token != INVALID_SPECULATIVE_TOKEN);
+	Assert(xid != FrozenTransactionId);
+
+	tid = zsbt_tid_insert_internal(rel, 1, xid, cid, speculative_token,
+								   InvalidUndoPtr, &undoptr);
+
+	last_speculative_insert.relid = RelationGetRelid(rel);
+	last_speculative_insert.tid = tid;
+	last_speculative_insert.xid = xid;
+	last_speculative_insert.undoptr = undoptr;
+
+	return tid;
+}
+
+/*
+ * Workhorse of zsbt_tid_multi_insert() and zsbt_tid_insert_speculative().
+ * If 'undoptr_p' is given, the location of the new UNDO record is returned
+ * in it.
+ */
+static zstid
+zsbt_tid_insert_internal(Relation rel, int ntuples,
+						 TransactionId xid, CommandId cid,
+						 uint32 speculative_token, ZSUndoRecPtr prevundoptr,
+						 ZSUndoRecPtr *undoptr_p)
 {
 	Buffer		buf;
 	Page		page;
-	ZSBtreePageOpaque *opaque;
 	OffsetNumber maxoff;
-	zstid		insert_target_key;
+	OffsetNumber prevoff;
+	int			nlanes;
 	List	   *newitems;
 	zs_pending_undo_op *undo_op;
-	zstid		endtid;
 	zstid		tid;
 	ZSTidArrayItem *lastitem;
 	bool		modified_orig;
 
 	/*
-	 * Insert to the rightmost leaf.
+	 * Insert to this backend's insertion lane, if the table has them, or to
+	 * the end of the rightmost leaf.
 	 *
 	 * TODO: use a Free Space Map to find suitable target.
 	 */
-	insert_target_key = MaxZSTid;
-	buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, insert_target_key, 0, false);
+	buf = InvalidBuffer;
+	nlanes = RelationGetZedstoreInsertLanes(rel);
+	if (nlanes > 1 && ntuples <= ZSBT_INSERT_LANE_SIZE)
+		buf = zsbt_tid_find_lane(rel, nlanes, ntuples, &tid, &prevoff);
+
+	if (!BufferIsValid(buf))
+	{
+		buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, MaxZSTid, 0, false);
+		page = BufferGetPage(buf);
+		prevoff = PageGetMaxOffsetNumber(page);
+
+		/*
+		 * Look at the last item, for its tid.
+		 *
+		 * assign TIDS for each item.
+		 */
+		if (prevoff >= FirstOffsetNumber)
+		{
+			ItemId		iid = PageGetItemId(page, prevoff);
+
+			tid = ((ZSTidArrayItem *) PageGetItem(page, iid))->t_endtid;
+		}
+		else
+			tid = ZSBtreePageGetOpaque(page)->zs_lokey;
+	}
 	page = BufferGetPage(buf);
-	opaque = ZSBtreePageGetOpaque(page);
 	maxoff = PageGetMaxOffsetNumber(page);
 
+	if (prevoff != InvalidOffsetNumber)
+		lastitem = (ZSTidArrayItem *) PageGetItem(page, PageGetItemId(page, prevoff));
+	else
+		lastitem = NULL;
+
+	/* Form an undo record */
+	if (xid != FrozenTransactionId)
+	{
+		undo_op = zsundo_create_for_insert(rel, xid, cid, tid, ntuples,
+										   speculative_token, prevundoptr);
+	}
+	else
+	{
+		undo_op = NULL;
+	}
+	if (undoptr_p)
+		*undoptr_p = undo_op ? undo_op->reservation.undorecptr : InvalidUndoPtr;
+
 	/*
-	 * Look at the last item, for its tid.
+	 * Create an item to represent all the TIDs, merging with the preceding
+	 * existing item if possible.
+	 */
+	newitems = zsbt_tid_item_add_tids(lastitem, tid, ntuples, undo_op ? undo_op->reservation.undorecptr : InvalidUndoPtr,
+									  &modified_orig);
+
+	/*
+	 * Replace the original preceding item with the new items, or add new
+	 * items. This splits the page if necessary.
 	 *
-	 * assign TIDS for each item.
+	 * If the new items go in the middle of the page, which can happen with
+	 * insertion lanes, replace the item before (or, if none, after) them
+	 * with a copy of itself and the new items.
 	 */
-	if (maxoff >= FirstOffsetNumber)
+	if (modified_orig)
+		zsbt_tid_replace_item(rel, buf, prevoff, newitems, undo_op);
+	else if (prevoff == maxoff)
+		zsbt_tid_add_items(rel, buf, newitems, undo_op);
+	else
 	{
-		ItemId		iid = PageGetItemId(page, maxoff);
+		OffsetNumber targetoff;
+		ZSTidArrayItem *origitem;
+		ZSTidArrayItem *copy;
 
-		lastitem = (ZSTidArrayItem *) PageGetItem(page, iid);
+		targetoff = (prevoff != InvalidOffsetNumber) ? prevoff : FirstOffsetNumber;
+		origitem = (ZSTidArrayItem *) PageGetItem(page, PageGetItemId(page, targetoff));
+		copy = palloc(origitem->t_size);
+		memcpy(copy, origitem, origitem->t_size);
 
-		endtid = lastitem->t_endtid;
+		if (prevoff != InvalidOffsetNumber)
+			newitems = lcons(copy, newitems);
+		else
+			newitems = lappend(newitems, copy);
+		zsbt_tid_replace_item(rel, buf, targetoff, newitems, undo_op);
 	}
-	else
+	/* zsbt_tid_replace/add_item unlocked 'buf' */
+	ReleaseBuffer(buf);
+
+	list_free_deep(newitems);
+
+	/* Return the TIDs to the caller */
+	return tid;
+}
+
+/*
+ * Bulk loading of the TID tree.
+ *
+ * Table rewrites copy all the rows into a new table, that no one else can
+ * insert to. Inserting them one by one with zsbt_tid_multi_insert() costs a
+ * descent of the tree and a WAL record for each row, and splits the rightmost
+ * leaf over and over. Instead, the bulk loader assigns consecutive TIDs
+ * itself, and coalesces runs of rows inserted by the same transaction into
+ * ranges. The all-visible rows, usually most of them, need no UNDO records,
+ * so their items are collected until there are ZS_TID_BULK_PENDING_SIZE
+ * bytes of them, and then appended in one go. zsbt_tid_add_items() lays
+ * them out on fully packed new leaves, and WAL-logs them as whole pages.
+ * Runs of rows that need an UNDO record are written out as soon as the run
+ * ends.
+ *
+ * The caller must hold a lock that prevents any other inserts into the
+ * table, until zsbt_tid_end_bulk_insert().
+ */
+#define ZS_TID_BULK_PENDING_SIZE	(16 * BLCKSZ)
+#define ZS_TID_BULK_MAX_RUN			(64 * 1024)
+
+static void zsbt_tid_bulk_flush_run(ZSTidBulkInsertState *state);
+static void zsbt_tid_bulk_write_pending(ZSTidBulkInsertState *state);
+
+void
+zsbt_tid_begin_bulk_insert(Relation rel, ZSTidBulkInsertState *state)
+{
+	state->rel = rel;
+	state->nexttid = zsbt_get_last_tid(rel);
+	state->run_start = InvalidZSTid;
+	state->run_len = 0;
+	state->run_xid = InvalidTransactionId;
+	state->run_cid = InvalidCommandId;
+	state->pending_items = NIL;
+	state->pending_size = 0;
+}
+
+/*
+ * Allocate a TID for a new row, inserted by 'xid'/'cid'.
+ *
+ * The row isn't necessarily in the tree yet when this returns. Call
+ * zsbt_tid_bulk_flush() before doing anything else with the TID.
+ */
+zstid
+zsbt_tid_bulk_insert(ZSTidBulkInsertState *state, TransactionId xid, CommandId cid)
+{
+	if (state->run_len > 0 &&
+		(state->run_xid != xid || state->run_cid != cid ||
+		 state->run_len >= ZS_TID_BULK_MAX_RUN))
+		zsbt_tid_bulk_flush_run(state);
+
+	if (state->run_len == 0)
 	{
-		endtid = opaque->zs_lokey;
-		lastitem = NULL;
+		state->run_start = state->nexttid;
+		state->run_xid = xid;
+		state->run_cid = cid;
 	}
-	tid = endtid;
+	state->run_len++;
 
-	/* Form an undo record */
-	if (xid != FrozenTransactionId)
+	return state->nexttid++;
+}
+
+/*
+ * Write out all the TIDs allocated so far.
+ */
+void
+zsbt_tid_bulk_flush(ZSTidBulkInsertState *state)
+{
+	zsbt_tid_bulk_flush_run(state);
+	zsbt_tid_bulk_write_pending(state);
+}
+
+void
+zsbt_tid_end_bulk_insert(ZSTidBulkInsertState *state)
+{
+	zsbt_tid_bulk_flush(state);
+}
+
+static void
+zsbt_tid_bulk_flush_run(ZSTidBulkInsertState *state)
+{
+	Relation	rel = state->rel;
+	List	   *newitems;
+	ListCell   *lc;
+
+	if (state->run_len == 0)
+		return;
+
+	if (state->run_xid == FrozenTransactionId)
 	{
-		undo_op = zsundo_create_for_insert(rel, xid, cid, tid, ntuples,
-										   speculative_token, prevundoptr);
+		newitems = zsbt_tid_item_create_for_range(state->run_start, state->run_len,
+												  InvalidUndoPtr);
+		foreach(lc, newitems)
+		{
+			ZSTidArrayItem *item = (ZSTidArrayItem *) lfirst(lc);
+
+			state->pending_size += sizeof(ItemIdData) + item->t_size;
+		}
+		state->pending_items = list_concat(state->pending_items, newitems);
+
+		if (state->pending_size >= ZS_TID_BULK_PENDING_SIZE)
+			zsbt_tid_bulk_write_pending(state);
 	}
 	else
 	{
-		undo_op = NULL;
-	}
+		Buffer		buf;
+		zs_pending_undo_op *undo_op;
 
-	/*
-	 * Create an item to represent all the TIDs, merging with the last existing
-	 * item if possible.
-	 */
-	newitems = zsbt_tid_item_add_tids(lastitem, tid, ntuples, undo_op ? undo_op->reservation.undorecptr : InvalidUndoPtr,
-									  &modified_orig);
+		/* The pending items go before these */
+		zsbt_tid_bulk_write_pending(state);
 
-	/*
-	 * Replace the original last item with the new items, or add new items.
-	 * This splits the page if necessary.
-	 */
-	if(modified_orig)
-		zsbt_tid_replace_item(rel, buf, maxoff, newitems, undo_op);
-	else
+		buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, MaxZSTid, 0, false);
+		undo_op = zsundo_create_for_insert(rel, state->run_xid, state->run_cid,
+										   state->run_start, state->run_len,
+										   INVALID_SPECULATIVE_TOKEN, InvalidUndoPtr);
+		newitems = zsbt_tid_item_create_for_range(state->run_start, state->run_len,
+												  undo_op->reservation.undorecptr);
 		zsbt_tid_add_items(rel, buf, newitems, undo_op);
-	/* zsbt_tid_replace/add_item unlocked 'buf' */
-	ReleaseBuffer(buf);
+		/* zsbt_tid_add_items unlocked 'buf' */
+		ReleaseBuffer(buf);
 
-	list_free_deep(newitems);
+		list_free_deep(newitems);
+	}
+	state->run_len = 0;
+}
 
-	/* Return the TIDs to the caller */
-	return tid;
+static void
+zsbt_tid_bulk_write_pending(ZSTidBulkInsertState *state)
+{
+	Buffer		buf;
+
+	if (state->pending_items == NIL)
+		return;
+
+	buf = zsbt_descend(state->rel, ZS_META_ATTRIBUTE_NUM, MaxZSTid, 0, false);
+	zsbt_tid_add_items(state->rel, buf, state->pending_items, NULL);
+	/* zsbt_tid_add_items unlocked 'buf' */
+	ReleaseBuffer(buf);
+
+	list_free_deep(state->pending_items);
+	state->pending_items = NIL;
+	state->pending_size = 0;
 }
 
 TM_Result
@@ -889,6 +1775,80 @@ zsbt_tid_mark_old_updated(Relation rel, zstid otid, zstid newtid,
 	return true;
 }
 
+/*
+ * Mark an item as updated by 'xid', with 'newtid' as the new version,
+ * without any visibility checks.
+ *
+ * This is used when rewriting a table, to re-create the UPDATE chains of
+ * the old table in the new one. No one else can see the new table yet.
+ */
+void
+zsbt_tid_mark_updated(Relation rel, zstid otid, zstid newtid,
+					  TransactionId xid, CommandId cid, bool key_update)
+{
+	Buffer		buf;
+	ZSUndoRecPtr item_undoptr;
+	bool		item_isdead;
+	OffsetNumber off;
+
+	off = zsbt_tid_fetch(rel, otid, &buf, &item_undoptr, &item_isdead);
+	if (!OffsetNumberIsValid(off) || item_isdead)
+		elog(ERROR, "could not find old tuple to update with TID (%u, %u) in TID tree",
+			 ZSTidGetBlockNumber(otid), ZSTidGetOffsetNumber(otid));
+	UnlockReleaseBuffer(buf);
+
+	if (!zsbt_tid_mark_old_updated(rel, otid, newtid, xid, cid, key_update, item_undoptr))
+		elog(ERROR, "tuple update failed during table rewrite");
+}
+
+/*
+ * Does the current transaction already hold a lock on the row, at least as
+ * strong as 'mode', according to its latest UNDO record?
+ *
+ * That's the case if we locked or updated the row ourselves with a strong
+ * enough lock mode. Rows that we inserted ourselves are also as good as
+ * locked: no one else can modify them before we commit, and our locks are
+ * released at commit anyway. Like heap_lock_tuple(), we don't distinguish
+ * between subtransactions here.
+ */
+static bool
+zsbt_tid_lock_already_held(Relation rel, ZSUndoRecPtr undoptr,
+						   ZSUndoRecPtr recent_oldest_undo, LockTupleMode mode)
+{
+	ZSUndoRec  *undorec;
+	bool		result = false;
+
+	if (undoptr.counter < recent_oldest_undo.counter)
+		return false;
+
+	undorec = zsundo_fetch_record(rel, undoptr);
+	if (!undorec)
+		return false;
+
+	if (TransactionIdIsCurrentTransactionId(undorec->xid))
+	{
+		switch (undorec->type)
+		{
+			case ZSUNDO_TYPE_INSERT:
+				result = true;
+				break;
+			case ZSUNDO_TYPE_TUPLE_LOCK:
+				result = ((ZSUndoRec_TupleLock *) undorec)->lockmode >= mode;
+				break;
+			case ZSUNDO_TYPE_UPDATE:
+				result = (((ZSUndoRec_Update *) undorec)->key_update ?
+						  LockTupleExclusive : LockTupleNoKeyExclusive) >= mode;
+				break;
+			default:
+				result = false;
+				break;
+		}
+	}
+	pfree(undorec);
+
+	return result;
+}
+
 TM_Result
 zsbt_tid_lock(Relation rel, zstid tid, TransactionId xid, CommandId cid,
 			  LockTupleMode mode, bool follow_updates, Snapshot snapshot,
@@ -941,6 +1901,18 @@ zsbt_tid_lock(Relation rel, zstid tid, TransactionId xid, CommandId cid,
 		}
 	}
 
+	/*
+	 * If we already hold a strong enough lock, a new lock record would be
+	 * redundant. This is common with FOR KEY SHARE locks from foreign key
+	 * checks, when a transaction inserts many rows referencing the same row.
+	 */
+	if (result == TM_Ok &&
+		zsbt_tid_lock_already_held(rel, item_undoptr, recent_oldest_undo, mode))
+	{
+		UnlockReleaseBuffer(buf);
+		return TM_Ok;
+	}
+
 	/* Create UNDO record. */
 	undo_op = zsundo_create_for_tuple_lock(rel, xid, cid, tid, mode,
 										   keep_old_undo_ptr ? item_undoptr : InvalidUndoPtr);
@@ -959,22 +1931,41 @@ zsbt_tid_lock(Relation rel, zstid tid, TransactionId xid, CommandId cid,
 /*
  * Collect all TIDs marked as dead in the TID tree.
  *
- * This is used during VACUUM.
+ * This is used during VACUUM. *num_live_tuples is incremented for each TID
+ * that is not dead, and *num_all_visible_tuples for each row that is visible
+ * to all transactions, like zsbt_tid_is_all_visible() would report. The
+ * caller uses them for reltuples and relallvisible. (Rows deleted by a
+ * transaction that's not old enough for the UNDO log to be trimmed are
+ * still counted as live.)
+ *
+ * The live rows also end the spans of dead TIDs in the result, so that the
+ * caller can use zs_tidstore_covers_range() to find leaves with no live rows
+ * left. With insertion lanes, new rows can be inserted into gaps in the TID
+ * space, so gaps end the spans too. Otherwise, new TIDs are always allocated
+ * past all the existing ones.
+ *
+ * Stops at a leaf boundary once the result exceeds maintenance_work_mem.
+ * *endtid is set to the point where the caller should continue.
  */
-IntegerSet *
-zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_live_tuples)
+ZSTidStore *
+zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_live_tuples,
+					   uint64 *num_all_visible_tuples, BufferAccessStrategy strategy)
 {
+	ZSUndoRecPtr recent_oldest_undo = zsundo_get_oldest_undo_ptr(rel, false);
 	Buffer		buf = InvalidBuffer;
-	IntegerSet *result;
+	ZSTidStore *result;
 	ZSBtreePageOpaque *opaque;
 	zstid		nexttid;
 	BlockNumber	nextblock;
 	ZSTidItemIterator iter;
+	bool		has_lanes = RelationGetZedstoreInsertLanes(rel) > 1;
+	zstid		prevtid = starttid - 1;
 
 	memset(&iter, 0, sizeof(ZSTidItemIterator));
 	iter.context = CurrentMemoryContext;
 
-	result = intset_create();
+	result = zs_tidstore_create();
+	zs_tidstore_end_span(result, starttid - 1);
 
 	nexttid = starttid;
 	nextblock = InvalidBlockNumber;
@@ -986,8 +1977,10 @@ zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_
 
 		if (nextblock != InvalidBlockNumber)
 		{
-			buf = ReleaseAndReadBuffer(buf, rel, nextblock);
-			LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+			if (BufferIsValid(buf))
+				ReleaseBuffer(buf);
+			buf = ReadBufferExtended(rel, MAIN_FORKNUM, nextblock, RBM_NORMAL, strategy);
+			LockBuffer(buf, BUFFER_LOCK_SHARE);
 
 			if (!zsbt_page_is_expected(rel, ZS_META_ATTRIBUTE_NUM, nexttid, 0, buf))
 			{
@@ -998,7 +1991,8 @@ zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_
 
 		if (!BufferIsValid(buf))
 		{
-			buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, nexttid, 0, true);
+			buf = zsbt_descend_extended(rel, ZS_META_ATTRIBUTE_NUM, nexttid, 0, true,
+										strategy);
 			if (!BufferIsValid(buf))
 				return result;
 		}
@@ -1015,9 +2009,23 @@ zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_
 
 			for (int j = 0; j < iter.num_tids; j++)
 			{
+				int			slotno = iter.tid_undoslotnos[j];
+
+				if (has_lanes && iter.tids[j] != prevtid + 1)
+					zs_tidstore_end_span(result, iter.tids[j] - 1);
+				prevtid = iter.tids[j];
+
+				if (slotno == ZSBT_DEAD_UNDO_SLOT)
+				{
+					zs_tidstore_add(result, iter.tids[j]);
+					continue;
+				}
+
+				zs_tidstore_end_span(result, iter.tids[j]);
 				(*num_live_tuples)++;
-				if (iter.tid_undoslotnos[j] == ZSBT_DEAD_UNDO_SLOT)
-					intset_add_member(result, iter.tids[j]);
+				if (slotno == ZSBT_OLD_UNDO_SLOT ||
+					iter.undoslots[slotno].counter < recent_oldest_undo.counter)
+					(*num_all_visible_tuples)++;
 			}
 		}
 
@@ -1033,7 +2041,7 @@ zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_
 			break;
 		}
 
-		if (intset_memory_usage(result) > (uint64) maintenance_work_mem * 1024)
+		if (zs_tidstore_memory_usage(result) > (uint64) maintenance_work_mem * 1024)
 			break;
 	}
 
@@ -1044,6 +2052,176 @@ zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_
 	return result;
 }
 
+/*
+ * Check if the row with given TID is visible to all transactions.
+ *
+ * That's the case if the TID exists and isn't dead, and its UNDO record is
+ * older than 'recent_oldest_undo', i.e. it has already been discarded. The
+ * UNDO log itself is not consulted, so this is cheap. A stale
+ * 'recent_oldest_undo' just makes the answer more conservative.
+ *
+ * This is used by index-only scans, in place of the visibility map that
+ * zedstore doesn't have. *buf_p is a pinned TID tree leaf from a previous
+ * call, or InvalidBuffer; it is checked first, and the leaf we used is left
+ * pinned in it for the next call. 'iter' is scratch space for unpacking the
+ * item, also reused across calls.
+ */
+bool
+zsbt_tid_is_all_visible(Relation rel, zstid tid, ZSUndoRecPtr recent_oldest_undo,
+						Buffer *buf_p, ZSTidItemIterator *iter)
+{
+	Buffer		buf;
+	Page		page;
+	OffsetNumber maxoff;
+	OffsetNumber off;
+	bool		result = false;
+
+	buf = zsbt_find_and_lock_leaf_containing_tid(rel, ZS_META_ATTRIBUTE_NUM,
+												 *buf_p, tid, BUFFER_LOCK_SHARE, NULL);
+	*buf_p = buf;
+	if (!BufferIsValid(buf))
+		return false;
+	page = BufferGetPage(buf);
+	maxoff = PageGetMaxOffsetNumber(page);
+
+	/* Find the item on the page that covers the target TID */
+	off = zsbt_binsrch_tidpage(tid, page);
+	if (off >= FirstOffsetNumber && off <= maxoff)
+	{
+		ItemId		iid = PageGetItemId(page, off);
+		ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
+
+		if (tid < item->t_endtid)
+		{
+			zsbt_tid_item_unpack(item, iter);
+
+			for (int i = 0; i < iter->num_tids; i++)
+			{
+				if (iter->tids[i] == tid)
+				{
+					int			slotno = iter->tid_undoslotnos[i];
+
+					if (slotno == ZSBT_OLD_UNDO_SLOT)
+						result = true;
+					else if (slotno != ZSBT_DEAD_UNDO_SLOT)
+						result = (iter->undoslots[slotno].counter < recent_oldest_undo.counter);
+					break;
+				}
+				if (iter->tids[i] > tid)
+					break;
+			}
+		}
+	}
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+	return result;
+}
+
+/*
+ * Look up the UNDO slot of the row with given TID.
+ *
+ * Returns the slot number, and the UNDO pointer of the slot in *undoptr_p, or
+ * -1 if the TID is not in the tree. Like zsbt_tid_is_all_visible(), this keeps
+ * the leaf pinned in *buf_p, for the next call.
+ */
+int
+zsbt_tid_get_undo_slot(Relation rel, zstid tid, Buffer *buf_p,
+					   ZSUndoRecPtr *undoptr_p)
+{
+	Buffer		buf;
+	Page		page;
+	OffsetNumber maxoff;
+	OffsetNumber off;
+	int			slotno = -1;
+
+	buf = zsbt_find_and_lock_leaf_containing_tid(rel, ZS_META_ATTRIBUTE_NUM,
+												 *buf_p, tid, BUFFER_LOCK_SHARE, NULL);
+	*buf_p = buf;
+	if (!BufferIsValid(buf))
+		return -1;
+	page = BufferGetPage(buf);
+	maxoff = PageGetMaxOffsetNumber(page);
+
+	off = zsbt_binsrch_tidpage(tid, page);
+	if (off >= FirstOffsetNumber && off <= maxoff)
+	{
+		ItemId		iid = PageGetItemId(page, off);
+		ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
+
+		slotno = zsbt_tid_item_lookup(item, tid, undoptr_p);
+	}
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+	return slotno;
+}
+
+/*
+ * Find the XID of the transaction that deleted or updated away the row with
+ * given TID, for computing the latestRemovedXid of index entries that are
+ * removed because they point to dead rows.
+ *
+ * Returns InvalidTransactionId if the row was inserted by an aborted
+ * transaction, so that no one could ever have seen it. Returns false if the
+ * XID can no longer be determined, because the UNDO record is gone; the
+ * caller must then make a conservative assumption.
+ */
+bool
+zsbt_tid_get_removing_xid(Relation rel, zstid tid, ZSUndoRecPtr recent_oldest_undo,
+						  TransactionId *xid_p)
+{
+	Buffer		buf;
+	Page		page;
+	OffsetNumber maxoff;
+	OffsetNumber off;
+	int			slotno = -1;
+	ZSUndoRecPtr undoptr = InvalidUndoPtr;
+	ZSUndoRec  *undorec;
+
+	buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, tid, 0, true);
+	if (!BufferIsValid(buf))
+		return false;
+	page = BufferGetPage(buf);
+	maxoff = PageGetMaxOffsetNumber(page);
+
+	off = zsbt_binsrch_tidpage(tid, page);
+	if (off >= FirstOffsetNumber && off <= maxoff)
+	{
+		ItemId		iid = PageGetItemId(page, off);
+		ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
+
+		slotno = zsbt_tid_item_lookup(item, tid, &undoptr);
+	}
+	UnlockReleaseBuffer(buf);
+
+	if (slotno < 0 || slotno == ZSBT_OLD_UNDO_SLOT || slotno == ZSBT_DEAD_UNDO_SLOT)
+		return false;
+
+	for (;;)
+	{
+		if (undoptr.counter < recent_oldest_undo.counter)
+			return false;
+		undorec = zsundo_fetch_record(rel, undoptr);
+		if (undorec == NULL)
+			return false;
+
+		if (undorec->type == ZSUNDO_TYPE_DELETE ||
+			undorec->type == ZSUNDO_TYPE_UPDATE)
+		{
+			*xid_p = undorec->xid;
+			return true;
+		}
+		else if (undorec->type == ZSUNDO_TYPE_INSERT)
+		{
+			*xid_p = InvalidTransactionId;
+			return true;
+		}
+		else if (undorec->type == ZSUNDO_TYPE_TUPLE_LOCK)
+			undoptr = undorec->prevundorec;
+		else
+			return false;
+	}
+}
+
 /*
  * Mark item with given TID as dead.
  *
@@ -1100,10 +2278,11 @@ zsbt_tid_mark_dead(Relation rel, zstid tid, ZSUndoRecPtr recent_oldest_undo)
 /*
  * Remove items for the given TIDs from the TID tree.
  *
- * This is used during VACUUM.
+ * This is used during VACUUM. Pages are read using 'strategy', which may be
+ * NULL.
  */
 void
-zsbt_tid_remove(Relation rel, IntegerSet *tids)
+zsbt_tid_remove(Relation rel, ZSTidStore *tids, BufferAccessStrategy strategy)
 {
 	ZSUndoRecPtr recent_oldest_undo = zsundo_get_oldest_undo_ptr(rel, true);
 	zstid		nexttid;
@@ -1115,8 +2294,8 @@ zsbt_tid_remove(Relation rel, IntegerSet *tids)
 									   ALLOCSET_DEFAULT_SIZES);
 	oldcontext = MemoryContextSwitchTo(tmpcontext);
 
-	intset_begin_iterate(tids);
-	if (!intset_iterate_next(tids, &nexttid))
+	zs_tidstore_begin_iterate(tids);
+	if (!zs_tidstore_iterate_next(tids, &nexttid))
 		nexttid = MaxPlusOneZSTid;
 
 	while (nexttid < MaxPlusOneZSTid)
@@ -1127,51 +2306,64 @@ zsbt_tid_remove(Relation rel, IntegerSet *tids)
 		List	   *newitems;
 		OffsetNumber maxoff;
 		OffsetNumber off;
+		zstid		lokey;
 
 		/*
 		 * Find the leaf page containing the next item to remove
 		 */
-		buf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, nexttid, 0, false);
+		buf = zsbt_descend_extended(rel, ZS_META_ATTRIBUTE_NUM, nexttid, 0, false,
+									strategy);
 		page = BufferGetPage(buf);
 		opaque = ZSBtreePageGetOpaque(page);
+		lokey = opaque->zs_lokey;
 
 		/*
 		 * Rewrite the items on the page, removing all TIDs that need to be
-		 * removed from the page.
+		 * removed from the page. If all the rows on the page are dead, like
+		 * after deleting a range of old rows, the page can go as a whole.
 		 */
 		newitems = NIL;
-		maxoff = PageGetMaxOffsetNumber(page);
-		for (off = FirstOffsetNumber; off <= maxoff; off++)
+		if (!zs_tidstore_covers_range(tids, lokey, opaque->zs_hikey))
 		{
-			ItemId		iid = PageGetItemId(page, off);
-			ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
-
-			while (nexttid < item->t_firsttid)
+			maxoff = PageGetMaxOffsetNumber(page);
+			for (off = FirstOffsetNumber; off <= maxoff; off++)
 			{
-				if (!intset_iterate_next(tids, &nexttid))
-					nexttid = MaxPlusOneZSTid;
-			}
+				ItemId		iid = PageGetItemId(page, off);
+				ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
 
-			if (nexttid < item->t_endtid)
-			{
-				List		*newitemsx = zsbt_tid_item_remove_tids(item, &nexttid, tids,
-																   recent_oldest_undo);
+				while (nexttid < item->t_firsttid)
+				{
+					if (!zs_tidstore_iterate_next(tids, &nexttid))
+						nexttid = MaxPlusOneZSTid;
+				}
 
-				newitems = list_concat(newitems, newitemsx);
-			}
-			else
-			{
-				/* keep this item unmodified */
-				newitems = lappend(newitems, item);
+				if (nexttid < item->t_endtid)
+				{
+					List		*newitemsx = zsbt_tid_item_remove_tids(item, &nexttid, tids,
+																	   recent_oldest_undo);
+
+					newitems = list_concat(newitems, newitemsx);
+				}
+				else
+				{
+					/* keep this item unmodified */
+					newitems = lappend(newitems, item);
+				}
 			}
 		}
 
 		while (nexttid < opaque->zs_hikey)
 		{
-			if (!intset_iterate_next(tids, &nexttid))
+			if (!zs_tidstore_iterate_next(tids, &nexttid))
 				nexttid = MaxPlusOneZSTid;
 		}
 
+		/*
+		 * The items that had TIDs removed may now be mostly empty. Combine
+		 * them with their neighbours.
+		 */
+		newitems = zsbt_tid_item_merge_small(newitems, recent_oldest_undo);
+
 		/* Pass the list to the recompressor. */
 		IncrBufferRefCount(buf);
 		if (newitems)
@@ -1198,12 +2390,80 @@ zsbt_tid_remove(Relation rel, IntegerSet *tids)
 
 		ReleaseBuffer(buf);
 
+		/* If the page is now mostly empty, try to merge it with its right sibling */
+		if (newitems)
+			zsbt_tid_merge_underfull(rel, lokey);
+
 		MemoryContextReset(tmpcontext);
 	}
 	MemoryContextSwitchTo(oldcontext);
 	MemoryContextDelete(tmpcontext);
 }
 
+/*
+ * Merge the TID leaf containing 'key' with its right sibling, if they are
+ * both so empty that their items fit comfortably on one page.
+ *
+ * This is used during VACUUM, after removing dead TIDs, so that a table
+ * doesn't stay bloated with half-empty pages after mass deletions.
+ */
+static void
+zsbt_tid_merge_underfull(Relation rel, zstid key)
+{
+	Buffer		leftbuf;
+	Buffer		rightbuf;
+	Page		leftpage;
+	Page		rightpage;
+	Page		newpage;
+	OffsetNumber off;
+	OffsetNumber newoff;
+	zs_split_stack *stack;
+
+	leftbuf = zsbt_descend(rel, ZS_META_ATTRIBUTE_NUM, key, 0, false);
+	if (!BufferIsValid(leftbuf))
+		return;
+	rightbuf = zsbt_get_merge_sibling(rel, ZS_META_ATTRIBUTE_NUM, leftbuf);
+	if (!BufferIsValid(rightbuf))
+	{
+		UnlockReleaseBuffer(leftbuf);
+		return;
+	}
+	leftpage = BufferGetPage(leftbuf);
+	rightpage = BufferGetPage(rightbuf);
+
+	/* Construct the merged page, with the items from both pages */
+	newpage = PageGetTempPageCopySpecial(leftpage);
+	if ((ZSBtreePageGetOpaque(rightpage)->zs_flags & ZSBT_TID_UNDO_SYNOPSIS) == 0)
+		ZSBtreePageGetOpaque(newpage)->zs_flags &= ~ZSBT_TID_UNDO_SYNOPSIS;
+	newoff = FirstOffsetNumber;
+	for (off = FirstOffsetNumber; off <= PageGetMaxOffsetNumber(leftpage); off++)
+	{
+		ItemId		iid = PageGetItemId(leftpage, off);
+
+		if (!PageAddItem(newpage, PageGetItem(leftpage, iid), ItemIdGetLength(iid),
+						 newoff++, true, false))
+			elog(ERROR, "could not add item to TID tree page");
+	}
+	for (off = FirstOffsetNumber; off <= PageGetMaxOffsetNumber(rightpage); off++)
+	{
+		ItemId		iid = PageGetItemId(rightpage, off);
+
+		if (!PageAddItem(newpage, PageGetItem(rightpage, iid), ItemIdGetLength(iid),
+						 newoff++, true, false))
+			elog(ERROR, "could not add item to TID tree page");
+		zsbt_tid_page_note_item(newpage, (ZSTidArrayItem *) PageGetItem(rightpage, iid));
+	}
+
+	stack = zsbt_merge_into_left(rel, ZS_META_ATTRIBUTE_NUM, leftbuf, rightbuf, newpage);
+	if (stack == NULL)
+	{
+		UnlockReleaseBuffer(rightbuf);
+		UnlockReleaseBuffer(leftbuf);
+		return;
+	}
+	zs_apply_split_changes(rel, stack, NULL);
+}
+
 /*
  * Clear an item's UNDO pointer.
  *
@@ -1248,9 +2508,12 @@ zsbt_tid_undo_deletion(Relation rel, zstid tid, ZSUndoRecPtr undoptr,
 	}
 	else
 	{
-		Assert(item_isdead ||
-			   item_undoptr.counter > undoptr.counter ||
-			   !IsZSUndoRecPtrValid(&item_undoptr));
+		/*
+		 * The item is dead, or has been modified since, and points to a
+		 * newer UNDO record. (We can't cross-check that by comparing the
+		 * counters, because records on different UNDO pages don't have
+		 * their counters in creation order.)
+		 */
 		UnlockReleaseBuffer(buf);
 	}
 }
@@ -1268,6 +2531,15 @@ zsbt_tid_clear_speculative_token(Relation rel, zstid tid, uint32 spectoken, bool
 	bool		item_isdead;
 	bool		found;
 
+	if (last_speculative_insert.tid == tid &&
+		last_speculative_insert.relid == RelationGetRelid(rel) &&
+		TransactionIdEquals(last_speculative_insert.xid, GetCurrentTransactionIdIfAny()))
+	{
+		zsundo_clear_speculative_token(rel, last_speculative_insert.undoptr);
+		last_speculative_insert.tid = InvalidZSTid;
+		return;
+	}
+
 	found = zsbt_tid_fetch(rel, tid, &buf, &item_undoptr, &item_isdead);
 	if (!found || item_isdead)
 		elog(ERROR, "couldn't find item for meta column for inserted tuple with TID (%u, %u) in rel %s",
@@ -1307,42 +2579,16 @@ zsbt_tid_fetch(Relation rel, zstid tid, Buffer *buf_p, ZSUndoRecPtr *undoptr_p,
 	{
 		ItemId		iid = PageGetItemId(page, off);
 		ZSTidArrayItem *item = (ZSTidArrayItem *) PageGetItem(page, iid);
+		int			slotno;
+		ZSUndoRecPtr undoptr;
 
-		if (tid < item->t_endtid)
+		slotno = zsbt_tid_item_lookup(item, tid, &undoptr);
+		if (slotno >= 0)
 		{
-			ZSTidItemIterator iter;
-
-			memset(&iter, 0, sizeof(ZSTidItemIterator));
-			iter.context = CurrentMemoryContext;
-
-			zsbt_tid_item_unpack(item, &iter);
-
-			/* TODO: could do binary search here. Better yet, integrate the
-			 * unpack function with the callers */
-			for (int i = 0; i < iter.num_tids; i++)
-			{
-				if (iter.tids[i] == tid)
-				{
-					int			slotno = iter.tid_undoslotnos[i];
-					ZSUndoRecPtr undoptr = iter.undoslots[slotno];
-
-					*isdead_p = (slotno == ZSBT_DEAD_UNDO_SLOT);
-					*undoptr_p = undoptr;
-					*buf_p = buf;
-
-					if (iter.tids)
-						pfree(iter.tids);
-					if (iter.tid_undoslotnos)
-						pfree(iter.tid_undoslotnos);
-
-					return off;
-				}
-			}
-
-			if (iter.tids)
-				pfree(iter.tids);
-			if (iter.tid_undoslotnos)
-				pfree(iter.tid_undoslotnos);
+			*isdead_p = (slotno == ZSBT_DEAD_UNDO_SLOT);
+			*undoptr_p = undoptr;
+			*buf_p = buf;
+			return off;
 		}
 	}
 	return InvalidOffsetNumber;
@@ -1390,6 +2636,7 @@ zsbt_tid_add_items(Relation rel, Buffer buf, List *newitems, zs_pending_undo_op
 
 			if (!PageAddItem(page, (Item) item, item->t_size, off, true, false))
 				elog(ERROR, "could not add item to TID tree page");
+			zsbt_tid_page_note_item(page, item);
 			off++;
 		}
 
@@ -1398,7 +2645,7 @@ zsbt_tid_add_items(Relation rel, Buffer buf, List *newitems, zs_pending_undo_op
 
 		MarkBufferDirty(buf);
 
-		if (RelationNeedsWAL(rel))
+		if (zs_relation_needs_wal(rel))
 			zsbt_wal_log_tidleaf_items(rel, buf, startoff, false, newitems, undo_op);
 
 		END_CRIT_SECTION();
@@ -1516,6 +2763,7 @@ zsbt_tid_replace_item(Relation rel, Buffer buf, OffsetNumber targetoff, List *ne
 			newitem = (ZSTidArrayItem *) lfirst(lc);
 			if (!PageIndexTupleOverwrite(page, targetoff, (Item) newitem, newitem->t_size))
 				elog(ERROR, "could not replace item in TID tree page at off %d", targetoff);
+			zsbt_tid_page_note_item(page, newitem);
 			lc = lnext(newitems, lc);
 
 			off = targetoff + 1;
@@ -1524,6 +2772,7 @@ zsbt_tid_replace_item(Relation rel, Buffer buf, OffsetNumber targetoff, List *ne
 				newitem = (ZSTidArrayItem *) lfirst(lc);
 				if (!PageAddItem(page, (Item) newitem, newitem->t_size, off, false, false))
 					elog(ERROR, "could not add item in TID tree page at off %d", off);
+				zsbt_tid_page_note_item(page, newitem);
 				off++;
 			}
 		}
@@ -1532,7 +2781,7 @@ zsbt_tid_replace_item(Relation rel, Buffer buf, OffsetNumber targetoff, List *ne
 		if (undo_op)
 			zsundo_finish_pending_op(undo_op, (char *) &undo_op->payload);
 
-		if (RelationNeedsWAL(rel))
+		if (zs_relation_needs_wal(rel))
 			zsbt_wal_log_tidleaf_items(rel, buf, targetoff, true, newitems, undo_op);
 		END_CRIT_SECTION();
 
@@ -1647,6 +2896,7 @@ typedef struct
 	int			free_space_per_page;
 
 	zstid		hikey;
+	zstid		orig_endtid;	/* end of the TIDs on the original page */
 } zsbt_tid_recompress_context;
 
 static void
@@ -1683,7 +2933,8 @@ zsbt_tid_recompress_newpage(zsbt_tid_recompress_context *cxt, zstid nexttid, int
 	newopaque->zs_lokey = nexttid;
 	newopaque->zs_hikey = cxt->hikey;		/* overwritten later, if this is not last page */
 	newopaque->zs_level = 0;
-	newopaque->zs_flags = flags;
+	newopaque->zs_flags = flags | ZSBT_TID_UNDO_SYNOPSIS;
+	newopaque->zs_maxval = 0;
 	newopaque->zs_page_id = ZS_BTREE_PAGE_ID;
 }
 
@@ -1703,6 +2954,7 @@ zsbt_tid_recompress_add_to_page(zsbt_tid_recompress_context *cxt, ZSTidArrayItem
 	maxoff = PageGetMaxOffsetNumber(cxt->currpage);
 	if (!PageAddItem(cxt->currpage, (Item) item, item->t_size, maxoff + 1, true, false))
 		elog(ERROR, "could not add item to TID tree page");
+	zsbt_tid_page_note_item(cxt->currpage, item);
 }
 
 /*
@@ -1716,6 +2968,12 @@ zsbt_tid_recompress_add_to_page(zsbt_tid_recompress_context *cxt, ZSTidArrayItem
  * left to the end of the index, where it's useful for new inserts. The
  * 90/10 splits ensure that the we don't waste too much space on a table
  * that's loaded at the end, and never updated.
+ *
+ * If the split of the rightmost page is caused by new TIDs being appended
+ * after all the existing ones, we're bulk-loading, and the rows on the left
+ * pages are unlikely to be updated soon. Pack the left pages completely in
+ * that case. An update of an existing row on the rightmost page still gets
+ * the 90/10 split, leaving some room for more updates of its neighbours.
  */
 static void
 zsbt_tid_recompress_picksplit(zsbt_tid_recompress_context *cxt, List *items)
@@ -1745,6 +3003,12 @@ zsbt_tid_recompress_picksplit(zsbt_tid_recompress_context *cxt, List *items)
 	{
 		free_space_per_page = 0;
 	}
+	/* If we're appending to the rightmost page, fill the left pages */
+	else if (cxt->hikey == MaxPlusOneZSTid && items != NIL &&
+			 ((ZSTidArrayItem *) llast(items))->t_endtid > cxt->orig_endtid)
+	{
+		free_space_per_page = 0;
+	}
 	/* If this is the rightmost page, do a 90/10 split */
 	else if (cxt->hikey == MaxPlusOneZSTid)
 	{
@@ -1802,6 +3066,15 @@ zsbt_tid_recompress_replace(Relation rel, Buffer oldbuf, List *items, zs_pending
 	cxt.currpage = NULL;
 	cxt.stack_head = cxt.stack_tail = NULL;
 	cxt.hikey = oldopaque->zs_hikey;
+	cxt.orig_endtid = oldopaque->zs_lokey;
+	if (PageGetMaxOffsetNumber(BufferGetPage(oldbuf)) >= FirstOffsetNumber)
+	{
+		Page		oldpage = BufferGetPage(oldbuf);
+		ItemId		iid = PageGetItemId(oldpage, PageGetMaxOffsetNumber(oldpage));
+		ZSTidArrayItem *lastitem = (ZSTidArrayItem *) PageGetItem(oldpage, iid);
+
+		cxt.orig_endtid = lastitem->t_endtid;
+	}
 
 	zsbt_tid_recompress_picksplit(&cxt, items);
 	zsbt_tid_recompress_newpage(&cxt, oldopaque->zs_lokey, (oldopaque->zs_flags & ZSBT_ROOT));
@@ -1832,7 +3105,7 @@ zsbt_tid_recompress_replace(Relation rel, Buffer oldbuf, List *items, zs_pending
 
 		Assert(stack->next->buf == InvalidBuffer);
 
-		nextbuf = zspage_getnewbuf(rel);
+		nextbuf = zspage_getnewbuf(rel, ZS_META_ATTRIBUTE_NUM);
 		stack->next->buf = nextbuf;
 
 		thisopaque->zs_next = BufferGetBlockNumber(nextbuf);
@@ -2013,6 +3286,7 @@ zsbt_tidleaf_items_redo(XLogReaderState *record, bool replace)
 				{
 					elog(ERROR, "could not add item to zedstore btree page");
 				}
+				zsbt_tid_page_note_item(page, (ZSTidArrayItem *) itembufp);
 				off++;
 			}
 			Assert(p - data == datasz);
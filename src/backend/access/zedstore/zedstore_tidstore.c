@@ -0,0 +1,501 @@
+/*
+ * zedstore_tidstore.c
+ *		Compact set of TIDs, used by VACUUM
+ *
+ * VACUUM collects the TIDs of dead rows before removing their index entries,
+ * and each batch of TIDs that doesn't fit in maintenance_work_mem costs a
+ * full pass over every index. The TIDs of a zedstore table are dense
+ * integers, and deleted rows tend to be clustered, so they compress well.
+ *
+ * This is similar to lib/integerset.c: the TIDs are stored as sorted items,
+ * each holding the first TID in full, followed by the deltas to up to 240
+ * more TIDs packed into a single Simple-8b codeword. A run of consecutive
+ * TIDs takes less than a bit per TID. Unlike an IntegerSet, the items are
+ * stored in a single flat array, rather than a B-tree, with no pointers, so
+ * the set can be copied into dynamic shared memory as is, and used from
+ * parallel VACUUM workers. Lookups binary search the array.
+ *
+ * Limitations:
+ *
+ * - TIDs must be added in order.
+ *
+ * - TIDs cannot be added while iteration is in progress, or to a shared
+ *   copy.
+ *
+ * The set also remembers long spans of dead TIDs with no live rows in
+ * between, if the caller marks the live rows with zs_tidstore_end_span().
+ * When a retention job deletes a contiguous range of old rows, VACUUM can
+ * then tell that a whole leaf page holds nothing but dead rows, and free it
+ * without looking at its contents. See zs_tidstore_covers_range().
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zedstore/zedstore_tidstore.c
+ */
+#include "postgres.h"
+
+#include "access/zedstore_simple8b.h"
+#include "access/zedstore_tidstore.h"
+#include "storage/shmem.h"
+#include "utils/memutils.h"
+
+typedef struct ZSTidStoreItem
+{
+	zstid		first;			/* first TID in the item */
+	uint64		codeword;		/* deltas to the following TIDs, minus one */
+} ZSTidStoreItem;
+
+#define MAX_VALUES_PER_ITEM		(1 + SIMPLE8B_MAX_VALUES_PER_CODEWORD)
+
+/*
+ * Newly added TIDs are buffered, until there are enough to fill an item.
+ */
+#define MAX_BUFFERED_VALUES		(MAX_VALUES_PER_ITEM * 2)
+
+/*
+ * Initial size of the item array. It is doubled as needed, up to
+ * ITEMS_DOUBLING_LIMIT items, and grown by 1/8 after that, so that large
+ * sets don't overshoot the caller's memory budget by much.
+ */
+#define INITIAL_ITEMS			64
+#define ITEMS_DOUBLING_LIMIT	(1024 * 1024)
+
+/*
+ * Spans of dead TIDs shorter than this are not remembered. They are unlikely
+ * to cover a whole leaf page, and would take more space than the TIDs.
+ */
+#define MIN_SPAN_LENGTH			64
+
+typedef struct ZSTidStoreSpan
+{
+	zstid		first;			/* first TID in the span */
+	zstid		end;			/* last dead TID in the span + 1 */
+} ZSTidStoreSpan;
+
+/*
+ * Shared representation, created by zs_tidstore_share().
+ */
+typedef struct ZSTidStoreShared
+{
+	uint64		num_entries;
+	uint64		num_items;
+	ZSTidStoreItem items[FLEXIBLE_ARRAY_MEMBER];
+} ZSTidStoreShared;
+
+struct ZSTidStore
+{
+	uint64		num_entries;	/* total number of TIDs in the set */
+	zstid		highest_value;	/* highest TID added so far */
+
+	ZSTidStoreItem *items;
+	uint64		num_items;
+	uint64		max_items;		/* allocated size of 'items' */
+	bool		shared;			/* 'items' points to a shared copy */
+
+	zstid		buffered_values[MAX_BUFFERED_VALUES];
+	int			num_buffered_values;
+
+	/* Spans of dead TIDs, with no live TIDs in between */
+	ZSTidStoreSpan *spans;
+	uint64		num_spans;
+	uint64		max_spans;		/* allocated size of 'spans' */
+	bool		span_open;		/* is 'curr_span' still being extended? */
+	ZSTidStoreSpan curr_span;
+	zstid		next_span_first;	/* see zs_tidstore_end_span(), or
+									 * InvalidZSTid if not tracking spans */
+
+	/* Iterator support */
+	bool		iter_active;
+	uint64		iter_itemno;	/* next item to decode */
+	int			iter_num_values;
+	int			iter_valueno;
+	zstid		iter_values[MAX_VALUES_PER_ITEM];
+};
+
+static void zs_tidstore_flush_buffered_values(ZSTidStore *store, bool flush_all);
+static int	zs_tidstore_decode_item(ZSTidStoreItem *item, zstid *dst);
+static void zs_tidstore_close_span(ZSTidStore *store);
+
+/*
+ * Create a new, empty set, in the current memory context.
+ */
+ZSTidStore *
+zs_tidstore_create(void)
+{
+	ZSTidStore *store;
+
+	store = (ZSTidStore *) palloc0(sizeof(ZSTidStore));
+	store->items = (ZSTidStoreItem *) palloc(INITIAL_ITEMS * sizeof(ZSTidStoreItem));
+	store->max_items = INITIAL_ITEMS;
+
+	return store;
+}
+
+void
+zs_tidstore_free(ZSTidStore *store)
+{
+	if (!store->shared)
+		pfree(store->items);
+	if (store->spans)
+		pfree(store->spans);
+	pfree(store);
+}
+
+/*
+ * Add a TID to the set. TIDs must be added in ascending order.
+ */
+void
+zs_tidstore_add(ZSTidStore *store, zstid tid)
+{
+	if (store->shared)
+		elog(ERROR, "cannot add TIDs to a shared TID store");
+	if (store->iter_active)
+		elog(ERROR, "cannot add TIDs to TID store while iteration is in progress");
+	if (tid <= store->highest_value && store->num_entries > 0)
+		elog(ERROR, "cannot add TID to TID store out of order");
+
+	if (store->num_buffered_values >= MAX_BUFFERED_VALUES)
+	{
+		zs_tidstore_flush_buffered_values(store, false);
+		Assert(store->num_buffered_values < MAX_BUFFERED_VALUES);
+	}
+
+	store->buffered_values[store->num_buffered_values++] = tid;
+	store->num_entries++;
+	store->highest_value = tid;
+
+	/* Track spans, if the caller has asked for them */
+	if (store->next_span_first == InvalidZSTid)
+		return;
+	if (!store->span_open)
+	{
+		store->curr_span.first = store->next_span_first;
+		store->span_open = true;
+	}
+	store->curr_span.end = tid + 1;
+}
+
+/*
+ * End the current span of dead TIDs. There might be a live row at 'tid',
+ * or TIDs up to 'tid' might be allocated to new rows concurrently, so the
+ * next span can begin only after it.
+ *
+ * Spans are tracked only if this is called before adding the first TID,
+ * with the TID before the first one that could be in the set. After that,
+ * the caller must call this between adding two TIDs if there is anything
+ * like that between them; zs_tidstore_covers_range() trusts that it did.
+ */
+void
+zs_tidstore_end_span(ZSTidStore *store, zstid tid)
+{
+	Assert(tid >= store->highest_value || store->num_entries == 0);
+
+	if (store->span_open)
+		zs_tidstore_close_span(store);
+	store->next_span_first = tid + 1;
+}
+
+/*
+ * Remember the current span of dead TIDs, if it's long enough.
+ */
+static void
+zs_tidstore_close_span(ZSTidStore *store)
+{
+	Assert(store->span_open);
+	store->span_open = false;
+
+	if (store->curr_span.end - store->curr_span.first < MIN_SPAN_LENGTH)
+		return;
+
+	if (store->num_spans == store->max_spans)
+	{
+		if (store->max_spans == 0)
+		{
+			store->max_spans = 16;
+			store->spans = (ZSTidStoreSpan *) palloc(store->max_spans * sizeof(ZSTidStoreSpan));
+		}
+		else
+		{
+			store->max_spans *= 2;
+			store->spans = (ZSTidStoreSpan *)
+				repalloc_huge(store->spans, store->max_spans * sizeof(ZSTidStoreSpan));
+		}
+	}
+	store->spans[store->num_spans++] = store->curr_span;
+}
+
+uint64
+zs_tidstore_num_entries(ZSTidStore *store)
+{
+	return store->num_entries;
+}
+
+/*
+ * Return the amount of memory used by the set.
+ */
+uint64
+zs_tidstore_memory_usage(ZSTidStore *store)
+{
+	uint64		size = sizeof(ZSTidStore);
+
+	if (!store->shared)
+		size += store->max_items * sizeof(ZSTidStoreItem);
+	size += store->max_spans * sizeof(ZSTidStoreSpan);
+
+	return size;
+}
+
+/*
+ * Pack buffered TIDs into items. If 'flush_all' is false, only full items
+ * are created, and the remainder is left in the buffer.
+ */
+static void
+zs_tidstore_flush_buffered_values(ZSTidStore *store, bool flush_all)
+{
+	zstid	   *values = store->buffered_values;
+	int			num_values = store->num_buffered_values;
+	int			num_packed = 0;
+
+	while (num_values - num_packed >= (flush_all ? 1 : MAX_VALUES_PER_ITEM))
+	{
+		uint64		deltas[SIMPLE8B_MAX_VALUES_PER_CODEWORD];
+		int			num_deltas;
+		int			num_encoded;
+		ZSTidStoreItem *item;
+
+		num_deltas = Min(num_values - num_packed - 1, SIMPLE8B_MAX_VALUES_PER_CODEWORD);
+		for (int i = 0; i < num_deltas; i++)
+			deltas[i] = values[num_packed + i + 1] - values[num_packed + i] - 1;
+
+		if (store->num_items == store->max_items)
+		{
+			uint64		newmax;
+
+			if (store->max_items < ITEMS_DOUBLING_LIMIT)
+				newmax = store->max_items * 2;
+			else
+				newmax = store->max_items + store->max_items / 8;
+			store->items = (ZSTidStoreItem *)
+				repalloc_huge(store->items, newmax * sizeof(ZSTidStoreItem));
+			store->max_items = newmax;
+		}
+
+		item = &store->items[store->num_items++];
+		item->first = values[num_packed];
+		if (num_deltas > 0)
+		{
+			/* TIDs are 48 bits, so there is always room for at least one */
+			item->codeword = simple8b_encode(deltas, num_deltas, &num_encoded);
+			Assert(num_encoded > 0);
+		}
+		else
+		{
+			item->codeword = EMPTY_CODEWORD;
+			num_encoded = 0;
+		}
+
+		num_packed += 1 + num_encoded;
+	}
+
+	if (num_packed < num_values)
+		memmove(&values[0], &values[num_packed],
+				(num_values - num_packed) * sizeof(zstid));
+	store->num_buffered_values = num_values - num_packed;
+}
+
+/*
+ * Decode all the TIDs in an item into 'dst'. Returns the number of TIDs.
+ */
+static int
+zs_tidstore_decode_item(ZSTidStoreItem *item, zstid *dst)
+{
+	uint64		deltas[SIMPLE8B_MAX_VALUES_PER_CODEWORD];
+	int			num_deltas;
+	zstid		tid;
+
+	tid = item->first;
+	dst[0] = tid;
+	num_deltas = simple8b_decode(item->codeword, deltas);
+	for (int i = 0; i < num_deltas; i++)
+	{
+		tid += deltas[i] + 1;
+		dst[i + 1] = tid;
+	}
+	return 1 + num_deltas;
+}
+
+/*
+ * Does the set contain the given TID?
+ */
+bool
+zs_tidstore_is_member(ZSTidStore *store, zstid tid)
+{
+	zstid		values[MAX_VALUES_PER_ITEM];
+	int			num_values;
+	uint64		lo;
+	uint64		hi;
+	ZSTidStoreItem *item;
+
+	if (store->num_buffered_values > 0)
+		zs_tidstore_flush_buffered_values(store, true);
+
+	/* find the last item whose first TID is <= 'tid' */
+	lo = 0;
+	hi = store->num_items;
+	while (lo < hi)
+	{
+		uint64		mid = lo + (hi - lo) / 2;
+
+		if (store->items[mid].first <= tid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return false;
+	item = &store->items[lo - 1];
+
+	if (item->first == tid)
+		return true;
+	if (item->codeword == EMPTY_CODEWORD)
+		return false;
+
+	num_values = zs_tidstore_decode_item(item, values);
+	for (int i = 1; i < num_values; i++)
+	{
+		if (values[i] == tid)
+			return true;
+		if (values[i] > tid)
+			break;
+	}
+	return false;
+}
+
+/*
+ * Are all the rows in the TID range [firsttid, endtid) dead?
+ *
+ * That's the case if the range falls within a span of dead TIDs that was
+ * not ended by zs_tidstore_end_span(). There might be TIDs in the range that
+ * are not in the set, but if so, they don't exist. A false answer means only
+ * that we don't know; a shared copy of the set never knows.
+ */
+bool
+zs_tidstore_covers_range(ZSTidStore *store, zstid firsttid, zstid endtid)
+{
+	uint64		lo;
+	uint64		hi;
+
+	if (store->span_open &&
+		store->curr_span.first <= firsttid && endtid <= store->curr_span.end)
+		return true;
+
+	/* find the last span that begins at or before 'firsttid' */
+	lo = 0;
+	hi = store->num_spans;
+	while (lo < hi)
+	{
+		uint64		mid = lo + (hi - lo) / 2;
+
+		if (store->spans[mid].first <= firsttid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return false;
+
+	return endtid <= store->spans[lo - 1].end;
+}
+
+/*
+ * Begin in-order scan through all the TIDs in the set.
+ */
+void
+zs_tidstore_begin_iterate(ZSTidStore *store)
+{
+	if (store->num_buffered_values > 0)
+		zs_tidstore_flush_buffered_values(store, true);
+
+	store->iter_active = true;
+	store->iter_itemno = 0;
+	store->iter_num_values = 0;
+	store->iter_valueno = 0;
+}
+
+/*
+ * Return the next TID in the set, or false if there are no more.
+ */
+bool
+zs_tidstore_iterate_next(ZSTidStore *store, zstid *tid)
+{
+	Assert(store->iter_active);
+
+	while (store->iter_valueno >= store->iter_num_values)
+	{
+		if (store->iter_itemno >= store->num_items)
+		{
+			store->iter_active = false;
+			return false;
+		}
+		store->iter_num_values =
+			zs_tidstore_decode_item(&store->items[store->iter_itemno++],
+									store->iter_values);
+		store->iter_valueno = 0;
+	}
+
+	*tid = store->iter_values[store->iter_valueno++];
+	return true;
+}
+
+/*
+ * Return the amount of shared memory needed by zs_tidstore_share().
+ */
+Size
+zs_tidstore_shared_size(ZSTidStore *store)
+{
+	if (store->num_buffered_values > 0)
+		zs_tidstore_flush_buffered_values(store, true);
+
+	return add_size(offsetof(ZSTidStoreShared, items),
+					mul_size(store->num_items, sizeof(ZSTidStoreItem)));
+}
+
+/*
+ * Copy the set to 'dst', which must be zs_tidstore_shared_size() bytes.
+ * Other processes can read it with zs_tidstore_attach().
+ */
+void
+zs_tidstore_share(ZSTidStore *store, void *dst)
+{
+	ZSTidStoreShared *shared = (ZSTidStoreShared *) dst;
+
+	if (store->num_buffered_values > 0)
+		zs_tidstore_flush_buffered_values(store, true);
+
+	shared->num_entries = store->num_entries;
+	shared->num_items = store->num_items;
+	memcpy(shared->items, store->items, store->num_items * sizeof(ZSTidStoreItem));
+}
+
+/*
+ * Return a read-only set that uses a shared copy created by
+ * zs_tidstore_share(). The copy must stay mapped for the lifetime of the
+ * returned set.
+ */
+ZSTidStore *
+zs_tidstore_attach(void *src)
+{
+	ZSTidStoreShared *shared = (ZSTidStoreShared *) src;
+	ZSTidStore *store;
+
+	store = (ZSTidStore *) palloc0(sizeof(ZSTidStore));
+	store->num_entries = shared->num_entries;
+	store->items = shared->items;
+	store->num_items = shared->num_items;
+	store->max_items = shared->num_items;
+	store->shared = true;
+
+	return store;
+}
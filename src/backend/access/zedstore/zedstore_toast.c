@@ -10,17 +10,87 @@
  */
 #include "postgres.h"
 
+#include "access/detoast.h"
+#include "access/table.h"
 #include "access/toast_internals.h"
+#include "access/zedstore_compression.h"
 #include "access/xlogutils.h"
 #include "access/zedstore_internal.h"
+#include "access/zedstore_stats.h"
 #include "access/zedstore_wal.h"
+#include "common/pg_lzcompress.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
+#include "utils/attoptcache.h"
 #include "utils/datum.h"
+#include "utils/expandeddatum.h"
+#include "utils/lsyscache.h"
 #include "utils/rel.h"
 
 static void zstoast_wal_log_newpage(Buffer prevbuf, Buffer buf, zstid tid, AttrNumber attno,
 									int offset, int32 total_size);
+static char *zstoast_compress(ZSCompressionMethod method, Datum value, int32 *compressed_size);
+
+/* Bytes of datum stored on each toast page */
+#define ZSTOAST_PAGE_PAYLOAD \
+	(BLCKSZ - SizeOfPageHeaderData - MAXALIGN(sizeof(ZSToastPageOpaque)))
+
+/* Datums that need at least this many toast pages get consecutive blocks */
+#define ZSTOAST_CONTIGUOUS_MIN_PAGES	4
+
+/* How many blocks to prefetch ahead, when reading a contiguous chain */
+#define ZSTOAST_PREFETCH_DISTANCE		32
+
+/*
+ * Get the size above which values of the given attribute are toasted.
+ *
+ * That's MaxZedStoreDatumSize, unless lowered with the
+ * "zedstore_toast_threshold" attribute option. A lower threshold keeps large
+ * values from bloating the attribute pages, so that scans that don't look at
+ * them, or only at other rows' short values, read fewer pages.
+ */
+int
+zedstore_toast_threshold(Relation rel, AttrNumber attno)
+{
+	AttributeOpts *aopt;
+	int			result = MaxZedStoreDatumSize;
+
+	aopt = get_attribute_options(RelationGetRelid(rel), attno);
+	if (aopt)
+	{
+		if (aopt->zedstore_toast_threshold >= 0)
+			result = Min(aopt->zedstore_toast_threshold, MaxZedStoreDatumSize);
+		pfree(aopt);
+	}
+
+	return result;
+}
+
+/*
+ * Compress a datum's data with a zedstore codec, for storing out-of-line.
+ *
+ * Returns a palloc'd buffer holding the compressed data, and its size in
+ * *compressed_size, or NULL if the data doesn't compress.
+ */
+static char *
+zstoast_compress(ZSCompressionMethod method, Datum value, int32 *compressed_size)
+{
+	int32		rawsize = VARSIZE_ANY_EXHDR(value);
+	int			srcsize = rawsize;
+	char	   *dst;
+	int			dstsize;
+
+	dst = palloc(rawsize);
+	dstsize = zs_compress_destSize(method, VARDATA_ANY(value), dst, &srcsize, rawsize);
+	if (dstsize <= 0 || srcsize != rawsize || dstsize >= rawsize)
+	{
+		pfree(dst);
+		return NULL;
+	}
+
+	*compressed_size = dstsize;
+	return dst;
+}
 
 /*
  * Toast a datum, inside the ZedStore file.
@@ -46,7 +116,14 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 	int32		offset;
 	bool		is_compressed;
 	bool		is_first;
-	Datum		toasted_datum;
+	BlockNumber npages;
+	bool		contiguous;
+	int			threshold;
+	ZSCompressionMethod compression;
+	ZSCompressionMethod stored_compression = ZS_COMPRESSION_DEFAULT;
+	char	   *codec_data = NULL;
+	int32		codec_size = 0;
+	Datum		toasted_datum = PointerGetDatum(NULL);
 
 	Assert(tid != InvalidZSTid);
 
@@ -55,17 +132,50 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 	 */
 	Assert(RelationGetNumberOfBlocks(rel) != 0);
 
+	/*
+	 * Compress the datum with the column's codec. pglz-compressed datums in
+	 * the regular TOAST format are stored as is, and can be returned inline
+	 * if they're small enough. Other codecs are only used for out-of-line
+	 * values, because the rest of the system couldn't decompress an inline
+	 * datum compressed with them.
+	 */
+	threshold = zedstore_toast_threshold(rel, attno);
+	compression = zs_get_attr_compression_method(rel, attno);
 	if (VARATT_IS_COMPRESSED(value))
 		toasted_datum = value;
-	else
+	else if (compression == ZS_COMPRESSION_PGLZ)
 		toasted_datum = toast_compress_datum(value);
-	if (DatumGetPointer(toasted_datum) != NULL)
+	else if (compression != ZS_COMPRESSION_NONE)
+	{
+		codec_data = zstoast_compress(compression, value, &codec_size);
+
+		/*
+		 * If it compresses well enough that it might fit inline, use pglz
+		 * instead.
+		 */
+		if (codec_data && codec_size <= threshold)
+		{
+			pfree(codec_data);
+			codec_data = NULL;
+			toasted_datum = toast_compress_datum(value);
+		}
+	}
+
+	if (codec_data != NULL)
+	{
+		is_compressed     = true;
+		stored_compression = compression;
+		decompressed_size = VARSIZE_ANY_EXHDR(value);
+		ptr               = codec_data;
+		total_size = codec_size;
+	}
+	else if (DatumGetPointer(toasted_datum) != NULL)
 	{
 		/*
 		 * If the compressed datum can be stored inline, return the datum
 		 * directly.
 		 */
-		if (VARSIZE_ANY(toasted_datum) <= MaxZedStoreDatumSize)
+		if (VARSIZE_ANY(toasted_datum) <= threshold)
 		{
 			return toasted_datum;
 		}
@@ -87,15 +197,34 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 	}
 
 
+	/*
+	 * If the datum needs many pages, allocate them all at once as a range
+	 * of consecutive blocks, so that they can be read back with readahead.
+	 */
+	npages = (total_size + ZSTOAST_PAGE_PAYLOAD - 1) / ZSTOAST_PAGE_PAYLOAD;
+	contiguous = (npages >= ZSTOAST_CONTIGUOUS_MIN_PAGES);
+	if (contiguous)
+	{
+		buf = zspage_getnewbufs_contiguous(rel, npages);
+		firstblk = BufferGetBlockNumber(buf);
+	}
+
 	offset = 0;
 	is_first = true;
 	while (total_size - offset > 0)
 	{
 		Size		thisbytes;
 
-		buf = zspage_getnewbuf(rel);
-		if (prevbuf == InvalidBuffer)
-			firstblk = BufferGetBlockNumber(buf);
+		if (!contiguous)
+		{
+			buf = zspage_getnewbuf(rel, attno);
+			if (prevbuf == InvalidBuffer)
+				firstblk = BufferGetBlockNumber(buf);
+		}
+		else if (!is_first)
+			buf = ReadBufferExtended(rel, MAIN_FORKNUM,
+									 firstblk + offset / ZSTOAST_PAGE_PAYLOAD,
+									 RBM_ZERO_AND_LOCK, NULL);
 
 		START_CRIT_SECTION();
 
@@ -103,6 +232,7 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 		PageInit(page, BLCKSZ, sizeof(ZSToastPageOpaque));
 
 		thisbytes = Min(total_size - offset, PageGetExactFreeSpace(page));
+		Assert(PageGetExactFreeSpace(page) == ZSTOAST_PAGE_PAYLOAD);
 
 		opaque = (ZSToastPageOpaque *) PageGetSpecialPointer(page);
 		opaque->zs_tid = tid;
@@ -113,7 +243,8 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 		opaque->zs_slice_offset = offset;
 		opaque->zs_prev = is_first ? InvalidBlockNumber : BufferGetBlockNumber(prevbuf);
 		opaque->zs_next = InvalidBlockNumber;
-		opaque->zs_flags = 0;
+		opaque->zs_flags = (is_first && contiguous) ? ZSTOAST_CONTIGUOUS : 0;
+		opaque->zs_compression = stored_compression;
 		opaque->zs_page_id = ZS_TOAST_PAGE_ID;
 
 		memcpy((char *) page + SizeOfPageHeaderData, ptr, thisbytes);
@@ -127,7 +258,7 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 
 		MarkBufferDirty(buf);
 
-		if (RelationNeedsWAL(rel))
+		if (zs_relation_needs_wal(rel))
 			zstoast_wal_log_newpage(prevbuf, buf, tid, attno, offset, total_size);
 
 		END_CRIT_SECTION();
@@ -143,6 +274,9 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 
 	UnlockReleaseBuffer(buf);
 
+	if (codec_data)
+		pfree(codec_data);
+
 	toastptr = palloc0(sizeof(varatt_zs_toastptr));
 	SET_VARTAG_1B_E(toastptr, VARTAG_ZEDSTORE);
 	toastptr->zst_block = firstblk;
@@ -150,17 +284,43 @@ zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid)
 	return PointerGetDatum(toastptr);
 }
 
-Datum
-zedstore_toast_flatten(Relation rel, AttrNumber attno, zstid tid, Datum toasted)
+/*
+ * Read the bytes [sliceoffset, sliceoffset + slicelength) of a toasted datum
+ * from its chain of toast pages, into a palloc'd varlena. slicelength < 0
+ * means all the bytes to the end.
+ *
+ * If the datum is stored uncompressed, the result is a plain varlena holding
+ * just the requested bytes. If it's compressed with pglz, the slice can't be
+ * located without decompressing, so the result is a compressed varlena
+ * holding the whole datum, or if only a prefix was requested, enough of the
+ * compressed data to decompress that prefix. If it's compressed with another
+ * codec, the whole datum is decompressed here, and the result is again a
+ * plain varlena holding just the requested bytes. Either way, we stop following the chain
+ * as soon as we have what we need.
+ *
+ * If the chain was allocated as consecutive blocks, the blocks we need are
+ * known after reading the first one, and are prefetched ahead of the walk.
+ */
+static struct varlena *
+zstoast_fetch_datum(Relation rel, AttrNumber attno, zstid tid, Datum toasted,
+					int32 sliceoffset, int32 slicelength)
 {
 	varatt_zs_toastptr *toastptr = (varatt_zs_toastptr *) DatumGetPointer(toasted);
 	BlockNumber	nextblk;
 	BlockNumber	prevblk;
 	char	   *result = NULL;
 	char	   *ptr = NULL;
-	int32		total_size = 0;
+	int32		startoff = 0;
+	int32		endoff = 0;
+	ZSCompressionMethod codec = ZS_COMPRESSION_DEFAULT;
+	int32		rawsize = 0;
+#ifdef USE_PREFETCH
+	BlockNumber	prefetch_next = InvalidBlockNumber;
+	BlockNumber	prefetch_end = InvalidBlockNumber;
+#endif
 
 	Assert(toastptr->va_tag == VARTAG_ZEDSTORE);
+	Assert(sliceoffset >= 0);
 
 	prevblk = InvalidBlockNumber;
 	nextblk = toastptr->zst_block;
@@ -170,7 +330,8 @@ zedstore_toast_flatten(Relation rel, AttrNumber attno, zstid tid, Datum toasted)
 		Buffer		buf;
 		Page		page;
 		ZSToastPageOpaque *opaque;
-		uint32		size;
+		int32		chunkoff;
+		int32		chunkend;
 
 		buf = ReadBuffer(rel, nextblk);
 		page = BufferGetPage(buf);
@@ -183,40 +344,307 @@ zedstore_toast_flatten(Relation rel, AttrNumber attno, zstid tid, Datum toasted)
 
 		if (prevblk == InvalidBlockNumber)
 		{
-			Assert(opaque->zs_tid == tid);
+			int32		total_size = opaque->zs_total_size;
 
-			total_size = opaque->zs_total_size;
+			Assert(opaque->zs_tid == tid);
+			Assert(total_size > 0);
 
-			if(opaque->zs_is_compressed)
+			if (opaque->zs_is_compressed &&
+				opaque->zs_compression != ZS_COMPRESSION_DEFAULT)
+			{
+				/* fetch all the compressed data, and decompress it below */
+				codec = opaque->zs_compression;
+				rawsize = opaque->zs_decompressed_size;
+				startoff = 0;
+				endoff = total_size;
+				result = palloc(total_size);
+				ptr = result;
+			}
+			else if (opaque->zs_is_compressed)
 			{
-				result = palloc(total_size + TOAST_COMPRESS_HDRSZ);
+				startoff = 0;
+				if (slicelength >= 0)
+					endoff = Min(pglz_maximum_compressed_size(sliceoffset + slicelength,
+															  total_size),
+								 total_size);
+				else
+					endoff = total_size;
+
+				result = palloc(endoff + TOAST_COMPRESS_HDRSZ);
 
 				TOAST_COMPRESS_SET_RAWSIZE(result, opaque->zs_decompressed_size);
-				SET_VARSIZE_COMPRESSED(result, total_size + TOAST_COMPRESS_HDRSZ);
+				SET_VARSIZE_COMPRESSED(result, endoff + TOAST_COMPRESS_HDRSZ);
 				ptr = result + TOAST_COMPRESS_HDRSZ;
 			}
 			else
 			{
-				result = palloc(total_size + VARHDRSZ);
-				SET_VARSIZE(result, total_size + VARHDRSZ);
+				startoff = Min(sliceoffset, total_size);
+				if (slicelength >= 0)
+					endoff = Min(startoff + slicelength, total_size);
+				else
+					endoff = total_size;
+
+				result = palloc(endoff - startoff + VARHDRSZ);
+				SET_VARSIZE(result, endoff - startoff + VARHDRSZ);
 				ptr = result + VARHDRSZ;
 			}
+
+#ifdef USE_PREFETCH
+			if ((opaque->zs_flags & ZSTOAST_CONTIGUOUS) != 0 && endoff > 0)
+			{
+				prefetch_next = nextblk + 1;
+				prefetch_end = nextblk + 1 + (endoff - 1) / ZSTOAST_PAGE_PAYLOAD;
+			}
+#endif
 		}
 
-		size = ((PageHeader) page)->pd_lower - SizeOfPageHeaderData;
-		memcpy(ptr, (char *) page + SizeOfPageHeaderData, size);
-		ptr += size;
+#ifdef USE_PREFETCH
+		while (prefetch_next < prefetch_end &&
+			   prefetch_next <= nextblk + ZSTOAST_PREFETCH_DISTANCE)
+			PrefetchBuffer(rel, MAIN_FORKNUM, prefetch_next++);
+#endif
+
+		/* Copy the part of this page's chunk that overlaps the slice */
+		chunkoff = opaque->zs_slice_offset;
+		chunkend = chunkoff + (((PageHeader) page)->pd_lower - SizeOfPageHeaderData);
+		if (chunkend > startoff && chunkoff < endoff)
+		{
+			int32		lo = Max(chunkoff, startoff);
+			int32		hi = Min(chunkend, endoff);
+
+			memcpy(ptr, (char *) page + SizeOfPageHeaderData + (lo - chunkoff), hi - lo);
+			ptr += hi - lo;
+		}
 
 		prevblk = nextblk;
 		nextblk = opaque->zs_next;
 		UnlockReleaseBuffer(buf);
+
+		if (chunkend >= endoff)
+			break;
 	}
-	Assert(total_size > 0);
+	Assert(result != NULL);
+
+	if (codec != ZS_COMPRESSION_DEFAULT)
+	{
+		char	   *decompressed;
+		int32		lo;
+		int32		hi;
+
+		Assert(ptr == result + endoff);
+
+		decompressed = palloc(rawsize + VARHDRSZ);
+		zs_decompress(codec, result, decompressed + VARHDRSZ, endoff, rawsize);
+		pfree(result);
+
+		lo = Min(sliceoffset, rawsize);
+		if (slicelength >= 0)
+			hi = Min(lo + slicelength, rawsize);
+		else
+			hi = rawsize;
+		if (lo > 0)
+			memmove(decompressed + VARHDRSZ, decompressed + VARHDRSZ + lo, hi - lo);
+		SET_VARSIZE(decompressed, hi - lo + VARHDRSZ);
+
+		return (struct varlena *) decompressed;
+	}
+
 	Assert(ptr == result + VARSIZE_ANY(result));
 
+	return (struct varlena *) result;
+}
+
+Datum
+zedstore_toast_flatten(Relation rel, AttrNumber attno, zstid tid, Datum toasted)
+{
+	zs_stats_count_toast_flatten(rel, attno);
+	return PointerGetDatum(zstoast_fetch_datum(rel, attno, tid, toasted, 0, -1));
+}
+
+/*
+ * Like zedstore_toast_flatten(), but return only the bytes
+ * [sliceoffset, sliceoffset + slicelength) of the value, like
+ * detoast_attr_slice(). Only the toast pages that are needed for the slice
+ * are read.
+ */
+Datum
+zedstore_toast_flatten_slice(Relation rel, AttrNumber attno, zstid tid, Datum toasted,
+							 int32 sliceoffset, int32 slicelength)
+{
+	struct varlena *preslice;
+	struct varlena *result;
+
+	zs_stats_count_toast_flatten(rel, attno);
+	preslice = zstoast_fetch_datum(rel, attno, tid, toasted, sliceoffset, slicelength);
+	if (!VARATT_IS_COMPRESSED(preslice))
+		return PointerGetDatum(preslice);
+
+	result = detoast_attr_slice(preslice, sliceoffset, slicelength);
+	pfree(preslice);
+
 	return PointerGetDatum(result);
 }
 
+/*
+ * Deferred flattening of toasted values.
+ *
+ * The rest of the system doesn't know how to deal with zedstore toast
+ * pointers, so scans can't return them as is. But many queries never look
+ * at the contents of a toasted value, e.g. if they only test it for NULL, or
+ * discard the row in a later qual. To avoid reading and decompressing the
+ * toast chain in those cases, scans return zedstore-toasted values wrapped
+ * in a read-only "expanded object". Core code knows how to flatten those,
+ * and calls our methods to do it only when the value is actually needed.
+ * The flat size is known from the first toast page, so e.g. length() on a
+ * text column only needs to read one page.
+ *
+ * The fetched value is cached in the object, so that it's only read once
+ * even if the datum is detoasted several times.
+ *
+ * The object is allocated in the memory context that the flattened value
+ * would have been allocated in, so it has the same lifetime. No read-write
+ * pointers are handed out, so the object doesn't need a context of its own.
+ * If the caller tracks the memory used in that context, it passes a pointer
+ * to its counter in 'mem_used', so that the cached value is accounted for
+ * when it's fetched later.
+ */
+typedef struct ZSToastExpanded
+{
+	ExpandedObjectHeader hdr;
+
+	Oid			relid;
+	AttrNumber	attno;
+	zstid		tid;
+	varatt_zs_toastptr toastptr;
+
+	Size		flat_size;		/* size of the flat value, or 0 if not known */
+	struct varlena *flat;		/* the flat value, once fetched */
+	int		   *mem_used;		/* caller's memory accounting, or NULL */
+} ZSToastExpanded;
+
+static Size zstoast_get_flat_size(ExpandedObjectHeader *eohptr);
+static void zstoast_flatten_into(ExpandedObjectHeader *eohptr,
+								 void *result, Size allocated_size);
+
+static const ExpandedObjectMethods zstoast_expanded_methods =
+{
+	zstoast_get_flat_size,
+	zstoast_flatten_into
+};
+
+/*
+ * Can scans defer flattening toasted values of this attribute?
+ *
+ * Arrays and composite types have expanded representations of their own,
+ * and code that handles them assumes that any expanded datum of such a type
+ * is one of those. So values of those types are always flattened.
+ */
+bool
+zedstore_toast_can_defer(Form_pg_attribute attr)
+{
+	Oid			basetype;
+
+	if (attr->attlen != -1)
+		return false;
+
+	basetype = getBaseType(attr->atttypid);
+
+	return !type_is_array(basetype) && !type_is_rowtype(basetype);
+}
+
+/*
+ * Wrap a zedstore toast pointer in an expanded object, which will be
+ * flattened only if something dereferences it.
+ */
+Datum
+zedstore_toast_defer(Relation rel, AttrNumber attno, zstid tid, Datum toasted,
+					 int *mem_used)
+{
+	ZSToastExpanded *zseh;
+
+	Assert(VARTAG_EXTERNAL(toasted) == VARTAG_ZEDSTORE);
+
+	zseh = palloc(sizeof(ZSToastExpanded));
+	EOH_init_header(&zseh->hdr, &zstoast_expanded_methods, CurrentMemoryContext);
+	zseh->relid = RelationGetRelid(rel);
+	zseh->attno = attno;
+	zseh->tid = tid;
+	memcpy(&zseh->toastptr, DatumGetPointer(toasted), sizeof(varatt_zs_toastptr));
+	zseh->flat_size = 0;
+	zseh->flat = NULL;
+	zseh->mem_used = mem_used;
+
+	return EOHPGetRODatum(&zseh->hdr);
+}
+
+static Size
+zstoast_get_flat_size(ExpandedObjectHeader *eohptr)
+{
+	ZSToastExpanded *zseh = (ZSToastExpanded *) eohptr;
+
+	if (zseh->flat_size == 0)
+	{
+		Relation	rel;
+		Buffer		buf;
+		ZSToastPageOpaque *opaque;
+
+		/* Read the first page of the chain, for the size */
+		rel = table_open(zseh->relid, NoLock);
+		buf = ReadBuffer(rel, zseh->toastptr.zst_block);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+		opaque = (ZSToastPageOpaque *) PageGetSpecialPointer(BufferGetPage(buf));
+		Assert(opaque->zs_tid == zseh->tid);
+		Assert(opaque->zs_attno == zseh->attno);
+		if (opaque->zs_is_compressed)
+			zseh->flat_size = opaque->zs_decompressed_size + VARHDRSZ;
+		else
+			zseh->flat_size = opaque->zs_total_size + VARHDRSZ;
+
+		UnlockReleaseBuffer(buf);
+		table_close(rel, NoLock);
+	}
+
+	return zseh->flat_size;
+}
+
+static void
+zstoast_flatten_into(ExpandedObjectHeader *eohptr,
+					 void *result, Size allocated_size)
+{
+	ZSToastExpanded *zseh = (ZSToastExpanded *) eohptr;
+
+	if (zseh->flat == NULL)
+	{
+		MemoryContext oldcxt;
+		Relation	rel;
+		struct varlena *fetched;
+
+		oldcxt = MemoryContextSwitchTo(zseh->hdr.eoh_context);
+
+		rel = table_open(zseh->relid, NoLock);
+		fetched = zstoast_fetch_datum(rel, zseh->attno, zseh->tid,
+									  PointerGetDatum(&zseh->toastptr), 0, -1);
+		table_close(rel, NoLock);
+
+		if (VARATT_IS_COMPRESSED(fetched))
+		{
+			zseh->flat = detoast_attr(fetched);
+			pfree(fetched);
+		}
+		else
+			zseh->flat = fetched;
+		zseh->flat_size = VARSIZE(zseh->flat);
+		if (zseh->mem_used)
+			*zseh->mem_used += zseh->flat_size;
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	Assert(allocated_size == zseh->flat_size);
+	memcpy(result, zseh->flat, zseh->flat_size);
+}
+
 void
 zedstore_toast_delete(Relation rel, Form_pg_attribute attr, zstid tid, BlockNumber blkno)
 {
@@ -236,7 +664,9 @@ zedstore_toast_delete(Relation rel, Form_pg_attribute attr, zstid tid, BlockNumb
 
 		opaque = (ZSToastPageOpaque *) PageGetSpecialPointer(page);
 
-		if (opaque->zs_tid != tid)
+		if (PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSToastPageOpaque)) ||
+			opaque->zs_page_id != ZS_TOAST_PAGE_ID ||
+			opaque->zs_tid != tid)
 		{
 			UnlockReleaseBuffer(buf);
 			break;
@@ -12,14 +12,44 @@
 #include "postgres.h"
 
 #include "access/detoast.h"
+#include "access/heapam.h"
 #include "access/table.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "access/xloginsert.h"
 #include "access/zedstoream.h"
 #include "access/zedstore_internal.h"
+#include "funcapi.h"
 #include "miscadmin.h"
+#include "pg_trace.h"
+#include "portability/instr_time.h"
+#include "storage/bufmgr.h"
+#include "utils/attoptcache.h"
+#include "utils/builtins.h"
 #include "utils/datum.h"
 #include "utils/hashutils.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/sortsupport.h"
+#include "utils/typcache.h"
 
+/*
+ * In batch mode, TIDs are reserved TID_RESERVATION_SIZE at a time at first.
+ * Each reservation appends to the rightmost TID tree leaf, under an exclusive
+ * lock, which concurrent inserters contend for. To make that less frequent,
+ * the reservation size is doubled each time a reservation is used up, up to
+ * TID_MAX_RESERVATION_SIZE. Because of the doubling, the number of unused
+ * TIDs that need to be killed at the end exceeds the number of rows inserted
+ * with reserved TIDs by at most TID_RESERVATION_SIZE.
+ *
+ * If another backend reserved TIDs in between two of our reservations, the
+ * table is being loaded concurrently. In that case we jump straight to
+ * TID_MAX_RESERVATION_SIZE, so that each backend claims long, disjoint TID
+ * ranges, and writes its attribute data into pages of its own, instead of
+ * the backends taking turns at the rightmost leaves.
+ */
 #define TID_RESERVATION_SIZE		100
+#define TID_MAX_RESERVATION_SIZE	12800
 
 /*
  * If we see more than TID_RESERVATION_THRESHOLD insertions with the
@@ -31,7 +61,23 @@
  */
 #define TID_RESERVATION_THRESHOLD	5
 
+/*
+ * Once an attribute buffer holds more than its share of encoded data, full
+ * pages are written out from it. Whatever is left in the buffers is written
+ * out at end of transaction, which adds to the COMMIT latency. To keep that
+ * bounded on wide tables, zedstore_tuple_buffer_size is divided among the
+ * attributes, but each attribute gets at least ATTBUFFER_MIN_SIZE, enough
+ * for some full pages, and at most ATTBUFFER_SIZE.
+ *
+ * zedstore_tuple_buffer_size also limits the total amount of data buffered
+ * for all tables in the backend. When it's exceeded, the largest attribute
+ * buffers are spilled to disk first, see tuplebuffers_enforce_limit().
+ */
 #define ATTBUFFER_SIZE				(1024 * 1024)
+#define ATTBUFFER_MIN_SIZE			(16 * BLCKSZ)
+
+/* GUC variable, in kB */
+int			zedstore_tuple_buffer_size = 16384;
 
 typedef struct
 {
@@ -42,6 +88,9 @@ typedef struct
 
 	attstream_buffer chunks;
 
+	int			flush_size;		/* write out full pages beyond this much data */
+	int			toast_threshold;	/* toast datums larger than this */
+
 } attbuffer;
 
 typedef struct
@@ -53,12 +102,21 @@ typedef struct
 	attbuffer	*attbuffers;
 
 	uint64		num_repeated_inserts;	/* number of inserted tuples since last flush */
+	int64		num_buffered_rows;	/* rows spooled since last flush */
+	zstid		first_buffered_tid; /* TID range of the rows spooled since */
+	zstid		last_buffered_tid;	/* last flush, if num_buffered_rows > 0 */
 
 	TransactionId reserved_tids_xid;
 	CommandId	reserved_tids_cid;
 	zstid		reserved_tids_start;
 	zstid		reserved_tids_next;
 	zstid		reserved_tids_end;
+	int			reservation_size;	/* size of the next reservation */
+
+	/* sort key for bulk loads, see zsbt_tuplebuffer_sort_slots() */
+	bool		sortkeys_valid;
+	int			nsortkeys;
+	SortSupport sortkeys;
 
 } tuplebuffer;
 
@@ -80,11 +138,53 @@ typedef struct
 static void zsbt_attbuffer_spool(Relation rel, AttrNumber attno, attbuffer *attbuffer, int ntuples, zstid *tids, Datum *datums, bool *isnulls);
 static void zsbt_attbuffer_init(Form_pg_attribute attr, attbuffer *attbuffer);
 static void zsbt_attbuffer_flush(Relation rel, AttrNumber attno, attbuffer *attbuffer, bool all);
+static void zsbt_attbuffer_spill(Relation rel, AttrNumber attno, attbuffer *attbuffer);
 static void tuplebuffer_kill_unused_reserved_tids(Relation rel, tuplebuffer *tupbuffer);
+static void tuplebuffers_enforce_limit(Relation rel);
+static void tuplebuffer_flush_internal(Relation rel, tuplebuffer *tupbuffer);
+static void tuplebuffer_add_tids(Relation rel, tuplebuffer *tupbuffer,
+								 zstid firsttid, zstid lasttid);
+static void tuplebuffer_init_sortkeys(Relation rel, tuplebuffer *tupbuffer);
+static int	tuplebuffer_cmp_slots(const void *a, const void *b, void *arg);
 
 static MemoryContext tuplebuffers_cxt = NULL;
 static struct tuplebuffers_hash *tuplebuffers = NULL;
 
+/* total amount of encoded data in all the attribute buffers */
+static Size tuplebuffers_total_size = 0;
+
+/* total number of rows spooled into the buffers since they were flushed */
+static int64 tuplebuffers_total_rows = 0;
+
+/*
+ * Counters of this backend's tuple buffer activity, since the backend
+ * started. Shown by pg_stat_get_zedstore_tuplebuffers(), along with the
+ * current contents of the buffers.
+ */
+static struct
+{
+	int64		rows_buffered;	/* rows spooled into the buffers */
+	int64		spills;			/* attribute buffers spilled over the limit */
+	int64		reserved_tids_killed;	/* unused reserved TIDs removed */
+	int64		commit_flushes; /* end-of-transaction flushes */
+	double		commit_flush_time;	/* time spent in them, in msec */
+	double		max_commit_flush_time;	/* longest of them, in msec */
+} tuplebuffer_stats;
+
+/*
+ * Relation that a WAL-skipping bulk load is in progress on, if any. See
+ * zsbt_tuplebuffer_begin_skip_wal().
+ */
+static Oid	skip_wal_relid = InvalidOid;
+static RelFileNode skip_wal_node;
+static Oid	skip_wal_checked_relid = InvalidOid;
+
+static inline Size
+attbuffer_pending_size(attbuffer *attbuffer)
+{
+	return attbuffer->chunks.len - attbuffer->chunks.cursor;
+}
+
 static tuplebuffer *
 get_tuplebuffer(Relation rel)
 {
@@ -106,17 +206,28 @@ retry:
 		AttrNumber	attno;
 		int			natts;
 
+		int			flush_size;
+
 		oldcxt = MemoryContextSwitchTo(tuplebuffers_cxt);
 		natts = rel->rd_att->natts;
 		tupbuffer->attbuffers = palloc(natts * sizeof(attbuffer));
 		tupbuffer->natts = natts;
 
+		flush_size = ((Size) zedstore_tuple_buffer_size * 1024) / Max(natts, 1);
+		flush_size = Max(flush_size, ATTBUFFER_MIN_SIZE);
+		flush_size = Min(flush_size, ATTBUFFER_SIZE);
+
 		for (attno = 1; attno <= natts; attno++)
 		{
 			Form_pg_attribute attr = TupleDescAttr(rel->rd_att, attno - 1);
 			attbuffer *attbuffer = &tupbuffer->attbuffers[attno - 1];
 
 			zsbt_attbuffer_init(attr, attbuffer);
+			attbuffer->flush_size = flush_size;
+			if (attr->attlen < 0 && !attr->attisdropped)
+				attbuffer->toast_threshold = zedstore_toast_threshold(rel, attno);
+			else
+				attbuffer->toast_threshold = MaxZedStoreDatumSize;
 		}
 
 		tupbuffer->reserved_tids_xid = InvalidTransactionId;
@@ -124,7 +235,15 @@ retry:
 		tupbuffer->reserved_tids_start = InvalidZSTid;
 		tupbuffer->reserved_tids_next = InvalidZSTid;
 		tupbuffer->reserved_tids_end = InvalidZSTid;
+		tupbuffer->reservation_size = TID_RESERVATION_SIZE;
 		tupbuffer->num_repeated_inserts = 0;
+		tupbuffer->num_buffered_rows = 0;
+		tupbuffer->first_buffered_tid = InvalidZSTid;
+		tupbuffer->last_buffered_tid = InvalidZSTid;
+
+		tupbuffer->sortkeys_valid = false;
+		tupbuffer->nsortkeys = 0;
+		tupbuffer->sortkeys = NULL;
 
 		MemoryContextSwitchTo(oldcxt);
 	}
@@ -157,6 +276,7 @@ zsbt_tuplebuffer_allocate_tid(Relation rel, TransactionId xid, CommandId cid)
 		 */
 		tuplebuffer_kill_unused_reserved_tids(rel, tupbuffer);
 		tupbuffer->num_repeated_inserts = 0;
+		tupbuffer->reservation_size = TID_RESERVATION_SIZE;
 
 		tupbuffer->reserved_tids_xid = xid;
 		tupbuffer->reserved_tids_cid = cid;
@@ -178,11 +298,20 @@ zsbt_tuplebuffer_allocate_tid(Relation rel, TransactionId xid, CommandId cid)
 	else
 	{
 		/* We're in batch mode. Reserve a new block of TIDs. */
-		result = zsbt_tid_multi_insert(rel, TID_RESERVATION_SIZE, xid, cid,
+		int			nreserve = tupbuffer->reservation_size;
+		bool		interleaved;
+
+		result = zsbt_tid_multi_insert(rel, nreserve, xid, cid,
 									   INVALID_SPECULATIVE_TOKEN, InvalidUndoPtr);
+		interleaved = (tupbuffer->reserved_tids_end != InvalidZSTid &&
+					   result != tupbuffer->reserved_tids_end);
 		tupbuffer->reserved_tids_start = result;
 		tupbuffer->reserved_tids_next = result + 1;
-		tupbuffer->reserved_tids_end = result + TID_RESERVATION_SIZE;
+		tupbuffer->reserved_tids_end = result + nreserve;
+		if (interleaved)
+			tupbuffer->reservation_size = TID_MAX_RESERVATION_SIZE;
+		else
+			tupbuffer->reservation_size = Min(nreserve * 2, TID_MAX_RESERVATION_SIZE);
 	}
 
 	tupbuffer->num_repeated_inserts++;
@@ -190,6 +319,206 @@ zsbt_tuplebuffer_allocate_tid(Relation rel, TransactionId xid, CommandId cid)
 	return result;
 }
 
+/*
+ * Allocate a range of consecutive TIDs for a multi-insert.
+ *
+ * This uses the same reservations as zsbt_tuplebuffer_allocate_tid(). After
+ * the first batch, TIDs are reserved for more than one batch at a time, so
+ * that when several backends are loading the same table concurrently, each
+ * one gets long runs of consecutive TIDs. That way, each backend's attribute
+ * data can be written out as full pages with zsbt_attr_add_bulk(), instead
+ * of being merged page by page with the other backends' data.
+ */
+zstid
+zsbt_tuplebuffer_allocate_tids(Relation rel, TransactionId xid, CommandId cid,
+							   int ntids)
+{
+	tuplebuffer *tupbuffer;
+	zstid		result;
+
+	tupbuffer = get_tuplebuffer(rel);
+
+	if (tupbuffer->reserved_tids_xid != xid ||
+		tupbuffer->reserved_tids_cid != cid)
+	{
+		tuplebuffer_kill_unused_reserved_tids(rel, tupbuffer);
+		tupbuffer->num_repeated_inserts = 0;
+		tupbuffer->reservation_size = TID_RESERVATION_SIZE;
+
+		tupbuffer->reserved_tids_xid = xid;
+		tupbuffer->reserved_tids_cid = cid;
+	}
+
+	if (tupbuffer->reserved_tids_end - tupbuffer->reserved_tids_next < ntids)
+	{
+		int			nreserve;
+		zstid		firsttid;
+		bool		interleaved = false;
+
+		/*
+		 * Reserve exactly what's needed for the first batch, so that a
+		 * single-batch COPY leaves no unused TIDs behind.
+		 */
+		if (tupbuffer->num_repeated_inserts == 0)
+			nreserve = ntids;
+		else
+			nreserve = Max(tupbuffer->reservation_size, ntids);
+
+		firsttid = zsbt_tid_multi_insert(rel, nreserve, xid, cid,
+										 INVALID_SPECULATIVE_TOKEN, InvalidUndoPtr);
+
+		if (firsttid == tupbuffer->reserved_tids_end &&
+			tupbuffer->reserved_tids_next != InvalidZSTid)
+		{
+			/* No one else inserted in between, so extend the old reservation */
+			tupbuffer->reserved_tids_end = firsttid + nreserve;
+		}
+		else
+		{
+			/* Someone else reserved TIDs after our previous reservation? */
+			if (tupbuffer->reserved_tids_end != InvalidZSTid)
+				interleaved = true;
+
+			tuplebuffer_kill_unused_reserved_tids(rel, tupbuffer);
+			tupbuffer->reserved_tids_start = firsttid;
+			tupbuffer->reserved_tids_next = firsttid;
+			tupbuffer->reserved_tids_end = firsttid + nreserve;
+		}
+		if (interleaved)
+			tupbuffer->reservation_size = TID_MAX_RESERVATION_SIZE;
+		else if (tupbuffer->num_repeated_inserts > 0)
+			tupbuffer->reservation_size = Min(nreserve * 2, TID_MAX_RESERVATION_SIZE);
+	}
+
+	result = tupbuffer->reserved_tids_next;
+	tupbuffer->reserved_tids_next += ntids;
+	tupbuffer->num_repeated_inserts += ntids;
+
+	return result;
+}
+
+/*
+ * Put a batch of rows in the order that they should be assigned TIDs in.
+ *
+ * Zone maps and run-length encoding work best on sorted data. If some
+ * columns are marked with the "zedstore_sort_key" attribute option, each
+ * batch of rows loaded with a multi-insert, like from COPY, is sorted by
+ * those columns before the rows are assigned consecutive TIDs, so that the
+ * load produces value-clustered pages without a separate CLUSTER pass. The
+ * option's value is the column's position in the sort key.
+ *
+ * Returns 'slots' as is if there is no sort key. Otherwise returns a sorted,
+ * palloc'd copy of the array; the caller's array is not modified, as the
+ * caller may keep per-row state in the same order.
+ */
+TupleTableSlot **
+zsbt_tuplebuffer_sort_slots(Relation rel, TupleTableSlot **slots, int ntuples)
+{
+	tuplebuffer *tupbuffer;
+	TupleTableSlot **sorted;
+
+	tupbuffer = get_tuplebuffer(rel);
+	if (!tupbuffer->sortkeys_valid)
+		tuplebuffer_init_sortkeys(rel, tupbuffer);
+
+	if (tupbuffer->nsortkeys == 0 || ntuples < 2)
+		return slots;
+
+	for (int i = 0; i < ntuples; i++)
+		slot_getallattrs(slots[i]);
+
+	sorted = palloc(ntuples * sizeof(TupleTableSlot *));
+	memcpy(sorted, slots, ntuples * sizeof(TupleTableSlot *));
+	qsort_arg(sorted, ntuples, sizeof(TupleTableSlot *),
+			  tuplebuffer_cmp_slots, tupbuffer);
+
+	return sorted;
+}
+
+/*
+ * Look up the sort key from the attribute options. It stays the same until
+ * the end of the transaction, when the tuple buffer is discarded.
+ */
+static void
+tuplebuffer_init_sortkeys(Relation rel, tuplebuffer *tupbuffer)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	AttrNumber	keyattnos[INDEX_MAX_KEYS];
+	int			nkeys = 0;
+
+	memset(keyattnos, 0, sizeof(keyattnos));
+	for (AttrNumber attno = 1; attno <= tupdesc->natts; attno++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attno - 1);
+		AttributeOpts *aopt;
+		int			keypos = 0;
+
+		if (attr->attisdropped)
+			continue;
+
+		aopt = get_attribute_options(RelationGetRelid(rel), attno);
+		if (aopt)
+		{
+			keypos = aopt->zedstore_sort_key;
+			pfree(aopt);
+		}
+
+		/* if two columns claim the same position, the first one wins */
+		if (keypos > 0 && keyattnos[keypos - 1] == InvalidAttrNumber)
+			keyattnos[keypos - 1] = attno;
+	}
+
+	tupbuffer->sortkeys = MemoryContextAllocZero(tuplebuffers_cxt,
+												 INDEX_MAX_KEYS * sizeof(SortSupportData));
+	for (int i = 0; i < INDEX_MAX_KEYS; i++)
+	{
+		AttrNumber	attno = keyattnos[i];
+		Form_pg_attribute attr;
+		TypeCacheEntry *typentry;
+		SortSupport ssup;
+
+		if (attno == InvalidAttrNumber)
+			continue;
+		attr = TupleDescAttr(tupdesc, attno - 1);
+
+		/* a column of a type that can't be sorted is ignored */
+		typentry = lookup_type_cache(attr->atttypid, TYPECACHE_LT_OPR);
+		if (!OidIsValid(typentry->lt_opr))
+			continue;
+
+		ssup = &tupbuffer->sortkeys[nkeys++];
+		ssup->ssup_cxt = tuplebuffers_cxt;
+		ssup->ssup_collation = attr->attcollation;
+		ssup->ssup_nulls_first = false;
+		ssup->ssup_attno = attno;
+		PrepareSortSupportFromOrderingOp(typentry->lt_opr, ssup);
+	}
+	tupbuffer->nsortkeys = nkeys;
+	tupbuffer->sortkeys_valid = true;
+}
+
+static int
+tuplebuffer_cmp_slots(const void *a, const void *b, void *arg)
+{
+	TupleTableSlot *slota = *(TupleTableSlot *const *) a;
+	TupleTableSlot *slotb = *(TupleTableSlot *const *) b;
+	tuplebuffer *tupbuffer = (tuplebuffer *) arg;
+
+	for (int i = 0; i < tupbuffer->nsortkeys; i++)
+	{
+		SortSupport ssup = &tupbuffer->sortkeys[i];
+		int			idx = ssup->ssup_attno - 1;
+		int			cmp;
+
+		cmp = ApplySortComparator(slota->tts_values[idx], slota->tts_isnull[idx],
+								  slotb->tts_values[idx], slotb->tts_isnull[idx],
+								  ssup);
+		if (cmp != 0)
+			return cmp;
+	}
+	return 0;
+}
+
 /* buffer more data */
 void
 zsbt_tuplebuffer_spool_tuple(Relation rel, zstid tid, Datum *datums, bool *isnulls)
@@ -198,6 +527,7 @@ zsbt_tuplebuffer_spool_tuple(Relation rel, zstid tid, Datum *datums, bool *isnul
 	tuplebuffer *tupbuffer;
 
 	tupbuffer = get_tuplebuffer(rel);
+	tuplebuffer_add_tids(rel, tupbuffer, tid, tid);
 
 	for (attno = 1; attno <= rel->rd_att->natts; attno++)
 	{
@@ -206,6 +536,10 @@ zsbt_tuplebuffer_spool_tuple(Relation rel, zstid tid, Datum *datums, bool *isnul
 		Datum		datum;
 		bool		isnull;
 
+		/* dropped columns are not stored, see zsbt_free_dropped_tree() */
+		if (attr->attisdropped)
+			continue;
+
 		datum = datums[attno - 1];
 		isnull = isnulls[attno - 1];
 
@@ -214,13 +548,18 @@ zsbt_tuplebuffer_spool_tuple(Relation rel, zstid tid, Datum *datums, bool *isnul
 
 		/* If this datum is too large, toast it */
 		if (!isnull && attr->attlen < 0 &&
-			VARSIZE_ANY_EXHDR(datum) > MaxZedStoreDatumSize)
+			VARSIZE_ANY_EXHDR(datum) > attbuffer->toast_threshold)
 		{
 			datum = zedstore_toast_datum(rel, attno, datum, tid);
 		}
 
 		zsbt_attbuffer_spool(rel, attno, attbuffer, 1, &tid, &datum, &isnull);
 	}
+	tupbuffer->num_buffered_rows++;
+	tuplebuffers_total_rows++;
+	tuplebuffer_stats.rows_buffered++;
+
+	tuplebuffers_enforce_limit(rel);
 }
 
 void
@@ -232,29 +571,33 @@ zsbt_tuplebuffer_spool_slots(Relation rel, zstid *tids, TupleTableSlot **slots,
 	bool	   *isnulls;
 
 	tupbuffer = get_tuplebuffer(rel);
+	tuplebuffer_add_tids(rel, tupbuffer, tids[0], tids[ntuples - 1]);
 
 	datums = palloc(ntuples * sizeof(Datum));
 	isnulls = palloc(ntuples * sizeof(bool));
 
+	for (int i = 0; i < ntuples; i++)
+		slot_getallattrs(slots[i]);
+
 	for (attno = 1; attno <= rel->rd_att->natts; attno++)
 	{
 		Form_pg_attribute attr = TupleDescAttr(rel->rd_att, attno - 1);
 		attbuffer *attbuffer = &tupbuffer->attbuffers[attno - 1];
 
+		if (attr->attisdropped)
+			continue;
+
 		for (int i = 0; i < ntuples; i++)
 		{
 			Datum		datum = slots[i]->tts_values[attno - 1];
 			bool		isnull = slots[i]->tts_isnull[attno - 1];
 
-			if (attno == 1)
-				slot_getallattrs(slots[i]);
-
 			if (!isnull && attr->attlen < 0 && VARATT_IS_EXTERNAL(datum))
 				datum = PointerGetDatum(detoast_external_attr((struct varlena *) DatumGetPointer(datum)));
 
 			/* If this datum is too large, toast it */
 			if (!isnull && attr->attlen < 0 &&
-				VARSIZE_ANY_EXHDR(datum) > MaxZedStoreDatumSize)
+				VARSIZE_ANY_EXHDR(datum) > attbuffer->toast_threshold)
 			{
 				datum = zedstore_toast_datum(rel, attno, datum, tids[i]);
 			}
@@ -267,18 +610,83 @@ zsbt_tuplebuffer_spool_slots(Relation rel, zstid *tids, TupleTableSlot **slots,
 
 	pfree(datums);
 	pfree(isnulls);
+	tupbuffer->num_buffered_rows += ntuples;
+	tuplebuffers_total_rows += ntuples;
+	tuplebuffer_stats.rows_buffered += ntuples;
+
+	tuplebuffers_enforce_limit(rel);
+}
+
+
+/*
+ * Make room for rows with TIDs between 'firsttid' and 'lasttid' in the
+ * buffer.
+ *
+ * The attribute buffers must be filled in TID order. Inserts consume TIDs
+ * in increasing order, but an UPDATE gets its new TID from the end of the
+ * TID tree, past any TIDs still reserved for inserts. If an insert then
+ * uses one of those reserved TIDs, write out what we have first.
+ */
+static void
+tuplebuffer_add_tids(Relation rel, tuplebuffer *tupbuffer,
+					 zstid firsttid, zstid lasttid)
+{
+	if (tupbuffer->num_buffered_rows > 0 &&
+		firsttid <= tupbuffer->last_buffered_tid)
+		tuplebuffer_flush_internal(rel, tupbuffer);
+
+	if (tupbuffer->num_buffered_rows == 0)
+		tupbuffer->first_buffered_tid = firsttid;
+	tupbuffer->last_buffered_tid = lasttid;
+}
+
+/*
+ * Write out the buffered rows of a table, if the row with 'tid' might be
+ * among them.
+ *
+ * An UPDATE needs to read the old version of the row, but it doesn't need
+ * to write out rows it has buffered earlier, if the old row isn't one of
+ * them. That way, a statement that updates many rows buffers the new
+ * versions like an INSERT would, instead of writing each one separately
+ * to the rightmost leaf of every attribute tree.
+ */
+void
+zsbt_tuplebuffer_flush_tid(Relation rel, zstid tid)
+{
+	tuplebuffer *tupbuffer;
+
+	if (!tuplebuffers)
+		return;
+	tupbuffer = tuplebuffers_lookup(tuplebuffers, RelationGetRelid(rel));
+	if (!tupbuffer)
+		return;
+
+	/*
+	 * Rows that were partially spilled to disk are still counted in
+	 * num_buffered_rows, so this errs on the side of flushing.
+	 */
+	if (tupbuffer->num_buffered_rows > 0 &&
+		tid >= tupbuffer->first_buffered_tid &&
+		tid <= tupbuffer->last_buffered_tid)
+		zsbt_tuplebuffer_flush(rel);
 }
 
+#define ATTBUF_INIT_SIZE 1024
 
 static void
 zsbt_attbuffer_init(Form_pg_attribute attr, attbuffer *attbuffer)
 {
 	attstream_buffer *attbuf = &attbuffer->chunks;
 
-#define ATTBUF_INIT_SIZE 1024
-	attbuf->data = palloc(ATTBUF_INIT_SIZE);
+	/*
+	 * The buffer for the encoded data is allocated on first use, in
+	 * zsbt_attbuffer_flush(). A single-row INSERT never encodes anything
+	 * before the end of the transaction, so on a wide table, that saves
+	 * allocating a buffer for every column in every transaction.
+	 */
+	attbuf->data = NULL;
 	attbuf->len = 0;
-	attbuf->maxlen = ATTBUF_INIT_SIZE;
+	attbuf->maxlen = 0;
 	attbuf->cursor = 0;
 
 	attbuf->firsttid = 0;
@@ -297,6 +705,37 @@ zsbt_attbuffer_spool(Relation rel, AttrNumber attno, attbuffer *attbuffer,
 	int			i;
 	attstream_buffer *chunks = &attbuffer->chunks;
 
+	/*
+	 * If there is nothing buffered yet, and we got a full batch of rows,
+	 * like from COPY, encode them directly from the caller's arrays. That
+	 * saves copying pass-by-reference datums to the buffer, only to encode
+	 * them and pfree the copies a moment later. Only the leftover rows that
+	 * don't fill a whole chunk are buffered.
+	 */
+	if (attbuffer->num_buffered_rows == 0 && ntuples >= 60)
+	{
+		int			num_encoded;
+
+		tuplebuffers_total_size -= attbuffer_pending_size(attbuffer);
+
+		if (chunks->data == NULL)
+		{
+			chunks->data = MemoryContextAlloc(tuplebuffers_cxt, ATTBUF_INIT_SIZE);
+			chunks->maxlen = ATTBUF_INIT_SIZE;
+		}
+		num_encoded = append_attstream(chunks, false, ntuples,
+									   tids, datums, isnulls);
+		tids += num_encoded;
+		datums += num_encoded;
+		isnulls += num_encoded;
+		ntuples -= num_encoded;
+
+		while (chunks->len - chunks->cursor > attbuffer->flush_size)
+			zsbt_attr_add_bulk(rel, attno, chunks);
+
+		tuplebuffers_total_size += attbuffer_pending_size(attbuffer);
+	}
+
 	for (i = 0; i < ntuples; i++)
 	{
 		Datum		datum;
@@ -326,17 +765,26 @@ zsbt_attbuffer_spool(Relation rel, AttrNumber attno, attbuffer *attbuffer,
 
 /* flush */
 
+/*
+ * Encode buffered rows into the attribute buffer's chunks. With 'all', all
+ * of them, otherwise only if there's a full batch of them.
+ */
 static void
-zsbt_attbuffer_flush(Relation rel, AttrNumber attno, attbuffer *attbuffer, bool all)
+zsbt_attbuffer_encode(attbuffer *attbuffer, bool all)
 {
 	int			num_encoded;
 	int			num_remain;
 	attstream_buffer *chunks = &attbuffer->chunks;
 
-	/* First encode more */
 	if (attbuffer->num_buffered_rows >= 60 ||
 		(all && attbuffer->num_buffered_rows > 0))
 	{
+		if (chunks->data == NULL)
+		{
+			chunks->data = MemoryContextAlloc(tuplebuffers_cxt, ATTBUF_INIT_SIZE);
+			chunks->maxlen = ATTBUF_INIT_SIZE;
+		}
+
 		num_encoded = append_attstream(chunks, all, attbuffer->num_buffered_rows,
 									   attbuffer->buffered_tids,
 									   attbuffer->buffered_datums,
@@ -357,11 +805,112 @@ zsbt_attbuffer_flush(Relation rel, AttrNumber attno, attbuffer *attbuffer, bool
 		memmove(attbuffer->buffered_isnulls, &attbuffer->buffered_isnulls[num_encoded], num_remain * sizeof(bool));
 		attbuffer->num_buffered_rows = num_remain;
 	}
+}
 
-	while ((all && chunks->len - chunks->cursor > 0) ||
-		   chunks->len - chunks->cursor > ATTBUFFER_SIZE)
-	{
+static void
+zsbt_attbuffer_flush(Relation rel, AttrNumber attno, attbuffer *attbuffer, bool all)
+{
+	attstream_buffer *chunks = &attbuffer->chunks;
+
+	tuplebuffers_total_size -= attbuffer_pending_size(attbuffer);
+
+	/* First encode more */
+	zsbt_attbuffer_encode(attbuffer, all);
+
+	/*
+	 * If we have accumulated more than our share of data, we're
+	 * bulk-loading. Write out full pages, without re-merging and
+	 * recompressing the rightmost page every time.
+	 */
+	while (chunks->len - chunks->cursor > attbuffer->flush_size)
+		zsbt_attr_add_bulk(rel, attno, chunks);
+
+	while (all && chunks->len - chunks->cursor > 0)
 		zsbt_attr_add(rel, attno, chunks);
+
+	tuplebuffers_total_size += attbuffer_pending_size(attbuffer);
+}
+
+/*
+ * Write out encoded data from an attribute buffer, to free up memory.
+ *
+ * Like zsbt_attbuffer_flush(), this leaves the tail of a large buffer in
+ * place, to be written out with more data later. A small buffer is written
+ * out completely, so that this always makes progress.
+ */
+static void
+zsbt_attbuffer_spill(Relation rel, AttrNumber attno, attbuffer *attbuffer)
+{
+	attstream_buffer *chunks = &attbuffer->chunks;
+
+	tuplebuffers_total_size -= attbuffer_pending_size(attbuffer);
+
+	if (chunks->len - chunks->cursor > ATTBUFFER_MIN_SIZE)
+	{
+		while (chunks->len - chunks->cursor > ATTBUFFER_MIN_SIZE)
+			zsbt_attr_add_bulk(rel, attno, chunks);
+	}
+	else
+	{
+		while (chunks->len - chunks->cursor > 0)
+			zsbt_attr_add(rel, attno, chunks);
+	}
+
+	tuplebuffers_total_size += attbuffer_pending_size(attbuffer);
+}
+
+/*
+ * If the attribute buffers of all tables together hold more than
+ * zedstore_tuple_buffer_size of data, spill the largest ones until we're
+ * below the limit again.
+ *
+ * 'rel' is the table we're currently inserting to. Other tables with
+ * buffered data are opened as needed; we're still holding locks on them,
+ * from when we inserted to them.
+ */
+static void
+tuplebuffers_enforce_limit(Relation rel)
+{
+	Size		limit = (Size) zedstore_tuple_buffer_size * 1024;
+
+	while (tuplebuffers_total_size > limit)
+	{
+		tuplebuffers_iterator iter;
+		tuplebuffer *tupbuffer;
+		tuplebuffer *victim = NULL;
+		AttrNumber	victim_attno = InvalidAttrNumber;
+		Size		victim_size = 0;
+		Relation	victim_rel;
+
+		tuplebuffers_start_iterate(tuplebuffers, &iter);
+		while ((tupbuffer = tuplebuffers_iterate(tuplebuffers, &iter)) != NULL)
+		{
+			for (AttrNumber attno = 1; attno <= tupbuffer->natts; attno++)
+			{
+				Size		size = attbuffer_pending_size(&tupbuffer->attbuffers[attno - 1]);
+
+				if (size > victim_size)
+				{
+					victim = tupbuffer;
+					victim_attno = attno;
+					victim_size = size;
+				}
+			}
+		}
+		if (victim == NULL)
+			break;
+
+		if (victim->relid == RelationGetRelid(rel))
+			victim_rel = rel;
+		else
+			victim_rel = table_open(victim->relid, NoLock);
+
+		zsbt_attbuffer_spill(victim_rel, victim_attno,
+							 &victim->attbuffers[victim_attno - 1]);
+		tuplebuffer_stats.spills++;
+
+		if (victim_rel != rel)
+			table_close(victim_rel, NoLock);
 	}
 }
 
@@ -371,7 +920,7 @@ zsbt_attbuffer_flush(Relation rel, AttrNumber attno, attbuffer *attbuffer, bool
 static void
 tuplebuffer_kill_unused_reserved_tids(Relation rel, tuplebuffer *tupbuffer)
 {
-	IntegerSet *unused_tids;
+	ZSTidStore *unused_tids;
 	zstid		tid;
 
 	if (tupbuffer->reserved_tids_next == tupbuffer->reserved_tids_end)
@@ -380,25 +929,25 @@ tuplebuffer_kill_unused_reserved_tids(Relation rel, tuplebuffer *tupbuffer)
 	/*
 	 * XXX: We use the zsbt_tid_remove() function for this, but it's
 	 * a bit too heavy-weight. It's geared towards VACUUM and removing
-	 * millions of TIDs in one go. Also, we leak the IntegerSet object;
-	 * usually flushing is done at end of transaction, so that's not
-	 * a problem, but it could be if we need to flush a lot in the
-	 * same transaction.
+	 * millions of TIDs in one go.
 	 *
 	 * XXX: It would be nice to adjust the UNDO record, too. Otherwise,
 	 * if we abort, the poor sod that tries to discard the UNDO record
 	 * will try to mark these TIDs as unused in vein.
 	 */
-	unused_tids = intset_create();
+	unused_tids = zs_tidstore_create();
 
 	for (tid = tupbuffer->reserved_tids_next;
 		 tid < tupbuffer->reserved_tids_end;
 		 tid++)
 	{
-		intset_add_member(unused_tids, tid);
+		zs_tidstore_add(unused_tids, tid);
 	}
 
-	zsbt_tid_remove(rel, unused_tids);
+	zsbt_tid_remove(rel, unused_tids, NULL);
+	zs_tidstore_free(unused_tids);
+	tuplebuffer_stats.reserved_tids_killed +=
+		tupbuffer->reserved_tids_end - tupbuffer->reserved_tids_next;
 
 	tupbuffer->reserved_tids_start = InvalidZSTid;
 	tupbuffer->reserved_tids_next = InvalidZSTid;
@@ -408,9 +957,54 @@ tuplebuffer_kill_unused_reserved_tids(Relation rel, tuplebuffer *tupbuffer)
 static void
 tuplebuffer_flush_internal(Relation rel, tuplebuffer *tupbuffer)
 {
+	AttrNumber *attnos;
+	attstream_buffer **chunks;
+	int			nchunks = 0;
+	/* for the trace probes */
+	int			nrows pg_attribute_unused() = tupbuffer->num_buffered_rows;
+	Size		size_before pg_attribute_unused() = tuplebuffers_total_size;
+
+	TRACE_POSTGRESQL_ZEDSTORE_TUPLEBUFFER_FLUSH_START(RelationGetRelid(rel), nrows);
+
 	tuplebuffer_kill_unused_reserved_tids(rel, tupbuffer);
 
-	/* Flush the attribute data */
+	/*
+	 * Encode all the buffered rows, and write out the small amounts of data
+	 * that can simply be appended to the rightmost leaf of each attribute
+	 * tree, with as few WAL records as possible. Then write out the rest,
+	 * one attribute at a time.
+	 */
+	attnos = palloc(tupbuffer->natts * sizeof(AttrNumber));
+	chunks = palloc(tupbuffer->natts * sizeof(attstream_buffer *));
+	for (AttrNumber attno = 1; attno <= tupbuffer->natts; attno++)
+	{
+		attbuffer *attbuffer = &tupbuffer->attbuffers[attno - 1];
+
+		tuplebuffers_total_size -= attbuffer_pending_size(attbuffer);
+		zsbt_attbuffer_encode(attbuffer, true);
+		tuplebuffers_total_size += attbuffer_pending_size(attbuffer);
+
+		if (attbuffer->chunks.data != NULL &&
+			attbuffer_pending_size(attbuffer) > 0 &&
+			attbuffer_pending_size(attbuffer) <= attbuffer->flush_size)
+		{
+			attnos[nchunks] = attno;
+			chunks[nchunks] = &attbuffer->chunks;
+			nchunks++;
+		}
+	}
+	if (nchunks > 1)
+	{
+		for (int i = 0; i < nchunks; i++)
+			tuplebuffers_total_size -= chunks[i]->len - chunks[i]->cursor;
+		zsbt_attr_add_multi(rel, nchunks, attnos, chunks);
+		for (int i = 0; i < nchunks; i++)
+			tuplebuffers_total_size += chunks[i]->len - chunks[i]->cursor;
+	}
+	pfree(attnos);
+	pfree(chunks);
+
+	/* Flush the rest of the attribute data */
 	for (AttrNumber attno = 1; attno <= tupbuffer->natts; attno++)
 	{
 		attbuffer *attbuffer = &tupbuffer->attbuffers[attno - 1];
@@ -419,6 +1013,14 @@ tuplebuffer_flush_internal(Relation rel, tuplebuffer *tupbuffer)
 	}
 
 	tupbuffer->num_repeated_inserts = 0;
+	tupbuffer->reservation_size = TID_RESERVATION_SIZE;
+	tuplebuffers_total_rows -= tupbuffer->num_buffered_rows;
+	tupbuffer->num_buffered_rows = 0;
+	tupbuffer->first_buffered_tid = InvalidZSTid;
+	tupbuffer->last_buffered_tid = InvalidZSTid;
+
+	TRACE_POSTGRESQL_ZEDSTORE_TUPLEBUFFER_FLUSH_DONE(RelationGetRelid(rel), nrows,
+													(int) (size_before - tuplebuffers_total_size));
 }
 
 void
@@ -437,7 +1039,9 @@ zsbt_tuplebuffer_flush(Relation rel)
 	for (int attno = 1 ; attno <= tupbuffer->natts; attno++)
 	{
 		attbuffer *attbuf = &(tupbuffer->attbuffers[attno-1]);
-		pfree(attbuf->chunks.data);
+
+		if (attbuf->chunks.data)
+			pfree(attbuf->chunks.data);
 	}
 	pfree(tupbuffer->attbuffers);
 
@@ -463,6 +1067,90 @@ zsbt_tuplebuffers_flush(void)
 	}
 }
 
+/*
+ * Skip WAL-logging on a relation, for the rest of a bulk load.
+ *
+ * The caller has checked that wal_level is minimal, and that the relation
+ * was created, or given a new relfilenode, in this transaction, so that it
+ * will be discarded if we crash before commit. Like heap, we then don't
+ * WAL-log the new data, but fsync the relation at the end instead, see
+ * zsbt_tuplebuffer_end_skip_wal().
+ *
+ * Heap only skips WAL for the tuples it inserts, but in zedstore, every
+ * insertion also modifies shared structures: the TID and attribute trees,
+ * the UNDO log and the free page map. Those pages can be WAL-logged by some
+ * operations and modified without WAL by others, and replaying a full-page
+ * image logged before an unlogged change would silently undo it. So we skip
+ * WAL for all changes to the relation while the bulk load is in progress,
+ * and only start doing so when the relation has nothing but the metapage,
+ * which is re-logged as a full-page image at the end. We also only do it at
+ * the top transaction level, so that the relation cannot go away under us.
+ */
+void
+zsbt_tuplebuffer_begin_skip_wal(Relation rel)
+{
+	if (skip_wal_relid == RelationGetRelid(rel) ||
+		skip_wal_checked_relid == RelationGetRelid(rel))
+		return;
+	skip_wal_checked_relid = RelationGetRelid(rel);
+
+	if (OidIsValid(skip_wal_relid) ||
+		!RelationNeedsWAL(rel) ||
+		XLogIsNeeded() ||
+		GetCurrentTransactionNestLevel() != 1 ||
+		RelationGetNumberOfBlocks(rel) > ZS_META_BLK + 1)
+		return;
+
+	skip_wal_relid = RelationGetRelid(rel);
+	skip_wal_node = rel->rd_node;
+}
+
+/*
+ * Finish a WAL-skipping bulk load, making the data written so far durable.
+ */
+void
+zsbt_tuplebuffer_end_skip_wal(Relation rel)
+{
+	if (skip_wal_relid != RelationGetRelid(rel))
+		return;
+
+	zsbt_tuplebuffer_flush(rel);
+
+	skip_wal_relid = InvalidOid;
+	skip_wal_checked_relid = InvalidOid;
+
+	/*
+	 * The metapage was WAL-logged when the relation was created. Log it
+	 * again, so that replay doesn't restore that old image over the
+	 * current contents.
+	 */
+	if (RelationGetNumberOfBlocks(rel) > ZS_META_BLK)
+	{
+		Buffer		metabuf = ReadBuffer(rel, ZS_META_BLK);
+
+		LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+		log_newpage_buffer(metabuf, true);
+		UnlockReleaseBuffer(metabuf);
+	}
+
+	heap_sync(rel);
+}
+
+/*
+ * Does this change to the relation need to be WAL-logged?
+ *
+ * All WAL-logging in zedstore checks this, rather than RelationNeedsWAL(),
+ * so that nothing is logged during a WAL-skipping bulk load.
+ */
+bool
+zs_relation_needs_wal(Relation rel)
+{
+	if (!RelationNeedsWAL(rel))
+		return false;
+	if (OidIsValid(skip_wal_relid) && RelFileNodeEquals(rel->rd_node, skip_wal_node))
+		return false;
+	return true;
+}
 
 /* check in a scan */
 
@@ -503,11 +1191,43 @@ AtEOXact_zedstore_tuplebuffers(bool isCommit)
 	if (tuplebuffers_cxt)
 	{
 		if (isCommit)
+		{
+			instr_time	start_time;
+			instr_time	duration;
+			double		msecs;
+
+			INSTR_TIME_SET_CURRENT(start_time);
 			zsbt_tuplebuffers_flush();
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, start_time);
+
+			msecs = INSTR_TIME_GET_MILLISEC(duration);
+			tuplebuffer_stats.commit_flushes++;
+			tuplebuffer_stats.commit_flush_time += msecs;
+			if (msecs > tuplebuffer_stats.max_commit_flush_time)
+				tuplebuffer_stats.max_commit_flush_time = msecs;
+		}
 		MemoryContextDelete(tuplebuffers_cxt);
 		tuplebuffers_cxt = NULL;
 		tuplebuffers = NULL;
+		tuplebuffers_total_size = 0;
+		tuplebuffers_total_rows = 0;
 	}
+
+	/*
+	 * A bulk load should've been finished already, but make sure we don't
+	 * commit unlogged data without syncing it. On abort, the relation is
+	 * discarded, as it was created in this transaction.
+	 */
+	if (OidIsValid(skip_wal_relid) && isCommit)
+	{
+		Relation	rel = table_open(skip_wal_relid, NoLock);
+
+		zsbt_tuplebuffer_end_skip_wal(rel);
+		table_close(rel, NoLock);
+	}
+	skip_wal_relid = InvalidOid;
+	skip_wal_checked_relid = InvalidOid;
 }
 
 void
@@ -519,6 +1239,8 @@ AtSubStart_zedstore_tuplebuffers(void)
 		MemoryContextDelete(tuplebuffers_cxt);
 		tuplebuffers_cxt = NULL;
 		tuplebuffers = NULL;
+		tuplebuffers_total_size = 0;
+		tuplebuffers_total_rows = 0;
 	}
 }
 
@@ -532,5 +1254,42 @@ AtEOSubXact_zedstore_tuplebuffers(bool isCommit)
 		MemoryContextDelete(tuplebuffers_cxt);
 		tuplebuffers_cxt = NULL;
 		tuplebuffers = NULL;
+		tuplebuffers_total_size = 0;
+		tuplebuffers_total_rows = 0;
 	}
 }
+
+/*
+ * SQL-callable function to show the tuple buffers of this backend.
+ *
+ * The first columns show what's currently buffered, the rest are counters
+ * since the backend started.
+ */
+Datum
+pg_stat_get_zedstore_tuplebuffers(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_ZEDSTORE_TUPLEBUFFERS_COLS	9
+	TupleDesc	tupdesc;
+	Datum		values[PG_STAT_GET_ZEDSTORE_TUPLEBUFFERS_COLS];
+	bool		nulls[PG_STAT_GET_ZEDSTORE_TUPLEBUFFERS_COLS];
+	Size		memory = 0;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tuplebuffers_cxt)
+		memory = MemoryContextMemAllocated(tuplebuffers_cxt, true);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(tuplebuffers_total_rows);
+	values[1] = Int64GetDatum((int64) tuplebuffers_total_size);
+	values[2] = Int64GetDatum((int64) memory);
+	values[3] = Int64GetDatum(tuplebuffer_stats.rows_buffered);
+	values[4] = Int64GetDatum(tuplebuffer_stats.spills);
+	values[5] = Int64GetDatum(tuplebuffer_stats.reserved_tids_killed);
+	values[6] = Int64GetDatum(tuplebuffer_stats.commit_flushes);
+	values[7] = Float8GetDatum(tuplebuffer_stats.commit_flush_time);
+	values[8] = Float8GetDatum(tuplebuffer_stats.max_commit_flush_time);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
@@ -4,7 +4,9 @@
  *
  * This implementation is identical to a Virtual tuple slot
  * (TTSOpsVirtual), but it has a slot_getsysattr() implementation
- * that can fetch and compute the 'xmin' for the tuple.
+ * that can fetch and compute the 'xmin' for the tuple. It also remembers
+ * which columns a projected scan filled in, so that materializing or copying
+ * the slot doesn't need to look at all the columns of a wide table.
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -26,11 +28,17 @@ tts_zedstore_init(TupleTableSlot *slot)
 {
 	ZedstoreTupleTableSlot *zslot = (ZedstoreTupleTableSlot *) slot;
 	zslot->visi_info = NULL;
+	zslot->proj_atts = NULL;
+	zslot->proj_atts_buf = NULL;
 }
 
 static void
 tts_zedstore_release(TupleTableSlot *slot)
 {
+	ZedstoreTupleTableSlot *zslot = (ZedstoreTupleTableSlot *) slot;
+
+	if (zslot->proj_atts_buf)
+		pfree(zslot->proj_atts_buf);
 }
 
 static void
@@ -50,6 +58,24 @@ tts_zedstore_clear(TupleTableSlot *slot)
 	ItemPointerSetInvalid(&slot->tts_tid);
 
 	zslot->visi_info = NULL;
+	zslot->proj_atts = NULL;
+}
+
+/*
+ * Number of columns that can be non-NULL in the slot, and the index of the
+ * i'th of them in tts_values/tts_isnull. See 'proj_atts' in
+ * ZedstoreTupleTableSlot.
+ */
+static inline int
+tts_zedstore_num_filled(ZedstoreTupleTableSlot *zslot, int natts)
+{
+	return zslot->proj_atts ? zslot->num_proj_atts : natts;
+}
+
+static inline int
+tts_zedstore_filled_att(ZedstoreTupleTableSlot *zslot, int i)
+{
+	return zslot->proj_atts ? zslot->proj_atts[i] - 1 : i;
 }
 
 /*
@@ -100,6 +126,7 @@ tts_zedstore_materialize(TupleTableSlot *slot)
 {
 	ZedstoreTupleTableSlot *vslot = (ZedstoreTupleTableSlot *) slot;
 	TupleDesc	desc = slot->tts_tupleDescriptor;
+	int			nfilled;
 	Size		sz = 0;
 	char	   *data;
 
@@ -114,9 +141,24 @@ tts_zedstore_materialize(TupleTableSlot *slot)
 		vslot->visi_info = &vslot->visi_info_buf;
 	}
 
+	/* likewise the list of filled columns */
+	if (vslot->proj_atts && vslot->proj_atts != vslot->proj_atts_buf)
+	{
+		if (vslot->proj_atts_buf == NULL)
+			vslot->proj_atts_buf = MemoryContextAlloc(slot->tts_mcxt,
+													  desc->natts * sizeof(int));
+		Assert(vslot->num_proj_atts <= desc->natts);
+		memcpy(vslot->proj_atts_buf, vslot->proj_atts,
+			   vslot->num_proj_atts * sizeof(int));
+		vslot->proj_atts = vslot->proj_atts_buf;
+	}
+
+	nfilled = tts_zedstore_num_filled(vslot, desc->natts);
+
 	/* compute size of memory required */
-	for (int natt = 0; natt < desc->natts; natt++)
+	for (int i = 0; i < nfilled; i++)
 	{
+		int			natt = tts_zedstore_filled_att(vslot, i);
 		Form_pg_attribute att = TupleDescAttr(desc, natt);
 		Datum val;
 
@@ -151,8 +193,9 @@ tts_zedstore_materialize(TupleTableSlot *slot)
 	slot->tts_flags |= TTS_FLAG_SHOULDFREE;
 
 	/* and copy all attributes into the pre-allocated space */
-	for (int natt = 0; natt < desc->natts; natt++)
+	for (int i = 0; i < nfilled; i++)
 	{
+		int			natt = tts_zedstore_filled_att(vslot, i);
 		Form_pg_attribute att = TupleDescAttr(desc, natt);
 		Datum val;
 
@@ -208,10 +251,30 @@ tts_zedstore_copyslot(TupleTableSlot *dstslot, TupleTableSlot *srcslot)
 
 	slot_getallattrs(srcslot);
 
-	for (int natt = 0; natt < srcdesc->natts; natt++)
+	if (srcslot->tts_ops == &TTSOpsZedstore &&
+		((ZedstoreTupleTableSlot *) srcslot)->proj_atts)
 	{
-		dstslot->tts_values[natt] = srcslot->tts_values[natt];
-		dstslot->tts_isnull[natt] = srcslot->tts_isnull[natt];
+		ZedstoreTupleTableSlot *zsrcslot = (ZedstoreTupleTableSlot *) srcslot;
+
+		/* only the projected columns can be non-NULL */
+		memset(dstslot->tts_isnull, true, srcdesc->natts * sizeof(bool));
+		for (int i = 0; i < zsrcslot->num_proj_atts; i++)
+		{
+			int			natt = zsrcslot->proj_atts[i] - 1;
+
+			dstslot->tts_values[natt] = srcslot->tts_values[natt];
+			dstslot->tts_isnull[natt] = srcslot->tts_isnull[natt];
+		}
+		zdstslot->num_proj_atts = zsrcslot->num_proj_atts;
+		zdstslot->proj_atts = zsrcslot->proj_atts;
+	}
+	else
+	{
+		for (int natt = 0; natt < srcdesc->natts; natt++)
+		{
+			dstslot->tts_values[natt] = srcslot->tts_values[natt];
+			dstslot->tts_isnull[natt] = srcslot->tts_isnull[natt];
+		}
 	}
 
 	if (srcslot->tts_ops == &TTSOpsZedstore)
@@ -226,6 +289,61 @@ tts_zedstore_copyslot(TupleTableSlot *dstslot, TupleTableSlot *srcslot)
 	tts_zedstore_materialize(dstslot);
 }
 
+/*
+ * Clear 'slot', and make sure that the columns not listed in 'proj_atts' are
+ * NULL, so that a scan can fill the slot with just the projected columns.
+ *
+ * Setting all the columns to NULL costs O(natts), which adds up when a
+ * narrow projection of a wide table is scanned. If the slot still holds a
+ * row filled with the same projection, the other columns are already NULL,
+ * and we leave them alone. That relies on the usual convention that a slot's
+ * contents are not modified in place without clearing it first;
+ * ExecClearTuple() forgets the projection, so after that we start over.
+ *
+ * 'proj_atts' is an array of 'num_proj_atts' attribute numbers. The caller
+ * must call zs_slot_set_projection() with the same list after filling in the
+ * values.
+ */
+void
+zs_slot_clear_for_projection(TupleTableSlot *slot, int num_proj_atts,
+							 const int *proj_atts)
+{
+	ZedstoreTupleTableSlot *zslot = (ZedstoreTupleTableSlot *) slot;
+	bool		same;
+
+	Assert(slot->tts_ops == &TTSOpsZedstore);
+
+	same = (zslot->proj_atts != NULL &&
+			zslot->num_proj_atts == num_proj_atts &&
+			memcmp(zslot->proj_atts, proj_atts, num_proj_atts * sizeof(int)) == 0);
+
+	ExecClearTuple(slot);
+
+	if (!same)
+		memset(slot->tts_isnull, true,
+			   slot->tts_tupleDescriptor->natts * sizeof(bool));
+}
+
+/*
+ * Remember that only the columns in 'proj_atts' can be non-NULL in the slot.
+ */
+void
+zs_slot_set_projection(TupleTableSlot *slot, int num_proj_atts,
+					   const int *proj_atts)
+{
+	ZedstoreTupleTableSlot *zslot = (ZedstoreTupleTableSlot *) slot;
+
+	Assert(slot->tts_ops == &TTSOpsZedstore);
+	Assert(num_proj_atts <= slot->tts_tupleDescriptor->natts);
+
+	if (zslot->proj_atts_buf == NULL)
+		zslot->proj_atts_buf = MemoryContextAlloc(slot->tts_mcxt,
+												  slot->tts_tupleDescriptor->natts * sizeof(int));
+	memcpy(zslot->proj_atts_buf, proj_atts, num_proj_atts * sizeof(int));
+	zslot->num_proj_atts = num_proj_atts;
+	zslot->proj_atts = zslot->proj_atts_buf;
+}
+
 static HeapTuple
 tts_zedstore_copy_heap_tuple(TupleTableSlot *slot)
 {
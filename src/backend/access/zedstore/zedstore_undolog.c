@@ -32,15 +32,34 @@
 #include "postgres.h"
 
 #include "access/genam.h"
+#include "access/xloginsert.h"
 #include "access/xlogreader.h"
 #include "access/xlogutils.h"
 #include "access/zedstore_internal.h"
+#include "access/zedstore_stats.h"
 #include "access/zedstore_undolog.h"
 #include "access/zedstore_wal.h"
+#include "access/zedstoream.h"
 #include "miscadmin.h"
+#include "postmaster/autovacuum.h"
+#include "pg_trace.h"
 #include "pgstat.h"
+#include "storage/proc.h"
 #include "utils/rel.h"
 
+/* GUC variable, in blocks */
+int			zedstore_autovacuum_undo_threshold = 1024;
+
+/*
+ * Wait until no-one holds a lock on 'buf'. The caller holds a pin on it.
+ */
+static void
+zsundo_wait_for_buffer(Buffer buf)
+{
+	LockBufferWithWaitEvent(buf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_UNDO_TAIL);
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+}
+
 /*
  * Reserve space in the UNDO log for a new UNDO record.
  *
@@ -61,9 +80,16 @@
  * used in the undo page header.
  *
  * The caller is responsible for WAL-logging, and replaying the changes, in
- * case of a crash. (If there isn't enough space on the current latest UNDO
+ * case of a crash. (If there isn't enough space on the current active UNDO
  * page, a new page is allocated and appended to the UNDO log. That allocation
  * is WAL-logged separately, the caller doesn't need to care about that.)
+ *
+ * There are ZS_UNDO_ACTIVE_PAGES active UNDO pages, and each backend inserts
+ * to one of them, so the active page lock is held only against other
+ * backends using the same slot. The counter values are still unique,
+ * because each page has its own range of them. But a record inserted later
+ * can have a smaller counter than a record inserted earlier, on a different
+ * page.
  */
 void
 zsundo_insert_reserve(Relation rel, size_t size, zs_undo_reservation *reservation_p)
@@ -71,35 +97,63 @@ zsundo_insert_reserve(Relation rel, size_t size, zs_undo_reservation *reservatio
 	Buffer		metabuf;
 	Page		metapage;
 	ZSMetaPageOpaque *metaopaque;
+	int			slot;
 	BlockNumber	tail_blk;
 	Buffer		tail_buf = InvalidBuffer;
 	Page		tail_pg = NULL;
 	ZSUndoPageOpaque *tail_opaque = NULL;
 	uint64		next_counter;
 	int			offset;
+	bool		request_trim = false;
 
 	if (size > MaxUndoRecordSize)
 		elog(ERROR, "UNDO record is too large (%zu bytes, max %zu bytes)", size, MaxUndoRecordSize);
 
+	TRACE_POSTGRESQL_ZEDSTORE_UNDO_RESERVE_START(RelationGetRelid(rel), (int) size);
+
+	/*
+	 * Pick the active UNDO page to use. Spreading backends over the slots
+	 * lets them insert UNDO records concurrently.
+	 */
+	slot = (MyProc ? MyProc->pgprocno : 0) % ZS_UNDO_ACTIVE_PAGES;
+
 	metabuf = ReadBuffer(rel, ZS_META_BLK);
 	metapage = BufferGetPage(metabuf);
 
-	LockBuffer(metabuf, BUFFER_LOCK_SHARE);
+	LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
 	metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
 
 retry_lock_tail:
-	tail_blk = metaopaque->zs_undo_tail;
+	tail_blk = metaopaque->zs_undo_active[slot];
 
 	/*
-	 * Is there space on the tail page? If not, allocate a new UNDO page.
+	 * Is there space on our active page? If not, allocate a new UNDO page.
+	 *
+	 * Note that we lock the active page while still holding the metapage
+	 * lock. zsundo_discard() and the replacing of an active page below rely
+	 * on that: once they hold the metapage lock exclusively, no-one can
+	 * start a new reservation on a page they're about to change.
 	 */
 	if (tail_blk != InvalidBlockNumber)
 	{
 		tail_buf = ReadBuffer(rel, tail_blk);
-		LockBuffer(tail_buf, BUFFER_LOCK_EXCLUSIVE);
+		if (!ConditionalLockBuffer(tail_buf))
+		{
+			/*
+			 * Someone else is inserting to the page. Don't wait while
+			 * holding the metapage lock, because the other backend might
+			 * need it to allocate new pages before it's done.
+			 */
+			LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
+			zsundo_wait_for_buffer(tail_buf);
+			ReleaseBuffer(tail_buf);
+			tail_buf = InvalidBuffer;
+			LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
+			goto retry_lock_tail;
+		}
 		tail_pg = BufferGetPage(tail_buf);
 		tail_opaque = (ZSUndoPageOpaque *) PageGetSpecialPointer(tail_pg);
-		Assert(tail_opaque->first_undorecptr.counter == metaopaque->zs_undo_tail_first_counter);
+		Assert(tail_opaque->first_undorecptr.counter <= metaopaque->zs_undo_tail_first_counter);
 	}
 
 	if (tail_blk == InvalidBlockNumber || PageGetExactFreeSpace(tail_pg) < size)
@@ -108,6 +162,9 @@ retry_lock_tail:
 		BlockNumber newblk;
 		Page		newpage;
 		ZSUndoPageOpaque *newopaque;
+		BlockNumber	prev_blk;
+		Buffer		prev_buf;
+		ZSUndoPageOpaque *prev_opaque = NULL;
 
 		/*
 		 * Release the lock on the old tail page and metapage while we find a new block,
@@ -119,27 +176,74 @@ retry_lock_tail:
 			LockBuffer(tail_buf, BUFFER_LOCK_UNLOCK);
 
 		/* new page */
-		newbuf = zspage_getnewbuf(rel);
+		newbuf = zspage_getnewbuf(rel, ZS_INVALID_ATTRIBUTE_NUM);
 
-		LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
-		if (metaopaque->zs_undo_tail != tail_blk)
+relock_meta:
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+		if (metaopaque->zs_undo_active[slot] != tail_blk)
 		{
 			/*
-			 * Someone else extended the UNDO log concurrently. We don't need
-			 * the new page, after all. (Or maybe we do, if the new
-			 * tail block is already full, but we're not smart about it.)
+			 * Someone else replaced our active page concurrently. We don't
+			 * need the new page, after all. (Or maybe we do, if the new
+			 * active page is already full, but we're not smart about it.)
 			 */
-			zspage_delete_page(rel, newbuf, metabuf);
+			zspage_delete_undo_page(rel, newbuf, metabuf);
 			UnlockReleaseBuffer(newbuf);
+			if (BufferIsValid(tail_buf))
+			{
+				ReleaseBuffer(tail_buf);
+				tail_buf = InvalidBuffer;
+			}
 			goto retry_lock_tail;
 		}
-		if (BufferIsValid(tail_buf))
-			LockBuffer(tail_buf, BUFFER_LOCK_EXCLUSIVE);
 
-		if (tail_blk == InvalidBlockNumber)
+		/*
+		 * Wait for any reservations still in progress on the old active
+		 * page to finish, before we stop using it. Once it's replaced, no
+		 * new records are added to it, and zsundo_trim() can treat it as
+		 * complete.
+		 *
+		 * As above, don't wait for the UNDO page locks while holding the
+		 * metapage lock.
+		 */
+		if (BufferIsValid(tail_buf) && !ConditionalLockBuffer(tail_buf))
+		{
+			LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
+			zsundo_wait_for_buffer(tail_buf);
+			goto relock_meta;
+		}
+
+		/*
+		 * The new page is appended to the end of the UNDO chain, and gets the
+		 * next range of counter values.
+		 */
+		prev_blk = metaopaque->zs_undo_tail;
+		if (prev_blk == InvalidBlockNumber)
+		{
+			prev_buf = InvalidBuffer;
 			next_counter = metaopaque->zs_undo_tail_first_counter;
+		}
 		else
-			next_counter = tail_opaque->last_undorecptr.counter + 1;
+		{
+			if (prev_blk == tail_blk)
+				prev_buf = tail_buf;
+			else
+			{
+				prev_buf = ReadBuffer(rel, prev_blk);
+				if (!ConditionalLockBuffer(prev_buf))
+				{
+					if (BufferIsValid(tail_buf))
+						LockBuffer(tail_buf, BUFFER_LOCK_UNLOCK);
+					LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
+					zsundo_wait_for_buffer(prev_buf);
+					ReleaseBuffer(prev_buf);
+					goto relock_meta;
+				}
+			}
+			prev_opaque = (ZSUndoPageOpaque *) PageGetSpecialPointer(BufferGetPage(prev_buf));
+			Assert(prev_opaque->first_undorecptr.counter == metaopaque->zs_undo_tail_first_counter);
+			next_counter = metaopaque->zs_undo_tail_first_counter + ZS_UNDO_PAGE_COUNTERS;
+		}
 
 		START_CRIT_SECTION();
 
@@ -155,48 +259,70 @@ retry_lock_tail:
 		newopaque->zs_page_id = ZS_UNDO_PAGE_ID;
 		MarkBufferDirty(newbuf);
 
+		metaopaque->zs_undo_active[slot] = newblk;
 		metaopaque->zs_undo_tail = newblk;
 		metaopaque->zs_undo_tail_first_counter = next_counter;
-		if (tail_blk == InvalidBlockNumber)
+		if (prev_blk == InvalidBlockNumber)
 			metaopaque->zs_undo_head = newblk;
 		MarkBufferDirty(metabuf);
 
-		if (tail_blk != InvalidBlockNumber)
+		if (prev_blk != InvalidBlockNumber)
 		{
-			tail_opaque->next = newblk;
-			MarkBufferDirty(tail_buf);
+			prev_opaque->next = newblk;
+			MarkBufferDirty(prev_buf);
 		}
 
-		if (RelationNeedsWAL(rel))
+		if (zs_relation_needs_wal(rel))
 		{
 			wal_zedstore_undo_newpage xlrec;
 			XLogRecPtr recptr;
 
 			xlrec.first_counter = next_counter;
+			xlrec.active_slot = slot;
 
 			XLogBeginInsert();
 			XLogRegisterData((char *) &xlrec, SizeOfZSWalUndoNewPage);
 
 			XLogRegisterBuffer(0, metabuf, REGBUF_STANDARD);
-			if (BufferIsValid(tail_buf))
-				XLogRegisterBuffer(1, tail_buf, REGBUF_STANDARD);
+			if (BufferIsValid(prev_buf))
+				XLogRegisterBuffer(1, prev_buf, REGBUF_STANDARD);
 			XLogRegisterBuffer(2, newbuf, REGBUF_WILL_INIT | REGBUF_STANDARD);
 
 			recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_UNDO_NEWPAGE);
 
 			PageSetLSN(BufferGetPage(metabuf), recptr);
-			if (BufferIsValid(tail_buf))
-				PageSetLSN(BufferGetPage(tail_buf), recptr);
+			if (BufferIsValid(prev_buf))
+				PageSetLSN(BufferGetPage(prev_buf), recptr);
 			PageSetLSN(BufferGetPage(newbuf), recptr);
 		}
 
-		if (tail_blk != InvalidBlockNumber)
+		if (BufferIsValid(prev_buf) && prev_buf != tail_buf)
+			UnlockReleaseBuffer(prev_buf);
+		if (BufferIsValid(tail_buf))
 			UnlockReleaseBuffer(tail_buf);
 
 		END_CRIT_SECTION();
 
 		Assert(size <= PageGetExactFreeSpace(newpage));
 
+		/*
+		 * If the UNDO log has grown past the threshold, ask autovacuum to
+		 * trim it. We ask again every time it grows by another threshold's
+		 * worth of pages, in case a previous request was lost or the trim
+		 * was held back by an old snapshot.
+		 */
+		if (zedstore_autovacuum_undo_threshold > 0 &&
+			!RelationUsesLocalBuffers(rel))
+		{
+			uint64		backlog;
+
+			backlog = (next_counter - metaopaque->zs_undo_oldestptr.counter) /
+				ZS_UNDO_PAGE_COUNTERS;
+			if (backlog > 0 &&
+				backlog % (uint64) zedstore_autovacuum_undo_threshold == 0)
+				request_trim = true;
+		}
+
 		tail_blk = newblk;
 		tail_buf = newbuf;
 		tail_pg = newpage;
@@ -206,18 +332,29 @@ retry_lock_tail:
 	{
 		if (IsZSUndoRecPtrValid(&tail_opaque->last_undorecptr))
 		{
-			Assert(tail_opaque->last_undorecptr.counter >= metaopaque->zs_undo_tail_first_counter);
+			Assert(tail_opaque->last_undorecptr.counter >= tail_opaque->first_undorecptr.counter);
 			next_counter = tail_opaque->last_undorecptr.counter + 1;
 		}
 		else
-		{
 			next_counter = tail_opaque->first_undorecptr.counter;
-			Assert(next_counter == metaopaque->zs_undo_tail_first_counter);
-		}
+		Assert(next_counter < tail_opaque->first_undorecptr.counter + ZS_UNDO_PAGE_COUNTERS);
 	}
 
 	UnlockReleaseBuffer(metabuf);
 
+	if (request_trim)
+	{
+		bool		recorded;
+
+		recorded = AutoVacuumRequestWork(AVW_ZedstoreTrimUndo,
+										 RelationGetRelid(rel),
+										 InvalidBlockNumber);
+		if (!recorded)
+			ereport(LOG,
+					(errmsg("request for zedstore UNDO trim for table \"%s\" was not recorded",
+							RelationGetRelationName(rel))));
+	}
+
 	/*
 	 * All set for writing the record. But since we haven't modified the page
 	 * yet, we are free to still turn back and release the lock without writing
@@ -231,6 +368,8 @@ retry_lock_tail:
 	reservation_p->undorecptr.blkno = tail_blk;
 	reservation_p->undorecptr.offset = offset;
 	reservation_p->length = size;
+
+	TRACE_POSTGRESQL_ZEDSTORE_UNDO_RESERVE_DONE(RelationGetRelid(rel), (int) size, tail_blk);
 	reservation_p->ptr = ((char *) tail_pg) + offset;
 }
 
@@ -301,9 +440,9 @@ zsundo_fetch(Relation rel, ZSUndoRecPtr undoptr, Buffer *buf_p, int lockmode,
 	 *
 	 * To avoid that, try to lock the page optimistically, but if we would
 	 * block, check in the metapage that the page hasn't been discarded away.
-	 * zsundo_discard() keeps the metapage locked, so if we lock the page
-	 * while holding the metapage, we can be sure that it's the UNDO page
-	 * we're looking for.
+	 * zsundo_discard() keeps the metapage locked while it recycles pages,
+	 * so if we lock the page while holding the metapage, we can be sure that
+	 * it's the UNDO page we're looking for.
 	 */
 	if (!ConditionalLockBufferInMode(buf, lockmode))
 	{
@@ -312,7 +451,7 @@ zsundo_fetch(Relation rel, ZSUndoRecPtr undoptr, Buffer *buf_p, int lockmode,
 
 		metabuf = ReadBuffer(rel, ZS_META_BLK);
 		metapage = BufferGetPage(metabuf);
-		LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
 		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
 
 		if (metaopaque->zs_undo_oldestptr.counter > undoptr.counter)
@@ -398,67 +537,118 @@ record_missing:
  * Discard old UNDO log, recycling any now-unused pages.
  *
  * Updates the metapage with the oldest value that remains after the discard.
+ *
+ * The pages are discarded in batches of up to ZS_UNDO_DISCARD_BATCH pages,
+ * with one WAL record per batch. The metapage is locked only for the
+ * duration of one batch, so that a discard of a long UNDO log, after a big
+ * load, doesn't block everyone else that needs the metapage for long.
  */
 void
 zsundo_discard(Relation rel, ZSUndoRecPtr oldest_undorecptr)
 {
-	/* Scan the undo log from oldest to newest */
-	Buffer		metabuf;
-	Page		metapage;
-	ZSMetaPageOpaque *metaopaque;
-	BlockNumber	nextblk;
+	bool		first = true;
+	bool		done = false;
 
-	metabuf = ReadBuffer(rel, ZS_META_BLK);
-	metapage = BufferGetPage(metabuf);
-	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
-	metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
-
-	nextblk = metaopaque->zs_undo_head;
-	while (nextblk != InvalidBlockNumber)
+	while (!done)
 	{
-		BlockNumber blk = nextblk;
-		Buffer		buf;
-		Page		page;
-		ZSUndoPageOpaque *opaque;
-		bool		discard_this_page = false;
-		BlockNumber nextfreeblkno = InvalidBlockNumber;
+		Buffer		metabuf;
+		Page		metapage;
+		ZSMetaPageOpaque *metaopaque;
+		Buffer		bufs[ZS_UNDO_DISCARD_BATCH];
+		BlockNumber blknos[ZS_UNDO_DISCARD_BATCH];
+		int			ndiscard = 0;
+		BlockNumber	nextblk;
+		BlockNumber prev_fpm_head;
 
-		buf = ReadBuffer(rel, blk);
-		page = BufferGetPage(buf);
-		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		metabuf = ReadBuffer(rel, ZS_META_BLK);
+		metapage = BufferGetPage(metabuf);
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_EXCLUSIVE, ZS_WAIT_METAPAGE);
+		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
 
-		/*
-		 * check that the page still looks like what we'd expect.
-		 *
-		 * FIXME: how to recover? Should these be just warnings?
-		 */
-		if (PageIsEmpty(page))
-			elog(ERROR, "corrupted zedstore table; oldest UNDO log page is empty");
+		/* Scan the undo log from oldest to newest */
+		nextblk = metaopaque->zs_undo_head;
+		while (ndiscard < ZS_UNDO_DISCARD_BATCH)
+		{
+			BlockNumber blk = nextblk;
+			Buffer		buf;
+			Page		page;
+			ZSUndoPageOpaque *opaque;
+			bool		discard_this_page;
 
-		if (PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSUndoPageOpaque)))
-			elog(ERROR, "corrupted zedstore table; oldest page in UNDO log is not an UNDO page");
-		opaque = (ZSUndoPageOpaque *) PageGetSpecialPointer(page);
-		if (opaque->zs_page_id != ZS_UNDO_PAGE_ID)
-			elog(ERROR, "corrupted zedstore table; oldest page in UNDO log has unexpected page id %d",
-				 opaque->zs_page_id);
-		/* FIXME: Also check here that the max UndoRecPtr on the page is less
-		 * than the new 'oldest_undorecptr'
-		 */
+			if (blk == InvalidBlockNumber)
+			{
+				done = true;
+				break;
+			}
+
+			buf = ReadBuffer(rel, blk);
+			page = BufferGetPage(buf);
+			LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+
+			/*
+			 * check that the page still looks like what we'd expect.
+			 *
+			 * FIXME: how to recover? Should these be just warnings?
+			 */
+			if (PageIsEmpty(page))
+				elog(ERROR, "corrupted zedstore table; oldest UNDO log page is empty");
+
+			if (PageGetSpecialSize(page) != MAXALIGN(sizeof(ZSUndoPageOpaque)))
+				elog(ERROR, "corrupted zedstore table; oldest page in UNDO log is not an UNDO page");
+			opaque = (ZSUndoPageOpaque *) PageGetSpecialPointer(page);
+			if (opaque->zs_page_id != ZS_UNDO_PAGE_ID)
+				elog(ERROR, "corrupted zedstore table; oldest page in UNDO log has unexpected page id %d",
+					 opaque->zs_page_id);
+			/* FIXME: Also check here that the max UndoRecPtr on the page is less
+			 * than the new 'oldest_undorecptr'
+			 */
+
+			/*
+			 * An empty page can be discarded if no record can be added to it
+			 * anymore below 'oldest_undorecptr'. That's not true for an active
+			 * page that zsundo_trim() stopped at.
+			 */
+			if (IsZSUndoRecPtrValid(&opaque->last_undorecptr))
+				discard_this_page = (opaque->last_undorecptr.counter < oldest_undorecptr.counter);
+			else
+				discard_this_page = (opaque->first_undorecptr.counter < oldest_undorecptr.counter);
+
+			if (!discard_this_page)
+			{
+				/* The rest of the chain is newer than this page */
+				UnlockReleaseBuffer(buf);
+				done = true;
+				break;
+			}
 
-		if (!IsZSUndoRecPtrValid(&opaque->last_undorecptr) ||
-			opaque->last_undorecptr.counter < oldest_undorecptr.counter)
-			discard_this_page = true;
+			if (blk == oldest_undorecptr.blkno)
+				elog(ERROR, "corrupted UNDO page chain, tried to discard active page");
 
-		if (discard_this_page && blk == oldest_undorecptr.blkno)
-			elog(ERROR, "corrupted UNDO page chain, tried to discard active page");
+			bufs[ndiscard] = buf;
+			blknos[ndiscard] = blk;
+			ndiscard++;
+			nextblk = opaque->next;
+		}
 
-		nextblk = opaque->next;
+		/*
+		 * If the previous batch happened to end at the last discardable page,
+		 * there's nothing more to do. (The first batch always updates the
+		 * oldest pointer, even if no pages can be discarded.)
+		 */
+		if (ndiscard == 0 && !first)
+		{
+			UnlockReleaseBuffer(metabuf);
+			break;
+		}
 
 		START_CRIT_SECTION();
 
-		metaopaque->zs_undo_oldestptr = oldest_undorecptr;
+		/* A concurrent discard might've moved it further already */
+		if (metaopaque->zs_undo_oldestptr.counter < oldest_undorecptr.counter)
+			metaopaque->zs_undo_oldestptr = oldest_undorecptr;
 
-		if (discard_this_page)
+		prev_fpm_head = metaopaque->zs_undo_fpm_head;
+		if (ndiscard > 0)
 		{
 			if (nextblk == InvalidBlockNumber)
 			{
@@ -469,45 +659,133 @@ zsundo_discard(Relation rel, ZSUndoRecPtr oldest_undorecptr)
 			else
 				metaopaque->zs_undo_head = nextblk;
 
-			/* Add the discarded page to the free page list */
-			nextfreeblkno = metaopaque->zs_fpm_head;
-			zspage_mark_page_deleted(page, nextfreeblkno);
-			metaopaque->zs_fpm_head = blk;
-
-			MarkBufferDirty(buf);
+			/*
+			 * Add the discarded pages to the list of free UNDO pages, in
+			 * order. Each page points to the one discarded before it, so
+			 * that replay can reconstruct the links from the block numbers
+			 * alone.
+			 */
+			for (int j = 0; j < ndiscard; j++)
+			{
+				/* If this was an active page, forget it */
+				for (int i = 0; i < ZS_UNDO_ACTIVE_PAGES; i++)
+				{
+					if (metaopaque->zs_undo_active[i] == blknos[j])
+						metaopaque->zs_undo_active[i] = InvalidBlockNumber;
+				}
+
+				zspage_mark_page_deleted(BufferGetPage(bufs[j]),
+										 j == 0 ? prev_fpm_head : blknos[j - 1]);
+				MarkBufferDirty(bufs[j]);
+			}
+			metaopaque->zs_undo_fpm_head = blknos[ndiscard - 1];
 		}
 
 		MarkBufferDirty(metabuf);
 
-		if (RelationNeedsWAL(rel))
+		if (zs_relation_needs_wal(rel))
 		{
 			wal_zedstore_undo_discard xlrec;
 			XLogRecPtr recptr;
 
 			xlrec.oldest_undorecptr = oldest_undorecptr;
 			xlrec.oldest_undopage = nextblk;
+			xlrec.prev_fpm_head = prev_fpm_head;
+			xlrec.ndiscarded = ndiscard;
 
+			XLogEnsureRecordSpace(ZS_UNDO_DISCARD_BATCH, 0);
 			XLogBeginInsert();
 			XLogRegisterData((char *) &xlrec, SizeOfZSWalUndoDiscard);
 			XLogRegisterBuffer(0, metabuf, REGBUF_STANDARD);
 
-			if (discard_this_page)
-			{
-				XLogRegisterBuffer(1, buf, REGBUF_KEEP_DATA | REGBUF_WILL_INIT | REGBUF_STANDARD);
-				XLogRegisterBufData(1, (char *) &nextfreeblkno, sizeof(BlockNumber));
-			}
+			for (int j = 0; j < ndiscard; j++)
+				XLogRegisterBuffer(1 + j, bufs[j], REGBUF_WILL_INIT | REGBUF_STANDARD);
 
 			recptr = XLogInsert(RM_ZEDSTORE_ID, WAL_ZEDSTORE_UNDO_DISCARD);
 
-			PageSetLSN(BufferGetPage(metabuf), recptr);
+			PageSetLSN(metapage, recptr);
+			for (int j = 0; j < ndiscard; j++)
+				PageSetLSN(BufferGetPage(bufs[j]), recptr);
 		}
 
 		END_CRIT_SECTION();
 
-		UnlockReleaseBuffer(buf);
+		for (int j = 0; j < ndiscard; j++)
+			UnlockReleaseBuffer(bufs[j]);
+		UnlockReleaseBuffer(metabuf);
+
+		if (ndiscard > 0)
+			zs_stats_count_undo_discard(rel, ndiscard);
+
+		first = false;
+
+		CHECK_FOR_INTERRUPTS();
 	}
+}
 
-	UnlockReleaseBuffer(metabuf);
+/*
+ * Summarize the UNDO log of a table, for monitoring.
+ *
+ * This only reads the metapage and the oldest UNDO page. Pages are assigned
+ * consecutive ranges of counter values in the order that they're linked into
+ * the chain, so the number of pages follows from the first counters of the
+ * oldest and the newest page.
+ *
+ * We don't hold the metapage lock while locking the oldest page, because a
+ * backend holding a lock on an UNDO page might be waiting for the metapage.
+ * If the oldest page is discarded in between, we just try again.
+ */
+void
+zsundo_get_stats(Relation rel, ZSUndoLogStats *stats)
+{
+	memset(stats, 0, sizeof(ZSUndoLogStats));
+	stats->head = InvalidBlockNumber;
+	stats->tail = InvalidBlockNumber;
+
+	if (RelationGetNumberOfBlocks(rel) == 0)
+		return;
+
+	for (;;)
+	{
+		Buffer		metabuf;
+		ZSMetaPageOpaque *metaopaque;
+		Buffer		buf;
+		Page		page;
+		ZSUndoPageOpaque *opaque;
+		bool		valid;
+
+		metabuf = ReadBuffer(rel, ZS_META_BLK);
+		LockBufferWithWaitEvent(metabuf, BUFFER_LOCK_SHARE, ZS_WAIT_METAPAGE);
+		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(BufferGetPage(metabuf));
+		stats->head = metaopaque->zs_undo_head;
+		stats->tail = metaopaque->zs_undo_tail;
+		stats->tail_counter = metaopaque->zs_undo_tail_first_counter;
+		stats->oldest_counter = metaopaque->zs_undo_oldestptr.counter;
+		UnlockReleaseBuffer(metabuf);
+
+		if (stats->head == InvalidBlockNumber)
+		{
+			stats->npages = 0;
+			break;
+		}
+
+		buf = ReadBuffer(rel, stats->head);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		opaque = (ZSUndoPageOpaque *) PageGetSpecialPointer(page);
+		valid = (PageGetSpecialSize(page) == MAXALIGN(sizeof(ZSUndoPageOpaque)) &&
+				 opaque->zs_page_id == ZS_UNDO_PAGE_ID &&
+				 opaque->first_undorecptr.counter <= stats->tail_counter);
+		if (valid)
+			stats->npages = (stats->tail_counter - opaque->first_undorecptr.counter) /
+				ZS_UNDO_PAGE_COUNTERS + 1;
+		UnlockReleaseBuffer(buf);
+
+		if (valid)
+			break;
+
+		CHECK_FOR_INTERRUPTS();
+	}
 }
 
 void
@@ -517,23 +795,13 @@ zsundo_discard_redo(XLogReaderState *record)
 	wal_zedstore_undo_discard *xlrec = (wal_zedstore_undo_discard *) XLogRecGetData(record);
 	ZSUndoRecPtr oldest_undorecptr = xlrec->oldest_undorecptr;
 	BlockNumber nextblk = xlrec->oldest_undopage;
+	int			ndiscard = xlrec->ndiscarded;
+	BlockNumber blknos[ZS_UNDO_DISCARD_BATCH];
 	Buffer		metabuf;
-	bool		discard_this_page;
-	BlockNumber discardedblkno = InvalidBlockNumber;
-	BlockNumber	nextfreeblkno = InvalidBlockNumber;
 
-	discard_this_page = XLogRecHasBlockRef(record, 1);
-	if (discard_this_page)
-	{
-		Size		datalen;
-		char	   *data;
-
-		XLogRecGetBlockTag(record, 1, NULL, NULL, &discardedblkno);
-		data = XLogRecGetBlockData(record, 1, &datalen);
-		Assert(datalen == sizeof(BlockNumber));
-
-		memcpy(&nextfreeblkno, data, sizeof(BlockNumber));
-	}
+	Assert(ndiscard <= ZS_UNDO_DISCARD_BATCH);
+	for (int j = 0; j < ndiscard; j++)
+		XLogRecGetBlockTag(record, 1 + j, NULL, NULL, &blknos[j]);
 
 	if (XLogReadBufferForRedo(record, 0, &metabuf) == BLK_NEEDS_REDO)
 	{
@@ -541,9 +809,10 @@ zsundo_discard_redo(XLogReaderState *record)
 		ZSMetaPageOpaque *metaopaque;
 
 		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
-		metaopaque->zs_undo_oldestptr = oldest_undorecptr;
+		if (metaopaque->zs_undo_oldestptr.counter < oldest_undorecptr.counter)
+			metaopaque->zs_undo_oldestptr = oldest_undorecptr;
 
-		if (discard_this_page)
+		if (ndiscard > 0)
 		{
 			if (nextblk == InvalidBlockNumber)
 			{
@@ -554,22 +823,32 @@ zsundo_discard_redo(XLogReaderState *record)
 			else
 				metaopaque->zs_undo_head = nextblk;
 
-			/* Add the discarded page to the free page list */
-			metaopaque->zs_fpm_head = discardedblkno;
+			for (int j = 0; j < ndiscard; j++)
+			{
+				for (int i = 0; i < ZS_UNDO_ACTIVE_PAGES; i++)
+				{
+					if (metaopaque->zs_undo_active[i] == blknos[j])
+						metaopaque->zs_undo_active[i] = InvalidBlockNumber;
+				}
+			}
+
+			/* Add the discarded pages to the list of free UNDO pages */
+			metaopaque->zs_undo_fpm_head = blknos[ndiscard - 1];
 		}
 
 		PageSetLSN(metapage, lsn);
 		MarkBufferDirty(metabuf);
 	}
 
-	if (discard_this_page)
+	for (int j = 0; j < ndiscard; j++)
 	{
 		Buffer		discardedbuf;
 		Page		discardedpage;
 
-		discardedbuf = XLogInitBufferForRedo(record, 1);
+		discardedbuf = XLogInitBufferForRedo(record, 1 + j);
 		discardedpage = BufferGetPage(discardedbuf);
-		zspage_mark_page_deleted(discardedpage, nextfreeblkno);
+		zspage_mark_page_deleted(discardedpage,
+								 j == 0 ? xlrec->prev_fpm_head : blknos[j - 1]);
 
 		PageSetLSN(discardedpage, lsn);
 		MarkBufferDirty(discardedbuf);
@@ -602,6 +881,7 @@ zsundo_newpage_redo(XLogReaderState *record)
 		ZSMetaPageOpaque *metaopaque;
 
 		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+		metaopaque->zs_undo_active[xlrec->active_slot] = newblk;
 		metaopaque->zs_undo_tail = newblk;
 		metaopaque->zs_undo_tail_first_counter = xlrec->first_counter;
 		if (!has_prev_block)
@@ -24,19 +24,30 @@
 
 #include "access/genam.h"
 #include "access/multixact.h"
+#include "access/parallel.h"
+#include "access/relation.h"
+#include "access/table.h"
+#include "access/xact.h"
 #include "access/xlogreader.h"
 #include "access/xlogutils.h"
 #include "access/zedstore_internal.h"
+#include "access/zedstore_stats.h"
 #include "access/zedstore_undolog.h"
 #include "access/zedstore_undorec.h"
 #include "access/zedstore_wal.h"
+#include "access/zedstoream.h"
 #include "commands/progress.h"
+#include "catalog/pg_am.h"
 #include "commands/vacuum.h"
-#include "lib/integerset.h"
 #include "miscadmin.h"
+#include "optimizer/paths.h"
+#include "port/atomics.h"
 #include "postmaster/autovacuum.h"
+#include "pg_trace.h"
 #include "pgstat.h"
 #include "storage/lmgr.h"
+#include "storage/proc.h"
+#include "storage/shm_toc.h"
 #include "utils/memutils.h"
 #include "utils/pg_rusage.h"
 #include "utils/rel.h"
@@ -62,16 +73,96 @@ typedef struct ZSVacRelStats
 	BlockNumber pages_removed;
 	double		tuples_deleted;
 
-	IntegerSet *dead_tids;
+	/*
+	 * Dead TIDs of the current batch. In a parallel worker, this is attached
+	 * to the leader's copy in shared memory.
+	 */
+	ZSTidStore *dead_tids;
+	uint64		num_dead_tids;
+
+	/* parallel index vacuuming */
+	int			nworkers;		/* 0 means process indexes serially */
+	bool	   *index_parallel_safe;
 } ZSVacRelStats;
 
+/*
+ * VACUUM compacts and truncates the relation when there are at least
+ * ZS_REL_TRUNCATE_MINIMUM or (relsize / ZS_REL_TRUNCATE_FRACTION) (whichever
+ * is less) free pages, like heap VACUUM.
+ */
+#define ZS_REL_TRUNCATE_MINIMUM		1000
+#define ZS_REL_TRUNCATE_FRACTION	16
+
+/*
+ * Parallel VACUUM.
+ *
+ * Each index pass, i.e. bulk deletion of a batch of dead TIDs, and the
+ * final cleanup, can be performed by parallel workers, one index per
+ * participant at a time. The leader participates too. Collecting the dead
+ * TIDs and removing them from the TID and attribute trees is done by the
+ * leader alone.
+ *
+ * The dead TIDs are passed to the workers by copying the ZSTidStore into
+ * the DSM segment, which is possible because its representation is flat.
+ */
+#define PARALLEL_VACUUM_KEY_SHARED		UINT64CONST(0xA000000000000001)
+#define PARALLEL_VACUUM_KEY_DEAD_TIDS	UINT64CONST(0xA000000000000002)
+
+/*
+ * Per-index state of a parallel index pass. 'stats' holds the result of
+ * ambulkdelete or amvacuumcleanup from the participant that processed the
+ * index, to be passed to the next call for the same index. That assumes
+ * the index AM doesn't return a larger struct of its own, which is true
+ * for the built-in AMs.
+ */
+typedef struct ZSParallelIndexState
+{
+	bool		parallel_safe;	/* may a worker process this index? */
+	bool		stats_valid;	/* is 'stats' set? */
+	IndexBulkDeleteResult stats;
+} ZSParallelIndexState;
+
+typedef struct ZSParallelVacuumShared
+{
+	Oid			relid;
+	int			elevel;
+	bool		for_cleanup;	/* amvacuumcleanup rather than ambulkdelete? */
+	BlockNumber rel_pages;
+	BlockNumber tupcount_pages;
+	double		old_live_tuples;
+	double		new_rel_tuples;
+	uint64		num_dead_tids;
+
+	/* next index to process, advanced by each participant */
+	pg_atomic_uint32 nextindex;
+
+	int			nindexes;
+	ZSParallelIndexState indexes[FLEXIBLE_ARRAY_MEMBER];
+} ZSParallelVacuumShared;
+
 static bool zs_lazy_tid_reaped(ItemPointer itemptr, void *state);
+static void zs_vacuum_compress_tails(Relation rel, ZSVacRelStats *vacrelstats);
+static int	zs_parallel_vacuum_compute_workers(Relation *Irel, int nindexes,
+											   bool *parallel_safe);
+static void zs_vacuum_all_indexes(Relation rel, Relation *Irel, int nindexes,
+								  IndexBulkDeleteResult **indstats,
+								  ZSVacRelStats *vacrelstats, bool for_cleanup);
+static void zs_parallel_vacuum_indexes(Relation rel, Relation *Irel, int nindexes,
+									   IndexBulkDeleteResult **indstats,
+									   ZSVacRelStats *vacrelstats, bool for_cleanup);
+static void zs_parallel_vacuum_process_indexes(ZSParallelVacuumShared *shared,
+											   Relation *Irel,
+											   ZSVacRelStats *vacrelstats);
 static void lazy_vacuum_index(Relation indrel,
 				  IndexBulkDeleteResult **stats,
 				  ZSVacRelStats *vacrelstats);
 static void lazy_cleanup_index(Relation indrel,
-				   IndexBulkDeleteResult *stats,
+				   IndexBulkDeleteResult **stats,
 				   ZSVacRelStats *vacrelstats);
+static void lazy_update_index_stats(Relation indrel,
+						IndexBulkDeleteResult *stats,
+						ZSVacRelStats *vacrelstats,
+						PGRUsage *ru0);
 
 
 /*
@@ -90,6 +181,9 @@ zsundo_fetch_record(Relation rel, ZSUndoRecPtr undoptr)
 	ZSUndoRec  *undorec;
 	Buffer		buf;
 
+	zs_stats_count_undo_fetch(rel);
+	TRACE_POSTGRESQL_ZEDSTORE_UNDO_FETCH_START(RelationGetRelid(rel), undoptr.blkno,
+											   undoptr.offset);
 	undorec = (ZSUndoRec *) zsundo_fetch(rel, undoptr, &buf, BUFFER_LOCK_SHARE, true);
 
 	if (undorec)
@@ -103,9 +197,65 @@ zsundo_fetch_record(Relation rel, ZSUndoRecPtr undoptr)
 	if (BufferIsValid(buf))
 		UnlockReleaseBuffer(buf);
 
+	TRACE_POSTGRESQL_ZEDSTORE_UNDO_FETCH_DONE(RelationGetRelid(rel), undoptr.blkno,
+											  undoptr.offset,
+											  undorec_copy ? (int) undorec_copy->size : 0);
 	return undorec_copy;
 }
 
+/*
+ * Set hint bits on an UNDO record, like SetHintBits() does for heap tuples.
+ *
+ * 'undorec' is a backend-local copy of the record, as returned by
+ * zsundo_fetch_record(). The bits are set on the copy, and on the UNDO page,
+ * if the record still exists. The caller must've checked that the
+ * transaction is no longer in progress.
+ */
+void
+zsundo_set_hint_bits(Relation rel, ZSUndoRec *undorec, uint8 hintbits)
+{
+	ZSUndoRec  *pagerec;
+	Buffer		buf;
+
+	undorec->hintbits |= hintbits;
+
+	/*
+	 * With asynchronous commit, the commit record might not be flushed yet.
+	 * Like SetHintBits(), don't mark the record as committed until it is,
+	 * or the hint could survive a crash that the commit doesn't.
+	 */
+	if ((hintbits & ZSUNDO_XID_COMMITTED) != 0 &&
+		RelationNeedsWAL(rel))
+	{
+		XLogRecPtr	commitLSN = TransactionIdGetCommitLSN(undorec->xid);
+
+		if (XLogNeedsFlush(commitLSN))
+			return;
+	}
+
+	/*
+	 * Dirtying the page for a hint could WAL-log a full-page image of it,
+	 * which mustn't happen during a WAL-skipping bulk load. The hint is
+	 * just an optimization, so skip it.
+	 */
+	if (RelationNeedsWAL(rel) && !zs_relation_needs_wal(rel))
+		return;
+
+	pagerec = (ZSUndoRec *) zsundo_fetch(rel, undorec->undorecptr, &buf,
+										 BUFFER_LOCK_SHARE, true);
+	if (pagerec)
+	{
+		if (pagerec->undorecptr.counter == undorec->undorecptr.counter &&
+			TransactionIdEquals(pagerec->xid, undorec->xid) &&
+			(pagerec->hintbits & hintbits) != hintbits)
+		{
+			pagerec->hintbits |= hintbits;
+			MarkBufferDirtyHint(buf, true);
+		}
+	}
+	if (BufferIsValid(buf))
+		UnlockReleaseBuffer(buf);
+}
 
 zs_pending_undo_op *
 zsundo_create_for_delete(Relation rel, TransactionId xid, CommandId cid, zstid tid,
@@ -136,8 +286,12 @@ zsundo_create_for_delete(Relation rel, TransactionId xid, CommandId cid, zstid t
 		if (orig_undorec->rec.type != ZSUNDO_TYPE_DELETE)
 			elog(ERROR, "unexpected undo record type %d, expected DELETE", orig_undorec->rec.type);
 
-		/* Is there space for a new TID in the record? */
-		if (orig_undorec->num_tids < ZSUNDO_NUM_TIDS_PER_DELETE)
+		/*
+		 * Can we extend the last TID range in the record, or is there space
+		 * for a new range?
+		 */
+		if (tid == orig_undorec->ranges[orig_undorec->num_ranges - 1].endtid ||
+			orig_undorec->num_ranges < ZSUNDO_NUM_RANGES_PER_DELETE)
 		{
 			pending_op = palloc(offsetof(zs_pending_undo_op, payload) + sizeof(ZSUndoRec_Delete));
 			undorec = (ZSUndoRec_Delete *) pending_op->payload;
@@ -149,8 +303,14 @@ zsundo_create_for_delete(Relation rel, TransactionId xid, CommandId cid, zstid t
 			pending_op->is_update = true;
 
 			memcpy(undorec, orig_undorec, sizeof(ZSUndoRec_Delete));
-			undorec->tids[undorec->num_tids] = tid;
-			undorec->num_tids++;
+			if (tid == undorec->ranges[undorec->num_ranges - 1].endtid)
+				undorec->ranges[undorec->num_ranges - 1].endtid++;
+			else
+			{
+				undorec->ranges[undorec->num_ranges].firsttid = tid;
+				undorec->ranges[undorec->num_ranges].endtid = tid + 1;
+				undorec->num_ranges++;
+			}
 
 			return pending_op;
 		}
@@ -168,13 +328,16 @@ zsundo_create_for_delete(Relation rel, TransactionId xid, CommandId cid, zstid t
 	undorec = (ZSUndoRec_Delete *) pending_op->payload;
 	undorec->rec.size = sizeof(ZSUndoRec_Delete);
 	undorec->rec.type = ZSUNDO_TYPE_DELETE;
+	undorec->rec.hintbits = 0;
 	undorec->rec.undorecptr = pending_op->reservation.undorecptr;
 	undorec->rec.xid = xid;
 	undorec->rec.cid = cid;
 	undorec->changedPart = changedPart;
 	undorec->rec.prevundorec = prev_undo_ptr;
-	undorec->tids[0] = tid;
-	undorec->num_tids = 1;
+	memset(undorec->ranges, 0, sizeof(undorec->ranges));
+	undorec->ranges[0].firsttid = tid;
+	undorec->ranges[0].endtid = tid + 1;
+	undorec->num_ranges = 1;
 
 	/* XXX: this caching mechanism assumes that once we've reserved the undo record,
 	 * we never change our minds and don't write the undo record, after all.
@@ -216,6 +379,7 @@ zsundo_create_for_insert(Relation rel, TransactionId xid, CommandId cid, zstid t
 
 	undorec->rec.size = sizeof(ZSUndoRec_Insert);
 	undorec->rec.type = ZSUNDO_TYPE_INSERT;
+	undorec->rec.hintbits = 0;
 	undorec->rec.undorecptr = pending_op->reservation.undorecptr;
 	undorec->rec.xid = xid;
 	undorec->rec.cid = cid;
@@ -245,6 +409,7 @@ zsundo_create_for_update(Relation rel, TransactionId xid, CommandId cid,
 	undorec = (ZSUndoRec_Update *) pending_op->payload;
 	undorec->rec.size = sizeof(ZSUndoRec_Update);
 	undorec->rec.type = ZSUNDO_TYPE_UPDATE;
+	undorec->rec.hintbits = 0;
 	undorec->rec.undorecptr = pending_op->reservation.undorecptr;
 	undorec->rec.xid = xid;
 	undorec->rec.cid = cid;
@@ -274,6 +439,7 @@ zsundo_create_for_tuple_lock(Relation rel, TransactionId xid, CommandId cid,
 	undorec = (ZSUndoRec_TupleLock *) pending_op->payload;
 	undorec->rec.size = sizeof(ZSUndoRec_TupleLock);
 	undorec->rec.type = ZSUNDO_TYPE_TUPLE_LOCK;
+	undorec->rec.hintbits = 0;
 	undorec->rec.undorecptr = pending_op->reservation.undorecptr;
 	undorec->rec.xid = xid;
 	undorec->rec.cid = cid;
@@ -283,16 +449,58 @@ zsundo_create_for_tuple_lock(Relation rel, TransactionId xid, CommandId cid,
 	return pending_op;
 }
 
+/*
+ * Is 'blk' one of the active UNDO pages in 'active_pages'?
+ */
+static bool
+zsundo_is_active_page(BlockNumber *active_pages, BlockNumber blk)
+{
+	for (int i = 0; i < ZS_UNDO_ACTIVE_PAGES; i++)
+	{
+		if (active_pages[i] == blk)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Read the current oldest UNDO pointer from the metapage.
+ */
+static ZSUndoRecPtr
+zsundo_read_oldest_undo_ptr(Relation rel)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	ZSMetaPageOpaque *metaopaque;
+	ZSUndoRecPtr result;
+
+	metabuf = ReadBuffer(rel, ZS_META_BLK);
+	metapage = BufferGetPage(metabuf);
+	LockBuffer(metabuf, BUFFER_LOCK_SHARE);
+	metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+
+	result = metaopaque->zs_undo_oldestptr;
+	UnlockReleaseBuffer(metabuf);
+
+	return result;
+}
 
 /*
  * Scan the UNDO log, starting from oldest entry. Undo the effects of any
  * aborted transactions. Records for committed transactions can be discarded
  * away immediately.
  *
+ * If 'nowait' is true, and another backend is already trimming the log,
+ * we don't wait for it, but return the current oldest pointer from the
+ * metapage. If 'max_pages' is > 0, we stop after processing that many UNDO
+ * pages; the next call will continue from where we left off. '*complete'
+ * is set to true, if we got as far as OldestXmin allows.
+ *
  * Returns the oldest valid UNDO ptr, after discarding.
  */
 static ZSUndoRecPtr
-zsundo_trim(Relation rel, TransactionId OldestXmin)
+zsundo_trim(Relation rel, TransactionId OldestXmin, bool nowait, int max_pages,
+			bool *complete)
 {
 	/* Scan the undo log from oldest to newest */
 	Buffer		metabuf;
@@ -302,19 +510,34 @@ zsundo_trim(Relation rel, TransactionId OldestXmin)
 	BlockNumber	lastblk;
 	ZSUndoRecPtr oldest_undorecptr;
 	bool		can_advance_oldestundorecptr;
+	BlockNumber	active_pages[ZS_UNDO_ACTIVE_PAGES];
 	char	   *ptr;
 	char	   *endptr;
 	char	   *pagebuf;
+	int			num_pages;
 
-	pagebuf = palloc(BLCKSZ);
+	*complete = false;
 
-	oldest_undorecptr = InvalidUndoPtr;
+	/*
+	 * Don't trim undo pages in recovery mode to avoid writing new WALs.
+	 */
+	if (RecoveryInProgress())
+		return zsundo_read_oldest_undo_ptr(rel);
 
 	/*
 	 * Ensure that only one process discards at a time. We use a page lock on the
-	 * metapage for that.
+	 * metapage for that. If someone else is already at it, an opportunistic
+	 * caller is happy with whatever they manage to discard.
 	 */
-	LockPage(rel, ZS_META_BLK, ExclusiveLock);
+	if (nowait)
+	{
+		if (!ConditionalLockPage(rel, ZS_META_BLK, ExclusiveLock))
+			return zsundo_read_oldest_undo_ptr(rel);
+	}
+	else
+		LockPage(rel, ZS_META_BLK, ExclusiveLock);
+
+	pagebuf = palloc(BLCKSZ);
 
 	/*
 	 * Get the current oldest undo page from the metapage.
@@ -327,6 +550,7 @@ zsundo_trim(Relation rel, TransactionId OldestXmin)
 	firstblk = metaopaque->zs_undo_head;
 
 	oldest_undorecptr = metaopaque->zs_undo_oldestptr;
+	memcpy(active_pages, metaopaque->zs_undo_active, sizeof(active_pages));
 
 	/*
 	 * If we assume that only one process can call TRIM at a time, then we
@@ -337,18 +561,13 @@ zsundo_trim(Relation rel, TransactionId OldestXmin)
 	 */
 	UnlockReleaseBuffer(metabuf);
 
-	/*
-	 * Don't trim undo pages in recovery mode to avoid writing new WALs.
-	 */
-	if(RecoveryInProgress())
-		return oldest_undorecptr;
-
 	/*
 	 * Loop through UNDO records, starting from the oldest page, until we
 	 * hit a record that we cannot remove.
 	 */
 	lastblk = firstblk;
 	can_advance_oldestundorecptr = false;
+	num_pages = 0;
 	while (lastblk != InvalidBlockNumber)
 	{
 		Buffer		buf;
@@ -411,7 +630,12 @@ zsundo_trim(Relation rel, TransactionId OldestXmin)
 			 * So we should just collect the TIDs to mark dead here, and pass
 			 * the whole list to zsbt_tid_mark_dead() after the loop.
 			 */
-			did_commit = TransactionIdDidCommit(undorec->xid);
+			if (undorec->hintbits & ZSUNDO_XID_COMMITTED)
+				did_commit = true;
+			else if (undorec->hintbits & ZSUNDO_XID_ABORTED)
+				did_commit = false;
+			else
+				did_commit = TransactionIdDidCommit(undorec->xid);
 
 			switch (undorec->type)
 			{
@@ -431,8 +655,11 @@ zsundo_trim(Relation rel, TransactionId OldestXmin)
 						if (did_commit)
 						{
 							/* The deletion is now visible to everyone */
-							for (int i = 0; i < deleterec->num_tids; i++)
-								zsbt_tid_mark_dead(rel, deleterec->tids[i], oldest_undorecptr);
+							for (int i = 0; i < deleterec->num_ranges; i++)
+							{
+								for (zstid tid = deleterec->ranges[i].firsttid; tid < deleterec->ranges[i].endtid; tid++)
+									zsbt_tid_mark_dead(rel, tid, oldest_undorecptr);
+							}
 						}
 						else
 						{
@@ -441,9 +668,12 @@ zsundo_trim(Relation rel, TransactionId OldestXmin)
 							 * becomes visible to everyone when the UNDO record is discarded
 							 * away.
 							 */
-							for (int i = 0; i < deleterec->num_tids; i++)
-								zsbt_tid_undo_deletion(rel, deleterec->tids[i], undorec->undorecptr,
-									oldest_undorecptr);
+							for (int i = 0; i < deleterec->num_ranges; i++)
+							{
+								for (zstid tid = deleterec->ranges[i].firsttid; tid < deleterec->ranges[i].endtid; tid++)
+									zsbt_tid_undo_deletion(rel, tid, undorec->undorecptr,
+														   oldest_undorecptr);
+							}
 						}
 					}
 					break;
@@ -463,31 +693,57 @@ zsundo_trim(Relation rel, TransactionId OldestXmin)
 
 		if (ptr < endptr)
 		{
+			*complete = true;
 			break;
 		}
-		else
+
+		/* We processed all records on the page. */
+		Assert(ptr == endptr);
+		num_pages++;
+
+		/*
+		 * If new records can still be added to this page, we must stop here.
+		 * They will get counter values from this page's range, which are
+		 * smaller than those on any later page. Advance to the counter that
+		 * the next record on this page will get, which hasn't been created
+		 * yet, and which is still needed.
+		 *
+		 * The same applies if we've used up our budget of pages. A closed
+		 * page won't get any more records, so everything up to the end of
+		 * its counter range is known to be discardable.
+		 */
+		if (opaque->next == InvalidBlockNumber ||
+			zsundo_is_active_page(active_pages, lastblk) ||
+			(max_pages > 0 && num_pages >= max_pages))
 		{
-			/* We processed all records on the page. Step to the next one, if any. */
-			Assert(ptr == endptr);
-			lastblk = opaque->next;
+			uint64		next_counter;
+
+			if (IsZSUndoRecPtrValid(&opaque->last_undorecptr))
+				next_counter = opaque->last_undorecptr.counter + 1;
+			else
+				next_counter = opaque->first_undorecptr.counter;
+
+			if (next_counter > oldest_undorecptr.counter)
+			{
+				oldest_undorecptr.counter = next_counter;
+				oldest_undorecptr.blkno = InvalidBlockNumber;
+				oldest_undorecptr.offset = 0;
+				can_advance_oldestundorecptr = true;
+			}
+			if (opaque->next == InvalidBlockNumber ||
+				zsundo_is_active_page(active_pages, lastblk))
+				*complete = true;
+			break;
 		}
+
+		/* Step to the next page */
+		lastblk = opaque->next;
 	}
+	if (lastblk == InvalidBlockNumber)
+		*complete = true;
 
 	if (can_advance_oldestundorecptr)
-	{
-		if (lastblk == InvalidBlockNumber)
-		{
-			/*
-			 * We stopped after the last valid record. Advance by one, to the next
-			 * record which hasn't been created yet, and which is still needed.
-			 */
-			oldest_undorecptr.counter++;
-			oldest_undorecptr.blkno = InvalidBlockNumber;
-			oldest_undorecptr.offset = 0;
-		}
-
 		zsundo_discard(rel, oldest_undorecptr);
-	}
 
 	UnlockPage(rel, ZS_META_BLK, ExclusiveLock);
 
@@ -538,7 +794,7 @@ zsundo_clear_speculative_token(Relation rel, ZSUndoRecPtr undoptr)
 	 * a full-page image of the page, if a checkpoint happened between the
 	 * speculative insertion and this call.
 	 */
-	if (RelationNeedsWAL(rel))
+	if (zs_relation_needs_wal(rel))
 	{
 		if (XLogHintBitIsNeeded())
 		{
@@ -614,7 +870,7 @@ zs_lazy_tid_reaped(ItemPointer itemptr, void *state)
 	ZSVacRelStats *vacrelstats = (ZSVacRelStats *) state;
 	zstid		tid = ZSTidFromItemPointer(*itemptr);
 
-	return intset_is_member(vacrelstats->dead_tids, tid);
+	return zs_tidstore_is_member(vacrelstats->dead_tids, tid);
 }
 
 /*
@@ -635,6 +891,11 @@ zsundo_vacuum(Relation rel, VacuumParams *params, BufferAccessStrategy bstrategy
 	zstid		starttid;
 	zstid		endtid;
 	uint64		num_live_tuples;
+	uint64		num_all_visible_tuples;
+	BlockNumber relpages;
+	BlockNumber relallvisible;
+	bool		complete;
+	PGRUsage	ru0;
 
 	/* do nothing if the table is completely empty. */
 	if (RelationGetTargetBlock(rel) == 0 ||
@@ -651,7 +912,17 @@ zsundo_vacuum(Relation rel, VacuumParams *params, BufferAccessStrategy bstrategy
 	/*
 	 * Scan the UNDO log, and discard what we can.
 	 */
-	(void) zsundo_trim(rel, RecentGlobalXmin);
+	(void) zsundo_trim(rel, zsundo_xmin_horizon(rel), false, 0, &complete);
+
+	/* Fold finished ALTER COLUMN TYPE rewrites, reclaiming the obsolete trees */
+	zsbt_fold_rewrites(rel);
+
+	/* Reclaim the space used by dropped columns */
+	for (int attno = 1; attno <= RelationGetNumberOfAttributes(rel); attno++)
+	{
+		if (TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped)
+			zsbt_free_dropped_tree(rel, attno);
+	}
 
 	vacrelstats = (ZSVacRelStats *) palloc0(sizeof(ZSVacRelStats));
 
@@ -660,6 +931,7 @@ zsundo_vacuum(Relation rel, VacuumParams *params, BufferAccessStrategy bstrategy
 	else
 		vacrelstats->elevel = DEBUG2;
 	vacrelstats->vac_strategy = bstrategy;
+	vacrelstats->old_live_tuples = rel->rd_rel->reltuples;
 
 	/* Open all indexes of the relation */
 	vac_open_indexes(rel, RowExclusiveLock, &nindexes, &Irel);
@@ -667,6 +939,11 @@ zsundo_vacuum(Relation rel, VacuumParams *params, BufferAccessStrategy bstrategy
 	indstats = (IndexBulkDeleteResult **)
 		palloc0(nindexes * sizeof(IndexBulkDeleteResult *));
 
+	vacrelstats->index_parallel_safe = (bool *) palloc0(nindexes * sizeof(bool));
+	vacrelstats->nworkers =
+		zs_parallel_vacuum_compute_workers(Irel, nindexes,
+										   vacrelstats->index_parallel_safe);
+
 	ereport(vacrelstats->elevel,
 			(errmsg("vacuuming \"%s.%s\"",
 					get_namespace_name(RelationGetNamespace(rel)),
@@ -674,59 +951,114 @@ zsundo_vacuum(Relation rel, VacuumParams *params, BufferAccessStrategy bstrategy
 
 	starttid = MinZSTid;
 	num_live_tuples = 0;
+	num_all_visible_tuples = 0;
 	do
 	{
-		IntegerSet *dead_tids;
+		ZSTidStore *dead_tids;
 
 		/* Scan the TID tree, to collect TIDs that have been marked dead. */
-		dead_tids = zsbt_collect_dead_tids(rel, starttid, &endtid, &num_live_tuples);
+		dead_tids = zsbt_collect_dead_tids(rel, starttid, &endtid, &num_live_tuples,
+										   &num_all_visible_tuples,
+										   vacrelstats->vac_strategy);
 		vacrelstats->dead_tids = dead_tids;
+		vacrelstats->num_dead_tids = zs_tidstore_num_entries(dead_tids);
 
-		if (intset_num_entries(dead_tids) > 0)
+		if (vacrelstats->num_dead_tids > 0)
 		{
 			/* Remove index entries */
-			for (int i = 0; i < nindexes; i++)
-				lazy_vacuum_index(Irel[i],
-								  &indstats[i],
-								  vacrelstats);
+			zs_vacuum_all_indexes(rel, Irel, nindexes, indstats, vacrelstats,
+								  false);
 
 			/*
 			 * Remove the attribute data for the dead rows, and finally their
 			 * TID tree entries.
 			 */
 			for (int attno = 1; attno <= RelationGetNumberOfAttributes(rel); attno++)
-				zsbt_attr_remove(rel, attno, dead_tids);
-			zsbt_tid_remove(rel, dead_tids);
+			{
+				if (!TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped)
+					zsbt_attr_remove(rel, attno, dead_tids,
+									 vacrelstats->vac_strategy);
+			}
+			zsbt_tid_remove(rel, dead_tids, vacrelstats->vac_strategy);
 		}
 
 		ereport(vacrelstats->elevel,
 				(errmsg("\"%s\": removed " UINT64_FORMAT " row versions",
 						RelationGetRelationName(rel),
-						intset_num_entries(dead_tids))));
+						vacrelstats->num_dead_tids)));
+
+		zs_tidstore_free(dead_tids);
+		vacrelstats->dead_tids = NULL;
 
 		starttid = endtid;
 	} while(starttid < MaxPlusOneZSTid);
 
+	/*
+	 * Compress the data that inserts have appended to the attribute leaves
+	 * uncompressed, so that inserters don't have to. With autovacuum, this
+	 * happens in the background.
+	 */
+	zs_vacuum_compress_tails(rel, vacrelstats);
+
+	/*
+	 * If there are many free pages, move the pages at the end of the
+	 * relation to them, and truncate it. The thresholds are the same as
+	 * heap VACUUM uses for truncating empty pages.
+	 */
+	if (params->truncate != VACOPT_TERNARY_DISABLED)
+	{
+		relpages = RelationGetNumberOfBlocks(rel);
+		(void) zspage_compact(rel,
+							  Max(Min(ZS_REL_TRUNCATE_MINIMUM,
+									  relpages / ZS_REL_TRUNCATE_FRACTION), 1),
+							  vacrelstats->elevel);
+	}
+
+	/*
+	 * The whole TID tree was scanned, so the indexes get an exact count of
+	 * the surviving rows.
+	 */
+	relpages = RelationGetNumberOfBlocks(rel);
+	vacrelstats->rel_pages = relpages;
+	vacrelstats->tupcount_pages = relpages;
+	vacrelstats->new_rel_tuples = num_live_tuples;
+	vacrelstats->new_live_tuples = num_live_tuples;
+
 	/* Do post-vacuum cleanup and statistics update for each index */
+	pg_rusage_init(&ru0);
+	zs_vacuum_all_indexes(rel, Irel, nindexes, indstats, vacrelstats, true);
 	for (int i = 0; i < nindexes; i++)
-		lazy_cleanup_index(Irel[i], indstats[i], vacrelstats);
+		lazy_update_index_stats(Irel[i], indstats[i], vacrelstats, &ru0);
 
 	/* Done with indexes */
 	vac_close_indexes(nindexes, Irel, NoLock);
 
+	/* Refresh the size statistics of the trees, for the planner */
+	zsmeta_update_stats(rel, num_live_tuples, vacrelstats->vac_strategy);
+
 	/*
-	 * Update pg_class to reflect new info we know. The main thing we know for
-	 * sure here is relhasindex or not currently. Using OldestXmin as new
-	 * frozenxid. And since we don't now the new multixid passing it as
-	 * invalid to avoid update. Plus, using false for relallisvisible as don't
-	 * know that either.
-	 *
-	 * FIXME: pass correct numbers for other arguments.
+	 * There is no visibility map, but index-only scans check the TID tree
+	 * instead, see zsbt_tid_is_all_visible(). For the planner's benefit,
+	 * report the fraction of rows that are visible to all as the same
+	 * fraction of the relation's pages.
+	 */
+	if (num_live_tuples > 0)
+		relallvisible = (BlockNumber)
+			((double) relpages * num_all_visible_tuples / num_live_tuples);
+	else
+		relallvisible = 0;
+
+	/*
+	 * Update pg_class to reflect new info we know. The TID tree was scanned
+	 * in full, so the live row count is exact, not an estimate to be blended
+	 * with the old reltuples like lazy vacuum does for a partial scan. Using
+	 * OldestXmin as new frozenxid. And since we don't now the new multixid
+	 * passing it as invalid to avoid update.
 	 */
 	vac_update_relstats(rel,
-						RelationGetNumberOfBlocks(rel),
+						relpages,
 						num_live_tuples,
-						false,
+						relallvisible,
 						nindexes > 0,
 						OldestXmin,
 						InvalidMultiXactId,
@@ -739,6 +1071,36 @@ zsundo_vacuum(Relation rel, VacuumParams *params, BufferAccessStrategy bstrategy
 						 0); /* FIXME: # of dead tuples */
 }
 
+/*
+ * Compress the uncompressed data on the attribute leaves where rows are
+ * being appended, see zsbt_attr_compress_tail().
+ */
+static void
+zs_vacuum_compress_tails(Relation rel, ZSVacRelStats *vacrelstats)
+{
+	zstid		append_points[ZSBT_MAX_APPEND_POINTS];
+	int			npoints;
+	BlockNumber ncompressed = 0;
+
+	npoints = zsbt_tid_get_append_points(rel, append_points);
+	for (int attno = 1; attno <= RelationGetNumberOfAttributes(rel); attno++)
+	{
+		if (TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped)
+			continue;
+		for (int i = 0; i < npoints; i++)
+		{
+			if (zsbt_attr_compress_tail(rel, attno, append_points[i],
+										vacrelstats->vac_strategy))
+				ncompressed++;
+		}
+	}
+
+	if (ncompressed > 0)
+		ereport(vacrelstats->elevel,
+				(errmsg("\"%s\": compressed appended data on %u leaf pages",
+						RelationGetRelationName(rel), ncompressed)));
+}
+
 /*
  *	lazy_vacuum_index() -- vacuum one index relation.
  *
@@ -770,22 +1132,22 @@ lazy_vacuum_index(Relation indrel,
 	ereport(vacrelstats->elevel,
 			(errmsg("scanned index \"%s\" to remove " UINT64_FORMAT " row versions",
 					RelationGetRelationName(indrel),
-					intset_num_entries(vacrelstats->dead_tids)),
+					vacrelstats->num_dead_tids),
 			 errdetail_internal("%s", pg_rusage_show(&ru0))));
 }
 
 /*
  *	lazy_cleanup_index() -- do post-vacuum cleanup for one index relation.
+ *
+ *		The statistics are reported to pg_class by lazy_update_index_stats()
+ *		afterwards, in the leader.
  */
 static void
 lazy_cleanup_index(Relation indrel,
-				   IndexBulkDeleteResult *stats,
+				   IndexBulkDeleteResult **stats,
 				   ZSVacRelStats *vacrelstats)
 {
 	IndexVacuumInfo ivinfo;
-	PGRUsage	ru0;
-
-	pg_rusage_init(&ru0);
 
 	ivinfo.index = indrel;
 	ivinfo.analyze_only = false;
@@ -800,8 +1162,21 @@ lazy_cleanup_index(Relation indrel,
 	ivinfo.num_heap_tuples = vacrelstats->new_rel_tuples;
 	ivinfo.strategy = vacrelstats->vac_strategy;
 
-	stats = index_vacuum_cleanup(&ivinfo, stats);
+	*stats = index_vacuum_cleanup(&ivinfo, *stats);
+}
 
+/*
+ *	lazy_update_index_stats() -- report the result of index cleanup.
+ *
+ *		Updates pg_class, which cannot be done in a parallel worker, and frees
+ *		'stats'.
+ */
+static void
+lazy_update_index_stats(Relation indrel,
+						IndexBulkDeleteResult *stats,
+						ZSVacRelStats *vacrelstats,
+						PGRUsage *ru0)
+{
 	if (!stats)
 		return;
 
@@ -829,11 +1204,374 @@ lazy_cleanup_index(Relation indrel,
 					   "%s.",
 					   stats->tuples_removed,
 					   stats->pages_deleted, stats->pages_free,
-					   pg_rusage_show(&ru0))));
+					   pg_rusage_show(ru0))));
 
 	pfree(stats);
 }
 
+/*
+ * Decide how many parallel workers to use for the index passes, and which
+ * indexes they may process.
+ *
+ * Only indexes of the built-in AMs are processed by workers, as other AMs
+ * might not be prepared for it, and only if they are large enough, per
+ * min_parallel_index_scan_size. The leader processes the rest, and one of
+ * the parallel-safe indexes, itself.
+ *
+ * Autovacuum, and VACUUM with cost-based delay, always process the indexes
+ * serially: each worker would apply the cost limit separately, multiplying
+ * the I/O rate.
+ */
+static int
+zs_parallel_vacuum_compute_workers(Relation *Irel, int nindexes,
+								   bool *parallel_safe)
+{
+	int			nindexes_parallel = 0;
+
+	if (IsAutoVacuumWorkerProcess() || VacuumCostDelay > 0 ||
+		max_parallel_maintenance_workers == 0 || nindexes < 2)
+		return 0;
+
+	for (int i = 0; i < nindexes; i++)
+	{
+		Oid			amid = Irel[i]->rd_rel->relam;
+
+		parallel_safe[i] = false;
+		if (amid != BTREE_AM_OID && amid != HASH_AM_OID &&
+			amid != GIST_AM_OID && amid != GIN_AM_OID &&
+			amid != SPGIST_AM_OID && amid != BRIN_AM_OID)
+			continue;
+		if (RelationGetNumberOfBlocks(Irel[i]) < min_parallel_index_scan_size)
+			continue;
+
+		parallel_safe[i] = true;
+		nindexes_parallel++;
+	}
+
+	return Max(Min(nindexes_parallel - 1, max_parallel_maintenance_workers), 0);
+}
+
+/*
+ * Perform one index pass over all the indexes: bulk deletion of the current
+ * batch of dead TIDs, or, if 'for_cleanup', the post-vacuum cleanup.
+ */
+static void
+zs_vacuum_all_indexes(Relation rel, Relation *Irel, int nindexes,
+					  IndexBulkDeleteResult **indstats,
+					  ZSVacRelStats *vacrelstats, bool for_cleanup)
+{
+	if (vacrelstats->nworkers > 0)
+	{
+		zs_parallel_vacuum_indexes(rel, Irel, nindexes, indstats, vacrelstats,
+								   for_cleanup);
+		return;
+	}
+
+	for (int i = 0; i < nindexes; i++)
+	{
+		if (for_cleanup)
+			lazy_cleanup_index(Irel[i], &indstats[i], vacrelstats);
+		else
+			lazy_vacuum_index(Irel[i], &indstats[i], vacrelstats);
+	}
+}
+
+/*
+ * Perform one index pass with parallel workers.
+ */
+static void
+zs_parallel_vacuum_indexes(Relation rel, Relation *Irel, int nindexes,
+						   IndexBulkDeleteResult **indstats,
+						   ZSVacRelStats *vacrelstats, bool for_cleanup)
+{
+	ParallelContext *pcxt;
+	ZSParallelVacuumShared *shared;
+	Size		est_shared;
+	Size		est_dead_tids = 0;
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext("postgres", "zsundo_parallel_vacuum_main",
+								 vacrelstats->nworkers);
+
+	est_shared = add_size(offsetof(ZSParallelVacuumShared, indexes),
+						  mul_size(sizeof(ZSParallelIndexState), nindexes));
+	shm_toc_estimate_chunk(&pcxt->estimator, est_shared);
+	if (!for_cleanup)
+	{
+		est_dead_tids = zs_tidstore_shared_size(vacrelstats->dead_tids);
+		shm_toc_estimate_chunk(&pcxt->estimator, est_dead_tids);
+		shm_toc_estimate_keys(&pcxt->estimator, 2);
+	}
+	else
+		shm_toc_estimate_keys(&pcxt->estimator, 1);
+
+	InitializeParallelDSM(pcxt);
+
+	shared = (ZSParallelVacuumShared *) shm_toc_allocate(pcxt->toc, est_shared);
+	shared->relid = RelationGetRelid(rel);
+	shared->elevel = vacrelstats->elevel;
+	shared->for_cleanup = for_cleanup;
+	shared->rel_pages = vacrelstats->rel_pages;
+	shared->tupcount_pages = vacrelstats->tupcount_pages;
+	shared->old_live_tuples = vacrelstats->old_live_tuples;
+	shared->new_rel_tuples = vacrelstats->new_rel_tuples;
+	shared->num_dead_tids = for_cleanup ? 0 : vacrelstats->num_dead_tids;
+	pg_atomic_init_u32(&shared->nextindex, 0);
+	shared->nindexes = nindexes;
+	for (int i = 0; i < nindexes; i++)
+	{
+		ZSParallelIndexState *istate = &shared->indexes[i];
+
+		istate->parallel_safe = vacrelstats->index_parallel_safe[i];
+		if (istate->parallel_safe && indstats[i] != NULL)
+		{
+			memcpy(&istate->stats, indstats[i], sizeof(IndexBulkDeleteResult));
+			istate->stats_valid = true;
+		}
+		else
+		{
+			memset(&istate->stats, 0, sizeof(IndexBulkDeleteResult));
+			istate->stats_valid = false;
+		}
+	}
+	shm_toc_insert(pcxt->toc, PARALLEL_VACUUM_KEY_SHARED, shared);
+
+	if (!for_cleanup)
+	{
+		void	   *shared_dead_tids;
+
+		shared_dead_tids = shm_toc_allocate(pcxt->toc, est_dead_tids);
+		zs_tidstore_share(vacrelstats->dead_tids, shared_dead_tids);
+		shm_toc_insert(pcxt->toc, PARALLEL_VACUUM_KEY_DEAD_TIDS, shared_dead_tids);
+	}
+
+	LaunchParallelWorkers(pcxt);
+
+	ereport(vacrelstats->elevel,
+			(errmsg_plural("launched %d parallel vacuum worker for index %s (planned: %d)",
+						   "launched %d parallel vacuum workers for index %s (planned: %d)",
+						   pcxt->nworkers_launched,
+						   pcxt->nworkers_launched,
+						   for_cleanup ? "cleanup" : "vacuuming",
+						   vacrelstats->nworkers)));
+
+	/*
+	 * Process the indexes that the workers cannot, and then join the workers.
+	 * If no workers could be launched, the leader processes all the indexes.
+	 */
+	for (int i = 0; i < nindexes; i++)
+	{
+		if (vacrelstats->index_parallel_safe[i])
+			continue;
+		if (for_cleanup)
+			lazy_cleanup_index(Irel[i], &indstats[i], vacrelstats);
+		else
+			lazy_vacuum_index(Irel[i], &indstats[i], vacrelstats);
+	}
+	zs_parallel_vacuum_process_indexes(shared, Irel, vacrelstats);
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	/* Copy the results back to local memory */
+	for (int i = 0; i < nindexes; i++)
+	{
+		ZSParallelIndexState *istate = &shared->indexes[i];
+
+		if (!istate->parallel_safe)
+			continue;
+
+		if (istate->stats_valid)
+		{
+			if (indstats[i] == NULL)
+				indstats[i] = (IndexBulkDeleteResult *)
+					palloc(sizeof(IndexBulkDeleteResult));
+			memcpy(indstats[i], &istate->stats, sizeof(IndexBulkDeleteResult));
+		}
+		else if (indstats[i] != NULL)
+		{
+			pfree(indstats[i]);
+			indstats[i] = NULL;
+		}
+	}
+
+	DestroyParallelContext(pcxt);
+	ExitParallelMode();
+}
+
+/*
+ * Process parallel-safe indexes, until there are none left. This is called
+ * by the leader and by each worker.
+ */
+static void
+zs_parallel_vacuum_process_indexes(ZSParallelVacuumShared *shared,
+								   Relation *Irel,
+								   ZSVacRelStats *vacrelstats)
+{
+	for (;;)
+	{
+		uint32		idx = pg_atomic_fetch_add_u32(&shared->nextindex, 1);
+		ZSParallelIndexState *istate;
+		IndexBulkDeleteResult *stats;
+
+		if (idx >= shared->nindexes)
+			break;
+		istate = &shared->indexes[idx];
+		if (!istate->parallel_safe)
+			continue;
+
+		stats = istate->stats_valid ? &istate->stats : NULL;
+		if (shared->for_cleanup)
+			lazy_cleanup_index(Irel[idx], &stats, vacrelstats);
+		else
+			lazy_vacuum_index(Irel[idx], &stats, vacrelstats);
+
+		/*
+		 * The AM usually updates the struct we passed in, in place. If it
+		 * returned a new one, copy it to shared memory.
+		 */
+		if (stats == NULL)
+			istate->stats_valid = false;
+		else if (stats != &istate->stats)
+		{
+			memcpy(&istate->stats, stats, sizeof(IndexBulkDeleteResult));
+			istate->stats_valid = true;
+			pfree(stats);
+		}
+	}
+}
+
+/*
+ * Main entry point of a parallel VACUUM worker.
+ */
+void
+zsundo_parallel_vacuum_main(dsm_segment *seg, shm_toc *toc)
+{
+	ZSParallelVacuumShared *shared;
+	ZSVacRelStats vacrelstats;
+	Relation	rel;
+	Relation   *Irel;
+	int			nindexes;
+
+	shared = (ZSParallelVacuumShared *)
+		shm_toc_lookup(toc, PARALLEL_VACUUM_KEY_SHARED, false);
+
+	memset(&vacrelstats, 0, sizeof(ZSVacRelStats));
+	vacrelstats.elevel = shared->elevel;
+	vacrelstats.vac_strategy = GetAccessStrategy(BAS_VACUUM);
+	vacrelstats.hasindex = true;
+	vacrelstats.rel_pages = shared->rel_pages;
+	vacrelstats.tupcount_pages = shared->tupcount_pages;
+	vacrelstats.old_live_tuples = shared->old_live_tuples;
+	vacrelstats.new_rel_tuples = shared->new_rel_tuples;
+	vacrelstats.num_dead_tids = shared->num_dead_tids;
+	if (!shared->for_cleanup)
+		vacrelstats.dead_tids =
+			zs_tidstore_attach(shm_toc_lookup(toc, PARALLEL_VACUUM_KEY_DEAD_TIDS, false));
+
+	/* The leader holds the same locks, so these don't block */
+	rel = table_open(shared->relid, ShareUpdateExclusiveLock);
+	vac_open_indexes(rel, RowExclusiveLock, &nindexes, &Irel);
+
+	/* the lock on the table prevents creating or dropping indexes */
+	if (nindexes != shared->nindexes)
+		elog(ERROR, "unexpected number of indexes in parallel vacuum worker: %d, expected %d",
+			 nindexes, shared->nindexes);
+
+	zs_parallel_vacuum_process_indexes(shared, Irel, &vacrelstats);
+
+	vac_close_indexes(nindexes, Irel, RowExclusiveLock);
+	table_close(rel, ShareUpdateExclusiveLock);
+	FreeAccessStrategy(vacrelstats.vac_strategy);
+}
+
+
+/*
+ * Max. number of UNDO pages to process in one opportunistic trim, at the
+ * beginning of a scan or DML operation. VACUUM processes the whole log.
+ */
+#define ZS_UNDO_TRIM_MAX_PAGES		16
+
+/*
+ * The relation and xmin horizon, that this backend last trimmed the UNDO
+ * log completely for.
+ */
+static RelFileNode last_trim_node;
+static TransactionId last_trim_xmin = InvalidTransactionId;
+
+/*
+ * Return the xmin horizon for discarding UNDO log of 'rel'. Transactions
+ * older than this are known to be finished, and invisible to no one.
+ *
+ * Normally that's RecentGlobalXmin, but a temporary table can only be
+ * accessed by our own backend, so other backends' snapshots don't matter.
+ * Any snapshot we still hold, and any transaction of ours that is still in
+ * progress, is at or after our own xmin, so that is a safe horizon, and
+ * usually a much newer one. That lets temp tables discard their UNDO log,
+ * and take the "all visible" fast paths, even while some long-running
+ * transaction in another session holds back the global horizon.
+ */
+TransactionId
+zsundo_xmin_horizon(Relation rel)
+{
+	TransactionId xmin = RecentGlobalXmin;
+
+	if (RelationUsesLocalBuffers(rel) &&
+		TransactionIdIsNormal(MyPgXact->xmin) &&
+		TransactionIdFollows(MyPgXact->xmin, xmin))
+		xmin = MyPgXact->xmin;
+
+	return xmin;
+}
+
+/*
+ * Discard all the UNDO log that's no longer needed, as far as the current
+ * xmin horizon allows, like VACUUM does. The freed UNDO pages are added to
+ * the list of free UNDO pages.
+ */
+void
+zsundo_trim_all(Relation rel)
+{
+	bool		complete;
+
+	if (RelationGetNumberOfBlocks(rel) == 0)
+		return;
+
+	(void) zsundo_trim(rel, zsundo_xmin_horizon(rel), false, 0, &complete);
+}
+
+/*
+ * Trim the UNDO log of a table, on behalf of an autovacuum work item.
+ *
+ * zsundo_insert_reserve() requests this when the UNDO log grows past
+ * zedstore_autovacuum_undo_threshold pages. Unlike a full VACUUM, this
+ * doesn't scan the table for dead TIDs; it only discards the UNDO log
+ * that's no longer needed, so it's cheap enough to run between VACUUMs.
+ */
+void
+zsundo_autovacuum_trim(Oid relid)
+{
+	Relation	rel;
+
+	/*
+	 * If a VACUUM is already running on the table, it will trim the UNDO
+	 * log anyway, so don't wait for it.
+	 */
+	if (!ConditionalLockRelationOid(relid, ShareUpdateExclusiveLock))
+		return;
+
+	/* The table might have been dropped since the request was made */
+	rel = try_relation_open(relid, NoLock);
+	if (rel == NULL)
+	{
+		UnlockRelationOid(relid, ShareUpdateExclusiveLock);
+		return;
+	}
+
+	if (rel->rd_rel->relam == ZEDSTORE_TABLE_AM_OID)
+		zsundo_trim_all(rel);
+
+	relation_close(rel, ShareUpdateExclusiveLock);
+}
 
 /*
  * Return the current "Oldest undo pointer". The effects of any actions with
@@ -842,11 +1580,11 @@ lazy_cleanup_index(Relation indrel,
  * be invisible.)
  *
  * If 'attempt_trim' is true, this not only gets the current oldest UNDO pointer,
- * but tries to first advance it as much as possible, by scanning and discarding
- * old UNDO log. That's pretty expensive, but fetching records from the UNDO log
- * is very expensive, too, so until that is somehow sped up, it is a good tradeoff
- * to advance the discard pointer aggressively. It is only safe to trim the UNDO
- * log when you're not holding any other page locks, however.
+ * but tries to first advance it, by scanning and discarding old UNDO log.
+ * Fetching records from the UNDO log is very expensive, so it is a good
+ * tradeoff to advance the discard pointer aggressively, between vacuums.
+ * It is only safe to trim the UNDO log when you're not holding any other
+ * page locks, however.
  */
 ZSUndoRecPtr
 zsundo_get_oldest_undo_ptr(Relation rel, bool attempt_trim)
@@ -869,25 +1607,31 @@ zsundo_get_oldest_undo_ptr(Relation rel, bool attempt_trim)
 	/*
 	 * If the caller asked for trimming the UNDO log, do that. Otherwise,
 	 * just get the current value from the metapage.
+	 *
+	 * The trimming is done in small, non-blocking steps, so that it can be
+	 * piggybacked on every scan without making scans wait for each other.
+	 * Whether a trim can make progress depends only on the xmin horizon: a
+	 * transaction older than it cannot create new UNDO records anymore. So
+	 * if we have already trimmed this relation as far as the current
+	 * horizon allows, don't bother scanning the UNDO log again until the
+	 * horizon moves.
 	 */
-	if (attempt_trim)
-		result = zsundo_trim(rel, RecentGlobalXmin);
-	else
+	if (attempt_trim && !RecoveryInProgress() &&
+		!(RelFileNodeEquals(rel->rd_node, last_trim_node) &&
+		  TransactionIdEquals(zsundo_xmin_horizon(rel), last_trim_xmin)))
 	{
-		/*
-		 * Get the current oldest undo page from the metapage.
-		 */
-		Buffer		metabuf;
-		Page		metapage;
-		ZSMetaPageOpaque *metaopaque;
-
-		metabuf = ReadBuffer(rel, ZS_META_BLK);
-		metapage = BufferGetPage(metabuf);
-		LockBuffer(metabuf, BUFFER_LOCK_SHARE);
-		metaopaque = (ZSMetaPageOpaque *) PageGetSpecialPointer(metapage);
+		TransactionId xmin = zsundo_xmin_horizon(rel);
+		bool		complete;
 
-		result = metaopaque->zs_undo_oldestptr;
-		UnlockReleaseBuffer(metabuf);
+		result = zsundo_trim(rel, xmin, true, ZS_UNDO_TRIM_MAX_PAGES, &complete);
+		if (complete)
+		{
+			last_trim_node = rel->rd_node;
+			last_trim_xmin = xmin;
+		}
 	}
+	else
+		result = zsundo_read_oldest_undo_ptr(rel);
+
 	return result;
 }
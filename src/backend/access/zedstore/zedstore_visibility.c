@@ -16,6 +16,45 @@
 #include "access/zedstore_undorec.h"
 #include "storage/procarray.h"
 
+/*
+ * Is the transaction that created the UNDO record still in progress? If the
+ * record has a hint bit set, we already know that it's not.
+ */
+static inline bool
+zs_undorec_xid_in_progress(ZSUndoRec *undorec)
+{
+	if ((undorec->hintbits & (ZSUNDO_XID_COMMITTED | ZSUNDO_XID_ABORTED)) != 0)
+		return false;
+	return TransactionIdIsInProgress(undorec->xid);
+}
+
+/*
+ * Like TransactionIdDidCommit(undorec->xid), but uses the hint bits in the
+ * record, and sets them after looking up the CLOG.
+ *
+ * Must only be called after checking that the transaction is not in progress
+ * anymore, because a "no" answer is remembered as an abort.
+ */
+static inline bool
+zs_undorec_xid_did_commit(Relation rel, ZSUndoRec *undorec)
+{
+	if (undorec->hintbits & ZSUNDO_XID_COMMITTED)
+		return true;
+	if (undorec->hintbits & ZSUNDO_XID_ABORTED)
+		return false;
+
+	if (TransactionIdDidCommit(undorec->xid))
+	{
+		zsundo_set_hint_bits(rel, undorec, ZSUNDO_XID_COMMITTED);
+		return true;
+	}
+	else
+	{
+		zsundo_set_hint_bits(rel, undorec, ZSUNDO_XID_ABORTED);
+		return false;
+	}
+}
+
 static bool
 zs_tuplelock_compatible(LockTupleMode mode, LockTupleMode newmode)
 {
@@ -175,9 +214,9 @@ retry_fetch:
 			if (undorec->cid >= snapshot->curcid)
 				return TM_Invisible;	/* inserted after scan started */
 		}
-		else if (TransactionIdIsInProgress(undorec->xid))
+		else if (zs_undorec_xid_in_progress(undorec))
 			return TM_Invisible;		/* inserter has not committed yet */
-		else if (!TransactionIdDidCommit(undorec->xid))
+		else if (!zs_undorec_xid_did_commit(rel, undorec))
 		{
 			/* it must have aborted or crashed */
 			return TM_Invisible;
@@ -216,7 +255,7 @@ retry_fetch:
 			}
 		}
 		else if (!zs_tuplelock_compatible(lock_undorec->lockmode, mode) &&
-				 TransactionIdIsInProgress(undorec->xid))
+				 zs_undorec_xid_in_progress(undorec))
 		{
 			tmfd->ctid = ItemPointerFromZSTid(item_tid);
 			tmfd->xmax = undorec->xid;
@@ -262,7 +301,7 @@ retry_fetch:
 				return TM_Invisible;	/* deleted before scan started */
 		}
 
-		if (TransactionIdIsInProgress(undorec->xid))
+		if (zs_undorec_xid_in_progress(undorec))
 		{
 			tmfd->ctid = ItemPointerFromZSTid(item_tid);
 			tmfd->xmax = undorec->xid;
@@ -275,7 +314,7 @@ retry_fetch:
 			return TM_BeingModified;
 		}
 
-		if (!TransactionIdDidCommit(undorec->xid))
+		if (!zs_undorec_xid_did_commit(rel, undorec))
 		{
 			/* deleter must have aborted or crashed. We have to keep following the
 			 * undo chain, in case there are LOCK records that are still visible
@@ -329,7 +368,7 @@ retry_fetch:
 				return TM_Invisible;	/* deleted before scan started */
 		}
 
-		if (TransactionIdIsInProgress(undorec->xid))
+		if (zs_undorec_xid_in_progress(undorec))
 		{
 			if (zs_tuplelock_compatible(old_lockmode, mode))
 				return TM_Ok;
@@ -345,7 +384,7 @@ retry_fetch:
 			return TM_BeingModified;
 		}
 
-		if (!TransactionIdDidCommit(undorec->xid))
+		if (!zs_undorec_xid_did_commit(rel, undorec))
 		{
 			/* deleter must have aborted or crashed. We have to keep following the
 			 * undo chain, in case there are LOCK records that are still visible
@@ -423,19 +462,24 @@ fetch_undo_record:
  * is visible to the snapshot.
  */
 static bool
-xid_is_visible(Snapshot snapshot, TransactionId xid, CommandId cid, bool *aborted)
+xid_is_visible(Relation rel, Snapshot snapshot, ZSUndoRec *undorec, bool *aborted)
 {
 	*aborted = false;
-	if (TransactionIdIsCurrentTransactionId(xid))
+	if (undorec->hintbits & ZSUNDO_XID_ABORTED)
 	{
-		if (cid >= snapshot->curcid)
+		*aborted = true;
+		return false;
+	}
+	else if (TransactionIdIsCurrentTransactionId(undorec->xid))
+	{
+		if (undorec->cid >= snapshot->curcid)
 			return false;
 		else
 			return true;
 	}
-	else if (XidInMVCCSnapshot(xid, snapshot))
+	else if (XidInMVCCSnapshot(undorec->xid, snapshot))
 		return false;
-	else if (TransactionIdDidCommit(xid))
+	else if (zs_undorec_xid_did_commit(rel, undorec))
 	{
 		return true;
 	}
@@ -487,7 +531,7 @@ fetch_undo_record:
 	{
 		/* Inserted tuple */
 		bool		result;
-		result = xid_is_visible(snapshot, undorec->xid, undorec->cid, &aborted);
+		result = xid_is_visible(rel, snapshot, undorec, &aborted);
 		if (!result && !aborted)
 			*obsoleting_xid = undorec->xid;
 
@@ -517,9 +561,13 @@ fetch_undo_record:
 		 * They only need different treatment when updating or locking the row,
 		 * in SatisfiesUpdate().
 		 */
-		if (xid_is_visible(snapshot, undorec->xid, undorec->cid, &aborted))
+		if (xid_is_visible(rel, snapshot, undorec, &aborted))
 		{
-			/* we can see the deletion */
+			/*
+			 * We can see the deletion. Report who deleted it, so that the
+			 * scan can prune the row, if everyone else can see it too.
+			 */
+			visi_info->xmax = undorec->xid;
 			return false;
 		}
 		else
@@ -574,9 +622,9 @@ fetch_undo_record:
 		/* Inserted tuple */
 		if (TransactionIdIsCurrentTransactionId(undorec->xid))
 			return true;		/* inserted by me */
-		else if (TransactionIdIsInProgress(undorec->xid))
+		else if (zs_undorec_xid_in_progress(undorec))
 			return false;
-		else if (TransactionIdDidCommit(undorec->xid))
+		else if (zs_undorec_xid_did_commit(rel, undorec))
 			return true;
 		else
 		{
@@ -607,10 +655,10 @@ fetch_undo_record:
 			return false;
 		}
 
-		if (TransactionIdIsInProgress(undorec->xid))
+		if (zs_undorec_xid_in_progress(undorec))
 			return true;
 
-		if (!TransactionIdDidCommit(undorec->xid))
+		if (!zs_undorec_xid_did_commit(rel, undorec))
 		{
 			/*
 			 * Deleter must have aborted or crashed. But we have to keep following the
@@ -678,14 +726,14 @@ fetch_undo_record:
 		/* Inserted tuple */
 		if (TransactionIdIsCurrentTransactionId(undorec->xid))
 			return true;		/* inserted by me */
-		else if (TransactionIdIsInProgress(undorec->xid))
+		else if (zs_undorec_xid_in_progress(undorec))
 		{
 			snapshot->xmin = undorec->xid;
 			visi_info->xmin = undorec->xid;
 			visi_info->cmin = undorec->cid;
 			return true;
 		}
-		else if (TransactionIdDidCommit(undorec->xid))
+		else if (zs_undorec_xid_did_commit(rel, undorec))
 		{
 			return true;
 		}
@@ -719,7 +767,7 @@ fetch_undo_record:
 			return false;
 		}
 
-		if (TransactionIdIsInProgress(undorec->xid))
+		if (zs_undorec_xid_in_progress(undorec))
 		{
 			/*
 			 * TODO: not required to set the snapshot's xmax here? As gets
@@ -730,7 +778,7 @@ fetch_undo_record:
 			return true;
 		}
 
-		if (!TransactionIdDidCommit(undorec->xid))
+		if (!zs_undorec_xid_did_commit(rel, undorec))
 		{
 			/*
 			 * Deleter must have aborted or crashed. But we have to keep following the
@@ -791,10 +839,10 @@ fetch_undo_record:
 		visi_info->cmin = undorec->cid;
 
 		/* Inserted tuple */
-		if (TransactionIdIsInProgress(undorec->xid))
+		if (zs_undorec_xid_in_progress(undorec))
 			return true;		/* inserter has not committed yet */
 
-		if (TransactionIdDidCommit(undorec->xid))
+		if (zs_undorec_xid_did_commit(rel, undorec))
 			return true;
 
 		/* it must have aborted or crashed */
@@ -806,9 +854,9 @@ fetch_undo_record:
 		/* deleted or updated-away tuple */
 		ZSUndoRecPtr	prevptr;
 
-		if (TransactionIdIsInProgress(undorec->xid))
+		if (zs_undorec_xid_in_progress(undorec))
 			return true;	/* delete-in-progress */
-		else if (TransactionIdDidCommit(undorec->xid))
+		else if (zs_undorec_xid_did_commit(rel, undorec))
 		{
 			/*
 			 * Deleter committed. But perhaps it was recent enough that some open
@@ -846,9 +894,9 @@ fetch_undo_record:
 
 		Assert(undorec->type == ZSUNDO_TYPE_INSERT);
 
-		if (TransactionIdIsInProgress(undorec->xid))
+		if (zs_undorec_xid_in_progress(undorec))
 			return true;	/* insert-in-progress */
-		else if (TransactionIdDidCommit(undorec->xid))
+		else if (zs_undorec_xid_did_commit(rel, undorec))
 			return true;	/* inserted committed */
 
 		/* inserter must have aborted or crashed */
@@ -900,6 +948,10 @@ zs_SatisfiesVisibility(ZSTidTreeScan *scan, ZSUndoRecPtr item_undoptr,
 	if (!IsZSUndoRecPtrValid(&undo_ptr))
 		return true;
 
+	/* count the checks that can't be answered without the UNDO log */
+	if (undo_ptr.counter >= scan->recent_oldest_undo.counter)
+		scan->undo_lookups++;
+
 	switch (scan->snapshot->snapshot_type)
 	{
 		case SNAPSHOT_MVCC:
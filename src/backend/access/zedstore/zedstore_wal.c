@@ -11,18 +11,71 @@
  */
 #include "postgres.h"
 
+#include <unistd.h>
+
 #include "access/bufmask.h"
+#include "access/rmgr.h"
+#include "access/xact.h"
+#include "access/xlog_internal.h"
 #include "access/xlogreader.h"
+#include "access/xlogutils.h"
 #include "access/zedstore_internal.h"
 #include "access/zedstore_undolog.h"
 #include "access/zedstore_undorec.h"
 #include "access/zedstore_wal.h"
+#include "catalog/pg_control.h"
+#include "catalog/storage_xlog.h"
+#include "storage/bufmgr.h"
+#include "storage/fd.h"
+#include "storage/smgr.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+/*
+ * A relation that is dropped or truncated later in the WAL, as found by
+ * zedstore_redo_lookahead().
+ */
+typedef struct ZSRedoTruncation
+{
+	XLogRecPtr	lsn;
+	BlockNumber nblocks;		/* new size of the main fork */
+} ZSRedoTruncation;
+
+typedef struct ZSRedoDoomedRel
+{
+	RelFileNode rnode;			/* hash key */
+
+	XLogRecPtr	drop_lsn;		/* last drop, or InvalidXLogRecPtr */
+	int			ntruncs;
+	int			maxtruncs;
+	ZSRedoTruncation *truncs;
+} ZSRedoDoomedRel;
+
+/*
+ * How far ahead to read the WAL at a time. The lookahead also stops at the
+ * next checkpoint record.
+ */
+#define ZS_REDO_LOOKAHEAD_MAX_SEGMENTS	64
+
+static XLogRecPtr zs_redo_lookahead_end = InvalidXLogRecPtr;
+static MemoryContext zs_redo_lookahead_cxt = NULL;
+static HTAB *zs_redo_doomed_rels = NULL;
+
+static void zedstore_redo_prefetch(XLogReaderState *record);
+static bool zedstore_redo_is_doomed(XLogReaderState *record);
+static void zedstore_redo_lookahead(XLogRecPtr startptr);
 
 void
 zedstore_redo(XLogReaderState *record)
 {
 	uint8		info = XLogRecGetInfo(record) & ~XLR_INFO_MASK;
 
+	if (zedstore_redo_is_doomed(record))
+		return;
+
+	zedstore_redo_prefetch(record);
+
 	switch (info)
 	{
 		case WAL_ZEDSTORE_INIT_METAPAGE:
@@ -58,11 +111,343 @@ zedstore_redo(XLogReaderState *record)
 		case WAL_ZEDSTORE_FPM_REUSE_PAGE:
 			zspage_reuse_page_redo(record);
 			break;
+		case WAL_ZEDSTORE_FPM_EXTENT:
+			zspage_extent_redo(record);
+			break;
+		case WAL_ZEDSTORE_LOGICAL_CHANGE:
+			/* only for logical decoding */
+			break;
 		default:
 			elog(PANIC, "zedstore_redo: unknown op code %u", info);
 	}
 }
 
+/*
+ * Prefetch the blocks a record modifies, before replaying it.
+ *
+ * A rewrite_pages record can reference a hundred pages of an attribute or
+ * TID tree, which are often far apart from each other, and replay reads
+ * them one at a time. So issue prefetch requests for all of them first, to
+ * let the kernel read them in parallel. Blocks that are restored from a
+ * full-page image, or re-initialized, don't need to be read at all.
+ *
+ * This costs a few system calls per record, to check the size of the
+ * relation: a block past the end might have been written after the record,
+ * and was then truncated away. Records that touch only a few pages aren't
+ * worth it.
+ */
+#define ZS_REDO_PREFETCH_MIN_BLOCKS		4
+
+static void
+zedstore_redo_prefetch(XLogReaderState *record)
+{
+#ifdef USE_PREFETCH
+	Relation	reln = NULL;
+	RelFileNode reln_node;
+	BlockNumber reln_nblocks = 0;
+	int			nblocks = 0;
+
+	if (record->max_block_id + 1 < ZS_REDO_PREFETCH_MIN_BLOCKS)
+		return;
+
+	for (int block_id = 0; block_id <= record->max_block_id; block_id++)
+	{
+		if (XLogRecHasBlockRef(record, block_id) &&
+			!XLogRecHasBlockImage(record, block_id) &&
+			(record->blocks[block_id].flags & BKPBLOCK_WILL_INIT) == 0)
+			nblocks++;
+	}
+	if (nblocks < ZS_REDO_PREFETCH_MIN_BLOCKS)
+		return;
+
+	for (int block_id = 0; block_id <= record->max_block_id; block_id++)
+	{
+		RelFileNode rnode;
+		ForkNumber	forknum;
+		BlockNumber blkno;
+
+		if (!XLogRecGetBlockTag(record, block_id, &rnode, &forknum, &blkno))
+			continue;
+		if (XLogRecHasBlockImage(record, block_id) ||
+			(record->blocks[block_id].flags & BKPBLOCK_WILL_INIT) != 0)
+			continue;
+
+		if (reln == NULL || !RelFileNodeEquals(rnode, reln_node))
+		{
+			if (reln)
+				FreeFakeRelcacheEntry(reln);
+			reln = CreateFakeRelcacheEntry(rnode);
+			reln_node = rnode;
+			RelationOpenSmgr(reln);
+			if (smgrexists(reln->rd_smgr, forknum))
+				reln_nblocks = smgrnblocks(reln->rd_smgr, forknum);
+			else
+				reln_nblocks = 0;
+		}
+		if (blkno < reln_nblocks)
+			PrefetchBuffer(reln, forknum, blkno);
+	}
+	if (reln)
+		FreeFakeRelcacheEntry(reln);
+#endif
+}
+
+/*
+ * Can replay of this record be skipped, because all the blocks it modifies
+ * are destroyed later in the WAL anyway?
+ *
+ * Bulk loading into a staging table that is dropped or truncated soon
+ * afterwards is a common pattern, and replaying all its attribute pages
+ * after a crash is wasted work. So on the first zedstore record, read ahead
+ * in the WAL, up to the next checkpoint record but at most
+ * ZS_REDO_LOOKAHEAD_MAX_SEGMENTS segments, and remember all the relations
+ * that are dropped at commit or abort, or truncated, in that window. A
+ * record in the window can be skipped if every block it references is in a
+ * relation that's dropped after it, or is beyond the new end of a relation
+ * that's truncated after it. Any later record that touches those blocks,
+ * before they're destroyed, is skipped for the same reason, so nothing ever
+ * sees the stale pages. When replay gets past the window, the next zedstore
+ * record starts a new one, so each part of the WAL is read ahead only once.
+ *
+ * This is only done in crash recovery. In archive recovery and on a
+ * standby, more WAL may arrive later, and the skipped pages might be read
+ * by hot standby queries before they're destroyed.
+ */
+static bool
+zedstore_redo_is_doomed(XLogReaderState *record)
+{
+	XLogRecPtr	lsn = record->ReadRecPtr;
+	bool		found_block = false;
+
+	if (!InRecovery || ArchiveRecoveryRequested || InArchiveRecovery)
+		return false;
+
+	/* wal_consistency_checking wants to compare the pages after replay */
+	if ((XLogRecGetInfo(record) & XLR_CHECK_CONSISTENCY) != 0)
+		return false;
+
+	if (lsn >= zs_redo_lookahead_end)
+		zedstore_redo_lookahead(lsn);
+	if (zs_redo_doomed_rels == NULL)
+		return false;
+
+	for (int block_id = 0; block_id <= record->max_block_id; block_id++)
+	{
+		RelFileNode rnode;
+		ForkNumber	forknum;
+		BlockNumber blkno;
+		ZSRedoDoomedRel *doomed;
+		bool		doomed_block;
+
+		if (!XLogRecGetBlockTag(record, block_id, &rnode, &forknum, &blkno))
+			continue;
+		found_block = true;
+
+		doomed = hash_search(zs_redo_doomed_rels, &rnode, HASH_FIND, NULL);
+		if (!doomed)
+			return false;
+
+		doomed_block = (doomed->drop_lsn > lsn);
+		for (int i = 0; !doomed_block && i < doomed->ntruncs; i++)
+		{
+			if (forknum == MAIN_FORKNUM &&
+				doomed->truncs[i].lsn > lsn &&
+				blkno >= doomed->truncs[i].nblocks)
+				doomed_block = true;
+		}
+		if (!doomed_block)
+			return false;
+	}
+
+	return found_block;
+}
+
+static void
+zedstore_redo_note_doomed(RelFileNode rnode, XLogRecPtr lsn, BlockNumber nblocks)
+{
+	ZSRedoDoomedRel *doomed;
+	bool		found;
+
+	if (zs_redo_doomed_rels == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(RelFileNode);
+		ctl.entrysize = sizeof(ZSRedoDoomedRel);
+		ctl.hcxt = zs_redo_lookahead_cxt;
+		zs_redo_doomed_rels = hash_create("zedstore redo lookahead", 100, &ctl,
+										  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	doomed = hash_search(zs_redo_doomed_rels, &rnode, HASH_ENTER, &found);
+	if (!found)
+	{
+		doomed->drop_lsn = InvalidXLogRecPtr;
+		doomed->ntruncs = 0;
+		doomed->maxtruncs = 0;
+		doomed->truncs = NULL;
+	}
+
+	if (nblocks == InvalidBlockNumber)
+		doomed->drop_lsn = lsn;
+	else
+	{
+		if (doomed->ntruncs == doomed->maxtruncs)
+		{
+			if (doomed->maxtruncs == 0)
+			{
+				doomed->maxtruncs = 4;
+				doomed->truncs = MemoryContextAlloc(zs_redo_lookahead_cxt,
+													doomed->maxtruncs * sizeof(ZSRedoTruncation));
+			}
+			else
+			{
+				doomed->maxtruncs *= 2;
+				doomed->truncs = repalloc(doomed->truncs,
+										  doomed->maxtruncs * sizeof(ZSRedoTruncation));
+			}
+		}
+		doomed->truncs[doomed->ntruncs].lsn = lsn;
+		doomed->truncs[doomed->ntruncs].nblocks = nblocks;
+		doomed->ntruncs++;
+	}
+}
+
+/*
+ * read_page callback for the lookahead.
+ *
+ * Crash recovery reads the WAL from pg_wal, preferring the files of the
+ * newest timeline, recoveryTargetTLI. We read only those files, and treat
+ * anything else as the end of WAL. So we never see a record that recovery
+ * won't replay, although we might stop before the real end of WAL.
+ */
+static int
+zedstore_redo_lookahead_read_page(XLogReaderState *state, XLogRecPtr targetPagePtr,
+								  int reqLen, XLogRecPtr targetRecPtr, char *cur_page)
+{
+	XLogSegNo	segno;
+	uint32		offset;
+
+	XLByteToSeg(targetPagePtr, segno, state->segcxt.ws_segsize);
+	offset = XLogSegmentOffset(targetPagePtr, state->segcxt.ws_segsize);
+
+	if (state->seg.ws_file < 0 || state->seg.ws_segno != segno)
+	{
+		char		path[MAXPGPATH];
+
+		if (state->seg.ws_file >= 0)
+			close(state->seg.ws_file);
+
+		XLogFilePath(path, recoveryTargetTLI, segno, state->segcxt.ws_segsize);
+		state->seg.ws_file = BasicOpenFile(path, O_RDONLY | PG_BINARY);
+		if (state->seg.ws_file < 0)
+			return -1;
+		state->seg.ws_segno = segno;
+		state->seg.ws_tli = recoveryTargetTLI;
+	}
+
+	if (pg_pread(state->seg.ws_file, cur_page, XLOG_BLCKSZ, (off_t) offset) != XLOG_BLCKSZ)
+		return -1;
+
+	return XLOG_BLCKSZ;
+}
+
+/*
+ * Scan the WAL from 'startptr' up to the next checkpoint record, or at most
+ * ZS_REDO_LOOKAHEAD_MAX_SEGMENTS segments, and remember the relations that
+ * are dropped or truncated. Forgets what the previous lookahead found.
+ */
+static void
+zedstore_redo_lookahead(XLogRecPtr startptr)
+{
+	XLogReaderState *reader;
+	XLogRecord *rec;
+	char	   *errormsg;
+	XLogRecPtr	recptr = startptr;
+	XLogRecPtr	endptr = startptr;
+	XLogRecPtr	maxptr;
+
+	if (zs_redo_lookahead_cxt == NULL)
+		zs_redo_lookahead_cxt = AllocSetContextCreate(TopMemoryContext,
+													  "zedstore redo lookahead",
+													  ALLOCSET_DEFAULT_SIZES);
+	else
+		MemoryContextReset(zs_redo_lookahead_cxt);
+	zs_redo_doomed_rels = NULL;
+
+	maxptr = startptr + (XLogRecPtr) ZS_REDO_LOOKAHEAD_MAX_SEGMENTS * wal_segment_size;
+
+	reader = XLogReaderAllocate(wal_segment_size, NULL,
+								zedstore_redo_lookahead_read_page, NULL);
+	if (!reader)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory"),
+				 errdetail("Failed while allocating a WAL reading processor.")));
+
+	while ((rec = XLogReadRecord(reader, recptr, &errormsg)) != NULL)
+	{
+		RmgrId		rmid = XLogRecGetRmid(reader);
+		uint8		info = XLogRecGetInfo(reader);
+		XLogRecPtr	lsn = reader->ReadRecPtr;
+
+		recptr = InvalidXLogRecPtr;
+		endptr = reader->EndRecPtr;
+
+		if (rmid == RM_XACT_ID)
+		{
+			uint8		xact_info = info & XLOG_XACT_OPMASK;
+			RelFileNode *xnodes = NULL;
+			int			nrels = 0;
+
+			if (xact_info == XLOG_XACT_COMMIT ||
+				xact_info == XLOG_XACT_COMMIT_PREPARED)
+			{
+				xl_xact_parsed_commit parsed;
+
+				ParseCommitRecord(info, (xl_xact_commit *) XLogRecGetData(reader), &parsed);
+				xnodes = parsed.xnodes;
+				nrels = parsed.nrels;
+			}
+			else if (xact_info == XLOG_XACT_ABORT ||
+					 xact_info == XLOG_XACT_ABORT_PREPARED)
+			{
+				xl_xact_parsed_abort parsed;
+
+				ParseAbortRecord(info, (xl_xact_abort *) XLogRecGetData(reader), &parsed);
+				xnodes = parsed.xnodes;
+				nrels = parsed.nrels;
+			}
+
+			for (int i = 0; i < nrels; i++)
+				zedstore_redo_note_doomed(xnodes[i], lsn, InvalidBlockNumber);
+		}
+		else if (rmid == RM_SMGR_ID &&
+				 (info & ~XLR_INFO_MASK) == XLOG_SMGR_TRUNCATE)
+		{
+			xl_smgr_truncate *xlrec = (xl_smgr_truncate *) XLogRecGetData(reader);
+
+			if ((xlrec->flags & SMGR_TRUNCATE_HEAP) != 0)
+				zedstore_redo_note_doomed(xlrec->rnode, lsn, xlrec->blkno);
+		}
+		else if (rmid == RM_XLOG_ID &&
+				 ((info & ~XLR_INFO_MASK) == XLOG_CHECKPOINT_ONLINE ||
+				  (info & ~XLR_INFO_MASK) == XLOG_CHECKPOINT_SHUTDOWN))
+			break;
+
+		if (endptr >= maxptr)
+			break;
+	}
+
+	if (reader->seg.ws_file >= 0)
+		close(reader->seg.ws_file);
+	XLogReaderFree(reader);
+
+	/* the window covers at least the record we started from */
+	zs_redo_lookahead_end = Max(endptr, startptr + 1);
+}
+
 void
 zedstore_mask(char *pagedata, BlockNumber blkno)
 {
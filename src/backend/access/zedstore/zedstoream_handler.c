@@ -17,6 +17,7 @@
 
 #include "access/genam.h"
 #include "access/heapam.h"
+#include "access/detoast.h"
 #include "access/multixact.h"
 #include "access/relscan.h"
 #include "access/tableam.h"
@@ -24,33 +25,65 @@
 #include "access/tupdesc_details.h"
 #include "access/xact.h"
 #include "access/zedstore_internal.h"
+#include "access/zedstore_metacache.h"
 #include "access/zedstore_undorec.h"
 #include "catalog/catalog.h"
 #include "catalog/index.h"
+#include "catalog/objectaddress.h"
+#include "catalog/pg_type.h"
 #include "catalog/storage.h"
 #include "catalog/storage_xlog.h"
+#include "commands/explain.h"
 #include "commands/progress.h"
 #include "commands/vacuum.h"
 #include "executor/executor.h"
 #include "miscadmin.h"
+#include "optimizer/optimizer.h"
 #include "optimizer/plancat.h"
 #include "pgstat.h"
 #include "storage/lmgr.h"
 #include "storage/predicate.h"
 #include "storage/procarray.h"
+#include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
 #include "utils/rel.h"
+#include "utils/tuplestore.h"
+#include "utils/typcache.h"
 
 typedef struct ZedStoreProjectData
 {
 	int			num_proj_atts;
 	Bitmapset   *project_columns;
 	int		   *proj_atts;
+
+	/*
+	 * Columns whose fetching is deferred until the caller asks for them with
+	 * zedstoream_scan_fetch_deferred_columns(). They are last in 'proj_atts',
+	 * the columns fetched for every row are first, 'num_early_atts' entries
+	 * including the meta-attribute.
+	 */
+	Bitmapset  *deferred_columns;
+	int			num_early_atts;
 	ZSTidTreeScan tid_scan;
 	ZSAttrTreeScan *attr_scans;
 	MemoryContext context;
 }  ZedStoreProjectData;
 
+/*
+ * The result of the last comparison of a scan key against a value fetched
+ * from its attribute tree. See zedstoream_scan_keys_match().
+ */
+typedef struct ZSScanKeyResult
+{
+	bool		valid;
+	bool		result;
+	Datum		datum;
+	int64		chunks_decoded;	/* decoder's counter when 'datum' was seen */
+} ZSScanKeyResult;
+
 typedef struct ZedStoreDescData
 {
 	/* scan parameters */
@@ -61,16 +94,58 @@ typedef struct ZedStoreDescData
 	zstid		cur_range_start;
 	zstid		cur_range_end;
 
+	/* TIDs a non-parallel scan is limited to, see zedstoream_scan_set_limits() */
+	zstid		limit_start;
+	zstid		limit_end;
+
+	/*
+	 * Synchronized scans, see zedstoream_scan_start(). The scan starts at
+	 * 'sync_start', and after reaching the end, wraps around to scan the TIDs
+	 * below it. 'sync_reported' is the logical block last reported to the
+	 * syncscan machinery.
+	 */
+	bool		syncscan;
+	bool		sync_wrapped;
+	zstid		sync_start;
+	BlockNumber sync_reported;
+
 	/* These fields are used for bitmap scans, to hold a "block's" worth of data */
 #define	MAX_ITEMS_PER_LOGICAL_BLOCK		MaxHeapTuplesPerPage
 	int			bmscan_ntuples;
 	zstid	   *bmscan_tids;
 	int			bmscan_nexttuple;
+	/* leaf key ranges last prefetched for each projected tree */
+	ZSTidRange *bmscan_prefetch_ranges;
 
 	/* These fields are use for TABLESAMPLE scans */
 	zstid       min_tid_to_scan;
 	zstid       max_tid_to_scan;
 	zstid       next_tid_to_scan;
+	/* leaf key ranges sampled by block-sampling methods, see zs_sample_setup_units() */
+	ZSTidRange *sample_units;
+	int			num_sample_units;
+	BlockNumber cur_sample_unit;
+
+	/* TID put back by zedstoream_getnextbatch(), for the next call */
+	zstid		pending_tid;
+	ZSUndoSlotVisibility pending_visi_info;
+
+	/*
+	 * TID ranges that can contain rows matching the scan keys, according to
+	 * the attribute pages' synopses. NULL if there is no such restriction.
+	 */
+	ZSTidRange *prune_ranges;
+	int			num_prune_ranges;
+	int			next_prune_range;
+	/* leaf pages ruled out by the synopses, for EXPLAIN */
+	int64		pages_pruned;
+
+	/* for each scan key, index of its attribute in proj_data.proj_atts */
+	int		   *key_proj_idx;
+	ZSScanKeyResult *key_results;
+
+	/* access strategy for reading the trees, or NULL for default */
+	BufferAccessStrategy strategy;
 
 } ZedStoreDescData;
 
@@ -80,6 +155,14 @@ typedef struct ZedStoreIndexFetchData
 {
 	IndexFetchTableData idx_fetch_data;
 	ZedStoreProjectData proj_data;
+
+	/*
+	 * State for index_fetch_all_visible, used by index-only scans. The TID
+	 * leaf pinned in allvis_buf is also used for the all_dead checks.
+	 */
+	ZSUndoRecPtr allvis_oldest_undo;
+	Buffer		allvis_buf;
+	ZSTidItemIterator allvis_iter;
 } ZedStoreIndexFetchData;
 
 typedef struct ZedStoreIndexFetchData *ZedStoreIndexFetch;
@@ -87,11 +170,19 @@ typedef struct ZedStoreIndexFetchData *ZedStoreIndexFetch;
 typedef struct ParallelZSScanDescData *ParallelZSScanDesc;
 
 static IndexFetchTableData *zedstoream_begin_index_fetch(Relation rel);
+static IndexFetchTableData *zs_begin_index_fetch_noflush(Relation rel);
+static bool zs_fetch_old_row(Relation rel, IndexFetchTableData *fetcher,
+							 Bitmapset *columns, ItemPointer tid_p,
+							 TupleTableSlot *slot);
+static void zedstoream_fetch_set_column_projection(struct IndexFetchTableData *scan,
+												   Bitmapset *project_columns);
 static void zedstoream_end_index_fetch(IndexFetchTableData *scan);
 static bool zedstoream_fetch_row(ZedStoreIndexFetchData *fetch,
 								 ItemPointer tid_p,
 								 Snapshot snapshot,
 								 TupleTableSlot *slot);
+static void zedstoream_scan_setup_pruning(ZedStoreDesc scan);
+static BufferAccessStrategy zedstoream_bulkread_strategy(Relation rel);
 static bool zs_acquire_tuplock(Relation relation, ItemPointer tid, LockTupleMode mode,
 							   LockWaitPolicy wait_policy, bool *have_tuple_lock);
 
@@ -112,6 +203,33 @@ static void zsbt_fill_missing_attribute_value(TupleDesc tupleDesc, int attno, Da
  * ----------------------------------------------------------------
  */
 
+/*
+ * Memory context for the allocations made while inserting or updating a
+ * single row: items being created and merged, split stacks, and so on.
+ * They are small, but add up with the number of columns, so they are freed
+ * wholesale after each row. The context is created once per backend and
+ * reset after each use, rather than created and destroyed for every row,
+ * so that the AllocSet's keeper block is reused.
+ *
+ * The modification routines are not reentrant, so a single context is
+ * enough. If an error is thrown in the middle, whatever was allocated is
+ * freed by the next reset.
+ */
+static MemoryContext zs_modify_mcontext = NULL;
+
+static MemoryContext
+zs_modify_context(void)
+{
+	if (zs_modify_mcontext == NULL)
+		zs_modify_mcontext = AllocSetContextCreate(TopMemoryContext,
+												   "ZedstoreAMContext",
+												   ALLOCSET_DEFAULT_SIZES);
+	else
+		MemoryContextReset(zs_modify_mcontext);
+
+	return zs_modify_mcontext;
+}
+
 static bool
 zedstoream_fetch_row_version(Relation rel,
 							 ItemPointer tid_p,
@@ -121,9 +239,9 @@ zedstoream_fetch_row_version(Relation rel,
 	IndexFetchTableData *fetcher;
 	bool		result;
 
-	zsbt_tuplebuffer_flush(rel);
+	zsbt_tuplebuffer_flush_tid(rel, ZSTidFromItemPointer(*tid_p));
 
-	fetcher = zedstoream_begin_index_fetch(rel);
+	fetcher = zs_begin_index_fetch_noflush(rel);
 
 	result = zedstoream_fetch_row((ZedStoreIndexFetchData *) fetcher,
 								  tid_p, snapshot, slot);
@@ -167,27 +285,29 @@ zedstoream_insert_internal(Relation relation, TupleTableSlot *slot, CommandId ci
 	MemoryContext oldcontext;
 	MemoryContext insert_mcontext;
 
-	/*
-	 * insert code performs allocations for creating items and merging
-	 * items. These are small allocations but add-up based on number of
-	 * columns and rows being inserted. Hence, creating context to track them
-	 * and wholesale free instead of retail freeing them. TODO: in long term
-	 * try if can avoid creating context here, retail free in normal case and
-	 * only create context for page splits maybe.
-	 */
-	insert_mcontext = AllocSetContextCreate(CurrentMemoryContext,
-											   "ZedstoreAMContext",
-											   ALLOCSET_DEFAULT_SIZES);
+	/* See zs_modify_context() */
+	insert_mcontext = zs_modify_context();
 	oldcontext = MemoryContextSwitchTo(insert_mcontext);
 
 	if (slot->tts_tupleDescriptor->natts != relation->rd_att->natts)
 		elog(ERROR, "slot's attribute count doesn't match relcache entry");
 
+	/* See zedstoream_multi_insert() */
+	if ((options & TABLE_INSERT_FROZEN) != 0 &&
+		speculative_token == INVALID_SPECULATIVE_TOKEN)
+		xid = FrozenTransactionId;
+
+	if ((options & TABLE_INSERT_SKIP_WAL) != 0)
+		zsbt_tuplebuffer_begin_skip_wal(relation);
+
+	/* Only bulk loads, which end with finish_bulk_insert, pass a bistate */
+	if (bistate != NULL && speculative_token == INVALID_SPECULATIVE_TOKEN)
+		zs_loadstats_begin(relation);
+
 	if (speculative_token == INVALID_SPECULATIVE_TOKEN)
 		tid = zsbt_tuplebuffer_allocate_tid(relation, xid, cid);
 	else
-		tid = zsbt_tid_multi_insert(relation, 1, xid, cid, speculative_token,
-									InvalidUndoPtr);
+		tid = zsbt_tid_insert_speculative(relation, xid, cid, speculative_token);
 
 	/*
 	 * We only need to check for table-level SSI locks. Our
@@ -200,12 +320,21 @@ zedstoream_insert_internal(Relation relation, TupleTableSlot *slot, CommandId ci
 	slot_getallattrs(slot);
 	zsbt_tuplebuffer_spool_tuple(relation, tid, slot->tts_values, slot->tts_isnull);
 
+	/* a speculative insertion is logged when it's confirmed */
+	if (speculative_token == INVALID_SPECULATIVE_TOKEN)
+		zs_logical_log_insert(relation, &slot, 1);
+
 	slot->tts_tableOid = RelationGetRelid(relation);
 	slot->tts_tid = ItemPointerFromZSTid(tid);
 	/* XXX: should we set visi_info here? */
 
+	if (bistate != NULL && speculative_token == INVALID_SPECULATIVE_TOKEN)
+		zs_loadstats_add(relation, &slot, 1);
+	else
+		zs_loadstats_forget(relation);
+
 	MemoryContextSwitchTo(oldcontext);
-	MemoryContextDelete(insert_mcontext);
+	MemoryContextReset(insert_mcontext);
 
 	/* Note: speculative insertions are counted too, even if aborted later */
 	pgstat_count_heap_insert(relation, 1);
@@ -244,6 +373,8 @@ zedstoream_complete_speculative(Relation relation, TupleTableSlot *slot, uint32
 
 		zsbt_tid_mark_dead(relation, tid, recent_oldest_undo);
 	}
+	else
+		zs_logical_log_insert(relation, &slot, 1);
 }
 
 static void
@@ -254,6 +385,7 @@ zedstoream_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 	TransactionId xid = GetCurrentTransactionId();
 	zstid		firsttid;
 	zstid	   *tids;
+	TupleTableSlot **sorted;
 
 	if (ntuples == 0)
 	{
@@ -261,8 +393,25 @@ zedstoream_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 		return;
 	}
 
-	firsttid = zsbt_tid_multi_insert(relation, ntuples, xid, cid,
-									 INVALID_SPECULATIVE_TOKEN, InvalidUndoPtr);
+	/*
+	 * With TABLE_INSERT_FROZEN, the caller has checked that the relation was
+	 * created or truncated in this (sub)transaction, so no one else can see
+	 * the new rows before we commit, and they will all go away if we abort.
+	 * Like heap's COPY FREEZE, insert them as visible to everyone: with a
+	 * frozen XID, the TID tree skips writing an UNDO record, and points the
+	 * new TIDs to the "old" UNDO slot.
+	 */
+	if ((options & TABLE_INSERT_FROZEN) != 0)
+		xid = FrozenTransactionId;
+
+	if ((options & TABLE_INSERT_SKIP_WAL) != 0)
+		zsbt_tuplebuffer_begin_skip_wal(relation);
+	zs_loadstats_begin(relation);
+
+	/* TIDs are assigned in sort key order, if the table has one */
+	sorted = zsbt_tuplebuffer_sort_slots(relation, slots, ntuples);
+
+	firsttid = zsbt_tuplebuffer_allocate_tids(relation, xid, cid, ntuples);
 
 	tids = palloc(ntuples * sizeof(zstid));
 	for (i = 0; i < ntuples; i++)
@@ -276,13 +425,18 @@ zedstoream_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 	 */
 	CheckForSerializableConflictIn(relation, NULL, InvalidBlockNumber);
 
-	zsbt_tuplebuffer_spool_slots(relation, tids, slots, ntuples);
+	zsbt_tuplebuffer_spool_slots(relation, tids, sorted, ntuples);
+
+	zs_logical_log_insert(relation, sorted, ntuples);
 
 	for (i = 0; i < ntuples; i++)
 	{
-		slots[i]->tts_tableOid = RelationGetRelid(relation);
-		slots[i]->tts_tid = ItemPointerFromZSTid(firsttid + i);
+		sorted[i]->tts_tableOid = RelationGetRelid(relation);
+		sorted[i]->tts_tid = ItemPointerFromZSTid(firsttid + i);
 	}
+	zs_loadstats_add(relation, sorted, ntuples);
+	if (sorted != slots)
+		pfree(sorted);
 
 	pgstat_count_heap_insert(relation, ntuples);
 }
@@ -298,8 +452,12 @@ zedstoream_delete(Relation relation, ItemPointer tid_p, CommandId cid,
 	bool		this_xact_has_lock = false;
 	bool		have_tuple_lock = false;
 
-	zsbt_tuplebuffer_flush(relation);
+	zs_loadstats_forget(relation);
 
+	/*
+	 * Deleting a row only touches the TID tree, and the TIDs of buffered rows
+	 * are already in there, so there's no need to write out the buffer.
+	 */
 retry:
 	result = zsbt_tid_delete(relation, tid, xid, cid,
 							 snapshot, crosscheck, wait, hufd, changingPart,
@@ -339,7 +497,32 @@ retry:
 	CheckForSerializableConflictIn(relation, tid_p, ItemPointerGetBlockNumber(tid_p));
 
 	if (result == TM_Ok)
+	{
+		/*
+		 * For logical decoding, fetch the deleted row, to log its replica
+		 * identity.
+		 */
+		if (RelationIsLogicallyLogged(relation))
+		{
+			TupleTableSlot *oldslot = NULL;
+
+			if (relation->rd_rel->relreplident != REPLICA_IDENTITY_NOTHING)
+			{
+				IndexFetchTableData *fetcher = zs_begin_index_fetch_noflush(relation);
+
+				oldslot = table_slot_create(relation, NULL);
+				if (!zs_fetch_old_row(relation, fetcher, NULL, tid_p, oldslot))
+					elog(ERROR, "could not fetch deleted row (%u, %u) for logical decoding",
+						 ItemPointerGetBlockNumber(tid_p), ItemPointerGetOffsetNumber(tid_p));
+				zedstoream_end_index_fetch(fetcher);
+			}
+			zs_logical_log_delete(relation, oldslot);
+			if (oldslot)
+				ExecDropSingleTupleTableSlot(oldslot);
+		}
+
 		pgstat_count_heap_delete(relation);
+	}
 
 	return result;
 }
@@ -463,8 +646,10 @@ zedstoream_lock_tuple(Relation relation, ItemPointer tid_p, Snapshot snapshot,
 	ZSUndoSlotVisibility *visi_info = &((ZedstoreTupleTableSlot *) slot)->visi_info_buf;
 	bool		follow_updates = false;
 
-	zsbt_tuplebuffer_flush(relation);
-
+	/*
+	 * Locking only touches the TID tree. zedstoream_fetch_row_version()
+	 * writes out the row, if it's still buffered, when we fetch it below.
+	 */
 	slot->tts_tableOid = RelationGetRelid(relation);
 	slot->tts_tid = *tid_p;
 
@@ -654,7 +839,14 @@ retry:
 		}
 	}
 
-	/* Fetch the tuple, too. */
+	/*
+	 * Fetch the tuple, too, unless the caller doesn't need it. Fetching means
+	 * visiting every attribute tree, which is the bulk of the cost of a
+	 * foreign key check against a wide table.
+	 */
+	if ((flags & TUPLE_LOCK_FLAG_FETCH_IF_TRAVERSED) != 0 && !tmfd->traversed)
+		return TM_Ok;
+
 	if (!zedstoream_fetch_row_version(relation, tid_p, SnapshotAny, slot))
 		elog(ERROR, "could not fetch locked tuple");
 
@@ -778,6 +970,64 @@ is_key_update(Relation relation, TupleTableSlot *oldslot, TupleTableSlot *newslo
 	return bms_overlap(modified_attrs, key_attrs);
 }
 
+/*
+ * Columns of the old row that zedstoream_update() needs: the key columns,
+ * for is_key_update(), and the replica identity, for logical decoding.
+ * There's no point in decompressing the rest, as the new row is written out
+ * from the caller's slot in full.
+ */
+static Bitmapset *
+zs_update_old_row_columns(Relation relation)
+{
+	Bitmapset  *attrs;
+	Bitmapset  *result;
+	int			attidx;
+
+	if (RelationIsLogicallyLogged(relation) &&
+		relation->rd_rel->relreplident == REPLICA_IDENTITY_FULL)
+		return NULL;		/* all columns */
+
+	attrs = RelationGetIndexAttrBitmap(relation, INDEX_ATTR_BITMAP_KEY);
+	if (RelationIsLogicallyLogged(relation))
+		attrs = bms_add_members(attrs,
+								RelationGetIndexAttrBitmap(relation,
+														   INDEX_ATTR_BITMAP_IDENTITY_KEY));
+
+	/*
+	 * A NULL projection means all columns, so start with the invalid
+	 * attribute number 0, so that the result is never empty.
+	 */
+	result = bms_make_singleton(InvalidAttrNumber);
+	attidx = -1;
+	while ((attidx = bms_next_member(attrs, attidx)) >= 0)
+	{
+		AttrNumber	attno = attidx + FirstLowInvalidHeapAttributeNumber;
+
+		if (attno > 0)
+			result = bms_add_member(result, attno);
+	}
+	bms_free(attrs);
+
+	return result;
+}
+
+/*
+ * Fetch the old version of a row that is being updated or deleted.
+ *
+ * The rows we've inserted or updated earlier in the transaction can stay in
+ * the tuple buffer, unless this row is one of them.
+ */
+static bool
+zs_fetch_old_row(Relation rel, IndexFetchTableData *fetcher,
+				 Bitmapset *columns, ItemPointer tid_p, TupleTableSlot *slot)
+{
+	zsbt_tuplebuffer_flush_tid(rel, ZSTidFromItemPointer(*tid_p));
+
+	zedstoream_fetch_set_column_projection(fetcher, columns);
+	return zedstoream_fetch_row((ZedStoreIndexFetchData *) fetcher,
+								tid_p, SnapshotAny, slot);
+}
+
 static TM_Result
 zedstoream_update(Relation relation, ItemPointer otid_p, TupleTableSlot *slot,
 				  CommandId cid, Snapshot snapshot, Snapshot crosscheck,
@@ -797,20 +1047,12 @@ zedstoream_update(Relation relation, ItemPointer otid_p, TupleTableSlot *slot,
 	MemoryContext insert_mcontext;
 	bool		this_xact_has_lock = false;
 	bool		have_tuple_lock = false;
+	Bitmapset  *oldcols;
 
-	zsbt_tuplebuffer_flush(relation);
+	zs_loadstats_forget(relation);
 
-	/*
-	 * insert code performs allocations for creating items and merging
-	 * items. These are small allocations but add-up based on number of
-	 * columns and rows being inserted. Hence, creating context to track them
-	 * and wholesale free instead of retail freeing them. TODO: in long term
-	 * try if can avoid creating context here, retail free in normal case and
-	 * only create context for page splits maybe.
-	 */
-	insert_mcontext = AllocSetContextCreate(CurrentMemoryContext,
-											   "ZedstoreAMContext",
-											   ALLOCSET_DEFAULT_SIZES);
+	/* See zs_modify_context() */
+	insert_mcontext = zs_modify_context();
 	oldcontext = MemoryContextSwitchTo(insert_mcontext);
 
 	slot_getallattrs(slot);
@@ -818,7 +1060,8 @@ zedstoream_update(Relation relation, ItemPointer otid_p, TupleTableSlot *slot,
 	isnulls = slot->tts_isnull;
 
 	oldslot = table_slot_create(relation, NULL);
-	fetcher = zedstoream_begin_index_fetch(relation);
+	fetcher = zs_begin_index_fetch_noflush(relation);
+	oldcols = zs_update_old_row_columns(relation);
 
 	/*
 	 * The meta-attribute holds the visibility information, including the "t_ctid"
@@ -834,9 +1077,14 @@ retry:
 	 * FIXME: if we have to follow the update chain, we should look at the
 	 * currently latest tuple version, rather than the one visible to our snapshot.
 	 */
-	if (!zedstoream_fetch_row((ZedStoreIndexFetchData *) fetcher,
-							 otid_p, SnapshotAny, oldslot))
+	if (!zs_fetch_old_row(relation, fetcher, oldcols, otid_p, oldslot))
 	{
+		if (have_tuple_lock)
+			UnlockTupleTuplock(relation, otid_p, LockTupleExclusive);
+		zedstoream_end_index_fetch(fetcher);
+		ExecDropSingleTupleTableSlot(oldslot);
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(insert_mcontext);
 		return TM_Invisible;
 	}
 	key_update = is_key_update(relation, oldslot, slot);
@@ -857,6 +1105,8 @@ retry:
 
 		zsbt_tuplebuffer_spool_tuple(relation, newtid, d, isnulls);
 
+		zs_logical_log_update(relation, oldslot, slot);
+
 		slot->tts_tableOid = RelationGetRelid(relation);
 		slot->tts_tid = ItemPointerFromZSTid(newtid);
 
@@ -904,7 +1154,7 @@ retry:
 	ExecDropSingleTupleTableSlot(oldslot);
 
 	MemoryContextSwitchTo(oldcontext);
-	MemoryContextDelete(insert_mcontext);
+	MemoryContextReset(insert_mcontext);
 
 	return result;
 }
@@ -947,8 +1197,24 @@ zs_initialize_proj_attributes(TupleDesc tupledesc, ZedStoreProjectData *proj_dat
 			continue;
 
 		/* project_columns empty also conveys need all the columns */
-		if (proj_data->project_columns == NULL ||
-			bms_is_member(att_no, proj_data->project_columns))
+		if ((proj_data->project_columns == NULL ||
+			 bms_is_member(att_no, proj_data->project_columns)) &&
+			!bms_is_member(att_no, proj_data->deferred_columns))
+			proj_data->proj_atts[proj_data->num_proj_atts++] = att_no;
+	}
+	proj_data->num_early_atts = proj_data->num_proj_atts;
+
+	/* Then the deferred columns */
+	for (int idx = 0; idx < tupledesc->natts; idx++)
+	{
+		int			att_no = idx + 1;
+
+		if  (TupleDescAttr(tupledesc, idx)->attisdropped)
+			continue;
+
+		if ((proj_data->project_columns == NULL ||
+			 bms_is_member(att_no, proj_data->project_columns)) &&
+			bms_is_member(att_no, proj_data->deferred_columns))
 			proj_data->proj_atts[proj_data->num_proj_atts++] = att_no;
 	}
 
@@ -976,6 +1242,8 @@ zs_initialize_proj_attributes_extended(ZedStoreDesc scan, TupleDesc tupledesc)
 		scan->bmscan_ntuples = 0;
 		scan->bmscan_tids = palloc(MAX_ITEMS_PER_LOGICAL_BLOCK * sizeof(zstid));
 	}
+	if (scan->rs_scan.rs_flags & SO_TYPE_BITMAPSCAN)
+		scan->bmscan_prefetch_ranges = palloc0(proj_data->num_proj_atts * sizeof(ZSTidRange));
 	MemoryContextSwitchTo(oldcontext);
 }
 
@@ -1017,13 +1285,34 @@ zedstoream_beginscan_with_column_projection(Relation relation, Snapshot snapshot
 	 * initscan() and we don't want to allocate memory again
 	 */
 	if (nkeys > 0)
+	{
 		scan->rs_scan.rs_key = (ScanKey) palloc(sizeof(ScanKeyData) * nkeys);
+		if (key)
+			memcpy(scan->rs_scan.rs_key, key, nkeys * sizeof(ScanKeyData));
+	}
 	else
 		scan->rs_scan.rs_key = NULL;
 
 	scan->proj_data.context = CurrentMemoryContext;
 	scan->proj_data.project_columns = project_columns;
 
+	scan->limit_start = MinZSTid;
+	scan->limit_end = MaxPlusOneZSTid;
+
+	if ((flags & SO_ALLOW_STRAT) != 0)
+		scan->strategy = zedstoream_bulkread_strategy(relation);
+	else
+		scan->strategy = NULL;
+
+	/* Same condition as in heapam's initscan() */
+	scan->syncscan = (flags & SO_TYPE_SEQSCAN) != 0 &&
+		(flags & SO_ALLOW_SYNC) != 0 &&
+		synchronize_seqscans &&
+		parallel_scan == NULL &&
+		!RelationUsesLocalBuffers(relation) &&
+		RelationGetNumberOfBlocks(relation) > NBuffers / 4;
+	scan->sync_reported = InvalidBlockNumber;
+
 	/*
 	 * For a seqscan in a serializable transaction, acquire a predicate lock
 	 * on the entire relation. This is required not only to lock all the
@@ -1081,6 +1370,16 @@ zedstoream_endscan(TableScanDesc sscan)
 
 	if (proj_data->attr_scans)
 		pfree(proj_data->attr_scans);
+	if (scan->prune_ranges)
+		pfree(scan->prune_ranges);
+	if (scan->sample_units)
+		pfree(scan->sample_units);
+	if (scan->key_proj_idx)
+		pfree(scan->key_proj_idx);
+	if (scan->key_results)
+		pfree(scan->key_results);
+	if (scan->strategy)
+		FreeAccessStrategy(scan->strategy);
 	pfree(scan);
 }
 
@@ -1111,177 +1410,907 @@ zedstoream_rescan(TableScanDesc sscan, struct ScanKeyData *key,
 			scan->rs_scan.rs_flags &= ~SO_ALLOW_PAGEMODE;
 	}
 
+	scan->pending_tid = InvalidZSTid;
+
+	if (key && scan->rs_scan.rs_nkeys > 0)
+	{
+		memcpy(scan->rs_scan.rs_key, key, scan->rs_scan.rs_nkeys * sizeof(ScanKeyData));
+		if (scan->started)
+			zedstoream_scan_setup_pruning(scan);
+	}
+	scan->next_prune_range = 0;
+
+	/* A synchronized scan starts over from where it started the first time */
+	if (scan->syncscan && scan->sync_wrapped)
+	{
+		scan->sync_wrapped = false;
+		scan->cur_range_start = scan->sync_start;
+		scan->cur_range_end = scan->limit_end;
+	}
+
 	if (scan->proj_data.num_proj_atts > 0)
 	{
 		zsbt_tid_reset_scan(&scan->proj_data.tid_scan,
 							scan->cur_range_start, scan->cur_range_end, scan->cur_range_start - 1);
 
 		if ((scan->rs_scan.rs_flags & SO_TYPE_SAMPLESCAN) != 0)
-			scan->next_tid_to_scan = ZSTidFromBlkOff(0, 1);
+			scan->next_tid_to_scan = InvalidZSTid;
 	}
 }
 
-static bool
-zedstoream_getnextslot(TableScanDesc sscan, ScanDirection direction,
-					   TupleTableSlot *slot)
+/*
+ * Buffer access strategy for a scan of the whole table, or NULL.
+ *
+ * Like in heapam, use a bulk-read ring for scanning a table that's larger
+ * than a quarter of shared_buffers, so that the scan doesn't evict
+ * everything else from the cache. Tables marked with the zedstore_cold
+ * reloption always use one. The blocks of all the trees share the one ring.
+ */
+static BufferAccessStrategy
+zedstoream_bulkread_strategy(Relation rel)
 {
-	ZedStoreDesc scan = (ZedStoreDesc) sscan;
-	ZedStoreProjectData *scan_proj = &scan->proj_data;
-	int			slot_natts = slot->tts_tupleDescriptor->natts;
-	Datum	   *slot_values = slot->tts_values;
-	bool	   *slot_isnull = slot->tts_isnull;
-	zstid		this_tid;
-	Datum		datum;
-	bool        isnull;
-	ZSUndoSlotVisibility *visi_info;
-	uint8		slotno;
+	if (RelationUsesLocalBuffers(rel))
+		return NULL;
+	if (RelationIsZedstoreCold(rel) ||
+		RelationGetNumberOfBlocks(rel) > NBuffers / 4)
+		return GetAccessStrategy(BAS_BULKREAD);
+	return NULL;
+}
 
-	if (direction != ForwardScanDirection && scan->rs_scan.rs_parallel)
-		elog(ERROR, "parallel backward scan not implemented");
+/*
+ * Return the first TID whose ItemPointer is >= (blk, off).
+ *
+ * The ItemPointer order matches the TID order, but not every ItemPointer
+ * corresponds to a TID, so a bound given as an arbitrary ItemPointer is
+ * rounded up to the next one that does.
+ */
+static zstid
+zs_tid_lower_bound(BlockNumber blk, uint32 off)
+{
+	if (off == 0)
+		off = 1;
+	else if (off >= MaxZSTidOffsetNumber)
+		return ((uint64) blk + 1) * (MaxZSTidOffsetNumber - 1) + 1;
 
-	if (!scan->started)
+	return (uint64) blk * (MaxZSTidOffsetNumber - 1) + off;
+}
+
+/*
+ * Narrow 'range' to the TIDs that can satisfy a scan key on ctid.
+ */
+static void
+zs_ctid_key_restrict_range(ScanKey key, ZSTidRange *range)
+{
+	ItemPointer iptr = (ItemPointer) DatumGetPointer(key->sk_argument);
+	BlockNumber blk = ItemPointerGetBlockNumberNoCheck(iptr);
+	uint32		off = ItemPointerGetOffsetNumberNoCheck(iptr);
+	zstid		at = zs_tid_lower_bound(blk, off);
+	zstid		after = zs_tid_lower_bound(blk, off + 1);
+
+	switch (key->sk_strategy)
 	{
-		MemoryContext oldcontext;
+		case BTLessStrategyNumber:
+			range->end = Min(range->end, at);
+			break;
+		case BTLessEqualStrategyNumber:
+			range->end = Min(range->end, after);
+			break;
+		case BTEqualStrategyNumber:
+			range->start = Max(range->start, at);
+			range->end = Min(range->end, after);
+			break;
+		case BTGreaterEqualStrategyNumber:
+			range->start = Max(range->start, at);
+			break;
+		case BTGreaterStrategyNumber:
+			range->start = Max(range->start, after);
+			break;
+	}
+}
+
+/*
+ * Use the attribute pages' synopses to find the TID ranges that might contain
+ * rows matching the scan keys.
+ *
+ * Scan keys on ctid, as in the "WHERE ctid BETWEEN ..." queries that tools
+ * use to export a big table in chunks, restrict the scan to a single TID
+ * range directly.
+ *
+ * We don't evaluate the scan keys on the rows themselves, so skipping the
+ * rest is just an optimization. The synopses only describe data that's
+ * already there, so restrict this to MVCC snapshots.
+ */
+static void
+zedstoream_scan_setup_pruning(ZedStoreDesc scan)
+{
+	Relation	rel = scan->rs_scan.rs_rd;
+	int			nkeys = scan->rs_scan.rs_nkeys;
+	ScanKey		keys = scan->rs_scan.rs_key;
+	MemoryContext oldcontext;
 
-		zs_initialize_proj_attributes(slot->tts_tupleDescriptor, scan_proj);
+	if (scan->prune_ranges)
+	{
+		pfree(scan->prune_ranges);
+		scan->prune_ranges = NULL;
+	}
+	scan->num_prune_ranges = 0;
+	scan->next_prune_range = 0;
 
-		if (scan->rs_scan.rs_parallel)
-		{
-			/* Allocate next range of TIDs to scan */
-			if (!zs_parallelscan_nextrange(scan->rs_scan.rs_rd,
-										   (ParallelZSScanDesc) scan->rs_scan.rs_parallel,
-										   &scan->cur_range_start, &scan->cur_range_end))
-			{
-				ExecClearTuple(slot);
-				return false;
-			}
-		}
-		else
-		{
-			scan->cur_range_start = MinZSTid;
-			scan->cur_range_end = MaxPlusOneZSTid;
-		}
+	if (nkeys == 0 || keys == NULL ||
+		(scan->rs_scan.rs_flags & SO_TYPE_SEQSCAN) == 0 ||
+		!IsMVCCSnapshot(scan->rs_scan.rs_snapshot))
+		return;
 
-		oldcontext = MemoryContextSwitchTo(scan_proj->context);
-		zsbt_tid_begin_scan(scan->rs_scan.rs_rd,
-							scan->cur_range_start,
-							scan->cur_range_end,
-							scan->rs_scan.rs_snapshot,
-							&scan_proj->tid_scan);
-		scan_proj->tid_scan.serializable = true;
-		for (int i = 1; i < scan_proj->num_proj_atts; i++)
-		{
-			int			attno = scan_proj->proj_atts[i];
+	oldcontext = MemoryContextSwitchTo(scan->proj_data.context);
+	for (int i = 0; i < nkeys; i++)
+	{
+		if (keys[i].sk_attno != SelfItemPointerAttributeNumber)
+			continue;
 
-			zsbt_attr_begin_scan(scan->rs_scan.rs_rd,
-								 slot->tts_tupleDescriptor,
-								 attno,
-								 &scan_proj->attr_scans[i - 1]);
+		if (scan->prune_ranges == NULL)
+		{
+			scan->prune_ranges = palloc(sizeof(ZSTidRange));
+			scan->prune_ranges[0].start = MinZSTid;
+			scan->prune_ranges[0].end = MaxPlusOneZSTid;
 		}
-		MemoryContextSwitchTo(oldcontext);
-		scan->started = true;
+		zs_ctid_key_restrict_range(&keys[i], &scan->prune_ranges[0]);
 	}
-	Assert((scan_proj->num_proj_atts - 1) <= slot_natts);
-
-	/*
-	 * Initialize the slot.
-	 *
-	 * We initialize all columns to NULL. The values for columns that are projected
-	 * will be set to the actual values below, but it's important that non-projected
-	 * columns are NULL.
-	 */
-	ExecClearTuple(slot);
-	for (int i = 0; i < slot_natts; i++)
-		slot_isnull[i] = true;
+	if (scan->prune_ranges != NULL)
+		scan->num_prune_ranges =
+			(scan->prune_ranges[0].start < scan->prune_ranges[0].end) ? 1 : 0;
 
-	/*
-	 * Find the next visible TID.
-	 */
-	for (;;)
+	for (int i = 0; i < nkeys; i++)
 	{
-		this_tid = zsbt_tid_scan_next(&scan_proj->tid_scan, direction);
-		if (this_tid == InvalidZSTid)
+		AttrNumber	attno = keys[i].sk_attno;
+		ZSTidRange *attranges;
+		int			nattranges;
+		bool		seen = false;
+
+		/* nothing can match anymore? Don't bother with the other attributes */
+		if (scan->prune_ranges != NULL && scan->num_prune_ranges == 0)
+			break;
+
+		/* each attribute only once */
+		for (int j = 0; j < i && !seen; j++)
+			seen = (keys[j].sk_attno == attno);
+		if (seen || attno <= 0 || attno > RelationGetNumberOfAttributes(rel))
+			continue;
+
+		nattranges = zsbt_attr_prune_ranges(rel, attno, nkeys, keys, &attranges,
+											&scan->pages_pruned);
+		if (nattranges < 0)
+			continue;
+
+		if (scan->prune_ranges == NULL)
 		{
-			if (scan->rs_scan.rs_parallel)
+			scan->prune_ranges = attranges;
+			scan->num_prune_ranges = nattranges;
+		}
+		else
+		{
+			/* intersect with the ranges from previous attributes */
+			ZSTidRange *a = scan->prune_ranges;
+			int			na = scan->num_prune_ranges;
+			ZSTidRange *result;
+			int			nresult = 0;
+			int			ia = 0;
+			int			ib = 0;
+
+			result = palloc((na + nattranges) * sizeof(ZSTidRange));
+			while (ia < na && ib < nattranges)
 			{
-				/* Allocate next range of TIDs to scan */
-				if (!zs_parallelscan_nextrange(scan->rs_scan.rs_rd,
-											   (ParallelZSScanDesc) scan->rs_scan.rs_parallel,
-											   &scan->cur_range_start, &scan->cur_range_end))
+				zstid		start = Max(a[ia].start, attranges[ib].start);
+				zstid		end = Min(a[ia].end, attranges[ib].end);
+
+				if (start < end)
 				{
-					ExecClearTuple(slot);
-					return false;
+					result[nresult].start = start;
+					result[nresult].end = end;
+					nresult++;
 				}
-
-				zsbt_tid_reset_scan(&scan_proj->tid_scan,
-									scan->cur_range_start, scan->cur_range_end, scan->cur_range_start - 1);
-				continue;
-			}
-			else
-			{
-				ExecClearTuple(slot);
-				return false;
+				if (a[ia].end < attranges[ib].end)
+					ia++;
+				else
+					ib++;
 			}
+			pfree(a);
+			pfree(attranges);
+			scan->prune_ranges = result;
+			scan->num_prune_ranges = nresult;
 		}
-		Assert (this_tid < scan->cur_range_end);
-		break;
 	}
+	MemoryContextSwitchTo(oldcontext);
+}
 
-	/* Note: We don't need to predicate-lock tuples in Serializable mode,
-	 * because in a sequential scan, we predicate-locked the whole table.
-	 */
+/*
+ * Show what the scan did in each of the trees, for EXPLAIN (ANALYZE, STORAGE).
+ */
+static void
+zedstoream_scan_explain(TableScanDesc sscan, ExplainState *es)
+{
+	ZedStoreDesc scan = (ZedStoreDesc) sscan;
+	ZedStoreProjectData *proj_data = &scan->proj_data;
+	TupleDesc	tupdesc = RelationGetDescr(scan->rs_scan.rs_rd);
 
-	/* Fetch the datums of each attribute for this row */
-	for (int i = 1; i < scan_proj->num_proj_atts; i++)
-	{
-		ZSAttrTreeScan *btscan = &scan_proj->attr_scans[i - 1];
-		Form_pg_attribute attr = btscan->attdesc;
-		int			natt;
+	if (!scan->started || proj_data->num_proj_atts == 0)
+		return;
 
-		if (!zsbt_attr_fetch(btscan, &datum, &isnull, this_tid))
-			zsbt_fill_missing_attribute_value(slot->tts_tupleDescriptor, btscan->attno,
-											  &datum, &isnull);
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str,
+						 "Zedstore: pruned pages=" INT64_FORMAT " undo lookups=" INT64_FORMAT "\n",
+						 scan->pages_pruned, proj_data->tid_scan.undo_lookups);
+	}
+	else
+	{
+		ExplainPropertyInteger("Pruned Pages", NULL, scan->pages_pruned, es);
+		ExplainPropertyInteger("UNDO Lookups", NULL,
+							   proj_data->tid_scan.undo_lookups, es);
+	}
 
-		/*
-		 * flatten any ZS-TOASTed values, because the rest of the system
-		 * doesn't know how to deal with them.
-		 */
-		natt = scan_proj->proj_atts[i];
+	ExplainOpenGroup("Columns", "Columns", false, es);
+	for (int i = 1; i < proj_data->num_proj_atts; i++)
+	{
+		ZSAttrTreeScan *attr_scan = &proj_data->attr_scans[i - 1];
+		const char *attname = NameStr(TupleDescAttr(tupdesc, attr_scan->attno - 1)->attname);
 
-		if (!isnull && attr->attlen == -1 &&
-			VARATT_IS_EXTERNAL(datum) && VARTAG_EXTERNAL(datum) == VARTAG_ZEDSTORE)
+		if (es->format == EXPLAIN_FORMAT_TEXT)
 		{
-			MemoryContext oldcxt = CurrentMemoryContext;
-
-			if (btscan->decoder.tmpcxt)
-				MemoryContextSwitchTo(btscan->decoder.tmpcxt);
-			datum = zedstore_toast_flatten(scan->rs_scan.rs_rd, natt, this_tid, datum);
-			MemoryContextSwitchTo(oldcxt);
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str,
+							 "Column %s: pages hit=" INT64_FORMAT " read=" INT64_FORMAT
+							 " compressed=" INT64_FORMAT " decompressed=" INT64_FORMAT,
+							 quote_identifier(attname),
+							 attr_scan->pages_hit, attr_scan->pages_read,
+							 attr_scan->decoder.bytes_compressed,
+							 attr_scan->decoder.bytes_decompressed);
+			if (es->timing)
+				appendStringInfo(es->str, " decode time=%0.3f",
+								 INSTR_TIME_GET_MILLISEC(attr_scan->decode_time));
+			appendStringInfoChar(es->str, '\n');
 		}
-
-		/* Check that the values coming out of the b-tree are aligned properly */
-		if (!isnull && attr->attlen == -1)
+		else
 		{
-			Assert (VARATT_IS_1B(datum) || INTALIGN(datum) == datum);
+			ExplainOpenGroup("Column", NULL, true, es);
+			ExplainPropertyText("Column Name", attname, es);
+			ExplainPropertyInteger("Pages Hit", NULL, attr_scan->pages_hit, es);
+			ExplainPropertyInteger("Pages Read", NULL, attr_scan->pages_read, es);
+			ExplainPropertyInteger("Compressed Bytes", NULL,
+								   attr_scan->decoder.bytes_compressed, es);
+			ExplainPropertyInteger("Decompressed Bytes", NULL,
+								   attr_scan->decoder.bytes_decompressed, es);
+			if (es->timing)
+				ExplainPropertyFloat("Decode Time", "ms",
+									 INSTR_TIME_GET_MILLISEC(attr_scan->decode_time),
+									 3, es);
+			ExplainCloseGroup("Column", NULL, true, es);
 		}
-
-		Assert(natt > 0);
-		slot_values[natt - 1] = datum;
-		slot_isnull[natt - 1] = isnull;
 	}
+	ExplainCloseGroup("Columns", "Columns", false, es);
+}
 
-	/* Fill in the rest of the fields in the slot, and return the tuple */
-	slotno = ZSTidScanCurUndoSlotNo(&scan_proj->tid_scan);
-	visi_info = &scan_proj->tid_scan.array_iter.undoslot_visibility[slotno];
-	((ZedstoreTupleTableSlot *) slot)->visi_info = visi_info;
-
-	slot->tts_tableOid = RelationGetRelid(scan->rs_scan.rs_rd);
-	slot->tts_tid = ItemPointerFromZSTid(this_tid);
-	slot->tts_nvalid = slot->tts_tupleDescriptor->natts;
-	slot->tts_flags &= ~TTS_FLAG_EMPTY;
+/*
+ * Move a parallel scan to the next range of TIDs, or a synchronized scan
+ * that has reached the end of the table back to the beginning.
+ *
+ * Returns false at the end of the scan.
+ */
+static bool
+zedstoream_scan_next_range(ZedStoreDesc scan, ScanDirection direction)
+{
+	if (!scan->rs_scan.rs_parallel)
+	{
+		if (!scan->syncscan || scan->sync_wrapped ||
+			!ScanDirectionIsForward(direction) ||
+			scan->sync_start <= scan->limit_start)
+			return false;
+
+		scan->sync_wrapped = true;
+		scan->cur_range_start = scan->limit_start;
+		scan->cur_range_end = scan->sync_start;
+		scan->next_prune_range = 0;
+		zsbt_tid_reset_scan(&scan->proj_data.tid_scan,
+							scan->cur_range_start, scan->cur_range_end, scan->cur_range_start - 1);
+
+		/* restart the read-ahead, too */
+		scan->proj_data.tid_scan.prefetch_trigger = InvalidZSTid;
+		for (int i = 1; i < scan->proj_data.num_proj_atts; i++)
+			scan->proj_data.attr_scans[i - 1].prefetch_trigger = InvalidZSTid;
+		return true;
+	}
+
+	/* Allocate next range of TIDs to scan */
+	if (!zs_parallelscan_nextrange(scan->rs_scan.rs_rd,
+								   (ParallelZSScanDesc) scan->rs_scan.rs_parallel,
+								   &scan->cur_range_start, &scan->cur_range_end))
+		return false;
+
+	zsbt_tid_reset_scan(&scan->proj_data.tid_scan,
+						scan->cur_range_start, scan->cur_range_end, scan->cur_range_start - 1);
+	return true;
+}
+
+/*
+ * Limit a non-parallel scan that hasn't started yet to the TIDs of logical
+ * blocks 'start_blockno' to 'start_blockno + numblocks - 1', like
+ * heap_setscanlimits() does for heap scans. 'numblocks' can be
+ * InvalidBlockNumber, to scan to the end.
+ */
+static void
+zedstoream_scan_set_limits(ZedStoreDesc scan, BlockNumber start_blockno,
+						   BlockNumber numblocks)
+{
+	Assert(!scan->started);
+	Assert(!scan->rs_scan.rs_parallel);
+
+	scan->syncscan = false;
+	scan->limit_start = ZSTidFromBlkOff(start_blockno, 1);
+	if (numblocks == InvalidBlockNumber)
+		scan->limit_end = MaxPlusOneZSTid;
+	else
+		scan->limit_end = Min(ZSTidFromBlkOff(start_blockno, 1) +
+							  (uint64) numblocks * (MaxZSTidOffsetNumber - 1),
+							  MaxPlusOneZSTid);
+}
+
+/*
+ * Start a sequential scan, on the first call to zedstoream_getnextslot() or
+ * zedstoream_getnextbatch().
+ *
+ * Returns false if there is nothing to scan.
+ */
+static bool
+zedstoream_scan_start(ZedStoreDesc scan, TupleDesc tupdesc)
+{
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	MemoryContext oldcontext;
+
+	/*
+	 * The scan keys are evaluated before the row is fetched, so make sure
+	 * their columns are projected, and not deferred.
+	 */
+	if (scan->rs_scan.rs_nkeys > 0 && scan_proj->num_proj_atts == 0)
+	{
+		oldcontext = MemoryContextSwitchTo(scan_proj->context);
+		if (scan_proj->project_columns)
+			scan_proj->project_columns = bms_copy(scan_proj->project_columns);
+		for (int k = 0; k < scan->rs_scan.rs_nkeys; k++)
+		{
+			AttrNumber	attno = scan->rs_scan.rs_key[k].sk_attno;
+
+			/* ctid is not fetched from an attribute tree */
+			if (attno == SelfItemPointerAttributeNumber)
+				continue;
+			if (attno <= 0 || attno > tupdesc->natts)
+				elog(ERROR, "invalid attribute number %d in scan key", attno);
+			if (scan_proj->project_columns)
+				scan_proj->project_columns = bms_add_member(scan_proj->project_columns, attno);
+			scan_proj->deferred_columns = bms_del_member(scan_proj->deferred_columns, attno);
+		}
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	zs_initialize_proj_attributes(tupdesc, scan_proj);
+	zedstoream_scan_setup_pruning(scan);
+
+	if (scan->rs_scan.rs_nkeys > 0)
+	{
+		scan->key_proj_idx = MemoryContextAlloc(scan_proj->context,
+												scan->rs_scan.rs_nkeys * sizeof(int));
+		for (int k = 0; k < scan->rs_scan.rs_nkeys; k++)
+		{
+			AttrNumber	attno = scan->rs_scan.rs_key[k].sk_attno;
+			int			i;
+
+			if (attno == SelfItemPointerAttributeNumber)
+			{
+				scan->key_proj_idx[k] = -1;
+				continue;
+			}
+			for (i = 1; i < scan_proj->num_early_atts; i++)
+			{
+				if (scan_proj->proj_atts[i] == attno)
+					break;
+			}
+			if (i == scan_proj->num_early_atts)
+				elog(ERROR, "scan key attribute %d is not projected", attno);
+			scan->key_proj_idx[k] = i;
+		}
+		scan->key_results = MemoryContextAllocZero(scan_proj->context,
+												   scan->rs_scan.rs_nkeys * sizeof(ZSScanKeyResult));
+	}
+
+	if (scan->rs_scan.rs_parallel)
+	{
+		/* Allocate next range of TIDs to scan */
+		if (!zs_parallelscan_nextrange(scan->rs_scan.rs_rd,
+									   (ParallelZSScanDesc) scan->rs_scan.rs_parallel,
+									   &scan->cur_range_start, &scan->cur_range_end))
+			return false;
+	}
+	else
+	{
+		scan->cur_range_start = scan->limit_start;
+		scan->cur_range_end = scan->limit_end;
+
+		/*
+		 * Like in heapam, a large sequential scan starts where other scans
+		 * of the same table currently are, so that they read the pages
+		 * together rather than each on its own. The position is shared as
+		 * the logical block number of a TID.
+		 */
+		if (scan->syncscan)
+		{
+			Relation	rel = scan->rs_scan.rs_rd;
+			BlockNumber nblocks;
+
+			nblocks = ZSTidGetBlockNumber(zsbt_get_last_tid(rel)) + 1;
+			scan->sync_start = Max(ZSTidFromBlkOff(ss_get_location(rel, nblocks), 1),
+								   MinZSTid);
+			scan->sync_wrapped = false;
+			scan->cur_range_start = scan->sync_start;
+		}
+	}
+
+	oldcontext = MemoryContextSwitchTo(scan_proj->context);
+	zsbt_tid_begin_scan(scan->rs_scan.rs_rd,
+						scan->cur_range_start,
+						scan->cur_range_end,
+						scan->rs_scan.rs_snapshot,
+						&scan_proj->tid_scan);
+	scan_proj->tid_scan.serializable = true;
+	scan_proj->tid_scan.strategy = scan->strategy;
+	scan_proj->tid_scan.prefetch = true;
+	for (int i = 1; i < scan_proj->num_proj_atts; i++)
+	{
+		int			attno = scan_proj->proj_atts[i];
+
+		zsbt_attr_begin_scan(scan->rs_scan.rs_rd,
+							 tupdesc,
+							 attno,
+							 &scan_proj->attr_scans[i - 1]);
+		scan_proj->attr_scans[i - 1].prefetch = true;
+		scan_proj->attr_scans[i - 1].strategy = scan->strategy;
+	}
+	MemoryContextSwitchTo(oldcontext);
+	scan->started = true;
+
+	return true;
+}
+
+/*
+ * Find the next visible TID in a sequential scan.
+ *
+ * Returns InvalidZSTid at the end of the scan. *visi_info is set to point to
+ * the visibility information of the tuple; it's valid until the next call.
+ */
+static zstid
+zedstoream_scan_next_tid(ZedStoreDesc scan, ScanDirection direction,
+						 ZSUndoSlotVisibility **visi_info)
+{
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	zstid		this_tid;
+	uint8		slotno;
+
+	/* Return the TID that zedstoream_getnextbatch() had to put back, if any */
+	if (scan->pending_tid != InvalidZSTid)
+	{
+		this_tid = scan->pending_tid;
+		scan->pending_tid = InvalidZSTid;
+		*visi_info = &scan->pending_visi_info;
+		return this_tid;
+	}
+
+	for (;;)
+	{
+		this_tid = zsbt_tid_scan_next(&scan_proj->tid_scan, direction);
+		if (this_tid == InvalidZSTid)
+		{
+			if (!zedstoream_scan_next_range(scan, direction))
+				return InvalidZSTid;
+			continue;
+		}
+		Assert (this_tid < scan->cur_range_end);
+
+		/*
+		 * Skip over TIDs that can't match the scan keys. The ranges are in
+		 * TID order, so this only works when scanning forward. (In a parallel
+		 * scan, each worker gets TID ranges in increasing order, too.)
+		 */
+		if (scan->prune_ranges && ScanDirectionIsForward(direction))
+		{
+			ZSTidRange *range;
+
+			while (scan->next_prune_range < scan->num_prune_ranges &&
+				   scan->prune_ranges[scan->next_prune_range].end <= this_tid)
+				scan->next_prune_range++;
+			if (scan->next_prune_range == scan->num_prune_ranges)
+			{
+				if (!scan->syncscan || !zedstoream_scan_next_range(scan, direction))
+					return InvalidZSTid;
+				continue;
+			}
+
+			range = &scan->prune_ranges[scan->next_prune_range];
+			if (this_tid < range->start)
+			{
+				if (range->start >= scan->cur_range_end)
+				{
+					if (!zedstoream_scan_next_range(scan, direction))
+						return InvalidZSTid;
+				}
+				else
+					zsbt_tid_reset_scan(&scan_proj->tid_scan,
+										range->start, scan->cur_range_end,
+										range->start - 1);
+				continue;
+			}
+		}
+		break;
+	}
+
+	/* Let other scans of the table know where we are */
+	if (scan->syncscan && ScanDirectionIsForward(direction) &&
+		ZSTidGetBlockNumber(this_tid) != scan->sync_reported)
+	{
+		scan->sync_reported = ZSTidGetBlockNumber(this_tid);
+		ss_report_location(scan->rs_scan.rs_rd, scan->sync_reported);
+	}
+
+	slotno = ZSTidScanCurUndoSlotNo(&scan_proj->tid_scan);
+	*visi_info = &scan_proj->tid_scan.array_iter.undoslot_visibility[slotno];
+
+	return this_tid;
+}
+
+/*
+ * Fetch the datum of projected attribute proj_atts[i] of the row with TID
+ * 'this_tid'.
+ */
+static inline void
+zedstoream_scan_fetch_attr(ZedStoreDesc scan, TupleDesc tupdesc, zstid this_tid,
+						   int i, Datum *datum, bool *isnull)
+{
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	ZSAttrTreeScan *btscan = &scan_proj->attr_scans[i - 1];
+	Form_pg_attribute attr = btscan->attdesc;
+
+	if (!zsbt_attr_fetch(btscan, datum, isnull, this_tid))
+		zsbt_fill_missing_attribute_value(tupdesc, btscan->attno,
+										  datum, isnull);
+
+	/*
+	 * flatten any ZS-TOASTed values, because the rest of the system
+	 * doesn't know how to deal with them. If possible, defer the actual
+	 * work until someone looks at the value.
+	 */
+	if (!*isnull && attr->attlen == -1 &&
+		VARATT_IS_EXTERNAL(*datum) && VARTAG_EXTERNAL(*datum) == VARTAG_ZEDSTORE)
+	{
+		MemoryContext oldcxt = CurrentMemoryContext;
+
+		if (btscan->decoder.tmpcxt)
+			MemoryContextSwitchTo(btscan->decoder.tmpcxt);
+		if (btscan->defer_detoast)
+			*datum = zedstore_toast_defer(scan->rs_scan.rs_rd, scan_proj->proj_atts[i],
+										  this_tid, *datum,
+										  btscan->decoder.tmpcxt ? &btscan->decoder.tmpcxt_used : NULL);
+		else
+			*datum = zedstore_toast_flatten(scan->rs_scan.rs_rd, scan_proj->proj_atts[i],
+											this_tid, *datum);
+		btscan->decoder.tmpcxt_used += VARSIZE_ANY(DatumGetPointer(*datum));
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	/* Check that the values coming out of the b-tree are aligned properly */
+	if (!*isnull && attr->attlen == -1)
+	{
+		Assert (VARATT_IS_1B(*datum) || INTALIGN(*datum) == *datum);
+	}
+}
+
+/*
+ * Fetch the datums of projected attributes proj_atts[from] .. proj_atts[to - 1]
+ * of the row with TID 'this_tid' into 'slot_values' and 'slot_isnull'.
+ */
+static void
+zedstoream_scan_fetch_attrs(ZedStoreDesc scan, TupleDesc tupdesc, zstid this_tid,
+							int from, int to,
+							Datum *slot_values, bool *slot_isnull)
+{
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+
+	for (int i = from; i < to; i++)
+	{
+		int			natt = scan_proj->proj_atts[i];
+
+		Assert(natt > 0);
+		zedstoream_scan_fetch_attr(scan, tupdesc, this_tid, i,
+								   &slot_values[natt - 1], &slot_isnull[natt - 1]);
+	}
+}
+
+/*
+ * Does the row with TID 'this_tid' satisfy the scan keys?
+ *
+ * This fetches the key attributes from the attribute trees, before the rest
+ * of the row is fetched into a slot. Like HeapKeyTest(), a NULL never
+ * satisfies a key.
+ *
+ * Columns with few distinct values are often stored in dictionary-encoded
+ * chunks, where all the rows with the same value point to the same decoded
+ * copy of it. So if a key's value is the very same Datum as last time, we
+ * reuse the previous result, and compare only once per dictionary entry.
+ * For pass-by-reference types, that's only safe as long as the attribute
+ * scan hasn't decoded more chunks, because then the memory can be reused.
+ */
+static bool
+zedstoream_scan_keys_match(ZedStoreDesc scan, TupleDesc tupdesc, zstid this_tid)
+{
+	int			nkeys = scan->rs_scan.rs_nkeys;
+	ScanKey		keys = scan->rs_scan.rs_key;
+
+	for (int k = 0; k < nkeys; k++)
+	{
+		ScanKey		key = &keys[k];
+		ZSScanKeyResult *res;
+		ZSAttrTreeScan *btscan;
+		Datum		datum;
+		bool		isnull;
+		int			i;
+
+		if (key->sk_flags & SK_ISNULL)
+			return false;
+
+		if (key->sk_attno == SelfItemPointerAttributeNumber)
+		{
+			ItemPointerData iptr = ItemPointerFromZSTid(this_tid);
+
+			if (!DatumGetBool(FunctionCall2Coll(&key->sk_func, key->sk_collation,
+												PointerGetDatum(&iptr),
+												key->sk_argument)))
+				return false;
+			continue;
+		}
+
+		i = scan->key_proj_idx[k];
+		zedstoream_scan_fetch_attr(scan, tupdesc, this_tid, i, &datum, &isnull);
+		if (isnull)
+			return false;
+
+		btscan = &scan->proj_data.attr_scans[i - 1];
+		res = &scan->key_results[k];
+		if (!res->valid || res->datum != datum ||
+			(!btscan->attdesc->attbyval &&
+			 res->chunks_decoded != btscan->decoder.chunks_decoded))
+		{
+			res->result = DatumGetBool(FunctionCall2Coll(&key->sk_func,
+														 key->sk_collation,
+														 datum, key->sk_argument));
+			res->datum = datum;
+			res->chunks_decoded = btscan->decoder.chunks_decoded;
+			res->valid = true;
+		}
+		if (!res->result)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Fill 'slot' with the projected attributes of the row with TID 'this_tid'.
+ */
+static void
+zedstoream_scan_fill_slot(ZedStoreDesc scan, TupleTableSlot *slot,
+						  zstid this_tid, ZSUndoSlotVisibility *visi_info)
+{
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	Datum	   *slot_values = slot->tts_values;
+	bool	   *slot_isnull = slot->tts_isnull;
+
+	Assert((scan_proj->num_proj_atts - 1) <= slot->tts_tupleDescriptor->natts);
+
+	/*
+	 * Initialize the slot.
+	 *
+	 * The values for columns that are projected will be set to the actual
+	 * values below, but it's important that non-projected columns are NULL.
+	 */
+	zs_slot_clear_for_projection(slot, scan_proj->num_proj_atts - 1,
+								 &scan_proj->proj_atts[1]);
+
+	/* Note: We don't need to predicate-lock tuples in Serializable mode,
+	 * because in a sequential scan, we predicate-locked the whole table.
+	 */
+
+	/* Fetch the datums of each attribute for this row */
+	zedstoream_scan_fetch_attrs(scan, slot->tts_tupleDescriptor, this_tid,
+								1, scan_proj->num_early_atts,
+								slot_values, slot_isnull);
+
+	/* Fill in the rest of the fields in the slot */
+	((ZedstoreTupleTableSlot *) slot)->visi_info = visi_info;
+	zs_slot_set_projection(slot, scan_proj->num_proj_atts - 1,
+						   &scan_proj->proj_atts[1]);
+
+	slot->tts_tableOid = RelationGetRelid(scan->rs_scan.rs_rd);
+	slot->tts_tid = ItemPointerFromZSTid(this_tid);
+	slot->tts_nvalid = slot->tts_tupleDescriptor->natts;
+	slot->tts_flags &= ~TTS_FLAG_EMPTY;
+
+	pgstat_count_heap_getnext(scan->rs_scan.rs_rd);
+}
+
+static bool
+zedstoream_getnextslot(TableScanDesc sscan, ScanDirection direction,
+					   TupleTableSlot *slot)
+{
+	ZedStoreDesc scan = (ZedStoreDesc) sscan;
+	zstid		this_tid;
+	ZSUndoSlotVisibility *visi_info;
+
+	if (direction != ForwardScanDirection && scan->rs_scan.rs_parallel)
+		elog(ERROR, "parallel backward scan not implemented");
+
+	if (!scan->started)
+	{
+		if (!zedstoream_scan_start(scan, slot->tts_tupleDescriptor))
+		{
+			ExecClearTuple(slot);
+			return false;
+		}
+	}
+
+	do
+	{
+		this_tid = zedstoream_scan_next_tid(scan, direction, &visi_info);
+		if (this_tid == InvalidZSTid)
+		{
+			ExecClearTuple(slot);
+			return false;
+		}
+	} while (scan->rs_scan.rs_nkeys > 0 &&
+			 !zedstoream_scan_keys_match(scan, slot->tts_tupleDescriptor, this_tid));
+
+	zedstoream_scan_fill_slot(scan, slot, this_tid, visi_info);
+	return true;
+}
+
+/*
+ * Would fetching the attributes of 'tid' make the decoder discard the data
+ * that pass-by-reference datums returned for earlier TIDs point to?
+ */
+static bool
+zedstoream_scan_needs_decode(ZedStoreDesc scan, zstid tid)
+{
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+
+	/* deferred columns are fetched one row at a time, after the batch */
+	for (int i = 1; i < scan_proj->num_early_atts; i++)
+	{
+		ZSAttrTreeScan *btscan = &scan_proj->attr_scans[i - 1];
+		attstream_decoder *decoder = &btscan->decoder;
+
+		if (btscan->attdesc->attbyval)
+			continue;
+
+		/* a page of NULLs doesn't need decoding */
+		if (tid >= btscan->allnull_start && tid < btscan->allnull_end)
+			continue;
+
+		if (decoder->num_elements == 0 ||
+			tid < decoder->tids[0] ||
+			tid > decoder->tids[decoder->num_elements - 1])
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Fetch many rows at a time.
+ *
+ * Pass-by-reference datums in the slots point to the attribute decoders'
+ * buffers, which are only valid until the decoders move on to the next
+ * chunk. So a batch ends when fetching the next row would require decoding
+ * more data for a pass-by-reference column. The TID we couldn't return is
+ * remembered in scan->pending_tid, and returned first on the next call.
+ */
+static int
+zedstoream_getnextbatch(TableScanDesc sscan, ScanDirection direction,
+						TupleTableSlot **slots, int maxslots)
+{
+	ZedStoreDesc scan = (ZedStoreDesc) sscan;
+	int			nslots = 0;
+
+	if (direction != ForwardScanDirection)
+		elog(ERROR, "batch scan is only supported in forward direction");
+
+	if (!scan->started)
+	{
+		if (!zedstoream_scan_start(scan, slots[0]->tts_tupleDescriptor))
+			return 0;
+	}
+
+	while (nslots < maxslots)
+	{
+		ZedstoreTupleTableSlot *zslot = (ZedstoreTupleTableSlot *) slots[nslots];
+		zstid		this_tid;
+		ZSUndoSlotVisibility *visi_info;
+
+		this_tid = zedstoream_scan_next_tid(scan, direction, &visi_info);
+		if (this_tid == InvalidZSTid)
+			break;
+
+		if (nslots > 0 && zedstoream_scan_needs_decode(scan, this_tid))
+		{
+			scan->pending_tid = this_tid;
+			scan->pending_visi_info = *visi_info;
+			break;
+		}
+
+		if (scan->rs_scan.rs_nkeys > 0 &&
+			!zedstoream_scan_keys_match(scan, slots[nslots]->tts_tupleDescriptor, this_tid))
+			continue;
+
+		zedstoream_scan_fill_slot(scan, slots[nslots], this_tid, visi_info);
+
+		/*
+		 * The visibility information lives in the TID scan, and will be
+		 * overwritten when the scan moves to the next TID array item. Keep
+		 * a copy in the slot.
+		 */
+		zslot->visi_info_buf = *visi_info;
+		zslot->visi_info = &zslot->visi_info_buf;
+
+		nslots++;
+	}
+
+	return nslots;
+}
+
+/*
+ * Late materialization support.
+ *
+ * The caller tells us which of the projected columns it doesn't need for
+ * every row, typically the columns not referenced by the scan's quals.
+ * zedstoream_getnextslot() and zedstoream_getnextbatch() leave those columns
+ * NULL, and zedstoream_scan_fetch_deferred_columns() fills them in for the
+ * rows that the caller is interested in. The rows must be passed to it in
+ * the order they were returned by the scan, but any of them can be skipped;
+ * the attribute scans then skip over the chunks of the skipped rows without
+ * decoding them.
+ */
+static void
+zedstoream_scan_set_deferred_columns(TableScanDesc sscan, Bitmapset *deferred_columns)
+{
+	ZedStoreDesc scan = (ZedStoreDesc) sscan;
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	MemoryContext oldcontext;
 
-	pgstat_count_heap_getnext(scan->rs_scan.rs_rd);
-	return true;
+	if (scan->started || scan_proj->num_proj_atts != 0)
+		elog(ERROR, "cannot defer columns after the scan has started");
+
+	oldcontext = MemoryContextSwitchTo(scan_proj->context);
+	scan_proj->deferred_columns = bms_copy(deferred_columns);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+static void
+zedstoream_scan_fetch_deferred_columns(TableScanDesc sscan, TupleTableSlot *slot)
+{
+	ZedStoreDesc scan = (ZedStoreDesc) sscan;
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+
+	Assert(!TTS_EMPTY(slot));
+
+	if (scan_proj->num_early_atts == scan_proj->num_proj_atts)
+		return;
+
+	zedstoream_scan_fetch_attrs(scan, slot->tts_tupleDescriptor,
+								ZSTidFromItemPointer(slot->tts_tid),
+								scan_proj->num_early_atts, scan_proj->num_proj_atts,
+								slot->tts_values, slot->tts_isnull);
 }
 
 static bool
@@ -1341,26 +2370,73 @@ zedstoream_tuple_satisfies_snapshot(Relation rel, TupleTableSlot *slot,
 	return found;
 }
 
+/*
+ * Compute the latestRemovedXid for removing index entries that point to the
+ * given rows, which the index AM has found to be dead (see
+ * zedstoream_index_fetch_tuple()).
+ *
+ * This is the latest XID that deleted or updated away any of the rows. If
+ * that's no longer known, because the UNDO log has been trimmed, the row
+ * was dead to everyone before the current xmin horizon, so we use that.
+ */
 static TransactionId
 zedstoream_compute_xid_horizon_for_tuples(Relation rel,
 										  ItemPointerData *items,
 										  int nitems)
 {
-	ereport(ERROR,
-			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-			 errmsg("function %s not implemented yet", __func__)));
+	TransactionId latestRemovedXid = InvalidTransactionId;
+	ZSUndoRecPtr recent_oldest_undo;
+	bool		need_horizon = false;
+
+	recent_oldest_undo = zsundo_get_oldest_undo_ptr(rel, false);
+
+	for (int i = 0; i < nitems; i++)
+	{
+		TransactionId xid;
+
+		if (!zsbt_tid_get_removing_xid(rel, ZSTidFromItemPointer(items[i]),
+									   recent_oldest_undo, &xid))
+			need_horizon = true;
+		else if (TransactionIdIsNormal(xid) &&
+				 (!TransactionIdIsValid(latestRemovedXid) ||
+				  TransactionIdFollows(xid, latestRemovedXid)))
+			latestRemovedXid = xid;
+	}
+
+	if (need_horizon)
+	{
+		TransactionId horizon = GetOldestXmin(rel, PROCARRAY_FLAGS_VACUUM);
+
+		if (!TransactionIdIsValid(latestRemovedXid) ||
+			TransactionIdFollows(horizon, latestRemovedXid))
+			latestRemovedXid = horizon;
+	}
+
+	return latestRemovedXid;
 }
 
 static IndexFetchTableData *
 zedstoream_begin_index_fetch(Relation rel)
 {
-	ZedStoreIndexFetch zscan;
-
 	zsbt_tuplebuffer_flush(rel);
 
+	return zs_begin_index_fetch_noflush(rel);
+}
+
+/*
+ * Like zedstoream_begin_index_fetch(), but for a caller that has made sure
+ * that the rows it's going to fetch are not in the tuple buffer.
+ */
+static IndexFetchTableData *
+zs_begin_index_fetch_noflush(Relation rel)
+{
+	ZedStoreIndexFetch zscan;
+
 	zscan = palloc0(sizeof(ZedStoreIndexFetchData));
 	zscan->idx_fetch_data.rel = rel;
 	zscan->proj_data.context = CurrentMemoryContext;
+	zscan->allvis_buf = InvalidBuffer;
+	zscan->allvis_iter.context = CurrentMemoryContext;
 
 	return (IndexFetchTableData *) zscan;
 }
@@ -1397,9 +2473,53 @@ zedstoream_end_index_fetch(IndexFetchTableData *scan)
 
 	if (zscan_proj->attr_scans)
 		pfree(zscan_proj->attr_scans);
+
+	if (BufferIsValid(zscan->allvis_buf))
+		ReleaseBuffer(zscan->allvis_buf);
+	if (zscan->allvis_iter.tids)
+		pfree(zscan->allvis_iter.tids);
+	if (zscan->allvis_iter.tid_undoslotnos)
+		pfree(zscan->allvis_iter.tid_undoslotnos);
 	pfree(zscan);
 }
 
+/*
+ * Is the row with given TID dead to all transactions? Like
+ * HeapTupleIsSurelyDead(), this checks for rows that a VACUUM would remove
+ * right now.
+ *
+ * Most of the time, the TID tree alone tells: a TID in the dead UNDO slot,
+ * or one that's not in the tree at all anymore, is dead, and one in the old
+ * UNDO slot is visible to everyone. Only if the row has a live UNDO record
+ * do we need to check its visibility.
+ */
+static bool
+zs_tid_is_surely_dead(ZedStoreIndexFetch zscan, zstid tid)
+{
+	Relation	rel = zscan->idx_fetch_data.rel;
+	SnapshotData SnapshotNonVacuumable;
+	ZSTidTreeScan scan;
+	ZSUndoRecPtr undoptr;
+	int			slotno;
+	bool		found;
+
+	slotno = zsbt_tid_get_undo_slot(rel, tid, &zscan->allvis_buf, &undoptr);
+	if (slotno == -1 || slotno == ZSBT_DEAD_UNDO_SLOT)
+		return true;
+	if (slotno == ZSBT_OLD_UNDO_SLOT)
+		return false;
+
+	if (!TransactionIdIsValid(RecentGlobalXmin))
+		return false;
+
+	InitNonVacuumableSnapshot(SnapshotNonVacuumable, RecentGlobalXmin);
+	zsbt_tid_begin_scan(rel, tid, tid + 1, &SnapshotNonVacuumable, &scan);
+	found = (zsbt_tid_scan_next(&scan, ForwardScanDirection) != InvalidZSTid);
+	zsbt_tid_end_scan(&scan);
+
+	return !found;
+}
+
 static bool
 zedstoream_index_fetch_tuple(struct IndexFetchTableData *scan,
 							 ItemPointer tid_p,
@@ -1419,6 +2539,17 @@ zedstoream_index_fetch_tuple(struct IndexFetchTableData *scan,
 		*all_dead = false;
 
 	result = zedstoream_fetch_row((ZedStoreIndexFetchData *) scan, tid_p, snapshot, slot);
+
+	/*
+	 * Every UPDATE creates new index entries, and until VACUUM, the entries
+	 * for the old row versions are only removed if the index AM knows that
+	 * they're dead. Tell it, if the row is dead to everyone, so that it can
+	 * mark the entry as killed and skip it in later scans.
+	 */
+	if (!result && all_dead)
+		*all_dead = zs_tid_is_surely_dead((ZedStoreIndexFetch) scan,
+										  ZSTidFromItemPointer(*tid_p));
+
 	if (result)
 	{
 		/* FIXME: heapam acquires the predicate lock first, and then
@@ -1434,17 +2565,13 @@ zedstoream_index_fetch_tuple(struct IndexFetchTableData *scan,
 }
 
 /*
- * Shared implementation of fetch_row_version and index_fetch_tuple callbacks.
+ * Prepare 'fetch' for fetching rows in the TID range [starttid, endtid).
  */
-static bool
-zedstoream_fetch_row(ZedStoreIndexFetchData *fetch,
-					 ItemPointer tid_p,
-					 Snapshot snapshot,
-					 TupleTableSlot *slot)
+static void
+zedstoream_fetch_begin(ZedStoreIndexFetchData *fetch, TupleDesc tupdesc,
+					   Snapshot snapshot, zstid starttid, zstid endtid)
 {
 	Relation	rel = fetch->idx_fetch_data.rel;
-	zstid		tid = ZSTidFromItemPointer(*tid_p);
-	bool		found = true;
 	ZedStoreProjectData *fetch_proj = &fetch->proj_data;
 
 	/* first time here, initialize */
@@ -1453,10 +2580,10 @@ zedstoream_fetch_row(ZedStoreIndexFetchData *fetch,
 		TupleDesc	reldesc = RelationGetDescr(rel);
 		MemoryContext oldcontext;
 
-		zs_initialize_proj_attributes(slot->tts_tupleDescriptor, fetch_proj);
+		zs_initialize_proj_attributes(tupdesc, fetch_proj);
 
 		oldcontext = MemoryContextSwitchTo(fetch_proj->context);
-		zsbt_tid_begin_scan(rel, tid, tid + 1,
+		zsbt_tid_begin_scan(rel, starttid, endtid,
 							snapshot,
 							&fetch_proj->tid_scan);
 		fetch_proj->tid_scan.serializable = true;
@@ -1470,73 +2597,216 @@ zedstoream_fetch_row(ZedStoreIndexFetchData *fetch,
 		MemoryContextSwitchTo(oldcontext);
 	}
 	else
-		zsbt_tid_reset_scan(&fetch_proj->tid_scan, tid, tid + 1, tid - 1);
+		zsbt_tid_reset_scan(&fetch_proj->tid_scan, starttid, endtid, starttid - 1);
+}
+
+/*
+ * Fill 'slot' with the projected columns of the row at 'tid', which the TID
+ * tree scan in 'fetch' has just returned.
+ */
+static void
+zedstoream_fetch_store(ZedStoreIndexFetchData *fetch, TupleTableSlot *slot,
+					   zstid tid)
+{
+	Relation	rel = fetch->idx_fetch_data.rel;
+	ZedStoreProjectData *fetch_proj = &fetch->proj_data;
+	uint8		slotno;
+	ZSUndoSlotVisibility *visi_info;
 
 	/*
-	 * Initialize the slot.
-	 *
-	 * If we're not fetching all columns, initialize the unfetched values
-	 * in the slot to NULL. (Actually, this initializes all to NULL, and the
-	 * code below will overwrite them for the columns that are projected)
+	 * Each projected column lives in a separate tree, so fetching a wide row
+	 * means reading a leaf page from each of them. If the leaves aren't in
+	 * the buffer cache, issue prefetches for all of them first, so that the
+	 * reads can proceed in parallel rather than one column at a time.
 	 */
-	ExecClearTuple(slot);
-	for (int i = 0; i < slot->tts_tupleDescriptor->natts; i++)
-		slot->tts_isnull[i] = true;
-
-	found = zsbt_tid_scan_next(&fetch_proj->tid_scan, ForwardScanDirection) != InvalidZSTid;
-	if (found)
+	if (target_prefetch_pages > 0 && fetch_proj->num_proj_atts > 2)
 	{
 		for (int i = 1; i < fetch_proj->num_proj_atts; i++)
 		{
-			int         natt = fetch_proj->proj_atts[i];
 			ZSAttrTreeScan *btscan = &fetch_proj->attr_scans[i - 1];
-			Form_pg_attribute attr;
-			Datum		datum;
-			bool        isnull;
+			ZSTidRange	range;
+
+			if (btscan->decoder.num_elements == 0 ||
+				tid < btscan->decoder.tids[0] ||
+				tid > btscan->decoder.tids[btscan->decoder.num_elements - 1])
+				zsbt_prefetch_leaf(rel, btscan->attno, tid, &range);
+		}
+	}
 
-			attr = btscan->attdesc;
-			if (zsbt_attr_fetch(btscan, &datum, &isnull, tid))
+	for (int i = 1; i < fetch_proj->num_proj_atts; i++)
+	{
+		int         natt = fetch_proj->proj_atts[i];
+		ZSAttrTreeScan *btscan = &fetch_proj->attr_scans[i - 1];
+		Form_pg_attribute attr;
+		Datum		datum;
+		bool        isnull;
+
+		attr = btscan->attdesc;
+		if (zsbt_attr_fetch(btscan, &datum, &isnull, tid))
+		{
+			/*
+			 * flatten any ZS-TOASTed values, because the rest of the system
+			 * doesn't know how to deal with them.
+			 */
+			if (!isnull && attr->attlen == -1 &&
+				VARATT_IS_EXTERNAL(datum) && VARTAG_EXTERNAL(datum) == VARTAG_ZEDSTORE)
 			{
-				/*
-				 * flatten any ZS-TOASTed values, because the rest of the system
-				 * doesn't know how to deal with them.
-				 */
-				if (!isnull && attr->attlen == -1 &&
-					VARATT_IS_EXTERNAL(datum) && VARTAG_EXTERNAL(datum) == VARTAG_ZEDSTORE)
-				{
-					MemoryContext oldcxt = CurrentMemoryContext;
+				MemoryContext oldcxt = CurrentMemoryContext;
 
-					if (btscan->decoder.tmpcxt)
-						MemoryContextSwitchTo(btscan->decoder.tmpcxt);
+				if (btscan->decoder.tmpcxt)
+					MemoryContextSwitchTo(btscan->decoder.tmpcxt);
+				if (btscan->defer_detoast)
+					datum = zedstore_toast_defer(rel, natt, tid, datum,
+												 btscan->decoder.tmpcxt ? &btscan->decoder.tmpcxt_used : NULL);
+				else
 					datum = zedstore_toast_flatten(rel, natt, tid, datum);
-					MemoryContextSwitchTo(oldcxt);
-				}
+				btscan->decoder.tmpcxt_used += VARSIZE_ANY(DatumGetPointer(datum));
+				MemoryContextSwitchTo(oldcxt);
 			}
-			else
-				zsbt_fill_missing_attribute_value(slot->tts_tupleDescriptor, btscan->attno,
-												  &datum, &isnull);
-
-			slot->tts_values[natt - 1] = datum;
-			slot->tts_isnull[natt - 1] = isnull;
 		}
+		else
+			zsbt_fill_missing_attribute_value(slot->tts_tupleDescriptor, btscan->attno,
+											  &datum, &isnull);
+
+		slot->tts_values[natt - 1] = datum;
+		slot->tts_isnull[natt - 1] = isnull;
 	}
 
-	if (found)
+	slotno = ZSTidScanCurUndoSlotNo(&fetch_proj->tid_scan);
+	visi_info = &fetch_proj->tid_scan.array_iter.undoslot_visibility[slotno];
+
+	((ZedstoreTupleTableSlot *) slot)->visi_info = visi_info;
+	zs_slot_set_projection(slot, fetch_proj->num_proj_atts - 1,
+						   &fetch_proj->proj_atts[1]);
+	slot->tts_tableOid = RelationGetRelid(rel);
+	slot->tts_tid = ItemPointerFromZSTid(tid);
+	slot->tts_nvalid = slot->tts_tupleDescriptor->natts;
+	slot->tts_flags &= ~TTS_FLAG_EMPTY;
+}
+
+/*
+ * Initialize 'slot' for zedstoream_fetch_store().
+ *
+ * If we're not fetching all columns, the unfetched values in the slot must
+ * be NULL. zedstoream_fetch_store() will overwrite the columns that are
+ * projected.
+ */
+static inline void
+zedstoream_fetch_clear_slot(ZedStoreProjectData *proj_data, TupleTableSlot *slot)
+{
+	zs_slot_clear_for_projection(slot, proj_data->num_proj_atts - 1,
+								 &proj_data->proj_atts[1]);
+}
+
+/*
+ * Check if the row at 'tid' is visible to all, for index-only scans.
+ *
+ * Zedstore has no visibility map, but the TID tree holds the same
+ * information: a row whose UNDO record has already been discarded is visible
+ * to everyone. This only needs to look at the TID tree leaf, not the
+ * attribute trees or the UNDO log.
+ */
+static bool
+zedstoream_index_fetch_all_visible(struct IndexFetchTableData *scan,
+								   ItemPointer tid_p)
+{
+	ZedStoreIndexFetch zscan = (ZedStoreIndexFetch) scan;
+
+	/*
+	 * Get the oldest UNDO pointer on first call. It can only advance, so
+	 * using the same value for the rest of the scan is safe.
+	 */
+	if (zscan->allvis_oldest_undo.counter == 0)
+		zscan->allvis_oldest_undo = zsundo_get_oldest_undo_ptr(scan->rel, true);
+
+	return zsbt_tid_is_all_visible(scan->rel, ZSTidFromItemPointer(*tid_p),
+								   zscan->allvis_oldest_undo,
+								   &zscan->allvis_buf, &zscan->allvis_iter);
+}
+
+/*
+ * Shared implementation of fetch_row_version and index_fetch_tuple callbacks.
+ */
+static bool
+zedstoream_fetch_row(ZedStoreIndexFetchData *fetch,
+					 ItemPointer tid_p,
+					 Snapshot snapshot,
+					 TupleTableSlot *slot)
+{
+	zstid		tid = ZSTidFromItemPointer(*tid_p);
+	ZedStoreProjectData *fetch_proj = &fetch->proj_data;
+
+	zedstoream_fetch_begin(fetch, slot->tts_tupleDescriptor, snapshot,
+						   tid, tid + 1);
+
+	zedstoream_fetch_clear_slot(fetch_proj, slot);
+
+	if (zsbt_tid_scan_next(&fetch_proj->tid_scan, ForwardScanDirection) == InvalidZSTid)
+		return false;
+
+	zedstoream_fetch_store(fetch, slot, tid);
+	return true;
+}
+
+/*
+ * Batched version of zedstoream_index_fetch_tuple().
+ *
+ * The TIDs are sorted, so we can scan the TID tree forward over the whole
+ * range, seeking to each requested TID, and fetch the attributes in
+ * ascending TID order. The TID and attribute tree scans keep their current
+ * leaf pinned and the current array item or attstream decoded, so
+ * consecutive TIDs that land on the same pages don't descend the trees
+ * again. Each slot is materialized, as the next TID can overwrite the
+ * decoded data.
+ */
+static void
+zedstoream_index_fetch_tuples(struct IndexFetchTableData *scan,
+							  ItemPointer tids, int ntids,
+							  Snapshot snapshot,
+							  TupleTableSlot **slots, bool *found)
+{
+	ZedStoreIndexFetchData *fetch = (ZedStoreIndexFetchData *) scan;
+	ZedStoreProjectData *fetch_proj = &fetch->proj_data;
+	zstid		nexttid = InvalidZSTid;
+
+	if (ntids == 0)
+		return;
+
+	zedstoream_fetch_begin(fetch, slots[0]->tts_tupleDescriptor, snapshot,
+						   ZSTidFromItemPointer(tids[0]),
+						   ZSTidFromItemPointer(tids[ntids - 1]) + 1);
+
+	for (int i = 0; i < ntids; i++)
 	{
-		uint8		slotno = ZSTidScanCurUndoSlotNo(&fetch_proj->tid_scan);
-		ZSUndoSlotVisibility *visi_info;
+		zstid		tid = ZSTidFromItemPointer(tids[i]);
+		TupleTableSlot *slot = slots[i];
 
-		visi_info = &fetch_proj->tid_scan.array_iter.undoslot_visibility[slotno];
+		Assert(i == 0 || tid >= ZSTidFromItemPointer(tids[i - 1]));
 
-		((ZedstoreTupleTableSlot *) slot)->visi_info = visi_info;
-		slot->tts_tableOid = RelationGetRelid(rel);
-		slot->tts_tid = ItemPointerFromZSTid(tid);
-		slot->tts_nvalid = slot->tts_tupleDescriptor->natts;
-		slot->tts_flags &= ~TTS_FLAG_EMPTY;
-		return true;
-	}
+		zedstoream_fetch_clear_slot(fetch_proj, slot);
 
-	return false;
+		/*
+		 * 'nexttid' is the next visible TID the scan returned. If it's
+		 * already past this TID, this one is not visible to us.
+		 */
+		if (nexttid < tid)
+		{
+			zsbt_tid_scan_skip_to(&fetch_proj->tid_scan, tid);
+			nexttid = zsbt_tid_scan_next(&fetch_proj->tid_scan, ForwardScanDirection);
+			if (nexttid == InvalidZSTid)
+				nexttid = MaxPlusOneZSTid;
+		}
+
+		found[i] = (nexttid == tid);
+		if (found[i])
+		{
+			zedstoream_fetch_store(fetch, slot, tid);
+			ExecMaterializeSlot(slot);
+
+			/* See comment in zedstoream_index_fetch_tuple() */
+			PredicateLockTID(scan->rel, &tids[i], snapshot);
+		}
+	}
 }
 
 static void
@@ -1582,10 +2852,12 @@ zedstoream_index_validate_scan(Relation baseRelation,
 	 * satisfying the passed-in reference snapshot.  We must disable syncscan
 	 * here, because it's critical that we read from block zero forward to
 	 * match the sorted TIDs.
-	 */
-
-	/*
-	 * TODO: It would be very good to fetch only the columns we need.
+	 *
+	 * Most rows are already in the index, so we only need their TIDs. Defer
+	 * all the columns, so that the scan walks just the TID tree, and fetch
+	 * the columns for the rows that are missing from the index. Those are
+	 * visited in TID order, so the attribute scans can skip over the chunks
+	 * in between without decoding them.
 	 */
 	for (attno = 0; attno < indexInfo->ii_NumIndexKeyAttrs; attno++)
 	{
@@ -1604,6 +2876,7 @@ zedstoream_index_validate_scan(Relation baseRelation,
 												  0, /* number of keys */
 												  NULL,	/* scan key */
 												  proj);
+	zedstoream_scan_set_deferred_columns(scan, proj);
 
 	/*
 	 * Scan all tuples matching the snapshot.
@@ -1656,6 +2929,7 @@ zedstoream_index_validate_scan(Relation baseRelation,
 		if (cmp < 0)
 		{
 			/* This item is not in the index */
+			zedstoream_scan_fetch_deferred_columns(scan, slot);
 
 			/*
 			 * In a partial index, discard tuples that don't satisfy the
@@ -1724,6 +2998,7 @@ zedstoream_index_build_range_scan(Relation baseRelation,
 	bool		need_unregister_snapshot = false;
 	TransactionId OldestXmin;
 	bool        tupleIsAlive;
+	Bitmapset  *proj = NULL;
 
 #ifdef USE_ASSERT_CHECKING
 	bool		checking_uniqueness;
@@ -1771,11 +3046,22 @@ zedstoream_index_build_range_scan(Relation baseRelation,
 		OldestXmin = GetOldestXmin(baseRelation, PROCARRAY_FLAGS_VACUUM);
 
 	zsbt_tuplebuffer_flush(baseRelation);
-	if (!scan)
+
+	/* We only need to fetch the columns used by the index */
+	for (int attno = 0; attno < indexInfo->ii_NumIndexKeyAttrs; attno++)
 	{
-		int			attno;
-		Bitmapset  *proj = NULL;
+		Assert(indexInfo->ii_IndexAttrNumbers[attno] <= baseRelation->rd_att->natts);
+		proj = bms_add_member(proj, indexInfo->ii_IndexAttrNumbers[attno]);
+	}
+	PopulateNeededColumnsForNode((Node *)indexInfo->ii_Predicate,
+								 baseRelation->rd_att->natts,
+								 &proj);
+	PopulateNeededColumnsForNode((Node *)indexInfo->ii_Expressions,
+								 baseRelation->rd_att->natts,
+								 &proj);
 
+	if (!scan)
+	{
 		/*
 		 * Serial index build.
 		 *
@@ -1794,65 +3080,42 @@ zedstoream_index_build_range_scan(Relation baseRelation,
 			snapshot = &NonVacuumableSnapshot;
 		}
 
-		for (attno = 0; attno < indexInfo->ii_NumIndexKeyAttrs; attno++)
-		{
-			Assert(indexInfo->ii_IndexAttrNumbers[attno] <= baseRelation->rd_att->natts);
-			proj = bms_add_member(proj, indexInfo->ii_IndexAttrNumbers[attno]);
-		}
-		PopulateNeededColumnsForNode((Node *)indexInfo->ii_Predicate,
-									 baseRelation->rd_att->natts,
-									 &proj);
-		PopulateNeededColumnsForNode((Node *)indexInfo->ii_Expressions,
-									 baseRelation->rd_att->natts,
-									 &proj);
-
 		scan = table_beginscan_with_column_projection(baseRelation,	/* relation */
 													  snapshot,	/* snapshot */
 													  0, /* number of keys */
 													  NULL,	/* scan key */
 													  proj);
 
+		/*
+		 * When summarizing a range of a BRIN index, only read the TIDs in
+		 * the range. Together with the projection, that means reading just
+		 * the parts of the indexed columns' trees that cover the range.
+		 */
 		if (start_blockno != 0 || numblocks != InvalidBlockNumber)
-		{
-			ZedStoreDesc zscan = (ZedStoreDesc) scan;
-			ZedStoreProjectData *zscan_proj = &zscan->proj_data;
-
-			zscan->cur_range_start = ZSTidFromBlkOff(start_blockno, 1);
-			zscan->cur_range_end = ZSTidFromBlkOff(numblocks, 1);
-
-			/* FIXME: when can 'num_proj_atts' be 0? */
-			if (zscan_proj->num_proj_atts > 0)
-			{
-				zsbt_tid_begin_scan(zscan->rs_scan.rs_rd,
-									zscan->cur_range_start,
-									zscan->cur_range_end,
-									zscan->rs_scan.rs_snapshot,
-									&zscan_proj->tid_scan);
-				for (int i = 1; i < zscan_proj->num_proj_atts; i++)
-				{
-					int			natt = zscan_proj->proj_atts[i];
-
-					zsbt_attr_begin_scan(zscan->rs_scan.rs_rd,
-										 RelationGetDescr(zscan->rs_scan.rs_rd),
-										 natt,
-										 &zscan_proj->attr_scans[i - 1]);
-				}
-			}
-		}
+			zedstoream_scan_set_limits((ZedStoreDesc) scan, start_blockno, numblocks);
 	}
 	else
 	{
+		ZedStoreDesc zscan = (ZedStoreDesc) scan;
+
 		/*
 		 * Parallel index build.
 		 *
 		 * Parallel case never registers/unregisters own snapshot.  Snapshot
 		 * is taken from parallel zedstore scan, and is SnapshotAny or an MVCC
 		 * snapshot, based on same criteria as serial case.
+		 *
+		 * Each participant scans the TID ranges handed out by the parallel
+		 * scan. The scan was begun by the caller, but it doesn't start
+		 * fetching until the first getnextslot call, so we can still limit
+		 * it to the indexed columns, and make it use the non-vacuumable
+		 * snapshot like the serial case does.
 		 */
 		Assert(!IsBootstrapProcessingMode());
 		Assert(allow_sync);
 		Assert(start_blockno == 0);
 		Assert(numblocks == InvalidBlockNumber);
+		Assert(zscan->proj_data.num_proj_atts == 0);
 		snapshot = scan->rs_snapshot;
 
 		if (snapshot == SnapshotAny)
@@ -1860,7 +3123,9 @@ zedstoream_index_build_range_scan(Relation baseRelation,
 			/* leave out completely dead items even with SnapshotAny */
 			InitNonVacuumableSnapshot(NonVacuumableSnapshot, OldestXmin);
 			snapshot = &NonVacuumableSnapshot;
+			scan->rs_snapshot = snapshot;
 		}
+		zscan->proj_data.project_columns = proj;
 	}
 
 	/*
@@ -1883,10 +3148,6 @@ zedstoream_index_build_range_scan(Relation baseRelation,
 	{
 		ZSUndoSlotVisibility *visi_info;
 
-		if (numblocks != InvalidBlockNumber &&
-			ItemPointerGetBlockNumber(&slot->tts_tid) >= numblocks)
-			break;
-
 		CHECK_FOR_INTERRUPTS();
 
 		/*
@@ -1963,7 +3224,9 @@ zedstoream_finish_bulk_insert(Relation relation, int options)
 	 * indexes since those use WAL anyway / don't go through tableam)
 	 */
 	if (options & HEAP_INSERT_SKIP_WAL)
-		heap_sync(relation);
+		zsbt_tuplebuffer_end_skip_wal(relation);
+
+	zs_loadstats_finish(relation);
 }
 
 /* ------------------------------------------------------------------------
@@ -1982,6 +3245,7 @@ zedstoream_relation_set_new_filenode(Relation rel,
 
 	/* XXX: I think we could just throw away all data in the buffer */
 	zsbt_tuplebuffer_flush(rel);
+	zs_loadstats_forget(rel);
 
 	/*
 	 * Initialize to the minimum XID that could put tuples in the table. We
@@ -2027,7 +3291,10 @@ zedstoream_relation_nontransactional_truncate(Relation rel)
 {
 	/* XXX: I think we could just throw away all data in the buffer */
 	zsbt_tuplebuffer_flush(rel);
+	zs_loadstats_forget(rel);
 	zsmeta_invalidate_cache(rel);
+	zs_metacache_invalidate(rel);
+	zspage_forget_pool(&rel->rd_node);
 	RelationTruncate(rel, 0);
 }
 
@@ -2038,9 +3305,22 @@ zedstoream_relation_copy_data(Relation rel, const RelFileNode *newrnode)
 
 	zsbt_tuplebuffer_flush(rel);
 
+	/*
+	 * Don't copy more than we have to. Discard the UNDO log that's no longer
+	 * needed, and compact the relation, so that the B-tree pages fill the
+	 * free pages in the middle, and the free pages at the end are truncated
+	 * away. We're holding an AccessExclusiveLock, so the truncation cannot
+	 * fail to get its lock.
+	 */
+	zsundo_trim_all(rel);
+	(void) zspage_compact(rel, 0, DEBUG1);
+
 	dstrel = smgropen(*newrnode, rel->rd_backend);
 	RelationOpenSmgr(rel);
 
+	/* the new relfilenode might have been used by a dropped relation */
+	zs_metacache_forget(newrnode);
+
 	/*
 	 * Since we copy the file directly without looking at the shared buffers,
 	 * we'd better first flush out any pages of the source relation that are
@@ -2070,19 +3350,57 @@ zedstoream_relation_copy_data(Relation rel, const RelFileNode *newrnode)
 	smgrclose(dstrel);
 }
 
+/*
+ * State for re-creating the UPDATE chains of the old table in the new one,
+ * in zedstoream_relation_copy_for_cluster(). Like in heap's rewriteheap.c,
+ * whichever version of an updated row is copied first waits in a hash table
+ * for the other one:
+ *
+ * 'tid_map' maps the old TIDs of recently inserted rows to their new TIDs,
+ * for when the old version of an update is copied after the new version.
+ * Only rows inserted by transactions that are not older than OldestXmin can
+ * be the new version of an update whose old version is still copied, so
+ * the rest are not remembered.
+ *
+ * 'unresolved' holds the old versions whose new version hasn't been copied
+ * yet, keyed by the old TID of the new version. When the new version is
+ * copied, the copy of the old version is marked as updated to it. If it's
+ * never copied, the old version is just marked as deleted at the end.
+ */
+typedef struct
+{
+	zstid		oldtid;			/* hash key */
+	zstid		newtid;
+} ZSRewriteTidMapEntry;
+
+typedef struct
+{
+	zstid		new_version_oldtid;	/* hash key */
+	zstid		newtid;			/* new TID of the old version */
+	TransactionId xmax;
+	CommandId	cmax;
+	bool		key_update;
+} ZSRewriteUnresolvedEntry;
+
+typedef struct
+{
+	HTAB	   *tid_map;
+	HTAB	   *unresolved;
+} ZSRewriteChainState;
+
 /*
  * Subroutine of the zedstoream_relation_copy_for_cluster() callback.
  *
  * Creates the TID item with correct visibility information for the
  * given tuple in the old table. Returns the tid of the tuple in the
  * new table, or InvalidZSTid if this tuple can be left out completely.
- *
- * FIXME: This breaks UPDATE chains. I.e. after this is done, an UPDATE
- * looks like DELETE + INSERT, instead of an UPDATE, to any transaction that
- * might try to follow the update chain.
+ * If the tuple was updated, or is the new version of an update, the
+ * update chain is re-created with the help of 'chains'.
  */
 static zstid
 zs_cluster_process_tuple(Relation OldHeap, Relation NewHeap,
+						 ZSTidBulkInsertState *tidstate,
+						 ZSRewriteChainState *chains,
 						 zstid oldtid, ZSUndoRecPtr old_undoptr,
 						 ZSUndoRecPtr recent_oldest_undo,
 						 TransactionId OldestXmin)
@@ -2092,6 +3410,8 @@ zs_cluster_process_tuple(Relation OldHeap, Relation NewHeap,
 	TransactionId this_xmax;
 	CommandId this_cmax;
 	bool		this_changedPart;
+	zstid		this_updated_to = InvalidZSTid;
+	bool		this_key_update = false;
 	ZSUndoRecPtr undo_ptr;
 	ZSUndoRec  *undorec;
 
@@ -2185,7 +3505,11 @@ zs_cluster_process_tuple(Relation OldHeap, Relation NewHeap,
 					if (undorec->type == ZSUNDO_TYPE_DELETE)
 						this_changedPart = ((ZSUndoRec_Delete *) undorec)->changedPart;
 					else
+					{
 						this_changedPart = false;
+						this_updated_to = ((ZSUndoRec_Update *) undorec)->newtid;
+						this_key_update = ((ZSUndoRec_Update *) undorec)->key_update;
+					}
 
 					/* follow the UNDO chain to find information about the inserting
 					 * transaction (xmin/cmin)
@@ -2195,31 +3519,71 @@ zs_cluster_process_tuple(Relation OldHeap, Relation NewHeap,
 				}
 			}
 		}
-	}
-
-	/*
-	 * We now know the visibility of this tuple. Re-create it in the new table.
-	 */
-	if (this_xmin != InvalidTransactionId)
-	{
-		/* Insert the first version of the row. */
-		zstid		newtid;
-
-		/* First, insert the tuple. */
-		newtid = zsbt_tid_multi_insert(NewHeap,
-									   1,
-									   this_xmin,
-									   this_cmin,
-									   INVALID_SPECULATIVE_TOKEN,
-									   InvalidUndoPtr);
-
-		/* And if the tuple was deleted/updated away, do the same in the new table. */
-		if (this_xmax != InvalidTransactionId)
+	}
+
+	/*
+	 * We now know the visibility of this tuple. Re-create it in the new table.
+	 */
+	if (this_xmin != InvalidTransactionId)
+	{
+		/* Insert the first version of the row. */
+		zstid		newtid;
+		ZSRewriteTidMapEntry *mapentry;
+		ZSRewriteUnresolvedEntry *unresolved;
+		bool		found;
+
+		/* First, insert the tuple. */
+		newtid = zsbt_tid_bulk_insert(tidstate, this_xmin, this_cmin);
+
+		/*
+		 * If this is the new version of an update whose old version was
+		 * copied already, link the old version to this one. Otherwise,
+		 * remember this row, in case it is.
+		 */
+		unresolved = hash_search(chains->unresolved, &oldtid, HASH_FIND, NULL);
+		if (unresolved)
+		{
+			zsbt_tid_bulk_flush(tidstate);
+			zsbt_tid_mark_updated(NewHeap, unresolved->newtid, newtid,
+								  unresolved->xmax, unresolved->cmax,
+								  unresolved->key_update);
+			hash_search(chains->unresolved, &oldtid, HASH_REMOVE, NULL);
+		}
+		else if (TransactionIdIsNormal(this_xmin) &&
+				 TransactionIdFollowsOrEquals(this_xmin, OldestXmin))
+		{
+			mapentry = hash_search(chains->tid_map, &oldtid, HASH_ENTER, &found);
+			mapentry->newtid = newtid;
+		}
+
+		if (this_xmax != InvalidTransactionId && this_updated_to != InvalidZSTid)
+		{
+			/* tuple was updated. Link it to the new version, if we have it */
+			mapentry = hash_search(chains->tid_map, &this_updated_to, HASH_FIND, NULL);
+			if (mapentry)
+			{
+				zsbt_tid_bulk_flush(tidstate);
+				zsbt_tid_mark_updated(NewHeap, newtid, mapentry->newtid,
+									  this_xmax, this_cmax, this_key_update);
+				hash_search(chains->tid_map, &this_updated_to, HASH_REMOVE, NULL);
+			}
+			else
+			{
+				unresolved = hash_search(chains->unresolved, &this_updated_to,
+										 HASH_ENTER, &found);
+				unresolved->newtid = newtid;
+				unresolved->xmax = this_xmax;
+				unresolved->cmax = this_cmax;
+				unresolved->key_update = this_key_update;
+			}
+		}
+		else if (this_xmax != InvalidTransactionId)
 		{
 			TM_Result	delete_result;
 			bool		this_xact_has_lock;
 
 			/* tuple was deleted. */
+			zsbt_tid_bulk_flush(tidstate);
 			delete_result = zsbt_tid_delete(NewHeap, newtid,
 											this_xmax, this_cmax,
 											NULL, NULL, false, NULL, this_changedPart,
@@ -2252,9 +3616,18 @@ zedstoream_relation_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 	IndexScanDesc indexScan;
 	Datum	   *newdatums;
 	bool       *newisnulls;
+	ZSTidBulkInsertState tidstate;
+	BufferAccessStrategy strategy;
+	ZSRewriteChainState chains;
+	HASHCTL		hash_ctl;
+	HASH_SEQ_STATUS seq_status;
+	ZSRewriteUnresolvedEntry *unresolved;
 
 	zsbt_tuplebuffer_flush(OldHeap);
 
+	/* read the old table through a ring, like a large seqscan would */
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+
 	olddesc = RelationGetDescr(OldHeap),
 
 	attr_scans = palloc(olddesc->natts * sizeof(ZSAttrTreeScan));
@@ -2268,6 +3641,8 @@ zedstoream_relation_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 	 */
 	zsbt_tid_begin_scan(OldHeap, MinZSTid, MaxPlusOneZSTid,
 						SnapshotAny, &tid_scan);
+	tid_scan.strategy = strategy;
+	tid_scan.prefetch = true;
 
 	for (attno = 1; attno <= olddesc->natts; attno++)
 	{
@@ -2278,11 +3653,31 @@ zedstoream_relation_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 							 olddesc,
 							 attno,
 							 &attr_scans[attno - 1]);
+		attr_scans[attno - 1].prefetch = true;
+		attr_scans[attno - 1].strategy = strategy;
 	}
 
 	newdatums = palloc(olddesc->natts * sizeof(Datum));
 	newisnulls = palloc(olddesc->natts * sizeof(bool));
 
+	/*
+	 * The new table is not visible to anyone else yet, so we can bulk load
+	 * it. Like heap, skip WAL-logging it if wal_level is minimal.
+	 */
+	zsbt_tuplebuffer_begin_skip_wal(NewHeap);
+	zsbt_tid_begin_bulk_insert(NewHeap, &tidstate);
+
+	memset(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(zstid);
+	hash_ctl.entrysize = sizeof(ZSRewriteTidMapEntry);
+	hash_ctl.hcxt = CurrentMemoryContext;
+	chains.tid_map = hash_create("zedstore rewrite TID map", 1024, &hash_ctl,
+								 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	hash_ctl.entrysize = sizeof(ZSRewriteUnresolvedEntry);
+	chains.unresolved = hash_create("zedstore rewrite unresolved updates", 1024,
+									&hash_ctl,
+									HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
 	/* TODO: sorting not implemented yet. (it would require materializing each
 	 * row into a HeapTuple or something like that, which could carry the xmin/xmax
 	 * information through the sorter).
@@ -2365,7 +3760,7 @@ zedstoream_relation_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 
 		old_undoptr = tid_scan.array_iter.undoslots[ZSTidScanCurUndoSlotNo(&tid_scan)];
 
-		new_tid = zs_cluster_process_tuple(OldHeap, NewHeap,
+		new_tid = zs_cluster_process_tuple(OldHeap, NewHeap, &tidstate, &chains,
 										   old_tid, old_undoptr,
 										   recent_oldest_undo,
 										   OldestXmin);
@@ -2416,15 +3811,252 @@ zedstoream_relation_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 
 		zsbt_attr_end_scan(&attr_scans[attno - 1]);
 	}
+	FreeAccessStrategy(strategy);
+
+	/*
+	 * The new versions of the remaining updated rows were not copied, so
+	 * they look like they were just deleted.
+	 */
+	zsbt_tid_bulk_flush(&tidstate);
+	hash_seq_init(&seq_status, chains.unresolved);
+	while ((unresolved = hash_seq_search(&seq_status)) != NULL)
+	{
+		TM_Result	delete_result;
+		bool		this_xact_has_lock;
+
+		delete_result = zsbt_tid_delete(NewHeap, unresolved->newtid,
+										unresolved->xmax, unresolved->cmax,
+										NULL, NULL, false, NULL, false,
+										&this_xact_has_lock);
+		if (delete_result != TM_Ok)
+			elog(ERROR, "tuple deletion failed during table rewrite");
+	}
+	hash_destroy(chains.tid_map);
+	hash_destroy(chains.unresolved);
 
+	zsbt_tid_end_bulk_insert(&tidstate);
 	zsbt_tuplebuffer_flush(NewHeap);
+	zsbt_tuplebuffer_end_skip_wal(NewHeap);
+}
+
+/*
+ * ALTER COLUMN TYPE rewrites only the trees of the changed columns. Likewise,
+ * ADD COLUMN with a volatile default builds just the tree of the new column;
+ * it has no old tree, so the pending rewrite's old root is invalid.
+ *
+ * ATRewriteTable() computes the new values from a scan of the table, with the
+ * old trees still in effect, so we can't load the new trees while the scan is
+ * in progress. The new values are spooled into a tuplestore instead, and the
+ * new trees are built from it at the end, one column at a time, in TID order.
+ * They are attached to the metapage as pending rewrites, which take effect
+ * when the transaction commits, see ZSPendingRewrite.
+ */
+typedef struct ZSColumnRewriteState
+{
+	Relation	rel;
+	int			nattrs;
+	AttrNumber *attnums;
+
+	TupleDesc	spooldesc;		/* TID as int8, followed by the new values */
+	Tuplestorestate *spool;
+	Datum	   *spoolvalues;
+	bool	   *spoolisnull;
+	zstid		lasttid;
+} ZSColumnRewriteState;
+
+/* rows encoded at a time, and buffered data to write out full pages from */
+#define ZS_REWRITE_BATCH_SIZE	4096
+#define ZS_REWRITE_FLUSH_SIZE	(16 * BLCKSZ)
+
+static void *
+zedstoream_relation_begin_column_rewrite(Relation rel, int nattrs,
+										 AttrNumber *attnums)
+{
+	ZSColumnRewriteState *state;
+	TupleDesc	spooldesc;
+
+	/* buffered rows must be in the old trees when they're scanned */
+	zsbt_tuplebuffer_flush(rel);
+
+	/* make room, and refuse to rewrite a column twice in one transaction */
+	zsbt_fold_rewrites(rel);
+	if (!zsmeta_can_begin_rewrite(rel, nattrs, attnums))
+		return NULL;
+
+	spooldesc = CreateTemplateTupleDesc(nattrs + 1);
+	TupleDescInitEntry(spooldesc, 1, "tid", INT8OID, -1, 0);
+	for (int i = 0; i < nattrs; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel),
+											   attnums[i] - 1);
+
+		TupleDescInitEntry(spooldesc, i + 2, NameStr(attr->attname),
+						   attr->atttypid, attr->atttypmod, 0);
+	}
+
+	state = palloc(sizeof(ZSColumnRewriteState));
+	state->rel = rel;
+	state->nattrs = nattrs;
+	state->attnums = palloc(nattrs * sizeof(AttrNumber));
+	memcpy(state->attnums, attnums, nattrs * sizeof(AttrNumber));
+	state->spooldesc = spooldesc;
+	state->spool = tuplestore_begin_heap(false, false, work_mem);
+	state->spoolvalues = palloc((nattrs + 1) * sizeof(Datum));
+	state->spoolisnull = palloc((nattrs + 1) * sizeof(bool));
+	state->lasttid = InvalidZSTid;
+
+	return state;
+}
+
+static void
+zedstoream_relation_column_rewrite_tuple(void *state, ItemPointer tid,
+										 Datum *values, bool *isnull)
+{
+	ZSColumnRewriteState *rwstate = (ZSColumnRewriteState *) state;
+	Datum	   *spoolvalues = rwstate->spoolvalues;
+	bool	   *spoolisnull = rwstate->spoolisnull;
+	zstid		this_tid = ZSTidFromItemPointer(*tid);
+
+	if (this_tid <= rwstate->lasttid)
+		elog(ERROR, "column rewrite rows out of TID order");
+	rwstate->lasttid = this_tid;
+
+	spoolvalues[0] = Int64GetDatum((int64) this_tid);
+	spoolisnull[0] = false;
+	for (int i = 0; i < rwstate->nattrs; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(rwstate->spooldesc, i + 1);
+		Datum		datum = values[i];
+
+		/* the spool outlives any TOAST pointers into the old trees */
+		if (!isnull[i] && attr->attlen == -1 && VARATT_IS_EXTERNAL(datum))
+			datum = PointerGetDatum(detoast_external_attr((struct varlena *) DatumGetPointer(datum)));
+
+		spoolvalues[i + 1] = datum;
+		spoolisnull[i + 1] = isnull[i];
+	}
+
+	tuplestore_putvalues(rwstate->spool, rwstate->spooldesc,
+						 spoolvalues, spoolisnull);
+}
+
+static void
+zedstoream_relation_end_column_rewrite(void *state)
+{
+	ZSColumnRewriteState *rwstate = (ZSColumnRewriteState *) state;
+	Relation	rel = rwstate->rel;
+	TupleTableSlot *slot;
+	MemoryContext batchcxt;
+	zstid	   *tids;
+	Datum	   *datums;
+	bool	   *isnulls;
+
+	/* From here on, this transaction sees the new, empty trees */
+	for (int i = 0; i < rwstate->nattrs; i++)
+		zsmeta_begin_rewrite(rel, rwstate->attnums[i]);
+
+	slot = MakeSingleTupleTableSlot(rwstate->spooldesc, &TTSOpsMinimalTuple);
+	batchcxt = AllocSetContextCreate(CurrentMemoryContext,
+									 "zedstore column rewrite",
+									 ALLOCSET_DEFAULT_SIZES);
+	tids = palloc(ZS_REWRITE_BATCH_SIZE * sizeof(zstid));
+	datums = palloc(ZS_REWRITE_BATCH_SIZE * sizeof(Datum));
+	isnulls = palloc(ZS_REWRITE_BATCH_SIZE * sizeof(bool));
+
+	for (int i = 0; i < rwstate->nattrs; i++)
+	{
+		AttrNumber	attno = rwstate->attnums[i];
+		Form_pg_attribute attr = TupleDescAttr(rwstate->spooldesc, i + 1);
+		int			toast_threshold = zedstore_toast_threshold(rel, attno);
+		attstream_buffer chunks;
+		int			n = 0;
+		bool		more;
+
+		init_attstream_buffer(&chunks, attr->attbyval, attr->attlen);
+		tuplestore_rescan(rwstate->spool);
+		do
+		{
+			more = tuplestore_gettupleslot(rwstate->spool, true, false, slot);
+			if (more)
+			{
+				MemoryContext oldcxt;
+				Datum		datum;
+				bool		isnull;
+
+				tids[n] = (zstid) DatumGetInt64(slot_getattr(slot, 1, &isnull));
+				datum = slot_getattr(slot, i + 2, &isnull);
+
+				oldcxt = MemoryContextSwitchTo(batchcxt);
+				if (!isnull && attr->attlen == -1 &&
+					VARSIZE_ANY_EXHDR(datum) > toast_threshold)
+					datum = zedstore_toast_datum(rel, attno, datum, tids[n]);
+				else if (!isnull && !attr->attbyval)
+					datum = zs_datumCopy(datum, attr->attbyval, attr->attlen);
+				MemoryContextSwitchTo(oldcxt);
+
+				datums[n] = datum;
+				isnulls[n] = isnull;
+				n++;
+			}
+
+			if (n == ZS_REWRITE_BATCH_SIZE || (!more && n > 0))
+			{
+				append_attstream(&chunks, true, n, tids, datums, isnulls);
+				n = 0;
+				MemoryContextReset(batchcxt);
+
+				while (chunks.len - chunks.cursor > ZS_REWRITE_FLUSH_SIZE)
+					zsbt_attr_add_bulk(rel, attno, &chunks);
+			}
+
+			CHECK_FOR_INTERRUPTS();
+		} while (more);
+
+		while (chunks.len - chunks.cursor > 0)
+			zsbt_attr_add(rel, attno, &chunks);
+		pfree(chunks.data);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	MemoryContextDelete(batchcxt);
+	pfree(tids);
+	pfree(datums);
+	pfree(isnulls);
+
+	tuplestore_end(rwstate->spool);
+	FreeTupleDesc(rwstate->spooldesc);
+	pfree(rwstate->spoolvalues);
+	pfree(rwstate->spoolisnull);
+	pfree(rwstate->attnums);
+	pfree(rwstate);
+}
+
+/*
+ * ANALYZE samples logical blocks, i.e. ranges of MaxZSTidOffsetNumber - 1
+ * consecutive TIDs, rather than physical pages. The physical size of the
+ * relation has little to do with the TID space, so we report the number of
+ * logical blocks up to the last TID in use. Picking blocks uniformly from
+ * that range gives each TID the same chance of being sampled; TIDs that
+ * have been deleted and vacuumed away just show up as sparser blocks.
+ */
+static BlockNumber
+zedstoream_scan_analyze_nblocks(Relation rel)
+{
+	zstid		lasttid;
+
+	zsbt_tuplebuffer_flush(rel);
+
+	lasttid = zsbt_get_last_tid(rel);
+	if (lasttid <= MinZSTid)
+		return 0;
+
+	return ZSTidGetBlockNumber(lasttid - 1) + 1;
 }
 
 /*
- * FIXME: The ANALYZE API is problematic for us. acquire_sample_rows() calls
- * RelationGetNumberOfBlocks() directly on the relation, and chooses the
- * block numbers to sample based on that. But the logical block numbers
- * have little to do with physical ones in zedstore.
+ * Only the TID tree and the trees of the columns being analyzed are read.
+ * The attribute tree scans stay open across blocks, so a decoded leaf serves
+ * every sampled block that falls within its range.
  */
 static bool
 zedstoream_scan_analyze_next_block(TableScanDesc sscan, BlockNumber blockno,
@@ -2448,14 +4080,21 @@ zedstoream_scan_analyze_next_tuple(TableScanDesc sscan, TransactionId OldestXmin
 	return result;
 }
 
+static void
+zedstoream_relation_analyze_done(Relation rel, double totalrows,
+								 BufferAccessStrategy bstrategy)
+{
+	zsmeta_update_stats(rel, totalrows, bstrategy);
+}
+
 /* ------------------------------------------------------------------------
  * Miscellaneous callbacks for the heap AM
  * ------------------------------------------------------------------------
  */
 
 /*
- * FIXME: Implement this function as best for zedstore. The return value is
- * for example leveraged by analyze to find which blocks to sample.
+ * FIXME: Implement this function as best for zedstore. Note that ANALYZE
+ * doesn't use this, see zedstoream_scan_analyze_nblocks().
  */
 static uint64
 zedstoream_relation_size(Relation rel, ForkNumber forkNumber)
@@ -2468,6 +4107,316 @@ zedstoream_relation_size(Relation rel, ForkNumber forkNumber)
 	return nblocks * BLCKSZ;
 }
 
+/*
+ * Count the rows visible to 'snapshot', for count(*). This only reads the
+ * TID tree, and skips the per-TID work wherever it can, see
+ * zsbt_tid_count_visible().
+ */
+static uint64
+zedstoream_relation_count_rows(Relation rel, Snapshot snapshot)
+{
+	BufferAccessStrategy strategy;
+	uint64		result;
+
+	zsbt_tuplebuffer_flush(rel);
+
+	strategy = zedstoream_bulkread_strategy(rel);
+	PredicateLockRelation(rel, snapshot);
+	pgstat_count_heap_scan(rel);
+
+	result = zsbt_tid_count_visible(rel, snapshot, strategy);
+
+	if (strategy)
+		FreeAccessStrategy(strategy);
+
+	return result;
+}
+
+/*
+ * We can compute min(ctid) and max(ctid) from the TID tree, and all the
+ * aggregates over a column from its attribute tree alone.
+ */
+static bool
+zedstoream_relation_supports_aggregate(Relation rel, AttrNumber attnum,
+									   TableAggKind kind)
+{
+	if (attnum == SelfItemPointerAttributeNumber)
+		return kind == TABLE_AGG_MIN || kind == TABLE_AGG_MAX;
+
+	if (attnum <= 0 || attnum > RelationGetNumberOfAttributes(rel))
+		return false;
+	return !TupleDescAttr(RelationGetDescr(rel), attnum - 1)->attisdropped;
+}
+
+/*
+ * min(ctid) is the first visible TID, and max(ctid) the last one. They map
+ * to the smallest and largest item pointers, because TIDs are allocated in
+ * the same order.
+ */
+static Datum
+zs_aggregate_tid(Relation rel, Snapshot snapshot, BufferAccessStrategy strategy,
+				 TableAggKind kind, bool *isnull)
+{
+	ZSTidTreeScan scan;
+	zstid		tid = InvalidZSTid;
+	ItemPointer result;
+
+	zsbt_tid_begin_scan(rel, MinZSTid, MaxPlusOneZSTid, snapshot, &scan);
+	scan.serializable = true;
+	scan.strategy = strategy;
+
+	if (kind == TABLE_AGG_MIN)
+		tid = zsbt_tid_scan_next(&scan, ForwardScanDirection);
+	else if (zsbt_tid_scan_next_array(&scan, MaxZSTid, BackwardScanDirection))
+		tid = scan.array_iter.tids[scan.array_iter.num_tids - 1];
+
+	zsbt_tid_end_scan(&scan);
+
+	if (tid == InvalidZSTid)
+	{
+		*isnull = true;
+		return (Datum) 0;
+	}
+
+	result = palloc(sizeof(ItemPointerData));
+	*result = ItemPointerFromZSTid(tid);
+	*isnull = false;
+	return PointerGetDatum(result);
+}
+
+/* The value of an attribute that has a synopsis, for comparing with it */
+static int64
+zs_synopsis_value(Form_pg_attribute attr, Datum datum)
+{
+	switch (attr->attlen)
+	{
+		case sizeof(int16):
+			return DatumGetInt16(datum);
+		case sizeof(int32):
+			return DatumGetInt32(datum);
+		default:
+			return DatumGetInt64(datum);
+	}
+}
+
+/*
+ * qsort comparators for the leaf synopses. Leaves without a synopsis sort
+ * first, because we can't skip them.
+ */
+static int
+zs_synopsis_cmp_min(const void *a, const void *b)
+{
+	const ZSAttrLeafSynopsis *sa = (const ZSAttrLeafSynopsis *) a;
+	const ZSAttrLeafSynopsis *sb = (const ZSAttrLeafSynopsis *) b;
+
+	if (sa->valid != sb->valid)
+		return sa->valid ? 1 : -1;
+	if (sa->minval != sb->minval)
+		return (sa->minval < sb->minval) ? -1 : 1;
+	return 0;
+}
+
+static int
+zs_synopsis_cmp_max(const void *a, const void *b)
+{
+	const ZSAttrLeafSynopsis *sa = (const ZSAttrLeafSynopsis *) a;
+	const ZSAttrLeafSynopsis *sb = (const ZSAttrLeafSynopsis *) b;
+
+	if (sa->valid != sb->valid)
+		return sa->valid ? 1 : -1;
+	if (sa->maxval != sb->maxval)
+		return (sa->maxval > sb->maxval) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Compute an aggregate over column 'attno', reading only the TID tree and
+ * the column's attribute tree.
+ *
+ * For min and max of a column whose leaf pages keep a synopsis, we visit the
+ * leaves in the order of their lower (for min) or upper (for max) bound, and
+ * stop as soon as the bound of the next leaf cannot beat the best value so
+ * far. The synopses are not narrowed by deletions, so a leaf's bound might
+ * not belong to a visible row, but it's still a valid bound.
+ */
+static Datum
+zs_aggregate_column(Relation rel, Snapshot snapshot,
+					BufferAccessStrategy strategy, AttrNumber attno,
+					TableAggKind kind, bool *isnull)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	Form_pg_attribute attr = TupleDescAttr(tupdesc, attno - 1);
+	ZSTidTreeScan tid_scan;
+	ZSAttrTreeScan attr_scan;
+	ZSAttrLeafSynopsis *synopses = NULL;
+	int			nsynopses = -1;
+	FmgrInfo   *cmp_finfo = NULL;
+	int64		count = 0;
+	int64		sum = 0;
+	Datum		best = (Datum) 0;
+	bool		found = false;
+
+	if (kind == TABLE_AGG_MIN || kind == TABLE_AGG_MAX)
+	{
+		TypeCacheEntry *typentry;
+
+		typentry = lookup_type_cache(attr->atttypid, TYPECACHE_CMP_PROC_FINFO);
+		if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
+			elog(ERROR, "could not find comparison function for type %u",
+				 attr->atttypid);
+		cmp_finfo = &typentry->cmp_proc_finfo;
+
+		nsynopses = zsbt_attr_leaf_synopses(rel, attno, &synopses);
+		if (nsynopses > 0)
+			qsort(synopses, nsynopses, sizeof(ZSAttrLeafSynopsis),
+				  kind == TABLE_AGG_MIN ? zs_synopsis_cmp_min : zs_synopsis_cmp_max);
+	}
+
+	zsbt_tid_begin_scan(rel, MinZSTid, MaxPlusOneZSTid, snapshot, &tid_scan);
+	tid_scan.serializable = true;
+	tid_scan.strategy = strategy;
+	zsbt_attr_begin_scan(rel, tupdesc, attno, &attr_scan);
+	attr_scan.strategy = strategy;
+
+	for (int i = 0; nsynopses < 0 || i < nsynopses; i++)
+	{
+		zstid		tid;
+
+		if (nsynopses >= 0)
+		{
+			ZSAttrLeafSynopsis *synopsis = &synopses[i];
+
+			if (synopsis->valid)
+			{
+				/* only NULLs on this page? */
+				if (synopsis->minval > synopsis->maxval)
+					continue;
+
+				/* none of the remaining pages can beat the current best */
+				if (found &&
+					(kind == TABLE_AGG_MIN ?
+					 synopsis->minval >= zs_synopsis_value(attr, best) :
+					 synopsis->maxval <= zs_synopsis_value(attr, best)))
+					break;
+			}
+			zsbt_tid_reset_scan(&tid_scan, synopsis->lokey, synopsis->hikey,
+								synopsis->lokey - 1);
+		}
+
+		while ((tid = zsbt_tid_scan_next(&tid_scan, ForwardScanDirection)) != InvalidZSTid)
+		{
+			Datum		datum;
+			bool		datum_isnull;
+
+			CHECK_FOR_INTERRUPTS();
+
+			if (zsbt_attr_fetch(&attr_scan, &datum, &datum_isnull, tid))
+			{
+				if (!datum_isnull && attr->attlen == -1 &&
+					VARATT_IS_EXTERNAL(datum) && VARTAG_EXTERNAL(datum) == VARTAG_ZEDSTORE)
+				{
+					MemoryContext oldcxt;
+
+					oldcxt = MemoryContextSwitchTo(attr_scan.decoder.tmpcxt);
+					datum = zedstore_toast_flatten(rel, attno, tid, datum);
+					attr_scan.decoder.tmpcxt_used += VARSIZE_ANY(DatumGetPointer(datum));
+					MemoryContextSwitchTo(oldcxt);
+				}
+			}
+			else
+				zsbt_fill_missing_attribute_value(tupdesc, attno, &datum, &datum_isnull);
+
+			if (datum_isnull)
+				continue;
+
+			switch (kind)
+			{
+				case TABLE_AGG_COUNT:
+					count++;
+					break;
+				case TABLE_AGG_SUM:
+					count++;
+					if (attr->atttypid == INT2OID)
+						sum += DatumGetInt16(datum);
+					else
+						sum += DatumGetInt32(datum);
+					break;
+				case TABLE_AGG_MIN:
+				case TABLE_AGG_MAX:
+					{
+						int32		cmp;
+
+						if (found)
+						{
+							cmp = DatumGetInt32(FunctionCall2Coll(cmp_finfo, InvalidOid,
+																  datum, best));
+							if (kind == TABLE_AGG_MIN ? cmp >= 0 : cmp <= 0)
+								break;
+							if (!attr->attbyval)
+								pfree(DatumGetPointer(best));
+						}
+						best = datumCopy(datum, attr->attbyval, attr->attlen);
+						found = true;
+					}
+					break;
+				default:
+					elog(ERROR, "unexpected aggregate kind %d", (int) kind);
+			}
+		}
+
+		if (nsynopses < 0)
+			break;
+	}
+
+	zsbt_attr_end_scan(&attr_scan);
+	zsbt_tid_end_scan(&tid_scan);
+	if (synopses)
+		pfree(synopses);
+
+	switch (kind)
+	{
+		case TABLE_AGG_COUNT:
+			*isnull = false;
+			return Int64GetDatum(count);
+		case TABLE_AGG_SUM:
+			*isnull = (count == 0);
+			return Int64GetDatum(sum);
+		default:
+			*isnull = !found;
+			return best;
+	}
+}
+
+/*
+ * Compute a single-column aggregate for the planner, see
+ * preprocess_table_aggregates().
+ */
+static Datum
+zedstoream_relation_aggregate(Relation rel, Snapshot snapshot,
+							  AttrNumber attnum, TableAggKind kind,
+							  bool *isnull)
+{
+	BufferAccessStrategy strategy;
+	Datum		result;
+
+	zsbt_tuplebuffer_flush(rel);
+
+	strategy = zedstoream_bulkread_strategy(rel);
+	PredicateLockRelation(rel, snapshot);
+	pgstat_count_heap_scan(rel);
+
+	if (attnum == SelfItemPointerAttributeNumber)
+		result = zs_aggregate_tid(rel, snapshot, strategy, kind, isnull);
+	else
+		result = zs_aggregate_column(rel, snapshot, strategy, attnum, kind,
+									 isnull);
+
+	if (strategy)
+		FreeAccessStrategy(strategy);
+
+	return result;
+}
+
 /*
  * Zedstore stores TOAST chunks within the table file itself. Hence, doesn't
  * need separate toast table to be created. Return false for this callback
@@ -2485,8 +4434,12 @@ zedstoream_relation_needs_toast_table(Relation rel)
  */
 
 /*
- * currently this is exact duplicate of heapam_estimate_rel_size().
- * TODO fix to tune it based on zedstore storage.
+ * This follows heapam_estimate_rel_size(), except for how the number of
+ * tuples is estimated. The relation is shared by all the attribute trees and
+ * the UNDO log, so its size doesn't grow in proportion to the number of rows.
+ * The TID tree does, so if VACUUM or ANALYZE has gathered size statistics
+ * (see zsmeta_update_stats()), scale the row count by how much the TID tree
+ * has grown since then.
  */
 static void
 zedstoream_relation_estimate_size(Relation rel, int32 *attr_widths,
@@ -2498,6 +4451,7 @@ zedstoream_relation_estimate_size(Relation rel, int32 *attr_widths,
 	double		reltuples;
 	BlockNumber relallvisible;
 	double		density;
+	const ZSRelStats *stats;
 
 	/* it has storage, ok to call the smgr */
 	curpages = RelationGetNumberOfBlocks(rel);
@@ -2548,9 +4502,21 @@ zedstoream_relation_estimate_size(Relation rel, int32 *attr_widths,
 		return;
 	}
 
-	/* estimate number of tuples from previous tuple density */
-	if (relpages > 0)
+	/* estimate number of tuples from the TID tree, if we have statistics */
+	stats = zsmeta_get_cached_stats(rel);
+	if (stats && stats->trees[ZS_META_ATTRIBUTE_NUM].zs_total_pages > 0)
+	{
+		BlockNumber tidpages = zsbt_estimate_tree_pages(rel, ZS_META_ATTRIBUTE_NUM);
+
+		density = stats->reltuples / stats->trees[ZS_META_ATTRIBUTE_NUM].zs_total_pages;
+		*tuples = rint(density * (double) Max(tidpages, 1));
+	}
+	/* otherwise from previous tuple density */
+	else if (relpages > 0)
+	{
 		density = reltuples / (double) relpages;
+		*tuples = rint(density * (double) curpages);
+	}
 	else
 	{
 		/*
@@ -2568,26 +4534,133 @@ zedstoream_relation_estimate_size(Relation rel, int32 *attr_widths,
 		 */
 		int32		tuple_width;
 
-		tuple_width = get_rel_data_width(rel, attr_widths);
-		tuple_width += MAXALIGN(SizeofHeapTupleHeader);
-		tuple_width += sizeof(ItemIdData);
-		/* note: integer division is intentional here */
-		density = (BLCKSZ - SizeOfPageHeaderData) / tuple_width;
+		/*
+		 * There are no per-tuple headers or line pointers in zedstore. The
+		 * TID tree takes a few bytes per row, and the attribute data is
+		 * packed into attribute streams.
+		 */
+		tuple_width = get_rel_data_width(rel, attr_widths);
+		tuple_width += sizeof(zstid);
+		/* note: integer division is intentional here */
+		density = (BLCKSZ - SizeOfPageHeaderData) / tuple_width;
+		*tuples = rint(density * (double) curpages);
+	}
+
+	/*
+	 * We use relallvisible as-is, rather than scaling it up like we do for
+	 * the pages and tuples counts, on the theory that any pages added since
+	 * the last VACUUM are most likely not marked all-visible.  But costsize.c
+	 * wants it converted to a fraction.
+	 */
+	if (relallvisible == 0 || curpages <= 0)
+		*allvisfrac = 0;
+	else if ((double) relallvisible >= curpages)
+		*allvisfrac = 1;
+	else
+		*allvisfrac = (double) relallvisible / curpages;
+}
+
+/*
+ * A sequential scan reads the TID tree, and the trees of the attributes it
+ * needs. Look up or estimate the size of those trees, and scale the
+ * estimated relation size by their share of the physical relation size. The rest of the
+ * relation is other attribute trees, UNDO and TOAST pages, and free pages.
+ * (TOAST pages of the needed attributes are read too, but we have no cheap
+ * way to count them.)
+ *
+ * The attribute streams need to be decompressed and decoded, which costs
+ * CPU time in proportion to their decompressed size. When we have
+ * statistics, charge cpu_operator_cost for every ZS_DECODE_BYTES_PER_OPERATOR
+ * bytes of the needed attributes, per row.
+ */
+#define ZS_DECODE_BYTES_PER_OPERATOR	64
+
+static BlockNumber
+zedstoream_relation_estimate_scan_pages(Relation rel, Bitmapset *attrs,
+										BlockNumber pages, double *decode_cost)
+{
+	const ZSRelStats *stats;
+	BlockNumber curpages;
+	BlockNumber scanpages;
+	int			maxattno;
+	int			x;
+
+	/* a whole-row reference needs all the attributes */
+	if (bms_is_member(InvalidAttrNumber - FirstLowInvalidHeapAttributeNumber, attrs))
+		return pages;
+
+	curpages = RelationGetNumberOfBlocks(rel);
+	if (curpages == 0)
+		return pages;
+
+	/*
+	 * Use the statistics gathered by VACUUM or ANALYZE, if they cover all
+	 * the attributes. Otherwise, estimate the sizes of the trees now.
+	 */
+	maxattno = bms_is_empty(attrs) ? 0 :
+		bms_prev_member(attrs, -1) + FirstLowInvalidHeapAttributeNumber;
+	stats = zsmeta_get_cached_stats(rel);
+	if (stats && stats->relpages > 0 && maxattno < stats->nattributes)
+	{
+		curpages = stats->relpages;
+		scanpages = stats->trees[ZS_META_ATTRIBUTE_NUM].zs_total_pages;
+	}
+	else
+	{
+		stats = NULL;
+		scanpages = zsbt_estimate_tree_pages(rel, ZS_META_ATTRIBUTE_NUM);
+	}
+
+	x = -1;
+	while ((x = bms_next_member(attrs, x)) >= 0)
+	{
+		AttrNumber	attno = x + FirstLowInvalidHeapAttributeNumber;
+
+		/* system columns are stored in the TID tree */
+		if (attno <= 0)
+			continue;
+		if (stats)
+		{
+			scanpages += stats->trees[attno].zs_total_pages;
+			if (stats->reltuples > 0)
+				*decode_cost += cpu_operator_cost *
+					(stats->trees[attno].zs_leaf_raw_bytes / stats->reltuples) /
+					ZS_DECODE_BYTES_PER_OPERATOR;
+		}
+		else
+			scanpages += zsbt_estimate_tree_pages(rel, attno);
+	}
+
+	if (scanpages >= curpages)
+		return pages;
+
+	return Max((BlockNumber) ceil((double) pages * scanpages / curpages), 1);
+}
+
+/*
+ * A sequential scan returns the rows in TID order, so it returns them in the
+ * order of an ordered column, see zsbt_attr_is_ordered(). Report the first
+ * such column.
+ */
+static AttrNumber
+zedstoream_relation_scan_order(Relation rel)
+{
+	for (AttrNumber attno = 1; attno <= RelationGetNumberOfAttributes(rel); attno++)
+	{
+		if (zsbt_attr_is_ordered(rel, attno))
+			return attno;
 	}
-	*tuples = rint(density * (double) curpages);
+	return InvalidAttrNumber;
+}
 
-	/*
-	 * We use relallvisible as-is, rather than scaling it up like we do for
-	 * the pages and tuples counts, on the theory that any pages added since
-	 * the last VACUUM are most likely not marked all-visible.  But costsize.c
-	 * wants it converted to a fraction.
-	 */
-	if (relallvisible == 0 || curpages <= 0)
-		*allvisfrac = 0;
-	else if ((double) relallvisible >= curpages)
-		*allvisfrac = 1;
-	else
-		*allvisfrac = (double) relallvisible / curpages;
+/*
+ * Check the rows already in the table, when a column is declared ordered.
+ */
+static void
+zedstoream_relation_validate_scan_order(Relation rel, AttrNumber attnum)
+{
+	if (zsbt_attr_is_ordered(rel, attnum))
+		zsbt_attr_validate_order(rel, attnum);
 }
 
 /* ------------------------------------------------------------------------
@@ -2600,6 +4673,32 @@ zedstoream_relation_estimate_size(Relation rel, int32 *attr_widths,
  * bitmap scans, and sample scans. The tableam interface for those are similar
  * enough that they can share most code.
  */
+static void
+zs_blkscan_start(ZedStoreDesc scan)
+{
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	Relation	rel = scan->rs_scan.rs_rd;
+	TupleDesc	reldesc = RelationGetDescr(rel);
+	MemoryContext oldcontext;
+
+	zs_initialize_proj_attributes_extended(scan, reldesc);
+
+	oldcontext = MemoryContextSwitchTo(scan_proj->context);
+	zsbt_tid_begin_scan(rel, MinZSTid, MinZSTid,
+						scan->rs_scan.rs_snapshot,
+						&scan_proj->tid_scan);
+	scan_proj->tid_scan.serializable = true;
+	for (int i = 1; i < scan_proj->num_proj_atts; i++)
+	{
+		int			attno = scan_proj->proj_atts[i];
+
+		zsbt_attr_begin_scan(rel,  reldesc, attno,
+							 &scan_proj->attr_scans[i - 1]);
+	}
+	MemoryContextSwitchTo(oldcontext);
+	scan->started = true;
+}
+
 static bool
 zs_blkscan_next_block(TableScanDesc sscan,
 					  BlockNumber blkno, OffsetNumber *offsets, int noffsets,
@@ -2612,37 +4711,12 @@ zs_blkscan_next_block(TableScanDesc sscan,
 	int			idx;
 
 	if (!scan->started)
-	{
-		Relation	rel = scan->rs_scan.rs_rd;
-		TupleDesc	reldesc = RelationGetDescr(rel);
-		MemoryContext oldcontext;
-
-		zs_initialize_proj_attributes_extended(scan, reldesc);
-
-		oldcontext = MemoryContextSwitchTo(scan_proj->context);
-		zsbt_tid_begin_scan(rel,
-							ZSTidFromBlkOff(blkno, 1),
-							ZSTidFromBlkOff(blkno + 1, 1),
-							scan->rs_scan.rs_snapshot,
-							&scan_proj->tid_scan);
-		scan_proj->tid_scan.serializable = true;
-		for (int i = 1; i < scan_proj->num_proj_atts; i++)
-		{
-			int			attno = scan_proj->proj_atts[i];
+		zs_blkscan_start(scan);
 
-			zsbt_attr_begin_scan(rel,  reldesc, attno,
-								 &scan_proj->attr_scans[i - 1]);
-		}
-		MemoryContextSwitchTo(oldcontext);
-		scan->started = true;
-	}
-	else
-	{
-		zsbt_tid_reset_scan(&scan_proj->tid_scan,
-							ZSTidFromBlkOff(blkno, 1),
-							ZSTidFromBlkOff(blkno + 1, 1),
-							ZSTidFromBlkOff(blkno, 1) - 1);
-	}
+	zsbt_tid_reset_scan(&scan_proj->tid_scan,
+						ZSTidFromBlkOff(blkno, 1),
+						ZSTidFromBlkOff(blkno + 1, 1),
+						ZSTidFromBlkOff(blkno, 1) - 1);
 
 	/*
 	 * Our strategy for a bitmap scan is to scan the TID tree in
@@ -2650,55 +4724,68 @@ zs_blkscan_next_block(TableScanDesc sscan,
 	 * store all the matching TIDs in in the scan struct. next_tuple() will
 	 * fetch the attribute data from the attribute trees.
 	 *
-	 * TODO: it might be good to pass the next expected TID down to
-	 * zsbt_tid_scan_next, so that it could skip over to the next match more
-	 * efficiently.
+	 * If we were given a list of offsets, we seek directly to each of them,
+	 * so that TID array items that contain none of them are not decoded.
 	 */
 	ntuples = 0;
 	idx = 0;
-	while ((tid = zsbt_tid_scan_next(&scan_proj->tid_scan, ForwardScanDirection)) != InvalidZSTid)
+	while (noffsets == -1 || idx < noffsets)
 	{
-		OffsetNumber off = ZSTidGetOffsetNumber(tid);
-		ItemPointerData itemptr;
+		OffsetNumber off;
 
-		Assert(ZSTidGetBlockNumber(tid) == blkno);
+		if (noffsets != -1)
+			zsbt_tid_scan_skip_to(&scan_proj->tid_scan,
+								  ZSTidFromBlkOff(blkno, offsets[idx]));
+
+		tid = zsbt_tid_scan_next(&scan_proj->tid_scan, ForwardScanDirection);
+		if (tid == InvalidZSTid)
+			break;
 
-		ItemPointerSet(&itemptr, blkno, off);
+		Assert(ZSTidGetBlockNumber(tid) == blkno);
+		off = ZSTidGetOffsetNumber(tid);
 
 		if (noffsets != -1)
 		{
-			while (off > offsets[idx] && idx < noffsets)
-			{
-				/*
-				 * Acquire predicate lock on all tuples that we scan, even those that are
-				 * not visible to the snapshot.
-				 */
-				if (predicatelocks)
-					PredicateLockTID(scan->rs_scan.rs_rd, &itemptr, scan->rs_scan.rs_snapshot);
-
+			/* the requested TIDs before this one are not visible to us */
+			while (idx < noffsets && offsets[idx] < off)
 				idx++;
-			}
-
 			if (idx == noffsets)
 				break;
-
-			if (off < offsets[idx])
+			if (offsets[idx] != off)
 				continue;
+			idx++;
 		}
 
-		/* FIXME: heapam acquires the predicate lock first, and then
-		 * calls CheckForSerializableConflictOut(). We do it in the
-		 * opposite order, because CheckForSerializableConflictOut()
-		 * call as done in zsbt_get_last_tid() already. Does it matter?
-		 * I'm not sure.
-		 */
-		if (predicatelocks)
-			PredicateLockTID(scan->rs_scan.rs_rd, &itemptr, scan->rs_scan.rs_snapshot);
-
 		scan->bmscan_tids[ntuples] = tid;
 		ntuples++;
 	}
 
+	/* FIXME: heapam acquires the predicate lock first, and then
+	 * calls CheckForSerializableConflictOut(). We do it in the
+	 * opposite order, because CheckForSerializableConflictOut()
+	 * call as done in zsbt_get_last_tid() already. Does it matter?
+	 * I'm not sure.
+	 *
+	 * If we return more rows from the block than there can be tuple locks
+	 * on a page, the tuple locks would be promoted to a lock on the
+	 * (logical) block anyway. Lock the block directly then, instead of
+	 * acquiring the tuple locks one by one, only to promote them.
+	 */
+	if (predicatelocks && ntuples > 0)
+	{
+		if (ntuples > max_predicate_locks_per_page)
+			PredicateLockPage(scan->rs_scan.rs_rd, blkno, scan->rs_scan.rs_snapshot);
+		else
+		{
+			for (int i = 0; i < ntuples; i++)
+			{
+				ItemPointerData itemptr = ItemPointerFromZSTid(scan->bmscan_tids[i]);
+
+				PredicateLockTID(scan->rs_scan.rs_rd, &itemptr, scan->rs_scan.rs_snapshot);
+			}
+		}
+	}
+
 	scan->bmscan_nexttuple = 0;
 	scan->bmscan_ntuples = ntuples;
 
@@ -2719,6 +4806,10 @@ zs_blkscan_next_tuple(TableScanDesc sscan, TupleTableSlot *slot)
 	 */
 	Assert((scan->proj_data.num_proj_atts - 1) <= slot->tts_tupleDescriptor->natts);
 	tid = scan->bmscan_tids[scan->bmscan_nexttuple];
+
+	/* Return NULLs for the columns that are not projected */
+	zedstoream_fetch_clear_slot(&scan->proj_data, slot);
+
 	for (int i = 1; i < scan->proj_data.num_proj_atts; i++)
 	{
 		ZSAttrTreeScan *attr_scan = &scan->proj_data.attr_scans[i - 1];
@@ -2746,6 +4837,8 @@ zs_blkscan_next_tuple(TableScanDesc sscan, TupleTableSlot *slot)
 	}
 
 	/* FIXME: Don't we need to set visi_info, like in a seqscan? */
+	zs_slot_set_projection(slot, scan->proj_data.num_proj_atts - 1,
+						   &scan->proj_data.proj_atts[1]);
 	slot->tts_tableOid = RelationGetRelid(scan->rs_scan.rs_rd);
 	slot->tts_tid = ItemPointerFromZSTid(tid);
 	slot->tts_nvalid = slot->tts_tupleDescriptor->natts;
@@ -2767,6 +4860,40 @@ zedstoream_scan_bitmap_next_block(TableScanDesc sscan,
 	return zs_blkscan_next_block(sscan, tbmres->blockno, tbmres->offsets, tbmres->ntuples, true);
 }
 
+/*
+ * Prefetch the leaf pages that zs_blkscan_next_block() and
+ * zs_blkscan_next_tuple() will need for the given logical block: the TID
+ * tree leaf, and the leaf of each projected attribute tree. A logical block
+ * doesn't correspond to any physical block, so the caller cannot do this
+ * for us.
+ *
+ * One leaf usually covers many logical blocks, so we remember the key range
+ * of the leaf we last prefetched for each tree, and skip the descent while
+ * the blocks fall within it.
+ */
+static void
+zedstoream_scan_bitmap_prefetch_block(TableScanDesc sscan, BlockNumber blockno)
+{
+	ZedStoreDesc scan = (ZedStoreDesc) sscan;
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	zstid		tid = ZSTidFromBlkOff(blockno, 1);
+
+	if (!scan->started)
+		return;
+
+	for (int i = 0; i < scan_proj->num_proj_atts; i++)
+	{
+		ZSTidRange *range = &scan->bmscan_prefetch_ranges[i];
+
+		if (tid >= range->start && tid < range->end)
+			continue;
+
+		zsbt_prefetch_leaf(scan->rs_scan.rs_rd,
+						   scan_proj->proj_atts[i],
+						   tid, range);
+	}
+}
+
 static bool
 zedstoream_scan_bitmap_next_tuple(TableScanDesc sscan,
 								  TBMIterateResult *tbmres,
@@ -2775,60 +4902,65 @@ zedstoream_scan_bitmap_next_tuple(TableScanDesc sscan,
 	return zs_blkscan_next_tuple(sscan, slot);
 }
 
-static bool
-zedstoream_scan_sample_next_block(TableScanDesc sscan, SampleScanState *scanstate)
+/*
+ * Set up the sampling units for a TABLESAMPLE method that samples whole
+ * blocks, like SYSTEM.
+ *
+ * Logical blocks of TIDs don't correspond to any physical pages, and one
+ * leaf page holds the values of many logical blocks, so sampling logical
+ * blocks would read most leaf pages of every column. Instead, we sample the
+ * key ranges of the leaves of one of the projected trees, so that sampling
+ * a fraction of the units reads about that fraction of the pages of that
+ * tree. We pick the smallest tree: each of its leaves covers at least a
+ * leaf of the other trees, so they read about the same fraction of their
+ * pages, plus the partial leaves at the ends of each range.
+ */
+static void
+zs_sample_setup_units(ZedStoreDesc scan)
 {
-	ZedStoreDesc scan = (ZedStoreDesc) sscan;
-	TsmRoutine *tsm = scanstate->tsmroutine;
-	BlockNumber blockno;
-
-	if (scan->next_tid_to_scan == InvalidZSTid)
-	{
-		/* initialize next tid with the first tid */
-		scan->next_tid_to_scan = zsbt_get_first_tid(scan->rs_scan.rs_rd);
-	}
-
-	if (scan->max_tid_to_scan == InvalidZSTid)
-	{
-		/*
-		 * get the max tid once and store it, used to calculate max blocks to
-		 * scan either for SYSTEM or BERNOULLI sampling.
-		 */
-		scan->max_tid_to_scan = zsbt_get_last_tid(scan->rs_scan.rs_rd);
-	}
+	Relation	rel = scan->rs_scan.rs_rd;
+	ZedStoreProjectData *scan_proj = &scan->proj_data;
+	AttrNumber	unit_attno = ZS_META_ATTRIBUTE_NUM;
+	BlockNumber unit_pages = InvalidBlockNumber;
+	MemoryContext oldcontext;
+	int			nunits;
 
-	if (tsm->NextSampleBlock)
+	for (int i = 1; i < scan_proj->num_proj_atts; i++)
 	{
-		/* Adding one below to convert block number to number of blocks. */
-		blockno = tsm->NextSampleBlock(scanstate,
-									   ZSTidGetBlockNumber(scan->max_tid_to_scan) + 1);
+		AttrNumber	attno = scan_proj->proj_atts[i];
+		BlockNumber pages = zsbt_estimate_tree_pages(rel, attno);
 
-		if (!BlockNumberIsValid(blockno))
-			return false;
+		if (pages > 0 && pages < unit_pages)
+		{
+			unit_attno = attno;
+			unit_pages = pages;
+		}
 	}
-	else
-	{
-		/* scanning table sequentially */
-		if (scan->next_tid_to_scan > scan->max_tid_to_scan)
-			return false;
 
-		blockno = ZSTidGetBlockNumber(scan->next_tid_to_scan);
-		/* move on to next block of tids for next iteration of scan */
-		scan->next_tid_to_scan = ZSTidFromBlkOff(blockno + 1, 1);
-	}
+	oldcontext = MemoryContextSwitchTo(scan_proj->context);
+	nunits = zsbt_leaf_ranges(rel, unit_attno, &scan->sample_units);
+	MemoryContextSwitchTo(oldcontext);
 
-	Assert(BlockNumberIsValid(blockno));
+	/* there's nothing to sample past the last TID */
+	while (nunits > 0 && scan->sample_units[nunits - 1].start >= scan->max_tid_to_scan)
+		nunits--;
+	if (nunits > 0)
+		scan->sample_units[nunits - 1].end = Min(scan->sample_units[nunits - 1].end,
+												 scan->max_tid_to_scan);
+	scan->num_sample_units = nunits;
+}
 
-	/*
-	 * Fetch all TIDs on the page.
-	 */
-	if (!zs_blkscan_next_block(sscan, blockno, NULL, -1, false))
-		return false;
+/*
+ * Keep only the TIDs of the current logical block that the sampling method
+ * chooses. 'sampleblock' is the block number that we report to the sampling
+ * method.
+ */
+static bool
+zs_sample_filter_block(ZedStoreDesc scan, SampleScanState *scanstate,
+					   BlockNumber sampleblock)
+{
+	TsmRoutine *tsm = scanstate->tsmroutine;
 
-	/*
-	 * Filter the list of TIDs, keeping only the TIDs that the sampling methods
-	 * tells us to keep.
-	 */
 	if (scan->bmscan_ntuples > 0)
 	{
 		zstid		lasttid_for_block = scan->bmscan_tids[scan->bmscan_ntuples - 1];
@@ -2838,7 +4970,7 @@ zedstoream_scan_sample_next_block(TableScanDesc sscan, SampleScanState *scanstat
 		int			idx;
 
 		/* ask the tablesample method which tuples to check on this page. */
-		nextoffset = tsm->NextSampleTuple(scanstate, blockno, maxoffset);
+		nextoffset = tsm->NextSampleTuple(scanstate, sampleblock, maxoffset);
 
 		outtuples = 0;
 		idx = 0;
@@ -2848,7 +4980,7 @@ zedstoream_scan_sample_next_block(TableScanDesc sscan, SampleScanState *scanstat
 			OffsetNumber thisoffset = ZSTidGetOffsetNumber(thistid);
 
 			if (thisoffset > nextoffset)
-				nextoffset = tsm->NextSampleTuple(scanstate, blockno, maxoffset);
+				nextoffset = tsm->NextSampleTuple(scanstate, sampleblock, maxoffset);
 			else
 			{
 				if (thisoffset == nextoffset)
@@ -2867,12 +4999,122 @@ zedstoream_scan_sample_next_block(TableScanDesc sscan, SampleScanState *scanstat
 		 * NextSampleBlock(). Perhaps we should fix this in the TSM API?
 		 */
 		while (OffsetNumberIsValid(nextoffset))
-			nextoffset = tsm->NextSampleTuple(scanstate, blockno, maxoffset);
+			nextoffset = tsm->NextSampleTuple(scanstate, sampleblock, maxoffset);
 	}
 
 	return scan->bmscan_ntuples > 0;
 }
 
+/*
+ * Return the next logical block with sampled rows.
+ *
+ * Methods that sample whole blocks choose among the leaf ranges set up by
+ * zs_sample_setup_units(), and we return the logical blocks in each chosen
+ * range, with the range's number as the block number that the method sees.
+ * Other methods, like BERNOULLI, see all the logical blocks. Either way, we
+ * skip over TIDs that don't exist, rather than visiting every logical block.
+ */
+static bool
+zedstoream_scan_sample_next_block(TableScanDesc sscan, SampleScanState *scanstate)
+{
+	ZedStoreDesc scan = (ZedStoreDesc) sscan;
+	ZSTidTreeScan *tid_scan = &scan->proj_data.tid_scan;
+	TsmRoutine *tsm = scanstate->tsmroutine;
+
+	if (scan->max_tid_to_scan == InvalidZSTid)
+	{
+		/*
+		 * get the max tid once and store it, used to calculate max blocks to
+		 * scan either for SYSTEM or BERNOULLI sampling.
+		 */
+		scan->max_tid_to_scan = zsbt_get_last_tid(scan->rs_scan.rs_rd);
+	}
+
+	if (!scan->started)
+		zs_blkscan_start(scan);
+
+	for (;;)
+	{
+		zstid		starttid;
+		zstid		endtid;
+		zstid		tid;
+		BlockNumber blockno;
+		BlockNumber sampleblock;
+		int			first;
+		int			ntuples;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (tsm->NextSampleBlock)
+		{
+			/* Move to the next sampled range, if we're done with the previous one */
+			if (scan->next_tid_to_scan == InvalidZSTid)
+			{
+				if (scan->sample_units == NULL)
+					zs_sample_setup_units(scan);
+
+				scan->cur_sample_unit = tsm->NextSampleBlock(scanstate,
+															 scan->num_sample_units);
+				if (!BlockNumberIsValid(scan->cur_sample_unit))
+					return false;
+				scan->next_tid_to_scan = scan->sample_units[scan->cur_sample_unit].start;
+			}
+			endtid = scan->sample_units[scan->cur_sample_unit].end;
+		}
+		else
+		{
+			if (scan->next_tid_to_scan == InvalidZSTid)
+				scan->next_tid_to_scan = MinZSTid;
+			endtid = scan->max_tid_to_scan;
+		}
+		starttid = scan->next_tid_to_scan;
+
+		/* Find the logical block of the next existing TID */
+		zsbt_tid_reset_scan(tid_scan, starttid, endtid, starttid - 1);
+		tid = zsbt_tid_scan_next(tid_scan, ForwardScanDirection);
+		if (tid == InvalidZSTid)
+		{
+			if (!tsm->NextSampleBlock)
+				return false;
+			scan->next_tid_to_scan = InvalidZSTid;
+			continue;
+		}
+		blockno = ZSTidGetBlockNumber(tid);
+		scan->next_tid_to_scan = ZSTidFromBlkOff(blockno + 1, 1);
+		if (tsm->NextSampleBlock)
+		{
+			sampleblock = scan->cur_sample_unit;
+			if (scan->next_tid_to_scan >= endtid)
+				scan->next_tid_to_scan = InvalidZSTid;
+		}
+		else
+			sampleblock = blockno;
+
+		/*
+		 * Fetch all TIDs in the block, and keep the ones within the range,
+		 * which doesn't need to start or end at a block boundary.
+		 */
+		zs_blkscan_next_block(sscan, blockno, NULL, -1, false);
+		first = 0;
+		while (first < scan->bmscan_ntuples && scan->bmscan_tids[first] < starttid)
+			first++;
+		ntuples = first;
+		while (ntuples < scan->bmscan_ntuples && scan->bmscan_tids[ntuples] < endtid)
+			ntuples++;
+		if (first > 0)
+			memmove(scan->bmscan_tids, &scan->bmscan_tids[first],
+					(ntuples - first) * sizeof(zstid));
+		scan->bmscan_ntuples = ntuples - first;
+
+		/*
+		 * Filter the list of TIDs, keeping only the TIDs that the sampling methods
+		 * tells us to keep.
+		 */
+		if (zs_sample_filter_block(scan, scanstate, sampleblock))
+			return true;
+	}
+}
+
 static bool
 zedstoream_scan_sample_next_tuple(TableScanDesc sscan, SampleScanState *scanstate,
 								  TupleTableSlot *slot)
@@ -2896,6 +5138,7 @@ zedstoream_vacuum_rel(Relation onerel, VacuumParams *params,
 static const TableAmRoutine zedstoream_methods = {
 	.type = T_TableAmRoutine,
 	.scans_leverage_column_projection = true,
+	.scans_support_scan_keys = true,
 
 	.slot_callbacks = zedstoream_slot_callbacks,
 
@@ -2904,6 +5147,10 @@ static const TableAmRoutine zedstoream_methods = {
 	.scan_end = zedstoream_endscan,
 	.scan_rescan = zedstoream_rescan,
 	.scan_getnextslot = zedstoream_getnextslot,
+	.scan_getnextbatch = zedstoream_getnextbatch,
+	.scan_set_deferred_columns = zedstoream_scan_set_deferred_columns,
+	.scan_fetch_deferred_columns = zedstoream_scan_fetch_deferred_columns,
+	.scan_explain = zedstoream_scan_explain,
 
 	.parallelscan_estimate = zs_parallelscan_estimate,
 	.parallelscan_initialize = zs_parallelscan_initialize,
@@ -2914,6 +5161,8 @@ static const TableAmRoutine zedstoream_methods = {
 	.index_fetch_end = zedstoream_end_index_fetch,
 	.index_fetch_set_column_projection = zedstoream_fetch_set_column_projection,
 	.index_fetch_tuple = zedstoream_index_fetch_tuple,
+	.index_fetch_tuples = zedstoream_index_fetch_tuples,
+	.index_fetch_all_visible = zedstoream_index_fetch_all_visible,
 
 	.tuple_insert = zedstoream_insert,
 	.tuple_insert_speculative = zedstoream_insert_speculative,
@@ -2934,19 +5183,31 @@ static const TableAmRoutine zedstoream_methods = {
 	.relation_nontransactional_truncate = zedstoream_relation_nontransactional_truncate,
 	.relation_copy_data = zedstoream_relation_copy_data,
 	.relation_copy_for_cluster = zedstoream_relation_copy_for_cluster,
+	.relation_begin_column_rewrite = zedstoream_relation_begin_column_rewrite,
+	.relation_column_rewrite_tuple = zedstoream_relation_column_rewrite_tuple,
+	.relation_end_column_rewrite = zedstoream_relation_end_column_rewrite,
 	.relation_vacuum = zedstoream_vacuum_rel,
 	.scan_analyze_next_block = zedstoream_scan_analyze_next_block,
 	.scan_analyze_next_tuple = zedstoream_scan_analyze_next_tuple,
+	.scan_analyze_nblocks = zedstoream_scan_analyze_nblocks,
+	.relation_analyze_done = zedstoream_relation_analyze_done,
 
 	.index_build_range_scan = zedstoream_index_build_range_scan,
 	.index_validate_scan = zedstoream_index_validate_scan,
 
 	.relation_size = zedstoream_relation_size,
 	.relation_needs_toast_table = zedstoream_relation_needs_toast_table,
+	.relation_count_rows = zedstoream_relation_count_rows,
+	.relation_supports_aggregate = zedstoream_relation_supports_aggregate,
+	.relation_aggregate = zedstoream_relation_aggregate,
 	.relation_estimate_size = zedstoream_relation_estimate_size,
+	.relation_estimate_scan_pages = zedstoream_relation_estimate_scan_pages,
+	.relation_scan_order = zedstoream_relation_scan_order,
+	.relation_validate_scan_order = zedstoream_relation_validate_scan_order,
 
 	.scan_bitmap_next_block = zedstoream_scan_bitmap_next_block,
 	.scan_bitmap_next_tuple = zedstoream_scan_bitmap_next_tuple,
+	.scan_bitmap_prefetch_block = zedstoream_scan_bitmap_prefetch_block,
 	.scan_sample_next_block = zedstoream_scan_sample_next_block,
 	.scan_sample_next_tuple = zedstoream_scan_sample_next_tuple
 };
@@ -2957,22 +5218,214 @@ zedstore_tableam_handler(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(&zedstoream_methods);
 }
 
+/*
+ * zedstore_recompress_column(relid regclass, colname name) returns int8
+ *
+ * Re-encode the data of a column with the compression options currently
+ * set for it. The leaf pages are rewritten one at a time, like VACUUM does,
+ * so the table remains fully usable while this runs. Returns the number of
+ * leaf pages that were rewritten.
+ */
+Datum
+zedstore_recompress_column(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	Name		colname = PG_GETARG_NAME(1);
+	Relation	rel;
+	AttrNumber	attno;
+	BufferAccessStrategy bstrategy;
+	BlockNumber nrewritten;
+
+	/* Conflict with VACUUM and DDL, but not with queries or DML */
+	rel = table_open(relid, ShareUpdateExclusiveLock);
+
+	if (rel->rd_tableam != &zedstoream_methods)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a zedstore table",
+						RelationGetRelationName(rel))));
+
+	if (!pg_class_ownercheck(relid, GetUserId()))
+		aclcheck_error(ACLCHECK_NOT_OWNER,
+					   get_relkind_objtype(rel->rd_rel->relkind),
+					   RelationGetRelationName(rel));
+
+	attno = get_attnum(relid, NameStr(*colname));
+	if (attno == InvalidAttrNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						NameStr(*colname), RelationGetRelationName(rel))));
+	if (attno < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot recompress system column \"%s\"",
+						NameStr(*colname))));
+
+	bstrategy = GetAccessStrategy(BAS_VACUUM);
+	nrewritten = zsbt_attr_recompress(rel, attno, bstrategy);
+	FreeAccessStrategy(bstrategy);
+
+	table_close(rel, ShareUpdateExclusiveLock);
+
+	PG_RETURN_INT64((int64) nrewritten);
+}
+
+/*
+ * zedstore_compact(relid regclass) returns int8
+ *
+ * Move the B-tree pages at the end of the relation to the free pages at the
+ * beginning, and truncate the relation, see zspage_compact(). Returns the
+ * number of blocks truncated away.
+ */
+Datum
+zedstore_compact(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	Relation	rel;
+	BlockNumber ntruncated;
+
+	/* Conflict with VACUUM and DDL, but not with queries or DML */
+	rel = table_open(relid, ShareUpdateExclusiveLock);
+
+	if (rel->rd_tableam != &zedstoream_methods)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a zedstore table",
+						RelationGetRelationName(rel))));
+
+	if (!pg_class_ownercheck(relid, GetUserId()))
+		aclcheck_error(ACLCHECK_NOT_OWNER,
+					   get_relkind_objtype(rel->rd_rel->relkind),
+					   RelationGetRelationName(rel));
+
+	ntruncated = zspage_compact(rel, 0, NOTICE);
+
+	table_close(rel, ShareUpdateExclusiveLock);
+
+	PG_RETURN_INT64((int64) ntruncated);
+}
+
+/*
+ * zedstore_prewarm(relid regclass, colnames name[]) returns int8
+ *
+ * Load the B-trees of the given columns, or of all columns if 'colnames' is
+ * NULL, into shared buffers, along with the TID tree, which every scan
+ * needs. This is meant for warming up the cache after a restart or
+ * failover, for the columns that queries are known to use; pg_prewarm can
+ * only load whole relations or block ranges. Returns the number of pages
+ * read.
+ */
+Datum
+zedstore_prewarm(PG_FUNCTION_ARGS)
+{
+	Oid			relid;
+	Relation	rel;
+	AclResult	aclresult;
+	bool	   *wanted;
+	int			natts;
+	int64		npages = 0;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("relation cannot be null")));
+	relid = PG_GETARG_OID(0);
+
+	rel = table_open(relid, AccessShareLock);
+
+	if (rel->rd_tableam != &zedstoream_methods)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a zedstore table",
+						RelationGetRelationName(rel))));
+
+	aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, get_relkind_objtype(rel->rd_rel->relkind),
+					   RelationGetRelationName(rel));
+
+	natts = RelationGetNumberOfAttributes(rel);
+	wanted = palloc0((natts + 1) * sizeof(bool));
+	if (PG_ARGISNULL(1))
+	{
+		for (AttrNumber attno = 1; attno <= natts; attno++)
+			wanted[attno] = !TupleDescAttr(RelationGetDescr(rel), attno - 1)->attisdropped;
+	}
+	else
+	{
+		ArrayType  *colnames = PG_GETARG_ARRAYTYPE_P(1);
+		Datum	   *elems;
+		bool	   *nulls;
+		int			nelems;
+
+		deconstruct_array(colnames, NAMEOID, NAMEDATALEN, false, 'c',
+						  &elems, &nulls, &nelems);
+		for (int i = 0; i < nelems; i++)
+		{
+			char	   *colname;
+			AttrNumber	attno;
+
+			if (nulls[i])
+				continue;
+			colname = NameStr(*DatumGetName(elems[i]));
+			attno = get_attnum(relid, colname);
+			if (attno == InvalidAttrNumber)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNDEFINED_COLUMN),
+						 errmsg("column \"%s\" of relation \"%s\" does not exist",
+								colname, RelationGetRelationName(rel))));
+			if (attno < 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("cannot prewarm system column \"%s\"",
+								colname)));
+			wanted[attno] = true;
+		}
+	}
+
+	/* The TID tree first, then the columns */
+	npages += zsbt_prewarm_tree(rel, ZS_META_ATTRIBUTE_NUM);
+	for (AttrNumber attno = 1; attno <= natts; attno++)
+	{
+		if (wanted[attno])
+			npages += zsbt_prewarm_tree(rel, attno);
+	}
+	pfree(wanted);
+
+	table_close(rel, AccessShareLock);
+
+	PG_RETURN_INT64(npages);
+}
+
 
 /*
  * Routines for dividing up the TID range for parallel seq scans
  */
 
 /*
- * Number of TIDs to assign to a parallel worker in a parallel Seq Scan in
- * one batch.
+ * Size of the TID ranges assigned to parallel workers in a parallel Seq Scan.
+ *
+ * The ranges are sized by the number of TID tree leaves they span, rather
+ * than the number of TIDs, because TIDs can be very unevenly distributed,
+ * e.g. after bulk deletions. We assign ZS_PARALLEL_CHUNK_LEAVES leaves at a
+ * time, until the last 1/ZS_PARALLEL_RAMPDOWN_FRACTION of the TID space,
+ * where the ranges shrink gradually down to a single leaf, so that the
+ * workers finish at about the same time.
  *
- * Not sure what the optimimum would be. If the chunk size is too small,
- * the parallel workers will waste effort, when two parallel workers both
- * need to decompress and process the pages at the boundary. But on the
- * other hand, if the chunk size is too large, we might not be able to make
- * good use of all the parallel workers.
+ * If the chunks are too small, the parallel workers will waste effort,
+ * when two parallel workers both need to decompress and process the
+ * attribute pages at the boundary. But on the other hand, if the chunks are
+ * too large, we might not be able to make good use of all the parallel
+ * workers.
+ *
+ * If the boundary cannot be determined from the TID tree, because of
+ * a concurrent page split for example, we fall back to a range of
+ * ZS_PARALLEL_FALLBACK_CHUNK_SIZE TIDs.
  */
-#define ZS_PARALLEL_CHUNK_SIZE	((uint64) 0x100000)
+#define ZS_PARALLEL_CHUNK_LEAVES			32
+#define ZS_PARALLEL_RAMPDOWN_FRACTION		16
+#define ZS_PARALLEL_FALLBACK_CHUNK_SIZE	((uint64) 0x10000)
 
 typedef struct ParallelZSScanDescData
 {
@@ -3026,23 +5479,47 @@ zs_parallelscan_nextrange(Relation rel, ParallelZSScanDesc pzscan,
 	uint64		allocatedtids;
 
 	/*
-	 * zhs_allocatedtid tracks how much has been allocated to workers
-	 * already.  When phs_allocatedtid >= rs_lasttid, all TIDs have been
+	 * pzs_allocatedtids tracks how much has been allocated to workers
+	 * already. When pzs_allocatedtids >= pzs_endtid, all TIDs have been
 	 * allocated.
 	 *
-	 * Because we use an atomic fetch-and-add to fetch the current value, the
-	 * phs_allocatedtid counter will exceed rs_lasttid, because workers will
-	 * still increment the value, when they try to allocate the next block but
-	 * all blocks have been allocated already. The counter must be 64 bits
-	 * wide because of that, to avoid wrapping around when rs_lasttid is close
-	 * to 2^32.  That's also one reason we do this at granularity of 2^16 TIDs,
-	 * even though zedstore isn't block-oriented.
-	 */
-	allocatedtids = pg_atomic_fetch_add_u64(&pzscan->pzs_allocatedtids, ZS_PARALLEL_CHUNK_SIZE);
-	*start = (zstid) allocatedtids;
-	*end = (zstid) (allocatedtids + ZS_PARALLEL_CHUNK_SIZE);
-
-	return *start < pzscan->pzs_endtid;
+	 * To claim the next range, we compute its end from the TID tree, and
+	 * try to advance the counter to it. If another worker advanced it
+	 * in between, we recompute from the new value.
+	 */
+	allocatedtids = pg_atomic_read_u64(&pzscan->pzs_allocatedtids);
+	for (;;)
+	{
+		zstid		remaining;
+		int			nleaves;
+		zstid		boundary;
+
+		if (allocatedtids >= pzscan->pzs_endtid)
+		{
+			*start = *end = (zstid) allocatedtids;
+			return false;
+		}
+
+		/* Ramp down towards the end of the scan */
+		remaining = pzscan->pzs_endtid - allocatedtids;
+		nleaves = ZS_PARALLEL_CHUNK_LEAVES;
+		if (remaining < pzscan->pzs_endtid / ZS_PARALLEL_RAMPDOWN_FRACTION)
+			nleaves = Max(1, (int) (ZS_PARALLEL_CHUNK_LEAVES * remaining *
+									ZS_PARALLEL_RAMPDOWN_FRACTION / pzscan->pzs_endtid));
+
+		boundary = zsbt_find_leaf_boundary(rel, ZS_META_ATTRIBUTE_NUM,
+										   (zstid) allocatedtids, nleaves);
+		if (boundary <= allocatedtids)
+			boundary = allocatedtids + ZS_PARALLEL_FALLBACK_CHUNK_SIZE;
+
+		if (pg_atomic_compare_exchange_u64(&pzscan->pzs_allocatedtids,
+										   &allocatedtids, boundary))
+		{
+			*start = (zstid) allocatedtids;
+			*end = boundary;
+			return true;
+		}
+	}
 }
 
 /*
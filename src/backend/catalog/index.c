@@ -2732,10 +2732,16 @@ index_update_stats(Relation rel,
 		BlockNumber relpages = RelationGetNumberOfBlocks(rel);
 		BlockNumber relallvisible;
 
-		if (rd_rel->relkind != RELKIND_INDEX)
+		if (rd_rel->relkind == RELKIND_INDEX)
+			relallvisible = 0;	/* don't bother for indexes */
+		else if (rel->rd_tableam &&
+				 table_index_fetch_checks_all_visible(rel))
+		{
+			/* maintained by VACUUM, see analyze.c */
+			relallvisible = Min((BlockNumber) rd_rel->relallvisible, relpages);
+		}
+		else
 			visibilitymap_count(rel, &relallvisible, NULL);
-		else					/* don't bother for indexes */
-			relallvisible = 0;
 
 		if (rd_rel->relpages != (int32) relpages)
 		{
@@ -926,6 +926,80 @@ CREATE VIEW pg_stat_xact_user_functions AS
     WHERE P.prolang != 12  -- fast check to eliminate built-in functions
           AND pg_stat_get_xact_function_calls(P.oid) IS NOT NULL;
 
+CREATE VIEW pg_stat_zedstore_columns AS
+    SELECT
+            S.relid,
+            N.nspname AS schemaname,
+            C.relname,
+            S.attnum,
+            A.attname,
+            S.pages_read,
+            S.pages_hit,
+            S.bytes_decompressed,
+            S.chunks_decoded,
+            S.toast_flattened,
+            S.undo_records_fetched
+    FROM pg_stat_get_zedstore_columns() AS S
+         JOIN pg_class C ON (C.oid = S.relid)
+         LEFT JOIN pg_namespace N ON (N.oid = C.relnamespace)
+         LEFT JOIN pg_attribute A ON (A.attrelid = S.relid AND A.attnum = S.attnum);
+
+CREATE VIEW pg_stat_zedstore_tuplebuffers AS
+    SELECT
+            S.buffered_rows,
+            S.buffered_bytes,
+            S.memory_bytes,
+            S.rows_buffered,
+            S.spills,
+            S.reserved_tids_killed,
+            S.commit_flushes,
+            S.commit_flush_time,
+            S.max_commit_flush_time
+    FROM pg_stat_get_zedstore_tuplebuffers() AS S;
+
+CREATE VIEW pg_stat_zedstore_undo AS
+    SELECT
+            C.oid AS relid,
+            N.nspname AS schemaname,
+            C.relname,
+            U.undo_pages,
+            U.undo_size,
+            U.oldest_undo_counter,
+            U.tail_undo_counter,
+            U.oldest_lag_pages,
+            U.undo_records_fetched,
+            U.undo_scans,
+            U.undo_pages_discarded
+    FROM pg_class C
+         JOIN pg_am AM ON (AM.oid = C.relam)
+         LEFT JOIN pg_namespace N ON (N.oid = C.relnamespace)
+         CROSS JOIN LATERAL pg_stat_get_zedstore_undo(C.oid) AS U
+    WHERE C.relkind IN ('r', 'm') AND AM.amname = 'zedstore';
+
+CREATE VIEW pg_zedstore_fragmentation AS
+    SELECT
+            C.oid AS relid,
+            N.nspname AS schemaname,
+            C.relname,
+            F.attno AS attnum,
+            A.attname,
+            F.leaf_pages,
+            F.leaf_runs,
+            F.avg_run_length,
+            F.sampled_pages,
+            F.avg_fill,
+            F.avg_free_space,
+            F.compressed_bytes,
+            F.uncompressed_bytes
+    FROM pg_class C
+         JOIN pg_am AM ON (AM.oid = C.relam)
+         LEFT JOIN pg_namespace N ON (N.oid = C.relnamespace)
+         CROSS JOIN LATERAL pg_zs_fragmentation(C.oid, 0.01) AS F
+         LEFT JOIN pg_attribute A ON (A.attrelid = C.oid AND A.attnum = F.attno)
+    WHERE C.relkind IN ('r', 'm') AND AM.amname = 'zedstore'
+          AND NOT pg_is_other_temp_schema(C.relnamespace)
+          AND has_table_privilege(C.oid, 'SELECT');
+
 CREATE VIEW pg_stat_archiver AS
     SELECT
         s.archived_count,
@@ -1332,6 +1406,13 @@ LANGUAGE INTERNAL
 STRICT STABLE PARALLEL SAFE
 AS 'jsonb_path_query_first_tz';
 
+CREATE OR REPLACE FUNCTION
+  zedstore_prewarm(relid regclass, colnames name[] DEFAULT NULL)
+RETURNS int8
+LANGUAGE INTERNAL
+VOLATILE PARALLEL UNSAFE
+AS 'zedstore_prewarm';
+
 --
 -- The default permissions for functions mean that anyone can execute them.
 -- A number of functions shouldn't be executable by just anyone, but rather
@@ -1357,6 +1438,7 @@ REVOKE EXECUTE ON FUNCTION pg_stat_reset() FROM public;
 REVOKE EXECUTE ON FUNCTION pg_stat_reset_shared(text) FROM public;
 REVOKE EXECUTE ON FUNCTION pg_stat_reset_single_table_counters(oid) FROM public;
 REVOKE EXECUTE ON FUNCTION pg_stat_reset_single_function_counters(oid) FROM public;
+REVOKE EXECUTE ON FUNCTION pg_stat_reset_zedstore_columns() FROM public;
 
 REVOKE EXECUTE ON FUNCTION lo_import(text) FROM public;
 REVOKE EXECUTE ON FUNCTION lo_import(text, oid) FROM public;
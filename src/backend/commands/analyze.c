@@ -41,6 +41,7 @@
 #include "foreign/fdwapi.h"
 #include "miscadmin.h"
 #include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
 #include "parser/parse_oper.h"
 #include "parser/parse_relation.h"
 #include "pgstat.h"
@@ -82,6 +83,12 @@ int			default_statistics_target = 100;
 /* A few variables that don't seem worth passing around as parameters */
 static MemoryContext anl_context = NULL;
 static BufferAccessStrategy vac_strategy;
+static Bitmapset *anl_sample_columns;	/* columns the sample rows need */
+
+/* sample passed to analyze_rel_sample(), see acquire_presampled_rows() */
+static HeapTuple *anl_presampled_rows;
+static int	anl_presampled_numrows;
+static double anl_presampled_totalrows;
 
 
 static void do_analyze_rel(Relation onerel,
@@ -97,6 +104,9 @@ static VacAttrStats *examine_attribute(Relation onerel, int attnum,
 static int	acquire_sample_rows(Relation onerel, int elevel,
 								HeapTuple *rows, int targrows,
 								double *totalrows, double *totaldeadrows);
+static int	acquire_presampled_rows(Relation onerel, int elevel,
+									HeapTuple *rows, int targrows,
+									double *totalrows, double *totaldeadrows);
 static int	compare_rows(const void *a, const void *b);
 static int	acquire_inherited_sample_rows(Relation onerel, int elevel,
 										  HeapTuple *rows, int targrows,
@@ -284,6 +294,51 @@ analyze_rel(Oid relid, RangeVar *relation,
 	LWLockRelease(ProcArrayLock);
 }
 
+/*
+ *	analyze_rel_sample() -- compute statistics from a given sample of rows
+ *
+ * This is for table AMs that can collect a random sample of the rows while
+ * the table is being loaded. 'rows' is a sample of 'numrows' rows, out of
+ * 'totalrows' rows in the table, with t_self set for each row. The column
+ * and index statistics are computed from it and stored like a plain
+ * ANALYZE of the table would, but without scanning the table.
+ *
+ * The caller must hold a lock on the relation that conflicts with ANALYZE,
+ * and be its owner.
+ */
+void
+analyze_rel_sample(Relation onerel, HeapTuple *rows, int numrows,
+				   double totalrows, int elevel)
+{
+	VacuumParams params;
+
+	/* Same settings as a plain ANALYZE command */
+	params.options = VACOPT_ANALYZE;
+	params.freeze_min_age = -1;
+	params.freeze_table_age = -1;
+	params.multixact_freeze_min_age = -1;
+	params.multixact_freeze_table_age = -1;
+	params.is_wraparound = false;
+	params.log_min_duration = -1;
+	params.index_cleanup = VACOPT_TERNARY_DEFAULT;
+	params.truncate = VACOPT_TERNARY_DEFAULT;
+
+	vac_strategy = GetAccessStrategy(BAS_VACUUM);
+
+	anl_presampled_rows = rows;
+	anl_presampled_numrows = numrows;
+	anl_presampled_totalrows = totalrows;
+
+	do_analyze_rel(onerel, &params, NIL, acquire_presampled_rows,
+				   RelationGetNumberOfBlocks(onerel), false, true, elevel);
+
+	anl_presampled_rows = NULL;
+	anl_presampled_numrows = 0;
+
+	FreeAccessStrategy(vac_strategy);
+	vac_strategy = NULL;
+}
+
 /*
  *	do_analyze_rel() -- analyze one relation, recursively or not
  *
@@ -469,6 +524,55 @@ do_analyze_rel(Relation onerel, VacuumParams *params,
 		}
 	}
 
+	/*
+	 * Work out which columns the sample rows need to contain: the ones we
+	 * compute statistics for, and whatever the indexes' columns, expressions
+	 * and predicates refer to.  AMs that store columns separately can skip
+	 * fetching the rest.  NULL means all columns; that's what we use for
+	 * inheritance trees, whose children may number their columns
+	 * differently.
+	 */
+	anl_sample_columns = NULL;
+	if (!inh)
+	{
+		Bitmapset  *varattnos = NULL;
+		int			attno;
+
+		for (i = 0; i < attr_cnt; i++)
+			anl_sample_columns = bms_add_member(anl_sample_columns,
+												vacattrstats[i]->tupattnum);
+		for (ind = 0; ind < nindexes; ind++)
+		{
+			IndexInfo  *indexInfo = indexdata[ind].indexInfo;
+
+			for (i = 0; i < indexInfo->ii_NumIndexAttrs; i++)
+			{
+				if (indexInfo->ii_IndexAttrNumbers[i] > 0)
+					anl_sample_columns =
+						bms_add_member(anl_sample_columns,
+									   indexInfo->ii_IndexAttrNumbers[i]);
+			}
+			pull_varattnos((Node *) indexInfo->ii_Expressions, 1, &varattnos);
+			pull_varattnos((Node *) indexInfo->ii_Predicate, 1, &varattnos);
+		}
+
+		attno = -1;
+		while ((attno = bms_next_member(varattnos, attno)) >= 0)
+		{
+			AttrNumber	varattno = attno + FirstLowInvalidHeapAttributeNumber;
+
+			if (varattno == InvalidAttrNumber)
+			{
+				/* whole-row reference, so we need everything */
+				anl_sample_columns = NULL;
+				break;
+			}
+			if (varattno > 0)
+				anl_sample_columns = bms_add_member(anl_sample_columns,
+													varattno);
+		}
+	}
+
 	/*
 	 * Determine how many rows we need to sample, using the worst case from
 	 * all analyzable columns.  We use a lower bound of 100 rows to avoid
@@ -514,6 +618,7 @@ do_analyze_rel(Relation onerel, VacuumParams *params,
 		numrows = (*acquirefunc) (onerel, elevel,
 								  rows, targrows,
 								  &totalrows, &totaldeadrows);
+	anl_sample_columns = NULL;
 
 	/*
 	 * Compute the statistics.  Temporary results during the calculations for
@@ -604,7 +709,15 @@ do_analyze_rel(Relation onerel, VacuumParams *params,
 	{
 		BlockNumber relallvisible;
 
-		visibilitymap_count(onerel, &relallvisible, NULL);
+		/*
+		 * If the table AM doesn't use the visibility map, it maintains
+		 * relallvisible itself in VACUUM, so keep the current value.
+		 */
+		if (onerel->rd_tableam &&
+			table_index_fetch_checks_all_visible(onerel))
+			relallvisible = Min((BlockNumber) onerel->rd_rel->relallvisible, relpages);
+		else
+			visibilitymap_count(onerel, &relallvisible, NULL);
 
 		vac_update_relstats(onerel,
 							relpages,
@@ -614,6 +727,9 @@ do_analyze_rel(Relation onerel, VacuumParams *params,
 							InvalidTransactionId,
 							InvalidMultiXactId,
 							in_outer_xact);
+
+		if (onerel->rd_tableam && !(params->options & VACOPT_VACUUM))
+			table_relation_analyze_done(onerel, totalrows, vac_strategy);
 	}
 
 	/*
@@ -995,7 +1111,8 @@ examine_attribute(Relation onerel, int attnum, Node *index_expr)
  * and return them into *totalrows and *totaldeadrows, respectively.
  *
  * The returned list of tuples is in order by physical position in the table.
- * (We will rely on this later to derive correlation estimates.)
+ * (We will rely on this later to derive correlation estimates.)  Columns not
+ * in anl_sample_columns may be returned as NULLs.
  *
  * As of May 2004 we use a new two-stage method:  Stage one selects up
  * to targrows random blocks (or all blocks, if there aren't so many).
@@ -1037,7 +1154,7 @@ acquire_sample_rows(Relation onerel, int elevel,
 
 	Assert(targrows > 0);
 
-	totalblocks = RelationGetNumberOfBlocks(onerel);
+	totalblocks = table_scan_analyze_nblocks(onerel);
 
 	/* Need a cutoff xmin for HeapTupleSatisfiesVacuum */
 	OldestXmin = GetOldestXmin(onerel, PROCARRAY_FLAGS_VACUUM);
@@ -1047,7 +1164,8 @@ acquire_sample_rows(Relation onerel, int elevel,
 	/* Prepare for sampling rows */
 	reservoir_init_selection_state(&rstate, targrows);
 
-	scan = table_beginscan_analyze(onerel);
+	scan = table_beginscan_analyze_with_column_projection(onerel,
+														  anl_sample_columns);
 	slot = table_slot_create(onerel, NULL);
 
 	/* Outer loop over blocks to sample */
@@ -1158,6 +1276,43 @@ acquire_sample_rows(Relation onerel, int elevel,
 	return numrows;
 }
 
+/*
+ * acquire_presampled_rows -- hand out the sample given to analyze_rel_sample
+ *
+ * This has the same API as acquire_sample_rows. If the given sample has more
+ * rows than we need, we pick a random subset of them.
+ */
+static int
+acquire_presampled_rows(Relation onerel, int elevel,
+						HeapTuple *rows, int targrows,
+						double *totalrows, double *totaldeadrows)
+{
+	int			numrows = 0;
+	BlockSamplerData bs;
+
+	/* Algorithm S works on the array indexes just like on block numbers */
+	BlockSampler_Init(&bs, anl_presampled_numrows, targrows, random());
+	while (BlockSampler_HasMore(&bs))
+	{
+		int			i = BlockSampler_Next(&bs);
+
+		rows[numrows++] = heap_copytuple(anl_presampled_rows[i]);
+	}
+
+	/* Sort the rows by position, like acquire_sample_rows() does */
+	qsort((void *) rows, numrows, sizeof(HeapTuple), compare_rows);
+
+	*totalrows = anl_presampled_totalrows;
+	*totaldeadrows = 0;
+
+	ereport(elevel,
+			(errmsg("\"%s\": %d rows in sample, %.0f total rows",
+					RelationGetRelationName(onerel),
+					numrows, *totalrows)));
+
+	return numrows;
+}
+
 /*
  * qsort comparator for sorting rows[] array
  */
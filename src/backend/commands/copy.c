@@ -253,6 +253,12 @@ typedef struct
 /* Trim the list of buffers back down to this number after flushing */
 #define MAX_PARTITION_BUFFERS	32
 
+/*
+ * Number of tuples fetched at a time in COPY TO, if the table AM supports
+ * fetching tuples in batches.
+ */
+#define COPY_TO_BATCH_SIZE		64
+
 /* Stores multi-insert data related to a single relation in CopyFrom. */
 typedef struct CopyMultiInsertBuffer
 {
@@ -2133,16 +2139,49 @@ CopyTo(CopyState cstate)
 		}
 
 		processed = 0;
-		while (table_scan_getnextslot(scandesc, ForwardScanDirection, slot))
+		if (table_scan_supports_batch(cstate->rel))
 		{
-			CHECK_FOR_INTERRUPTS();
+			TupleTableSlot *slots[COPY_TO_BATCH_SIZE];
+			int			nslots;
+
+			/*
+			 * Fetch the tuples a batch at a time. This lets the AM decode
+			 * many values of each column in one go, rather than switching
+			 * between the columns for every row.
+			 */
+			slots[0] = slot;
+			for (int i = 1; i < COPY_TO_BATCH_SIZE; i++)
+				slots[i] = table_slot_create(cstate->rel, NULL);
 
-			/* Deconstruct the tuple ... */
-			slot_getallattrs(slot);
+			while ((nslots = table_scan_getnextbatch(scandesc, ForwardScanDirection,
+													 slots, COPY_TO_BATCH_SIZE)) > 0)
+			{
+				CHECK_FOR_INTERRUPTS();
 
-			/* Format and send the data */
-			CopyOneRowTo(cstate, slot);
-			processed++;
+				for (int i = 0; i < nslots; i++)
+				{
+					slot_getallattrs(slots[i]);
+					CopyOneRowTo(cstate, slots[i]);
+				}
+				processed += nslots;
+			}
+
+			for (int i = 1; i < COPY_TO_BATCH_SIZE; i++)
+				ExecDropSingleTupleTableSlot(slots[i]);
+		}
+		else
+		{
+			while (table_scan_getnextslot(scandesc, ForwardScanDirection, slot))
+			{
+				CHECK_FOR_INTERRUPTS();
+
+				/* Deconstruct the tuple ... */
+				slot_getallattrs(slot);
+
+				/* Format and send the data */
+				CopyOneRowTo(cstate, slot);
+				processed++;
+			}
 		}
 
 		ExecDropSingleTupleTableSlot(slot);
@@ -31,6 +31,7 @@
 #include "access/xact.h"
 #include "access/xloginsert.h"
 #include "access/xlogutils.h"
+#include "access/zedstore_metacache.h"
 #include "catalog/catalog.h"
 #include "catalog/dependency.h"
 #include "catalog/indexing.h"
@@ -969,6 +970,7 @@ dropdb(const char *dbname, bool missing_ok, bool force)
 	 * dirty buffer to the dead database later...
 	 */
 	DropDatabaseBuffers(db_id);
+	zs_metacache_forget_database(db_id);
 
 	/*
 	 * Tell the stats collector to forget it immediately, too.
@@ -1255,6 +1257,7 @@ movedb(const char *dbname, const char *tblspcname)
 	 * src_tblspcoid, but bufmgr.c presently provides no API for that.
 	 */
 	DropDatabaseBuffers(db_id);
+	zs_metacache_forget_database(db_id);
 
 	/*
 	 * Check for existence of files in the target directory, i.e., objects of
@@ -13,6 +13,7 @@
  */
 #include "postgres.h"
 
+#include "access/tableam.h"
 #include "access/xact.h"
 #include "catalog/pg_type.h"
 #include "commands/createas.h"
@@ -110,6 +111,7 @@ static void show_foreignscan_info(ForeignScanState *fsstate, ExplainState *es);
 static void show_eval_params(Bitmapset *bms_params, ExplainState *es);
 static const char *explain_get_index_name(Oid indexId);
 static void show_buffer_usage(ExplainState *es, const BufferUsage *usage);
+static void show_storage_info(ScanState *scanstate, ExplainState *es);
 static void ExplainIndexScanDetails(Oid indexid, ScanDirection indexorderdir,
 									ExplainState *es);
 static void ExplainScanTarget(Scan *plan, ExplainState *es);
@@ -165,6 +167,8 @@ ExplainQuery(ParseState *pstate, ExplainStmt *stmt, const char *queryString,
 			es->buffers = defGetBoolean(opt);
 		else if (strcmp(opt->defname, "settings") == 0)
 			es->settings = defGetBoolean(opt);
+		else if (strcmp(opt->defname, "storage") == 0)
+			es->storage = defGetBoolean(opt);
 		else if (strcmp(opt->defname, "timing") == 0)
 		{
 			timing_set = true;
@@ -207,6 +211,11 @@ ExplainQuery(ParseState *pstate, ExplainStmt *stmt, const char *queryString,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("EXPLAIN option BUFFERS requires ANALYZE")));
 
+	if (es->storage && !es->analyze)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("EXPLAIN option STORAGE requires ANALYZE")));
+
 	/* if the timing was not set explicitly, set default value */
 	es->timing = (timing_set) ? es->timing : es->analyze;
 
@@ -1864,6 +1873,14 @@ ExplainNode(PlanState *planstate, List *ancestors,
 			break;
 	}
 
+	/* Show table AM scan details */
+	if (es->storage && IsA(plan, SeqScan))
+	{
+		show_scan_qual(((SeqScanState *) planstate)->scan_key_quals,
+					   "Scan Key", planstate, ancestors, es);
+		show_storage_info((ScanState *) planstate, es);
+	}
+
 	/* Show buffer usage */
 	if (es->buffers && planstate->instrument)
 		show_buffer_usage(es, &planstate->instrument->bufusage);
@@ -2844,6 +2861,22 @@ explain_get_index_name(Oid indexId)
 	return result;
 }
 
+/*
+ * Show the table AM's details of a scan, for EXPLAIN (ANALYZE, STORAGE).
+ *
+ * The scan descriptor is still open at this point, as the executor hasn't
+ * been shut down yet. It's not there if the node was never executed. In a
+ * parallel scan, only the leader's part of the scan is shown.
+ */
+static void
+show_storage_info(ScanState *scanstate, ExplainState *es)
+{
+	if (scanstate->ss_currentScanDesc == NULL)
+		return;
+
+	table_scan_explain(scanstate->ss_currentScanDesc, es);
+}
+
 /*
  * Show buffer usage details.
  */
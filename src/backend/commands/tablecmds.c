@@ -86,6 +86,7 @@
 #include "storage/predicate.h"
 #include "storage/smgr.h"
 #include "utils/acl.h"
+#include "utils/attoptcache.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/inval.h"
@@ -346,7 +347,9 @@ static void ATExecCmd(List **wqueue, AlteredTableInfo *tab, Relation rel,
 					  AlterTableCmd *cmd, LOCKMODE lockmode);
 static void ATRewriteTables(AlterTableStmt *parsetree,
 							List **wqueue, LOCKMODE lockmode);
-static void ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode);
+static void ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap,
+						   void *colrewrite, LOCKMODE lockmode);
+static AttrNumber *ATGetRewrittenAttnums(AlteredTableInfo *tab, int *nattrs);
 static AlteredTableInfo *ATGetQueueEntry(List **wqueue, Relation rel);
 static void ATSimplePermissions(Relation rel, int allowed_targets);
 static void ATWrongRelkindError(Relation rel, int allowed_targets);
@@ -4560,6 +4563,7 @@ ATRewriteTables(AlterTableStmt *parsetree, List **wqueue, LOCKMODE lockmode)
 			Oid			OIDNewHeap;
 			Oid			NewTableSpace;
 			char		persistence;
+			void	   *colrewrite = NULL;
 
 			OldHeap = table_open(tab->relid, NoLock);
 
@@ -4622,6 +4626,44 @@ ATRewriteTables(AlterTableStmt *parsetree, List **wqueue, LOCKMODE lockmode)
 										 tab->relid,
 										 tab->rewrite);
 
+			/*
+			 * If only the values of some columns change, or new columns get
+			 * values computed for each row, the table AM may be able to
+			 * write just those columns in place, instead of copying the whole
+			 * table.
+			 */
+			if ((tab->rewrite & ~(AT_REWRITE_COLUMN_REWRITE |
+								  AT_REWRITE_DEFAULT_VAL)) == 0 &&
+				!OidIsValid(tab->newTableSpace))
+			{
+				AttrNumber *attnums;
+				int			nattrs;
+
+				attnums = ATGetRewrittenAttnums(tab, &nattrs);
+				OldHeap = table_open(tab->relid, NoLock);
+				colrewrite = table_relation_begin_column_rewrite(OldHeap,
+																 nattrs,
+																 attnums);
+				table_close(OldHeap, NoLock);
+				pfree(attnums);
+			}
+
+			if (colrewrite)
+			{
+				ATRewriteTable(tab, InvalidOid, colrewrite, lockmode);
+
+				/*
+				 * Rebuild the indexes, like finish_heap_swap() does. Indexes
+				 * on the changed columns were recreated without building
+				 * them, in anticipation of the rewrite.
+				 */
+				reindex_relation(tab->relid,
+								 REINDEX_REL_SUPPRESS_INDEX_USE |
+								 REINDEX_REL_CHECK_CONSTRAINTS,
+								 0);
+				continue;
+			}
+
 			/*
 			 * Create transient table that will receive the modified data.
 			 *
@@ -4645,7 +4687,7 @@ ATRewriteTables(AlterTableStmt *parsetree, List **wqueue, LOCKMODE lockmode)
 			 * modifications, and test the current data within the table
 			 * against new constraints generated by ALTER TABLE commands.
 			 */
-			ATRewriteTable(tab, OIDNewHeap, lockmode);
+			ATRewriteTable(tab, OIDNewHeap, NULL, lockmode);
 
 			/*
 			 * Swap the physical files of the old and new heaps, then rebuild
@@ -4671,7 +4713,7 @@ ATRewriteTables(AlterTableStmt *parsetree, List **wqueue, LOCKMODE lockmode)
 			 */
 			if (tab->constraints != NIL || tab->verify_new_notnull ||
 				tab->partition_constraint != NULL)
-				ATRewriteTable(tab, InvalidOid, lockmode);
+				ATRewriteTable(tab, InvalidOid, NULL, lockmode);
 
 			/*
 			 * If we had SET TABLESPACE but no reason to reconstruct tuples,
@@ -4737,10 +4779,13 @@ ATRewriteTables(AlterTableStmt *parsetree, List **wqueue, LOCKMODE lockmode)
 /*
  * ATRewriteTable: scan or rewrite one table
  *
- * OIDNewHeap is InvalidOid if we don't need to rewrite
+ * OIDNewHeap is InvalidOid if we don't need to rewrite, or if we rewrite
+ * only the columns in tab->newvals in place. colrewrite is the state of such
+ * an in-place rewrite, from table_relation_begin_column_rewrite(), or NULL.
  */
 static void
-ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
+ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, void *colrewrite,
+			   LOCKMODE lockmode)
 {
 	Relation	oldrel;
 	Relation	newrel;
@@ -4755,6 +4800,10 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 	BulkInsertState bistate;
 	int			ti_options;
 	ExprState  *partqualstate = NULL;
+	AttrNumber *rewrite_attnums = NULL;
+	int			rewrite_nattrs = 0;
+	Datum	   *rewrite_values = NULL;
+	bool	   *rewrite_isnull = NULL;
 
 	/*
 	 * Open the relation(s).  We have surely already locked the existing
@@ -4833,8 +4882,15 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 		ex->exprstate = ExecInitExpr((Expr *) ex->expr, NULL);
 	}
 
+	if (colrewrite)
+	{
+		rewrite_attnums = ATGetRewrittenAttnums(tab, &rewrite_nattrs);
+		rewrite_values = palloc(rewrite_nattrs * sizeof(Datum));
+		rewrite_isnull = palloc(rewrite_nattrs * sizeof(bool));
+	}
+
 	notnull_attrs = NIL;
-	if (newrel || tab->verify_new_notnull)
+	if (newrel || colrewrite || tab->verify_new_notnull)
 	{
 		/*
 		 * If we are rebuilding the tuples OR if we added any new but not
@@ -4853,7 +4909,7 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 			needscan = true;
 	}
 
-	if (newrel || needscan)
+	if (newrel || colrewrite || needscan)
 	{
 		ExprContext *econtext;
 		TupleTableSlot *oldslot;
@@ -4868,6 +4924,10 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 			ereport(DEBUG1,
 					(errmsg("rewriting table \"%s\"",
 							RelationGetRelationName(oldrel))));
+		else if (colrewrite)
+			ereport(DEBUG1,
+					(errmsg("rewriting columns of table \"%s\"",
+							RelationGetRelationName(oldrel))));
 		else
 			ereport(DEBUG1,
 					(errmsg("verifying table \"%s\"",
@@ -4895,11 +4955,11 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 		 */
 		if (tab->rewrite)
 		{
-			Assert(newrel != NULL);
+			Assert(newrel != NULL || colrewrite != NULL);
 			oldslot = MakeSingleTupleTableSlot(oldTupDesc,
 											   table_slot_callbacks(oldrel));
 			newslot = MakeSingleTupleTableSlot(newTupDesc,
-											   table_slot_callbacks(newrel));
+											   table_slot_callbacks(newrel ? newrel : oldrel));
 
 			/*
 			 * Set all columns in the new slot to NULL initially, to ensure
@@ -4934,7 +4994,39 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 		 * checking all the constraints.
 		 */
 		snapshot = RegisterSnapshot(GetLatestSnapshot());
-		scan = table_beginscan(oldrel, snapshot, 0, NULL);
+		if (colrewrite && table_scans_leverage_column_projection(oldrel))
+		{
+			/*
+			 * The other columns are left alone, so only read the ones that
+			 * the new values and the constraints are computed from.
+			 */
+			Bitmapset  *proj = NULL;
+
+			foreach(l, tab->newvals)
+			{
+				NewColumnValue *ex = lfirst(l);
+
+				PopulateNeededColumnsForNode((Node *) ex->expr,
+											 oldTupDesc->natts, &proj);
+			}
+			foreach(l, tab->constraints)
+			{
+				NewConstraint *con = lfirst(l);
+
+				if (con->contype == CONSTR_CHECK)
+					PopulateNeededColumnsForNode(con->qual,
+												 newTupDesc->natts, &proj);
+			}
+			PopulateNeededColumnsForNode((Node *) tab->partition_constraint,
+										 newTupDesc->natts, &proj);
+			foreach(l, notnull_attrs)
+				proj = bms_add_member(proj, lfirst_int(l) + 1);
+
+			scan = table_beginscan_with_column_projection(oldrel, snapshot,
+														  0, NULL, proj);
+		}
+		else
+			scan = table_beginscan(oldrel, snapshot, 0, NULL);
 
 		/*
 		 * Switch to per-tuple memory context and reset it for each tuple
@@ -5055,6 +5147,19 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 			if (newrel)
 				table_tuple_insert(newrel, insertslot, mycid,
 								   ti_options, bistate);
+			else if (colrewrite)
+			{
+				/* Or just the changed columns, in place */
+				for (i = 0; i < rewrite_nattrs; i++)
+				{
+					rewrite_values[i] = insertslot->tts_values[rewrite_attnums[i] - 1];
+					rewrite_isnull[i] = insertslot->tts_isnull[rewrite_attnums[i] - 1];
+				}
+				table_relation_column_rewrite_tuple(oldrel, colrewrite,
+													&oldslot->tts_tid,
+													rewrite_values,
+													rewrite_isnull);
+			}
 
 			ResetExprContext(econtext);
 
@@ -5065,6 +5170,9 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 		table_endscan(scan);
 		UnregisterSnapshot(snapshot);
 
+		if (colrewrite)
+			table_relation_end_column_rewrite(oldrel, colrewrite);
+
 		ExecDropSingleTupleTableSlot(oldslot);
 		if (newslot)
 			ExecDropSingleTupleTableSlot(newslot);
@@ -5083,6 +5191,29 @@ ATRewriteTable(AlteredTableInfo *tab, Oid OIDNewHeap, LOCKMODE lockmode)
 	}
 }
 
+/*
+ * ATGetRewrittenAttnums: the columns whose values are replaced by a rewrite,
+ * in the order of tab->newvals
+ */
+static AttrNumber *
+ATGetRewrittenAttnums(AlteredTableInfo *tab, int *nattrs)
+{
+	AttrNumber *attnums;
+	ListCell   *l;
+	int			n = 0;
+
+	attnums = palloc(Max(list_length(tab->newvals), 1) * sizeof(AttrNumber));
+	foreach(l, tab->newvals)
+	{
+		NewColumnValue *ex = lfirst(l);
+
+		attnums[n++] = ex->attnum;
+	}
+	*nattrs = n;
+
+	return attnums;
+}
+
 /*
  * ATGetQueueEntry: find or create an entry in the ALTER TABLE work queue
  */
@@ -6855,6 +6986,7 @@ ATExecSetOptions(Relation rel, const char *colName, Node *options,
 				newOptions;
 	bool		isnull;
 	ObjectAddress address;
+	AttributeOpts *aopts;
 	Datum		repl_val[Natts_pg_attribute];
 	bool		repl_null[Natts_pg_attribute];
 	bool		repl_repl[Natts_pg_attribute];
@@ -6884,7 +7016,7 @@ ATExecSetOptions(Relation rel, const char *colName, Node *options,
 									 castNode(List, options), NULL, NULL,
 									 false, isReset);
 	/* Validate new options */
-	(void) attribute_reloptions(newOptions, true);
+	aopts = (AttributeOpts *) attribute_reloptions(newOptions, true);
 
 	/* Build new tuple. */
 	memset(repl_null, false, sizeof(repl_null));
@@ -6900,6 +7032,16 @@ ATExecSetOptions(Relation rel, const char *colName, Node *options,
 	/* Update system catalog. */
 	CatalogTupleUpdate(attrelation, &newtuple->t_self, newtuple);
 
+	/*
+	 * If the column is now declared to be in insertion order, have the table
+	 * AM check that the rows already in the table are.
+	 */
+	if (aopts && aopts->zedstore_ordered)
+	{
+		CommandCounterIncrement();
+		table_relation_validate_scan_order(rel, attnum);
+	}
+
 	InvokeObjectPostAlterHook(RelationRelationId,
 							  RelationGetRelid(rel),
 							  attrtuple->attnum);
@@ -153,12 +153,16 @@ ExecScanFetch(ScanState *node,
  *		Initial States:
  *		  -- the relation indicated is opened for scanning so that the
  *			 "cursor" is positioned before the first qualifying tuple.
+ *
+ *		ExecScanInternal() is the common implementation of ExecScan() and
+ *		ExecScanExtended().
  * ----------------------------------------------------------------
  */
-TupleTableSlot *
-ExecScan(ScanState *node,
-		 ExecScanAccessMtd accessMtd,	/* function returning a tuple */
-		 ExecScanRecheckMtd recheckMtd)
+static pg_attribute_always_inline TupleTableSlot *
+ExecScanInternal(ScanState *node,
+				 ExecScanAccessMtd accessMtd,
+				 ExecScanRecheckMtd recheckMtd,
+				 ExecScanFinishMtd finishMtd)
 {
 	ExprContext *econtext;
 	ExprState  *qual;
@@ -177,7 +181,7 @@ ExecScan(ScanState *node,
 	 * If we have neither a qual to check nor a projection to do, just skip
 	 * all the overhead and return the raw scan tuple.
 	 */
-	if (!qual && !projInfo)
+	if (!qual && !projInfo && !finishMtd)
 	{
 		ResetExprContext(econtext);
 		return ExecScanFetch(node, accessMtd, recheckMtd);
@@ -230,6 +234,9 @@ ExecScan(ScanState *node,
 			/*
 			 * Found a satisfactory scan tuple.
 			 */
+			if (finishMtd)
+				(*finishMtd) (node, slot);
+
 			if (projInfo)
 			{
 				/*
@@ -256,6 +263,32 @@ ExecScan(ScanState *node,
 	}
 }
 
+TupleTableSlot *
+ExecScan(ScanState *node,
+		 ExecScanAccessMtd accessMtd,	/* function returning a tuple */
+		 ExecScanRecheckMtd recheckMtd)
+{
+	return ExecScanInternal(node, accessMtd, recheckMtd, NULL);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecScanExtended
+ *
+ *		Like ExecScan(), but calls 'finishMtd' on each scan tuple that
+ *		passes the qual-clause, before projecting it. This allows the
+ *		access method to fetch the rest of the tuple only when it's
+ *		needed.
+ * ----------------------------------------------------------------
+ */
+TupleTableSlot *
+ExecScanExtended(ScanState *node,
+				 ExecScanAccessMtd accessMtd,
+				 ExecScanRecheckMtd recheckMtd,
+				 ExecScanFinishMtd finishMtd)
+{
+	return ExecScanInternal(node, accessMtd, recheckMtd, finishMtd);
+}
+
 /*
  * ExecAssignScanProjectionInfo
  *		Set up projection info for a scan node, if necessary.
@@ -369,7 +402,7 @@ neededColumnContextWalker(Node *node, neededColumnContext *c)
 		 * columns.
 		 */
 		if (var->varattno == 0)
-			bms_add_range(*(c->mask), 1, c->n);
+			*(c->mask) = bms_add_range(*(c->mask), 1, c->n);
 
 		return false;
 	}
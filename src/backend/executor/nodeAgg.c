@@ -272,7 +272,7 @@ static TupleTableSlot *project_aggregates(AggState *aggstate);
 static Bitmapset *find_unaggregated_cols(AggState *aggstate);
 static bool find_unaggregated_cols_walker(Node *node, Bitmapset **colnos);
 static void build_hash_table(AggState *aggstate);
-static TupleHashEntryData *lookup_hash_entry(AggState *aggstate);
+static AggStatePerGroup lookup_hash_entry(AggState *aggstate);
 static void lookup_hash_entries(AggState *aggstate);
 static TupleTableSlot *agg_retrieve_direct(AggState *aggstate);
 static void agg_fill_hash_table(AggState *aggstate);
@@ -1277,6 +1277,10 @@ build_hash_table(AggState *aggstate)
 
 		Assert(perhash->aggnode->numGroups > 0);
 
+		perhash->lastpergroup = NULL;
+		perhash->lastgroup_hits = 0;
+		perhash->lastgroup_misses = 0;
+
 		if (perhash->hashtable)
 			ResetTupleHashTable(perhash->hashtable);
 		else
@@ -1422,6 +1426,8 @@ find_hash_columns(AggState *aggstate)
 							  perhash->aggnode->grpOperators,
 							  &perhash->eqfuncoids,
 							  &perhash->hashfunctions);
+		if (perhash->numCols == 1)
+			fmgr_info(perhash->eqfuncoids[0], &perhash->keyeqfunction);
 		perhash->hashslot =
 			ExecAllocTableSlot(&estate->es_tupleTable, hashDesc,
 							   &TTSOpsMinimalTuple);
@@ -1454,15 +1460,25 @@ hash_agg_entry_size(int numAggs)
 	return entrysize;
 }
 
+/* number of previous-group checks before we judge whether they pay off */
+#define LASTGROUP_MIN_TRIES		1000
+
 /*
  * Find or create a hashtable entry for the tuple group containing the current
  * tuple (already set in tmpcontext's outertuple slot), in the current grouping
  * set (which the caller must have selected - note that initialize_aggregate
- * depends on this).
+ * depends on this). Returns the group's per-group data.
+ *
+ * With a single grouping column, consecutive input rows often belong to the
+ * same group, e.g. when a column with few distinct values was loaded in
+ * runs (which is also what makes zedstore's dictionary encoding effective).
+ * So we first check whether the row belongs to the previous row's group,
+ * which saves hashing the key and probing the table. If that mostly fails,
+ * we stop checking.
  *
  * When called, CurrentMemoryContext should be the per-query context.
  */
-static TupleHashEntryData *
+static AggStatePerGroup
 lookup_hash_entry(AggState *aggstate)
 {
 	TupleTableSlot *inputslot = aggstate->tmpcontext->ecxt_outertuple;
@@ -1470,10 +1486,42 @@ lookup_hash_entry(AggState *aggstate)
 	TupleTableSlot *hashslot = perhash->hashslot;
 	TupleHashEntryData *entry;
 	bool		isnew;
+	bool		try_lastgroup;
 	int			i;
 
-	/* transfer just the needed columns into hashslot */
 	slot_getsomeattrs(inputslot, perhash->largestGrpColIdx);
+
+	try_lastgroup = (perhash->numCols == 1 &&
+					 (perhash->lastgroup_misses < LASTGROUP_MIN_TRIES ||
+					  perhash->lastgroup_hits >= perhash->lastgroup_misses));
+	if (try_lastgroup && perhash->lastpergroup != NULL)
+	{
+		int			varNumber = perhash->hashGrpColIdxInput[0] - 1;
+		Datum		key = inputslot->tts_values[varNumber];
+		bool		isnull = inputslot->tts_isnull[varNumber];
+		bool		match;
+
+		if (isnull || perhash->lastkeyisnull)
+			match = (isnull && perhash->lastkeyisnull);
+		else
+		{
+			MemoryContext oldContext;
+
+			oldContext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
+			match = DatumGetBool(FunctionCall2Coll(&perhash->keyeqfunction,
+												   perhash->aggnode->grpCollations[0],
+												   key, perhash->lastkey));
+			MemoryContextSwitchTo(oldContext);
+		}
+		if (match)
+		{
+			perhash->lastgroup_hits++;
+			return perhash->lastpergroup;
+		}
+		perhash->lastgroup_misses++;
+	}
+
+	/* transfer just the needed columns into hashslot */
 	ExecClearTuple(hashslot);
 
 	for (i = 0; i < perhash->numhashGrpCols; i++)
@@ -1511,7 +1559,20 @@ lookup_hash_entry(AggState *aggstate)
 		}
 	}
 
-	return entry;
+	/*
+	 * Remember the group for the next row. The key is read from the group's
+	 * representative tuple, which lives as long as the hash table.
+	 */
+	if (try_lastgroup)
+	{
+		TupleTableSlot *tableslot = perhash->hashtable->tableslot;
+
+		ExecStoreMinimalTuple(entry->firstTuple, tableslot, false);
+		perhash->lastkey = slot_getattr(tableslot, 1, &perhash->lastkeyisnull);
+		perhash->lastpergroup = (AggStatePerGroup) entry->additional;
+	}
+
+	return (AggStatePerGroup) entry->additional;
 }
 
 /*
@@ -1530,7 +1591,7 @@ lookup_hash_entries(AggState *aggstate)
 	for (setno = 0; setno < numHashes; setno++)
 	{
 		select_current_set(aggstate, setno, true);
-		pergroup[setno] = lookup_hash_entry(aggstate)->additional;
+		pergroup[setno] = lookup_hash_entry(aggstate);
 	}
 }
 
@@ -457,6 +457,19 @@ BitmapAdjustPrefetchTarget(BitmapHeapScanState *node)
 #endif							/* USE_PREFETCH */
 }
 
+/*
+ * BitmapPrefetchBlock - Prefetch one upcoming block of the bitmap
+ *
+ * The table AM may know better what storage the block maps to, so let it
+ * handle the request if it wants to.
+ */
+static inline void
+BitmapPrefetchBlock(TableScanDesc scan, BlockNumber blockno)
+{
+	if (!table_scan_bitmap_prefetch_block(scan, blockno))
+		PrefetchBuffer(scan->rs_rd, MAIN_FORKNUM, blockno);
+}
+
 /*
  * BitmapPrefetch - Prefetch, if prefetch_pages are behind prefetch_target
  */
@@ -504,7 +517,7 @@ BitmapPrefetch(BitmapHeapScanState *node, TableScanDesc scan)
 											 &node->pvmbuffer));
 
 				if (!skip_fetch)
-					PrefetchBuffer(scan->rs_rd, MAIN_FORKNUM, tbmpre->blockno);
+					BitmapPrefetchBlock(scan, tbmpre->blockno);
 			}
 		}
 
@@ -555,7 +568,7 @@ BitmapPrefetch(BitmapHeapScanState *node, TableScanDesc scan)
 											 &node->pvmbuffer));
 
 				if (!skip_fetch)
-					PrefetchBuffer(scan->rs_rd, MAIN_FORKNUM, tbmpre->blockno);
+					BitmapPrefetchBlock(scan, tbmpre->blockno);
 			}
 		}
 	}
@@ -1588,20 +1588,32 @@ ExecParallelHashIncreaseNumBuckets(HashJoinTable hashtable)
  * tuples from batch files.  We could save some cycles in the regular-tuple
  * case by not forcing the slot contents into minimal form; not clear if it's
  * worth the messiness required.
+ *
+ * If the slot has no physical tuple at all, like a virtual slot or the slot
+ * of a columnar table AM, its copy_minimal_tuple callback would form one
+ * from the slot's values, only for us to copy it into the hash table and
+ * free it.  In that case, we form the tuple directly in the hash table.
  */
 void
 ExecHashTableInsert(HashJoinTable hashtable,
 					TupleTableSlot *slot,
 					uint32 hashvalue)
 {
-	bool		shouldFree;
-	MinimalTuple tuple = ExecFetchSlotMinimalTuple(slot, &shouldFree);
+	bool		shouldFree = false;
+	MinimalTuple tuple = NULL;
+	bool		formInPlace;
 	int			bucketno;
 	int			batchno;
 
 	ExecHashGetBucketAndBatch(hashtable, hashvalue,
 							  &bucketno, &batchno);
 
+	formInPlace = (batchno == hashtable->curbatch &&
+				   slot->tts_ops->get_heap_tuple == NULL &&
+				   slot->tts_ops->get_minimal_tuple == NULL);
+	if (!formInPlace)
+		tuple = ExecFetchSlotMinimalTuple(slot, &shouldFree);
+
 	/*
 	 * decide whether to put the tuple in the hash table or a temp file
 	 */
@@ -1615,11 +1627,31 @@ ExecHashTableInsert(HashJoinTable hashtable,
 		double		ntuples = (hashtable->totalTuples - hashtable->skewTuples);
 
 		/* Create the HashJoinTuple */
-		hashTupleSize = HJTUPLE_OVERHEAD + tuple->t_len;
-		hashTuple = (HashJoinTuple) dense_alloc(hashtable, hashTupleSize);
+		if (formInPlace)
+		{
+			Size		tupleSize;
+
+			/* Such slots always have all their values available */
+			Assert(slot->tts_nvalid == slot->tts_tupleDescriptor->natts);
+			tupleSize = heap_compute_minimal_tuple_size(slot->tts_tupleDescriptor,
+														slot->tts_values,
+														slot->tts_isnull);
+			hashTupleSize = HJTUPLE_OVERHEAD + tupleSize;
+			hashTuple = (HashJoinTuple) dense_alloc(hashtable, hashTupleSize);
+			heap_fill_minimal_tuple(slot->tts_tupleDescriptor,
+									slot->tts_values,
+									slot->tts_isnull,
+									HJTUPLE_MINTUPLE(hashTuple),
+									tupleSize);
+		}
+		else
+		{
+			hashTupleSize = HJTUPLE_OVERHEAD + tuple->t_len;
+			hashTuple = (HashJoinTuple) dense_alloc(hashtable, hashTupleSize);
+			memcpy(HJTUPLE_MINTUPLE(hashTuple), tuple, tuple->t_len);
+		}
 
 		hashTuple->hashvalue = hashvalue;
-		memcpy(HJTUPLE_MINTUPLE(hashTuple), tuple, tuple->t_len);
 
 		/*
 		 * We always reset the tuple-matched flag on insertion.  This is okay
@@ -112,7 +112,10 @@
 #include "executor/hashjoin.h"
 #include "executor/nodeHash.h"
 #include "executor/nodeHashjoin.h"
+#include "executor/nodeSeqscan.h"
+#include "lib/bloomfilter.h"
 #include "miscadmin.h"
+#include "parser/parsetree.h"
 #include "pgstat.h"
 #include "utils/memutils.h"
 #include "utils/sharedtuplestore.h"
@@ -146,6 +149,9 @@ static TupleTableSlot *ExecHashJoinGetSavedTuple(HashJoinState *hjstate,
 static bool ExecHashJoinNewBatch(HashJoinState *hjstate);
 static bool ExecParallelHashJoinNewBatch(HashJoinState *hjstate);
 static void ExecParallelHashJoinPartitionOuter(HashJoinState *node);
+static SeqScanState *ExecHashJoinFilterScan(HashJoinState *hjstate,
+											HashJoin *node);
+static void ExecHashJoinBuildFilter(HashJoinState *hjstate);
 
 
 /* ----------------------------------------------------------------
@@ -298,6 +304,13 @@ ExecHashJoinImpl(PlanState *pstate, bool parallel)
 				if (hashtable->totalTuples == 0 && !HJ_FILL_OUTER(node))
 					return NULL;
 
+				/*
+				 * If all the inner tuples are in memory, let the outer scan
+				 * skip the tuples that cannot have a match.
+				 */
+				if (node->hj_FilterScan && !parallel && hashtable->nbatch == 1)
+					ExecHashJoinBuildFilter(node);
+
 				/*
 				 * need to remember whether nbatch has increased since we
 				 * began scanning the outer relation
@@ -733,9 +746,112 @@ ExecInitHashJoin(HashJoin *node, EState *estate, int eflags)
 	hjstate->hj_MatchedOuter = false;
 	hjstate->hj_OuterNotEmpty = false;
 
+	hjstate->hj_FilterScan = ExecHashJoinFilterScan(hjstate, node);
+
 	return hjstate;
 }
 
+/*
+ * ExecHashJoinFilterScan
+ *		Check if we can push a runtime join filter into the outer scan
+ *
+ * That's possible if the outer plan is a sequential scan, the join has a
+ * single hash key that is a plain column of it, and outer tuples without a
+ * match are not needed. Returns the scan, having prepared it for the filter,
+ * or NULL.
+ */
+static SeqScanState *
+ExecHashJoinFilterScan(HashJoinState *hjstate, HashJoin *node)
+{
+	PlanState  *outerState = outerPlanState(hjstate);
+	Plan	   *outerNode = outerPlan(node);
+	Expr	   *key;
+	TargetEntry *tle;
+	Var		   *var;
+
+	if (node->join.jointype != JOIN_INNER &&
+		node->join.jointype != JOIN_SEMI &&
+		node->join.jointype != JOIN_RIGHT)
+		return NULL;
+	if (!IsA(outerState, SeqScanState) || list_length(node->hashkeys) != 1)
+		return NULL;
+
+	/* the key refers to the outer plan's tlist, which refers to the table */
+	key = (Expr *) linitial(node->hashkeys);
+	if (IsA(key, RelabelType))
+		key = ((RelabelType *) key)->arg;
+	if (!IsA(key, Var) || ((Var *) key)->varno != OUTER_VAR)
+		return NULL;
+	tle = get_tle_by_resno(outerNode->targetlist, ((Var *) key)->varattno);
+	if (tle == NULL)
+		return NULL;
+	key = tle->expr;
+	if (IsA(key, RelabelType))
+		key = ((RelabelType *) key)->arg;
+	if (!IsA(key, Var))
+		return NULL;
+	var = (Var *) key;
+	if (var->varno != ((Scan *) outerNode)->scanrelid ||
+		var->varlevelsup != 0 || var->varattno <= 0)
+		return NULL;
+
+	if (!ExecSeqScanInitRuntimeFilter((SeqScanState *) outerState,
+									  var->varattno))
+		return NULL;
+
+	return (SeqScanState *) outerState;
+}
+
+/*
+ * ExecHashJoinBuildFilter
+ *		Build a bloom filter of the hash values in the hash table, and pass
+ *		it to the outer scan
+ *
+ * The filter lives in the hash table's memory context, so it must be
+ * removed from the scan whenever the hash table is destroyed.
+ */
+static void
+ExecHashJoinBuildFilter(HashJoinState *hjstate)
+{
+	HashJoinTable hashtable = hjstate->hj_HashTable;
+	MemoryContext oldcontext;
+	bloom_filter *filter;
+
+	Assert(hashtable->nbatch == 1 && hashtable->parallel_state == NULL);
+
+	/* a NULL outer key can only match if the operator isn't strict */
+	if (!hashtable->hashStrict[0])
+		return;
+
+	oldcontext = MemoryContextSwitchTo(hashtable->hashCxt);
+	filter = bloom_create((int64) hashtable->totalTuples, work_mem, 0);
+	MemoryContextSwitchTo(oldcontext);
+
+	for (int i = 0; i < hashtable->nbuckets; i++)
+	{
+		for (HashJoinTuple tuple = hashtable->buckets.unshared[i];
+			 tuple != NULL;
+			 tuple = tuple->next.unshared)
+			bloom_add_element(filter, (unsigned char *) &tuple->hashvalue,
+							  sizeof(uint32));
+	}
+	for (int i = 0; i < hashtable->nSkewBuckets; i++)
+	{
+		HashSkewBucket *skewBucket =
+			hashtable->skewBucket[hashtable->skewBucketNums[i]];
+
+		for (HashJoinTuple tuple = skewBucket->tuples;
+			 tuple != NULL;
+			 tuple = tuple->next.unshared)
+			bloom_add_element(filter, (unsigned char *) &tuple->hashvalue,
+							  sizeof(uint32));
+	}
+
+	ExecSeqScanSetRuntimeFilter(hjstate->hj_FilterScan, filter,
+								&hashtable->outer_hashfunctions[0],
+								hashtable->collations[0]);
+}
+
 /* ----------------------------------------------------------------
  *		ExecEndHashJoin
  *
@@ -750,6 +866,9 @@ ExecEndHashJoin(HashJoinState *node)
 	 */
 	if (node->hj_HashTable)
 	{
+		if (node->hj_FilterScan)
+			ExecSeqScanSetRuntimeFilter(node->hj_FilterScan, NULL, NULL,
+										InvalidOid);
 		ExecHashTableDestroy(node->hj_HashTable);
 		node->hj_HashTable = NULL;
 	}
@@ -1317,6 +1436,9 @@ ExecReScanHashJoin(HashJoinState *node)
 		else
 		{
 			/* must destroy and rebuild hash table */
+			if (node->hj_FilterScan)
+				ExecSeqScanSetRuntimeFilter(node->hj_FilterScan, NULL, NULL,
+											InvalidOid);
 			ExecHashTableDestroy(node->hj_HashTable);
 			node->hj_HashTable = NULL;
 			node->hj_JoinState = HJ_BUILD_HASHTABLE;
@@ -50,6 +50,23 @@ static void StoreIndexTuple(TupleTableSlot *slot, IndexTuple itup,
 							TupleDesc itupdesc);
 
 
+/*
+ * IndexOnlyTupleAllVisible - is the table tuple at 'tid' visible to all?
+ *
+ * If it is, the index tuple can be returned without visiting the table.
+ */
+static inline bool
+IndexOnlyTupleAllVisible(IndexOnlyScanState *node, IndexScanDesc scandesc,
+						 ItemPointer tid)
+{
+	if (table_index_fetch_checks_all_visible(scandesc->heapRelation))
+		return table_index_fetch_all_visible(scandesc->xs_heapfetch, tid);
+
+	return VM_ALL_VISIBLE(scandesc->heapRelation,
+						  ItemPointerGetBlockNumber(tid),
+						  &node->ioss_VMBuffer);
+}
+
 /* ----------------------------------------------------------------
  *		IndexOnlyNext
  *
@@ -157,10 +174,11 @@ IndexOnlyNext(IndexOnlyScanState *node)
 		 *
 		 * It's worth going through this complexity to avoid needing to lock
 		 * the VM buffer, which could cause significant contention.
+		 *
+		 * Table AMs without a visibility map check the TID themselves, see
+		 * IndexOnlyTupleAllVisible().
 		 */
-		if (!VM_ALL_VISIBLE(scandesc->heapRelation,
-							ItemPointerGetBlockNumber(tid),
-							&node->ioss_VMBuffer))
+		if (!IndexOnlyTupleAllVisible(node, scandesc, tid))
 		{
 			/*
 			 * Rats, we have to visit the heap to check visibility.
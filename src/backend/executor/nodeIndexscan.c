@@ -17,6 +17,7 @@
  *		ExecIndexScan			scans a relation using an index
  *		IndexNext				retrieve next tuple using index
  *		IndexNextWithReorder	same, but recheck ORDER BY expressions
+ *		IndexNextFromBatch		same, but fetch tuples in batches, in TID order
  *		ExecInitIndexScan		creates and initializes state info.
  *		ExecReScanIndexScan		rescans the indexed relation.
  *		ExecEndIndexScan		releases all storage.
@@ -38,11 +39,13 @@
 #include "lib/pairingheap.h"
 #include "miscadmin.h"
 #include "nodes/nodeFuncs.h"
+#include "pgstat.h"
 #include "utils/array.h"
 #include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/snapmgr.h"
 
 /*
  * When an ordering operator is used, tuples fetched from the index that
@@ -56,8 +59,22 @@ typedef struct
 	bool	   *orderbynulls;
 } ReorderTuple;
 
+/*
+ * When the order of the rows doesn't matter, and the table AM can fetch many
+ * tuples at a time, TIDs are read from the index in batches, and the tuples
+ * are fetched in TID order. The batches start small, so that a scan that is
+ * stopped early, by a LIMIT for example, doesn't read much further ahead in
+ * the index than it has to, and grow up to INDEXSCAN_BATCH_SIZE.
+ */
+#define INDEXSCAN_BATCH_INITIAL_SIZE	4
+#define INDEXSCAN_BATCH_SIZE			64
+
 static TupleTableSlot *IndexNext(IndexScanState *node);
 static TupleTableSlot *IndexNextWithReorder(IndexScanState *node);
+static TupleTableSlot *IndexNextFromBatch(IndexScanState *node,
+										  IndexScanDesc scandesc,
+										  ScanDirection direction);
+static int	itemptr_comparator(const void *a, const void *b);
 static void EvalOrderByExpressions(IndexScanState *node, ExprContext *econtext);
 static bool IndexRecheck(IndexScanState *node, TupleTableSlot *slot);
 static int	cmp_orderbyvals(const Datum *adist, const bool *anulls,
@@ -134,6 +151,9 @@ IndexNext(IndexScanState *node)
 						 node->iss_OrderByKeys, node->iss_NumOrderByKeys);
 	}
 
+	if (node->iss_BatchSlots)
+		return IndexNextFromBatch(node, scandesc, direction);
+
 	/*
 	 * ok, now that we have what we need, fetch the next tuple.
 	 */
@@ -167,6 +187,110 @@ IndexNext(IndexScanState *node)
 	return ExecClearTuple(slot);
 }
 
+/* ----------------------------------------------------------------
+ *		IndexNextFromBatch
+ *
+ *		Like IndexNext, but reads a batch of TIDs from the index at a
+ *		time, and fetches their tuples in TID order, with one call to
+ *		the table AM. That turns the random probes of the table into a
+ *		sweep over it, like in a bitmap scan. Only used when the rows
+ *		may be returned in any order, see ExecInitIndexScan.
+ * ----------------------------------------------------------------
+ */
+static TupleTableSlot *
+IndexNextFromBatch(IndexScanState *node, IndexScanDesc scandesc,
+				   ScanDirection direction)
+{
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+
+	for (;;)
+	{
+		int			ntids;
+
+		/* Return the next visible tuple of the current batch */
+		while (node->iss_BatchNext < node->iss_BatchNTids)
+		{
+			int			i = node->iss_BatchNext++;
+			TupleTableSlot *slot = node->iss_BatchSlots[i];
+
+			if (!node->iss_BatchFound[i])
+				continue;
+
+			/*
+			 * If the index was lossy for any of the TIDs of the batch, we
+			 * recheck all of them. That's harmless for the others.
+			 */
+			if (node->iss_BatchRecheck)
+			{
+				econtext->ecxt_scantuple = slot;
+				if (!ExecQualAndReset(node->indexqualorig, econtext))
+				{
+					InstrCountFiltered2(node, 1);
+					continue;
+				}
+			}
+
+			/* make it the scan tuple, for WHERE CURRENT OF */
+			node->ss.ss_ScanTupleSlot = slot;
+			return slot;
+		}
+
+		if (node->iss_ReachedEnd)
+			break;
+
+		/* Read the next batch of TIDs from the index */
+		ntids = 0;
+		node->iss_BatchRecheck = false;
+		while (ntids < node->iss_BatchSize)
+		{
+			ItemPointer tid;
+
+			CHECK_FOR_INTERRUPTS();
+
+			tid = index_getnext_tid(scandesc, direction);
+			if (tid == NULL)
+			{
+				node->iss_ReachedEnd = true;
+				break;
+			}
+			node->iss_BatchTids[ntids++] = *tid;
+			if (scandesc->xs_recheck)
+				node->iss_BatchRecheck = true;
+		}
+		node->iss_BatchNTids = ntids;
+		node->iss_BatchNext = 0;
+		if (ntids == 0)
+			break;
+
+		/* Fetch the tuples in TID order */
+		qsort(node->iss_BatchTids, ntids, sizeof(ItemPointerData),
+			  itemptr_comparator);
+		table_index_fetch_tuples(scandesc->xs_heapfetch,
+								 node->iss_BatchTids, ntids,
+								 scandesc->xs_snapshot,
+								 node->iss_BatchSlots, node->iss_BatchFound);
+		for (int i = 0; i < ntids; i++)
+		{
+			if (node->iss_BatchFound[i])
+				pgstat_count_heap_fetch(scandesc->indexRelation);
+		}
+
+		node->iss_BatchSize = Min(node->iss_BatchSize * 2,
+								  node->iss_BatchMaxSize);
+	}
+
+	return ExecClearTuple(node->ss.ss_ScanTupleSlot);
+}
+
+/*
+ * qsort comparator for ItemPointerData items
+ */
+static int
+itemptr_comparator(const void *a, const void *b)
+{
+	return ItemPointerCompare((ItemPointer) a, (ItemPointer) b);
+}
+
 /* ----------------------------------------------------------------
  *		IndexNextWithReorder
  *
@@ -585,6 +709,17 @@ ExecReScanIndexScan(IndexScanState *node)
 			reorderqueue_pop(node);
 	}
 
+	/* forget any tuples left in the current batch */
+	if (node->iss_BatchSlots)
+	{
+		for (int i = 0; i < node->iss_BatchMaxSize; i++)
+			ExecClearTuple(node->iss_BatchSlots[i]);
+		node->ss.ss_ScanTupleSlot = node->iss_BatchSlots[0];
+		node->iss_BatchSize = INDEXSCAN_BATCH_INITIAL_SIZE;
+		node->iss_BatchNTids = 0;
+		node->iss_BatchNext = 0;
+	}
+
 	/* reset index scan */
 	if (node->iss_ScanDesc)
 		index_rescan(node->iss_ScanDesc,
@@ -813,6 +948,11 @@ ExecEndIndexScan(IndexScanState *node)
 	if (node->ss.ps.ps_ResultTupleSlot)
 		ExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
 	ExecClearTuple(node->ss.ss_ScanTupleSlot);
+	if (node->iss_BatchSlots)
+	{
+		for (int i = 0; i < node->iss_BatchMaxSize; i++)
+			ExecClearTuple(node->iss_BatchSlots[i]);
+	}
 
 	/*
 	 * close the index relation (no-op if we didn't open it)
@@ -949,6 +1089,33 @@ ExecInitIndexScan(IndexScan *node, EState *estate, int eflags)
 	if (node->indexorderby && table_slot_ops != &TTSOpsHeapTuple)
 		indexstate->ss.ps.scanopsfixed = false;
 
+	/*
+	 * If the order of the rows doesn't matter, and the AM can fetch many
+	 * tuples at a time, fetch them in batches in TID order. That requires
+	 * more slots, the first of which is the regular scan tuple slot. The
+	 * batches are only read in forward direction, and can't be marked and
+	 * restored. Fetching a batch sees only one version of each row, so
+	 * it's also only done with MVCC snapshots.
+	 */
+	if (node->indexanyorder && node->indexorderby == NIL &&
+		(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK |
+				   EXEC_FLAG_EXPLAIN_ONLY)) == 0 &&
+		IsMVCCSnapshot(estate->es_snapshot) &&
+		table_index_fetch_supports_batch(currentRelation))
+	{
+		indexstate->iss_BatchMaxSize = INDEXSCAN_BATCH_SIZE;
+		indexstate->iss_BatchSize = INDEXSCAN_BATCH_INITIAL_SIZE;
+		indexstate->iss_BatchSlots = palloc(INDEXSCAN_BATCH_SIZE * sizeof(TupleTableSlot *));
+		indexstate->iss_BatchSlots[0] = indexstate->ss.ss_ScanTupleSlot;
+		for (int i = 1; i < INDEXSCAN_BATCH_SIZE; i++)
+			indexstate->iss_BatchSlots[i] =
+				ExecAllocTableSlot(&estate->es_tupleTable,
+								   RelationGetDescr(currentRelation),
+								   table_slot_ops);
+		indexstate->iss_BatchTids = palloc(INDEXSCAN_BATCH_SIZE * sizeof(ItemPointerData));
+		indexstate->iss_BatchFound = palloc(INDEXSCAN_BATCH_SIZE * sizeof(bool));
+	}
+
 	/*
 	 * Initialize result type and projection.
 	 */
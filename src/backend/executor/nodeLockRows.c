@@ -179,6 +179,14 @@ lnext:
 		if (!IsolationUsesXactSnapshot())
 			lockflags |= TUPLE_LOCK_FLAG_FIND_LAST_VERSION;
 
+		/*
+		 * With a single rowmark, markSlot is only used for EvalPlanQual, which
+		 * is needed only if the update chain was followed.  That's the common
+		 * case for foreign key checks; let the AM skip fetching the tuple.
+		 */
+		if (list_length(node->lr_arowMarks) == 1)
+			lockflags |= TUPLE_LOCK_FLAG_FETCH_IF_TRAVERSED;
+
 		test = table_tuple_lock(erm->relation, &tid, estate->es_snapshot,
 								markSlot, estate->es_output_cid,
 								lockmode, erm->waitPolicy,
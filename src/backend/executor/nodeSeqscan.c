@@ -28,13 +28,28 @@
 #include "postgres.h"
 
 #include "access/relscan.h"
+#include "access/skey.h"
 #include "access/tableam.h"
+#include "catalog/pg_am.h"
+#include "commands/defrem.h"
 #include "executor/execdebug.h"
 #include "executor/nodeSeqscan.h"
+#include "lib/bloomfilter.h"
 #include "nodes/nodeFuncs.h"
+#include "utils/lsyscache.h"
 #include "utils/rel.h"
 
 static TupleTableSlot *SeqNext(SeqScanState *node);
+static bool SeqFilterRejects(SeqScanState *node, TupleTableSlot *slot);
+static void SeqSetupDeferredColumns(SeqScanState *node);
+static Bitmapset *SeqComputeDeferredColumns(SeqScanState *node,
+											 AttrNumber filter_attno);
+static void SeqBuildScanKeys(SeqScanState *node, List *quals);
+
+/*
+ * Number of tuples to fetch at a time, if the table AM supports batches.
+ */
+#define SEQSCAN_BATCH_SIZE		64
 
 /* ----------------------------------------------------------------
  *						Scan Support
@@ -75,25 +90,268 @@ SeqNext(SeqScanState *node)
 														   node->ss.ss_currentRelation->rd_att->natts);
 			scandesc = table_beginscan_with_column_projection(node->ss.ss_currentRelation,
 															  estate->es_snapshot,
-															  0, NULL, proj);
+															  node->num_scan_keys,
+															  node->scan_keys,
+															  proj);
 		}
 		else
 		{
 			scandesc = table_beginscan(node->ss.ss_currentRelation,
 									   estate->es_snapshot,
-									   0, NULL);
+									   node->num_scan_keys,
+									   node->scan_keys);
 		}
 		node->ss.ss_currentScanDesc = scandesc;
+		SeqSetupDeferredColumns(node);
+	}
+
+	/*
+	 * If the AM can return many tuples at a time, return the next tuple from
+	 * the current batch, fetching a new batch when it's exhausted. The
+	 * tuple is returned in one of the batch slots, which becomes the scan
+	 * tuple slot, so that e.g. WHERE CURRENT OF still finds it.
+	 */
+	if (node->batch_slots)
+	{
+		for (;;)
+		{
+			if (node->batch_next >= node->batch_nslots)
+			{
+				node->batch_nslots = table_scan_getnextbatch(scandesc, direction,
+															 node->batch_slots,
+															 node->batch_size);
+				node->batch_next = 0;
+				if (node->batch_nslots == 0)
+				{
+					ExecClearTuple(slot);
+					return NULL;
+				}
+			}
+			slot = node->batch_slots[node->batch_next++];
+			if (node->filter && SeqFilterRejects(node, slot))
+				continue;
+			node->ss.ss_ScanTupleSlot = slot;
+			node->deferred_slot = slot;
+			return slot;
+		}
 	}
 
 	/*
 	 * get the next tuple from the table
 	 */
-	if (table_scan_getnextslot(scandesc, direction, slot))
+	while (table_scan_getnextslot(scandesc, direction, slot))
+	{
+		if (node->filter && SeqFilterRejects(node, slot))
+			continue;
+		node->deferred_slot = slot;
 		return slot;
+	}
 	return NULL;
 }
 
+/*
+ * SeqFilterRejects -- check a tuple against the runtime join filter
+ *
+ * Returns true if the tuple cannot have a join partner in the parent hash
+ * join. See ExecSeqScanSetRuntimeFilter().
+ */
+static bool
+SeqFilterRejects(SeqScanState *node, TupleTableSlot *slot)
+{
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	MemoryContext oldcontext;
+	Datum		value;
+	bool		isnull;
+	uint32		hashvalue;
+
+	value = slot_getattr(slot, node->filter_attno, &isnull);
+
+	/* the join operator is strict, so a NULL key can't match anything */
+	if (isnull)
+		return true;
+
+	/* the hash function might leak memory, e.g. when detoasting */
+	ResetExprContext(econtext);
+	oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	hashvalue = DatumGetUInt32(FunctionCall1Coll(node->filter_hashfunc,
+												 node->filter_collation,
+												 value));
+	MemoryContextSwitchTo(oldcontext);
+
+	return bloom_lacks_element(node->filter, (unsigned char *) &hashvalue,
+							   sizeof(hashvalue));
+}
+
+/*
+ * SeqBuildScanKeys -- turn simple quals into scan keys for the AM
+ *
+ * We look for quals of the form "column op constant", or the commuted form,
+ * where the operator belongs to the default btree operator family of the
+ * column's type. "ctid op constant" is accepted too, so that the AM can
+ * restrict the scan to a range of TIDs. The quals stay in the qual list too, as the AM is free to
+ * return rows that don't match the keys, and in an EvalPlanQual recheck the
+ * AM isn't involved at all.
+ *
+ * The AM evaluates the keys before any of the quals, including the security
+ * barrier and row-level security quals that the planner placed first, so only
+ * leakproof operators are accepted.
+ *
+ * The scan keys are not used in parallel scans, because
+ * table_beginscan_parallel() doesn't take any.
+ */
+static void
+SeqBuildScanKeys(SeqScanState *node, List *quals)
+{
+	Index		scanrelid = ((Scan *) node->ss.ps.plan)->scanrelid;
+	ScanKey		keys;
+	int			nkeys = 0;
+	List	   *keyquals = NIL;
+	ListCell   *lc;
+
+	keys = palloc(list_length(quals) * sizeof(ScanKeyData));
+
+	foreach(lc, quals)
+	{
+		Expr	   *clause = (Expr *) lfirst(lc);
+		OpExpr	   *op;
+		Expr	   *leftop;
+		Expr	   *rightop;
+		Var		   *var;
+		Const	   *con;
+		Oid			opno;
+		Oid			opclass;
+		Oid			opfamily;
+		int			strategy;
+		Oid			lefttype;
+		Oid			righttype;
+
+		if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2)
+			continue;
+		op = (OpExpr *) clause;
+		opno = op->opno;
+
+		leftop = (Expr *) linitial(op->args);
+		rightop = (Expr *) lsecond(op->args);
+		if (leftop && IsA(leftop, RelabelType))
+			leftop = ((RelabelType *) leftop)->arg;
+		if (rightop && IsA(rightop, RelabelType))
+			rightop = ((RelabelType *) rightop)->arg;
+
+		if (IsA(leftop, Var) && IsA(rightop, Const))
+		{
+			var = (Var *) leftop;
+			con = (Const *) rightop;
+		}
+		else if (IsA(leftop, Const) && IsA(rightop, Var))
+		{
+			/* "constant op column"; use the commutator */
+			var = (Var *) rightop;
+			con = (Const *) leftop;
+			opno = get_commutator(opno);
+			if (!OidIsValid(opno))
+				continue;
+		}
+		else
+			continue;
+
+		if (var->varno != scanrelid || var->varlevelsup != 0 ||
+			(var->varattno <= 0 && var->varattno != SelfItemPointerAttributeNumber) ||
+			con->constisnull)
+			continue;
+
+		if (!get_func_leakproof(get_opcode(opno)))
+			continue;
+
+		opclass = GetDefaultOpClass(var->vartype, BTREE_AM_OID);
+		if (!OidIsValid(opclass))
+			continue;
+		opfamily = get_opclass_family(opclass);
+		if (!op_in_opfamily(opno, opfamily))
+			continue;
+		get_op_opfamily_properties(opno, opfamily, false,
+								   &strategy, &lefttype, &righttype);
+
+		ScanKeyEntryInitialize(&keys[nkeys],
+							   0,
+							   var->varattno,
+							   strategy,
+							   righttype,
+							   op->inputcollid,
+							   get_opcode(opno),
+							   con->constvalue);
+		nkeys++;
+		keyquals = lappend(keyquals, clause);
+	}
+
+	if (nkeys == 0)
+	{
+		pfree(keys);
+		return;
+	}
+	node->scan_keys = keys;
+	node->num_scan_keys = nkeys;
+	node->scan_key_quals = keyquals;
+}
+
+/*
+ * SeqComputeDeferredColumns -- decide which columns to defer, if any
+ *
+ * The columns needed by the quals, and the column the runtime join filter
+ * looks at, if any, are fetched for every tuple, the rest of the projected
+ * columns only for the tuples that pass. Returns NULL if nothing can be
+ * deferred.
+ */
+static Bitmapset *
+SeqComputeDeferredColumns(SeqScanState *node, AttrNumber filter_attno)
+{
+	Relation	rel = node->ss.ss_currentRelation;
+	int			natts = rel->rd_att->natts;
+	Bitmapset  *proj;
+	Bitmapset  *earlycols = NULL;
+
+	if (!table_scans_leverage_column_projection(rel) ||
+		!table_scan_supports_deferred_columns(rel))
+		return NULL;
+
+	proj = PopulateNeededColumnsForScan(&node->ss, natts);
+	PopulateNeededColumnsForNode((Node *) node->ss.ps.plan->qual, natts,
+								 &earlycols);
+	if (filter_attno != InvalidAttrNumber)
+		earlycols = bms_add_member(earlycols, filter_attno);
+
+	proj = bms_del_members(proj, earlycols);
+	if (bms_is_empty(proj))
+		return NULL;
+	return proj;
+}
+
+/*
+ * SeqSetupDeferredColumns -- tell a newly begun scan which columns to defer
+ */
+static void
+SeqSetupDeferredColumns(SeqScanState *node)
+{
+	if (node->deferred_cols)
+		table_scan_set_deferred_columns(node->ss.ss_currentScanDesc,
+										node->deferred_cols);
+}
+
+/*
+ * SeqFetchDeferred -- fetch the deferred columns of a tuple that passed quals
+ *
+ * In an EvalPlanQual recheck, the tuple might be a test tuple instead of one
+ * returned by the scan. It's complete already.
+ */
+static void
+SeqFetchDeferred(SeqScanState *node, TupleTableSlot *slot)
+{
+	if (slot == node->deferred_slot)
+	{
+		table_scan_fetch_deferred_columns(node->ss.ss_currentScanDesc, slot);
+		node->deferred_slot = NULL;
+	}
+}
+
 /*
  * SeqRecheck -- access method routine to recheck a tuple in EvalPlanQual
  */
@@ -126,6 +384,23 @@ ExecSeqScan(PlanState *pstate)
 					(ExecScanRecheckMtd) SeqRecheck);
 }
 
+/*
+ * ExecSeqScanDeferred -- like ExecSeqScan, but with late materialization
+ *
+ * Only the columns needed by the quals are fetched for every tuple, the
+ * rest only for tuples that pass the quals.
+ */
+static TupleTableSlot *
+ExecSeqScanDeferred(PlanState *pstate)
+{
+	SeqScanState *node = castNode(SeqScanState, pstate);
+
+	return ExecScanExtended(&node->ss,
+							(ExecScanAccessMtd) SeqNext,
+							(ExecScanRecheckMtd) SeqRecheck,
+							(ExecScanFinishMtd) SeqFetchDeferred);
+}
+
 
 /* ----------------------------------------------------------------
  *		ExecInitSeqScan
@@ -171,6 +446,25 @@ ExecInitSeqScan(SeqScan *node, EState *estate, int eflags)
 						  RelationGetDescr(scanstate->ss.ss_currentRelation),
 						  table_slot_callbacks(scanstate->ss.ss_currentRelation));
 
+	/*
+	 * If the AM supports it, fetch tuples in batches. That requires more
+	 * slots, the first of which is the regular scan tuple slot. Batches are
+	 * only fetched in forward direction, so don't do it if backward scans
+	 * are possible.
+	 */
+	if (table_scan_supports_batch(scanstate->ss.ss_currentRelation) &&
+		(eflags & EXEC_FLAG_BACKWARD) == 0)
+	{
+		scanstate->batch_size = SEQSCAN_BATCH_SIZE;
+		scanstate->batch_slots = palloc(SEQSCAN_BATCH_SIZE * sizeof(TupleTableSlot *));
+		scanstate->batch_slots[0] = scanstate->ss.ss_ScanTupleSlot;
+		for (int i = 1; i < SEQSCAN_BATCH_SIZE; i++)
+			scanstate->batch_slots[i] =
+				ExecAllocTableSlot(&estate->es_tupleTable,
+								   RelationGetDescr(scanstate->ss.ss_currentRelation),
+								   table_slot_callbacks(scanstate->ss.ss_currentRelation));
+	}
+
 	/*
 	 * Initialize result type and projection.
 	 */
@@ -183,9 +477,81 @@ ExecInitSeqScan(SeqScan *node, EState *estate, int eflags)
 	scanstate->ss.ps.qual =
 		ExecInitQual(node->plan.qual, (PlanState *) scanstate);
 
+	/* Let the AM skip non-matching rows early, if it can */
+	if (node->plan.qual != NIL &&
+		table_scans_support_scan_keys(scanstate->ss.ss_currentRelation))
+		SeqBuildScanKeys(scanstate, node->plan.qual);
+
+	/*
+	 * If the AM supports it, fetch the columns that are not needed by the
+	 * quals only for the tuples that pass them.
+	 */
+	if (node->plan.qual != NIL)
+	{
+		scanstate->deferred_cols =
+			SeqComputeDeferredColumns(scanstate, InvalidAttrNumber);
+		if (scanstate->deferred_cols)
+			scanstate->ss.ps.ExecProcNode = ExecSeqScanDeferred;
+	}
+
 	return scanstate;
 }
 
+/* ----------------------------------------------------------------
+ *		ExecSeqScanInitRuntimeFilter
+ *
+ *		Prepare for a runtime join filter on column 'attno'.
+ *
+ *		A parent hash join calls this at executor startup if its only hash
+ *		key is a column of this scan, and the join discards outer tuples
+ *		without a match. Once it has built its hash table, it passes a
+ *		bloom filter of the inner side's hash values to
+ *		ExecSeqScanSetRuntimeFilter(), and we skip the tuples that cannot
+ *		have a join partner. That's only worthwhile if the AM can defer
+ *		fetching the other columns, so that the skipped tuples cost little
+ *		more than decoding the join key; returns false if it can't.
+ * ----------------------------------------------------------------
+ */
+bool
+ExecSeqScanInitRuntimeFilter(SeqScanState *node, AttrNumber attno)
+{
+	Bitmapset  *deferred_cols;
+
+	Assert(node->ss.ss_currentScanDesc == NULL);
+	Assert(attno > 0);
+
+	deferred_cols = SeqComputeDeferredColumns(node, attno);
+	if (deferred_cols == NULL)
+		return false;
+
+	node->filter_attno = attno;
+	node->deferred_cols = deferred_cols;
+	ExecSetExecProcNode(&node->ss.ps, ExecSeqScanDeferred);
+
+	return true;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecSeqScanSetRuntimeFilter
+ *
+ *		Install, or with filter == NULL remove, the runtime join filter.
+ *
+ *		The filter contains the hash values computed with 'hashfunc' and
+ *		'collation' of the join keys on the inner side. The caller owns the
+ *		filter, and must remove it before freeing it.
+ * ----------------------------------------------------------------
+ */
+void
+ExecSeqScanSetRuntimeFilter(SeqScanState *node, bloom_filter *filter,
+							FmgrInfo *hashfunc, Oid collation)
+{
+	Assert(filter == NULL || node->filter_attno != InvalidAttrNumber);
+
+	node->filter = filter;
+	node->filter_hashfunc = hashfunc;
+	node->filter_collation = collation;
+}
+
 /* ----------------------------------------------------------------
  *		ExecEndSeqScan
  *
@@ -213,6 +579,11 @@ ExecEndSeqScan(SeqScanState *node)
 	if (node->ss.ps.ps_ResultTupleSlot)
 		ExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
 	ExecClearTuple(node->ss.ss_ScanTupleSlot);
+	if (node->batch_slots)
+	{
+		for (int i = 0; i < node->batch_size; i++)
+			ExecClearTuple(node->batch_slots[i]);
+	}
 
 	/*
 	 * close heap scan
@@ -243,6 +614,17 @@ ExecReScanSeqScan(SeqScanState *node)
 		table_rescan(scan,		/* scan desc */
 					 NULL);		/* new scan keys */
 
+	/* forget any tuples left in the current batch */
+	if (node->batch_slots)
+	{
+		for (int i = 0; i < node->batch_size; i++)
+			ExecClearTuple(node->batch_slots[i]);
+		node->ss.ss_ScanTupleSlot = node->batch_slots[0];
+		node->batch_nslots = 0;
+		node->batch_next = 0;
+	}
+	node->deferred_slot = NULL;
+
 	ExecScanReScan((ScanState *) node);
 }
 
@@ -298,6 +680,10 @@ ExecSeqScanInitializeDSM(SeqScanState *node,
 	shm_toc_insert(pcxt->toc, node->ss.ps.plan->plan_node_id, pscan);
 	node->ss.ss_currentScanDesc =
 		table_beginscan_parallel(node->ss.ss_currentRelation, pscan, proj);
+	SeqSetupDeferredColumns(node);
+
+	/* the scan keys aren't used after all, so don't show them in EXPLAIN */
+	node->scan_key_quals = NIL;
 }
 
 /* ----------------------------------------------------------------
@@ -342,4 +728,5 @@ ExecSeqScanInitializeWorker(SeqScanState *node,
 	pscan = shm_toc_lookup(pwcxt->toc, node->ss.ps.plan->plan_node_id, false);
 	node->ss.ss_currentScanDesc =
 		table_beginscan_parallel(node->ss.ss_currentRelation, pscan, proj);
+	SeqSetupDeferredColumns(node);
 }
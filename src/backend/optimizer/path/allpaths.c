@@ -581,6 +581,9 @@ set_plain_rel_size(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte)
 
 	/* Mark rel with estimated output rows, width, etc */
 	set_baserel_size_estimates(root, rel);
+
+	/* For column stores, a seqscan reads only the needed columns' pages */
+	estimate_rel_scan_pages(root, rel);
 }
 
 /*
@@ -237,15 +237,17 @@ cost_seqscan(Path *path, PlannerInfo *root,
 							  &spc_seq_page_cost);
 
 	/*
-	 * disk costs
+	 * disk costs.  A table AM that stores columns separately reads only the
+	 * pages of the needed columns, see estimate_rel_scan_pages().
 	 */
-	disk_run_cost = spc_seq_page_cost * baserel->pages;
+	disk_run_cost = spc_seq_page_cost * baserel->scan_pages;
 
 	/* CPU costs */
 	get_restriction_qual_cost(root, baserel, param_info, &qpqual_cost);
 
 	startup_cost += qpqual_cost.startup;
-	cpu_per_tuple = cpu_tuple_cost + qpqual_cost.per_tuple;
+	cpu_per_tuple = cpu_tuple_cost + baserel->scan_decode_cost +
+		qpqual_cost.per_tuple;
 	cpu_run_cost = cpu_per_tuple * baserel->tuples;
 	/* tlist eval costs are paid per output row, not per tuple scanned */
 	startup_cost += path->pathtarget->cost.startup;
@@ -496,6 +498,7 @@ cost_index(IndexPath *path, PlannerInfo *root, double loop_count,
 	QualCost	qpqual_cost;
 	Cost		cpu_per_tuple;
 	double		tuples_fetched;
+	BlockNumber table_pages;
 	double		pages_fetched;
 	double		rand_heap_pages;
 	double		index_pages;
@@ -592,8 +595,16 @@ cost_index(IndexPath *path, PlannerInfo *root, double loop_count,
 	 * We use the measured fraction of the entire heap that is all-visible,
 	 * which might not be particularly relevant to the subset of the heap
 	 * that this query will fetch; but it's not clear how to do better.
+	 *
+	 * A table AM that stores columns separately fetches only the pages of
+	 * the needed columns, and each of those pages holds many more rows than
+	 * a heap page.  So the "table size" in the formulas is the size of the
+	 * needed columns, see estimate_rel_scan_pages().  The index correlation
+	 * then tells how clustered the fetched rows are in the AM's TID order.
 	 *----------
 	 */
+	table_pages = baserel->scan_pages;
+
 	if (loop_count > 1)
 	{
 		/*
@@ -605,7 +616,7 @@ cost_index(IndexPath *path, PlannerInfo *root, double loop_count,
 		 * fetches are random accesses.
 		 */
 		pages_fetched = index_pages_fetched(tuples_fetched * loop_count,
-											baserel->pages,
+											table_pages,
 											(double) index->pages,
 											root);
 
@@ -626,10 +637,10 @@ cost_index(IndexPath *path, PlannerInfo *root, double loop_count,
 		 * where such a plan is actually interesting, only one page would get
 		 * fetched per scan anyway, so it shouldn't matter much.)
 		 */
-		pages_fetched = ceil(indexSelectivity * (double) baserel->pages);
+		pages_fetched = ceil(indexSelectivity * (double) table_pages);
 
 		pages_fetched = index_pages_fetched(pages_fetched * loop_count,
-											baserel->pages,
+											table_pages,
 											(double) index->pages,
 											root);
 
@@ -645,7 +656,7 @@ cost_index(IndexPath *path, PlannerInfo *root, double loop_count,
 		 * interpolate between that and the correlation-derived result.
 		 */
 		pages_fetched = index_pages_fetched(tuples_fetched,
-											baserel->pages,
+											table_pages,
 											(double) index->pages,
 											root);
 
@@ -658,7 +669,7 @@ cost_index(IndexPath *path, PlannerInfo *root, double loop_count,
 		max_IO_cost = pages_fetched * spc_random_page_cost;
 
 		/* min_IO_cost is for the perfectly correlated case (csquared=1) */
-		pages_fetched = ceil(indexSelectivity * (double) baserel->pages);
+		pages_fetched = ceil(indexSelectivity * (double) table_pages);
 
 		if (indexonly)
 			pages_fetched = ceil(pages_fetched * (1.0 - baserel->allvisfrac));
@@ -764,6 +764,30 @@ build_expression_pathkey(PlannerInfo *root,
 	return pathkeys;
 }
 
+/*
+ * build_seqscan_pathkeys
+ *	  Build a pathkeys list that describes the ordering of a non-parallel
+ *	  sequential scan of the given base relation.
+ *
+ * Usually that's NIL, but some table AMs return the rows in the order of a
+ * column, see table_relation_scan_order().  As with index scans, we return
+ * only pathkeys that are useful for merging or for the query's ordering.
+ */
+List *
+build_seqscan_pathkeys(PlannerInfo *root, RelOptInfo *rel)
+{
+	List	   *pathkeys;
+
+	if (rel->scan_order_expr == NULL)
+		return NIL;
+
+	pathkeys = build_expression_pathkey(root, rel->scan_order_expr, NULL,
+										rel->scan_order_opno, rel->relids,
+										false);
+
+	return truncate_useless_pathkeys(root, rel, pathkeys);
+}
+
 /*
  * convert_subquery_pathkeys
  *	  Build a pathkeys list that describes the ordering of a subquery's
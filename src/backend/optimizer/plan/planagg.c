@@ -16,6 +16,10 @@
  * non-optimizable aggregates, there's no point since we'll have to
  * scan all the rows anyway.
  *
+ * It also lets the table's access method compute simple aggregates over
+ * a whole table, like count(*) or max(col), if it can do that without
+ * returning the rows.
+ *
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -29,7 +33,11 @@
 #include "postgres.h"
 
 #include "access/htup_details.h"
+#include "access/sysattr.h"
+#include "access/table.h"
+#include "access/tableam.h"
 #include "catalog/pg_aggregate.h"
+#include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
@@ -44,15 +52,222 @@
 #include "parser/parse_clause.h"
 #include "parser/parsetree.h"
 #include "rewrite/rewriteManip.h"
+#include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
 
+/* Context for preprocess_table_aggregates() and its subroutines */
+typedef struct
+{
+	Index		rtindex;		/* range table index of the table */
+	Relation	rel;			/* the table */
+	Const	   *relid;			/* the table's OID, as a regclass Const */
+} table_aggs_context;
+
 static bool find_minmax_aggs_walker(Node *node, List **context);
 static bool build_minmax_path(PlannerInfo *root, MinMaxAggInfo *mminfo,
 							  Oid eqop, Oid sortop, bool nulls_first);
 static void minmax_qp_callback(PlannerInfo *root, void *extra);
 static Oid	fetch_agg_sort_op(Oid aggfnoid);
+static bool table_aggregate_supported(Aggref *aggref,
+									  table_aggs_context *context,
+									  Var **var_p);
+static bool find_unsupported_agg_walker(Node *node,
+										table_aggs_context *context);
+static Node *replace_table_aggs_mutator(Node *node,
+										table_aggs_context *context);
+
+
+/*
+ * preprocess_table_aggregates - let the table AM compute simple aggregates
+ *
+ * If the query only computes aggregates over a single table, with no WHERE,
+ * GROUP BY or HAVING, and the table's access method can compute all of them
+ * itself, replace them with calls to pg_table_count_rows() (for count(*))
+ * and pg_table_aggregate() (for count, min, max and sum of a single column),
+ * and the table in the jointree with an RTE_RESULT. The query then becomes
+ * a FROM-less SELECT, and no scan is needed.
+ *
+ * The table's RTE stays in the range table, so that the executor still
+ * checks the permissions on it, and the plan is invalidated if it changes.
+ * The functions check the permissions and row security of the current user
+ * again when they're called, so a table that's accessed with another
+ * user's permissions, through a view, is not handled.
+ * The access method computes the same results as the aggregates over a
+ * scan would, and it's expected to do so more cheaply, so we don't cost
+ * this against the regular aggregation paths.
+ *
+ * This should be called by grouping_planner() before
+ * preprocess_minmax_aggregates(), after the targetlist and quals have been
+ * preprocessed.
+ */
+void
+preprocess_table_aggregates(PlannerInfo *root)
+{
+	Query	   *parse = root->parse;
+	FromExpr   *jtnode = parse->jointree;
+	RangeTblRef *rtr;
+	RangeTblEntry *rte;
+	RangeTblEntry *resultrte;
+	table_aggs_context context;
+	bool		supported;
+
+	if (!parse->hasAggs)
+		return;
+
+	/* Reject everything but the simplest case */
+	if (parse->commandType != CMD_SELECT ||
+		parse->groupClause || parse->groupingSets ||
+		parse->hasWindowFuncs || parse->hasTargetSRFs ||
+		parse->hasSubLinks || parse->cteList ||
+		root->hasHavingQual || parse->rowMarks)
+		return;
+
+	if (jtnode->quals != NULL || list_length(jtnode->fromlist) != 1)
+		return;
+	if (!IsA(linitial(jtnode->fromlist), RangeTblRef))
+		return;
+	rtr = linitial_node(RangeTblRef, jtnode->fromlist);
+	rte = planner_rt_fetch(rtr->rtindex, root);
+	if (rte->rtekind != RTE_RELATION ||
+		rte->relkind != RELKIND_RELATION ||
+		rte->inh ||
+		rte->tablesample != NULL ||
+		rte->securityQuals != NIL ||
+		OidIsValid(rte->checkAsUser))
+		return;
+
+	/* We already hold a lock on the table, from the parser or plancache */
+	context.rtindex = rtr->rtindex;
+	context.rel = table_open(rte->relid, NoLock);
+	context.relid = makeConst(REGCLASSOID, -1, InvalidOid, sizeof(Oid),
+							  ObjectIdGetDatum(rte->relid), false, true);
+
+	supported = !find_unsupported_agg_walker((Node *) root->processed_tlist,
+											 &context);
+	table_close(context.rel, NoLock);
+	if (!supported)
+		return;
+
+	root->processed_tlist = (List *)
+		replace_table_aggs_mutator((Node *) root->processed_tlist, &context);
+
+	resultrte = makeNode(RangeTblEntry);
+	resultrte->rtekind = RTE_RESULT;
+	resultrte->eref = makeAlias("*RESULT*", NIL);
+	parse->rtable = lappend(parse->rtable, resultrte);
+	rtr = makeNode(RangeTblRef);
+	rtr->rtindex = list_length(parse->rtable);
+	jtnode->fromlist = list_make1(rtr);
+
+	parse->hasAggs = false;
+}
+
+/*
+ * Can the table AM compute 'aggref' itself? If so, returns the aggregated
+ * column in *var_p, or NULL for count(*).
+ */
+static bool
+table_aggregate_supported(Aggref *aggref, table_aggs_context *context,
+						  Var **var_p)
+{
+	TargetEntry *tle;
+	Var		   *var;
+	TableAggKind kind;
+
+	if (aggref->agglevelsup != 0 ||
+		aggref->aggkind != AGGKIND_NORMAL ||
+		aggref->aggfilter != NULL ||
+		aggref->aggdistinct != NIL ||
+		aggref->aggorder != NIL)
+		return false;
+
+	if (aggref->aggstar)
+	{
+		*var_p = NULL;
+		return aggref->aggfnoid == COUNT_STAR_AGG_OID &&
+			table_relation_supports_count_rows(context->rel);
+	}
+
+	if (list_length(aggref->args) != 1)
+		return false;
+	tle = linitial_node(TargetEntry, aggref->args);
+	if (!IsA(tle->expr, Var))
+		return false;
+	var = (Var *) tle->expr;
+	if (var->varno != context->rtindex || var->varlevelsup != 0)
+		return false;
+	if (var->varattno <= 0 && var->varattno != SelfItemPointerAttributeNumber)
+		return false;
+
+	kind = table_aggregate_kind(aggref->aggfnoid, var->vartype);
+	if (kind == TABLE_AGG_NONE ||
+		!table_relation_supports_aggregate(context->rel, var->varattno, kind))
+		return false;
+
+	*var_p = var;
+	return true;
+}
+
+/*
+ * Returns true if there's an aggregate in the tree that the table AM cannot
+ * compute.
+ */
+static bool
+find_unsupported_agg_walker(Node *node, table_aggs_context *context)
+{
+	if (node == NULL)
+		return false;
+	if (IsA(node, Aggref))
+	{
+		Var		   *var;
+
+		return !table_aggregate_supported((Aggref *) node, context, &var);
+	}
+	Assert(!IsA(node, SubLink));
+	return expression_tree_walker(node, find_unsupported_agg_walker,
+								  (void *) context);
+}
 
+/*
+ * Replace every Aggref with the corresponding pg_table_count_rows() or
+ * pg_table_aggregate() call.
+ */
+static Node *
+replace_table_aggs_mutator(Node *node, table_aggs_context *context)
+{
+	if (node == NULL)
+		return NULL;
+	if (IsA(node, Aggref))
+	{
+		Aggref	   *aggref = (Aggref *) node;
+		Var		   *var;
+		List	   *args;
+
+		if (!table_aggregate_supported(aggref, context, &var))
+			elog(ERROR, "unexpected aggregate %u", aggref->aggfnoid);
+
+		if (var == NULL)
+			return (Node *) makeFuncExpr(F_PG_TABLE_COUNT_ROWS, INT8OID,
+										 list_make1(copyObject(context->relid)),
+										 InvalidOid, InvalidOid,
+										 COERCE_EXPLICIT_CALL);
+
+		args = list_make4(copyObject(context->relid),
+						  makeConst(INT2OID, -1, InvalidOid, sizeof(int16),
+									Int16GetDatum(var->varattno), false, true),
+						  makeConst(REGPROCEDUREOID, -1, InvalidOid,
+									sizeof(Oid),
+									ObjectIdGetDatum(aggref->aggfnoid),
+									false, true),
+						  makeNullConst(aggref->aggtype, -1, InvalidOid));
+		return (Node *) makeFuncExpr(F_PG_TABLE_AGGREGATE, aggref->aggtype,
+									 args, InvalidOid, InvalidOid,
+									 COERCE_EXPLICIT_CALL);
+	}
+	return expression_tree_mutator(node, replace_table_aggs_mutator,
+								   (void *) context);
+}
 
 /*
  * preprocess_minmax_aggregates - preprocess MIN/MAX aggregates
@@ -2011,6 +2011,13 @@ grouping_planner(PlannerInfo *root, bool inheritance_update,
 				parse->hasWindowFuncs = false;
 		}
 
+		/*
+		 * Let the table AM compute whole-table aggregates itself, if
+		 * possible.  This clears parse->hasAggs if it succeeds.
+		 */
+		if (parse->hasAggs)
+			preprocess_table_aggregates(root);
+
 		/*
 		 * Preprocess MIN/MAX aggregates, if any.  Note: be careful about
 		 * adding logic between here and the query_planner() call.  Anything
@@ -939,7 +939,15 @@ create_seqscan_path(PlannerInfo *root, RelOptInfo *rel,
 	pathnode->parallel_aware = parallel_workers > 0 ? true : false;
 	pathnode->parallel_safe = rel->consider_parallel;
 	pathnode->parallel_workers = parallel_workers;
-	pathnode->pathkeys = NIL;	/* seqscan has unordered result */
+
+	/*
+	 * A seqscan has unordered result, unless the table AM returns the rows
+	 * in the order of a column. A parallel scan doesn't.
+	 */
+	if (parallel_workers > 0)
+		pathnode->pathkeys = NIL;
+	else
+		pathnode->pathkeys = build_seqscan_pathkeys(root, rel);
 
 	cost_seqscan(pathnode, root, rel, pathnode->param_info);
 
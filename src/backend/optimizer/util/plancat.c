@@ -52,6 +52,7 @@
 #include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/typcache.h"
 
 /* GUC parameter */
 int			constraint_exclusion = CONSTRAINT_EXCLUSION_PARTITION;
@@ -97,6 +98,7 @@ static void set_baserel_partition_constraint(Relation relation,
  *	pages		number of pages
  *	tuples		number of tuples
  *	rel_parallel_workers user-defined number of parallel workers
+ *	scan_order_expr, scan_order_opno	ordering of a sequential scan, if any
  *
  * Also, add information about the relation's foreign keys to root->fkey_list.
  *
@@ -152,6 +154,34 @@ get_relation_info(PlannerInfo *root, Oid relationObjectId, bool inhparent,
 		estimate_rel_size(relation, rel->attr_widths - rel->min_attr,
 						  &rel->pages, &rel->tuples, &rel->allvisfrac);
 
+	/* refined by estimate_rel_scan_pages(), once we know the needed attrs */
+	rel->scan_pages = rel->pages;
+	rel->scan_decode_cost = 0;
+
+	/* Does a sequential scan return the rows in some useful order? */
+	if (!inhparent)
+	{
+		AttrNumber	attno = table_relation_scan_order(relation);
+
+		if (attno != InvalidAttrNumber)
+		{
+			Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(relation),
+												   attno - 1);
+			TypeCacheEntry *typentry;
+
+			typentry = lookup_type_cache(attr->atttypid, TYPECACHE_LT_OPR);
+			if (OidIsValid(typentry->lt_opr))
+			{
+				rel->scan_order_expr = (Expr *) makeVar(varno, attno,
+														attr->atttypid,
+														attr->atttypmod,
+														attr->attcollation,
+														0);
+				rel->scan_order_opno = typentry->lt_opr;
+			}
+		}
+	}
+
 	/* Retrieve the parallel_workers reloption, or -1 if not set. */
 	rel->rel_parallel_workers = RelationGetParallelWorkers(relation, -1);
 
@@ -1121,6 +1151,47 @@ get_rel_data_width(Relation rel, int32 *attr_widths)
 	return tuple_width;
 }
 
+/*
+ * estimate_rel_scan_pages - estimate # pages read by a seqscan of a table
+ *
+ * For table AMs that store each column separately, a sequential scan reads
+ * only the pages of the columns it needs. So once the rel's targetlist and
+ * restriction clauses are known, ask the AM how many pages that is, and store
+ * it in rel->scan_pages. The AM can also tell what it costs to decode those
+ * columns, which goes to rel->scan_decode_cost. For other AMs,
+ * rel->scan_pages stays equal to rel->pages, as set by get_relation_info(),
+ * and rel->scan_decode_cost stays zero.
+ */
+void
+estimate_rel_scan_pages(PlannerInfo *root, RelOptInfo *rel)
+{
+	RangeTblEntry *rte = planner_rt_fetch(rel->relid, root);
+	Bitmapset  *attrs = NULL;
+	Relation	relation;
+	double		decode_cost;
+	ListCell   *lc;
+
+	if (!rel->leverage_column_projection || rel->pages == 0)
+		return;
+
+	pull_varattnos((Node *) rel->reltarget->exprs, rel->relid, &attrs);
+	foreach(lc, rel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+		pull_varattnos((Node *) rinfo->clause, rel->relid, &attrs);
+	}
+
+	relation = table_open(rte->relid, NoLock);
+	rel->scan_pages = table_relation_estimate_scan_pages(relation, attrs,
+														 rel->pages,
+														 &decode_cost);
+	rel->scan_decode_cost = decode_cost;
+	table_close(relation, NoLock);
+
+	bms_free(attrs);
+}
+
 /*
  * get_relation_data_width
  *
@@ -221,6 +221,10 @@ build_simple_rel(PlannerInfo *root, int relid, RelOptInfo *parent)
 	rel->pages = 0;
 	rel->tuples = 0;
 	rel->allvisfrac = 0;
+	rel->scan_pages = 0;
+	rel->scan_decode_cost = 0;
+	rel->scan_order_expr = NULL;
+	rel->scan_order_opno = InvalidOid;
 	rel->eclass_indexes = NULL;
 	rel->subroot = NULL;
 	rel->subplan_params = NIL;
@@ -633,6 +637,10 @@ build_join_rel(PlannerInfo *root,
 	joinrel->pages = 0;
 	joinrel->tuples = 0;
 	joinrel->allvisfrac = 0;
+	joinrel->scan_pages = 0;
+	joinrel->scan_decode_cost = 0;
+	joinrel->scan_order_expr = NULL;
+	joinrel->scan_order_opno = InvalidOid;
 	joinrel->eclass_indexes = NULL;
 	joinrel->subroot = NULL;
 	joinrel->subplan_params = NIL;
@@ -813,6 +821,10 @@ build_child_join_rel(PlannerInfo *root, RelOptInfo *outer_rel,
 	joinrel->pages = 0;
 	joinrel->tuples = 0;
 	joinrel->allvisfrac = 0;
+	joinrel->scan_pages = 0;
+	joinrel->scan_decode_cost = 0;
+	joinrel->scan_order_expr = NULL;
+	joinrel->scan_order_opno = InvalidOid;
 	joinrel->eclass_indexes = NULL;
 	joinrel->subroot = NULL;
 	joinrel->subplan_params = NIL;
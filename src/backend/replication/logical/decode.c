@@ -34,6 +34,7 @@
 #include "access/xlogreader.h"
 #include "access/xlogrecord.h"
 #include "access/xlogutils.h"
+#include "access/zedstore_wal.h"
 #include "catalog/pg_control.h"
 #include "replication/decode.h"
 #include "replication/logical.h"
@@ -57,6 +58,7 @@ static void DecodeHeap2Op(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeXactOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeStandbyOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeLogicalMsgOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
+static void DecodeZedstoreOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 
 /* individual record(group)'s handlers */
 static void DecodeInsert(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
@@ -130,6 +132,10 @@ LogicalDecodingProcessRecord(LogicalDecodingContext *ctx, XLogReaderState *recor
 			DecodeLogicalMsgOp(ctx, &buf);
 			break;
 
+		case RM_ZEDSTORE_ID:
+			DecodeZedstoreOp(ctx, &buf);
+			break;
+
 			/*
 			 * Rmgrs irrelevant for logical decoding; they describe stuff not
 			 * represented in logical decoding. Add new rmgrs in rmgrlist.h's
@@ -151,7 +157,6 @@ LogicalDecodingProcessRecord(LogicalDecodingContext *ctx, XLogReaderState *recor
 		case RM_COMMIT_TS_ID:
 		case RM_REPLORIGIN_ID:
 		case RM_GENERIC_ID:
-		case RM_ZEDSTORE_ID:
 			/* just deal with xid, and done */
 			ReorderBufferProcessXid(ctx->reorder, XLogRecGetXid(record),
 									buf.origptr);
@@ -553,6 +558,134 @@ DecodeLogicalMsgOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 							  message->message + message->prefix_size);
 }
 
+/*
+ * Handle rmgr ZEDSTORE_ID records for DecodeRecordIntoReorderBuffer().
+ *
+ * Only the WAL_ZEDSTORE_LOGICAL_CHANGE records are interesting; the rest
+ * describe physical changes to zedstore's B-trees, which cannot be turned
+ * into rows.
+ */
+static void
+DecodeZedstoreOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
+{
+	SnapBuild  *builder = ctx->snapshot_builder;
+	XLogReaderState *r = buf->record;
+	TransactionId xid = XLogRecGetXid(r);
+	uint8		info = XLogRecGetInfo(r) & ~XLR_INFO_MASK;
+	wal_zedstore_logical_change *xlrec;
+	char	   *data;
+	char	   *end;
+	int			nchanges;
+	int			i;
+
+	ReorderBufferProcessXid(ctx->reorder, xid, buf->origptr);
+
+	if (info != WAL_ZEDSTORE_LOGICAL_CHANGE)
+		return;
+
+	/*
+	 * If we don't have snapshot or we are just fast-forwarding, there is no
+	 * point in decoding changes.
+	 */
+	if (SnapBuildCurrentState(builder) < SNAPBUILD_FULL_SNAPSHOT ||
+		ctx->fast_forward)
+		return;
+
+	if (!SnapBuildProcessChange(builder, xid, buf->origptr))
+		return;
+
+	xlrec = (wal_zedstore_logical_change *) XLogRecGetData(r);
+
+	/* only interested in our database */
+	if (xlrec->node.dbNode != ctx->slot->data.database)
+		return;
+
+	/* output plugin doesn't look for this origin, no need to queue */
+	if (FilterByOrigin(ctx, XLogRecGetOrigin(r)))
+		return;
+
+	data = (char *) xlrec + SizeOfZSWalLogicalChange;
+	end = (char *) xlrec + XLogRecGetDataLen(r);
+
+	/*
+	 * An insert record carries one new tuple per row. An update carries the
+	 * new tuple, optionally followed by the old key, and a delete carries
+	 * just the optional old key.
+	 */
+	nchanges = (xlrec->action == ZSLOGICAL_INSERT) ? xlrec->ntuples : 1;
+	for (i = 0; i < nchanges; i++)
+	{
+		ReorderBufferChange *change;
+		uint32		newlen;
+		uint32		oldlen = 0;
+		char	   *newdata = NULL;
+		char	   *olddata = NULL;
+
+		change = ReorderBufferGetChange(ctx->reorder);
+		change->origin_id = XLogRecGetOrigin(r);
+		memcpy(&change->data.tp.relnode, &xlrec->node, sizeof(RelFileNode));
+
+		switch (xlrec->action)
+		{
+			case ZSLOGICAL_INSERT:
+				change->action = REORDER_BUFFER_CHANGE_INSERT;
+				memcpy(&newlen, data, sizeof(uint32));
+				newdata = data + sizeof(uint32);
+				data = newdata + newlen;
+				break;
+
+			case ZSLOGICAL_UPDATE:
+				change->action = REORDER_BUFFER_CHANGE_UPDATE;
+				memcpy(&newlen, data, sizeof(uint32));
+				newdata = data + sizeof(uint32);
+				data = newdata + newlen;
+				if (xlrec->flags & ZSLOGICAL_HAS_OLD)
+				{
+					memcpy(&oldlen, data, sizeof(uint32));
+					olddata = data + sizeof(uint32);
+					data = olddata + oldlen;
+				}
+				break;
+
+			case ZSLOGICAL_DELETE:
+				change->action = REORDER_BUFFER_CHANGE_DELETE;
+				if (xlrec->flags & ZSLOGICAL_HAS_OLD)
+				{
+					memcpy(&oldlen, data, sizeof(uint32));
+					olddata = data + sizeof(uint32);
+					data = olddata + oldlen;
+				}
+				break;
+
+			default:
+				elog(ERROR, "unexpected zedstore logical change action: %u",
+					 xlrec->action);
+		}
+
+		if (data > end)
+			elog(ERROR, "zedstore logical change record is truncated");
+
+		if (newdata)
+		{
+			Assert(newlen >= SizeOfHeapHeader);
+			change->data.tp.newtuple =
+				ReorderBufferGetTupleBuf(ctx->reorder, newlen - SizeOfHeapHeader);
+			DecodeXLogTuple(newdata, newlen, change->data.tp.newtuple);
+		}
+		if (olddata)
+		{
+			Assert(oldlen >= SizeOfHeapHeader);
+			change->data.tp.oldtuple =
+				ReorderBufferGetTupleBuf(ctx->reorder, oldlen - SizeOfHeapHeader);
+			DecodeXLogTuple(olddata, oldlen, change->data.tp.oldtuple);
+		}
+
+		change->data.tp.clear_toast_afterwards = true;
+
+		ReorderBufferQueueChange(ctx->reorder, xid, buf->origptr, change);
+	}
+}
+
 /*
  * Consolidated commit record handling between the different form of commit
  * records.
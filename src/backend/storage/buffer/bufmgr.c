@@ -3283,6 +3283,76 @@ FlushRelationBuffers(Relation rel)
 	}
 }
 
+/* ---------------------------------------------------------------------
+ *		FlushRelationBlockRange
+ *
+ *		This function writes out the dirty pages of blocks 'start' to 'end'
+ *		(exclusive) of the relation's main fork, in block number order, and
+ *		schedules writeback of them through the backend's writeback context.
+ *		It's meant for table AMs that fill a range of blocks during a bulk
+ *		load, so that the range reaches the disk as sequential writes, rather
+ *		than later from the checkpointer in whatever order.
+ *
+ *		This is only an optimization: buffers that are locked by someone
+ *		else, including by the caller, are skipped rather than waited for.
+ *		Temporary relations are skipped altogether.
+ * --------------------------------------------------------------------
+ */
+void
+FlushRelationBlockRange(Relation rel, BlockNumber start, BlockNumber end)
+{
+	BlockNumber blkno;
+
+	if (RelationUsesLocalBuffers(rel))
+		return;
+
+	/* Open rel at the smgr level if not already done */
+	RelationOpenSmgr(rel);
+
+	for (blkno = start; blkno < end; blkno++)
+	{
+		BufferTag	tag;
+		uint32		hash;
+		LWLock	   *partitionLock;
+		int			buf_id;
+		BufferDesc *bufHdr;
+		uint32		buf_state;
+
+		INIT_BUFFERTAG(tag, rel->rd_smgr->smgr_rnode.node, MAIN_FORKNUM, blkno);
+		hash = BufTableHashCode(&tag);
+		partitionLock = BufMappingPartitionLock(hash);
+
+		LWLockAcquire(partitionLock, LW_SHARED);
+		buf_id = BufTableLookup(&tag, hash);
+		LWLockRelease(partitionLock);
+		if (buf_id < 0)
+			continue;
+
+		/* Make sure we can handle the pin */
+		ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
+		ReservePrivateRefCountEntry();
+
+		/* Recheck the tag, the buffer might have been evicted meanwhile */
+		bufHdr = GetBufferDescriptor(buf_id);
+		buf_state = LockBufHdr(bufHdr);
+		if (BUFFERTAGS_EQUAL(bufHdr->tag, tag) &&
+			(buf_state & (BM_VALID | BM_DIRTY)) == (BM_VALID | BM_DIRTY))
+		{
+			PinBuffer_Locked(bufHdr);
+			if (LWLockConditionalAcquire(BufferDescriptorGetContentLock(bufHdr),
+										 LW_SHARED))
+			{
+				FlushBuffer(bufHdr, rel->rd_smgr);
+				LWLockRelease(BufferDescriptorGetContentLock(bufHdr));
+				ScheduleBufferTagForWriteback(&BackendWritebackContext, &tag);
+			}
+			UnpinBuffer(bufHdr, true);
+		}
+		else
+			UnlockBufHdr(bufHdr, buf_state);
+	}
+}
+
 /* ---------------------------------------------------------------------
  *		FlushDatabaseBuffers
  *
@@ -3619,6 +3689,33 @@ LockBuffer(Buffer buffer, int mode)
 		elog(ERROR, "unrecognized buffer lock mode: %d", mode);
 }
 
+/*
+ * Like LockBuffer, but report 'wait_event_info' if we have to wait for the
+ * lock, instead of the generic buffer_content wait event. This lets callers
+ * identify the kind of page that is contended. 'mode' must not be
+ * BUFFER_LOCK_UNLOCK.
+ */
+void
+LockBufferWithWaitEvent(Buffer buffer, int mode, uint32 wait_event_info)
+{
+	BufferDesc *buf;
+
+	Assert(BufferIsValid(buffer));
+	if (BufferIsLocal(buffer))
+		return;					/* local buffers need no lock */
+
+	buf = GetBufferDescriptor(buffer - 1);
+
+	if (mode == BUFFER_LOCK_SHARE)
+		LWLockAcquireWithWaitEvent(BufferDescriptorGetContentLock(buf), LW_SHARED,
+								   wait_event_info);
+	else if (mode == BUFFER_LOCK_EXCLUSIVE)
+		LWLockAcquireWithWaitEvent(BufferDescriptorGetContentLock(buf), LW_EXCLUSIVE,
+								   wait_event_info);
+	else
+		elog(ERROR, "unrecognized buffer lock mode: %d", mode);
+}
+
 /*
  * Acquire the content_lock for the buffer, but only if we don't have to wait.
  */
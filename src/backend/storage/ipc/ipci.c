@@ -21,6 +21,9 @@
 #include "access/nbtree.h"
 #include "access/subtrans.h"
 #include "access/twophase.h"
+#include "access/zedstore_decompcache.h"
+#include "access/zedstore_metacache.h"
+#include "access/zedstore_stats.h"
 #include "commands/async.h"
 #include "miscadmin.h"
 #include "pgstat.h"
@@ -147,6 +150,9 @@ CreateSharedMemoryAndSemaphores(void)
 		size = add_size(size, BTreeShmemSize());
 		size = add_size(size, SyncScanShmemSize());
 		size = add_size(size, AsyncShmemSize());
+		size = add_size(size, ZSDecompCacheShmemSize());
+		size = add_size(size, ZSStatsShmemSize());
+		size = add_size(size, ZSMetaCacheShmemSize());
 #ifdef EXEC_BACKEND
 		size = add_size(size, ShmemBackendArraySize());
 #endif
@@ -263,6 +269,9 @@ CreateSharedMemoryAndSemaphores(void)
 	BTreeShmemInit();
 	SyncScanShmemInit();
 	AsyncShmemInit();
+	ZSDecompCacheShmemInit();
+	ZSStatsShmemInit();
+	ZSMetaCacheShmemInit();
 
 #ifdef EXEC_BACKEND
 
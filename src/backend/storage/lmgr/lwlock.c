@@ -522,6 +522,14 @@ RegisterLWLockTranches(void)
 	LWLockRegisterTranche(LWTRANCHE_PARALLEL_APPEND, "parallel_append");
 	LWLockRegisterTranche(LWTRANCHE_PARALLEL_HASH_JOIN, "parallel_hash_join");
 	LWLockRegisterTranche(LWTRANCHE_SXACT, "serializable_xact");
+	LWLockRegisterTranche(LWTRANCHE_ZEDSTORE_DECOMPCACHE, "zedstore_decompcache");
+	LWLockRegisterTranche(LWTRANCHE_ZEDSTORE_STATS, "zedstore_stats");
+	LWLockRegisterTranche(LWTRANCHE_ZEDSTORE_METAPAGE, "zedstore_metapage");
+	LWLockRegisterTranche(LWTRANCHE_ZEDSTORE_UNDO_TAIL, "zedstore_undo_tail");
+	LWLockRegisterTranche(LWTRANCHE_ZEDSTORE_RIGHTMOST_TID_LEAF,
+						  "zedstore_rightmost_tid_leaf");
+	LWLockRegisterTranche(LWTRANCHE_ZEDSTORE_FPM, "zedstore_fpm");
+	LWLockRegisterTranche(LWTRANCHE_ZEDSTORE_METACACHE, "zedstore_metacache");
 
 	/* Register named tranches. */
 	for (i = 0; i < NamedLWLockTrancheRequests; i++)
@@ -1111,15 +1119,14 @@ LWLockDequeueSelf(LWLock *lock)
 }
 
 /*
- * LWLockAcquire - acquire a lightweight lock in the specified mode
- *
- * If the lock is not available, sleep until it is.  Returns true if the lock
- * was available immediately, false if we had to sleep.
+ * Workhorse of LWLockAcquire and LWLockAcquireWithWaitEvent: acquire the lock,
+ * reporting 'wait_event_info' if we have to sleep.
  *
- * Side effect: cancel/die interrupts are held off until lock release.
+ * Returns true if the lock was available immediately, false if we had to
+ * sleep.
  */
-bool
-LWLockAcquire(LWLock *lock, LWLockMode mode)
+static inline bool
+LWLockAcquireCommon(LWLock *lock, LWLockMode mode, uint32 wait_event_info)
 {
 	PGPROC	   *proc = MyProc;
 	bool		result = true;
@@ -1236,7 +1243,7 @@ LWLockAcquire(LWLock *lock, LWLockMode mode)
 		lwstats->block_count++;
 #endif
 
-		LWLockReportWaitStart(lock);
+		pgstat_report_wait_start(wait_event_info);
 		TRACE_POSTGRESQL_LWLOCK_WAIT_START(T_NAME(lock), mode);
 
 		for (;;)
@@ -1283,6 +1290,33 @@ LWLockAcquire(LWLock *lock, LWLockMode mode)
 	return result;
 }
 
+/*
+ * LWLockAcquire - acquire a lightweight lock in the specified mode
+ *
+ * If the lock is not available, sleep until it is.  Returns true if the lock
+ * was available immediately, false if we had to sleep.
+ *
+ * Side effect: cancel/die interrupts are held off until lock release.
+ */
+bool
+LWLockAcquire(LWLock *lock, LWLockMode mode)
+{
+	return LWLockAcquireCommon(lock, mode, PG_WAIT_LWLOCK | lock->tranche);
+}
+
+/*
+ * LWLockAcquireWithWaitEvent - like LWLockAcquire, but report the given
+ * wait event while sleeping, instead of the lock's tranche.
+ *
+ * This lets callers tell apart waits on locks that share a tranche, like
+ * the content locks of buffers that hold a particular kind of page.
+ */
+bool
+LWLockAcquireWithWaitEvent(LWLock *lock, LWLockMode mode, uint32 wait_event_info)
+{
+	return LWLockAcquireCommon(lock, mode, wait_event_info);
+}
+
 /*
  * LWLockConditionalAcquire - acquire a lightweight lock in the specified mode
  *
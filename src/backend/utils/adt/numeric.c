@@ -685,6 +685,175 @@ numeric_is_nan(Numeric num)
 	return NUMERIC_IS_NAN(num);
 }
 
+/*
+ * numeric_to_scaled_int64() -
+ *
+ *	Convert a numeric to an integer holding its value multiplied by
+ *	10^dscale, so 123.45 with dscale 2 becomes 12345. This allows storing
+ *	values of a fixed scale compactly, see zedstore_attstream.c.
+ *
+ *	Only canonical short-format values, as built by make_result(), are
+ *	accepted, for which numeric_from_scaled_int64() reconstructs exactly the
+ *	same bytes. The input is checked rather than trusted, so 'num' needs
+ *	only be a varlena with a 4-byte header. Returns false if the value is
+ *	not in that form, or doesn't fit.
+ */
+bool
+numeric_to_scaled_int64(Numeric num, int64 *result, int *dscale)
+{
+	NumericDigit *digits;
+	int			ndigits;
+	int			weight;
+	int			scale;
+	int			exp;
+	uint64		acc = 0;
+
+	if (VARSIZE(num) < NUMERIC_HDRSZ_SHORT ||
+		(VARSIZE(num) - NUMERIC_HDRSZ_SHORT) % sizeof(NumericDigit) != 0 ||
+		!NUMERIC_IS_SHORT(num))
+		return false;
+
+	digits = NUMERIC_DIGITS(num);
+	ndigits = NUMERIC_NDIGITS(num);
+	weight = NUMERIC_WEIGHT(num);
+	scale = NUMERIC_DSCALE(num);
+	if (scale > NUMERIC_SCALED_INT64_MAX_DSCALE)
+		return false;
+
+	/* no leading or trailing zero digits, and zero is positive */
+	if (ndigits == 0)
+	{
+		if (weight != 0 || NUMERIC_SIGN(num) != NUMERIC_POS)
+			return false;
+	}
+	else if (digits[0] == 0 || digits[ndigits - 1] == 0)
+		return false;
+
+	for (int i = 0; i < ndigits; i++)
+	{
+		if (digits[i] < 0 || digits[i] >= NBASE)
+			return false;
+		if (pg_mul_u64_overflow(acc, NBASE, &acc) ||
+			pg_add_u64_overflow(acc, digits[i], &acc))
+			return false;
+	}
+
+	/*
+	 * 'acc' now holds the value multiplied by NBASE^(ndigits - 1 - weight).
+	 * Rescale it to 10^dscale. Any digits beyond dscale must be zeros.
+	 */
+	exp = scale - (ndigits - 1 - weight) * DEC_DIGITS;
+	for (; exp > 0; exp--)
+	{
+		if (pg_mul_u64_overflow(acc, 10, &acc))
+			return false;
+	}
+	for (; exp < 0; exp++)
+	{
+		if (acc % 10 != 0)
+			return false;
+		acc /= 10;
+	}
+
+	if (acc > (uint64) PG_INT64_MAX)
+		return false;
+
+	*result = (NUMERIC_SIGN(num) == NUMERIC_NEG) ? -(int64) acc : (int64) acc;
+	*dscale = scale;
+	return true;
+}
+
+/*
+ * numeric_from_scaled_int64() -
+ *
+ *	Inverse of numeric_to_scaled_int64(). The numeric is built in 'result',
+ *	which must have room for NUMERIC_SCALED_INT64_MAX_SIZE bytes.
+ */
+void
+numeric_from_scaled_int64(int64 val, int dscale, Numeric result)
+{
+#define SCALED_MAX_DIGITS \
+	((19 + DEC_DIGITS - 1) / DEC_DIGITS + \
+	 (NUMERIC_SCALED_INT64_MAX_DSCALE + DEC_DIGITS - 1) / DEC_DIGITS)
+	NumericDigit digits[SCALED_MAX_DIGITS];
+	int			sign = (val < 0) ? NUMERIC_NEG : NUMERIC_POS;
+	uint64		uval = (val < 0) ? -((uint64) val) : (uint64) val;
+	uint64		pow10 = 1;
+	uint64		ipart;
+	uint64		fpart;
+	int			nfrac = (dscale + DEC_DIGITS - 1) / DEC_DIGITS;
+	int			start = SCALED_MAX_DIGITS;
+	int			end = SCALED_MAX_DIGITS;
+	int			weight = -1;
+	int			n;
+
+	StaticAssertStmt(NUMERIC_SCALED_INT64_MAX_SIZE >=
+					 NUMERIC_HDRSZ_SHORT + SCALED_MAX_DIGITS * sizeof(NumericDigit),
+					 "NUMERIC_SCALED_INT64_MAX_SIZE is too small");
+	Assert(dscale >= 0 && dscale <= NUMERIC_SCALED_INT64_MAX_DSCALE);
+
+	for (int i = 0; i < dscale; i++)
+		pow10 *= 10;
+	ipart = uval / pow10;
+	fpart = uval % pow10;
+
+	/*
+	 * Fractional digits, least significant first. The last one holds the
+	 * remaining 1 to DEC_DIGITS decimal digits, padded with zeros.
+	 */
+	if (nfrac > 0)
+	{
+		int			lastdigits = dscale - (nfrac - 1) * DEC_DIGITS;
+		uint64		lastpow = 1;
+		uint64		pad = 1;
+
+		for (int i = 0; i < lastdigits; i++)
+			lastpow *= 10;
+		for (int i = lastdigits; i < DEC_DIGITS; i++)
+			pad *= 10;
+		digits[--start] = (NumericDigit) ((fpart % lastpow) * pad);
+		fpart /= lastpow;
+		for (int i = 1; i < nfrac; i++)
+		{
+			digits[--start] = (NumericDigit) (fpart % NBASE);
+			fpart /= NBASE;
+		}
+	}
+	while (ipart > 0)
+	{
+		digits[--start] = (NumericDigit) (ipart % NBASE);
+		ipart /= NBASE;
+		weight++;
+	}
+
+	/* truncate leading and trailing zeroes, like make_result() */
+	while (start < end && digits[start] == 0)
+	{
+		start++;
+		weight--;
+	}
+	while (end > start && digits[end - 1] == 0)
+		end--;
+	n = end - start;
+	if (n == 0)
+	{
+		weight = 0;
+		sign = NUMERIC_POS;
+	}
+
+	Assert(NUMERIC_CAN_BE_SHORT(dscale, weight));
+	SET_VARSIZE(result, NUMERIC_HDRSZ_SHORT + n * sizeof(NumericDigit));
+	result->choice.n_short.n_header =
+		(sign == NUMERIC_NEG ? (NUMERIC_SHORT | NUMERIC_SHORT_SIGN_MASK)
+		 : NUMERIC_SHORT)
+		| (dscale << NUMERIC_SHORT_DSCALE_SHIFT)
+		| (weight < 0 ? NUMERIC_SHORT_WEIGHT_SIGN_MASK : 0)
+		| (weight & NUMERIC_SHORT_WEIGHT_MASK);
+	if (n > 0)
+		memcpy(NUMERIC_DIGITS(result), &digits[start], n * sizeof(NumericDigit));
+#undef SCALED_MAX_DIGITS
+}
+
 /*
  * numeric_maximum_size() -
  *
@@ -28,12 +28,15 @@
 
 #include "access/commit_ts.h"
 #include "access/gin.h"
+#include "access/htup_details.h"
 #include "access/rmgr.h"
 #include "access/tableam.h"
 #include "access/transam.h"
 #include "access/twophase.h"
 #include "access/xact.h"
 #include "access/xlog_internal.h"
+#include "access/zedstoream.h"
+#include "access/zedstore_decompcache.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_authid.h"
 #include "commands/async.h"
@@ -1883,6 +1886,16 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"zedstore_load_statistics", PGC_USERSET, QUERY_TUNING_OTHER,
+			gettext_noop("Computes planner statistics while bulk loading zedstore tables."),
+			gettext_noop("Applies to tables created or truncated in the same transaction.")
+		},
+		&zedstore_load_statistics,
+		false,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"jit_debugging_support", PGC_SU_BACKEND, DEVELOPER_OPTIONS,
 			gettext_noop("Register JIT compiled function with debugger."),
@@ -2180,6 +2193,39 @@ static struct config_int ConfigureNamesInt[] =
 		check_temp_buffers, NULL, NULL
 	},
 
+	{
+		{"zedstore_decompressed_cache_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the amount of shared memory used to cache decompressed zedstore attribute data."),
+			gettext_noop("0 disables the cache."),
+			GUC_UNIT_KB
+		},
+		&zedstore_decompressed_cache_size,
+		8192, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zedstore_tuple_buffer_size", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the maximum memory used by each session to buffer rows inserted to zedstore tables."),
+			NULL,
+			GUC_UNIT_KB
+		},
+		&zedstore_tuple_buffer_size,
+		16384, 1024, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zedstore_debug_rootdir_items", PGC_SUSET, DEVELOPER_OPTIONS,
+			gettext_noop("Limits the number of root directory entries kept on the metapage of new zedstore tables."),
+			gettext_noop("0 means as many as fit."),
+			GUC_NOT_IN_SAMPLE
+		},
+		&zedstore_debug_rootdir_items,
+		0, 0, MaxHeapAttributeNumber,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"port", PGC_POSTMASTER, CONN_AUTH_SETTINGS,
 			gettext_noop("Sets the TCP port the server listens on."),
@@ -2994,6 +3040,16 @@ static struct config_int ConfigureNamesInt[] =
 		50, 0, INT_MAX,
 		NULL, NULL, NULL
 	},
+	{
+		{"zedstore_autovacuum_undo_threshold", PGC_SIGHUP, AUTOVACUUM,
+			gettext_noop("Size of the UNDO log of a zedstore table at which autovacuum is asked to trim it."),
+			gettext_noop("0 disables the requests."),
+			GUC_UNIT_BLOCKS
+		},
+		&zedstore_autovacuum_undo_threshold,
+		1024, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
 	{
 		/* see varsup.c for why this is PGC_POSTMASTER not PGC_SIGHUP */
 		{"autovacuum_freeze_max_age", PGC_POSTMASTER, AUTOVACUUM,
@@ -32,6 +32,7 @@ extern bool synchronize_seqscans;
 
 
 struct BulkInsertStateData;
+struct ExplainState;
 struct IndexInfo;
 struct SampleScanState;
 struct TBMIterateResult;
@@ -137,8 +138,23 @@ typedef struct TM_FailureData
 #define TUPLE_LOCK_FLAG_LOCK_UPDATE_IN_PROGRESS	(1 << 0)
 /* Follow update chain and lock latest version of tuple */
 #define TUPLE_LOCK_FLAG_FIND_LAST_VERSION		(1 << 1)
+/* Caller only needs the locked tuple if the update chain was followed */
+#define TUPLE_LOCK_FLAG_FETCH_IF_TRAVERSED		(1 << 2)
 
 
+/*
+ * Aggregates over a single column that a table AM can compute itself, see
+ * table_relation_aggregate().
+ */
+typedef enum TableAggKind
+{
+	TABLE_AGG_NONE,				/* not one of the below */
+	TABLE_AGG_COUNT,			/* count(col): number of non-NULL values */
+	TABLE_AGG_MIN,				/* min(col), by the type's btree order */
+	TABLE_AGG_MAX,				/* max(col), by the type's btree order */
+	TABLE_AGG_SUM				/* sum(col) of an int2 or int4 column */
+} TableAggKind;
+
 /* Typedef for callback function for table_index_build_scan */
 typedef void (*IndexBuildCallback) (Relation index,
 									ItemPointer tid,
@@ -164,6 +180,14 @@ typedef struct TableAmRoutine
 	NodeTag		type;
 	bool scans_leverage_column_projection;
 
+	/*
+	 * Does the AM evaluate the scan keys passed to scan_begin? If so, the
+	 * executor passes simple quals of sequential scans down as scan keys,
+	 * so that the AM can skip non-matching rows early. The executor still
+	 * checks the quals on the returned tuples.
+	 */
+	bool		scans_support_scan_keys;
+
 
 	/* ------------------------------------------------------------------------
 	 * Slot related callbacks.
@@ -231,6 +255,47 @@ typedef struct TableAmRoutine
 									 ScanDirection direction,
 									 TupleTableSlot *slot);
 
+	/*
+	 * Return up to `maxslots` next tuples from `scan`, stored in
+	 * slots[0 .. maxslots - 1]. Returns the number of slots filled, 0 at the
+	 * end of the scan. The contents of all the returned slots must stay valid
+	 * until the next call.
+	 *
+	 * Optional callback; if not provided, the executor fetches tuples one at
+	 * a time with scan_getnextslot. Batches are only requested for scans in
+	 * ForwardScanDirection.
+	 */
+	int			(*scan_getnextbatch) (TableScanDesc scan,
+									  ScanDirection direction,
+									  TupleTableSlot **slots,
+									  int maxslots);
+
+	/*
+	 * Late materialization of columns.
+	 *
+	 * scan_set_deferred_columns is called right after the scan has been begun,
+	 * with a subset of the projected columns. The tuples returned by the scan
+	 * don't need to have valid values for those columns. Once the executor
+	 * has checked the quals, it calls scan_fetch_deferred_columns to fill in
+	 * the deferred columns of the tuple in the slot, which must be the last
+	 * tuple fetched from the scan, or one of the last batch.
+	 *
+	 * Optional callbacks; either both or neither must be provided.
+	 */
+	void		(*scan_set_deferred_columns) (TableScanDesc scan,
+											  Bitmapset *deferred_columns);
+	void		(*scan_fetch_deferred_columns) (TableScanDesc scan,
+												TupleTableSlot *slot);
+
+	/*
+	 * Add AM-specific details about what the scan did to the output of
+	 * EXPLAIN (ANALYZE, STORAGE). Called after the scan has been run, before
+	 * it is ended.
+	 *
+	 * Optional callback.
+	 */
+	void		(*scan_explain) (TableScanDesc scan, struct ExplainState *es);
+
 
 	/* ------------------------------------------------------------------------
 	 * Parallel table scan related functions.
@@ -318,6 +383,39 @@ typedef struct TableAmRoutine
 									  TupleTableSlot *slot,
 									  bool *call_again, bool *all_dead);
 
+	/*
+	 * Fetch the tuples at `tids[0..ntids-1]` into `slots[0..ntids-1]`, like
+	 * calling index_fetch_tuple for each of them in turn. `tids` must be
+	 * sorted in ascending order. found[i] is set to whether a visible tuple
+	 * was found for tids[i]; if not, slots[i] is cleared. There is no
+	 * equivalent of *call_again, so this should only be used with a snapshot
+	 * that sees at most one version of each row, like an MVCC snapshot.
+	 *
+	 * Unlike with index_fetch_tuple, the tuples in the slots must stay valid
+	 * independently of each other, until the slots are cleared.
+	 *
+	 * Optional callback. table_index_fetch_tuples() falls back to calling
+	 * index_fetch_tuple for each TID if it's not provided.
+	 */
+	void		(*index_fetch_tuples) (struct IndexFetchTableData *scan,
+									   ItemPointer tids, int ntids,
+									   Snapshot snapshot,
+									   TupleTableSlot **slots, bool *found);
+
+	/*
+	 * Return true if the tuple at `tid` is known to be visible to all
+	 * transactions, so that an index-only scan can return the index tuple
+	 * without fetching the table tuple. Returning false is always safe.
+	 *
+	 * Optional callback, for AMs that don't use the visibility map. If it's
+	 * not provided, index-only scans check the visibility map. An AM that
+	 * provides it is expected to maintain pg_class.relallvisible in VACUUM,
+	 * as ANALYZE and index builds will not compute it from the visibility
+	 * map.
+	 */
+	bool		(*index_fetch_all_visible) (struct IndexFetchTableData *scan,
+											ItemPointer tid);
+
 
 	/* ------------------------------------------------------------------------
 	 * Callbacks for non-modifying operations on individual tuples
@@ -496,6 +594,19 @@ typedef struct TableAmRoutine
 											  double *tups_vacuumed,
 											  double *tups_recently_dead);
 
+	/*
+	 * See table_relation_begin_column_rewrite() and friends.
+	 *
+	 * Optional callbacks; either all three or none must be provided. AMs
+	 * that store each row in one place have nothing to gain from rewriting
+	 * only some columns, and let ALTER TABLE copy the whole table instead.
+	 */
+	void	   *(*relation_begin_column_rewrite) (Relation rel, int nattrs,
+												  AttrNumber *attnums);
+	void		(*relation_column_rewrite_tuple) (void *state, ItemPointer tid,
+												  Datum *values, bool *isnull);
+	void		(*relation_end_column_rewrite) (void *state);
+
 	/*
 	 * React to VACUUM command on the relation. The VACUUM can be
 	 * triggered by a user or by autovacuum. The specific actions
@@ -536,6 +647,14 @@ typedef struct TableAmRoutine
 											BlockNumber blockno,
 											BufferAccessStrategy bstrategy);
 
+	/*
+	 * See table_scan_analyze_nblocks().
+	 *
+	 * Optional callback, for AMs whose block numbers passed to
+	 * scan_analyze_next_block don't correspond to physical blocks.
+	 */
+	BlockNumber (*scan_analyze_nblocks) (Relation rel);
+
 	/*
 	 * See table_scan_analyze_next_tuple().
 	 *
@@ -550,6 +669,14 @@ typedef struct TableAmRoutine
 											double *deadrows,
 											TupleTableSlot *slot);
 
+	/*
+	 * See table_relation_analyze_done().
+	 *
+	 * Optional callback.
+	 */
+	void		(*relation_analyze_done) (Relation rel, double totalrows,
+										  BufferAccessStrategy bstrategy);
+
 	/* see table_index_build_range_scan for reference about parameters */
 	double		(*index_build_range_scan) (Relation table_rel,
 										   Relation index_rel,
@@ -596,6 +723,26 @@ typedef struct TableAmRoutine
 	 */
 	bool		(*relation_needs_toast_table) (Relation rel);
 
+	/*
+	 * See table_relation_count_rows().
+	 *
+	 * Optional callback. If the AM provides it, the planner computes a plain
+	 * count(*) over the whole table with it, instead of scanning the table.
+	 */
+	uint64		(*relation_count_rows) (Relation rel, Snapshot snapshot);
+
+	/*
+	 * See table_relation_supports_aggregate() and table_relation_aggregate().
+	 *
+	 * Optional callbacks. relation_aggregate must be provided if
+	 * relation_supports_aggregate is.
+	 */
+	bool		(*relation_supports_aggregate) (Relation rel, AttrNumber attnum,
+												TableAggKind kind);
+	Datum		(*relation_aggregate) (Relation rel, Snapshot snapshot,
+									   AttrNumber attnum, TableAggKind kind,
+									   bool *isnull);
+
 
 	/* ------------------------------------------------------------------------
 	 * Planner related functions.
@@ -616,6 +763,32 @@ typedef struct TableAmRoutine
 										   BlockNumber *pages, double *tuples,
 										   double *allvisfrac);
 
+	/*
+	 * See table_relation_estimate_scan_pages().
+	 *
+	 * Optional callback. AMs that always read every page in a sequential
+	 * scan can leave it NULL.
+	 */
+	BlockNumber (*relation_estimate_scan_pages) (Relation rel,
+												 Bitmapset *attrs,
+												 BlockNumber pages,
+												 double *decode_cost);
+
+	/*
+	 * See table_relation_scan_order().
+	 *
+	 * Optional callback. AMs whose sequential scans return the rows in no
+	 * particular order can leave it NULL.
+	 */
+	AttrNumber	(*relation_scan_order) (Relation rel);
+
+	/*
+	 * See table_relation_validate_scan_order().
+	 *
+	 * Optional callback, for AMs that implement relation_scan_order.
+	 */
+	void		(*relation_validate_scan_order) (Relation rel, AttrNumber attnum);
+
 
 	/* ------------------------------------------------------------------------
 	 * Executor related functions.
@@ -639,11 +812,11 @@ typedef struct TableAmRoutine
 	 * on the page have to be returned, otherwise the tuples at offsets in
 	 * `tbmres->offsets` need to be returned.
 	 *
-	 * XXX: Currently this may only be implemented if the AM uses md.c as its
-	 * storage manager, and uses ItemPointer->ip_blkid in a manner that maps
-	 * blockids directly to the underlying storage. nodeBitmapHeapscan.c
-	 * performs prefetching directly using that interface.  This probably
-	 * needs to be rectified at a later point.
+	 * XXX: Unless the AM provides scan_bitmap_prefetch_block, this may only
+	 * be implemented if the AM uses md.c as its storage manager, and uses
+	 * ItemPointer->ip_blkid in a manner that maps blockids directly to the
+	 * underlying storage. nodeBitmapHeapscan.c performs prefetching directly
+	 * using that interface in that case.
 	 *
 	 * XXX: Currently this may only be implemented if the AM uses the
 	 * visibilitymap, as nodeBitmapHeapscan.c unconditionally accesses it to
@@ -671,6 +844,17 @@ typedef struct TableAmRoutine
 										   struct TBMIterateResult *tbmres,
 										   TupleTableSlot *slot);
 
+	/*
+	 * Issue prefetch requests for the storage that a later
+	 * scan_bitmap_next_block call for `blockno` will need to read. This is
+	 * a hint, called ahead of the scan according to effective_io_concurrency.
+	 *
+	 * Optional callback. If it's not provided, nodeBitmapHeapscan.c issues
+	 * PrefetchBuffer for `blockno` of the main fork directly.
+	 */
+	void		(*scan_bitmap_prefetch_block) (TableScanDesc scan,
+											   BlockNumber blockno);
+
 	/*
 	 * Prepare to fetch tuples from the next block in a sample scan. Return
 	 * false if the sample scan is finished, true otherwise. `scan` was
@@ -763,6 +947,12 @@ table_scans_leverage_column_projection(Relation relation)
 	return relation->rd_tableam->scans_leverage_column_projection;
 }
 
+static inline bool
+table_scans_support_scan_keys(Relation relation)
+{
+	return relation->rd_tableam->scans_support_scan_keys;
+}
+
 /*
  * Like table_beginscan(), but for scanning catalog. It'll automatically use a
  * snapshot appropriate for scanning catalog relations.
@@ -858,6 +1048,26 @@ table_beginscan_analyze(Relation rel)
 	return rel->rd_tableam->scan_begin(rel, NULL, 0, NULL, NULL, flags);
 }
 
+/*
+ * table_beginscan_analyze_with_column_projection is like
+ * table_beginscan_analyze, but only the columns in project_columns need to
+ * be filled in the returned tuples, the rest may be returned as NULLs. AMs
+ * that don't leverage column projection return all columns.
+ */
+static inline TableScanDesc
+table_beginscan_analyze_with_column_projection(Relation rel,
+											   Bitmapset *project_columns)
+{
+	uint32		flags = SO_TYPE_ANALYZE;
+
+	if (project_columns == NULL || !rel->rd_tableam->scans_leverage_column_projection)
+		return table_beginscan_analyze(rel);
+
+	return rel->rd_tableam->scan_begin_with_column_projection(rel, NULL, 0, NULL,
+															  NULL, flags,
+															  project_columns);
+}
+
 /*
  * End relation scan.
  */
@@ -909,6 +1119,69 @@ table_scan_getnextslot(TableScanDesc sscan, ScanDirection direction, TupleTableS
 	return sscan->rs_rd->rd_tableam->scan_getnextslot(sscan, direction, slot);
 }
 
+/*
+ * Does the AM support fetching many tuples at a time, with
+ * table_scan_getnextbatch()?
+ */
+static inline bool
+table_scan_supports_batch(Relation relation)
+{
+	return relation->rd_tableam->scan_getnextbatch != NULL;
+}
+
+/*
+ * Does the AM support deferring the fetching of some columns until after
+ * the quals have been checked?
+ */
+static inline bool
+table_scan_supports_deferred_columns(Relation relation)
+{
+	return relation->rd_tableam->scan_set_deferred_columns != NULL;
+}
+
+/*
+ * Tell the scan to leave out `deferred_columns` from the tuples it returns,
+ * until they are requested with table_scan_fetch_deferred_columns().
+ */
+static inline void
+table_scan_set_deferred_columns(TableScanDesc sscan, Bitmapset *deferred_columns)
+{
+	sscan->rs_rd->rd_tableam->scan_set_deferred_columns(sscan, deferred_columns);
+}
+
+/*
+ * Fill in the deferred columns of the tuple in `slot`.
+ */
+static inline void
+table_scan_fetch_deferred_columns(TableScanDesc sscan, TupleTableSlot *slot)
+{
+	sscan->rs_rd->rd_tableam->scan_fetch_deferred_columns(sscan, slot);
+}
+
+/*
+ * Show AM-specific details of the scan in EXPLAIN (ANALYZE, STORAGE) output.
+ * Does nothing if the AM doesn't provide any.
+ */
+static inline void
+table_scan_explain(TableScanDesc sscan, struct ExplainState *es)
+{
+	if (sscan->rs_rd->rd_tableam->scan_explain)
+		sscan->rs_rd->rd_tableam->scan_explain(sscan, es);
+}
+
+/*
+ * Return up to `maxslots` next tuples from `scan`, stored in the slots.
+ * Returns the number of slots filled, 0 at the end of the scan.
+ */
+static inline int
+table_scan_getnextbatch(TableScanDesc sscan, ScanDirection direction,
+						TupleTableSlot **slots, int maxslots)
+{
+	Assert(ScanDirectionIsForward(direction));
+	return sscan->rs_rd->rd_tableam->scan_getnextbatch(sscan, direction,
+													   slots, maxslots);
+}
+
 
 /* ----------------------------------------------------------------------------
  * Parallel table scan related functions.
@@ -1032,6 +1305,45 @@ table_index_fetch_tuple(struct IndexFetchTableData *scan,
 													all_dead);
 }
 
+/*
+ * Does the AM check all-visibility for index-only scans itself, rather than
+ * relying on the visibility map?
+ */
+static inline bool
+table_index_fetch_checks_all_visible(Relation rel)
+{
+	return rel->rd_tableam->index_fetch_all_visible != NULL;
+}
+
+/*
+ * Returns true if the tuple at `tid` is known to be visible to all
+ * transactions. Only valid if table_index_fetch_checks_all_visible().
+ */
+static inline bool
+table_index_fetch_all_visible(struct IndexFetchTableData *scan, ItemPointer tid)
+{
+	return scan->rel->rd_tableam->index_fetch_all_visible(scan, tid);
+}
+
+/*
+ * Does the AM have its own index_fetch_tuples callback, so that fetching
+ * the tuples of an index scan a batch at a time is worth the trouble?
+ */
+static inline bool
+table_index_fetch_supports_batch(Relation relation)
+{
+	return relation->rd_tableam->index_fetch_tuples != NULL;
+}
+
+/*
+ * Fetches, as part of an index scan, the tuples at a sorted array of TIDs.
+ * See the index_fetch_tuples callback for the details.
+ */
+extern void table_index_fetch_tuples(struct IndexFetchTableData *scan,
+									 ItemPointer tids, int ntids,
+									 Snapshot snapshot,
+									 TupleTableSlot **slots, bool *found);
+
 /*
  * This is a convenience wrapper around table_index_fetch_tuple() which
  * returns whether there are table tuple items corresponding to an index
@@ -1322,6 +1634,8 @@ table_tuple_update(Relation rel, ItemPointer otid, TupleTableSlot *slot,
  *		also lock descendant tuples if lock modes don't conflict.
  *		If TUPLE_LOCK_FLAG_FIND_LAST_VERSION, follow the update chain and lock
  *		latest version.
+ *		If TUPLE_LOCK_FLAG_FETCH_IF_TRAVERSED, the caller only looks at *slot
+ *		when tmfd->traversed is set, so the AM may leave it empty otherwise.
  *
  * Output parameters:
  *	*slot: contains the target tuple
@@ -1456,6 +1770,54 @@ table_relation_copy_for_cluster(Relation OldTable, Relation NewTable,
 													tups_recently_dead);
 }
 
+/*
+ * Start replacing the values of columns `attnums` of `rel` in place, as part
+ * of ALTER TABLE ... ALTER COLUMN TYPE or ADD COLUMN with a default that has
+ * to be computed for each row, leaving the other columns and the TIDs of the
+ * rows alone.
+ *
+ * The caller then scans the table, and passes the new values of every row
+ * visible to its snapshot to table_relation_column_rewrite_tuple(), in TID
+ * order. table_relation_end_column_rewrite() makes them replace the old
+ * values, as part of the current transaction. The attributes in the
+ * relation's tuple descriptor already have their new types, and include
+ * the added columns, which have no values stored yet.
+ *
+ * Returns NULL if the AM can't rewrite the columns in place, in which case
+ * the caller has to rewrite the whole table.
+ */
+static inline void *
+table_relation_begin_column_rewrite(Relation rel, int nattrs,
+									AttrNumber *attnums)
+{
+	if (rel->rd_tableam->relation_begin_column_rewrite == NULL)
+		return NULL;
+
+	return rel->rd_tableam->relation_begin_column_rewrite(rel, nattrs, attnums);
+}
+
+/*
+ * Pass the new values of the rewritten columns of the row with TID `tid`,
+ * in the order of the `attnums` given to
+ * table_relation_begin_column_rewrite().
+ */
+static inline void
+table_relation_column_rewrite_tuple(Relation rel, void *state,
+									ItemPointer tid, Datum *values,
+									bool *isnull)
+{
+	rel->rd_tableam->relation_column_rewrite_tuple(state, tid, values, isnull);
+}
+
+/*
+ * Finish a column rewrite started with table_relation_begin_column_rewrite().
+ */
+static inline void
+table_relation_end_column_rewrite(Relation rel, void *state)
+{
+	rel->rd_tableam->relation_end_column_rewrite(state);
+}
+
 /*
  * Perform VACUUM on the relation. The VACUUM can be triggered by a user or by
  * autovacuum. The specific actions performed by the AM will depend heavily on
@@ -1510,6 +1872,19 @@ table_scan_analyze_next_tuple(TableScanDesc scan, TransactionId OldestXmin,
 															slot);
 }
 
+/*
+ * Called by ANALYZE, after sampling the relation, with the estimated total
+ * number of live rows. Lets the AM update size statistics of its own. Not
+ * called when ANALYZE runs as part of VACUUM, which has done that already.
+ */
+static inline void
+table_relation_analyze_done(Relation rel, double totalrows,
+							BufferAccessStrategy bstrategy)
+{
+	if (rel->rd_tableam->relation_analyze_done)
+		rel->rd_tableam->relation_analyze_done(rel, totalrows, bstrategy);
+}
+
 /*
  * table_index_build_scan - scan the table to find tuples to be indexed
  *
@@ -1636,6 +2011,22 @@ table_relation_size(Relation rel, ForkNumber forkNumber)
 	return rel->rd_tableam->relation_size(rel, forkNumber);
 }
 
+/*
+ * table_scan_analyze_nblocks - number of blocks ANALYZE samples from
+ *
+ * This is the valid range of block numbers for
+ * table_scan_analyze_next_block(). It defaults to the physical size of the
+ * relation's main fork.
+ */
+static inline BlockNumber
+table_scan_analyze_nblocks(Relation rel)
+{
+	if (rel->rd_tableam->scan_analyze_nblocks)
+		return rel->rd_tableam->scan_analyze_nblocks(rel);
+
+	return (table_relation_size(rel, MAIN_FORKNUM) + (BLCKSZ - 1)) / BLCKSZ;
+}
+
 /*
  * table_relation_needs_toast_table - does this relation need a toast table?
  */
@@ -1645,6 +2036,64 @@ table_relation_needs_toast_table(Relation rel)
 	return rel->rd_tableam->relation_needs_toast_table(rel);
 }
 
+/*
+ * table_relation_supports_count_rows - can table_relation_count_rows be used?
+ */
+static inline bool
+table_relation_supports_count_rows(Relation rel)
+{
+	return rel->rd_tableam->relation_count_rows != NULL;
+}
+
+/*
+ * table_relation_count_rows - count the rows visible to a snapshot
+ *
+ * This is equivalent to counting the tuples returned by a sequential scan
+ * with the same snapshot, but the AM may be able to do it without forming
+ * the tuples.
+ */
+static inline uint64
+table_relation_count_rows(Relation rel, Snapshot snapshot)
+{
+	Assert(table_relation_supports_count_rows(rel));
+
+	return rel->rd_tableam->relation_count_rows(rel, snapshot);
+}
+
+/*
+ * table_relation_supports_aggregate - can table_relation_aggregate compute
+ * the aggregate 'kind' over column 'attnum'?
+ *
+ * 'attnum' can also be SelfItemPointerAttributeNumber, for min/max of ctid.
+ */
+static inline bool
+table_relation_supports_aggregate(Relation rel, AttrNumber attnum,
+								  TableAggKind kind)
+{
+	if (rel->rd_tableam->relation_supports_aggregate == NULL)
+		return false;
+
+	return rel->rd_tableam->relation_supports_aggregate(rel, attnum, kind);
+}
+
+/*
+ * table_relation_aggregate - compute an aggregate over the rows visible to a
+ * snapshot
+ *
+ * The result is what the corresponding aggregate function would return over
+ * a sequential scan with the same snapshot. A pass-by-reference result is
+ * allocated in the current memory context.
+ */
+static inline Datum
+table_relation_aggregate(Relation rel, Snapshot snapshot, AttrNumber attnum,
+						 TableAggKind kind, bool *isnull)
+{
+	Assert(table_relation_supports_aggregate(rel, attnum, kind));
+
+	return rel->rd_tableam->relation_aggregate(rel, snapshot, attnum, kind,
+											   isnull);
+}
+
 
 /* ----------------------------------------------------------------------------
  * Planner related functionality
@@ -1664,6 +2113,62 @@ table_relation_estimate_size(Relation rel, int32 *attr_widths,
 											allvisfrac);
 }
 
+/*
+ * Estimate the number of pages that a sequential scan reads, if it needs only
+ * the attributes in `attrs`. `attrs` uses the same representation as
+ * pull_varattnos(), and `pages` is the relation size estimated by
+ * table_relation_estimate_size(). AMs that store columns separately can
+ * return less than `pages`.
+ *
+ * `*decode_cost` is set to the extra CPU cost, per tuple, of decoding the
+ * needed attributes from the AM's storage format, e.g. decompressing them.
+ */
+static inline BlockNumber
+table_relation_estimate_scan_pages(Relation rel, Bitmapset *attrs,
+								   BlockNumber pages, double *decode_cost)
+{
+	*decode_cost = 0;
+
+	if (rel->rd_tableam->relation_estimate_scan_pages == NULL)
+		return pages;
+
+	return rel->rd_tableam->relation_estimate_scan_pages(rel, attrs, pages,
+														 decode_cost);
+}
+
+/*
+ * Return the attribute that a non-parallel, forward sequential scan returns
+ * the rows in ascending order of, or InvalidAttrNumber if there is no such
+ * attribute. The order is that of the "<" operator of the attribute type's
+ * default B-tree operator class, and the attribute must not contain NULLs.
+ * The planner uses this to treat a sequential scan as pre-sorted input.
+ */
+static inline AttrNumber
+table_relation_scan_order(Relation rel)
+{
+	if (rel->rd_tableam->relation_scan_order == NULL)
+		return InvalidAttrNumber;
+
+	return rel->rd_tableam->relation_scan_order(rel);
+}
+
+/*
+ * Check that the rows already in the relation are in the order of attribute
+ * 'attnum', if its options now tell the AM to report it as the scan order.
+ * Raises an error if not. Called after the attribute's options have been
+ * changed, with an AccessExclusiveLock on the relation, like the validation
+ * of a new CHECK constraint.
+ */
+static inline void
+table_relation_validate_scan_order(Relation rel, AttrNumber attnum)
+{
+	if (rel->rd_tableam == NULL ||
+		rel->rd_tableam->relation_validate_scan_order == NULL)
+		return;
+
+	rel->rd_tableam->relation_validate_scan_order(rel, attnum);
+}
+
 
 /* ----------------------------------------------------------------------------
  * Executor related functionality
@@ -1705,6 +2210,22 @@ table_scan_bitmap_next_tuple(TableScanDesc scan,
 														   slot);
 }
 
+/*
+ * Prefetch the data that table_scan_bitmap_next_block() will need for
+ * `blockno`, if the AM has a callback for that. Returns false if it
+ * doesn't, in which case the caller may prefetch `blockno` of the main fork
+ * itself.
+ */
+static inline bool
+table_scan_bitmap_prefetch_block(TableScanDesc scan, BlockNumber blockno)
+{
+	if (scan->rs_rd->rd_tableam->scan_bitmap_prefetch_block == NULL)
+		return false;
+
+	scan->rs_rd->rd_tableam->scan_bitmap_prefetch_block(scan, blockno);
+	return true;
+}
+
 /*
  * Prepare to fetch tuples from the next block in a sample scan. Returns false
  * if the sample scan is finished, true otherwise. `scan` needs to have been
@@ -1739,6 +2260,14 @@ table_scan_sample_next_tuple(TableScanDesc scan,
 }
 
 
+/* ----------------------------------------------------------------------------
+ * Helper for the aggregate callbacks, in tableam.c
+ * ----------------------------------------------------------------------------
+ */
+
+extern TableAggKind table_aggregate_kind(Oid aggfnoid, Oid argtype);
+
+
 /* ----------------------------------------------------------------------------
  * Functions to make modifications a bit simpler.
  * ----------------------------------------------------------------------------
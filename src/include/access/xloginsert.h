@@ -37,6 +37,9 @@
 									 * will be skipped) */
 #define REGBUF_KEEP_DATA	0x10	/* include data even if a full-page image
 									 * is taken */
+#define REGBUF_NO_COMPRESS	0x20	/* don't try to compress a full-page
+									 * image, the page has already been
+									 * compressed */
 
 /* prototypes for public functions in xloginsert.c: */
 extern void XLogBeginInsert(void);
@@ -10,7 +10,40 @@
 #ifndef ZEDSTORE_COMPRESSION_H
 #define ZEDSTORE_COMPRESSION_H
 
-extern int zs_compress_destSize(const char *src, char *dst, int *srcSizePtr, int targetDstSize);
-extern void zs_decompress(const char *src, char *dst, int compressedSize, int uncompressedSize);
+#include "access/attnum.h"
+#include "utils/relcache.h"
+
+/*
+ * Compression methods ("codecs") for attribute streams.
+ *
+ * The method used for a compressed attribute stream is recorded in the
+ * stream header, so these values are stored on disk and must not be changed.
+ * ZS_COMPRESSION_DEFAULT is stored in streams written before the method was
+ * recorded; it means the compile-time default, LZ4 if the server was built
+ * with --with-lz4 and pglz otherwise. When writing, DEFAULT is always
+ * resolved to a concrete method first.
+ *
+ * The method is selected per column with the "zedstore_compression"
+ * attribute option:
+ *
+ *	ALTER TABLE foo ALTER COLUMN bar SET (zedstore_compression = pglz);
+ */
+typedef enum ZSCompressionMethod
+{
+	ZS_COMPRESSION_DEFAULT = 0,
+	ZS_COMPRESSION_NONE = 1,
+	ZS_COMPRESSION_PGLZ = 2,
+	ZS_COMPRESSION_LZ4 = 3
+} ZSCompressionMethod;
+
+#define ZS_MAX_COMPRESSION_METHOD	ZS_COMPRESSION_LZ4
+
+extern const char *zs_compression_method_name(ZSCompressionMethod method);
+extern ZSCompressionMethod zs_get_attr_compression_method(Relation rel, AttrNumber attno);
+extern ZSCompressionMethod zs_resolve_compression_method(ZSCompressionMethod method);
+extern bool zs_get_attr_compression_frames(Relation rel, AttrNumber attno);
+
+extern int zs_compress_destSize(ZSCompressionMethod method, const char *src, char *dst, int *srcSizePtr, int targetDstSize);
+extern void zs_decompress(ZSCompressionMethod method, const char *src, char *dst, int compressedSize, int uncompressedSize);
 
 #endif							/* ZEDSTORE_COMPRESSION_H */
@@ -0,0 +1,27 @@
+/*
+ * zedstore_decompcache.h
+ *		Caches of decompressed zedstore attribute streams
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		src/include/access/zedstore_decompcache.h
+ */
+#ifndef ZEDSTORE_DECOMPCACHE_H
+#define ZEDSTORE_DECOMPCACHE_H
+
+#include "storage/buf.h"
+#include "utils/relcache.h"
+
+/* GUC variable, in kB */
+extern int	zedstore_decompressed_cache_size;
+
+extern Size ZSDecompCacheShmemSize(void);
+extern void ZSDecompCacheShmemInit(void);
+
+extern bool zs_decompcache_lookup(Relation rel, Buffer buf, char *dst, int len,
+								  bool local);
+extern void zs_decompcache_insert(Relation rel, Buffer buf, char *src, int len,
+								  bool local);
+
+#endif							/* ZEDSTORE_DECOMPCACHE_H */
@@ -13,15 +13,19 @@
 #include "access/tableam.h"
 #include "access/zedstore_compression.h"
 #include "access/zedstore_tid.h"
+#include "access/zedstore_tidstore.h"
 #include "access/zedstore_undolog.h"
-#include "lib/integerset.h"
+#include "pgstat.h"
+#include "portability/instr_time.h"
 #include "storage/bufmgr.h"
+#include "storage/lwlock.h"
 #include "storage/smgr.h"
 #include "utils/datum.h"
 
 struct zs_pending_undo_op;
 
 #define ZS_META_ATTRIBUTE_NUM 0
+#define ZS_INVALID_ATTRIBUTE_NUM (-1)
 
 #define INVALID_SPECULATIVE_TOKEN 0
 
@@ -56,6 +60,24 @@ typedef struct
 	bool		attbyval;
 } attstream_buffer;
 
+/*
+ * Function to decode one chunk of an attstream. See decode_chunk() in
+ * zedstore_attstream.c.
+ */
+typedef int (*zs_decode_chunk_fn) (bool attbyval, int attlen, zstid *lasttid,
+								   char *chunk, int *num_elems, zstid *tids,
+								   Datum *datums, bool *isnulls);
+
+/*
+ * Start of a chunk in an attstream: its offset in the decoder's buffer, and
+ * the TID that its first TID is relative to.
+ */
+typedef struct
+{
+	int			pos;
+	zstid		prevtid;
+} attstream_chunk_boundary;
+
 /*
  * attstream_decoder is used to unpack an attstream into tids/datums/isnulls.
  */
@@ -64,8 +86,13 @@ typedef struct
 	/* memory context holding the buffer */
 	MemoryContext cxt;
 
-	/* this is for holding decoded element data in the arrays, reset between decoder_attstream_cont calls */
+	/*
+	 * this is for holding decoded element data in the arrays. It is reset
+	 * lazily by the decode functions, once 'tmpcxt_used' bytes (an estimate)
+	 * have been allocated in it since the last reset.
+	 */
 	MemoryContext tmpcxt;
+	int			tmpcxt_used;
 
 	/*
 	 * meta-data of the attribute, so that we don't need to pass these along
@@ -74,19 +101,42 @@ typedef struct
 	int16		attlen;
 	bool		attbyval;
 
-	/* buffer and its allocated size */
+	/* chunk decoder specialized for attlen and attbyval */
+	zs_decode_chunk_fn decode_chunk;
+
+	/*
+	 * buffer and its allocated size. If chunks_buf_borrowed is set, the
+	 * buffer points to memory owned by the caller, and chunks_buf_size is 0.
+	 */
 	char	   *chunks_buf;
 	int			chunks_buf_size;
+	bool		chunks_buf_borrowed;
 
 	/* information about the current attstream in the buffer */
 	int			chunks_len;
 	zstid		firsttid;
 	zstid		lasttid;
 
+	/*
+	 * TID that the first chunk in the buffer is relative to. Zero, unless
+	 * only one frame of a framed stream was loaded.
+	 */
+	zstid		basetid;
+
 	/* next position within the attstream */
 	int			pos;
 	zstid		prevtid;
 
+	/*
+	 * Starts of the chunks that have been passed in the current attstream,
+	 * in order, so that decode_attstream_seek() can go back to an earlier
+	 * chunk without walking the stream again from the beginning. That makes
+	 * a backward scan linear, rather than quadratic, in the number of chunks.
+	 */
+	attstream_chunk_boundary *boundaries;
+	int			num_boundaries;
+	int			max_boundaries;
+
 	/*
 	 * currently decoded batch of elements
 	 */
@@ -96,25 +146,77 @@ typedef struct
 	Datum		datums[DECODER_MAX_ELEMS];
 	bool		isnulls[DECODER_MAX_ELEMS];
 	int			num_elements;
+
+	/* activity counters, for pg_stat_zedstore_columns and EXPLAIN */
+	int64		bytes_compressed;
+	int64		bytes_decompressed;
+	int64		chunks_decoded;
 } attstream_decoder;
 
+/*
+ * Initial size of a decoder's chunk buffer. Large enough for the decompressed
+ * contents of most pages, so that the buffer is allocated once per scan. It
+ * grows geometrically if a larger stream is encountered.
+ */
+#define DECODER_INITIAL_BUF_SIZE	(4 * BLCKSZ)
+
+/*
+ * Size of the block kept in a decoder's tmpcxt across resets, and the
+ * amount of memory allocated in it after which it is reset.
+ */
+#define DECODER_TMPCXT_SIZE			(8 * BLCKSZ)
+#define DECODER_TMPCXT_RESET_SIZE	(DECODER_TMPCXT_SIZE / 2)
+
 /*
  * A ZedStore table contains different kinds of pages, all in the same file.
  *
  * Block 0 is always a metapage. It contains the block numbers of the other
  * data structures stored within the file, like the per-attribute B-trees,
  * and the UNDO log. In addition, if there are overly large datums in the
- * the table, they are chopped into separate "toast" pages.
+ * the table, they are chopped into separate "toast" pages. Size statistics
+ * of the trees, gathered by VACUUM and ANALYZE, are kept on "stats" pages,
+ * and bloom filters of the attribute leaves on "bloom" pages. If the root
+ * directory of a very wide table doesn't fit on the metapage, the rest of it
+ * is stored on "root directory" pages.
  */
 #define	ZS_META_PAGE_ID		0xF083
 #define	ZS_BTREE_PAGE_ID	0xF084
 #define	ZS_UNDO_PAGE_ID		0xF085
 #define	ZS_TOAST_PAGE_ID	0xF086
 #define	ZS_FREE_PAGE_ID		0xF087
+#define	ZS_STATS_PAGE_ID	0xF088
+#define	ZS_BLOOM_PAGE_ID	0xF089
+#define	ZS_ROOTDIR_PAGE_ID	0xF08A
 
 /* flags for zedstore b-tree pages */
 #define ZSBT_ROOT				0x0001
+#define ZSBT_ATTR_SYNOPSIS		0x0002	/* zs_nullcount etc. are valid */
+#define ZSBT_TID_UNDO_SYNOPSIS	0x0004	/* zs_maxval of TID leaf is valid */
+#define ZSBT_ATTR_SUMMARY_PENDING 0x0008	/* summary being gathered, see below */
 
+/*
+ * Attribute leaf pages carry a "synopsis" of the values stored on them, also
+ * known as a zone map: the number of NULLs, and for integer-like types (see
+ * zsbt_attr_synopsis_minmax()), the smallest and largest value, as signed
+ * integers. For other types, zs_minval and zs_maxval are both 0 if there are
+ * any non-NULL values. Either way, if there are no non-NULL values,
+ * zs_minval > zs_maxval. The synopsis is only valid if the ZSBT_ATTR_SYNOPSIS flag is set; pages
+ * initialized by other code than the attribute page routines don't have it.
+ *
+ * The synopsis is kept up-to-date when data is added to a page, but not
+ * narrowed when data is removed, until the page is rewritten. So it covers
+ * all the values on the page, and possibly more.
+ *
+ * The synopsis of the root page covers the whole tree. A root leaf's own
+ * synopsis does that already. An internal root page gets one, a "summary",
+ * from zsbt_attr_summarize() at VACUUM or ANALYZE, with zs_nullcount holding
+ * the number of leaves it was computed from. It is gathered in two steps:
+ * first the root is marked with ZSBT_ATTR_SUMMARY_PENDING and an empty
+ * range, then the leaves are read, and the range is stored if the flag is
+ * still set. Anyone adding values to a leaf that fall outside the root's
+ * range clears both flags, so the summary is only ever too wide, never too
+ * narrow.
+ */
 typedef struct ZSBtreePageOpaque
 {
 	AttrNumber	zs_attno;
@@ -125,7 +227,19 @@ typedef struct ZSBtreePageOpaque
 	uint16		zs_flags;
 
 	uint16		padding1;
+
+	/*
+	 * synopsis of an attribute leaf page. On a TID tree leaf page with
+	 * the ZSBT_TID_UNDO_SYNOPSIS flag, zs_maxval is instead an upper bound
+	 * of the UNDO counters of all items on the page.
+	 */
+	uint32		zs_nullcount;
+	int64		zs_minval;
+	int64		zs_maxval;
+
 	uint16		padding2;
+	uint16		padding3;
+	uint16		padding4;
 
 	uint16		zs_page_id;			/* always ZS_BTREE_PAGE_ID */
 } ZSBtreePageOpaque;
@@ -272,6 +386,66 @@ typedef struct
 #define SizeOfZSAttStreamHeader	offsetof(ZSAttStream, t_payload)
 
 #define ATTSTREAM_COMPRESSED	1
+#define ATTSTREAM_FRAMED		2
+
+/*
+ * For a compressed stream, the compression method (ZSCompressionMethod) is
+ * stored in the second byte of 't_flags'. Zero means the compile-time
+ * default method.
+ */
+#define ATTSTREAM_COMPRESSION_METHOD_SHIFT	8
+#define ATTSTREAM_COMPRESSION_METHOD_MASK	0xFF00
+
+#define ZSAttStreamGetCompressionMethod(stream) \
+	((ZSCompressionMethod) (((stream)->t_flags & ATTSTREAM_COMPRESSION_METHOD_MASK) >> ATTSTREAM_COMPRESSION_METHOD_SHIFT))
+
+/*
+ * A compressed stream can also be divided into frames, which are compressed
+ * separately, so that fetching a single TID only needs to decompress the
+ * frame containing it. That's enabled per column with the
+ * "zedstore_compression_frames" attribute option, and marked with the
+ * ATTSTREAM_FRAMED flag.
+ *
+ * The payload of a framed stream begins with the number of frames, as a
+ * uint32, followed by a ZSAttStreamFrame for each frame, followed by the
+ * compressed frames back to back. Each frame holds about
+ * ZS_ATTSTREAM_FRAME_SIZE bytes of complete chunks, except that the last
+ * frame can end with an incomplete chunk, like an unframed compressed
+ * stream. The first chunk in each frame is relative to the last TID of the
+ * previous frame, as usual, so the frames concatenated form a normal stream.
+ * 't_decompressed_size' and 't_decompressed_bufsize' cover all the frames.
+ *
+ * The frame directory is not aligned, use zs_attstream_get_frame() to read
+ * it.
+ */
+typedef struct ZSAttStreamFrame
+{
+	zstid		lasttid;			/* last TID in this frame */
+	uint32		compressed_size;
+	uint32		decompressed_size;	/* excludes waste at the end */
+} ZSAttStreamFrame;
+
+#define ZS_ATTSTREAM_FRAME_SIZE		(BLCKSZ / 2)
+#define ZS_ATTSTREAM_MAX_FRAMES		32
+
+#define SizeOfZSAttStreamFrameDir(nframes) \
+	(sizeof(uint32) + (nframes) * sizeof(ZSAttStreamFrame))
+
+static inline uint32
+zs_attstream_num_frames(ZSAttStream *attstream)
+{
+	uint32		nframes;
+
+	memcpy(&nframes, attstream->t_payload, sizeof(uint32));
+	return nframes;
+}
+
+static inline void
+zs_attstream_get_frame(ZSAttStream *attstream, int frameno, ZSAttStreamFrame *frame)
+{
+	memcpy(frame, attstream->t_payload + SizeOfZSAttStreamFrameDir(frameno),
+		   sizeof(ZSAttStreamFrame));
+}
 
 
 /*
@@ -325,14 +499,18 @@ typedef struct
  * every item. They are included in 't_num_undo_slots', so the number of UNDO
  * pointers physically stored on an item is actually 't_num_undo_slots - 2'.
  *
- * With the 4 UNDO slots, we can represent an UNDO pointer using a 2-bit
- * slot number. If you update a tuple with a new UNDO pointer, and all four
- * slots are already in use, the item needs to be split. Hopefully that doesn't
- * happen too often (see assumptions above).
+ * With 4 UNDO slots, we can represent an UNDO pointer using a 2-bit slot
+ * number. Under concurrent updates to nearby rows, an item can need more
+ * distinct UNDO pointers than that, and splitting it every time would
+ * fragment the page into many tiny items. So an item can have up to 16
+ * slots, in which case the slot numbers are 4 bits wide instead. The width
+ * follows from 't_num_undo_slots', so it doesn't need to be stored
+ * separately. If you update a tuple with a new UNDO pointer, and all 16
+ * slots are already in use, the item needs to be split.
  *
  * After the UNDO slots come "UNDO slotwords". The slotwords contain the slot
  * number of each tuple in the item. The slot numbers are packed in 64 bit
- * integers, with 2 bits for each tuple.
+ * integers, with 2 or 4 bits for each tuple.
  *
  * Representing UNDO pointers as distinct slots also has the advantage that
  * when we're scanning the TID array, we can check the few UNDO pointers in
@@ -362,13 +540,19 @@ typedef struct
 } ZSTidArrayItem;
 
 /*
- * We use 2 bits for the UNDO slot number for every tuple. We can therefore
- * fit 32 slot numbers in each 64-bit "slotword".
+ * We use 2 bits for the UNDO slot number for every tuple, if the item has at
+ * most 4 UNDO slots, and 4 bits otherwise. We can therefore fit 32 or 16 slot
+ * numbers in each 64-bit "slotword".
  */
-#define ZSBT_ITEM_UNDO_SLOT_BITS	2
-#define ZSBT_MAX_ITEM_UNDO_SLOTS	(1 << (ZSBT_ITEM_UNDO_SLOT_BITS))
-#define ZSBT_ITEM_UNDO_SLOT_MASK	(ZSBT_MAX_ITEM_UNDO_SLOTS - 1)
-#define ZSBT_SLOTNOS_PER_WORD		(64 / ZSBT_ITEM_UNDO_SLOT_BITS)
+#define ZSBT_NARROW_UNDO_SLOT_BITS	2
+#define ZSBT_WIDE_UNDO_SLOT_BITS	4
+#define ZSBT_MAX_NARROW_UNDO_SLOTS	(1 << (ZSBT_NARROW_UNDO_SLOT_BITS))
+#define ZSBT_MAX_ITEM_UNDO_SLOTS	(1 << (ZSBT_WIDE_UNDO_SLOT_BITS))
+
+/* Width of the slot numbers, and slot numbers per slotword, in an item */
+#define ZSBT_UNDO_SLOT_BITS(num_undo_slots) \
+	((num_undo_slots) <= ZSBT_MAX_NARROW_UNDO_SLOTS ? ZSBT_NARROW_UNDO_SLOT_BITS : ZSBT_WIDE_UNDO_SLOT_BITS)
+#define ZSBT_SLOTNOS_PER_WORD(num_undo_slots) (64 / ZSBT_UNDO_SLOT_BITS(num_undo_slots))
 
 /*
  * To keep the item size and time needed to work with them reasonable,
@@ -381,8 +565,9 @@ typedef struct
 #define ZSBT_DEAD_UNDO_SLOT			1
 #define ZSBT_FIRST_NORMAL_UNDO_SLOT	2
 
-/* Number of UNDO slotwords needed for a given number of tuples */
-#define ZSBT_NUM_SLOTWORDS(num_tids) ((num_tids + ZSBT_SLOTNOS_PER_WORD - 1) / ZSBT_SLOTNOS_PER_WORD)
+/* Number of UNDO slotwords needed for a given number of tuples and slots */
+#define ZSBT_NUM_SLOTWORDS(num_tids, num_undo_slots) \
+	(((num_tids) + ZSBT_SLOTNOS_PER_WORD(num_undo_slots) - 1) / ZSBT_SLOTNOS_PER_WORD(num_undo_slots))
 
 static inline size_t
 SizeOfZSTidArrayItem(int num_tids, int num_undo_slots, int num_codewords)
@@ -392,7 +577,7 @@ SizeOfZSTidArrayItem(int num_tids, int num_undo_slots, int num_codewords)
 	sz = offsetof(ZSTidArrayItem, t_payload);
 	sz += num_codewords * sizeof(uint64);
 	sz += (num_undo_slots - ZSBT_FIRST_NORMAL_UNDO_SLOT) * sizeof(ZSUndoRecPtr);
-	sz += ZSBT_NUM_SLOTWORDS(num_tids) * sizeof(uint64);
+	sz += ZSBT_NUM_SLOTWORDS(num_tids, num_undo_slots) * sizeof(uint64);
 
 	return sz;
 }
@@ -422,6 +607,11 @@ ZSTidArrayItemDecode(ZSTidArrayItem *item, uint64 **codewords,
  * When an overly large datum is stored, it is divided into chunks, and each
  * chunk is stored on a dedicated toast page. The toast pages of a datum form
  * list, each page has a next/prev pointer.
+ *
+ * The pages of a large datum are allocated as one contiguous range of new
+ * blocks. That's marked with the ZSTOAST_CONTIGUOUS flag on the first page,
+ * and allows reading the chain with readahead. The pages still have the
+ * next/prev pointers, so that code that walks the chain needn't care.
  */
 /*
  * Maximum size of an individual untoasted Datum stored in ZedStore. Datums
@@ -433,6 +623,12 @@ ZSTidArrayItemDecode(ZSTidArrayItem *item, uint64 **codewords,
  */
 #define		MaxZedStoreDatumSize		(BLCKSZ - 500)
 
+/*
+ * By default, datums up to MaxZedStoreDatumSize are stored inline. The
+ * "zedstore_toast_threshold" attribute option can lower that, see
+ * zedstore_toast_threshold().
+ */
+
 typedef struct ZSToastPageOpaque
 {
 	AttrNumber	zs_attno;
@@ -447,11 +643,21 @@ typedef struct ZSToastPageOpaque
 	BlockNumber	zs_prev;
 	BlockNumber	zs_next;
 	uint16		zs_flags;
-	uint16		padding1;			/* padding, to put zs_page_id last */
+	uint16		zs_compression;		/* only set on the first page, see below */
 	uint16		padding2;			/* padding, to put zs_page_id last */
 	uint16		zs_page_id;
 } ZSToastPageOpaque;
 
+/*
+ * If zs_is_compressed is set, zs_compression tells the format of the data.
+ * ZS_COMPRESSION_DEFAULT means a pglz-compressed datum in the regular TOAST
+ * format, without the varlena header. Other values mean raw data compressed
+ * with that zedstore codec, see zedstore_compression.h.
+ */
+
+/* flags for zedstore toast pages */
+#define ZSTOAST_CONTIGUOUS		0x0001		/* chain is in consecutive blocks */
+
 /*
  * "Toast pointer" of a datum that's stored in zedstore toast pages.
  *
@@ -520,7 +726,20 @@ zs_datumCopy(Datum value, bool typByVal, int typLen)
 #define ZS_META_BLK		0
 
 /*
- * The metapage stores one of these for each attribute.
+ * Wait events reported while waiting for the locks that many backends
+ * compete for: the metapage, the active UNDO pages, the rightmost leaf of
+ * the TID tree, where new rows go, and the Free Page Map. They are reported
+ * as LWLock waits in their own tranches, instead of as buffer_content, so
+ * that pg_stat_activity shows which one is contended.
+ */
+#define ZS_WAIT_METAPAGE		(PG_WAIT_LWLOCK | LWTRANCHE_ZEDSTORE_METAPAGE)
+#define ZS_WAIT_UNDO_TAIL		(PG_WAIT_LWLOCK | LWTRANCHE_ZEDSTORE_UNDO_TAIL)
+#define ZS_WAIT_RIGHTMOST_TID_LEAF	(PG_WAIT_LWLOCK | LWTRANCHE_ZEDSTORE_RIGHTMOST_TID_LEAF)
+#define ZS_WAIT_FPM				(PG_WAIT_LWLOCK | LWTRANCHE_ZEDSTORE_FPM)
+
+/*
+ * The metapage stores one of these for each attribute, see also
+ * ZSMetaPageMaxRootDirItems.
  */
 typedef struct ZSRootDirItem
 {
@@ -533,6 +752,205 @@ typedef struct ZSMetaPage
 	ZSRootDirItem tree_root_dir[FLEXIBLE_ARRAY_MEMBER];	/* one for each attribute */
 } ZSMetaPage;
 
+/*
+ * Size statistics of each tree, for the planner.
+ *
+ * They don't fit on the metapage next to the root directory, for tables with
+ * many attributes, so they are stored on a chain of stats pages, starting
+ * from 'zs_stats_head' in the metapage. Each stats page holds a
+ * ZSStatsPageHeader, followed by ZSTreeStats entries for consecutive
+ * attribute numbers, starting from 'zs_firstattno'. The entry for
+ * ZS_META_ATTRIBUTE_NUM is the TID tree.
+ *
+ * VACUUM and ANALYZE rewrite all the stats pages, see zsmeta_update_stats().
+ * The byte and TID counts are extrapolated from a sample of the leaf pages,
+ * the page counts are exact, as of the time they were gathered.
+ *
+ * 'zs_leaf_raw_bytes' is the size of the leaf data once decompressed, i.e.
+ * the size of the decompressed attribute streams, or of the TIDs decoded
+ * from the TID array items. Together with 'zs_leaf_bytes', it gives the
+ * compression ratio of the tree. In the TID tree, 'zs_leaf_tids' and
+ * 'zs_leaf_tid_span' give the density of the TIDs: the fraction of TIDs in
+ * the ranges covered by the TID array items that are still in use.
+ *
+ * 'zs_bloom_head' is the first page of the chain of bloom filters of the
+ * attribute's leaves, if it has any, see ZSBloomEntry.
+ */
+typedef struct ZSTreeStats
+{
+	BlockNumber zs_leaf_pages;
+	BlockNumber zs_total_pages;		/* leaf and internal pages */
+	uint64		zs_leaf_bytes;		/* data bytes on the leaf pages */
+	uint64		zs_leaf_raw_bytes;	/* same, decompressed */
+	uint64		zs_leaf_tids;		/* # of TIDs on the leaves (TID tree only) */
+	uint64		zs_leaf_tid_span;	/* # of TIDs covered by the items (ditto) */
+	BlockNumber zs_bloom_head;		/* first bloom page, or InvalidBlockNumber */
+} ZSTreeStats;
+
+/*
+ * Physical layout of a tree, as measured by zsbt_tree_fragmentation(). The
+ * byte counts are from a sample of the leaf pages, 'sampled_pages' of them.
+ */
+typedef struct ZSTreeFragmentation
+{
+	int64		leaf_pages;
+	int64		leaf_runs;			/* runs of leaves in consecutive blocks */
+	int64		sampled_pages;
+	int64		used_bytes;			/* data on the sampled leaves */
+	int64		free_bytes;			/* free space on the sampled leaves */
+	int64		compressed_bytes;	/* compressed streams on them */
+	int64		uncompressed_bytes; /* other data on them */
+} ZSTreeFragmentation;
+
+typedef struct ZSStatsPageHeader
+{
+	int32		zs_firstattno;
+	int32		zs_nattributes;		/* # of ZSTreeStats on this page */
+	BlockNumber zs_relpages;		/* size of the relation, when gathered */
+	uint32		zs_format;			/* ZS_STATS_FORMAT, when gathered */
+	double		zs_reltuples;		/* # of live rows, when gathered */
+} ZSStatsPageHeader;
+
+/*
+ * Stats pages written with a different layout of ZSTreeStats are ignored,
+ * until the next VACUUM or ANALYZE rewrites them.
+ */
+#define ZS_STATS_FORMAT		2
+
+typedef struct ZSStatsPageOpaque
+{
+	BlockNumber zs_next;
+	uint16		zs_flags;
+	uint16		zs_page_id;			/* ZS_STATS_PAGE_ID */
+} ZSStatsPageOpaque;
+
+#define ZSStatsPageGetItems(page) \
+	((ZSTreeStats *) (PageGetContents(page) + MAXALIGN(sizeof(ZSStatsPageHeader))))
+#define ZSStatsPageMaxItems \
+	((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(ZSStatsPageHeader)) - \
+	  MAXALIGN(sizeof(ZSStatsPageOpaque))) / sizeof(ZSTreeStats))
+
+/*
+ * In-memory copy of the statistics, returned by zsmeta_read_stats() and
+ * zsmeta_get_cached_stats()
+ */
+typedef struct ZSRelStats
+{
+	BlockNumber relpages;
+	double		reltuples;
+	int			nattributes;
+	ZSTreeStats trees[FLEXIBLE_ARRAY_MEMBER];
+} ZSRelStats;
+
+/*
+ * Bloom filters of attribute leaves.
+ *
+ * For columns marked with the "zedstore_bloom" attribute option, VACUUM and
+ * ANALYZE build a small bloom filter over the values on each leaf page, so
+ * that a scan with an equality key can skip the leaves that cannot contain
+ * the value, without decompressing them. The filters are stored on a chain
+ * of bloom pages, one chain per attribute, with one ZSBloomEntry for each
+ * leaf, in TID order. An entry is only valid as long as the leaf's LSN
+ * hasn't changed, so the filters are never updated in place; a leaf that
+ * has been modified since the filters were built simply can't be skipped.
+ * That relies on the leaves being WAL-logged, so there are no filters for
+ * relations that don't need WAL.
+ *
+ * 'nbytes' is the size of the filter, a power of two, or 0 if the leaf has
+ * values that can't be hashed without fetching them, i.e. zedstore-toasted
+ * datums.
+ */
+typedef struct ZSBloomEntry
+{
+	zstid		lokey;				/* zs_lokey of the leaf */
+	XLogRecPtr	leaflsn;			/* LSN of the leaf, when the filter was built */
+	BlockNumber leafblk;
+	uint16		nbytes;
+	uint16		padding;
+	uint8		bits[FLEXIBLE_ARRAY_MEMBER];
+} ZSBloomEntry;
+
+#define ZSBloomEntrySize(nbytes) MAXALIGN(offsetof(ZSBloomEntry, bits) + (nbytes))
+
+/* limits on the size of a filter, and bits set per value */
+#define ZS_BLOOM_MIN_BYTES		64
+#define ZS_BLOOM_MAX_BYTES		1024
+#define ZS_BLOOM_NHASHES		3
+
+typedef struct ZSBloomPageOpaque
+{
+	BlockNumber zs_next;
+	AttrNumber	zs_attno;
+	uint16		zs_flags;
+	uint16		padding1;
+	uint16		padding2;
+	uint16		padding3;			/* padding, to put zs_page_id last */
+	uint16		zs_page_id;			/* ZS_BLOOM_PAGE_ID */
+} ZSBloomPageOpaque;
+
+/* Lockstep reader of a bloom page chain, see zsbloom_begin_read() */
+typedef struct ZSBloomReader
+{
+	Relation	rel;
+	AttrNumber	attno;
+	BlockNumber next;				/* next page in the chain */
+	char	   *page;				/* copy of the current page */
+	int			off;				/* next entry on 'page' */
+	int			end;
+	zstid		lastkey;			/* lokey of the last entry seen */
+	bool		valid;				/* false if the chain was exhausted */
+} ZSBloomReader;
+
+/*
+ * When the relation is extended to allocate new B-tree or TOAST pages, it's
+ * extended by a whole extent of blocks at a time. The rest of the extent is
+ * reserved for later allocations for the same attribute, so that the pages
+ * of each attribute tree are mostly contiguous on disk, and sequential scans
+ * of a single column can benefit from OS readahead. Attributes are mapped to
+ * one of the extent slots in the metapage by attribute number, modulo
+ * ZS_FPM_EXTENT_SLOTS.
+ *
+ * 'next' is the next unused block in the extent, and 'end' is the end of the
+ * extent (exclusive). next == end means that the slot is empty.
+ */
+#define ZS_FPM_EXTENT_SLOTS		16
+
+/*
+ * UNDO pages have an extent slot of their own, after the attribute slots,
+ * so that the UNDO log is appended to contiguous ranges of blocks, and
+ * doesn't get interleaved with the attribute trees.
+ */
+#define ZS_FPM_UNDO_EXTENT_SLOT	ZS_FPM_EXTENT_SLOTS
+
+/*
+ * Number of UNDO pages that can be inserted to concurrently, see
+ * ZSMetaPageOpaque.zs_undo_active.
+ */
+#define ZS_UNDO_ACTIVE_PAGES	8
+
+typedef struct ZSFpmExtent
+{
+	BlockNumber next;
+	BlockNumber end;
+} ZSFpmExtent;
+
+/*
+ * ALTER COLUMN TYPE can rewrite a column into a new B-tree, leaving the other
+ * columns alone. Until VACUUM folds it into the root directory, the new tree
+ * is recorded in one of these slots on the metapage. The rewriting
+ * transaction 'xid' sees the new tree right away, and everyone else once it
+ * has committed. If it aborts, the old tree in the root directory stays. An
+ * unused slot has attno == InvalidAttrNumber.
+ */
+#define ZS_MAX_PENDING_REWRITES	8
+
+typedef struct ZSPendingRewrite
+{
+	AttrNumber	attno;
+	BlockNumber root;
+	TransactionId xid;
+} ZSPendingRewrite;
+
 /*
  * it's not clear what we should store in the "opaque" special area, and what
  * as page contents, on a metapage. But have at least the page_id field here,
@@ -556,6 +974,15 @@ typedef struct ZSMetaPageOpaque
 	BlockNumber	zs_undo_tail;
 	uint64		zs_undo_tail_first_counter;
 
+	/*
+	 * UNDO pages that new records are currently being inserted to. Each
+	 * backend uses one of these, chosen by its PGPROC number, so that
+	 * concurrent writers don't all serialize on a single tail page. Every
+	 * active page is part of the chain from 'zs_undo_head', and
+	 * 'zs_undo_tail' is always one of them, unless the log is empty.
+	 */
+	BlockNumber	zs_undo_active[ZS_UNDO_ACTIVE_PAGES];
+
 	/*
 	 * Oldest UNDO record that is still needed. Anything older than this can
 	 * be discarded, and considered as visible to everyone.
@@ -563,11 +990,65 @@ typedef struct ZSMetaPageOpaque
 	ZSUndoRecPtr zs_undo_oldestptr;
 
 	BlockNumber zs_fpm_head;		/* head of the Free Page Map list */
+	BlockNumber zs_undo_fpm_head;	/* head of the list of free UNDO pages */
+
+	/*
+	 * extents of never-used blocks, reserved for groups of B-trees, and
+	 * for the UNDO log
+	 */
+	ZSFpmExtent	zs_extents[ZS_FPM_EXTENT_SLOTS + 1];
+
+	BlockNumber zs_stats_head;		/* first stats page, see ZSTreeStats */
+	BlockNumber zs_rootdir_head;	/* first root directory overflow page */
+	uint16		zs_rootdir_nitems;	/* root directory entries on the metapage */
+
+	ZSPendingRewrite zs_rewrites[ZS_MAX_PENDING_REWRITES];
 
 	uint16		zs_flags;
 	uint16		zs_page_id;
 } ZSMetaPageOpaque;
 
+/*
+ * Number of root directory entries that fit on the metapage. With the
+ * default block size, that's more than MaxHeapAttributeNumber, but with
+ * smaller blocks, the entries of the higher-numbered attributes overflow to
+ * a chain of root directory pages. 'zs_rootdir_nitems' in the metapage says
+ * how many entries are kept on the metapage; it's ZSMetaPageMaxRootDirItems,
+ * unless zedstore_debug_rootdir_items was set when the metapage was
+ * initialized. The chain starts from 'zs_rootdir_head' in the metapage.
+ * Each overflow page holds a ZSRootDirPageHeader, followed by
+ * ZSRootDirPageMaxItems entries, for consecutive attribute numbers starting
+ * from 'zs_firstattno'. New overflow pages are added to the head of the
+ * chain, so the chain is in descending attribute number order. All the
+ * entries on an overflow page are initialized when the page is added, and
+ * 'nattributes' on the metapage says how many of them are in use.
+ *
+ * The overflow pages are protected by the metapage lock: they are only
+ * locked while holding a lock on the metapage, and only modified while
+ * holding it in exclusive mode.
+ */
+#define ZSMetaPageMaxRootDirItems \
+	((int) ((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - offsetof(ZSMetaPage, tree_root_dir) - \
+			 MAXALIGN(sizeof(ZSMetaPageOpaque))) / sizeof(ZSRootDirItem)))
+
+typedef struct ZSRootDirPageHeader
+{
+	int32		zs_firstattno;
+} ZSRootDirPageHeader;
+
+typedef struct ZSRootDirPageOpaque
+{
+	BlockNumber zs_next;
+	uint16		zs_flags;
+	uint16		zs_page_id;			/* ZS_ROOTDIR_PAGE_ID */
+} ZSRootDirPageOpaque;
+
+#define ZSRootDirPageGetItems(page) \
+	((ZSRootDirItem *) (PageGetContents(page) + MAXALIGN(sizeof(ZSRootDirPageHeader))))
+#define ZSRootDirPageMaxItems \
+	((int) ((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(ZSRootDirPageHeader)) - \
+			 MAXALIGN(sizeof(ZSRootDirPageOpaque))) / sizeof(ZSRootDirItem)))
+
 /*
  * Codes populated by zs_SatisfiesNonVacuumable. This has minimum values
  * defined based on what's needed. Heap equivalent has more states.
@@ -595,6 +1076,25 @@ static const ZSUndoSlotVisibility InvalidUndoSlotVisibility = {
 	.nonvacuumable_status = ZSNV_NONE
 };
 
+/*
+ * Memo of the visibility of recently seen UNDO pointers in an MVCC scan.
+ *
+ * Bulk loads create one UNDO record for many items, often spanning many
+ * pages, so a scan over freshly loaded data sees the same UNDO pointers over
+ * and over. This remembers the result of zs_SatisfiesVisibility() for them,
+ * so that the UNDO chain is only followed once for each. It's a direct-mapped
+ * table, indexed by the UNDO counter.
+ */
+#define ZS_VISIBILITY_MEMO_SIZE		64
+
+typedef struct ZSUndoVisibilityMemo
+{
+	ZSUndoRecPtr undoptr;			/* InvalidUndoPtr if not in use */
+	bool		visible;
+	TransactionId obsoleting_xid;
+	ZSUndoSlotVisibility visi_info;
+} ZSUndoVisibilityMemo;
+
 typedef struct ZSTidItemIterator
 {
 	int			tids_allocated_size;
@@ -607,6 +1107,9 @@ typedef struct ZSTidItemIterator
 	ZSUndoSlotVisibility undoslot_visibility[ZSBT_MAX_ITEM_UNDO_SLOTS];
 } ZSTidItemIterator;
 
+/* max number of UNDO pointers a TID tree scan collects for pruning */
+#define ZS_MAX_PRUNABLE_UNDOPTRS	8
+
 /*
  * Holds the state of an in-progress scan on a zedstore Tid tree.
  */
@@ -627,6 +1130,13 @@ typedef struct ZSTidTreeScan
 	OffsetNumber lastoff;
 	Snapshot	snapshot;
 
+	/* buffer access strategy for reading pages, or NULL for default */
+	BufferAccessStrategy strategy;
+
+	/* read-ahead of leaf pages, like in ZSAttrTreeScan */
+	bool		prefetch;
+	zstid		prefetch_trigger;
+
 	/*
 	 * starttid and endtid define a range of TIDs to scan. currtid is the previous
 	 * TID that was returned from the scan. They determine what zsbt_tid_scan_next()
@@ -639,10 +1149,28 @@ typedef struct ZSTidTreeScan
 	/* in the "real" UNDO-log, this would probably be a global variable */
 	ZSUndoRecPtr recent_oldest_undo;
 
+	/* visibility of recently seen UNDO pointers, for MVCC snapshots */
+	ZSUndoVisibilityMemo visi_memo[ZS_VISIBILITY_MEMO_SIZE];
+
 	/* should this scan do predicate locking? Or check for conflicts? */
 	bool		serializable;
 	bool		acquire_predicate_tuple_locks;
 
+	/*
+	 * visibility checks that had to look at the UNDO log, for EXPLAIN and
+	 * the undo_scans counter of pg_stat_zedstore_undo
+	 */
+	int64		undo_lookups;
+
+	/*
+	 * UNDO pointers of deletions that are visible to everyone, seen on the
+	 * current TID leaf by an MVCC scan. The TIDs that point to them are
+	 * marked dead when the scan moves off the page, so that later scans
+	 * don't need to look them up in the UNDO log again.
+	 */
+	int			num_prunable;
+	ZSUndoRecPtr prunable[ZS_MAX_PRUNABLE_UNDOPTRS];
+
 	/*
 	 * These fields are used, when the scan is processing an array item.
 	 */
@@ -685,6 +1213,29 @@ typedef struct ZSAttrTreeScan
 	Buffer		lastbuf;
 	OffsetNumber lastoff;
 
+	/*
+	 * Has the first fetch set up the decoder, 'cold_strategy' and
+	 * 'defer_detoast' yet? Many of the trees in a scan of a wide table are
+	 * never read, if the query stops early, so that's not done until needed.
+	 */
+	bool		initialized;
+
+	/* buffer access strategy for reading pages, or NULL for default */
+	BufferAccessStrategy strategy;
+
+	/*
+	 * Private buffer ring for a column marked with the "zedstore_cold"
+	 * attribute option. Overrides 'strategy' if set.
+	 */
+	BufferAccessStrategy cold_strategy;
+
+	/* tree pages read and found in shared buffers, for statistics */
+	int64		pages_read;
+	int64		pages_hit;
+
+	/* time spent decompressing and decoding leaf pages, for EXPLAIN */
+	instr_time	decode_time;
+
 	/*
 	 * These fields are used, when the scan is processing an array tuple.
 	 * They are filled in by zsbt_attr_scan_fetch_array().
@@ -694,6 +1245,29 @@ typedef struct ZSAttrTreeScan
 	/* last index into attr_decoder arrays */
 	int			decoder_last_idx;
 
+	/*
+	 * Read-ahead of leaf pages, for scans that read the whole tree in order.
+	 * When the scan reaches 'prefetch_trigger', the next few leaves are
+	 * prefetched, see zsbt_prefetch_leaves().
+	 */
+	bool		prefetch;
+	zstid		prefetch_trigger;
+
+	/*
+	 * Can toasted values be returned without flattening them? See
+	 * zedstore_toast_defer().
+	 */
+	bool		defer_detoast;
+
+	/*
+	 * TID range of the last leaf page read that holds only NULLs, according
+	 * to its synopsis. zsbt_attr_fetch() returns NULL for any TID in it,
+	 * without decoding the page. Only set in sequential scans, see
+	 * zsbt_attr_scan_fetch_array().
+	 */
+	zstid		allnull_start;
+	zstid		allnull_end;
+
 } ZSAttrTreeScan;
 
 /*
@@ -706,33 +1280,86 @@ typedef struct ZSAttrTreeScan
  *
  * Use zsmeta_get_cache() to get the cached struct.
  *
- * This is used together with smgr_targblock. smgr_targblock tracks the
- * physical size of the relation file. This struct is only considered valid
- * when smgr_targblock is valid. So in effect, we invalidate this whenever
- * a smgr invalidation happens. Logically, the lifetime of this is the same
- * as smgr_targblocks/smgr_fsm_nblocks/smgr_vm_nblocks, but there's no way
- * to attach an AM-specific struct directly to SmgrRelation.
+ * The cached block numbers are only hints: every page is checked with
+ * zsbt_page_is_expected() when it's visited, and if it's not what we
+ * expected, the cached state of that attribute is forgotten, with
+ * zsmeta_invalidate_cache_attr(), and looked up again from the metapage.
+ * Other attributes are not affected.
+ *
+ * This is used together with smgr_targblock, which tracks the physical size
+ * of the relation file. When smgr_targblock has been invalidated, by an smgr
+ * invalidation, zsmeta_revalidate_cache() re-checks the size of the
+ * relation, 'cache_nblocks', and forgets any cached blocks that no longer
+ * exist because the relation was truncated. The rest of the cache is kept.
+ *
+ * The roots are also cached in shared memory, see zedstore_metacache.c, so
+ * that the struct can be rebuilt without reading the metapage. If it was
+ * built with a shared entry, 'cache_shared_version' is the entry's version
+ * at the time, and the struct stays valid across smgr invalidations, for
+ * as long as the entry has the same version.
  */
+/* Number of leaf downlinks cached for each tree, see ZSMetaCacheData */
+#define ZS_CACHED_DOWNLINKS		16
+
 typedef struct ZSMetaCacheData
 {
 	int			cache_nattributes;
+	uint64		cache_shared_version;	/* 0 if not in the shared cache */
+	BlockNumber cache_nblocks;		/* size of the relation, when validated */
+
+	/*
+	 * Insertion lane state, see zsbt_tid_find_lane(). 'cache_lane_nlanes' is
+	 * the zedstore_insert_lanes setting that 'cache_lane_group' was computed
+	 * with, or 0 if it hasn't been computed yet.
+	 */
+	int			cache_lane_nlanes;
+	uint64		cache_lane_group;
 
 	/* For each attribute */
 	struct {
 		BlockNumber root;				/* root of the b-tree */
 		BlockNumber rightmost; 			/* right most leaf page */
 		zstid		rightmost_lokey;	/* lokey of rightmost leaf */
+
+		/*
+		 * Adaptive compression state, see zsbt_attr_pack_attstream().
+		 * 'compress_failures' is the number of consecutive page writes where
+		 * compression didn't pay off, and 'compress_skip' is the number of
+		 * page writes remaining before compression is tried again.
+		 */
+		uint32		compress_failures;
+		uint32		compress_skip;
+
+		/*
+		 * A window of consecutive downlinks copied from the leaf-parent page
+		 * visited last, covering keys from downlinks[0].tid up to
+		 * 'downlinks_hikey'. Lets zsbt_descend() jump directly to the leaf.
+		 */
+		int			num_downlinks;
+		zstid		downlinks_hikey;
+		ZSBtreeInternalPageItem downlinks[ZS_CACHED_DOWNLINKS];
 	} cache_attrs[FLEXIBLE_ARRAY_MEMBER];
 
 } ZSMetaCacheData;
 
 extern ZSMetaCacheData *zsmeta_populate_cache(Relation rel);
+extern void zsmeta_revalidate_cache(Relation rel);
+
+/* prototypes for functions in zedstore_metacache.c */
+extern uint64 zs_metacache_version(Relation rel);
+extern ZSMetaCacheData *zs_metacache_load(Relation rel);
+extern void zs_metacache_publish(Relation rel, Page metapage, ZSMetaCacheData *cache);
+extern void zs_metacache_invalidate(Relation rel);
+extern void zs_metacache_set_rightmost(Relation rel, AttrNumber attno,
+									   BlockNumber blkno, zstid lokey);
 
 static inline ZSMetaCacheData *
 zsmeta_get_cache(Relation rel)
 {
-	if (rel->rd_amcache == NULL || RelationGetTargetBlock(rel) == InvalidBlockNumber)
+	if (rel->rd_amcache == NULL)
 		zsmeta_populate_cache(rel);
+	else if (RelationGetTargetBlock(rel) == InvalidBlockNumber)
+		zsmeta_revalidate_cache(rel);
 	return (ZSMetaCacheData *) rel->rd_amcache;
 }
 
@@ -750,6 +1377,64 @@ zsmeta_invalidate_cache(Relation rel)
 	}
 }
 
+/*
+ * Forget the cached root, rightmost leaf and downlinks of one attribute,
+ * after finding that one of them was out of date. The next
+ * zsmeta_get_root_for_attribute() call reads the root from the metapage.
+ */
+static inline void
+zsmeta_invalidate_cache_attr(Relation rel, AttrNumber attno)
+{
+	ZSMetaCacheData *metacache = (ZSMetaCacheData *) rel->rd_amcache;
+
+	if (metacache != NULL && attno < metacache->cache_nattributes)
+	{
+		metacache->cache_attrs[attno].root = InvalidBlockNumber;
+		metacache->cache_attrs[attno].rightmost = InvalidBlockNumber;
+		metacache->cache_attrs[attno].num_downlinks = 0;
+	}
+}
+
+/*
+ * VACUUM merges a leaf page that it has removed data from with its right
+ * sibling, if the contents of the two pages together take at most this many
+ * bytes. That leaves room on the merged page for some new data, before it
+ * needs to be split again.
+ */
+#define ZSBT_MERGE_MAX_FILL		(BLCKSZ * 2 / 3)
+
+/*
+ * Number of leaf pages that zsbt_prefetch_leaves() reads ahead, per tree.
+ * It's based on effective_io_concurrency, but clamped to this range.
+ */
+#define ZSBT_MIN_PREFETCH_LEAVES	4
+#define ZSBT_MAX_PREFETCH_LEAVES	32
+
+/*
+ * VACUUM compresses the uncompressed data on the attribute leaves where new
+ * rows are appended, once there's at least this much of it, so that inserts
+ * can keep appending to it without repacking the page. Up to
+ * ZSBT_MAX_APPEND_POINTS such places are checked: the end of the TID space,
+ * and the end of each insertion lane (max 64 lanes).
+ */
+#define ZSBT_TAIL_COMPRESS_MIN_SIZE	(BLCKSZ / 4)
+#define ZSBT_MAX_APPEND_POINTS		(1 + 64)
+
+/*
+ * Number of bytes used by data on a B-tree page, in the area between the page
+ * header and the special space. This works for all kinds of B-tree pages:
+ * TID leaves keep line pointers at the beginning and items at the end of
+ * that area, and attribute leaves keep the uncompressed and compressed
+ * attstreams there.
+ */
+static inline Size
+zsbt_page_used_space(Page page)
+{
+	PageHeader	phdr = (PageHeader) page;
+
+	return (phdr->pd_lower - SizeOfPageHeaderData) + (phdr->pd_special - phdr->pd_upper);
+}
+
 /*
  * zs_split_stack is used during page split, or page merge, to keep track
  * of all the modified pages. The page split (or merge) routines don't
@@ -769,6 +1454,9 @@ struct zs_split_stack
 	bool		recycle;	/* should the page be added to the FPM? */
 	bool		special_only; /* if set, only the "special" area was changed, (the
 							   * rest of the page won't need to be WAL-logged */
+	bool		delta;		/* if set, 'buf' holds the old version of the page,
+							 * and the changes may be WAL-logged as a delta
+							 * against it, rather than a full-page image */
 };
 
 /* prototypes for functions in zedstore_tidpage.c */
@@ -777,11 +1465,42 @@ extern void zsbt_tid_begin_scan(Relation rel, zstid starttid, zstid endtid,
 extern void zsbt_tid_reset_scan(ZSTidTreeScan *scan, zstid starttid, zstid endtid, zstid currtid);
 extern void zsbt_tid_end_scan(ZSTidTreeScan *scan);
 extern bool zsbt_tid_scan_next_array(ZSTidTreeScan *scan, zstid nexttid, ScanDirection direction);
+extern void zsbt_tid_page_tid_stats(Page page, uint64 *ntids, uint64 *span);
+
+/*
+ * Return the TID at 'idx' in the current array, and remember it as the
+ * scan's position. Subroutine of zsbt_tid_scan_next().
+ */
+static inline zstid
+zsbt_tid_scan_return(ZSTidTreeScan *scan, int idx)
+{
+	zstid		this_tid = scan->array_iter.tids[idx];
+
+	/*
+	 * Callers using SnapshotDirty need some extra visibility information.
+	 */
+	if (scan->snapshot->snapshot_type == SNAPSHOT_DIRTY)
+	{
+		int			slotno = scan->array_iter.tid_undoslotnos[idx];
+		ZSUndoSlotVisibility *visi_info = &scan->array_iter.undoslot_visibility[slotno];
+
+		if (visi_info->xmin != FrozenTransactionId)
+			scan->snapshot->xmin = visi_info->xmin;
+		scan->snapshot->xmax = visi_info->xmax;
+		scan->snapshot->speculativeToken = visi_info->speculativeToken;
+	}
+
+	/* on next call, continue the scan at the next TID */
+	scan->currtid = this_tid;
+	scan->array_curr_idx = idx;
+	return this_tid;
+}
 
 /*
  * Return the next TID in the scan.
  *
- * The next TID means the first TID > scan->currtid. Each call moves
+ * The next TID means the first TID > scan->currtid, or with a backward
+ * scan, the last TID < scan->currtid. Each call moves
  * scan->currtid to the last returned TID. You can call zsbt_tid_reset_scan()
  * to change the position, scan->starttid and scan->endtid define the
  * boundaries of the search.
@@ -813,45 +1532,54 @@ zsbt_tid_scan_next(ZSTidTreeScan *scan, ScanDirection direction)
 		}
 	}
 
-	/*
-	 * Optimize for the common case that we're scanning forward from the previous
-	 * TID.
-	 */
-	if (scan->array_curr_idx >= 0 && scan->array_iter.tids[scan->array_curr_idx] < nexttid)
-		idx = scan->array_curr_idx + 1;
-	else
-		idx = 0;
-
-	for (; idx < scan->array_iter.num_tids; idx++)
+	if (direction == BackwardScanDirection)
 	{
-		zstid		this_tid = scan->array_iter.tids[idx];
+		/*
+		 * Search for the last TID <= nexttid, continuing downwards from the
+		 * previous TID if we can.
+		 */
+		if (scan->array_curr_idx >= 0 && scan->array_iter.tids[scan->array_curr_idx] > nexttid)
+			idx = scan->array_curr_idx - 1;
+		else
+			idx = scan->array_iter.num_tids - 1;
 
-		if (this_tid >= scan->endtid)
+		for (; idx >= 0; idx--)
 		{
-			scan->currtid = nexttid;
-			return InvalidZSTid;
+			zstid		this_tid = scan->array_iter.tids[idx];
+
+			if (this_tid < scan->starttid)
+			{
+				scan->currtid = nexttid;
+				return InvalidZSTid;
+			}
+
+			if (this_tid <= nexttid)
+				return zsbt_tid_scan_return(scan, idx);
 		}
+	}
+	else
+	{
+		/*
+		 * Optimize for the common case that we're scanning forward from the
+		 * previous TID.
+		 */
+		if (scan->array_curr_idx >= 0 && scan->array_iter.tids[scan->array_curr_idx] < nexttid)
+			idx = scan->array_curr_idx + 1;
+		else
+			idx = 0;
 
-		if (this_tid >= nexttid)
+		for (; idx < scan->array_iter.num_tids; idx++)
 		{
-			/*
-			 * Callers using SnapshotDirty need some extra visibility information.
-			 */
-			if (scan->snapshot->snapshot_type == SNAPSHOT_DIRTY)
-			{
-				int			slotno = scan->array_iter.tid_undoslotnos[idx];
-				ZSUndoSlotVisibility *visi_info = &scan->array_iter.undoslot_visibility[slotno];
+			zstid		this_tid = scan->array_iter.tids[idx];
 
-				if (visi_info->xmin != FrozenTransactionId)
-					scan->snapshot->xmin = visi_info->xmin;
-				scan->snapshot->xmax = visi_info->xmax;
-				scan->snapshot->speculativeToken = visi_info->speculativeToken;
+			if (this_tid >= scan->endtid)
+			{
+				scan->currtid = nexttid;
+				return InvalidZSTid;
 			}
 
-			/* on next call, continue the scan at the next TID */
-			scan->currtid = this_tid;
-			scan->array_curr_idx = idx;
-			return this_tid;
+			if (this_tid >= nexttid)
+				return zsbt_tid_scan_return(scan, idx);
 		}
 	}
 
@@ -863,10 +1591,74 @@ zsbt_tid_scan_next(ZSTidTreeScan *scan, ScanDirection direction)
 	return InvalidZSTid;
 }
 
+/*
+ * Move a forward scan so that the next zsbt_tid_scan_next() call returns
+ * the first TID >= 'tid'.
+ *
+ * This doesn't access the tree. If 'tid' is within the current array item,
+ * we binary search for it, otherwise zsbt_tid_scan_next_array() skips over
+ * the items before it without decoding them.
+ */
+static inline void
+zsbt_tid_scan_skip_to(ZSTidTreeScan *scan, zstid tid)
+{
+	int			lo;
+	int			hi;
+
+	if (tid <= scan->currtid + 1)
+		return;
+	scan->currtid = tid - 1;
+
+	if (scan->array_iter.num_tids == 0 ||
+		tid < scan->array_iter.tids[0] ||
+		tid > scan->array_iter.tids[scan->array_iter.num_tids - 1])
+		return;
+
+	/* find the first TID >= 'tid' in the array */
+	lo = Max(scan->array_curr_idx, 0);
+	hi = scan->array_iter.num_tids - 1;
+	while (lo < hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+
+		if (scan->array_iter.tids[mid] < tid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	scan->array_curr_idx = lo - 1;
+}
+
+
+/*
+ * State of a bulk load into the TID tree, see zsbt_tid_begin_bulk_insert().
+ */
+typedef struct ZSTidBulkInsertState
+{
+	Relation	rel;
+	zstid		nexttid;		/* TID to assign next */
+
+	/* current run of new TIDs, inserted by the same transaction */
+	zstid		run_start;
+	int			run_len;
+	TransactionId run_xid;
+	CommandId	run_cid;
+
+	/* all-visible items that haven't been written to the tree yet */
+	List	   *pending_items;
+	Size		pending_size;
+} ZSTidBulkInsertState;
+
+extern void zsbt_tid_begin_bulk_insert(Relation rel, ZSTidBulkInsertState *state);
+extern zstid zsbt_tid_bulk_insert(ZSTidBulkInsertState *state, TransactionId xid, CommandId cid);
+extern void zsbt_tid_bulk_flush(ZSTidBulkInsertState *state);
+extern void zsbt_tid_end_bulk_insert(ZSTidBulkInsertState *state);
 
 extern zstid zsbt_tid_multi_insert(Relation rel, int ntuples,
 								   TransactionId xid, CommandId cid,
 								   uint32 speculative_token, ZSUndoRecPtr prevundoptr);
+extern zstid zsbt_tid_insert_speculative(Relation rel, TransactionId xid, CommandId cid,
+										 uint32 speculative_token);
 extern TM_Result zsbt_tid_delete(Relation rel, zstid tid,
 								 TransactionId xid, CommandId cid,
 								 Snapshot snapshot, Snapshot crosscheck, bool wait,
@@ -875,10 +1667,19 @@ extern TM_Result zsbt_tid_update(Relation rel, zstid otid,
 								 TransactionId xid,
 								 CommandId cid, bool key_update, Snapshot snapshot, Snapshot crosscheck,
 								 bool wait, TM_FailureData *hufd, zstid *newtid_p, bool *this_xact_has_lock);
+extern void zsbt_tid_mark_updated(Relation rel, zstid otid, zstid newtid,
+								  TransactionId xid, CommandId cid, bool key_update);
 extern void zsbt_tid_clear_speculative_token(Relation rel, zstid tid, uint32 spectoken, bool forcomplete);
 extern void zsbt_tid_mark_dead(Relation rel, zstid tid, ZSUndoRecPtr recent_oldest_undo);
-extern IntegerSet *zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_live_tuples);
-extern void zsbt_tid_remove(Relation rel, IntegerSet *tids);
+extern ZSTidStore *zsbt_collect_dead_tids(Relation rel, zstid starttid, zstid *endtid, uint64 *num_live_tuples,
+										  uint64 *num_all_visible_tuples, BufferAccessStrategy strategy);
+extern bool zsbt_tid_is_all_visible(Relation rel, zstid tid, ZSUndoRecPtr recent_oldest_undo,
+									Buffer *buf_p, ZSTidItemIterator *iter);
+extern int	zsbt_tid_get_undo_slot(Relation rel, zstid tid, Buffer *buf_p,
+								   ZSUndoRecPtr *undoptr_p);
+extern bool zsbt_tid_get_removing_xid(Relation rel, zstid tid, ZSUndoRecPtr recent_oldest_undo,
+									  TransactionId *xid_p);
+extern void zsbt_tid_remove(Relation rel, ZSTidStore *tids, BufferAccessStrategy strategy);
 extern TM_Result zsbt_tid_lock(Relation rel, zstid tid,
 							   TransactionId xid, CommandId cid,
 							   LockTupleMode lockmode, bool follow_updates,
@@ -888,17 +1689,38 @@ extern TM_Result zsbt_tid_lock(Relation rel, zstid tid,
 extern void zsbt_tid_undo_deletion(Relation rel, zstid tid, ZSUndoRecPtr undoptr, ZSUndoRecPtr recent_oldest_undo);
 extern zstid zsbt_get_first_tid(Relation rel);
 extern zstid zsbt_get_last_tid(Relation rel);
+extern int	zsbt_tid_get_append_points(Relation rel, zstid *points);
 extern void zsbt_find_latest_tid(Relation rel, zstid *tid, Snapshot snapshot);
+extern uint64 zsbt_tid_count_visible(Relation rel, Snapshot snapshot,
+									 BufferAccessStrategy strategy);
 
 /* prototypes for functions in zedstore_tiditem.c */
 extern List *zsbt_tid_item_create_for_range(zstid tid, int nelements, ZSUndoRecPtr undo_ptr);
 extern List *zsbt_tid_item_add_tids(ZSTidArrayItem *orig, zstid firsttid, int nelements,
 									ZSUndoRecPtr undo_ptr, bool *modified_orig);
 extern void zsbt_tid_item_unpack(ZSTidArrayItem *item, ZSTidItemIterator *iter);
+extern void zsbt_tid_item_count_slots(ZSTidArrayItem *item, int *counts);
+extern bool zsbt_tid_item_is_all_dead(ZSTidArrayItem *item);
+extern int	zsbt_tid_item_lookup(ZSTidArrayItem *item, zstid tid, ZSUndoRecPtr *undoptr_p);
 extern List *zsbt_tid_item_change_undoptr(ZSTidArrayItem *orig, zstid target_tid, ZSUndoRecPtr undoptr, ZSUndoRecPtr recent_oldest_undo);
-extern List *zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, IntegerSet *remove_tids,
+extern ZSTidArrayItem *zsbt_tid_item_kill_slot(ZSTidArrayItem *orig, int slotno);
+extern List *zsbt_tid_item_remove_tids(ZSTidArrayItem *orig, zstid *nexttid, ZSTidStore *remove_tids,
 									   ZSUndoRecPtr recent_oldest_undo);
+extern List *zsbt_tid_item_merge_small(List *items, ZSUndoRecPtr recent_oldest_undo);
+
 
+/*
+ * The synopsis of one attribute leaf page, as returned by
+ * zsbt_attr_leaf_synopses().
+ */
+typedef struct ZSAttrLeafSynopsis
+{
+	zstid		lokey;
+	zstid		hikey;
+	bool		valid;			/* false if the page has no synopsis */
+	int64		minval;			/* minval > maxval if only NULLs */
+	int64		maxval;
+} ZSAttrLeafSynopsis;
 
 /* prototypes for functions in zedstore_attpage.c */
 extern void zsbt_attr_begin_scan(Relation rel, TupleDesc tdesc, AttrNumber attno,
@@ -907,6 +1729,26 @@ extern void zsbt_attr_end_scan(ZSAttrTreeScan *scan);
 extern bool zsbt_attr_scan_fetch_array(ZSAttrTreeScan *scan, zstid tid);
 
 extern void zsbt_attr_add(Relation rel, AttrNumber attno, attstream_buffer *newstream);
+extern void zsbt_attr_add_bulk(Relation rel, AttrNumber attno, attstream_buffer *newstream);
+extern void zsbt_attr_add_multi(Relation rel, int nattrs, AttrNumber *attnos,
+								attstream_buffer **attbufs);
+extern int zsbt_attr_prune_ranges(Relation rel, AttrNumber attno,
+								  int nkeys, struct ScanKeyData *keys,
+								  ZSTidRange **ranges_p, int64 *npruned_p);
+extern int zsbt_attr_leaf_synopses(Relation rel, AttrNumber attno,
+								   ZSAttrLeafSynopsis **synopses_p);
+extern void zsbt_attr_summarize(Relation rel, AttrNumber attno);
+extern bool zsbt_attr_is_ordered(Relation rel, AttrNumber attno);
+extern void zsbt_attr_validate_order(Relation rel, AttrNumber attno);
+extern uint64 zsbt_attr_page_raw_bytes(Page page);
+extern void zsbt_attr_page_stream_sizes(Page page, int64 *compressed,
+										int64 *uncompressed);
+extern void zsbt_attr_page_free_toast(Relation rel, Form_pg_attribute attr, Page page);
+extern ZSAttStream *get_page_lowerstream(Page page);
+extern ZSAttStream *get_page_upperstream(Page page);
+extern BlockNumber zsbt_attr_recompress(Relation rel, AttrNumber attno, BufferAccessStrategy strategy);
+extern bool zsbt_attr_compress_tail(Relation rel, AttrNumber attno, zstid tid,
+									BufferAccessStrategy strategy);
 extern void zsbt_attstream_change_redo(XLogReaderState *record);
 
 /* prototypes for functions in zedstore_attstream.c */
@@ -927,40 +1769,100 @@ extern void merge_attstream_buffer(Form_pg_attribute attr, attstream_buffer *buf
 extern bool append_attstream_inplace(Form_pg_attribute att, ZSAttStream *oldstream, int freespace, attstream_buffer *newstream);
 
 extern int find_chunk_for_offset(attstream_buffer *attbuf, int offset, zstid *lasttid);
+extern int compress_attstream_framed(ZSCompressionMethod method, attstream_buffer *attbuf,
+									 char *dst, int dstsize, int *srcSizePtr);
+extern void zs_decompress_attstream(ZSAttStream *attstream, char *dst);
 extern int find_chunk_containing_tid(attstream_buffer *attbuf, zstid tid, zstid *lasttid);
 extern void trim_attstream_upto_offset(attstream_buffer *buf, int chunk_pos, zstid prev_lasttid);
 extern void split_attstream_buffer(attstream_buffer *oldattbuf, attstream_buffer *newattbuf, zstid splittid);
+extern void attstream_chunks_synopsis(bool attbyval, int16 attlen, bool minmax,
+									  char *chunks, int chunkslen,
+									  uint32 *nullcount, int64 *minval, int64 *maxval);
+extern bool attstream_chunks_ordered(int16 attlen, char *chunks, int chunkslen,
+									 int64 *firstval);
 
 extern void print_attstream(int attlen, char *chunk, int len);
+extern const char *attstream_chunk_mode_name(int16 attlen, char *chunk);
 
 extern void init_attstream_decoder(attstream_decoder *decoder, bool attbyval, int16 attlen);
 extern void destroy_attstream_decoder(attstream_decoder *decoder);
 extern void decode_attstream_begin(attstream_decoder *decoder, ZSAttStream *attstream);
+extern void decode_attstream_begin_cached(attstream_decoder *decoder, ZSAttStream *attstream,
+										  Relation rel, Buffer buf, bool local);
+extern void decode_attstream_begin_frame(attstream_decoder *decoder, ZSAttStream *attstream,
+										 zstid tid);
+extern void decode_attstream_rewind(attstream_decoder *decoder);
 extern bool decode_attstream_cont(attstream_decoder *decoder);
+extern int decode_attstream_batch(attstream_decoder *decoder, int max_elems,
+								  zstid *tids, Datum *datums, bool *isnulls);
+extern void decode_attstream_skip_to(attstream_decoder *decoder, zstid tid);
+extern void decode_attstream_seek(attstream_decoder *decoder, zstid tid);
 extern bool get_attstream_chunk_cont(attstream_decoder *decoder, zstid *prevtid, zstid *firsttid, zstid *lasttid, bytea **chunk);
 
+/* prototypes for functions in zedstore_logical.c */
+extern void zs_logical_log_insert(Relation rel, TupleTableSlot **slots, int ntuples);
+extern void zs_logical_log_update(Relation rel, TupleTableSlot *oldslot, TupleTableSlot *newslot);
+extern void zs_logical_log_delete(Relation rel, TupleTableSlot *oldslot);
+
 /* prototypes for functions in zedstore_tuplebuffer.c */
 extern zstid zsbt_tuplebuffer_allocate_tid(Relation rel, TransactionId xid, CommandId cid);
+extern zstid zsbt_tuplebuffer_allocate_tids(Relation rel, TransactionId xid, CommandId cid,
+											int ntids);
 extern void zsbt_tuplebuffer_flush(Relation rel);
+extern void zsbt_tuplebuffer_flush_tid(Relation rel, zstid tid);
 extern void zsbt_tuplebuffer_spool_tuple(Relation rel, zstid tid, Datum *datums, bool *isnulls);
 extern void zsbt_tuplebuffer_spool_slots(Relation rel, zstid *tids, TupleTableSlot **slots, int ntuples);
+extern TupleTableSlot **zsbt_tuplebuffer_sort_slots(Relation rel, TupleTableSlot **slots, int ntuples);
+extern void zsbt_tuplebuffer_begin_skip_wal(Relation rel);
+extern void zsbt_tuplebuffer_end_skip_wal(Relation rel);
+extern bool zs_relation_needs_wal(Relation rel);
 
 extern void AtEOXact_zedstream_tuplebuffers(bool isCommit);
 
+/* prototypes for functions in zedstore_loadstats.c */
+extern void zs_loadstats_begin(Relation rel);
+extern void zs_loadstats_add(Relation rel, TupleTableSlot **slots, int ntuples);
+extern void zs_loadstats_finish(Relation rel);
+extern void zs_loadstats_forget(Relation rel);
+
 
 /* prototypes for functions in zedstore_btree.c */
 extern zs_split_stack *zsbt_newroot(Relation rel, AttrNumber attno, int level, List *downlinks);
 extern zs_split_stack *zsbt_insert_downlinks(Relation rel, AttrNumber attno,
 					  zstid leftlokey, BlockNumber leftblkno, int level,
 					  List *downlinks);
-extern void zsbt_attr_remove(Relation rel, AttrNumber attno, IntegerSet *tids);
+extern void zsbt_attr_remove(Relation rel, AttrNumber attno, ZSTidStore *tids,
+							 BufferAccessStrategy strategy);
 extern zs_split_stack *zsbt_unlink_page(Relation rel, AttrNumber attno, Buffer buf, int level);
+extern zs_split_stack *zsbt_merge_into_left(Relation rel, AttrNumber attno, Buffer leftbuf,
+											Buffer rightbuf, Page newleftpage);
+extern Buffer zsbt_get_merge_sibling(Relation rel, AttrNumber attno, Buffer leftbuf);
+extern void zsbt_free_dropped_tree(Relation rel, AttrNumber attno);
+extern void zsbt_fold_rewrites(Relation rel);
+extern bool zsbt_relocate_tree(Relation rel, AttrNumber attno, BlockNumber cutoff,
+							   BlockNumber end, BlockNumber *moved, int *nmoved);
 extern zs_split_stack *zs_new_split_stack_entry(Buffer buf, Page page);
+extern uint8 zsbt_page_regbuf_flags(Page page);
 extern void zs_apply_split_changes(Relation rel, zs_split_stack *stack, struct zs_pending_undo_op *undo_op);
 extern Buffer zsbt_descend(Relation rel, AttrNumber attno, zstid key, int level, bool readonly);
+extern Buffer zsbt_descend_extended(Relation rel, AttrNumber attno, zstid key, int level,
+									bool readonly, BufferAccessStrategy strategy);
 extern Buffer zsbt_find_and_lock_leaf_containing_tid(Relation rel, AttrNumber attno,
-													 Buffer buf, zstid nexttid, int lockmode);
+													 Buffer buf, zstid nexttid, int lockmode,
+													 BufferAccessStrategy strategy);
 extern bool zsbt_page_is_expected(Relation rel, AttrNumber attno, zstid key, int level, Buffer buf);
+extern void zsbt_prefetch_leaf(Relation rel, AttrNumber attno, zstid key, ZSTidRange *range);
+extern zstid zsbt_prefetch_leaves(Relation rel, AttrNumber attno, zstid key);
+extern zstid zsbt_find_leaf_boundary(Relation rel, AttrNumber attno, zstid key, int nleaves);
+extern int	zsbt_leaf_ranges(Relation rel, AttrNumber attno, ZSTidRange **ranges_p);
+extern BlockNumber zsbt_estimate_tree_pages(Relation rel, AttrNumber attno);
+extern void zsbt_gather_tree_stats(Relation rel, AttrNumber attno, ZSTreeStats *stats,
+								   BufferAccessStrategy strategy);
+extern void zsbt_tree_fragmentation(Relation rel, AttrNumber attno,
+									double sample_fraction,
+									BufferAccessStrategy strategy,
+									ZSTreeFragmentation *frag);
+extern BlockNumber zsbt_prewarm_tree(Relation rel, AttrNumber attno);
 extern void zsbt_wal_log_leaf_items(Relation rel, AttrNumber attno, Buffer buf, OffsetNumber off, bool replace, List *items, struct zs_pending_undo_op *undo_op);
 extern void zsbt_wal_log_rewrite_pages(Relation rel, AttrNumber attno, List *buffers, struct zs_pending_undo_op *undo_op);
 
@@ -979,14 +1881,28 @@ zsbt_attr_fetch(ZSAttrTreeScan *scan, Datum *datum, bool *isnull, zstid tid)
 
 	/*
 	 * Fetch the next item from the scan. The item we're looking for might
-	 * already be in scan->array_*.
+	 * already be in scan->array_*, or on a page of NULLs.
 	 */
 	if (scan->decoder.num_elements == 0 ||
 		tid < scan->decoder.tids[0] ||
 		tid > scan->decoder.tids[scan->decoder.num_elements - 1])
 	{
+		if (tid < scan->allnull_end && tid >= scan->allnull_start)
+		{
+			*isnull = true;
+			*datum = (Datum) 0;
+			return true;
+		}
 		if (!zsbt_attr_scan_fetch_array(scan, tid))
+		{
+			if (tid < scan->allnull_end && tid >= scan->allnull_start)
+			{
+				*isnull = true;
+				*datum = (Datum) 0;
+				return true;
+			}
 			return false;
+		}
 		scan->decoder_last_idx = -1;
 	}
 	Assert(scan->decoder.num_elements > 0 &&
@@ -999,6 +1915,25 @@ zsbt_attr_fetch(ZSAttrTreeScan *scan, Datum *datum, bool *isnull, zstid tid)
 	 */
 	if (scan->decoder_last_idx != -1 && scan->decoder.tids[scan->decoder_last_idx] < tid)
 		idx = scan->decoder_last_idx + 1;
+	else if (scan->decoder_last_idx != -1 && scan->decoder.tids[scan->decoder_last_idx] > tid)
+	{
+		/* scanning backward, search downwards from the previous TID */
+		for (idx = scan->decoder_last_idx - 1; idx >= 0; idx--)
+		{
+			zstid		this_tid = scan->decoder.tids[idx];
+
+			if (this_tid == tid)
+			{
+				*isnull = scan->decoder.isnulls[idx];
+				*datum = scan->decoder.datums[idx];
+				scan->decoder_last_idx = idx;
+				return true;
+			}
+			if (this_tid < tid)
+				return false;
+		}
+		return false;
+	}
 	else
 		idx = 0;
 
@@ -1022,11 +1957,41 @@ zsbt_attr_fetch(ZSAttrTreeScan *scan, Datum *datum, bool *isnull, zstid tid)
 
 extern PGDLLIMPORT const TupleTableSlotOps TTSOpsZedstore;
 
+/* prototypes for functions in zedstore_tupslot.c */
+extern void zs_slot_clear_for_projection(TupleTableSlot *slot, int num_proj_atts,
+										 const int *proj_atts);
+extern void zs_slot_set_projection(TupleTableSlot *slot, int num_proj_atts,
+								   const int *proj_atts);
+
 /* prototypes for functions in zedstore_meta.c */
 extern void zsmeta_initmetapage(Relation rel);
 extern void zsmeta_initmetapage_redo(XLogReaderState *record);
 extern BlockNumber zsmeta_get_root_for_attribute(Relation rel, AttrNumber attno, bool for_update);
 extern void zsmeta_add_root_for_new_attributes(Relation rel, Page page);
+extern BlockNumber zsmeta_detach_root_for_attribute(Relation rel, AttrNumber attno);
+extern BlockNumber *zsmeta_root_location(Relation rel, Buffer metabuf, AttrNumber attno,
+										 int mode, Buffer *dirbuf);
+extern bool zsmeta_can_begin_rewrite(Relation rel, int nattrs, AttrNumber *attnums);
+extern void zsmeta_begin_rewrite(Relation rel, AttrNumber attno);
+extern bool zsmeta_fold_rewrite(Relation rel, AttrNumber *attno, BlockNumber *oldroot);
+extern void zsmeta_update_stats(Relation rel, double reltuples, BufferAccessStrategy strategy);
+extern ZSRelStats *zsmeta_read_stats(Relation rel);
+extern const ZSRelStats *zsmeta_get_cached_stats(Relation rel);
+
+/* prototypes for functions in zedstore_bloom.c */
+extern bool zsbloom_attr_enabled(Relation rel, AttrNumber attno);
+extern BlockNumber zsbloom_build(Relation rel, AttrNumber attno, BlockNumber oldhead,
+								 BufferAccessStrategy strategy);
+extern void zsbloom_free_chain(Relation rel, AttrNumber attno, BlockNumber head);
+extern void zsbloom_begin_read(ZSBloomReader *reader, Relation rel, AttrNumber attno,
+							   BlockNumber head);
+extern ZSBloomEntry *zsbloom_find_entry(ZSBloomReader *reader, zstid lokey,
+										BlockNumber leafblk, XLogRecPtr leaflsn);
+extern void zsbloom_end_read(ZSBloomReader *reader);
+extern BlockNumber zsbloom_get_head(Relation rel, AttrNumber attno);
+extern bool zsbloom_hash_key(Relation rel, AttrNumber attno, struct ScanKeyData *key,
+							 uint32 *hash);
+extern bool zsbloom_entry_may_contain(ZSBloomEntry *entry, uint32 hash);
 
 /* prototypes for functions in zedstore_visibility.c */
 extern TM_Result zs_SatisfiesUpdate(Relation rel, Snapshot snapshot,
@@ -1043,12 +2008,26 @@ extern bool zs_SatisfiesVisibility(ZSTidTreeScan *scan, ZSUndoRecPtr item_undopt
 /* prototypes for functions in zedstore_toast.c */
 extern Datum zedstore_toast_datum(Relation rel, AttrNumber attno, Datum value, zstid tid);
 extern Datum zedstore_toast_flatten(Relation rel, AttrNumber attno, zstid tid, Datum toasted);
+extern int	zedstore_toast_threshold(Relation rel, AttrNumber attno);
+extern bool zedstore_toast_can_defer(Form_pg_attribute attr);
+extern Datum zedstore_toast_defer(Relation rel, AttrNumber attno, zstid tid, Datum toasted,
+								  int *mem_used);
+extern Datum zedstore_toast_flatten_slice(Relation rel, AttrNumber attno, zstid tid, Datum toasted,
+										  int32 sliceoffset, int32 slicelength);
 extern void zedstore_toast_delete(Relation rel, Form_pg_attribute attr, zstid tid, BlockNumber blkno);
 
 /* prototypes for functions in zedstore_freepagemap.c */
-extern Buffer zspage_getnewbuf(Relation rel);
+extern Buffer zspage_getnewbuf(Relation rel, AttrNumber attno);
+extern Buffer zspage_getnewbufs_contiguous(Relation rel, BlockNumber nblocks);
 extern void zspage_mark_page_deleted(Page page, BlockNumber next_free_blk);
 extern void zspage_delete_page(Relation rel, Buffer buf, Buffer metabuf);
+extern void zspage_delete_undo_page(Relation rel, Buffer buf, Buffer metabuf);
+extern Buffer zspage_getfreebuf_below(Relation rel, BlockNumber limit);
+extern void zspage_forget_pool(const RelFileNode *rnode);
+extern BlockNumber zspage_sort_fpm(Relation rel);
+extern BlockNumber zspage_truncate(Relation rel, BlockNumber *unlinked, int nunlinked,
+								   bool truncate);
+extern BlockNumber zspage_compact(Relation rel, BlockNumber min_free, int elevel);
 
 typedef struct ZedstoreTupleTableSlot
 {
@@ -1073,6 +2052,24 @@ typedef struct ZedstoreTupleTableSlot
 	 * fill in 'visi_info_buf', and set visi_info = &visi_info_buf.
 	 */
 	ZSUndoSlotVisibility visi_info_buf;
+
+	/*
+	 * If the slot was filled by a scan that fetched only some columns,
+	 * 'proj_atts' lists their attribute numbers, and all other columns are
+	 * NULL. Materializing or copying the slot then only needs to look at the
+	 * listed columns, rather than every column of a possibly wide table. NULL
+	 * means that any column can be non-NULL.
+	 *
+	 * 'proj_atts' points to 'proj_atts_buf', or to the source slot's list
+	 * after copying a slot, until the slot is materialized.
+	 *
+	 * Since the non-projected columns are known to be NULL, a scan that fills
+	 * the slot with the same projection again doesn't need to reset them. See
+	 * zs_slot_clear_for_projection().
+	 */
+	int			num_proj_atts;
+	const int  *proj_atts;
+	int		   *proj_atts_buf;
 } ZedstoreTupleTableSlot;
 
 #endif							/* ZEDSTORE_INTERNAL_H */
@@ -0,0 +1,21 @@
+/*
+ * zedstore_metacache.h
+ *		Shared cache of the root directories of zedstore tables
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		src/include/access/zedstore_metacache.h
+ */
+#ifndef ZEDSTORE_METACACHE_H
+#define ZEDSTORE_METACACHE_H
+
+#include "storage/relfilenode.h"
+
+extern Size ZSMetaCacheShmemSize(void);
+extern void ZSMetaCacheShmemInit(void);
+
+extern void zs_metacache_forget(const RelFileNode *rnode);
+extern void zs_metacache_forget_database(Oid dbid);
+
+#endif							/* ZEDSTORE_METACACHE_H */
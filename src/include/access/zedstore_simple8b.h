@@ -10,6 +10,21 @@
 #ifndef ZEDSTORE_SIMPLE8B_H
 #define ZEDSTORE_SIMPLE8B_H
 
+/*
+ * Maximum number of integers that can be encoded in a single Simple-8b
+ * codeword.
+ */
+#define SIMPLE8B_MAX_VALUES_PER_CODEWORD 240
+
+/*
+ * EMPTY_CODEWORD is a special value, used to indicate "no values".
+ * It is used if the next value is too large to be encoded with Simple-8b.
+ *
+ * This value looks like a mode-0 codeword, but we can distinguish it
+ * because a regular mode-0 codeword would have zeroes in the unused bits.
+ */
+#define EMPTY_CODEWORD		UINT64CONST(0x0FFFFFFFFFFFFFFF)
+
 extern uint64 simple8b_encode(const uint64 *ints, int num_ints, int *num_encoded);
 extern uint64 simple8b_encode_consecutive(const uint64 firstint, const uint64 secondint, int num_ints,
 										  int *num_encoded);
@@ -17,5 +32,9 @@ extern int simple8b_decode(uint64 codeword, uint64 *decoded);
 
 extern void simple8b_decode_words(uint64 *codewords, int num_codewords,
 								  uint64 *dst, int num_integers);
+extern void simple8b_decode_words_to_values(uint64 *codewords, int num_codewords,
+											uint64 firstval, uint64 *dst, int num_integers);
+extern int simple8b_find_value(uint64 *codewords, int num_codewords,
+								uint64 firstval, uint64 target);
 
 #endif							/* ZEDSTORE_SIMPLE8B_H */
@@ -0,0 +1,46 @@
+/*
+ * zedstore_stats.h
+ *		Per-column activity statistics of zedstore tables
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		src/include/access/zedstore_stats.h
+ */
+#ifndef ZEDSTORE_STATS_H
+#define ZEDSTORE_STATS_H
+
+#include "access/attnum.h"
+#include "utils/relcache.h"
+
+/*
+ * Counters kept for each column of each zedstore table. The counters of
+ * attribute 0 are for the table as a whole, i.e. the TID tree and UNDO log.
+ */
+typedef struct ZSColumnCounters
+{
+	int64		pages_read;		/* tree pages read from disk */
+	int64		pages_hit;		/* tree pages found in shared buffers */
+	int64		bytes_decompressed; /* decompressed size of streams read */
+	int64		chunks_decoded; /* attstream chunks decoded */
+	int64		toast_flattened;	/* toasted values fetched */
+	int64		undo_fetched;	/* UNDO records fetched */
+	int64		undo_scans;		/* scans that had to look at the UNDO log */
+	int64		undo_pages_discarded;	/* UNDO pages discarded */
+} ZSColumnCounters;
+
+/* set when this backend has counts that haven't been flushed yet */
+extern bool zs_have_column_stats;
+
+extern Size ZSStatsShmemSize(void);
+extern void ZSStatsShmemInit(void);
+
+extern void zs_stats_count_column(Relation rel, AttrNumber attno,
+								  const ZSColumnCounters *counts);
+extern void zs_stats_count_toast_flatten(Relation rel, AttrNumber attno);
+extern void zs_stats_count_undo_fetch(Relation rel);
+extern void zs_stats_count_undo_scan(Relation rel);
+extern void zs_stats_count_undo_discard(Relation rel, int npages);
+extern void zs_stats_flush(void);
+
+#endif							/* ZEDSTORE_STATS_H */
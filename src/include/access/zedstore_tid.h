@@ -26,6 +26,13 @@ typedef uint64	zstid;
 
 #define MaxZSTidOffsetNumber	129
 
+/* A range of TIDs, from 'start' (inclusive) to 'end' (exclusive) */
+typedef struct ZSTidRange
+{
+	zstid		start;
+	zstid		end;
+} ZSTidRange;
+
 #define PG_GETARG_ZSTID(n) DatumGetZSTid(PG_GETARG_DATUM(n))
 #define PG_RETURN_ZSTID(x) return ZSTidGetDatum(x)
 
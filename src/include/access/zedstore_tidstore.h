@@ -0,0 +1,32 @@
+/*
+ * zedstore_tidstore.h
+ *		Compact set of TIDs, used by VACUUM
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		src/include/access/zedstore_tidstore.h
+ */
+#ifndef ZEDSTORE_TIDSTORE_H
+#define ZEDSTORE_TIDSTORE_H
+
+#include "access/zedstore_tid.h"
+
+typedef struct ZSTidStore ZSTidStore;
+
+extern ZSTidStore *zs_tidstore_create(void);
+extern void zs_tidstore_free(ZSTidStore *store);
+extern void zs_tidstore_add(ZSTidStore *store, zstid tid);
+extern void zs_tidstore_end_span(ZSTidStore *store, zstid tid);
+extern uint64 zs_tidstore_num_entries(ZSTidStore *store);
+extern uint64 zs_tidstore_memory_usage(ZSTidStore *store);
+extern bool zs_tidstore_is_member(ZSTidStore *store, zstid tid);
+extern bool zs_tidstore_covers_range(ZSTidStore *store, zstid firsttid, zstid endtid);
+extern void zs_tidstore_begin_iterate(ZSTidStore *store);
+extern bool zs_tidstore_iterate_next(ZSTidStore *store, zstid *tid);
+
+extern Size zs_tidstore_shared_size(ZSTidStore *store);
+extern void zs_tidstore_share(ZSTidStore *store, void *dst);
+extern ZSTidStore *zs_tidstore_attach(void *src);
+
+#endif							/* ZEDSTORE_TIDSTORE_H */
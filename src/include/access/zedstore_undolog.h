@@ -40,6 +40,17 @@ typedef struct
 	int32		offset;		/* int16 would suffice, but avoid padding */
 } ZSUndoRecPtr;
 
+/*
+ * Each UNDO page is assigned a range of ZS_UNDO_PAGE_COUNTERS counter values
+ * when it's created, and the records on it use the values from that range in
+ * order. Pages are assigned ranges in the order that they are linked into the
+ * UNDO chain, so the counters still increase as you walk the chain, even
+ * though several pages can be inserted to at the same time. Every record
+ * takes at least one byte, so a page cannot run out of counter values
+ * before it runs out of space.
+ */
+#define ZS_UNDO_PAGE_COUNTERS	((uint64) BLCKSZ)
+
 /* TODO: assert that blkno and offset match, too, if counter matches */
 #define ZSUndoRecPtrEquals(a, b) ((a).counter == (b).counter)
 
@@ -94,6 +105,18 @@ typedef struct
 	char	   *ptr;
 } zs_undo_reservation;
 
+/*
+ * Summary of a table's UNDO log, returned by zsundo_get_stats().
+ */
+typedef struct
+{
+	BlockNumber	head;			/* oldest page */
+	BlockNumber	tail;			/* newest page */
+	uint64		npages;			/* number of pages in the chain */
+	uint64		tail_counter;	/* first counter value of the newest page */
+	uint64		oldest_counter;	/* oldest UNDO record that's still needed */
+} ZSUndoLogStats;
+
 /* prototypes for functions in zedstore_undolog.c */
 extern void zsundo_insert_reserve(Relation rel, size_t size, zs_undo_reservation *reservation_p);
 extern void zsundo_insert_finish(zs_undo_reservation *reservation);
@@ -101,6 +124,7 @@ extern void zsundo_insert_finish(zs_undo_reservation *reservation);
 extern char *zsundo_fetch(Relation rel, ZSUndoRecPtr undoptr, Buffer *buf_p, int lockmode, bool missing_ok);
 
 extern void zsundo_discard(Relation rel, ZSUndoRecPtr oldest_undorecptr);
+extern void zsundo_get_stats(Relation rel, ZSUndoLogStats *stats);
 
 extern void zsundo_newpage_redo(XLogReaderState *record);
 extern void zsundo_discard_redo(XLogReaderState *record);
@@ -21,10 +21,19 @@
 #define ZSUNDO_TYPE_UPDATE		3
 #define ZSUNDO_TYPE_TUPLE_LOCK	4
 
+/*
+ * Hint bits in ZSUndoRec, caching the commit status of 'xid'. Like the
+ * hint bits on heap tuples, they are set opportunistically, and without
+ * WAL-logging, when the status is first looked up in the CLOG.
+ */
+#define ZSUNDO_XID_COMMITTED	0x01
+#define ZSUNDO_XID_ABORTED		0x02
+
 struct ZSUndoRec
 {
 	int16		size;			/* size of this record, including header */
 	uint8		type;			/* ZSUNDO_TYPE_* */
+	uint8		hintbits;		/* ZSUNDO_XID_* hint bits, not WAL-logged */
 	ZSUndoRecPtr undorecptr;
 	TransactionId xid;
 	CommandId	cid;
@@ -57,7 +66,16 @@ typedef struct
 
 } ZSUndoRec_Insert;
 
-#define ZSUNDO_NUM_TIDS_PER_DELETE	10
+/*
+ * A range of consecutive TIDs deleted by the same DELETE record.
+ */
+typedef struct
+{
+	zstid		firsttid;
+	zstid		endtid;			/* exclusive */
+} ZSUndoTidRange;
+
+#define ZSUNDO_NUM_RANGES_PER_DELETE	5
 
 typedef struct
 {
@@ -67,10 +85,13 @@ typedef struct
 
 	/*
 	 * One deletion record can represent deleting up to
-	 * ZSUNDO_NUM_TIDS_PER_DELETE tuples. The 'rec.tid' field is unused.
+	 * ZSUNDO_NUM_RANGES_PER_DELETE ranges of consecutive tuples. A DELETE
+	 * that sweeps through a table in TID order typically deletes long runs
+	 * of consecutive TIDs, so a single record can cover a large number of
+	 * tuples. The 'rec.tid' field is unused.
 	 */
-	uint16		num_tids;
-	zstid		tids[ZSUNDO_NUM_TIDS_PER_DELETE];
+	uint16		num_ranges;
+	ZSUndoTidRange ranges[ZSUNDO_NUM_RANGES_PER_DELETE];
 
 	/*
 	 * TODO: It might be good to move the deleted tuple to the undo-log, so
@@ -170,6 +191,7 @@ typedef struct zs_pending_undo_op  zs_pending_undo_op;
 
 /* prototypes for functions in zedstore_undorec.c */
 extern struct ZSUndoRec *zsundo_fetch_record(Relation rel, ZSUndoRecPtr undorecptr);
+extern void zsundo_set_hint_bits(Relation rel, struct ZSUndoRec *undorec, uint8 hintbits);
 
 extern zs_pending_undo_op *zsundo_create_for_delete(Relation rel, TransactionId xid, CommandId cid, zstid tid,
 													bool changedPart, ZSUndoRecPtr prev_undo_ptr);
@@ -189,8 +211,13 @@ extern void XLogRegisterUndoOp(uint8 block_id, zs_pending_undo_op *undo_op);
 extern Buffer XLogRedoUndoOp(XLogReaderState *record, uint8 block_id);
 
 struct VacuumParams;
+extern TransactionId zsundo_xmin_horizon(Relation rel);
+extern void zsundo_trim_all(Relation rel);
 extern void zsundo_vacuum(Relation rel, struct VacuumParams *params, BufferAccessStrategy bstrategy,
 			  TransactionId OldestXmin);
+struct dsm_segment;
+struct shm_toc;
+extern void zsundo_parallel_vacuum_main(struct dsm_segment *seg, struct shm_toc *toc);
 extern ZSUndoRecPtr zsundo_get_oldest_undo_ptr(Relation rel, bool attempt_trim);
 
 #endif							/* ZEDSTORE_UNDOREC_H */
@@ -16,6 +16,7 @@
 #include "access/zedstore_undolog.h"
 #include "lib/stringinfo.h"
 #include "storage/off.h"
+#include "storage/relfilenode.h"
 
 #define WAL_ZEDSTORE_INIT_METAPAGE			0x00
 #define WAL_ZEDSTORE_UNDO_NEWPAGE			0x10
@@ -28,6 +29,8 @@
 #define WAL_ZEDSTORE_TOAST_NEWPAGE			0x80
 #define WAL_ZEDSTORE_FPM_DELETE_PAGE		0x90
 #define WAL_ZEDSTORE_FPM_REUSE_PAGE			0xA0
+#define WAL_ZEDSTORE_FPM_EXTENT				0xB0
+#define WAL_ZEDSTORE_LOGICAL_CHANGE		0xC0
 
 /* in zedstore_wal.c */
 extern void zedstore_redo(XLogReaderState *record);
@@ -41,7 +44,8 @@ extern const char *zedstore_identify(uint8 info);
  * WAL record for initializing zedstore metapage (WAL_ZEDSTORE_INIT_METAPAGE)
  *
  * These records always use a full-page image, so this data is really just
- * for debugging purposes.
+ * for debugging purposes. blkref #0 is the metapage, and #1, if present, is
+ * a root directory overflow page that was modified together with it.
  */
 typedef struct wal_zedstore_init_metapage
 {
@@ -52,13 +56,18 @@ typedef struct wal_zedstore_init_metapage
 
 /*
  * WAL record for extending the UNDO log with one page.
+ *
+ * blkref #0 is the metapage, #1 is the previous last page in the UNDO chain,
+ * if any, and #2 is the new page. The new page becomes the last page in the
+ * chain, and the active page in slot 'active_slot'.
  */
 typedef struct wal_zedstore_undo_newpage
 {
 	uint64		first_counter;
+	uint16		active_slot;	/* index in zs_undo_active[] */
 } wal_zedstore_undo_newpage;
 
-#define SizeOfZSWalUndoNewPage (offsetof(wal_zedstore_undo_newpage, first_counter) + sizeof(uint64))
+#define SizeOfZSWalUndoNewPage (offsetof(wal_zedstore_undo_newpage, active_slot) + sizeof(uint16))
 
 /*
  * WAL record for updating the oldest undo pointer on the metapage, after
@@ -66,9 +75,10 @@ typedef struct wal_zedstore_undo_newpage
  *
  * blkref #0 is the metapage.
  *
- * If an old UNDO page was discarded away, advancing zs_undo_head, that page
- * is stored as blkref #1. The new block number to store in zs_undo_head is
- * stored as the data of blkref #0.
+ * The UNDO pages that were discarded away, advancing zs_undo_head, are
+ * stored as blkrefs #1 to #ndiscarded, oldest first. They are added to the
+ * free list in that order: the first one points to prev_fpm_head, and each
+ * one after that to the page before it, so no per-page data is needed.
  */
 typedef struct wal_zedstore_undo_discard
 {
@@ -76,26 +86,42 @@ typedef struct wal_zedstore_undo_discard
 
 	/*
 	 * Next oldest remaining block in the UNDO chain. This is not the same as
-	 * oldest_undorecptr.block, if we are discarding multiple UNDO blocks. We will
-	 * update oldest_undorecptr in the first iteration already, so that visibility
-	 * checks can use the latest value immediately. But we can't hold a potentially
-	 * unlimited number of pages locked while we mark them as deleted, so they are
-	 * deleted one by one, and each deletion is WAL-logged separately.
+	 * oldest_undorecptr.block, if we are discarding more UNDO blocks than fit
+	 * in one record. We will update oldest_undorecptr in the first record
+	 * already, so that visibility checks can use the latest value
+	 * immediately. But we don't want to hold a potentially unlimited number
+	 * of pages locked while we mark them as deleted, so they are deleted in
+	 * batches of ZS_UNDO_DISCARD_BATCH, and each batch is WAL-logged
+	 * separately.
 	 */
 	BlockNumber	oldest_undopage;
+
+	BlockNumber prev_fpm_head;	/* zs_undo_fpm_head before the discard */
+	uint16		ndiscarded;		/* number of discarded pages */
 } wal_zedstore_undo_discard;
 
-#define SizeOfZSWalUndoDiscard (offsetof(wal_zedstore_undo_discard, oldest_undopage) + sizeof(BlockNumber))
+#define SizeOfZSWalUndoDiscard (offsetof(wal_zedstore_undo_discard, ndiscarded) + sizeof(uint16))
+
+/* max. number of UNDO pages discarded in one WAL record */
+#define ZS_UNDO_DISCARD_BATCH	(XLR_MAX_BLOCK_ID - 1)
 
 /*
  * WAL record for creating a new, empty, root page for an attribute.
+ *
+ * blkref #0 is the page holding the attribute's root directory entry, i.e.
+ * the metapage, or a root directory overflow page, and #1 is the new root.
+ * The new tree of a column rewrite is always recorded on the metapage.
  */
 typedef struct wal_zedstore_btree_new_root
 {
 	AttrNumber	attno;		/* 0 means TID tree */
+
+	/* for the new tree of a column rewrite, see ZSPendingRewrite */
+	int16		rewrite_slot;	/* -1 if not a rewrite */
+	TransactionId rewrite_xid;
 } wal_zedstore_btree_new_root;
 
-#define SizeOfZSWalBtreeNewRoot	(offsetof(wal_zedstore_btree_new_root, attno) + sizeof(AttrNumber))
+#define SizeOfZSWalBtreeNewRoot	(offsetof(wal_zedstore_btree_new_root, rewrite_xid) + sizeof(TransactionId))
 
 /*
  * WAL record for replacing/adding items to the TID tree.
@@ -116,6 +142,10 @@ typedef struct wal_zedstore_tidleaf_items
  *
  * block #0 is UNDO buffer, if any.
  * The rest are the b-tree pages (numpages).
+ *
+ * Each page is logged as a full-page image, unless 'special_only' or
+ * 'delta' is set. With 'special_only', the block data contains the new
+ * special area. With 'delta', it contains a wal_zedstore_page_delta.
  */
 typedef struct wal_zedstore_btree_rewrite_pages
 {
@@ -126,11 +156,48 @@ typedef struct wal_zedstore_btree_rewrite_pages
 	{
 		bool		recycle;
 		bool		special_only;
+		bool		delta;
 	} pageinfo[FLEXIBLE_ARRAY_MEMBER];
 } wal_zedstore_btree_rewrite_pages;
 
 #define SizeOfZSWalBtreeRewritePages(numpages) (offsetof(wal_zedstore_btree_rewrite_pages, pageinfo[numpages]))
 
+/*
+ * Delta of a rewritten page, against its old contents.
+ *
+ * When a leaf page is rewritten, e.g. to merge new data into a compressed
+ * stream, much of the new page is often the same as before: the part of a
+ * recompressed stream before the change usually recompresses to the same
+ * bytes, and the end of the upper area might not change at all. So instead
+ * of a full-page image, we can log just the differences.
+ *
+ * The lower area (from the end of the page header to pd_lower) and the upper
+ * area (from pd_upper to pd_special) are each described as: 'head' bytes that
+ * are always included in the record (where stream headers live), then 'keep'
+ * bytes that are the same as in the old area at the same distance from its
+ * start, then new bytes that are included in the record, and finally 'tail'
+ * bytes that are the same as at the end of the old area. Those are followed
+ * by the whole new special area.
+ *
+ * The bytes in the record follow this struct, in order: lower head, lower
+ * middle, upper head, upper middle, special area.
+ */
+typedef struct wal_zedstore_page_delta
+{
+	uint16		pd_flags;		/* new values of the page header fields */
+	uint16		pd_lower;
+	uint16		pd_upper;
+
+	uint16		lower_head;
+	uint16		lower_keep;
+	uint16		lower_tail;
+	uint16		upper_head;
+	uint16		upper_keep;
+	uint16		upper_tail;
+} wal_zedstore_page_delta;
+
+#define SizeOfZSWalPageDelta	(offsetof(wal_zedstore_page_delta, upper_tail) + sizeof(uint16))
+
 /*
  * WAL record for a change to attribute leaf page.
  *
@@ -145,7 +212,11 @@ typedef struct wal_zedstore_btree_rewrite_pages
  * area on the page conceptually moved to the beginning of the upper
  * area, before the replacement data in the record is applied.
  *
- * The block data 0 contains new data, which overwrites the data
+ * The record can describe changes to several pages, see
+ * zsbt_attr_add_multi(). The main data is then an array of these structs,
+ * one for each block reference, in order.
+ *
+ * The block data contains new data, which overwrites the data
  * between begin_offset and end_offset. Not all data in the stream
  * needs to be overwritten, that is, begin_offset and end_offset
  * don't need to cover the whole stream. That allows efficiently
@@ -154,6 +225,9 @@ typedef struct wal_zedstore_btree_rewrite_pages
  * decompressed, some changes are made, and the stream is
  * recompressed, the part before the change will usually re-compress
  * to the same bytes.)
+ *
+ * The record also carries the new synopsis of the page, see
+ * ZSBtreePageOpaque.
  */
 typedef struct wal_zedstore_attstream_change
 {
@@ -173,9 +247,15 @@ typedef struct wal_zedstore_attstream_change
 
 	uint16		begin_offset;
 	uint16		end_offset;
+
+	/* new synopsis of the page */
+	bool		has_synopsis;
+	uint32		new_nullcount;
+	int64		new_minval;
+	int64		new_maxval;
 } wal_zedstore_attstream_change;
 
-#define SizeOfZSWalAttstreamChange (offsetof(wal_zedstore_attstream_change, end_offset) + sizeof(uint16))
+#define SizeOfZSWalAttstreamChange (offsetof(wal_zedstore_attstream_change, new_maxval) + sizeof(int64))
 
 /*
  * WAL record for zedstore toasting. When a large datum spans multiple pages,
@@ -196,19 +276,76 @@ typedef struct wal_zedstore_toast_newpage
 
 #define SizeOfZSWalToastNewPage (offsetof(wal_zedstore_toast_newpage, offset) + sizeof(int32))
 
+/*
+ * Adding a page to, or taking a page from, one of the free page lists.
+ * 'undo' indicates the list of free UNDO pages, rather than the main FPM.
+ */
 typedef struct wal_zedstore_fpm_delete_page
 {
 	BlockNumber	next_free_blkno;
+	bool		undo;
 } wal_zedstore_fpm_delete_page;
 
-#define SizeOfZSWalFpmDeletePage (offsetof(wal_zedstore_fpm_delete_page, next_free_blkno) + sizeof(BlockNumber))
+#define SizeOfZSWalFpmDeletePage (offsetof(wal_zedstore_fpm_delete_page, undo) + sizeof(bool))
 
 typedef struct wal_zedstore_fpm_reuse_page
 {
 	BlockNumber	next_free_blkno;
+	bool		undo;
 } wal_zedstore_fpm_reuse_page;
 
-#define SizeOfZSWalFpmReusePage (offsetof(wal_zedstore_fpm_reuse_page, next_free_blkno) + sizeof(BlockNumber))
+#define SizeOfZSWalFpmReusePage (offsetof(wal_zedstore_fpm_reuse_page, undo) + sizeof(bool))
+
+/*
+ * Reserving a new extent, or allocating a block from an existing one. The
+ * metapage is registered as block 0.
+ */
+typedef struct wal_zedstore_fpm_extent
+{
+	uint16		slot;
+	BlockNumber	next;
+	BlockNumber	end;
+} wal_zedstore_fpm_extent;
+
+#define SizeOfZSWalFpmExtent (offsetof(wal_zedstore_fpm_extent, end) + sizeof(BlockNumber))
+
+/*
+ * Logical description of a row change, for logical decoding
+ * (WAL_ZEDSTORE_LOGICAL_CHANGE).
+ *
+ * The physical records describe changes to individual TID and attribute
+ * trees, often long after the change was made, so the rows cannot be
+ * reconstructed from them. With wal_level=logical, each insert, update and
+ * delete on a zedstore table also writes one of these. It doesn't reference
+ * any blocks, and is a no-op at replay.
+ *
+ * The struct is followed by 'ntuples' tuples, each stored as a uint32
+ * length, followed by that many bytes: an xl_heap_header, and the tuple
+ * data starting at t_bits, like in heap WAL records. None of this is
+ * aligned. The tuples are, for each action:
+ *
+ * ZSLOGICAL_INSERT: the new tuples
+ * ZSLOGICAL_UPDATE: the new tuple, and the old key if ZSLOGICAL_HAS_OLD
+ * ZSLOGICAL_DELETE: the old key, if ZSLOGICAL_HAS_OLD
+ *
+ * The old key contains the replica identity columns, or all columns with
+ * REPLICA IDENTITY FULL, and NULLs for the rest.
+ */
+typedef struct wal_zedstore_logical_change
+{
+	RelFileNode node;
+	uint8		action;
+	uint8		flags;
+	uint16		ntuples;
+} wal_zedstore_logical_change;
+
+#define SizeOfZSWalLogicalChange (offsetof(wal_zedstore_logical_change, ntuples) + sizeof(uint16))
+
+#define ZSLOGICAL_INSERT		1
+#define ZSLOGICAL_UPDATE		2
+#define ZSLOGICAL_DELETE		3
+
+#define ZSLOGICAL_HAS_OLD		0x01
 
 extern void zsbt_tidleaf_items_redo(XLogReaderState *record, bool replace);
 extern void zsmeta_new_btree_root_redo(XLogReaderState *record);
@@ -216,5 +353,6 @@ extern void zsbt_rewrite_pages_redo(XLogReaderState *record);
 extern void zstoast_newpage_redo(XLogReaderState *record);
 extern void zspage_delete_page_redo(XLogReaderState *record);
 extern void zspage_reuse_page_redo(XLogReaderState *record);
+extern void zspage_extent_redo(XLogReaderState *record);
 
 #endif							/* ZEDSTORE_WAL_H */
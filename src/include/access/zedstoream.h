@@ -10,8 +10,24 @@
 #ifndef ZEDSTOREAM_H
 #define ZEDSTOREAM_H
 
+/* GUC variable, in kB */
+extern int	zedstore_tuple_buffer_size;
+
+/* GUC variable, in blocks */
+extern int	zedstore_autovacuum_undo_threshold;
+
+/* GUC variable */
+extern bool zedstore_load_statistics;
+
+/* GUC variable, for testing */
+extern int	zedstore_debug_rootdir_items;
+
 extern void AtEOXact_zedstore_tuplebuffers(bool isCommit);
 extern void AtSubStart_zedstore_tuplebuffers(void);
 extern void AtEOSubXact_zedstore_tuplebuffers(bool isCommit);
+extern void AtEOXact_zedstore_freepages(void);
+extern void AtEOXact_zedstore_loadstats(void);
+
+extern void zsundo_autovacuum_trim(Oid relid);
 
 #endif							/* ZEDSTOREAM_H */
@@ -302,6 +302,19 @@ typedef struct AggStatePerHashData
 	AttrNumber *hashGrpColIdxInput; /* hash col indices in input slot */
 	AttrNumber *hashGrpColIdxHash;	/* indices in hash table tuples */
 	Agg		   *aggnode;		/* original Agg node, for numGroups etc. */
+
+	/*
+	 * With a single grouping column, the group of the previous input row, see
+	 * lookup_hash_entry(). 'lastkey' points into the group's representative
+	 * tuple, and 'lastpergroup' is its per-group data; both stay put while
+	 * the hash table grows, unlike the hash table entry itself.
+	 */
+	FmgrInfo	keyeqfunction;	/* equality fn of the grouping column */
+	AggStatePerGroup lastpergroup;	/* NULL if none */
+	Datum		lastkey;
+	bool		lastkeyisnull;
+	int64		lastgroup_hits; /* rows that matched the previous group */
+	int64		lastgroup_misses;	/* rows that didn't */
 }			AggStatePerHashData;
 
 
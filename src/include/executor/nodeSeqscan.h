@@ -15,12 +15,18 @@
 #define NODESEQSCAN_H
 
 #include "access/parallel.h"
+#include "lib/bloomfilter.h"
 #include "nodes/execnodes.h"
 
 extern SeqScanState *ExecInitSeqScan(SeqScan *node, EState *estate, int eflags);
 extern void ExecEndSeqScan(SeqScanState *node);
 extern void ExecReScanSeqScan(SeqScanState *node);
 
+/* runtime join filter support */
+extern bool ExecSeqScanInitRuntimeFilter(SeqScanState *node, AttrNumber attno);
+extern void ExecSeqScanSetRuntimeFilter(SeqScanState *node, bloom_filter *filter,
+										FmgrInfo *hashfunc, Oid collation);
+
 /* parallel scan support */
 extern void ExecSeqScanEstimate(SeqScanState *node, ParallelContext *pcxt);
 extern void ExecSeqScanInitializeDSM(SeqScanState *node, ParallelContext *pcxt);
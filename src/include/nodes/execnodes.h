@@ -1341,6 +1341,27 @@ typedef struct SeqScanState
 {
 	ScanState	ss;				/* its first field is NodeTag */
 	Size		pscan_len;		/* size of parallel heap scan descriptor */
+
+	/* slots for fetching many tuples at a time, if the AM supports it */
+	TupleTableSlot **batch_slots;	/* NULL if not batching */
+	int			batch_size;		/* number of slots in batch_slots */
+	int			batch_nslots;	/* number of filled slots */
+	int			batch_next;		/* next slot to return */
+
+	/* columns fetched only for tuples that pass the quals, if any */
+	Bitmapset  *deferred_cols;
+	TupleTableSlot *deferred_slot;	/* last slot returned by the AM */
+
+	/* quals passed down to the AM as scan keys, if it supports them */
+	struct ScanKeyData *scan_keys;
+	int			num_scan_keys;
+	List	   *scan_key_quals; /* the quals the keys were made from */
+
+	/* runtime join filter from a parent hash join, see nodeSeqscan.c */
+	AttrNumber	filter_attno;	/* join key column, or InvalidAttrNumber */
+	struct bloom_filter *filter;	/* NULL until the hash table is built */
+	FmgrInfo   *filter_hashfunc;	/* hash function of the join key */
+	Oid			filter_collation;
 } SeqScanState;
 
 /* ----------------
@@ -1410,6 +1431,15 @@ typedef struct
  *		OrderByTypByVals   is the datatype of order by expression pass-by-value?
  *		OrderByTypLens	   typlens of the datatypes of order by expressions
  *		PscanLen		   size of parallel index scan descriptor
+ *
+ *		BatchSlots		   slots for fetching tuples in TID order, or NULL
+ *		BatchTids		   TIDs of the current batch, sorted
+ *		BatchFound		   was a visible tuple found for each TID?
+ *		BatchMaxSize	   number of slots in BatchSlots
+ *		BatchSize		   number of TIDs to read for the next batch
+ *		BatchNTids		   number of TIDs in the current batch
+ *		BatchNext		   next entry of the batch to return
+ *		BatchRecheck	   must the tuples of the batch be rechecked?
  * ----------------
  */
 typedef struct IndexScanState
@@ -1437,6 +1467,16 @@ typedef struct IndexScanState
 	bool	   *iss_OrderByTypByVals;
 	int16	   *iss_OrderByTypLens;
 	Size		iss_PscanLen;
+
+	/* These are used when fetching tuples in batches, in TID order */
+	TupleTableSlot **iss_BatchSlots;
+	ItemPointerData *iss_BatchTids;
+	bool	   *iss_BatchFound;
+	int			iss_BatchMaxSize;
+	int			iss_BatchSize;
+	int			iss_BatchNTids;
+	int			iss_BatchNext;
+	bool		iss_BatchRecheck;
 } IndexScanState;
 
 /* ----------------
@@ -1920,6 +1960,7 @@ typedef struct MergeJoinState
  *		hj_JoinState			current state of ExecHashJoin state machine
  *		hj_MatchedOuter			true if found a join match for current outer
  *		hj_OuterNotEmpty		true if outer relation known not empty
+ *		hj_FilterScan			outer scan to pass a runtime join filter to
  * ----------------
  */
 
@@ -1947,6 +1988,7 @@ typedef struct HashJoinState
 	int			hj_JoinState;
 	bool		hj_MatchedOuter;
 	bool		hj_OuterNotEmpty;
+	SeqScanState *hj_FilterScan;
 } HashJoinState;
 
 
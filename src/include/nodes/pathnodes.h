@@ -680,6 +680,10 @@ typedef struct RelOptInfo
 	BlockNumber pages;			/* size estimates derived from pg_class */
 	double		tuples;
 	double		allvisfrac;
+	BlockNumber scan_pages;		/* pages read by a seqscan of needed attrs */
+	Cost		scan_decode_cost;	/* per-tuple cost to decode needed attrs */
+	Expr	   *scan_order_expr;	/* a seqscan returns rows ordered by this, */
+	Oid			scan_order_opno;	/* ... per this "<" operator, if not NULL */
 	Bitmapset  *eclass_indexes; /* Indexes in PlannerInfo's eq_classes list of
 								 * ECs that mention this rel */
 	PlannerInfo *subroot;		/* if subquery */
@@ -393,6 +393,10 @@ typedef struct SampleScan
  *
  * indexorderdir specifies the scan ordering, for indexscans on amcanorder
  * indexes (for other indexes it should be "don't care").
+ *
+ * indexanyorder is true if nothing above the scan depends on the order of
+ * its output, so that the executor may return the rows in a different order
+ * than the index does, e.g. sorted by TID.
  * ----------------
  */
 typedef struct IndexScan
@@ -405,6 +409,7 @@ typedef struct IndexScan
 	List	   *indexorderbyorig;	/* the same in original form */
 	List	   *indexorderbyops;	/* OIDs of sort ops for ORDER BY exprs */
 	ScanDirection indexorderdir;	/* forward or backward or don't care */
+	bool		indexanyorder;	/* may rows be returned in any order? */
 } IndexScan;
 
 /* ----------------
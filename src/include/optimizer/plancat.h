@@ -33,6 +33,8 @@ extern List *infer_arbiter_indexes(PlannerInfo *root);
 extern void estimate_rel_size(Relation rel, int32 *attr_widths,
 							  BlockNumber *pages, double *tuples, double *allvisfrac);
 
+extern void estimate_rel_scan_pages(PlannerInfo *root, RelOptInfo *rel);
+
 extern int32 get_rel_data_width(Relation rel, int32 *attr_widths);
 extern int32 get_relation_data_width(Oid relid, int32 *attr_widths);
 
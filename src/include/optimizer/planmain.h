@@ -33,6 +33,7 @@ extern RelOptInfo *query_planner(PlannerInfo *root,
 /*
  * prototypes for plan/planagg.c
  */
+extern void preprocess_table_aggregates(PlannerInfo *root);
 extern void preprocess_minmax_aggregates(PlannerInfo *root);
 
 /*
@@ -189,6 +189,8 @@ extern BlockNumber RelationGetNumberOfBlocksInFork(Relation relation,
 												   ForkNumber forkNum);
 extern void FlushOneBuffer(Buffer buffer);
 extern void FlushRelationBuffers(Relation rel);
+extern void FlushRelationBlockRange(Relation rel, BlockNumber start,
+									BlockNumber end);
 extern void FlushDatabaseBuffers(Oid dbid);
 extern void DropRelFileNodeBuffers(RelFileNodeBackend rnode, ForkNumber *forkNum,
 								   int nforks, BlockNumber *firstDelBlock);
@@ -212,6 +214,8 @@ extern void MarkBufferDirtyHint(Buffer buffer, bool buffer_std);
 
 extern void UnlockBuffers(void);
 extern void LockBuffer(Buffer buffer, int mode);
+extern void LockBufferWithWaitEvent(Buffer buffer, int mode,
+									uint32 wait_event_info);
 extern bool ConditionalLockBuffer(Buffer buffer);
 extern bool ConditionalLockBufferInMode(Buffer buffer, int mode);
 extern void LockBufferForCleanup(Buffer buffer);
@@ -144,6 +144,8 @@ extern bool Trace_lwlocks;
 #endif
 
 extern bool LWLockAcquire(LWLock *lock, LWLockMode mode);
+extern bool LWLockAcquireWithWaitEvent(LWLock *lock, LWLockMode mode,
+									   uint32 wait_event_info);
 extern bool LWLockConditionalAcquire(LWLock *lock, LWLockMode mode);
 extern bool LWLockAcquireOrWait(LWLock *lock, LWLockMode mode);
 extern void LWLockRelease(LWLock *lock);
@@ -220,6 +222,13 @@ typedef enum BuiltinTrancheIds
 	LWTRANCHE_TBM,
 	LWTRANCHE_PARALLEL_APPEND,
 	LWTRANCHE_SXACT,
+	LWTRANCHE_ZEDSTORE_DECOMPCACHE,
+	LWTRANCHE_ZEDSTORE_STATS,
+	LWTRANCHE_ZEDSTORE_METAPAGE,
+	LWTRANCHE_ZEDSTORE_UNDO_TAIL,
+	LWTRANCHE_ZEDSTORE_RIGHTMOST_TID_LEAF,
+	LWTRANCHE_ZEDSTORE_FPM,
+	LWTRANCHE_ZEDSTORE_METACACHE,
 	LWTRANCHE_FIRST_USER_DEFINED
 }			BuiltinTrancheIds;
 
@@ -21,6 +21,13 @@ typedef struct AttributeOpts
 	int32		vl_len_;		/* varlena header (do not touch directly!) */
 	float8		n_distinct;
 	float8		n_distinct_inherited;
+	int			zedstore_compression;	/* ZSCompressionMethod */
+	bool		zedstore_compression_frames;
+	bool		zedstore_cold;
+	bool		zedstore_bloom;
+	int			zedstore_toast_threshold;	/* -1 for the built-in maximum */
+	int			zedstore_sort_key;	/* 1-based key position, 0 if not a key */
+	bool		zedstore_ordered;
 } AttributeOpts;
 
 AttributeOpts *get_attribute_options(Oid spcid, int attnum);
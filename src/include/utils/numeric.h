@@ -42,6 +42,13 @@
 struct NumericData;
 typedef struct NumericData *Numeric;
 
+/*
+ * Limits of numeric_to_scaled_int64() and numeric_from_scaled_int64(): the
+ * largest display scale handled, and the largest numeric constructed.
+ */
+#define NUMERIC_SCALED_INT64_MAX_DSCALE	18
+#define NUMERIC_SCALED_INT64_MAX_SIZE	(VARHDRSZ + sizeof(uint16) + 10 * sizeof(int16))
+
 /*
  * fmgr interface macros
  */
@@ -73,4 +80,7 @@ extern Numeric numeric_mod_opt_error(Numeric num1, Numeric num2,
 									 bool *have_error);
 extern int32 numeric_int4_opt_error(Numeric num, bool *error);
 
+extern bool numeric_to_scaled_int64(Numeric num, int64 *result, int *dscale);
+extern void numeric_from_scaled_int64(int64 val, int dscale, Numeric result);
+
 #endif							/* _PG_NUMERIC_H_ */
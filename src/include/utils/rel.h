@@ -271,6 +271,8 @@ typedef struct StdRdOptions
 	int			parallel_workers;	/* max number of parallel workers */
 	bool		vacuum_index_cleanup;	/* enables index vacuuming and cleanup */
 	bool		vacuum_truncate;	/* enables vacuum to truncate a relation */
+	int			zedstore_insert_lanes;	/* # of zedstore TID insertion lanes */
+	bool		zedstore_cold;	/* read zedstore pages through a ring */
 } StdRdOptions;
 
 #define HEAP_MIN_FILLFACTOR			10
@@ -326,6 +328,24 @@ typedef struct StdRdOptions
 	((relation)->rd_options ? \
 	 ((StdRdOptions *) (relation)->rd_options)->parallel_workers : (defaultpw))
 
+/*
+ * RelationGetZedstoreInsertLanes
+ *		Returns the relation's zedstore_insert_lanes reloption setting.
+ *		Note multiple eval of argument!
+ */
+#define RelationGetZedstoreInsertLanes(relation) \
+	((relation)->rd_options ? \
+	 ((StdRdOptions *) (relation)->rd_options)->zedstore_insert_lanes : 0)
+
+/*
+ * RelationIsZedstoreCold
+ *		Returns the relation's zedstore_cold reloption setting.
+ *		Note multiple eval of argument!
+ */
+#define RelationIsZedstoreCold(relation) \
+	((relation)->rd_options ? \
+	 ((StdRdOptions *) (relation)->rd_options)->zedstore_cold : false)
+
 /* ViewOptions->check_option values */
 typedef enum ViewOptCheckOption
 {
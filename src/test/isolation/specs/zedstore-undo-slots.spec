@@ -0,0 +1,63 @@
+# Many concurrent UPDATE/DELETE/row-lock operations on neighbouring rows of
+# a zedstore table.
+#
+# The rows are inserted by a single statement, so their TIDs are covered by
+# one TID array item. Each session then modifies or locks a different row,
+# so that the item needs more than four distinct UNDO pointers at the same
+# time, which requires the wide slot number encoding. Check that every
+# session sees its own changes but not the others', before and after some
+# of them commit and some abort, and that none of the row locks are left
+# behind.
+
+setup
+{
+  CREATE TABLE zs_undo_slots (a int, b int) USING zedstore;
+  INSERT INTO zs_undo_slots SELECT g, g FROM generate_series(1, 10) g;
+}
+
+teardown
+{
+  DROP TABLE zs_undo_slots;
+}
+
+session "s1"
+setup		{ BEGIN; }
+step "s1u"	{ UPDATE zs_undo_slots SET b = b + 100 WHERE a = 1; }
+step "s1sel"	{ SELECT string_agg(a || ':' || b, ' ' ORDER BY a) AS contents FROM zs_undo_slots; }
+step "s1c"	{ COMMIT; }
+
+session "s2"
+setup		{ BEGIN; }
+step "s2d"	{ DELETE FROM zs_undo_slots WHERE a = 2; }
+step "s2sel"	{ SELECT string_agg(a || ':' || b, ' ' ORDER BY a) AS contents FROM zs_undo_slots; }
+step "s2c"	{ COMMIT; }
+
+session "s3"
+setup		{ BEGIN; }
+step "s3l"	{ SELECT a FROM zs_undo_slots WHERE a = 3 FOR UPDATE; }
+step "s3sel"	{ SELECT string_agg(a || ':' || b, ' ' ORDER BY a) AS contents FROM zs_undo_slots; }
+step "s3r"	{ ROLLBACK; }
+
+session "s4"
+setup		{ BEGIN; }
+step "s4l"	{ SELECT a FROM zs_undo_slots WHERE a = 4 FOR SHARE; }
+step "s4sel"	{ SELECT string_agg(a || ':' || b, ' ' ORDER BY a) AS contents FROM zs_undo_slots; }
+step "s4c"	{ COMMIT; }
+
+session "s5"
+setup		{ BEGIN; }
+step "s5l"	{ SELECT a FROM zs_undo_slots WHERE a = 5 FOR KEY SHARE; }
+step "s5sel"	{ SELECT string_agg(a || ':' || b, ' ' ORDER BY a) AS contents FROM zs_undo_slots; }
+step "s5r"	{ ROLLBACK; }
+
+session "s6"
+setup		{ BEGIN; }
+step "s6u"	{ UPDATE zs_undo_slots SET b = b + 600 WHERE a = 6; }
+step "s6sel"	{ SELECT string_agg(a || ':' || b, ' ' ORDER BY a) AS contents FROM zs_undo_slots; }
+step "s6r"	{ ROLLBACK; }
+
+session "s7"
+step "s7sel"	{ SELECT string_agg(a || ':' || b, ' ' ORDER BY a) AS contents FROM zs_undo_slots; }
+step "s7u"	{ UPDATE zs_undo_slots SET b = -b WHERE a BETWEEN 3 AND 6; }
+
+permutation "s1u" "s2d" "s3l" "s4l" "s5l" "s6u" "s1sel" "s2sel" "s3sel" "s4sel" "s5sel" "s6sel" "s7sel" "s1c" "s2sel" "s2c" "s3sel" "s3r" "s4c" "s5r" "s6sel" "s6r" "s7sel" "s7u" "s7sel"
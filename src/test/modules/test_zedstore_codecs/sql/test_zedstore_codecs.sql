@@ -0,0 +1,257 @@
+CREATE EXTENSION test_zedstore_codecs;
+
+--
+-- The zs_codec_benchmark() function checks that the data survives each
+-- round trip, and throws an error if not. The timings vary, so only check
+-- that the results are sane.
+--
+SELECT operation, tid_pattern, value_pattern,
+       ns_per_elem >= 0 AS timed, bytes_per_elem > 0 AS sized
+  FROM zs_codec_benchmark(1000, 2);
+
+--
+-- zs_codec_roundtrip() encodes the array elements into an attribute stream,
+-- checks that they survive encoding, appending, merging and splitting, and
+-- shows which chunk modes were used.
+--
+
+-- Dictionary mode, for varlenas with few distinct values
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT (ARRAY['red', 'green', 'blue', 'cyan'])[i % 4 + 1]
+    FROM generate_series(1, 200) i));
+-- with NULLs mixed in, and gaps between the TIDs
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 5 = 0 THEN NULL
+              ELSE (ARRAY['red', 'green', 'blue', 'cyan'])[i % 4 + 1] END
+    FROM generate_series(1, 200) i),
+  ARRAY(SELECT i * 3 FROM generate_series(1, 200) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT (ARRAY['', 'a', NULL])[i % 3 + 1] FROM generate_series(1, 100) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT NULL::text FROM generate_series(1, 100) i));
+-- the dictionary is limited to 128 bytes, including a length byte per entry
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT repeat(chr(ascii('a') + i % 4), 31) FROM generate_series(1, 60) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT repeat(chr(ascii('a') + i % 4), 32) FROM generate_series(1, 60) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN repeat('x', 125) ELSE 'y' END
+    FROM generate_series(1, 60) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN repeat('x', 126) ELSE 'y' END
+    FROM generate_series(1, 60) i));
+-- values that don't repeat fall back to the regular modes
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT md5(i::text) FROM generate_series(1, 100) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i <= 100 THEN (ARRAY['on', 'off'])[i % 2 + 1] ELSE md5(i::text) END
+    FROM generate_series(1, 200) i));
+
+-- Run mode, for fixed-width values that repeat. A run chunk holds at most 60
+-- elements, and runs shorter than 8 elements aren't worth it.
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i / 100 FROM generate_series(1, 1000) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT v FROM (VALUES (1, 7), (2, 8), (3, 60), (4, 61), (5, 120)) AS r(v, n),
+                generate_series(1, n) ORDER BY v));
+-- runs of NULLs
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i / 50 % 2 = 0 THEN NULL ELSE 42 END::int8
+    FROM generate_series(1, 400) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i <= 100 THEN true WHEN i <= 200 THEN false END
+    FROM generate_series(1, 300) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i <= 59 THEN 3 END::int2 FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT 1.5::float8 FROM generate_series(1, 100) i));
+-- a run needs consecutive TIDs
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT 5::int8 FROM generate_series(1, 200) i),
+  ARRAY(SELECT i * 2 FROM generate_series(1, 200) i));
+
+-- Frame-of-reference mode, for 4- and 8-byte integers within a narrow range
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i FROM generate_series(1, 1000) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i % 2 FROM generate_series(1, 120) i));
+-- decreasing values, crossing zero
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT (1000 - i * 7)::int8 FROM generate_series(1, 300) i));
+-- the values are stored as offsets from the minimum, in at most 24 bits for
+-- int4 and 48 bits for int8
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 0 ELSE 16777215 END::int4
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 0 ELSE 16777216 END::int4
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN -2147483648 ELSE -2130706433 END::int4
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 2130706432 ELSE 2147483647 END::int4
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN -2147483648 ELSE 2147483647 END::int4
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 0 ELSE 281474976710655 END::int8
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 0 ELSE 281474976710656 END::int8
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN -9223372036854775808 ELSE -9223090561878065153 END::int8
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 9223090561878065152 ELSE 9223372036854775807 END::int8
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN -9223372036854775808 ELSE 9223372036854775807 END::int8
+    FROM generate_series(1, 120) i));
+-- the TID deltas within a chunk take at most 15 bits, and the first TID at
+-- most 40 bits
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i FROM generate_series(1, 120) i),
+  ARRAY(SELECT 1 + i * 32768 FROM generate_series(0, 119) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i FROM generate_series(1, 120) i),
+  ARRAY(SELECT 1 + i * 32769 FROM generate_series(0, 119) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i FROM generate_series(1, 120) i),
+  ARRAY(SELECT 1099511627776 + i FROM generate_series(0, 119) i));
+-- NULLs end a chunk
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 10 <> 0 THEN i END FROM generate_series(1, 120) i));
+
+-- Packed mode, for 1- and 2-byte values within a narrow range, with NULLs
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 7 <> 0 THEN i % 3 = 0 END FROM generate_series(1, 200) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 11 <> 0 THEN (i * 7919) % 13 - 6 END::int2
+    FROM generate_series(1, 200) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 4 <> 0 THEN chr(ascii('A') + i % 26)::"char" END
+    FROM generate_series(1, 120) i));
+-- a packed chunk holds at least 16 elements
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i % 2 = 0 FROM generate_series(1, 15) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i % 2 = 0 FROM generate_series(1, 16) i));
+-- int2 values are stored as offsets from the minimum, in at most 12 bits
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 0 ELSE 4095 END::int2
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 0 ELSE 4096 END::int2
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN -32768 ELSE -28673 END::int2
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 28672 ELSE 32767 END::int2
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN -32768 ELSE 32767 END::int2
+    FROM generate_series(1, 120) i));
+
+-- XOR mode, for 4- and 8-byte values that change slowly, like floats. The
+-- frame-of-reference mode is tried first, and takes floats with the same
+-- exponent.
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT (20 + (i % 200) * 0.125)::float8 FROM generate_series(1, 500) i));
+-- NaN, infinities and negative zero must survive bit for bit
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE i % 10 WHEN 0 THEN 'NaN' WHEN 3 THEN 'Infinity'
+                     WHEN 5 THEN '-Infinity' WHEN 7 THEN '-0'
+                     ELSE (i * 0.5)::float8 END::float8
+    FROM generate_series(1, 200) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE i % 10 WHEN 0 THEN 'NaN' WHEN 3 THEN 'Infinity'
+                     WHEN 5 THEN '-Infinity' WHEN 7 THEN '-0'
+                     ELSE (i * 0.5)::float4 END::float4
+    FROM generate_series(1, 200) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN '0' ELSE '-0' END::float8
+    FROM generate_series(1, 120) i));
+-- values that don't change slowly are stored as is
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT 1::float8 / i FROM generate_series(1, 120) i));
+-- NULLs end a chunk
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 10 <> 0 THEN 20 + (i % 200) * 0.125 END::float8
+    FROM generate_series(1, 200) i));
+-- the TID deltas within a chunk take at most 15 bits
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT (20 + (i % 200) * 0.125)::float8 FROM generate_series(1, 120) i),
+  ARRAY(SELECT 1 + i * 32768 FROM generate_series(0, 119) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT (20 + (i % 200) * 0.125)::float8 FROM generate_series(1, 120) i),
+  ARRAY(SELECT 1 + i * 32769 FROM generate_series(0, 119) i));
+
+-- Scaled numeric mode, for numerics with the same display scale that fit in
+-- an int64 when scaled
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i * 1.37 FROM generate_series(1, 200) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 10 <> 0 THEN i * 1.37 - 100 END FROM generate_series(1, 200) i));
+-- a scaled chunk holds at least 8 elements
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i * 1.37 FROM generate_series(1, 7) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i * 1.37 FROM generate_series(1, 8) i));
+-- the display scale can be at most 18
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i * 0.000000000000000001 FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT i * 0.0000000000000000001 FROM generate_series(1, 120) i));
+-- the scaled values must fit in an int64. In the second case of each pair
+-- below, every 10th value doesn't fit, and ends the chunk.
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT 9223372036854775807::numeric - i % 10 FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT 9223372036854775808::numeric - i % 10 FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT -9223372036854775807::numeric + i % 10 FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT -9223372036854775808::numeric + i % 10 FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT 922337203685477.5807 - (i % 10) * 0.0001 FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT 922337203685477.5808 - (i % 10) * 0.0001 FROM generate_series(1, 120) i));
+-- different scales, and NaNs, end a chunk
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 2 = 0 THEN 1.5 ELSE 2.25 END FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 10 <> 0 THEN i * 1.37 ELSE 'NaN' END FROM generate_series(1, 120) i));
+
+-- Front coding, for varlenas that share a prefix with the previous value
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 50 <> 0 THEN
+         '/srv/data/project-' || (i / 1000) || '/dir-' || lpad((i / 50)::text, 4, '0') ||
+         '/file-' || lpad(i::text, 6, '0') || '.dat' END
+    FROM generate_series(1, 300) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT '/srv/data/project-' || (i / 1000) || '/dir-' || lpad((i / 50)::text, 4, '0') ||
+           '/file-' || lpad(i::text, 6, '0') || '.dat'
+    FROM generate_series(1, 120) i),
+  ARRAY(SELECT 1 + i * 1000 FROM generate_series(0, 119) i));
+-- a front-coded chunk holds at least 4 elements
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT '/srv/data/project-' || (i / 1000) || '/dir-' || lpad((i / 50)::text, 4, '0') ||
+           '/file-' || lpad(i::text, 6, '0') || '.dat'
+    FROM generate_series(1, 3) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT '/srv/data/project-' || (i / 1000) || '/dir-' || lpad((i / 50)::text, 4, '0') ||
+           '/file-' || lpad(i::text, 6, '0') || '.dat'
+    FROM generate_series(1, 4) i));
+-- values that are a prefix of the next one, empty values, and values in
+-- descending order
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT repeat('a', i) FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT CASE WHEN i % 3 = 0 THEN '' ELSE 'key-' || (i / 2) END
+    FROM generate_series(1, 120) i));
+SELECT * FROM zs_codec_roundtrip(ARRAY(
+  SELECT repeat('z', 20) || lpad(i::text, 5, '0') FROM generate_series(120, 1, -1) i));
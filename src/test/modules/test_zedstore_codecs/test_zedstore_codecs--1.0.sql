@@ -0,0 +1,22 @@
+/* src/test/modules/test_zedstore_codecs/test_zedstore_codecs--1.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION test_zedstore_codecs" to load this file. \quit
+
+CREATE FUNCTION zs_codec_benchmark(nelems int4 DEFAULT 100000,
+                                   loops int4 DEFAULT 10,
+                                   OUT operation text,
+                                   OUT tid_pattern text,
+                                   OUT value_pattern text,
+                                   OUT ns_per_elem float8,
+                                   OUT bytes_per_elem float8)
+RETURNS SETOF record STRICT
+AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION zs_codec_roundtrip(vals anyarray,
+                                   tids int8[] DEFAULT NULL,
+                                   OUT mode text,
+                                   OUT chunks int4,
+                                   OUT elems int4)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME' LANGUAGE C;
@@ -0,0 +1,769 @@
+/*--------------------------------------------------------------------------
+ *
+ * test_zedstore_codecs.c
+ *		Micro-benchmarks and round-trip tests for the zedstore attribute
+ *		stream codecs.
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		src/test/modules/test_zedstore_codecs/test_zedstore_codecs.c
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/zedstore_internal.h"
+#include "access/zedstore_simple8b.h"
+#include "catalog/pg_attribute.h"
+#include "catalog/pg_type.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+PG_MODULE_MAGIC;
+
+PG_FUNCTION_INFO_V1(zs_codec_benchmark);
+PG_FUNCTION_INFO_V1(zs_codec_roundtrip);
+
+/*
+ * The values are stored in a pass-by-value column as wide as a Datum, i.e.
+ * int8 on 64-bit systems.
+ */
+#define BENCH_ATTLEN		((int16) sizeof(Datum))
+
+/* number of elements passed to append_attstream() at a time */
+#define APPEND_BATCH_SIZE	1000
+
+/*
+ * Number of elements appended at a time in the round-trip tests. Small, and
+ * not a divisor of the chunk sizes, so that chunks get cut at odd places.
+ */
+#define ROUNDTRIP_BATCH_SIZE	7
+
+static const char *const tid_patterns[] = {"sequential", "gapped", "random"};
+static const char *const value_patterns[] = {"constant", "low cardinality", "random"};
+
+/* Input data of the benchmarks */
+typedef struct
+{
+	int			nelems;
+	int			loops;
+	zstid	   *tids;
+	Datum	   *datums;
+	bool	   *isnulls;
+} bench_input;
+
+/* state of the pseudo-random number generator, see bench_random() */
+static uint64 bench_random_state;
+
+static uint64 bench_random(void);
+static void generate_tids(int pattern, bench_input *input);
+static void generate_values(int pattern, bench_input *input);
+static void verify_stream(attstream_buffer *buf, bench_input *input,
+						  const char *operation);
+static void verify_elements(attstream_buffer *buf, int nelems, zstid *tids,
+							Datum *datums, bool *isnulls, const char *operation);
+static bool datums_equal(attstream_buffer *buf, Datum a, Datum b);
+static ZSAttStream *make_attstream(attstream_buffer *buf);
+static double elapsed_ns_per_elem(instr_time start, bench_input *input);
+static void bench_attstream(Tuplestorestate *tupstore, TupleDesc tupdesc,
+							const char *tid_pattern, const char *value_pattern,
+							bench_input *input);
+static void bench_simple8b(Tuplestorestate *tupstore, TupleDesc tupdesc,
+						   const char *tid_pattern, bench_input *input);
+static void put_result(Tuplestorestate *tupstore, TupleDesc tupdesc,
+					   const char *operation, const char *tid_pattern,
+					   const char *value_pattern, double ns_per_elem,
+					   double bytes_per_elem);
+static void roundtrip_attstream(int16 attlen, bool attbyval, int nelems,
+								zstid *tids, Datum *datums, bool *isnulls);
+static void put_chunk_modes(Tuplestorestate *tupstore, TupleDesc tupdesc,
+							attstream_buffer *buf);
+
+/*
+ * SQL-callable entry point. Runs all the benchmarks, and returns a row for
+ * each operation and input distribution.
+ */
+Datum
+zs_codec_benchmark(PG_FUNCTION_ARGS)
+{
+	int32		nelems = PG_GETARG_INT32(0);
+	int32		loops = PG_GETARG_INT32(1);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	MemoryContext bench_cxt;
+	bench_input input;
+
+	if (nelems < 2 || nelems > 10000000)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of elements must be between 2 and 10000000")));
+	if (loops < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of loops must be at least 1")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* use a fixed seed, so that the encoded sizes are reproducible */
+	bench_random_state = UINT64CONST(0x9E3779B97F4A7C15);
+
+	input.nelems = nelems;
+	input.loops = loops;
+	input.tids = palloc(nelems * sizeof(zstid));
+	input.datums = palloc(nelems * sizeof(Datum));
+	input.isnulls = palloc0(nelems * sizeof(bool));
+
+	bench_cxt = AllocSetContextCreate(CurrentMemoryContext,
+									  "zedstore codec benchmark",
+									  ALLOCSET_DEFAULT_SIZES);
+
+	for (int t = 0; t < lengthof(tid_patterns); t++)
+	{
+		generate_tids(t, &input);
+
+		for (int v = 0; v < lengthof(value_patterns); v++)
+		{
+			generate_values(v, &input);
+
+			oldcontext = MemoryContextSwitchTo(bench_cxt);
+			bench_attstream(tupstore, tupdesc, tid_patterns[t], value_patterns[v],
+							&input);
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(bench_cxt);
+		}
+
+		oldcontext = MemoryContextSwitchTo(bench_cxt);
+		bench_simple8b(tupstore, tupdesc, tid_patterns[t], &input);
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(bench_cxt);
+	}
+
+	MemoryContextDelete(bench_cxt);
+
+	return (Datum) 0;
+}
+
+/*
+ * A simple xorshift64* generator. We don't want to use random(), so that
+ * the input doesn't depend on the platform, or on other users of it.
+ */
+static uint64
+bench_random(void)
+{
+	uint64		x = bench_random_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	bench_random_state = x;
+
+	return x * UINT64CONST(2685821657736338717);
+}
+
+static void
+generate_tids(int pattern, bench_input *input)
+{
+	zstid		tid = MinZSTid;
+
+	for (int i = 0; i < input->nelems; i++)
+	{
+		input->tids[i] = tid;
+
+		switch (pattern)
+		{
+			case 0:				/* sequential */
+				tid++;
+				break;
+			case 1:				/* runs of 100, with gaps of 1000 */
+				tid += (i % 100 == 99) ? 1000 : 1;
+				break;
+			case 2:				/* random gaps */
+				tid += 1 + bench_random() % 1000;
+				break;
+		}
+	}
+}
+
+static void
+generate_values(int pattern, bench_input *input)
+{
+	for (int i = 0; i < input->nelems; i++)
+	{
+		switch (pattern)
+		{
+			case 0:				/* constant */
+				input->datums[i] = (Datum) 42;
+				break;
+			case 1:				/* low cardinality */
+				input->datums[i] = (Datum) (bench_random() % 16);
+				break;
+			case 2:				/* random */
+				input->datums[i] = (Datum) bench_random();
+				break;
+		}
+	}
+}
+
+/*
+ * Check that 'buf' decodes back to the input.
+ */
+static void
+verify_stream(attstream_buffer *buf, bench_input *input, const char *operation)
+{
+	verify_elements(buf, input->nelems, input->tids, input->datums,
+					input->isnulls, operation);
+}
+
+/*
+ * Check that 'buf' decodes back to the given elements.
+ */
+static void
+verify_elements(attstream_buffer *buf, int nelems, zstid *tids,
+				Datum *datums, bool *isnulls, const char *operation)
+{
+	attstream_decoder decoder;
+	int			n = 0;
+
+	init_attstream_decoder(&decoder, buf->attbyval, buf->attlen);
+	decode_attstream_begin(&decoder, make_attstream(buf));
+	while (decode_attstream_cont(&decoder))
+	{
+		for (int i = 0; i < decoder.num_elements; i++)
+		{
+			if (n >= nelems ||
+				decoder.tids[i] != tids[n] ||
+				decoder.isnulls[i] != isnulls[n] ||
+				(!isnulls[n] && !datums_equal(buf, decoder.datums[i], datums[n])))
+				elog(ERROR, "%s: element %d did not survive the round trip",
+					 operation, n);
+			n++;
+		}
+	}
+	if (n != nelems)
+		elog(ERROR, "%s: decoded %d elements, expected %d",
+			 operation, n, nelems);
+	destroy_attstream_decoder(&decoder);
+}
+
+/*
+ * Are two datums of the stream's attribute binary equal? For varlenas, only
+ * the payload is compared, as the codecs are free to choose the header.
+ */
+static bool
+datums_equal(attstream_buffer *buf, Datum a, Datum b)
+{
+	if (buf->attbyval)
+		return a == b;
+	if (buf->attlen > 0)
+		return memcmp(DatumGetPointer(a), DatumGetPointer(b), buf->attlen) == 0;
+
+	return VARSIZE_ANY_EXHDR(a) == VARSIZE_ANY_EXHDR(b) &&
+		memcmp(VARDATA_ANY(a), VARDATA_ANY(b), VARSIZE_ANY_EXHDR(a)) == 0;
+}
+
+/*
+ * Wrap the chunks in 'buf' in an uncompressed ZSAttStream, like they would
+ * be stored on a page.
+ */
+static ZSAttStream *
+make_attstream(attstream_buffer *buf)
+{
+	int			len = buf->len - buf->cursor;
+	ZSAttStream *attstream;
+
+	attstream = palloc(SizeOfZSAttStreamHeader + len);
+	attstream->t_size = SizeOfZSAttStreamHeader + len;
+	attstream->t_flags = 0;
+	attstream->t_decompressed_size = len;
+	attstream->t_decompressed_bufsize = len;
+	attstream->t_lasttid = buf->lasttid;
+	memcpy(attstream->t_payload, buf->data + buf->cursor, len);
+
+	return attstream;
+}
+
+static double
+elapsed_ns_per_elem(instr_time start, bench_input *input)
+{
+	instr_time	duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	return INSTR_TIME_GET_DOUBLE(duration) * 1000000000.0 /
+		((double) input->nelems * input->loops);
+}
+
+/*
+ * Benchmark encoding, appending, decoding and merging attribute streams.
+ */
+static void
+bench_attstream(Tuplestorestate *tupstore, TupleDesc tupdesc,
+				const char *tid_pattern, const char *value_pattern,
+				bench_input *input)
+{
+	int			nelems = input->nelems;
+	attstream_buffer buf;
+	attstream_buffer half1;
+	attstream_buffer half2;
+	ZSAttStream *attstream;
+	attstream_decoder decoder;
+	FormData_pg_attribute attr;
+	zstid	   *tids;
+	Datum	   *datums;
+	bool	   *isnulls;
+	int			nhalf1;
+	int			nhalf2;
+	instr_time	start;
+	double		ns;
+
+	/* encode */
+	INSTR_TIME_SET_CURRENT(start);
+	for (int l = 0; l < input->loops; l++)
+	{
+		if (l > 0)
+			pfree(buf.data);
+		create_attstream(&buf, true, BENCH_ATTLEN, nelems,
+						 input->tids, input->datums, input->isnulls);
+	}
+	ns = elapsed_ns_per_elem(start, input);
+	verify_stream(&buf, input, "encode");
+	put_result(tupstore, tupdesc, "encode", tid_pattern, value_pattern, ns,
+			   (double) (buf.len - buf.cursor) / nelems);
+	pfree(buf.data);
+
+	/* append, in batches */
+	INSTR_TIME_SET_CURRENT(start);
+	for (int l = 0; l < input->loops; l++)
+	{
+		int			pos = 0;
+
+		if (l > 0)
+			pfree(buf.data);
+		init_attstream_buffer(&buf, true, BENCH_ATTLEN);
+		while (pos < nelems)
+		{
+			int			n = Min(APPEND_BATCH_SIZE, nelems - pos);
+
+			pos += append_attstream(&buf, pos + n == nelems, n,
+									&input->tids[pos], &input->datums[pos],
+									&input->isnulls[pos]);
+		}
+	}
+	ns = elapsed_ns_per_elem(start, input);
+	verify_stream(&buf, input, "append");
+	put_result(tupstore, tupdesc, "append", tid_pattern, value_pattern, ns,
+			   (double) (buf.len - buf.cursor) / nelems);
+
+	/* decode the stream we just built */
+	attstream = make_attstream(&buf);
+	init_attstream_decoder(&decoder, true, BENCH_ATTLEN);
+	INSTR_TIME_SET_CURRENT(start);
+	for (int l = 0; l < input->loops; l++)
+	{
+		int			n = 0;
+
+		decode_attstream_begin(&decoder, attstream);
+		while (decode_attstream_cont(&decoder))
+			n += decoder.num_elements;
+		if (n != nelems)
+			elog(ERROR, "decode: decoded %d elements, expected %d", n, nelems);
+	}
+	ns = elapsed_ns_per_elem(start, input);
+	destroy_attstream_decoder(&decoder);
+	put_result(tupstore, tupdesc, "decode", tid_pattern, value_pattern, ns,
+			   (double) (buf.len - buf.cursor) / nelems);
+	pfree(buf.data);
+
+	/*
+	 * merge two streams, with every other element in each, so that they
+	 * overlap fully
+	 */
+	tids = palloc(nelems * sizeof(zstid));
+	datums = palloc(nelems * sizeof(Datum));
+	isnulls = palloc(nelems * sizeof(bool));
+	nhalf1 = (nelems + 1) / 2;
+	nhalf2 = nelems / 2;
+	for (int i = 0; i < nelems; i++)
+	{
+		int			j = (i % 2 == 0) ? i / 2 : nhalf1 + i / 2;
+
+		tids[j] = input->tids[i];
+		datums[j] = input->datums[i];
+		isnulls[j] = input->isnulls[i];
+	}
+	create_attstream(&half1, true, BENCH_ATTLEN, nhalf1, tids, datums, isnulls);
+	create_attstream(&half2, true, BENCH_ATTLEN, nhalf2,
+					 &tids[nhalf1], &datums[nhalf1], &isnulls[nhalf1]);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.attlen = BENCH_ATTLEN;
+	attr.attbyval = true;
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (int l = 0; l < input->loops; l++)
+	{
+		if (l > 0)
+			pfree(buf.data);
+		buf = half1;
+		buf.data = palloc(half1.maxlen);
+		memcpy(buf.data, half1.data, half1.len);
+		merge_attstream_buffer(&attr, &buf, &half2);
+	}
+	ns = elapsed_ns_per_elem(start, input);
+	verify_stream(&buf, input, "merge");
+	put_result(tupstore, tupdesc, "merge", tid_pattern, value_pattern, ns,
+			   (double) (buf.len - buf.cursor) / nelems);
+}
+
+/*
+ * Benchmark Simple-8b encoding and decoding of the TID deltas.
+ */
+static void
+bench_simple8b(Tuplestorestate *tupstore, TupleDesc tupdesc,
+			   const char *tid_pattern, bench_input *input)
+{
+	int			nelems = input->nelems;
+	uint64	   *deltas;
+	uint64	   *codewords;
+	uint64	   *decoded;
+	int			ncodewords = 0;
+	instr_time	start;
+	double		ns;
+
+	deltas = palloc(nelems * sizeof(uint64));
+	for (int i = 0; i < nelems; i++)
+		deltas[i] = input->tids[i] - (i > 0 ? input->tids[i - 1] : 0);
+
+	/* in the worst case, each codeword holds one integer */
+	codewords = palloc(nelems * sizeof(uint64));
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (int l = 0; l < input->loops; l++)
+	{
+		int			pos = 0;
+
+		ncodewords = 0;
+		while (pos < nelems)
+		{
+			int			num_encoded;
+
+			codewords[ncodewords++] = simple8b_encode(&deltas[pos], nelems - pos,
+													  &num_encoded);
+			if (num_encoded == 0)
+				elog(ERROR, "simple8b encode: could not encode integer " UINT64_FORMAT,
+					 deltas[pos]);
+			pos += num_encoded;
+		}
+	}
+	ns = elapsed_ns_per_elem(start, input);
+	put_result(tupstore, tupdesc, "simple8b encode", tid_pattern, NULL, ns,
+			   (double) ncodewords * sizeof(uint64) / nelems);
+
+	decoded = palloc(nelems * sizeof(uint64));
+	INSTR_TIME_SET_CURRENT(start);
+	for (int l = 0; l < input->loops; l++)
+		simple8b_decode_words(codewords, ncodewords, decoded, nelems);
+	ns = elapsed_ns_per_elem(start, input);
+
+	for (int i = 0; i < nelems; i++)
+	{
+		if (decoded[i] != deltas[i])
+			elog(ERROR, "simple8b decode: integer %d did not survive the round trip", i);
+	}
+	put_result(tupstore, tupdesc, "simple8b decode", tid_pattern, NULL, ns,
+			   (double) ncodewords * sizeof(uint64) / nelems);
+}
+
+static void
+put_result(Tuplestorestate *tupstore, TupleDesc tupdesc,
+		   const char *operation, const char *tid_pattern,
+		   const char *value_pattern, double ns_per_elem,
+		   double bytes_per_elem)
+{
+	Datum		values[5];
+	bool		nulls[5];
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = CStringGetTextDatum(operation);
+	values[1] = CStringGetTextDatum(tid_pattern);
+	if (value_pattern)
+		values[2] = CStringGetTextDatum(value_pattern);
+	else
+		nulls[2] = true;
+	values[3] = Float8GetDatum(ns_per_elem);
+	values[4] = Float8GetDatum(bytes_per_elem);
+
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
+
+/*
+ * SQL-callable round-trip test. Encodes the elements of an array into an
+ * attribute stream, with the given TIDs or consecutive TIDs starting from 1,
+ * and checks that they survive encoding, appending in small batches, merging
+ * and splitting. Throws an error if not. Returns the encoding modes chosen
+ * for the chunks, with one row for each run of chunks in the same mode.
+ */
+Datum
+zs_codec_roundtrip(PG_FUNCTION_ARGS)
+{
+	ArrayType  *vals;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	Oid			elemtype;
+	int16		attlen;
+	bool		attbyval;
+	char		attalign;
+	Datum	   *datums;
+	bool	   *isnulls;
+	zstid	   *tids;
+	int			nelems;
+	attstream_buffer buf;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("array of values must not be null")));
+	vals = PG_GETARG_ARRAYTYPE_P(0);
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	elemtype = ARR_ELEMTYPE(vals);
+	get_typlenbyvalalign(elemtype, &attlen, &attbyval, &attalign);
+	if (attlen == -2)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cstring values are not supported")));
+	deconstruct_array(vals, elemtype, attlen, attbyval, attalign,
+					  &datums, &isnulls, &nelems);
+	if (nelems < 2)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("at least 2 values are required")));
+
+	tids = palloc(nelems * sizeof(zstid));
+	if (PG_ARGISNULL(1))
+	{
+		for (int i = 0; i < nelems; i++)
+			tids[i] = MinZSTid + i;
+	}
+	else
+	{
+		ArrayType  *tidarr = PG_GETARG_ARRAYTYPE_P(1);
+		Datum	   *tiddatums;
+		bool	   *tidnulls;
+		int			ntids;
+
+		deconstruct_array(tidarr, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd',
+						  &tiddatums, &tidnulls, &ntids);
+		if (ntids != nelems)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("number of TIDs must match the number of values")));
+		for (int i = 0; i < nelems; i++)
+		{
+			int64		tid = tidnulls[i] ? 0 : DatumGetInt64(tiddatums[i]);
+
+			if (tid < (int64) MinZSTid || (uint64) tid > MaxZSTid ||
+				(i > 0 && (zstid) tid <= tids[i - 1]))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("TIDs must be valid and in ascending order")));
+			tids[i] = (zstid) tid;
+		}
+	}
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	roundtrip_attstream(attlen, attbyval, nelems, tids, datums, isnulls);
+
+	create_attstream(&buf, attbyval, attlen, nelems, tids, datums, isnulls);
+	put_chunk_modes(tupstore, tupdesc, &buf);
+
+	return (Datum) 0;
+}
+
+/*
+ * Run the elements through each attstream operation, and check the result.
+ */
+static void
+roundtrip_attstream(int16 attlen, bool attbyval, int nelems,
+					zstid *tids, Datum *datums, bool *isnulls)
+{
+	attstream_buffer buf;
+	attstream_buffer half1;
+	attstream_buffer half2;
+	attstream_buffer right;
+	FormData_pg_attribute attr;
+	zstid	   *mtids;
+	Datum	   *mdatums;
+	bool	   *misnulls;
+	int			nhalf1;
+	int			nhalf2;
+	int			pos;
+	int			end;
+	int			nleft;
+
+	/* encode */
+	create_attstream(&buf, attbyval, attlen, nelems, tids, datums, isnulls);
+	verify_elements(&buf, nelems, tids, datums, isnulls, "encode");
+
+	/*
+	 * append, in small batches. Like the tuple buffers, pass everything that
+	 * append_attstream() hasn't encoded yet, up to the end of the batch.
+	 */
+	init_attstream_buffer(&buf, attbyval, attlen);
+	pos = 0;
+	end = 0;
+	while (pos < nelems)
+	{
+		end = Min(end + ROUNDTRIP_BATCH_SIZE, nelems);
+		pos += append_attstream(&buf, end == nelems, end - pos,
+								&tids[pos], &datums[pos], &isnulls[pos]);
+	}
+	verify_elements(&buf, nelems, tids, datums, isnulls, "append");
+
+	/* merge two streams, with every other element in each */
+	mtids = palloc(nelems * sizeof(zstid));
+	mdatums = palloc(nelems * sizeof(Datum));
+	misnulls = palloc(nelems * sizeof(bool));
+	nhalf1 = (nelems + 1) / 2;
+	nhalf2 = nelems / 2;
+	for (int i = 0; i < nelems; i++)
+	{
+		int			j = (i % 2 == 0) ? i / 2 : nhalf1 + i / 2;
+
+		mtids[j] = tids[i];
+		mdatums[j] = datums[i];
+		misnulls[j] = isnulls[i];
+	}
+	create_attstream(&half1, attbyval, attlen, nhalf1, mtids, mdatums, misnulls);
+	create_attstream(&half2, attbyval, attlen, nhalf2,
+					 &mtids[nhalf1], &mdatums[nhalf1], &misnulls[nhalf1]);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.attlen = attlen;
+	attr.attbyval = attbyval;
+	merge_attstream_buffer(&attr, &half1, &half2);
+	verify_elements(&half1, nelems, tids, datums, isnulls, "merge");
+
+	/* split in the middle, re-encoding the chunk at the split point */
+	create_attstream(&buf, attbyval, attlen, nelems, tids, datums, isnulls);
+	nleft = (nelems + 1) / 2;
+	split_attstream_buffer(&buf, &right, tids[nleft - 1]);
+	verify_elements(&buf, nleft, tids, datums, isnulls, "split left");
+	verify_elements(&right, nelems - nleft, &tids[nleft], &datums[nleft],
+					&isnulls[nleft], "split right");
+}
+
+/*
+ * Return a row for each run of consecutive chunks that use the same mode,
+ * with the number of chunks and elements in it.
+ */
+static void
+put_chunk_modes(Tuplestorestate *tupstore, TupleDesc tupdesc,
+				attstream_buffer *buf)
+{
+	attstream_decoder decoder;
+	const char *mode = NULL;
+	int			nchunks = 0;
+	int			nelems = 0;
+	bytea	   *chunk;
+	zstid		prevtid;
+	zstid		firsttid;
+	zstid		lasttid;
+	Datum		values[3];
+	bool		nulls[3];
+
+	memset(nulls, 0, sizeof(nulls));
+
+	init_attstream_decoder(&decoder, buf->attbyval, buf->attlen);
+	decode_attstream_begin(&decoder, make_attstream(buf));
+	for (;;)
+	{
+		bool		more;
+		const char *thismode = NULL;
+
+		more = get_attstream_chunk_cont(&decoder, &prevtid, &firsttid, &lasttid,
+										&chunk);
+		if (more)
+			thismode = attstream_chunk_mode_name(buf->attlen, VARDATA(chunk));
+
+		if (mode && (!more || strcmp(mode, thismode) != 0))
+		{
+			values[0] = CStringGetTextDatum(mode);
+			values[1] = Int32GetDatum(nchunks);
+			values[2] = Int32GetDatum(nelems);
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			nchunks = 0;
+			nelems = 0;
+		}
+		if (!more)
+			break;
+
+		mode = thismode;
+		nchunks++;
+		nelems += decoder.num_elements;
+	}
+	destroy_attstream_decoder(&decoder);
+}
@@ -1017,3 +1017,32 @@ select v||'a', case when v||'a' = 'aa' then 1 else 0 end, count(*)
 explain (costs off)
   select 1 from tenk1
    where (hundred, thousand) in (select twothousand, twothousand from onek);
+
+-- Test single-key hash aggregation, which reuses the previous row's group
+-- when consecutive rows have the same key
+set enable_sort = off;
+create temp table agg_runs (k int, v int);
+insert into agg_runs values (1, 1), (1, 2), (null, 3), (null, 4), (1, 5),
+  (2, 6), (null, 7), (2, 8), (2, 9), (1, 10);
+explain (costs off) select k, count(*), sum(v) from agg_runs group by k;
+-- runs of equal keys, with runs of NULL keys in between
+select string_agg(format('%s:%s:%s', k, c, s), ' ' order by k)
+  from (select k, count(*) c, sum(v) s from agg_runs group by k) ss;
+-- the check turns itself off when it keeps missing
+select string_agg(format('%s:%s:%s', k, c, s), ' ' order by k)
+  from (select case when i <= 3000 then i % 2 else 2 end as k,
+               count(*) c, sum(i) s
+          from generate_series(1, 4000) i
+         group by case when i <= 3000 then i % 2 else 2 end) ss;
+-- a rescan rebuilds the hash table, which must forget the previous group
+select x, (select string_agg(format('%s:%s', k, c), ' ' order by k)
+             from (select k, count(*) c from agg_runs where v <= x
+                    group by k) ss)
+  from (values (2), (4), (10)) o(x);
+-- with grouping sets, each hash table remembers its own previous group
+select x, (select string_agg(format('%s/%s:%s', k, g, c), ' ' order by k, g)
+             from (select k, v % 2 as g, count(*) c from agg_runs where v <= x
+                    group by grouping sets ((k), (v % 2))) ss)
+  from (values (4), (10)) o(x);
+reset enable_sort;
+drop table agg_runs;
@@ -30,6 +30,22 @@ checkpoint;
 
 SET search_path='public';
 
+-- Label for the machine-readable results, e.g. the commit being tested:
+--   psql -v label=`git rev-parse --short HEAD` -f driver.sql postgres
+\if :{?label}
+\else
+\set label 'unlabeled'
+\endif
+
+-- Write the results to a CSV file, one line per test and access method, so
+-- that runs on different commits can be compared.
+COPY (SELECT :'label' AS label, 'heap' AS am, testname, time, size, walsize
+        FROM storagetest_heap.results
+      UNION ALL
+      SELECT :'label', 'zedstore', testname, time, size, walsize
+        FROM storagetest_zedstore.results)
+  TO '/tmp/storageperf-results.csv' WITH (FORMAT csv, HEADER);
+
 SELECT COALESCE(h.testname, zs.testname) as testname,
        h.time as "heap time",
        h.size as "heap size",
@@ -0,0 +1,28 @@
+-- Single-row INSERTs, with many concurrent clients. They all append to the
+-- end of the table, so this measures the contention there.
+--
+-- Like in lockperf.sql, pgbench goes through a view in the public schema.
+
+drop view if exists public.concurrentinsert_redirector;
+
+CREATE TABLE concurrentinsert (i int4, a int4, b text);
+
+CREATE VIEW public.concurrentinsert_redirector AS SELECT * FROM concurrentinsert;
+
+select pg_current_wal_insert_lsn() as wal_before, extract(epoch from now()) as time_before
+\gset
+
+\! echo "\set i random(1, 1000000)" > /tmp/concurrentinsert-pgbench-script.sql
+\! echo "INSERT INTO concurrentinsert_redirector VALUES (:i, :client_id, 'row ' || :i);" >> /tmp/concurrentinsert-pgbench-script.sql
+
+\! pgbench -n -t5000 -c 20 -j 4 -f /tmp/concurrentinsert-pgbench-script.sql postgres
+
+select pg_current_wal_insert_lsn() as wal_after, extract(epoch from now()) as time_after
+\gset
+INSERT INTO results (testname, size, walsize, time)
+  VALUES ('pgbench, concurrent INSERT',
+          pg_total_relation_size('concurrentinsert'),
+	  :'wal_after'::pg_lsn - :'wal_before',
+	  :time_after - :time_before);
+
+drop view public.concurrentinsert_redirector;
@@ -0,0 +1,32 @@
+-- Single-row lookups through an index, with many concurrent clients.
+--
+-- pgbench connects to the 'postgres' database, and doesn't know which
+-- schema we're testing, so it goes through a view in the public schema,
+-- like in lockperf.sql.
+
+drop view if exists public.pointfetch_redirector;
+
+CREATE TABLE pointfetch (i int4 PRIMARY KEY, a int4, b text, c int4);
+
+CREATE VIEW public.pointfetch_redirector AS SELECT * FROM pointfetch;
+
+INSERT INTO pointfetch SELECT g, g, 'row ' || g, g FROM generate_series(1, 1000000) g;
+VACUUM ANALYZE pointfetch;
+
+select pg_current_wal_insert_lsn() as wal_before, extract(epoch from now()) as time_before
+\gset
+
+\! echo "\set i random(1, 1000000)" > /tmp/pointfetch-pgbench-script.sql
+\! echo "SELECT a, b FROM pointfetch_redirector WHERE i = :i" >> /tmp/pointfetch-pgbench-script.sql
+
+\! pgbench -n -t10000 -c 20 -j 4 -f /tmp/pointfetch-pgbench-script.sql postgres
+
+select pg_current_wal_insert_lsn() as wal_after, extract(epoch from now()) as time_after
+\gset
+INSERT INTO results (testname, size, walsize, time)
+  VALUES ('pgbench, index fetch',
+          pg_total_relation_size('pointfetch'),
+	  :'wal_after'::pg_lsn - :'wal_before',
+	  :time_after - :time_before);
+
+drop view public.pointfetch_redirector;
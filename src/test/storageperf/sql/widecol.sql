@@ -0,0 +1,93 @@
+-- Tests with a wide table, where queries only need a few of the columns.
+
+SELECT 'CREATE TABLE widecol (' || string_agg(format('c%s int4', g), ', ') || ')'
+  FROM generate_series(1, 50) g
+\gexec
+
+SELECT 'INSERT INTO widecol SELECT ' || string_agg(format('g + %s', i), ', ') ||
+       ' FROM generate_series(1, 200000) g'
+  FROM generate_series(1, 50) i
+\gexec
+
+COPY widecol TO '/tmp/widecol.data'; -- dump the data, for COPY test below.
+
+--
+-- Truncate and populate it again with the same data, using COPY.
+--
+TRUNCATE widecol;
+
+select pg_current_wal_insert_lsn() as wal_before, extract(epoch from now()) as time_before
+\gset
+
+COPY widecol FROM '/tmp/widecol.data';
+
+select pg_current_wal_insert_lsn() as wal_after, extract(epoch from now()) as time_after
+\gset
+
+INSERT INTO results (testname, size, walsize, time)
+  VALUES ('widecol, COPY',
+          pg_total_relation_size('widecol'),
+	  :'wal_after'::pg_lsn - :'wal_before',
+	  :time_after - :time_before);
+
+VACUUM FREEZE widecol;
+
+--
+-- SELECT one column. This is where a column store should shine.
+--
+
+select pg_current_wal_insert_lsn() as wal_before, extract(epoch from now()) as time_before
+\gset
+
+SELECT SUM(c25) FROM widecol;
+SELECT SUM(c25) FROM widecol;
+SELECT SUM(c25) FROM widecol;
+
+select pg_current_wal_insert_lsn() as wal_after, extract(epoch from now()) as time_after
+\gset
+
+INSERT INTO results (testname, size, walsize, time)
+  VALUES ('widecol, SELECT 1 column',
+          pg_total_relation_size('widecol'),
+	  :'wal_after'::pg_lsn - :'wal_before',
+	  :time_after - :time_before);
+
+--
+-- SELECT three columns, with a qual on one of them
+--
+
+select pg_current_wal_insert_lsn() as wal_before, extract(epoch from now()) as time_before
+\gset
+
+SELECT SUM(c2), SUM(c30) FROM widecol WHERE c50 % 10 = 0;
+SELECT SUM(c2), SUM(c30) FROM widecol WHERE c50 % 10 = 0;
+SELECT SUM(c2), SUM(c30) FROM widecol WHERE c50 % 10 = 0;
+
+select pg_current_wal_insert_lsn() as wal_after, extract(epoch from now()) as time_after
+\gset
+
+INSERT INTO results (testname, size, walsize, time)
+  VALUES ('widecol, SELECT 3 columns',
+          pg_total_relation_size('widecol'),
+	  :'wal_after'::pg_lsn - :'wal_before',
+	  :time_after - :time_before);
+
+--
+-- SELECT all columns, for comparison
+--
+
+select pg_current_wal_insert_lsn() as wal_before, extract(epoch from now()) as time_before
+\gset
+
+SELECT COUNT(*) FROM (SELECT * FROM widecol OFFSET 0) s WHERE s IS NOT NULL;
+SELECT COUNT(*) FROM (SELECT * FROM widecol OFFSET 0) s WHERE s IS NOT NULL;
+SELECT COUNT(*) FROM (SELECT * FROM widecol OFFSET 0) s WHERE s IS NOT NULL;
+
+select pg_current_wal_insert_lsn() as wal_after, extract(epoch from now()) as time_after
+\gset
+
+INSERT INTO results (testname, size, walsize, time)
+  VALUES ('widecol, SELECT all columns',
+          pg_total_relation_size('widecol'),
+	  :'wal_after'::pg_lsn - :'wal_before',
+	  :time_after - :time_before);
@@ -5,3 +5,6 @@
 \i sql/lockperf.sql
 \i sql/inlinecompress.sql
 \i sql/toast.sql
+\i sql/widecol.sql
+\i sql/pointfetch.sql
+\i sql/concurrentinsert.sql